@@ -19,6 +19,7 @@
 
 //Home brewed Header Files
 #include "DigiPot.h"
+#include "diag.h"
 
 //Standard Header Files
 
@@ -217,13 +218,15 @@ uint8_t digiPot_spiXmitByte(uint8_t data)
 
 	//Perform transaction
 	bool ret = SPI_transfer(digiPot_spiHandle, &spiTransaction);
+	diag_count(DIAG_SPI_TRANSFER);
 	if (!ret) {
+	    diag_count(DIAG_SPI_ERROR);
 	    System_printf("Unsuccessful SPI1 Transfer");
 	    System_flush();
 	}
 
-	// Wait on successful transaction
-    while(SPI_TRANSFER_COMPLETED != spiTransaction.status) {};
+	// Wait on successful transaction, a failed one never completes
+    while(ret && SPI_TRANSFER_COMPLETED != spiTransaction.status) {};
 
 	//SPI_close(digiPot_spiHandle);
 
@@ -35,6 +35,7 @@
  */
 #include <Accel_Service.h>
 #include <EMG_Service.h>
+#include <Diag_Service.h>
 #include <string.h>
 
 //#define xdc_runtime_Log_DISABLE_ALL 0 // Add to disable logs from this file
@@ -66,6 +67,18 @@
 #include "Board.h"
 #include "FlexZone.h"
 #include "FlexZoneGlobals.h"
+#include "accelerometer.h"
+#include "emg.h"
+#include "msg_pool.h"
+#include "set_summary.h"
+#include "set_history.h"
+#include "conn_policy.h"
+#include "adv_policy.h"
+#include "workout_config.h"
+#include "session_log.h"
+#include "diag.h"
+#include "time_sync.h"
+#include "trace.h"
 
 /*********************************************************************
  * CONSTANTS
@@ -93,6 +106,32 @@
 #define PRZ_PERIODIC_EVT                      0x0004
 #define PRZ_CONN_EVT_END_EVT                  0x0008
 
+// ATT MTU requested from the central, see USER_MAX_NOTIFY_LEN
+#define USER_MAX_ATT_MTU                      (USER_MAX_NOTIFY_LEN + 3)
+
+// LE Data Length Extension request: one LL packet per notification where possible
+#define USER_DLE_TX_OCTETS                    251
+#define USER_DLE_TX_TIME                      2120
+
+// Notification TX queue depth, in queued messages
+#define USER_TXQ_DEPTH                        8
+
+// Live status broadcast in the manufacturer specific advertising data. The
+// status is the last USER_BCAST_STATUS_LEN bytes of advertData:
+//   [0] sequence number, +1 per update
+//   [1] USER_BCAST_FLAG_* bits
+//   [2] finished sets, [3] reps in the current set
+//   [4-5] peak of the last rep, little endian
+// It is all zero while broadcasting is off.
+#define USER_BCAST_STATUS_LEN                 6
+#define USER_BCAST_STATUS_OFFSET              (sizeof(advertData) - USER_BCAST_STATUS_LEN)
+#define USER_BCAST_PERIOD_UNIT_MS             100   // Unit of the configured period
+#define USER_BCAST_MIN_PERIOD_MS              200   // No faster than we advertise
+#define USER_BCAST_FLAG_ACTIVE                0x01  // Broadcasting is on
+#define USER_BCAST_FLAG_WORKOUT               0x02  // Workout running
+#define USER_BCAST_FLAG_CONNECTED             0x04  // Someone is connected
+#define USER_MS_TO_TICKS(ms)                  ((ms) * (1000 / Clock_tickPeriod))
+
 /*********************************************************************
  * TYPEDEFS
  */
@@ -106,8 +145,12 @@ typedef enum
   APP_MSG_GAP_STATE_CHANGE,    /* The GAP / connection state has changed      */
 //  APP_MSG_BUTTON_DEBOUNCED,    /* A button has been debounced with new value  */
   APP_MSG_SEND_PASSCODE,       /* A pass-code/PIN is requested during pairing */
-  APP_MSG_SEND_EMG_DATA,    	/* An EMG data has been collected. Send the data  */
-  APP_MSG_SEND_ACCEL_DATA,    	/* An Aceelerometer data has been collected. Send the data  */
+  APP_MSG_SEND_SET_SUMMARY,    /* A set has been published. Send its summary  */
+  APP_MSG_CONN_ACTIVITY,       /* An activity started/stopped, or policy retry */
+  APP_MSG_CONN_PARAM_UPDATE,   /* The central applied new connection params   */
+  APP_MSG_BROADCAST_TICK,      /* Time to refresh the broadcast status        */
+  APP_MSG_ADV_POLICY,          /* Advertising phase is over                   */
+  APP_MSG_BONDED,              /* The connected central bonded                */
 } app_msg_types_t;
 
 // Struct for messages sent to the application task
@@ -135,6 +178,33 @@ typedef struct
   uint8_t  uiOutputs;
 } passcode_req_t;
 
+// Struct for message about an activity that affects connection parameters.
+typedef struct
+{
+  uint8_t activity;   // CONN_ACTIVITY_* bits, 0 to only re-evaluate
+  uint8_t active;
+} conn_activity_t;
+
+// Struct for message about connection parameters applied by the central.
+typedef struct
+{
+  uint16_t interval;
+  uint16_t latency;
+} conn_params_t;
+
+// Struct for message about a published set. The EMG task queues the record
+// pointer, which stays valid until the message is handled; the TX queue then
+// sends the copy in the set history.
+typedef struct
+{
+  const EMG_stats *pStats;
+  uint8_t          setIndex;
+  uint8_t          withMotion;
+  uint8_t          historyId;  // Stored summary to send, 0 for a notice only
+  uint8_t          nextFrag;   // Next fragment to send, used by the TX queue
+  uint8_t          fragLen;    // Fragment notification length, fixed at the first one
+} set_summary_req_t;
+
 /*********************************************************************
  * LOCAL VARIABLES
  */
@@ -177,13 +247,14 @@ static uint8_t advertData[] =
   10,
   GAP_ADTYPE_LOCAL_NAME_COMPLETE,
   'F', 'l', 'e', 'x', 'Z', 'o', 'n', 'e', 'D',
-  5,
+  1 + 4 + USER_BCAST_STATUS_LEN,
   GAP_ADTYPE_MANUFACTURER_SPECIFIC,
   0x11,
   0x11,
   0x40,
-  0x11
-
+  0x11,
+  // live status, see USER_BCAST_STATUS_LEN
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
 // GAP GATT Attributes
@@ -193,9 +264,29 @@ static uint8_t attDeviceName[GAP_DEVICE_NAME_LEN] = "FlexZoneD";
 static gattMsgEvent_t *pAttRsp = NULL;
 static uint8_t rspTxRetry = 0;
 
-//Data array used by App and BLE stack to psuh EMG and Accel data
-static uint8_t emgArrayData[EMG_STREAM_LEN];
-static uint8_t accelArrayData[ACCEL_STREAM_LEN];
+// ATT MTU of the current connection, notifications carry at most MTU - 3 bytes
+static uint16_t user_attMtu = ATT_MTU_SIZE;
+
+// Notification TX queue. Ring of messages that still have notifications to
+// send, owned by this task and drained whenever the stack may have buffers.
+static app_msg_t *txQueue[USER_TXQ_DEPTH];
+static uint8_t txqHead = 0;
+static uint8_t txqCount = 0;
+static uint16_t txqConnHandle = INVALID_CONNHANDLE;
+static uint8_t txqNoticeOn = FALSE;
+static uint8_t txqWaitCccd = FALSE;         // Head waits for a subscription
+static uint8_t txqSetMissed = FALSE;        // A set was stored while disconnected
+static TxQueue_stats txqStats;
+
+// Last GAP role state, to tell a new connection from the end of advertising
+// while connected
+static gaprole_States_t user_gapState = GAPROLE_INIT;
+
+// Live status broadcast
+static Clock_Struct user_bcastClock;
+static uint16_t user_bcastPeriodMs = 0;     // 0 while off
+static uint8_t user_bcastSeq = 0;
+static uint8_t user_bcastRestoreAdv = FALSE; // Re-enable connectable advertising
 
 //Arrays to store test data from EMG and ACCEL
 //static uint8_t test_emgArrayData[EMG_STREAM_LEN - 2];
@@ -212,7 +303,7 @@ extern uint8_t emgConfig_data[];
 static void FlexZone_init( void );
 static void FlexZone_taskFxn(UArg a0, UArg a1);
 
-static void user_processApplicationMessage(app_msg_t *pMsg);
+static uint8_t user_processApplicationMessage(app_msg_t *pMsg);
 static uint8_t FlexZone_processStackMsg(ICall_Hdr *pMsg);
 static uint8_t FlexZone_processGATTMsg(gattMsgEvent_t *pMsg);
 
@@ -222,6 +313,16 @@ static void FlexZone_freeAttRsp(uint8_t status);
 
 static void user_processGapStateChangeEvt(gaprole_States_t newState);
 static void user_gapStateChangeCB(gaprole_States_t newState);
+static void user_gapParamUpdateCB(uint16_t connInterval, uint16_t connSlaveLatency,
+                                  uint16_t connTimeout);
+static void user_connPolicyPost(void);
+static void user_advPolicyPost(void);
+static void user_negotiateDataLen(uint16_t connHandle);
+static void user_bcastClockFxn(UArg a0);
+static void user_setBroadcast(uint8_t periodUnits);
+static void user_updateBroadcast(void);
+static void user_bcastConnectedAdv(uint8_t enable);
+static void user_bcastRestoreConnectable(void);
 static void user_gapBondMgr_passcodeCB(uint8_t *deviceAddr, uint16_t connHandle,
                                        uint8_t uiInputs, uint8_t uiOutputs);
 static void user_gapBondMgr_pairStateCB(uint16_t connHandle, uint8_t state,
@@ -229,8 +330,6 @@ static void user_gapBondMgr_pairStateCB(uint16_t connHandle, uint8_t state,
 
 //static void buttonDebounceSwiFxn(UArg buttonId);
 //static void user_handleButtonPress(button_state_t *pState);
-static void user_handleEmgData(void);
-static void user_handleAccelData(void);
 
 // Generic callback handlers for value changes in services.
 static void user_service_ValueChangeCB( uint16_t connHandle, uint16_t svcUuid, uint8_t paramID, uint8_t *pValue, uint16_t len );
@@ -241,15 +340,36 @@ static void user_EMGService_ValueChangeHandler(char_data_t *pCharData);
 static void user_EMGService_CfgChangeHandler(char_data_t *pCharData);
 static void user_AccelService_ValueChangeHandler(char_data_t *pCharData);
 static void user_AccelService_CfgChangeHandler(char_data_t *pCharData);
+static void user_DiagService_ValueChangeHandler(char_data_t *pCharData);
+static void user_diagNotify(void);
 
 // Task handler for sending notifications.
 static void user_updateCharVal(char_data_t *pCharData);
 
+// Notification TX queue
+static uint8_t user_isConnected(void);
+static uint8_t user_txqIsDurable(app_msg_t *pMsg);
+static uint8_t user_txqPush(app_msg_t *pMsg);
+static bStatus_t user_txqSend(app_msg_t *pMsg, uint8_t *pDone);
+static bStatus_t user_txqNotifySummary(uint8_t setIndex, uint8_t *pDone);
+static void user_txqDrain(void);
+static void user_txqFlush(void);
+static void user_txqQueueSetMissed(void);
+static void user_txqUpdateNotice(void);
+static void user_txqLogRepEvent(app_msg_t *pMsg);
+static void user_syncDrain(void);
+static void user_syncStop(void);
+static void user_timeSyncPoll(void);
+
 // Utility functions
-static void user_enqueueRawAppMsg(app_msg_types_t appMsgType, uint8_t *pData, uint16_t len );
+static user_app_error_type_t user_enqueueRawAppMsg(app_msg_types_t appMsgType,
+                                                   uint8_t *pData, uint16_t len );
 static void user_enqueueCharDataMsg(app_msg_types_t appMsgType, uint16_t connHandle,
                                     uint16_t serviceUUID, uint8_t paramID,
                                     uint8_t *pValue, uint16_t len);
+static void user_enqueueStreamPacket(uint16_t serviceUUID, uint8_t paramID,
+                                     app_pkt_type_t packetType,
+                                     uint8_t *pData, uint8_t len);
 
 static char *Util_convertArrayToHexString(uint8_t const *src, uint8_t src_len,
                                           uint8_t *dst, uint8_t dst_len);
@@ -266,6 +386,9 @@ static gapRolesCBs_t user_gapRoleCBs =
   user_gapStateChangeCB     // Profile State Change Callbacks
 };
 
+// GAP Role connection parameter update callback
+static gapRolesParamUpdateCB_t user_gapParamUpdateCBs = user_gapParamUpdateCB;
+
 // GAP Bond Manager Callbacks
 static gapBondCBs_t user_bondMgrCBs =
 {
@@ -289,6 +412,14 @@ static AccelServiceCBs_t user_Accel_ServiceCBs=
   .pfnCfgChangeCb = user_service_CfgChangeCB, // Noti/ind configuration callback handler
 };
 
+// Diagnostics Service callback handler.
+// The type DiagServiceCBs_t is defined in Diag_Service.h
+static DiagServiceCBs_t user_Diag_ServiceCBs =
+{
+  .pfnChangeCb    = user_service_ValueChangeCB, // Characteristic value change callback handler
+  .pfnCfgChangeCb = user_service_CfgChangeCB, // Noti/ind configuration callback handler
+};
+
 
 /*********************************************************************
  * PUBLIC FUNCTIONS
@@ -312,6 +443,7 @@ void FlexZone_createTask(void)
   taskParams.priority = PRZ_TASK_PRIORITY;
 
   Task_construct(&przTask, FlexZone_taskFxn, &taskParams, NULL);
+  diag_addTask(DIAG_TASK_APP, Task_handle(&przTask));
 }
 
 /*
@@ -339,6 +471,8 @@ static void FlexZone_init(void)
   // Note: Used to transfer control to application thread from e.g. interrupts.
   Queue_construct(&applicationMsgQ, NULL);
   hApplicationMsgQ = Queue_handle(&applicationMsgQ);
+  msgPool_init();
+  diag_init();
 
   // ******************************************************************
   // BLE Stack initialization
@@ -368,13 +502,13 @@ static void FlexZone_init(void)
   Log_info1("Name in advertData array: \x1b[33m%s\x1b[0m",
             (IArg)Util_getLocalNameStr(advertData));
 
-  // Set advertising interval
+  // Set advertising interval. The general discoverable interval follows the
+  // reconnect phases, see adv_policy.h
   uint16_t advInt = DEFAULT_ADVERTISING_INTERVAL;
 
   GAP_SetParamValue(TGAP_LIM_DISC_ADV_INT_MIN, advInt);
   GAP_SetParamValue(TGAP_LIM_DISC_ADV_INT_MAX, advInt);
-  GAP_SetParamValue(TGAP_GEN_DISC_ADV_INT_MIN, advInt);
-  GAP_SetParamValue(TGAP_GEN_DISC_ADV_INT_MAX, advInt);
+  advPolicy_init(user_advPolicyPost);
 
   // Set duration of advertisement before stopping in Limited adv mode.
   GAP_SetParamValue(TGAP_LIM_ADV_TIMEOUT, 400); // Seconds
@@ -410,11 +544,13 @@ static void FlexZone_init(void)
   // Add services to GATT server and give ID of this task for Indication acks.
   EMGService_AddService( selfEntity );
   AccelService_AddService( selfEntity );
+  DiagService_AddService( selfEntity );
 
   // Register callbacks with the generated services that
   // can generate events (writes received) to the application
   EMGService_RegisterAppCBs( &user_EMG_ServiceCBs );
   AccelService_RegisterAppCBs( &user_Accel_ServiceCBs );
+  DiagService_RegisterAppCBs( &user_Diag_ServiceCBs );
 
   // Placeholder variable for characteristic intialization
   uint8_t initVal[EMG_STREAM_LEN] = {0};
@@ -427,8 +563,9 @@ static void FlexZone_init(void)
   AccelService_SetParameter(ACCEL_CONFIG_ID, ACCEL_CONFIG_LEN, initVal);
   AccelService_SetParameter(ACCEL_STREAM_ID, ACCEL_STREAM_LEN, initVal);
 
-  // Start the stack in Peripheral mode.
-  VOID GAPRole_StartDevice(&user_gapRoleCBs);
+  // Connection parameters are requested by the policy, not by GAPRole itself
+  GAPRole_RegisterAppCBs(&user_gapParamUpdateCBs);
+  connPolicy_init(user_connPolicyPost);
 
   // Start Bond Manager
   VOID GAPBondMgr_Register(&user_bondMgrCBs);
@@ -438,6 +575,30 @@ static void FlexZone_init(void)
 
   // Register for GATT local events and ATT Responses pending for transmission
   GATT_RegisterForMsgs(selfEntity);
+
+  // Client role is only used to start the ATT MTU exchange
+  VOID GATT_InitClient();
+
+  // Start the stack in Peripheral mode. Everything a connection needs is registered
+  // above; what the BLE link does not need yet is set up after this call. Connection
+  // events only reach this task when init is done. Whether this order advertises any
+  // sooner is not measured: compare DIAG_BOOT_ADVERTISING in the diag snapshot on a
+  // device before relying on it.
+  VOID GAPRole_StartDevice(&user_gapRoleCBs);
+
+  // Records kept while no app was connected, see session_log.h
+  sessionLog_init();
+
+  // Shared timebase with other devices, see time_sync.h
+  timeSync_init();
+
+  // Broadcast refresh clock, started when a period is configured
+  Clock_Params clockParams;
+  Clock_Params_init(&clockParams);
+  clockParams.startFlag = FALSE;
+  Clock_construct(&user_bcastClock, user_bcastClockFxn, 1, &clockParams);
+
+  diag_bootMark(DIAG_BOOT_APP_READY);
 }
 
 
@@ -460,6 +621,8 @@ static void FlexZone_init(void)
  */
 static void FlexZone_taskFxn(UArg a0, UArg a1)
 {
+  diag_bootMark(DIAG_BOOT_APP_START);
+
   // Initialize application
   FlexZone_init();
 
@@ -494,8 +657,14 @@ static void FlexZone_taskFxn(UArg a0, UArg a1)
             // Event received when a connection event is completed
             if (pEvt->event_flag & PRZ_CONN_EVT_END_EVT)
             {
+              // A time sync ping goes out at the next anchor, ahead of the rest
+              user_timeSyncPoll();
+
               // Try to retransmit pending ATT Response (if any)
               FlexZone_sendAttRsp();
+
+              // Refill the LL buffers freed by this connection event
+              user_txqDrain();
             }
           }
           else // It's a message from the stack and not an event.
@@ -507,10 +676,7 @@ static void FlexZone_taskFxn(UArg a0, UArg a1)
 
         if (pMsg && safeToDealloc)
         {
-        	Log_info0("Attempting memory dealloc ");
-        	ICall_freeMsg(pMsg);
-
-        	Log_info0("Memory dealloc passed ");
+          ICall_freeMsg(pMsg);
         }
       }
 
@@ -520,11 +686,16 @@ static void FlexZone_taskFxn(UArg a0, UArg a1)
         app_msg_t *pMsg = Queue_dequeue(hApplicationMsgQ);
 
         // Process application-layer message probably sent from ourselves.
-        user_processApplicationMessage(pMsg);
-
-        // Free the received message.
-        ICall_free(pMsg);
+        // Notifications are kept by the TX queue until they are sent.
+        if (user_processApplicationMessage(pMsg))
+        {
+          // Free the received message.
+          msgPool_free(pMsg);
+        }
       }
+
+      // Send as much of the TX queue as the stack has buffers for.
+      user_txqDrain();
     }
   }
 }
@@ -542,11 +713,12 @@ static void FlexZone_taskFxn(UArg a0, UArg a1)
  *
  * @param   pMsg  Pointer to the message of type app_msg_t.
  *
- * @return  None.
+ * @return  TRUE if safe to deallocate the message, FALSE if the TX queue kept it.
  */
-static void user_processApplicationMessage(app_msg_t *pMsg)
+static uint8_t user_processApplicationMessage(app_msg_t *pMsg)
 {
   char_data_t *pCharData = (char_data_t *)pMsg->pdu;
+  uint8_t safeToDealloc = TRUE;
 
   switch (pMsg->type)
   {
@@ -561,6 +733,10 @@ static void user_processApplicationMessage(app_msg_t *pMsg)
           user_AccelService_ValueChangeHandler(pCharData);
           break;
 
+        case DIAG_SERVICE_SERV_UUID:
+          user_DiagService_ValueChangeHandler(pCharData);
+          break;
+
       }
       break;
 
@@ -577,7 +753,15 @@ static void user_processApplicationMessage(app_msg_t *pMsg)
       break;
 
     case APP_MSG_UPDATE_CHARVAL: /* Message from ourselves to send  */
-      user_updateCharVal(pCharData);
+      if ((pCharData->svcUUID == EMG_SERVICE_SERV_UUID && pCharData->paramID == EMG_STREAM_ID) ||
+          (pCharData->svcUUID == ACCEL_SERVICE_SERV_UUID && pCharData->paramID == ACCEL_STREAM_ID))
+      {
+        safeToDealloc = !user_txqPush(pMsg);
+      }
+      else
+      {
+        user_updateCharVal(pCharData);
+      }
       break;
 
     case APP_MSG_GAP_STATE_CHANGE: /* Message that GAP state changed  */
@@ -595,6 +779,50 @@ static void user_processApplicationMessage(app_msg_t *pMsg)
       }
       break;
 
+    case APP_MSG_SEND_SET_SUMMARY: /* Message from EMG task about a finished set */
+      {
+        set_summary_req_t *pReq = (set_summary_req_t *)pMsg->pdu;
+        // Keep it readable on the Summary characteristic, connected or not.
+        // Fragments are sent from that copy, the EMG task reuses the record.
+        pReq->historyId = setHistory_add(pReq->pStats, pReq->setIndex, pReq->withMotion);
+        if (!user_isConnected())
+        {
+          // The history only holds the last few sets, the log keeps them all
+          sessionLog_appendSet(pReq->pStats, pReq->setIndex, pReq->withMotion);
+          txqSetMissed = TRUE;
+        }
+        emg_setStored(pReq->pStats);
+        pReq->pStats = NULL;
+        safeToDealloc = !user_txqPush(pMsg);
+      }
+      break;
+
+    case APP_MSG_CONN_ACTIVITY: /* Activity change or policy retry */
+      {
+        conn_activity_t *pAct = (conn_activity_t *)pMsg->pdu;
+        connPolicy_setActivity(pAct->activity, pAct->active);
+      }
+      break;
+
+    case APP_MSG_CONN_PARAM_UPDATE: /* Central applied new parameters */
+      {
+        conn_params_t *pParams = (conn_params_t *)pMsg->pdu;
+        connPolicy_paramsUpdated(pParams->interval, pParams->latency);
+      }
+      break;
+
+    case APP_MSG_BROADCAST_TICK: /* Broadcast clock expired */
+      user_updateBroadcast();
+      break;
+
+    case APP_MSG_ADV_POLICY: /* Advertising phase clock expired */
+      advPolicy_evaluate();
+      break;
+
+    case APP_MSG_BONDED: /* Reconnect to this central with directed advertising */
+      advPolicy_bonded();
+      break;
+
 //    case APP_MSG_BUTTON_DEBOUNCED: /* Message from swi about pin change */
 //      {
 //    	  Log_info0("APP_MSG_BUTTON_DEBOUNCED event called ");
@@ -603,20 +831,10 @@ static void user_processApplicationMessage(app_msg_t *pMsg)
 //      }
 //      break;
 
-    case APP_MSG_SEND_EMG_DATA:
-    	{
-    		Log_info0("APP_MSG_SEND_EMG_DATA event called ");
-            user_handleEmgData();
-        }
-    	break;
 
-    case APP_MSG_SEND_ACCEL_DATA:
-    	{
-    		Log_info0("APP_MSG_SEND_ACCEL_DATA event called ");
-    		user_handleAccelData();
-        }
-    	break;
   }
+
+  return (safeToDealloc);
 }
 
 
@@ -675,16 +893,55 @@ static void user_processGapStateChangeEvt(gaprole_States_t newState)
 
     case GAPROLE_ADVERTISING:
       Log_info0("Advertising");
+      advPolicy_advertising();
       break;
 
     case GAPROLE_CONNECTED:
+      if (user_gapState == GAPROLE_CONNECTED_ADV)
+      {
+        // Same link, broadcasting stopped. Connectable advertising comes back
+        // when the link goes down.
+        Log_info0("Connected, advertising stopped");
+        user_bcastRestoreConnectable();
+        break;
+      }
       {
         uint8_t peerAddress[B_ADDR_LEN];
 
         GAPRole_GetParameter(GAPROLE_CONN_BD_ADDR, peerAddress);
 
+        // Remember the central for directed advertising after a link drop
+        uint8_t peerAddrType;
+        GAPRole_GetParameter(GAPROLE_BD_ADDR_TYPE, &peerAddrType);
+        advPolicy_connected(peerAddress, peerAddrType);
+
         char *cstr_peerAddress = Util_convertBdAddr2Str(peerAddress);
         Log_info1("Connected. Peer address: \x1b[32m%s\x1b[0m", (IArg)cstr_peerAddress);
+
+        // Start steering the central towards our connection parameters
+        uint16_t connInterval, connLatency;
+        GAPRole_GetParameter(GAPROLE_CONN_INTERVAL, &connInterval);
+        GAPRole_GetParameter(GAPROLE_CONN_LATENCY, &connLatency);
+        connPolicy_connected(connInterval, connLatency);
+
+        // Ask for a larger ATT MTU (and longer LL packets), so streams pack
+        // more records per notification. Legacy centrals stay at 23 bytes.
+        uint16_t connHandle;
+        GAPRole_GetParameter(GAPROLE_CONNHANDLE, &connHandle);
+        user_negotiateDataLen(connHandle);
+
+        // The connection event notice needs the link before any notification
+        // goes out, a time sync burst may be the first thing the app starts
+        txqConnHandle = connHandle;
+
+        // Keep observers following along while connected
+        if (user_bcastPeriodMs)
+        {
+          user_bcastConnectedAdv(TRUE);
+        }
+
+        // Deliver what was buffered while disconnected
+        user_txqQueueSetMissed();
        }
       break;
 
@@ -692,12 +949,47 @@ static void user_processGapStateChangeEvt(gaprole_States_t newState)
       Log_info0("Connected and advertising");
       break;
 
+    case GAPROLE_ADVERTISING_NONCONN:
+      // Only reached when the link dropped while broadcasting. Stop, then go
+      // back to connectable advertising once waiting.
+      Log_info0("Disconnected, broadcasting");
+      user_attMtu = ATT_MTU_SIZE;
+      user_txqFlush();
+      connPolicy_disconnected();
+      user_syncStop();
+      timeSync_stop();
+      advPolicy_disconnected();
+      user_bcastConnectedAdv(FALSE);
+      break;
+
     case GAPROLE_WAITING:
       Log_info0("Disconnected / Idle");
+      user_attMtu = ATT_MTU_SIZE;
+      user_txqFlush();
+      connPolicy_disconnected();
+      user_syncStop();
+      timeSync_stop();
+      if (user_gapState == GAPROLE_CONNECTED || user_gapState == GAPROLE_CONNECTED_ADV)
+      {
+        advPolicy_disconnected();
+      }
+      user_bcastRestoreConnectable();
+      advPolicy_waiting();
       break;
 
     case GAPROLE_WAITING_AFTER_TIMEOUT:
       Log_info0("Connection timed out");
+      user_attMtu = ATT_MTU_SIZE;
+      user_txqFlush();
+      connPolicy_disconnected();
+      user_syncStop();
+      timeSync_stop();
+      if (user_gapState == GAPROLE_CONNECTED || user_gapState == GAPROLE_CONNECTED_ADV)
+      {
+        advPolicy_disconnected();
+      }
+      user_bcastRestoreConnectable();
+      advPolicy_waiting();
       break;
 
     case GAPROLE_ERROR:
@@ -707,49 +999,11 @@ static void user_processGapStateChangeEvt(gaprole_States_t newState)
     default:
       break;
   }
-}
-
-
-/*
- * @brief   Handle a debounced button press or release in Task context.
- *          Invoked by the taskFxn based on a message received from a callback.
- *
- * @see     buttonDebounceSwiFxn
- * @see     buttonCallbackFxn
- *
- * @param   None.
- *
- * @return  None.
- */
-static void user_handleEmgData(void)
-{
-  // Update the service with the new value.
-  // Will automatically send notification/indication if enabled.
-    	EMGService_SetParameter(EMG_STREAM_ID,
-									 sizeof(emgArrayData),
-									 emgArrayData);
 
+  user_gapState = newState;
 }
 
-/*
- * @brief   Handle a debounced button press or release in Task context.
- *          Invoked by the taskFxn based on a message received from a callback.
- *
- * @see     buttonDebounceSwiFxn
- * @see     buttonCallbackFxn
- *
- * @param   None.
- *
- * @return  None.
- */
-static void user_handleAccelData(void)
-{
-	  // Update the service with the new value.
-	  // Will automatically send notification/indication if enabled.
-	 AccelService_SetParameter(ACCEL_STREAM_ID,
-									 sizeof(accelArrayData),
-									 accelArrayData);
-}
+
 /*
  * @brief   Handle a CCCD (configuration change) write received from a peer
  *          device. This tells us whether the peer device wants us to send
@@ -784,7 +1038,22 @@ void user_EMGService_ValueChangeHandler(char_data_t *pCharData)
       // -------------------------
       // Copy received data to holder array, ensuring NULL termination.
     	memcpy(emgConfig_data, pCharData->data, EMG_CONFIG_LEN-1);
-        Swi_post(Swi_handle(&emgConfigSwi));
+      {
+        // Validated and staged here, applied by the EMG side, see workout_config.h
+        Workout_config staged;
+        uint8_t cmd = workoutConfig_write(pCharData->data, pCharData->dataLen, &staged);
+
+        if (cmd != WORKOUT_CFG_CMD_NONE)
+        {
+          Swi_post(Swi_handle(&emgConfigSwi));
+        }
+
+        // The broadcast belongs to this task, so it follows right away
+        if ((cmd == WORKOUT_CFG_CMD_START) || (cmd == WORKOUT_CFG_CMD_UPDATE))
+        {
+          user_setBroadcast(staged.broadcastPeriod);
+        }
+      }
 
       // Needed to copy before log statement, as the holder array remains after
       // the pCharData message has been freed and reused for something else.
@@ -804,6 +1073,18 @@ void user_EMGService_ValueChangeHandler(char_data_t *pCharData)
       // Do something useful with pCharData->data here
       break;
 
+    case EMG_SESSION_LOG_ID:
+      // Start, ack or stop of a bulk sync. The main loop sends what it allows.
+      connPolicy_setActivity(CONN_ACTIVITY_SYNC,
+                             sessionLog_control(pCharData->data, pCharData->dataLen));
+      break;
+
+    case EMG_TIME_SYNC_ID:
+      // Start of a burst or a pong, pings go out at connection event ends
+      timeSync_control(pCharData->data, pCharData->dataLen);
+      user_txqUpdateNotice();
+      break;
+
   default:
     return;
   }
@@ -842,6 +1123,30 @@ void user_EMGService_CfgChangeHandler(char_data_t *pCharData)
       // ...
       break;
 
+    case EMG_SUMMARY_ID:
+      // Checked when each set is published, see user_txqSend
+      Log_info3("CCCD Change msg: %s %s: %s",
+                (IArg)"EMG Service",
+                (IArg)"Summary",
+                (IArg)configValString);
+      break;
+
+    case EMG_SESSION_LOG_ID:
+      // A sync without a subscriber ends at its next notification
+      Log_info3("CCCD Change msg: %s %s: %s",
+                (IArg)"EMG Service",
+                (IArg)"Session Log",
+                (IArg)configValString);
+      break;
+
+    case EMG_TIME_SYNC_ID:
+      // A burst without a subscriber ends at its first ping
+      Log_info3("CCCD Change msg: %s %s: %s",
+                (IArg)"EMG Service",
+                (IArg)"Time Sync",
+                (IArg)configValString);
+      break;
+
     /*case BS_BUTTON1_ID:
       Log_info3("CCCD Change msg: %s %s: %s",
                 (IArg)"Button Service",
@@ -883,8 +1188,9 @@ void user_AccelService_ValueChangeHandler(char_data_t *pCharData)
 //      memset(received_string, 0, ACCEL_CONFIG_LEN);
       memcpy(accelConfig_data, pCharData->data, ACCEL_CONFIG_LEN-1);
 
-      //accelConfig_SwiFxn();
-      Swi_post(Swi_handle(&accelConfigSwi));
+      // Byte 0: IMU stream enable, byte 1: stream rate in Hz (0 = default).
+      // Applied here rather than via accelConfigSwi, which main() does not construct.
+      accel_setStreaming(accelConfig_data[0], accelConfig_data[1]);
 
       // Needed to copy before log statement, as the holder array remains after
       // the pCharData message has been freed and reused for something else.
@@ -952,6 +1258,61 @@ void user_AccelService_CfgChangeHandler(char_data_t *pCharData)
   }
 }
 
+/*
+ * @brief   Handle a write to the Diagnostics Control characteristic.
+ *
+ * @param   pCharData  pointer to malloc'd char write data
+ *
+ * @return  None.
+ */
+void user_DiagService_ValueChangeHandler(char_data_t *pCharData)
+{
+  switch (pCharData->data[0])
+  {
+    case DIAG_OP_NOTIFY:
+      user_diagNotify();
+      break;
+
+    case DIAG_OP_RESET:
+      diag_reset();
+      break;
+
+    case DIAG_OP_TRACE_MEMORY:
+      diag_traceMemory();
+      break;
+
+    default:
+      Log_warning1("Diagnostics: unknown op 0x%02x", (IArg)pCharData->data[0]);
+      break;
+  }
+}
+
+/*
+ * @brief   Sends a diagnostics snapshot, as much as fits in one notification.
+ *          Outside the TX queue: a request the app makes now and then, and a
+ *          lost one is simply asked for again.
+ *
+ * @return  None.
+ */
+static void user_diagNotify(void)
+{
+  attHandleValueNoti_t noti;
+  uint16_t connHandle;
+  uint16_t len = MIN(DIAG_SNAPSHOT_LEN, user_getNotifyPayloadLen());
+
+  if (DiagService_AllocCountersNoti(len, &connHandle, &noti) != SUCCESS)
+  {
+    Log_warning0("Diagnostics: notifications off or no buffer");
+    return;
+  }
+
+  diag_read(0, noti.pValue, len);
+  if (GATT_Notification(connHandle, &noti, FALSE) != SUCCESS)
+  {
+    GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+  }
+}
+
 
 /*
  * @brief   Process an incoming BLE stack message.
@@ -1042,6 +1403,7 @@ static uint8_t FlexZone_processGATTMsg(gattMsgEvent_t *pMsg)
   {
     // MTU size updated
     Log_info1("MTU Size change: %d bytes", pMsg->msg.mtuEvt.MTU);
+    user_attMtu = pMsg->msg.mtuEvt.MTU;
   }
   else
   {
@@ -1089,8 +1451,12 @@ static void FlexZone_sendAttRsp(void)
     status = GATT_SendRsp(pAttRsp->connHandle, pAttRsp->method, &(pAttRsp->msg));
     if ((status != blePending) && (status != MSG_BUFFER_NOT_AVAIL))
     {
-      // Disable connection event end notice
-      HCI_EXT_ConnEventNoticeCmd(pAttRsp->connHandle, selfEntity, 0);
+      // Disable connection event end notice, unless the TX queue still needs it
+      if (txqCount == 0)
+      {
+        HCI_EXT_ConnEventNoticeCmd(pAttRsp->connHandle, selfEntity, 0);
+        txqNoticeOn = FALSE;
+      }
 
       // We're done with the response message
       FlexZone_freeAttRsp(status);
@@ -1162,125 +1528,335 @@ static void FlexZone_freeAttRsp(uint8_t status)
  */
 static void user_gapStateChangeCB(gaprole_States_t newState)
 {
+  // Stamped here, the message waits until the application is initialized
+  if (GAPROLE_STARTED == newState)
+    diag_bootMark(DIAG_BOOT_DEVICE_STARTED);
+  else if (GAPROLE_ADVERTISING == newState)
+    diag_bootMark(DIAG_BOOT_ADVERTISING);
+
   Log_info1("(CB) GAP State change: %d, Sending msg to app.", (IArg)newState);
   user_enqueueRawAppMsg( APP_MSG_GAP_STATE_CHANGE, (uint8_t *)&newState, sizeof(newState) );
 }
 
 /*
- * @brief   Passcode callback.
+ * @brief   Callback from GAPRole when the central applied new connection
+ *          parameters. Runs in the GAPRole task, so it only sends a message.
  *
- * @param   connHandle - connection handle
- * @param   uiInputs   - input passcode?
- * @param   uiOutputs  - display passcode?
+ * @param   connInterval     - interval, 1.25 ms units
+ * @param   connSlaveLatency - slave latency
+ * @param   connTimeout      - supervision timeout, 10 ms units
  *
  * @return  none
  */
-static void user_gapBondMgr_passcodeCB(uint8_t *deviceAddr, uint16_t connHandle,
-                                       uint8_t uiInputs, uint8_t uiOutputs)
+static void user_gapParamUpdateCB(uint16_t connInterval, uint16_t connSlaveLatency,
+                                  uint16_t connTimeout)
 {
-  passcode_req_t req =
-  {
-    .connHandle = connHandle,
-    .uiInputs = uiInputs,
-    .uiOutputs = uiOutputs
+  conn_params_t params = {
+    .interval = connInterval,
+    .latency = connSlaveLatency
   };
 
-  // Defer handling of the passcode request to the application, in case
-  // user input is required, and because a BLE API must be used from Task.
-  user_enqueueRawAppMsg(APP_MSG_SEND_PASSCODE, (uint8_t *)&req, sizeof(req));
+  user_enqueueRawAppMsg(APP_MSG_CONN_PARAM_UPDATE, (uint8_t *)&params, sizeof(params));
 }
 
 /*
- * @brief   Pairing state callback.
+ * @brief   Starts the ATT MTU exchange and, on stacks with LE Data Length
+ *          Extension, asks for the longest LL payload. The result arrives
+ *          as ATT_MTU_UPDATED_EVENT.
  *
  * @param   connHandle - connection handle
- * @param   state      - pairing state
- * @param   status     - pairing status
  *
  * @return  none
  */
-static void user_gapBondMgr_pairStateCB(uint16_t connHandle, uint8_t state,
-                                        uint8_t status)
+static void user_negotiateDataLen(uint16_t connHandle)
 {
-  if (state == GAPBOND_PAIRING_STATE_STARTED)
-  {
-    Log_info0("Pairing started");
-  }
-  else if (state == GAPBOND_PAIRING_STATE_COMPLETE)
-  {
-    if (status == SUCCESS)
-    {
-      Log_info0("Pairing completed successfully.");
-    }
-    else
-    {
-      Log_error1("Pairing failed. Error: %02x", status);
-    }
-  }
-  else if (state == GAPBOND_PAIRING_STATE_BONDED)
+  attExchangeMTUReq_t mtuReq;
+
+  mtuReq.clientRxMTU = USER_MAX_ATT_MTU;
+  if (GATT_ExchangeMTU(connHandle, &mtuReq, selfEntity) != SUCCESS)
   {
-    if (status == SUCCESS)
-    {
-     Log_info0("Re-established pairing from stored bond info.");
-    }
+    Log_warning0("MTU exchange not started");
   }
+
+#if defined(BLE_V42_FEATURES) && (BLE_V42_FEATURES & EXT_DATA_LEN_CFG)
+  HCI_LE_SetDataLenCmd(connHandle, USER_DLE_TX_OCTETS, USER_DLE_TX_TIME);
+#endif
 }
 
-/**
- * Callback handler for characteristic value changes in services.
+/*
+ * @brief   Connection policy retry clock expired (Swi context).
+ *
+ * @return  none
  */
-static void user_service_ValueChangeCB( uint16_t connHandle, uint16_t svcUuid,
-                                        uint8_t paramID, uint8_t *pValue,
-                                        uint16_t len )
+static void user_connPolicyPost(void)
 {
-  // See the service header file to compare paramID with characteristic.
-  Log_info2("(CB) Characteristic value change: svc(0x%04x) paramID(%d). "
-            "Sending msg to app.", (IArg)svcUuid, (IArg)paramID);
-  user_enqueueCharDataMsg(APP_MSG_SERVICE_WRITE, connHandle, svcUuid, paramID,
-                          pValue, len);
+  user_setConnActivity(0, 0);
 }
 
-/**
- * Callback handler for characteristic configuration changes in services.
+/*
+ * @brief   Advertising phase clock expired (Swi context).
+ *
+ * @return  none
  */
-static void user_service_CfgChangeCB( uint16_t connHandle, uint16_t svcUuid,
-                                      uint8_t paramID, uint8_t *pValue,
-                                      uint16_t len )
+static void user_advPolicyPost(void)
 {
-  Log_info2("(CB) Char config change: svc(0x%04x) paramID(%d). "
-            "Sending msg to app.", (IArg)svcUuid, (IArg)paramID);
-  user_enqueueCharDataMsg(APP_MSG_SERVICE_CFG, connHandle, svcUuid,
-                          paramID, pValue, len);
+  user_enqueueRawAppMsg(APP_MSG_ADV_POLICY, NULL, 0);
 }
 
-/******************************************************************************
- *****************************************************************************
- *
- *  Utility functions
+/*
+ * @brief   Broadcast clock expired (Swi context).
  *
- ****************************************************************************
- *****************************************************************************/
+ * @return  none
+ */
+static void user_bcastClockFxn(UArg a0)
+{
+  user_enqueueRawAppMsg(APP_MSG_BROADCAST_TICK, NULL, 0);
+}
 
 /*
- * @brief  Generic message constructor for characteristic data.
+ * @brief   Turns the live status broadcast on or off. Observers read it from
+ *          the advertising data, connectable while idle, non-connectable
+ *          while a central is connected.
  *
- *         Sends a message to the application for handling in Task context where
- *         the message payload is a char_data_t struct.
- *
- *         From service callbacks the appMsgType is APP_MSG_SERVICE_WRITE or
- *         APP_MSG_SERVICE_CFG, and functions running in another context than
- *         the Task itself, can set the type to APP_MSG_UPDATE_CHARVAL to
- *         make the user Task loop invoke user_updateCharVal function for them.
+ * @param   periodUnits - update period in USER_BCAST_PERIOD_UNIT_MS, 0 off
  *
- * @param  appMsgType    Enumerated type of message being sent.
- * @param  connHandle    GAP Connection handle of the relevant connection
- * @param  serviceUUID   16-bit part of the relevant service UUID
- * @param  paramID       Index of the characteristic in the service
- * @oaram  *pValue       Pointer to characteristic value
- * @param  len           Length of characteristic data
+ * @return  none
  */
-static void user_enqueueCharDataMsg( app_msg_types_t appMsgType,
-                                     uint16_t connHandle,
+static void user_setBroadcast(uint8_t periodUnits)
+{
+  uint16_t periodMs = periodUnits * USER_BCAST_PERIOD_UNIT_MS;
+  Clock_Handle hClock = Clock_handle(&user_bcastClock);
+
+  if (periodMs && (periodMs < USER_BCAST_MIN_PERIOD_MS))
+  {
+    periodMs = USER_BCAST_MIN_PERIOD_MS;
+  }
+  if (periodMs == user_bcastPeriodMs)
+  {
+    return;
+  }
+
+  Clock_stop(hClock);
+  user_bcastPeriodMs = periodMs;
+
+  if (periodMs)
+  {
+    Clock_setPeriod(hClock, USER_MS_TO_TICKS(periodMs));
+    Clock_setTimeout(hClock, USER_MS_TO_TICKS(periodMs));
+    Clock_start(hClock);
+
+    if (user_gapState == GAPROLE_CONNECTED)
+    {
+      user_bcastConnectedAdv(TRUE);
+    }
+  }
+  else if (user_gapState == GAPROLE_CONNECTED_ADV)
+  {
+    user_bcastConnectedAdv(FALSE);
+  }
+
+  // Publish now, also clears the status when turned off
+  user_updateBroadcast();
+  Log_info1("Broadcast period %d ms", (IArg)periodMs);
+}
+
+/*
+ * @brief   Writes the live status into advertData and hands it to the stack.
+ *          Taking effect with the next advertising event.
+ *
+ * @return  none
+ */
+static void user_updateBroadcast(void)
+{
+  uint8_t *pStatus = &advertData[USER_BCAST_STATUS_OFFSET];
+
+  if (user_bcastPeriodMs)
+  {
+    uint16_t peak = lastRepPeak;
+
+    pStatus[0] = user_bcastSeq++;
+    pStatus[1] = USER_BCAST_FLAG_ACTIVE |
+                 (emgRunning ? USER_BCAST_FLAG_WORKOUT : 0) |
+                 ((user_gapState == GAPROLE_CONNECTED ||
+                   user_gapState == GAPROLE_CONNECTED_ADV) ? USER_BCAST_FLAG_CONNECTED : 0);
+    pStatus[2] = setCount;
+    pStatus[3] = repCount;
+    pStatus[4] = LO_UINT16(peak);
+    pStatus[5] = HI_UINT16(peak);
+  }
+  else
+  {
+    memset(pStatus, 0, USER_BCAST_STATUS_LEN);
+  }
+
+  GAPRole_SetParameter(GAPROLE_ADVERT_DATA, sizeof(advertData), advertData);
+}
+
+/*
+ * @brief   Switches between connectable advertising (idle) and
+ *          non-connectable advertising while connected. The peripheral role
+ *          only allows one of them enabled at a time.
+ *
+ * @param   enable - TRUE to advertise while connected
+ *
+ * @return  none
+ */
+static void user_bcastConnectedAdv(uint8_t enable)
+{
+  uint8_t value;
+
+  if (enable)
+  {
+    value = FALSE;
+    GAPRole_SetParameter(GAPROLE_ADVERT_ENABLED, sizeof(uint8_t), &value);
+    advPolicy_setBroadcasting(TRUE);
+    value = TRUE;
+    GAPRole_SetParameter(GAPROLE_ADV_NONCONN_ENABLED, sizeof(uint8_t), &value);
+  }
+  else
+  {
+    // Connectable advertising can only be enabled once this has ended,
+    // see user_bcastRestoreConnectable
+    value = FALSE;
+    GAPRole_SetParameter(GAPROLE_ADV_NONCONN_ENABLED, sizeof(uint8_t), &value);
+    advPolicy_setBroadcasting(FALSE);
+    user_bcastRestoreAdv = TRUE;
+  }
+}
+
+/*
+ * @brief   Re-enables connectable advertising after broadcasting while
+ *          connected ended. Starts advertising right away when waiting,
+ *          otherwise when the link goes down.
+ *
+ * @return  none
+ */
+static void user_bcastRestoreConnectable(void)
+{
+  uint8_t advEnable = TRUE;
+
+  if (user_bcastRestoreAdv)
+  {
+    GAPRole_SetParameter(GAPROLE_ADVERT_ENABLED, sizeof(uint8_t), &advEnable);
+    user_bcastRestoreAdv = FALSE;
+  }
+}
+
+/*
+ * @brief   Passcode callback.
+ *
+ * @param   connHandle - connection handle
+ * @param   uiInputs   - input passcode?
+ * @param   uiOutputs  - display passcode?
+ *
+ * @return  none
+ */
+static void user_gapBondMgr_passcodeCB(uint8_t *deviceAddr, uint16_t connHandle,
+                                       uint8_t uiInputs, uint8_t uiOutputs)
+{
+  passcode_req_t req =
+  {
+    .connHandle = connHandle,
+    .uiInputs = uiInputs,
+    .uiOutputs = uiOutputs
+  };
+
+  // Defer handling of the passcode request to the application, in case
+  // user input is required, and because a BLE API must be used from Task.
+  user_enqueueRawAppMsg(APP_MSG_SEND_PASSCODE, (uint8_t *)&req, sizeof(req));
+}
+
+/*
+ * @brief   Pairing state callback.
+ *
+ * @param   connHandle - connection handle
+ * @param   state      - pairing state
+ * @param   status     - pairing status
+ *
+ * @return  none
+ */
+static void user_gapBondMgr_pairStateCB(uint16_t connHandle, uint8_t state,
+                                        uint8_t status)
+{
+  if (state == GAPBOND_PAIRING_STATE_STARTED)
+  {
+    Log_info0("Pairing started");
+  }
+  else if (state == GAPBOND_PAIRING_STATE_COMPLETE)
+  {
+    if (status == SUCCESS)
+    {
+      Log_info0("Pairing completed successfully.");
+      user_enqueueRawAppMsg(APP_MSG_BONDED, NULL, 0);
+    }
+    else
+    {
+      Log_error1("Pairing failed. Error: %02x", status);
+    }
+  }
+  else if (state == GAPBOND_PAIRING_STATE_BONDED)
+  {
+    if (status == SUCCESS)
+    {
+     Log_info0("Re-established pairing from stored bond info.");
+     user_enqueueRawAppMsg(APP_MSG_BONDED, NULL, 0);
+    }
+  }
+}
+
+/**
+ * Callback handler for characteristic value changes in services.
+ */
+static void user_service_ValueChangeCB( uint16_t connHandle, uint16_t svcUuid,
+                                        uint8_t paramID, uint8_t *pValue,
+                                        uint16_t len )
+{
+  // See the service header file to compare paramID with characteristic.
+  TRACE_DEBUG2(TRACE_SVC_WRITE, svcUuid, paramID);
+  user_enqueueCharDataMsg(APP_MSG_SERVICE_WRITE, connHandle, svcUuid, paramID,
+                          pValue, len);
+}
+
+/**
+ * Callback handler for characteristic configuration changes in services.
+ */
+static void user_service_CfgChangeCB( uint16_t connHandle, uint16_t svcUuid,
+                                      uint8_t paramID, uint8_t *pValue,
+                                      uint16_t len )
+{
+  TRACE_DEBUG2(TRACE_SVC_CFG, svcUuid, paramID);
+  user_enqueueCharDataMsg(APP_MSG_SERVICE_CFG, connHandle, svcUuid,
+                          paramID, pValue, len);
+}
+
+/******************************************************************************
+ *****************************************************************************
+ *
+ *  Utility functions
+ *
+ ****************************************************************************
+ *****************************************************************************/
+
+/*
+ * @brief  Generic message constructor for characteristic data.
+ *
+ *         Sends a message to the application for handling in Task context where
+ *         the message payload is a char_data_t struct.
+ *
+ *         From service callbacks the appMsgType is APP_MSG_SERVICE_WRITE or
+ *         APP_MSG_SERVICE_CFG, and functions running in another context than
+ *         the Task itself, can set the type to APP_MSG_UPDATE_CHARVAL to
+ *         make the user Task loop invoke user_updateCharVal function for them.
+ *
+ * @param  appMsgType    Enumerated type of message being sent.
+ * @param  connHandle    GAP Connection handle of the relevant connection
+ * @param  serviceUUID   16-bit part of the relevant service UUID
+ * @param  paramID       Index of the characteristic in the service
+ * @oaram  *pValue       Pointer to characteristic value
+ * @param  len           Length of characteristic data
+ */
+static void user_enqueueCharDataMsg( app_msg_types_t appMsgType,
+                                     uint16_t connHandle,
                                      uint16_t serviceUUID, uint8_t paramID,
                                      uint8_t *pValue, uint16_t len )
 {
@@ -1295,8 +1871,8 @@ static void user_enqueueCharDataMsg( app_msg_types_t appMsgType,
   //       However, to prevent data loss if a new value is received before the
   //       service's container is read out via the GetParameter API is called,
   //       we copy the characteristic's data now.
-  app_msg_t *pMsg = ICall_malloc( sizeof(app_msg_t) + sizeof(char_data_t) +
-                                  readLen );
+  app_msg_t *pMsg = msgPool_alloc( sizeof(app_msg_t) + sizeof(char_data_t) +
+                                   readLen );
 
   if (pMsg != NULL)
   {
@@ -1324,19 +1900,63 @@ static void user_enqueueCharDataMsg( app_msg_types_t appMsgType,
  * @param  appMsgType    Enumerated type of message being sent.
  * @oaram  *pValue       Pointer to characteristic value
  * @param  len           Length of characteristic data
+ *
+ * @return USER_APP_ERROR_NO_MEM if the message pool is empty
  */
-static void user_enqueueRawAppMsg(app_msg_types_t appMsgType, uint8_t *pData,
-                                  uint16_t len)
+static user_app_error_type_t user_enqueueRawAppMsg(app_msg_types_t appMsgType,
+                                                   uint8_t *pData, uint16_t len)
 {
   // Allocate memory for the message.
-  app_msg_t *pMsg = ICall_malloc( sizeof(app_msg_t) + len );
+  app_msg_t *pMsg = msgPool_alloc( sizeof(app_msg_t) + len );
+
+  if (pMsg == NULL)
+  {
+    return(USER_APP_ERROR_NO_MEM);
+  }
+
+  pMsg->type = appMsgType;
+
+  // Copy data into message
+  memcpy(pMsg->pdu, pData, len);
+  // Enqueue the message using pointer to queue node element.
+  Queue_enqueue(hApplicationMsgQ, &pMsg->_elem);
+
+  // Let application know there's a message.
+  Semaphore_post(sem);
+  return(USER_APP_ERROR_OK);
+}
+
+/*
+ * @brief  Builds a stream packet (two-byte type/length header, then data)
+ *         directly in its APP_MSG_UPDATE_CHARVAL message. Each message owns
+ *         its packet, so packets queued back to back never overwrite each
+ *         other, and no staging buffer is needed on the caller's stack.
+ *
+ * @param  serviceUUID   16-bit part of the service UUID
+ * @param  paramID       Stream characteristic of the service
+ * @param  packetType    Packet type for the header
+ * @param  *pData        Packet data
+ * @param  len           Length of the data, without the header
+ */
+static void user_enqueueStreamPacket(uint16_t serviceUUID, uint8_t paramID,
+                                     app_pkt_type_t packetType,
+                                     uint8_t *pData, uint8_t len)
+{
+  app_msg_t *pMsg = msgPool_alloc( sizeof(app_msg_t) + sizeof(char_data_t) +
+                                   len + 2 );
 
   if (pMsg != NULL)
   {
-    pMsg->type = appMsgType;
+    pMsg->type = APP_MSG_UPDATE_CHARVAL;
+
+    char_data_t *pCharData = (char_data_t *)pMsg->pdu;
+    pCharData->svcUUID = serviceUUID;
+    pCharData->paramID = paramID;
+    pCharData->dataLen = len + 2;
+    pCharData->data[0] = packetType;	// packet type
+    pCharData->data[1] = len;			// length of data, without the header
+    memcpy(&pCharData->data[2], pData, len);
 
-    // Copy data into message
-    memcpy(pMsg->pdu, pData, len);
     // Enqueue the message using pointer to queue node element.
     Queue_enqueue(hApplicationMsgQ, &pMsg->_elem);
 
@@ -1361,7 +1981,6 @@ user_app_error_type_t user_sendEmgPacket(uint8_t* pData,
 												uint8 len,
 												app_pkt_type_t packetType)
 {
-
 	if((pData == NULL) || (len == 0))
 	{
 		return(USER_APP_ERROR_INVALID_PARAM);
@@ -1372,14 +1991,10 @@ user_app_error_type_t user_sendEmgPacket(uint8_t* pData,
 	}
 	else
 	{
-		emgArrayData[0] = packetType;	//  packet type
-		emgArrayData[1]	= len; //Length of data. This does not include the two bytes of header
-
-		memcpy(&emgArrayData[2], pData, len);
-
-		user_enqueueRawAppMsg(APP_MSG_SEND_EMG_DATA,
-		    	                      (uint8_t *)emgArrayData, sizeof(emgArrayData));
+		user_enqueueStreamPacket(EMG_SERVICE_SERV_UUID, EMG_STREAM_ID,
+		                         packetType, pData, len);
 	}
+	return(USER_APP_ERROR_OK);
 }
 
 /*
@@ -1398,8 +2013,6 @@ user_app_error_type_t user_sendAccelPacket(uint8_t* pData,
 													uint8 len,
 													app_pkt_type_t packetType)
 {
-
-
 	if((pData == NULL) || (len == 0))
 	{
 		return(USER_APP_ERROR_INVALID_PARAM);
@@ -1410,14 +2023,63 @@ user_app_error_type_t user_sendAccelPacket(uint8_t* pData,
 	}
 	else
 	{
-		accelArrayData[0] = packetType;	//  packet type
-		accelArrayData[1] = len; //Length of data. This does not include the two bytes of header
+		user_enqueueStreamPacket(ACCEL_SERVICE_SERV_UUID, ACCEL_STREAM_ID,
+		                         packetType, pData, len);
+	}
+	return(USER_APP_ERROR_OK);
+}
+
+/*
+ * @brief  Hands a finished set to the BLE task for sending as a set summary.
+ *
+ * @note   Only the pointer is queued. The BLE task stores the set and then
+ *         hands the record back with emg_setStored.
+ *
+ * @param  *pStats    : Finished set record
+ * @param  setIndex   : Index of the set in the workout
+ * @param  withMotion : 1 if movedOrNah holds IMU results
+ *
+ * @return USER_APP_ERROR_NO_MEM if nothing was queued, the caller keeps the set
+ */
+user_app_error_type_t user_publishSetSummary(const EMG_stats *pStats, uint8_t setIndex, uint8_t withMotion)
+{
+	set_summary_req_t req;
 
-		memcpy(&accelArrayData[2], pData, len);
+	req.pStats = pStats;
+	req.setIndex = setIndex;
+	req.withMotion = withMotion;
+	req.historyId = 0;
+	req.nextFrag = 0;
+	req.fragLen = 0;
 
-		user_enqueueRawAppMsg(APP_MSG_SEND_ACCEL_DATA,
-		    	                      (uint8_t *)accelArrayData, sizeof(accelArrayData));
-	}
+	return(user_enqueueRawAppMsg(APP_MSG_SEND_SET_SUMMARY, (uint8_t *)&req, sizeof(req)));
+}
+
+/*
+ * @brief  Reports an activity that needs different connection parameters.
+ *         Safe from any context, the policy runs in the BLE task.
+ *
+ * @param  activity : CONN_ACTIVITY_* bits, 0 to only re-evaluate
+ * @param  active   : 1 started, 0 stopped
+ */
+void user_setConnActivity(uint8_t activity, uint8_t active)
+{
+	conn_activity_t act;
+
+	act.activity = activity;
+	act.active = active;
+
+	user_enqueueRawAppMsg(APP_MSG_CONN_ACTIVITY, (uint8_t *)&act, sizeof(act));
+}
+
+/*
+ * @brief  Largest notification payload on the current connection.
+ *
+ * @return	ATT MTU - 3, 20 bytes until the central negotiates a larger MTU.
+ */
+uint16_t user_getNotifyPayloadLen(void)
+{
+	return(user_attMtu - 3);
 }
 
 /*
@@ -1444,6 +2106,508 @@ static void user_updateCharVal(char_data_t *pCharData)
   }
 }
 
+/*
+ * @brief  Whether a central is connected.
+ *
+ * @return TRUE while connected, with or without advertising.
+ */
+static uint8_t user_isConnected(void)
+{
+  return ((user_gapState == GAPROLE_CONNECTED) ||
+          (user_gapState == GAPROLE_CONNECTED_ADV));
+}
+
+/*
+ * @brief  Whether a queued message outlives the connection. Rep events and
+ *         "summary available" notices are few and small, and the app needs
+ *         them after a reconnect. Live streams are stale by then, and pushed
+ *         summaries can be read from the set history instead.
+ *
+ * @param  *pMsg  Queued message
+ *
+ * @return TRUE if kept while disconnected.
+ */
+static uint8_t user_txqIsDurable(app_msg_t *pMsg)
+{
+  if (pMsg->type == APP_MSG_SEND_SET_SUMMARY)
+  {
+    return (((set_summary_req_t *)pMsg->pdu)->historyId == 0);
+  }
+  else
+  {
+    char_data_t *pCharData = (char_data_t *)pMsg->pdu;
+
+    return ((pCharData->svcUUID == EMG_SERVICE_SERV_UUID) &&
+            (pCharData->data[0] == APP_PACKET_TYPE_REP_EVENT));
+  }
+}
+
+/*
+ * @brief  Takes ownership of a notification message (stream packet or set
+ *         summary) and queues it for sending. While disconnected nothing is
+ *         queued, rep events go to the session log instead.
+ *
+ * @param  *pMsg  Message to queue
+ *
+ * @return TRUE if queued, FALSE if the caller keeps it.
+ */
+static uint8_t user_txqPush(app_msg_t *pMsg)
+{
+  if (!user_isConnected())
+  {
+    if (user_txqIsDurable(pMsg) && (pMsg->type != APP_MSG_SEND_SET_SUMMARY))
+    {
+      user_txqLogRepEvent(pMsg);
+    }
+    else
+    {
+      txqStats.discards++;
+    }
+    return (FALSE);
+  }
+
+  if (txqCount == USER_TXQ_DEPTH)
+  {
+    txqStats.drops++;
+    Log_warning1("TX queue full, dropped message type %d", (IArg)pMsg->type);
+    return (FALSE);
+  }
+
+  txQueue[(txqHead + txqCount) % USER_TXQ_DEPTH] = pMsg;
+  txqCount++;
+  txqStats.depth = txqCount;
+  if (txqCount > txqStats.highWater)
+  {
+    txqStats.highWater = txqCount;
+  }
+  return (TRUE);
+}
+
+/*
+ * @brief  Builds the next notification of a queued message in a stack-owned
+ *         buffer and hands it to the stack.
+ *
+ * @param  *pMsg   Queued message
+ * @param  *pDone  Set to TRUE once the message has nothing left to send
+ *
+ * @return SUCCESS, or the stack status that stopped the send.
+ */
+static bStatus_t user_txqSend(app_msg_t *pMsg, uint8_t *pDone)
+{
+  attHandleValueNoti_t noti;
+  bStatus_t status;
+  uint16_t len;
+
+  *pDone = FALSE;
+
+  if (pMsg->type == APP_MSG_SEND_SET_SUMMARY)
+  {
+    set_summary_req_t *pReq = (set_summary_req_t *)pMsg->pdu;
+
+    if (pReq->fragLen == 0)
+    {
+      // Apps subscribed to the Summary characteristic only get the set index
+      // and read the summary when they want it
+      status = user_txqNotifySummary(pReq->setIndex, pDone);
+      if ((status != bleIncorrectMode) || (pReq->historyId == 0))
+      {
+        return (status);
+      }
+
+      // Otherwise push the summary. All fragments of a set must have the same length
+      pReq->fragLen = MIN(user_getNotifyPayloadLen(), EMG_STREAM_LEN);
+    }
+
+    status = EMGService_AllocStreamNoti(pReq->fragLen, &txqConnHandle, &noti);
+    if (status != SUCCESS)
+    {
+      return (status);
+    }
+
+    // Two-byte EMG packet header, then the fragment copied from the history.
+    // Nothing comes back once newer sets pushed the summary out of it.
+    len = setHistory_fillFragment(pReq->historyId, pReq->nextFrag,
+                                  &noti.pValue[2], pReq->fragLen - 2);
+    if (len == 0)
+    {
+      GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+      *pDone = TRUE;
+      return (SUCCESS);
+    }
+    noti.pValue[0] = APP_PACKET_TYPE_SET_SUMMARY;
+    noti.pValue[1] = len;
+    noti.len = len + 2;
+
+    if ((noti.pValue[2] & SET_SUMMARY_FRAG_LAST) == 0)
+    {
+      // More to come, stays queued unless this send fails
+      status = GATT_Notification(txqConnHandle, &noti, FALSE);
+      if (status == SUCCESS)
+      {
+        pReq->nextFrag++;
+      }
+      else
+      {
+        GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+      }
+      return (status);
+    }
+  }
+  else
+  {
+    // Stream packet, copied once from the message into the stack buffer
+    char_data_t *pCharData = (char_data_t *)pMsg->pdu;
+
+    len = MIN(pCharData->dataLen, user_getNotifyPayloadLen());
+    if (pCharData->svcUUID == EMG_SERVICE_SERV_UUID)
+    {
+      status = EMGService_AllocStreamNoti(len, &txqConnHandle, &noti);
+    }
+    else
+    {
+      status = AccelService_AllocStreamNoti(len, &txqConnHandle, &noti);
+    }
+    if (status != SUCCESS)
+    {
+      return (status);
+    }
+    memcpy(noti.pValue, pCharData->data, len);
+  }
+
+  status = GATT_Notification(txqConnHandle, &noti, FALSE);
+  if (status == SUCCESS)
+  {
+    *pDone = TRUE;
+  }
+  else
+  {
+    GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+  }
+  return (status);
+}
+
+/*
+ * @brief  Sends the "summary available" notification of a stored set.
+ *
+ * @param  setIndex  Set that was stored
+ * @param  *pDone    Set to TRUE once sent
+ *
+ * @return SUCCESS, bleIncorrectMode if the Summary characteristic has no
+ *         subscriber, or the stack status that stopped the send.
+ */
+static bStatus_t user_txqNotifySummary(uint8_t setIndex, uint8_t *pDone)
+{
+  attHandleValueNoti_t noti;
+  bStatus_t status;
+
+  status = EMGService_AllocSummaryNoti(EMG_SUMMARY_NOTI_LEN, &txqConnHandle, &noti);
+  if (status != SUCCESS)
+  {
+    return (status);
+  }
+  noti.pValue[0] = setIndex;
+
+  status = GATT_Notification(txqConnHandle, &noti, FALSE);
+  if (status == SUCCESS)
+  {
+    *pDone = TRUE;
+  }
+  else
+  {
+    GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+  }
+  return (status);
+}
+
+/*
+ * @brief  Sends queued notifications until the queue is empty or the stack
+ *         runs out of buffers. In that case the rest is retried at the end of
+ *         the next connection event. A durable message waits for the central
+ *         to subscribe, unless the queue behind it is full.
+ */
+static void user_txqDrain(void)
+{
+  txqWaitCccd = FALSE;
+  if (!user_isConnected())
+  {
+    return;
+  }
+
+  while (txqCount > 0)
+  {
+    app_msg_t *pMsg = txQueue[txqHead];
+    uint8_t done;
+    bStatus_t status;
+
+    status = user_txqSend(pMsg, &done);
+    if (status == SUCCESS)
+    {
+      txqStats.sent++;
+      if (!done)
+      {
+        continue;
+      }
+    }
+    else if ((status == MSG_BUFFER_NOT_AVAIL) || (status == blePending) ||
+             (status == bleMemAllocError))
+    {
+      // Stack buffers are full, keep the message for the next connection event
+      txqStats.retries++;
+      break;
+    }
+    else if ((status == bleIncorrectMode) && (txqCount < USER_TXQ_DEPTH) &&
+             user_txqIsDurable(pMsg))
+    {
+      // Re-subscribing after a reconnect ends in a CCCD write, which drains again
+      txqWaitCccd = TRUE;
+      break;
+    }
+    else
+    {
+      // Not connected or notifications disabled, give up on this message
+      txqStats.discards++;
+    }
+
+    msgPool_free(pMsg);
+    txqHead = (txqHead + 1) % USER_TXQ_DEPTH;
+    txqCount--;
+  }
+
+  // Live data first, the backlog fills what is left
+  if ((txqCount == 0) || txqWaitCccd)
+  {
+    user_syncDrain();
+  }
+
+  txqStats.depth = txqCount;
+  user_txqUpdateNotice();
+}
+
+/*
+ * @brief  Discards what is not worth keeping once the connection is gone.
+ *         Rep events move to the session log, "summary available" notices
+ *         stay queued for the next connection.
+ */
+static void user_txqFlush(void)
+{
+  uint8_t n = txqCount;
+
+  while (n-- > 0)
+  {
+    app_msg_t *pMsg = txQueue[txqHead];
+
+    txqHead = (txqHead + 1) % USER_TXQ_DEPTH;
+    txqCount--;
+    if (user_txqIsDurable(pMsg) && (pMsg->type == APP_MSG_SEND_SET_SUMMARY))
+    {
+      txQueue[(txqHead + txqCount) % USER_TXQ_DEPTH] = pMsg;
+      txqCount++;
+    }
+    else if (user_txqIsDurable(pMsg))
+    {
+      user_txqLogRepEvent(pMsg);
+      msgPool_free(pMsg);
+    }
+    else
+    {
+      if (pMsg->type == APP_MSG_SEND_SET_SUMMARY)
+      {
+        // Still in the set history, announced again on reconnect
+        txqSetMissed = TRUE;
+      }
+      msgPool_free(pMsg);
+      txqStats.discards++;
+    }
+  }
+
+  txqStats.depth = txqCount;
+  txqConnHandle = INVALID_CONNHANDLE;
+  txqNoticeOn = FALSE;
+  txqWaitCccd = FALSE;
+
+  // The link is gone, so the log may write what it kept in RAM: the rep events
+  // above and the offset the app acked
+  sessionLog_flush();
+}
+
+/*
+ * @brief  Queues a "summary available" notice for the newest stored set if
+ *         a set summary was missed while disconnected.
+ */
+static void user_txqQueueSetMissed(void)
+{
+  uint8_t setIndex = setHistory_lastSetIndex();
+  app_msg_t *pMsg;
+
+  if (!txqSetMissed || (setIndex == 0))
+  {
+    return;
+  }
+
+  pMsg = msgPool_alloc(sizeof(app_msg_t) + sizeof(set_summary_req_t));
+  if (pMsg != NULL)
+  {
+    set_summary_req_t *pReq = (set_summary_req_t *)pMsg->pdu;
+
+    pMsg->type = APP_MSG_SEND_SET_SUMMARY;
+    pReq->pStats = NULL;
+    pReq->setIndex = setIndex;
+    pReq->withMotion = 0;
+    pReq->historyId = 0;
+    pReq->nextFrag = 0;
+    pReq->fragLen = 0;
+    if (user_txqPush(pMsg))
+    {
+      txqSetMissed = FALSE;
+    }
+    else
+    {
+      msgPool_free(pMsg);
+    }
+  }
+}
+
+/*
+ * @brief  Keeps the connection event end notice registered while the TX queue
+ *         or the bulk sync has work. A pending ATT response shares the same
+ *         notice.
+ */
+static void user_txqUpdateNotice(void)
+{
+  if (txqConnHandle == INVALID_CONNHANDLE)
+  {
+    return;
+  }
+
+  uint8_t work = ((txqCount > 0) && !txqWaitCccd) ||
+                 (sessionLog_nextChunk(NULL, user_getNotifyPayloadLen()) > 0) ||
+                 timeSync_isActive();
+
+  if (work && !txqNoticeOn)
+  {
+    if (HCI_EXT_ConnEventNoticeCmd(txqConnHandle, selfEntity,
+                                   PRZ_CONN_EVT_END_EVT) == SUCCESS)
+    {
+      txqNoticeOn = TRUE;
+    }
+  }
+  else if (!work && txqNoticeOn && (pAttRsp == NULL))
+  {
+    HCI_EXT_ConnEventNoticeCmd(txqConnHandle, selfEntity, 0);
+    txqNoticeOn = FALSE;
+  }
+}
+
+/*
+ * @brief  Appends the rep event of a queued stream packet to the session log.
+ *
+ * @param  *pMsg  Queued rep event packet
+ */
+static void user_txqLogRepEvent(app_msg_t *pMsg)
+{
+  char_data_t *pCharData = (char_data_t *)pMsg->pdu;
+
+  // Without the two-byte packet header
+  if (!sessionLog_appendRep(&pCharData->data[2], pCharData->dataLen - 2))
+  {
+    txqStats.drops++;
+  }
+}
+
+/*
+ * @brief  Sends session log notifications until the sync window is full,
+ *         the log is sent or the stack runs out of buffers.
+ */
+static void user_syncDrain(void)
+{
+  attHandleValueNoti_t noti;
+  bStatus_t status;
+  uint16_t len;
+
+  while ((len = sessionLog_nextChunk(NULL, user_getNotifyPayloadLen())) > 0)
+  {
+    status = EMGService_AllocSessionLogNoti(len, &txqConnHandle, &noti);
+    if (status == bleIncorrectMode)
+    {
+      // Nobody subscribed, the app starts again once it has
+      user_syncStop();
+      return;
+    }
+    if (status != SUCCESS)
+    {
+      return;
+    }
+
+    sessionLog_nextChunk(noti.pValue, len);
+    if (GATT_Notification(txqConnHandle, &noti, FALSE) != SUCCESS)
+    {
+      GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+      return;
+    }
+    sessionLog_chunkSent(len);
+  }
+}
+
+/*
+ * @brief  Sends the next time sync ping, if one is due. Called at the end of
+ *         each connection event while a burst runs.
+ */
+static void user_timeSyncPoll(void)
+{
+  uint8_t ping[TIME_SYNC_PING_LEN];
+  attHandleValueNoti_t noti;
+  uint16_t connHandle;
+  bStatus_t status;
+  uint16_t len;
+
+  len = timeSync_connEvent((uint32_t)connPolicy_getInterval() * 1250, ping);
+  if (len == 0)
+  {
+    return;
+  }
+
+  status = EMGService_AllocTimeSyncNoti(len, &connHandle, &noti);
+  if (status == bleIncorrectMode)
+  {
+    // Nobody subscribed, the app starts again once it has
+    timeSync_stop();
+    return;
+  }
+  if (status != SUCCESS)
+  {
+    return;
+  }
+
+  memcpy(noti.pValue, ping, len);
+  if (GATT_Notification(connHandle, &noti, FALSE) == SUCCESS)
+  {
+    timeSync_pingSent();
+  }
+  else
+  {
+    GATT_bm_free((gattMsg_t *)&noti, ATT_HANDLE_VALUE_NOTI);
+  }
+}
+
+/*
+ * @brief  Ends a bulk sync and gives up its connection parameters.
+ */
+static void user_syncStop(void)
+{
+  sessionLog_stopSync();
+  connPolicy_setActivity(CONN_ACTIVITY_SYNC, FALSE);
+}
+
+/*
+ * @brief  TX queue counters.
+ *
+ * @return Pointer to the live counters
+ */
+const TxQueue_stats *user_getTxQueueStats(void)
+{
+  return (&txqStats);
+}
+
 /*
  * @brief   Convert {0x01, 0x02} to "01:02"
  *
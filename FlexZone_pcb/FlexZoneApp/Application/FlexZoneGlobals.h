@@ -30,6 +30,12 @@
 //EMG
 #define EMG_NUMBER_OF_SAMPLES_SLICE			50
 #define EMG_MAX_REPS						19 //lol
+#define EMG_PERIOD_IN_MS					30
+
+//Bluetooth
+//Largest notification payload: MAX_PDU_SIZE (104, set in the project) - 4 byte
+//L2CAP header - 3 byte ATT header. Streams pack up to MIN(this, ATT MTU - 3).
+#define USER_MAX_NOTIFY_LEN					97
 
 //**********************************************************************************
 // Data Structures
@@ -54,15 +60,39 @@ typedef struct {
 	uint8_t movedOrNah[EMG_MAX_REPS];			//1 - moved; 0 - nah
 	uint8_t numReps;
 	uint8_t setDone;
+	uint8_t exerciseId;							//EXERCISE_* from the classifier, set after the first rep
+	uint8_t samplePeriodMs;						//Unit of the widths, GCD of the sample periods of the set
 } EMG_stats;
 
 
+//Notification TX queue counters
+typedef struct {
+	uint8_t depth;				//Messages queued now
+	uint8_t highWater;			//Most messages queued at once
+	uint16_t sent;				//Notifications accepted by the stack
+	uint16_t retries;			//Drains stopped by full stack buffers
+	uint16_t drops;				//Messages dropped, queue full
+	uint16_t discards;			//Messages given up, link down or notifications off
+} TxQueue_stats;
+
 typedef struct {
 	uint8_t targetSetCount;
 	uint8_t targetRepCount;
-	uint16_t maxRestSeconds;
+	uint16_t maxRestSeconds;			//Longest rest between sets, the front end is off for it
 	uint8_t hapticFeedback;
 	uint8_t imuFeedback;
+	uint8_t rawStream;					//1 - stream raw EMG blocks during the workout
+	uint8_t broadcastPeriod;			//Live status broadcast period in 100 ms, 0 - off
+	uint8_t repCue;						//1 - haptic tick on every counted rep
+	uint8_t concentricTarget;			//Tempo target, rep start to peak in 100 ms, 0 - none
+	uint8_t eccentricTarget;			//Tempo target, peak to rep end in 100 ms, 0 - none
+	uint16_t repThresholdHigh;			//ADC level that starts a rep
+	uint16_t repThresholdLow;			//ADC level that ends a rep
+	uint16_t minRepMs;					//Shorter pulses are not reps
+	uint8_t setTimeoutSec;				//Rest after the last rep that ends a set
+	uint8_t samplePeriodMs;				//EMG sample period
+	uint8_t adcAverage;					//ADC reads averaged per sample
+	uint8_t gain[2];					//DigiPot wipers, 0 - left at the power-on value
 } Workout_config;
 
 //Bluetooth stuff
@@ -72,12 +102,17 @@ typedef enum
 	USER_APP_ERROR_INVALID_LEN,		/* Input parameters have invalid length  */
 	USER_APP_ERROR_INVALID_PARAM,	/* Input parameters are not correct  */
 	USER_APP_ERROR_UNKNOWN,			/* Unknown error  */
+	USER_APP_ERROR_NO_MEM,			/* No message memory, nothing was queued  */
 } user_app_error_type_t;
 
 typedef enum
 {
 	APP_PACKET_TYPE_DATA = 0,		/* Packet contains data  */
 	APP_PACKET_TYPE_CONFIG = 1,		/* Packet contains configuration  */
+	APP_PACKET_TYPE_IMU_STREAM = 2,	/* Packet contains raw IMU frames  */
+	APP_PACKET_TYPE_SET_SUMMARY = 3,	/* Packet contains a set summary fragment  */
+	APP_PACKET_TYPE_EMG_RAW = 4,	/* Packet contains a raw EMG block  */
+	APP_PACKET_TYPE_REP_EVENT = 5,	/* Packet contains one finished rep  */
 } app_pkt_type_t;
 //**********************************************************************************
 // Globally Scoped Variables (for RTOS: Semaphores, Mailboxes, Queues, Data Structures)
@@ -85,26 +120,21 @@ typedef enum
 //FlexZone - BLE Simple Peripheral Thread
 
 
-//Accelerometer Thread
-extern Semaphore_Struct accelSemaphore;
-
 //EMG Thread
 extern Semaphore_Struct emgSemaphore;
 extern uint32_t rawAdc[EMG_NUMBER_OF_SAMPLES_SLICE];
-extern EMG_stats emg_set_stats;
+extern EMG_stats *emg_set_stats;
 extern EMG_stats emgSets[10];
 extern Workout_config myWorkoutConfig;
 
 // Clocks
 extern Clock_Struct emgClock;
-extern Clock_Struct accelClock;
 
 //Data
 extern uint8_t repCount;
-extern uint8_t setIMUThres;
-extern uint8_t stopEmgRequest;
 extern uint8_t emgRunning;
 extern uint8_t setCount;
+extern uint16_t lastRepPeak;
 //**********************************************************************************
 // General Functions
 //**********************************************************************************
@@ -114,6 +144,10 @@ extern void buzz(uint8_t numTimes);
 //Bluetooth stuff
 extern user_app_error_type_t user_sendEmgPacket(uint8_t* pData, uint8_t len, app_pkt_type_t packetType);
 extern user_app_error_type_t user_sendAccelPacket(uint8_t* pData, uint8_t len, app_pkt_type_t packetType);
+extern uint16_t user_getNotifyPayloadLen(void);
+extern user_app_error_type_t user_publishSetSummary(const EMG_stats *pStats, uint8_t setIndex, uint8_t withMotion);
+extern const TxQueue_stats *user_getTxQueueStats(void);
+extern void user_setConnActivity(uint8_t activity, uint8_t active);
 
 
 //FOR TESTING: DELETE LATERS
@@ -19,6 +19,7 @@
 
 //Home brewed Header Files
 #include "MPU9250.h"
+#include "diag.h"
 
 //Standard Header Files
 #include <string.h>
@@ -34,6 +35,7 @@
 //I2C Transaction Buffer
 uint8_t accelTxBuf[2];
 uint8_t accelRxBuf[1];
+uint8_t accelBurstRxBuf[MPU_BURST_LEN];
 
 //I2C Driver Handle
 I2C_Handle accel_i2c_handle;
@@ -45,9 +47,14 @@ uint8_t axes[2][3] = {
 };
 Accel_State Thres_accelState;
 
+//Registers changed by mpu_enterWakeOnMotion
+static uint8_t womSaved[4];				//PWR_MGMT_1, PWR_MGMT_2, ACCEL_CONFIG_2, INT_ENABLE
+
 //**********************************************************************************
 // Local Function Prototypes
 //**********************************************************************************
+static bool mpuTransfer(I2C_Transaction *pTransaction);
+static bool mpuWrite(uint8_t regAddr, uint8_t data);
 
 //**********************************************************************************
 // Function Definitions
@@ -75,6 +82,38 @@ uint16_t read_MPU(uint8_t axis, uint8_t fsel)
 	return result;
 }
 
+/**
+ *	Reads all accelerometer and gyroscope axes in a single burst transaction.
+ *
+ * @param 	state		Accel_State to fill in.
+ * @return	1 on success, 0 if the I2C transfer failed.
+ */
+uint8_t read_MPU_all(Accel_State *state)
+{
+	I2C_Transaction i2cTransaction;
+
+	accelTxBuf[0] = ACCEL_XOUT_H;
+
+	//Registers auto-increment, so one transaction covers accel, temp and gyro
+	i2cTransaction.slaveAddress = ACCEL_I2C_SLAVE_ADDR;
+	i2cTransaction.writeBuf = accelTxBuf;
+	i2cTransaction.writeCount = 1;
+	i2cTransaction.readBuf = accelBurstRxBuf;
+	i2cTransaction.readCount = MPU_BURST_LEN;
+
+	if (!mpuTransfer(&i2cTransaction))
+		return 0;
+
+	state->ACCEL_X = (accelBurstRxBuf[0] << 8) | accelBurstRxBuf[1];
+	state->ACCEL_Y = (accelBurstRxBuf[2] << 8) | accelBurstRxBuf[3];
+	state->ACCEL_Z = (accelBurstRxBuf[4] << 8) | accelBurstRxBuf[5];
+	//accelBurstRxBuf[6..7] is temperature
+	state->GYRO_X = (accelBurstRxBuf[8] << 8) | accelBurstRxBuf[9];
+	state->GYRO_Y = (accelBurstRxBuf[10] << 8) | accelBurstRxBuf[11];
+	state->GYRO_Z = (accelBurstRxBuf[12] << 8) | accelBurstRxBuf[13];
+	return 1;
+}
+
 /**
  * Performs a register read and return 8-bit value of register.
  *
@@ -162,7 +201,7 @@ uint8_t i2cRead(uint8_t regAddr)
 	i2cTransaction.readCount = 1;
 
 	//Perform transaction
-	bool ret = I2C_transfer(accel_i2c_handle, &i2cTransaction);
+	bool ret = mpuTransfer(&i2cTransaction);
 	if (!ret) {
 		System_printf("Unsuccessful accelerometer I2C transfer\n");
 		System_flush();
@@ -195,7 +234,7 @@ void i2cWrite(uint8_t regAddr, uint8_t data)
 	i2cTransaction.readCount = 0;
 
 	//Perform address transaction
-	bool ret = I2C_transfer(accel_i2c_handle, &i2cTransaction);
+	bool ret = mpuTransfer(&i2cTransaction);
 	if (!ret) {
 		System_printf("Unsuccessful accelerometer I2C transfer\n");
 		System_flush();
@@ -203,6 +242,106 @@ void i2cWrite(uint8_t regAddr, uint8_t data)
 }
 
 
+/**
+ * Puts the MPU into low power accelerometer cycling with wake on motion, gyro off.
+ * The registers it changes are saved for mpu_exitWakeOnMotion.
+ *
+ * @param 	none
+ * @return	1 on success, 0 if the I2C transfer failed.
+ */
+uint8_t mpu_enterWakeOnMotion(void)
+{
+	uint32_t errors = 0;
+	uint8_t i, pwr1;
+	const uint8_t regs[4] = {MPU_PWR_MGMT_1, MPU_PWR_MGMT_2, MPU_ACCEL_CONFIG_2, MPU_INT_ENABLE};
+
+	for (i = 0; i < 4; i++)
+		womSaved[i] = i2cRead(regs[i]);
+	pwr1 = womSaved[0] & ~MPU_PWR1_SLEEP_MASK;
+
+	//Sequence of the MPU-9250 datasheet: accel only, awake, then start cycling
+	errors += !mpuWrite(MPU_PWR_MGMT_1, pwr1);
+	errors += !mpuWrite(MPU_PWR_MGMT_2, MPU_PWR2_GYRO_OFF);
+	errors += !mpuWrite(MPU_ACCEL_CONFIG_2, MPU_ACCEL_LP_DLPF);
+	errors += !mpuWrite(MPU_INT_ENABLE, MPU_INT_WOM);
+	errors += !mpuWrite(MPU_MOT_DETECT_CTRL, MPU_MOT_DETECT_EN);
+	errors += !mpuWrite(MPU_WOM_THR, MPU_WOM_THRESHOLD);
+	errors += !mpuWrite(MPU_LP_ACCEL_ODR, MPU_LP_ODR_2HZ);
+	i2cRead(MPU_INT_STATUS);
+	errors += !mpuWrite(MPU_PWR_MGMT_1, pwr1 | MPU_PWR1_CYCLE);
+
+	return errors ? 0 : 1;
+}
+
+/**
+ * Restores the power and interrupt registers saved by mpu_enterWakeOnMotion.
+ *
+ * @param 	none
+ * @return	none
+ */
+void mpu_exitWakeOnMotion(void)
+{
+	//Out of cycling first, the other registers only take while awake
+	i2cWrite(MPU_PWR_MGMT_1, womSaved[0] & ~MPU_PWR1_SLEEP_MASK);
+	i2cWrite(MPU_MOT_DETECT_CTRL, 0);
+	i2cWrite(MPU_INT_ENABLE, womSaved[3]);
+	i2cWrite(MPU_ACCEL_CONFIG_2, womSaved[2]);
+	i2cWrite(MPU_PWR_MGMT_2, womSaved[1]);
+	i2cWrite(MPU_PWR_MGMT_1, womSaved[0]);
+	i2cRead(MPU_INT_STATUS);
+}
+
+/**
+ * Reads and clears the interrupt status.
+ *
+ * @param 	none
+ * @return	1 if motion was detected since the last call.
+ */
+uint8_t mpu_motionDetected(void)
+{
+	return (i2cRead(MPU_INT_STATUS) & MPU_INT_WOM) ? 1 : 0;
+}
+
+/**
+ * Writes one register.
+ *
+ * @param 	regAddr		1-byte register address (RA)
+ * @param	data		1-byte data
+ * @return	true on success
+ */
+static bool mpuWrite(uint8_t regAddr, uint8_t data)
+{
+	I2C_Transaction i2cTransaction;
+
+	accelTxBuf[0] = regAddr;
+	accelTxBuf[1] = data;
+
+	i2cTransaction.slaveAddress = ACCEL_I2C_SLAVE_ADDR;
+	i2cTransaction.writeBuf = accelTxBuf;
+	i2cTransaction.writeCount = 2;
+	i2cTransaction.readBuf = accelRxBuf;
+	i2cTransaction.readCount = 0;
+
+	return mpuTransfer(&i2cTransaction);
+}
+
+/**
+ * Runs one I2C transaction and counts it for the diagnostics.
+ *
+ * @param 	pTransaction	Transaction
+ * @return	true on success
+ */
+static bool mpuTransfer(I2C_Transaction *pTransaction)
+{
+	bool ret = I2C_transfer(accel_i2c_handle, pTransaction);
+
+	diag_count(DIAG_I2C_TRANSFER);
+	if (!ret)
+		diag_count(DIAG_I2C_ERROR);
+	return ret;
+}
+
+
 /*****************************************************************************/
 /********************************MPU User functions************************/
 
@@ -34,6 +34,28 @@
 #define GYRO_YOUT_L  0x46
 #define GYRO_ZOUT_H  0x47
 
+//Burst read of ACCEL_XOUT_H..GYRO_ZOUT_L (includes 2 temperature bytes)
+#define MPU_BURST_LEN	14
+
+//Power and wake on motion registers
+#define MPU_ACCEL_CONFIG_2	0x1d
+#define MPU_LP_ACCEL_ODR	0x1e
+#define MPU_WOM_THR			0x1f
+#define MPU_INT_ENABLE		0x38
+#define MPU_INT_STATUS		0x3a
+#define MPU_MOT_DETECT_CTRL	0x69
+#define MPU_PWR_MGMT_1		0x6b
+#define MPU_PWR_MGMT_2		0x6c
+
+#define MPU_PWR1_CYCLE		0x20
+#define MPU_PWR1_SLEEP_MASK	0x70	//SLEEP, CYCLE, GYRO_STANDBY
+#define MPU_PWR2_GYRO_OFF	0x07
+#define MPU_ACCEL_LP_DLPF	0x09	//ACCEL_FCHOICE_B, 184 Hz
+#define MPU_INT_WOM			0x40
+#define MPU_MOT_DETECT_EN	0xc0
+#define MPU_LP_ODR_2HZ		3		//1.95 Hz
+#define MPU_WOM_THRESHOLD	32		//4 mg per LSB
+
 //R/W masks
 #define READ_FLAG 	0x80
 #define WRITE_FLAG 	0x00
@@ -78,6 +100,14 @@
  */
 uint16_t read_MPU(uint8_t axis, uint8_t fsel);
 
+/**
+ *	Reads all accelerometer and gyroscope axes in a single burst transaction.
+ *
+ * @param 	state		Accel_State to fill in.
+ * @return	1 on success, 0 if the I2C transfer failed.
+ */
+uint8_t read_MPU_all(Accel_State *state);
+
 /**
  * Performs a register read and return 8-bit value of register.
  *
@@ -123,6 +153,31 @@ uint8_t i2cRead(uint8_t regAddr);
  */
 void i2cWrite(uint8_t regAddr, uint8_t data);
 
+/**
+ * Puts the MPU into low power accelerometer cycling with wake on motion, gyro off.
+ * The registers it changes are saved for mpu_exitWakeOnMotion.
+ *
+ * @param 	none
+ * @return	1 on success, 0 if the I2C transfer failed.
+ */
+uint8_t mpu_enterWakeOnMotion(void);
+
+/**
+ * Restores the power and interrupt registers saved by mpu_enterWakeOnMotion.
+ *
+ * @param 	none
+ * @return	none
+ */
+void mpu_exitWakeOnMotion(void);
+
+/**
+ * Reads and clears the interrupt status.
+ *
+ * @param 	none
+ * @return	1 if motion was detected since the last call.
+ */
+uint8_t mpu_motionDetected(void);
+
 /*****************************************************************************/
 /********************************MPU User functions************************/
 
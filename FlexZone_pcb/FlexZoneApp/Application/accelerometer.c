@@ -2,7 +2,7 @@
  * Application Name:	FlexZone (Application)
  * File Name: 			accelerometer.c
  * Group: 				GroupX - FlexZone
- * Description:			Implementation file for the accelerometer thread.
+ * Description:			Implementation file for the accelerometer handler.
  */
 
 //**********************************************************************************
@@ -11,10 +11,6 @@
 //XDCtools Header Files
 
 //SYS/BIOS Header Files
-#include <ti/sysbios/knl/Task.h>
-#include <ti/sysbios/knl/Clock.h>
-#include <ti/sysbios/knl/Semaphore.h>
-#include <ti/sysbios/BIOS.h>				//required for BIOS_WAIT_FOREVER in Semaphore_pend();
 
 //TI-RTOS Header Files
 
@@ -25,182 +21,452 @@
 #include "accelerometer.h"
 #include "FlexZoneGlobals.h"
 #include "MPU9250.h"
+#include "Accel_Service.h"
+#include "classifier.h"
+#include "conn_policy.h"
+#include "time_sync.h"
+#include "sched.h"
+#include "event_bus.h"
 
 //Standard Header Files
 
 //**********************************************************************************
 // Required Definitions
 //**********************************************************************************
-#define ACCEL_TASK_PRIORITY					1
-#ifndef ACCEL_TASK_STACK_SIZE
-#define ACCEL_TASK_STACK_SIZE              400
-#endif
-
 #define ACCEL_PERIOD_IN_MS					300
+#define ACCEL_REST_POLL_MS					500		//Wake on motion status, during a rest
 
 
 //**********************************************************************************
 // Global Data Structures
 //**********************************************************************************
-//Task Structures
-Task_Struct accelTask;
-Char accelTaskStack[ACCEL_TASK_STACK_SIZE];
-
-//Semaphore Structures
-Semaphore_Struct accelSemaphore;
-
-//Clock Structures
-Clock_Struct accelClock;
+//Timer Structures
+static Sched_timer accelTimer;
 
 //Accel_State myAccel;
 Accel_State reset_myAccel;
 
+//IMU streaming, flags written from SWI/BLE task, everything else owned by accel_handler
+static volatile uint8_t accelStreamEnabled = 0;
+static volatile uint8_t accelStreamRestart = 0;
+static volatile uint8_t accelMotionEnabled = 0;
+static volatile uint8_t accelResting = 0;		//IMU in wake on motion between two sets
+static volatile uint8_t accelStreamPeriodMs = 1000 / ACCEL_STREAM_DEFAULT_RATE_HZ;
+static uint8_t accelStreamPkt[ACCEL_STREAM_LEN - 2];
+static uint8_t accelStreamPktLen = 0;
+static uint8_t accelStreamSeq = 0;
+static uint16_t accelStreamLastMs = 0;
+static uint16_t accelMotionCounter = 0;
+
+//Rep under motion check, owned by the event loop task
+static uint8_t motionSet = 0;
+static uint8_t motionRep = 0;
+static uint8_t motionSetThreshold = 0;	//Next sample sets the movement thresholds
+static uint8_t motionMoved = 0;			//Last result published for the rep
+
+//I2C opened and the IMU configured on first use, owned by the event loop task
+static uint8_t accelOpen = 0;
+
 //**********************************************************************************
 // Local Function Prototypes
 //**********************************************************************************
-void accel_init();
-static void accel_taskFxn(UArg a0, UArg a1);
-static void accel_SwiFxn(UArg a0);
+static void accel_open(void);
+static void accel_handler(uint32_t arg);
+static void accel_busHandler(const Bus_msg *pMsg);
+static void accel_startMotionCheck(void);
+static void accel_stopMotionCheck(void);
+static void accel_restStart(void);
+static void accel_restEnd(void);
+static void accel_motionCheck(uint8_t haveSample);
+static void accel_streamSample(void);
+static void accel_streamFlush(void);
 
 //**********************************************************************************
 // Function Definitions
 //**********************************************************************************
 /**
- * Creates Accelerometer task running at and creates required semaphore for deferred interrupt processing of accelerometer data.
+ * Registers the Accelerometer handler with the application event loop. Samples are
+ * taken when the accelerometer timer posts SCHED_EVT_ACCEL.
  *
  * @param 	none
  * @return 	none
  */
-void accel_createTask(void) {
-	Task_Params taskParams;
-	Semaphore_Params semaphoreParams;
-
-	// Configure & construct semaphore
-	Semaphore_Params_init(&semaphoreParams);
-	Semaphore_construct(&accelSemaphore, 0, &semaphoreParams);
-
-	// Configure task
-	Task_Params_init(&taskParams);
-	taskParams.stack = accelTaskStack;
-	taskParams.stackSize = ACCEL_TASK_STACK_SIZE;
-	taskParams.priority = ACCEL_TASK_PRIORITY;
-
-	//Dynamically construct task
-	Task_construct(&accelTask, accel_taskFxn, &taskParams, NULL);
+void accel_register(void) {
+	sched_register(SCHED_EVT_ACCEL, NULL, accel_handler);
+
+	//The EMG task's reps drive the motion check
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_REP_START, accel_busHandler);
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_REP_END, accel_busHandler);
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_SET_DONE, accel_busHandler);
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_WORKOUT_ENDED, accel_busHandler);
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_REST_START, accel_busHandler);
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_REST_END, accel_busHandler);
 }
 
 /**
- * Initialize Accelerometer module
+ * Enables or disables raw IMU streaming. While streaming, the accelerometer clock runs
+ * at the stream rate and motion checks are decimated to their normal period.
  *
- * @param 	none
- * @return	none
+ * @param 	enable		1 to stream, 0 to stop
+ * @param	rateHz		Sample rate, 0 selects ACCEL_STREAM_DEFAULT_RATE_HZ
+ * @return 	none
  */
-void accel_init()
+void accel_setStreaming(uint8_t enable, uint8_t rateHz)
 {
-	mpu_i2c_init();
+	uint32_t periodMs = ACCEL_PERIOD_IN_MS;
+
+	sched_timerStop(&accelTimer);
+
+	if (enable) {
+		if (0 == rateHz)
+			rateHz = ACCEL_STREAM_DEFAULT_RATE_HZ;
+		else if (rateHz < ACCEL_STREAM_MIN_RATE_HZ)
+			rateHz = ACCEL_STREAM_MIN_RATE_HZ;
+		else if (rateHz > ACCEL_STREAM_MAX_RATE_HZ)
+			rateHz = ACCEL_STREAM_MAX_RATE_HZ;
+		periodMs = 1000 / rateHz;
+
+		accelStreamPeriodMs = periodMs;
+		accelStreamRestart = 1;
+	}
+	accelStreamEnabled = enable;
+	user_setConnActivity(CONN_ACTIVITY_STREAM, enable ? 1 : 0);
 
-	//Configure clock object
-	Clock_Params clockParams;
-	Clock_Params_init(&clockParams);
-	clockParams.period = ACCEL_PERIOD_IN_MS * (1000 / Clock_tickPeriod);
-	clockParams.startFlag = FALSE;	//Indicates to start immediately
+	if (!enable && accelResting)
+		periodMs = ACCEL_REST_POLL_MS;
 
-	//Dynamically Construct Clock
-	Clock_construct(&accelClock, accel_SwiFxn, 0, &clockParams);
+	if (enable || accelMotionEnabled || accelResting)
+		sched_timerStart(&accelTimer, SCHED_EVT_ACCEL, periodMs, periodMs);
+	else	//run the handler once so it flushes the last partial packet
+		sched_post(SCHED_EVT_ACCEL);
 }
 
 /**
- * Primary Accelerometer task. Calls function to initialize hardware once and samples Accelerometer via SPI0.
+ * Initialize Accelerometer module on first use, so boot does not wait on the I2C
+ * bring-up of an IMU that a workout without IMU feedback never reads.
  *
  * @param 	none
+ * @return	none
+ */
+static void accel_open(void)
+{
+	if (accelOpen)
+		return;
+	mpu_i2c_init();
+	accelOpen = 1;
+}
+
+/**
+ * Accelerometer handler, runs in the event loop task on every accelerometer timer
+ * expiry. Samples the IMU via I2C for the stream and the motion check.
+ *
+ * @param 	arg			unused
  * @return 	none
  */
-static void accel_taskFxn(UArg a0, UArg a1) {
-	uint8_t accel_range_mask=0;
+static void accel_handler(uint32_t arg) {
+	Bus_msg msg;
 
-	//Initialize required hardware & clocks for task.
-	accel_init();
-
-	while (1) {
-		//Wait for Accelerometer Semaphore
-		Semaphore_pend(Semaphore_handle(&accelSemaphore), BIOS_WAIT_FOREVER);
-//		myAccel.ACCEL_X = read_MPU(X_AXIS, ACCEL);
-//		myAccel.ACCEL_Y = read_MPU(Y_AXIS, ACCEL);
-//		myAccel.ACCEL_Z = read_MPU(Z_AXIS, ACCEL);
-//		myAccel.GYRO_X = read_MPU(X_AXIS, GYRO);
-//		myAccel.GYRO_Y = read_MPU(Y_AXIS, GYRO);
-//		myAccel.GYRO_Z = read_MPU(Z_AXIS, GYRO);
+	accel_open();
+
+//	myAccel.ACCEL_X = read_MPU(X_AXIS, ACCEL);
+//	myAccel.ACCEL_Y = read_MPU(Y_AXIS, ACCEL);
+//	myAccel.ACCEL_Z = read_MPU(Z_AXIS, ACCEL);
+//	myAccel.GYRO_X = read_MPU(X_AXIS, GYRO);
+//	myAccel.GYRO_Y = read_MPU(Y_AXIS, GYRO);
+//	myAccel.GYRO_Z = read_MPU(Z_AXIS, GYRO);
 //#if defined(USE_UART)
-//		Log_info3("Accel Thread: ACCEL (XYZ) \t%d\t%d\t%d", (IArg)myAccel.ACCEL_X, (IArg)myAccel.ACCEL_Y, (IArg)myAccel.ACCEL_Z);
+//	Log_info3("Accel Thread: ACCEL (XYZ) \t%d\t%d\t%d", (IArg)myAccel.ACCEL_X, (IArg)myAccel.ACCEL_Y, (IArg)myAccel.ACCEL_Z);
 //#else
 ////		System_printf("Accel Thread: ACCEL (XYZ) \t%d\t%d\t%d\t%d\n", myAccel.ACCEL_X, myAccel.ACCEL_Y, myAccel.ACCEL_Z, i2cRead(0x75));
 ////		System_printf("Whoami: %d\n", i2cRead(0x75));
 ////		System_flush();
 //#endif // USE_UART
-		reset_myAccel.ACCEL_X = read_MPU(X_AXIS, ACCEL);
-		reset_myAccel.ACCEL_Y = read_MPU(Y_AXIS, ACCEL);
-		reset_myAccel.ACCEL_Z = read_MPU(Z_AXIS, ACCEL);
-
-		if(setIMUThres)	{
-			//Initialize the Accel threshold values depending on first value read
-			user_setMpuThreshold(reset_myAccel);
-			setIMUThres = 0;
+
+	if (accelResting) {
+		if (!accelStreamEnabled) {
+			if (mpu_motionDetected()) {
+				//Once, the EMG task ends the rest with BUS_EVT_REST_END
+				sched_timerStop(&accelTimer);
+				msg.event = BUS_EVT_REST_WAKE;
+				msg.u.wake.reason = BUS_WAKE_MOTION;
+				bus_publish(&msg);
+			}
+			return;
 		}
-		else {
-			accel_range_mask = user_mpuMovementState(reset_myAccel);
 
-			//if there is motion
-			if (accel_range_mask)
-				emg_set_stats.movedOrNah[repCount] = 1;
-			else //else
-				emg_set_stats.movedOrNah[repCount] = 0;
+		//Streaming needs the IMU awake, the rest goes on without a motion wake
+		accel_restEnd();
+	}
+
+	if (accelStreamEnabled) {
+		accel_streamSample();
+
+		//Decimate motion check down to its normal period
+		if (++accelMotionCounter < ACCEL_PERIOD_IN_MS / accelStreamPeriodMs)
+			return;
+		accelMotionCounter = 0;
+	}
+	else if (accelStreamPktLen) {
+		//Streaming was turned off, push out what is left
+		accel_streamFlush();
+	}
+
+	if (accelMotionEnabled)
+		accel_motionCheck(accelStreamEnabled);
+}
+
+/**
+ * Follows the reps of the EMG task: a rep with IMU feedback is checked for motion
+ * until it ends.
+ *
+ * @param 	pMsg		Bus message
+ * @return 	none
+ */
+static void accel_busHandler(const Bus_msg *pMsg) {
+	switch (pMsg->event) {
+	case BUS_EVT_REP_START:
+		if (!pMsg->u.rep.imuFeedback)
+			break;
+		motionSet = pMsg->u.rep.setIndex;
+		motionRep = pMsg->u.rep.repIndex;
+		motionSetThreshold = 1;
+		motionMoved = 0;
+		accel_startMotionCheck();
+		break;
+
+	case BUS_EVT_REP_END:
+	case BUS_EVT_SET_DONE:
+	case BUS_EVT_WORKOUT_ENDED:
+		accel_stopMotionCheck();
+		break;
+
+	case BUS_EVT_REST_START:
+		accel_restStart();
+		break;
+
+	case BUS_EVT_REST_END:
+		accel_restEnd();
+		break;
+
+	default:
+		break;
+	}
+}
 
-//			if(accel_range_mask != 0)
+/**
+ * Starts the rep motion check.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void accel_startMotionCheck(void)
+{
+	accelMotionEnabled = 1;
+	if (!accelStreamEnabled)
+		sched_timerStart(&accelTimer, SCHED_EVT_ACCEL, ACCEL_PERIOD_IN_MS, ACCEL_PERIOD_IN_MS);
+}
+
+/**
+ * Stops the rep motion check. The clock keeps running if IMU streaming is active.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void accel_stopMotionCheck(void)
+{
+	accelMotionEnabled = 0;
+	if (!accelStreamEnabled)
+		sched_timerStop(&accelTimer);
+}
+
+/**
+ * Puts the IMU into wake on motion for the rest between two sets and polls its
+ * status. Skipped while streaming, which needs the IMU awake.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void accel_restStart(void)
+{
+	if (accelStreamEnabled)
+		return;
+
+	accel_open();
+	if (!mpu_enterWakeOnMotion()) {
+		mpu_exitWakeOnMotion();
+		return;
+	}
+
+	accelResting = 1;
+	sched_timerStart(&accelTimer, SCHED_EVT_ACCEL, ACCEL_REST_POLL_MS, ACCEL_REST_POLL_MS);
+}
+
+/**
+ * Brings the IMU back to its normal power mode after a rest.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void accel_restEnd(void)
+{
+	if (!accelResting)
+		return;
+
+	accelResting = 0;
+	mpu_exitWakeOnMotion();
+	if (!accelStreamEnabled && !accelMotionEnabled)
+		sched_timerStop(&accelTimer);
+}
+
+/**
+ * Reads accelerometer and publishes the movement flag of the current rep when it
+ * changes.
+ *
+ * @param 	haveSample	1 if reset_myAccel already holds a fresh sample from the stream
+ * @return 	none
+ */
+static void accel_motionCheck(uint8_t haveSample) {
+	uint8_t accel_range_mask=0;
+	Bus_msg msg;
+
+	if (!haveSample && !read_MPU_all(&reset_myAccel))
+		return;
+
+	//The first rep of a set is the classifier's feature window
+	if (0 == motionRep)
+		classifier_addImuSample(&reset_myAccel);
+
+	if(motionSetThreshold)	{
+		//Initialize the Accel threshold values depending on first value read
+		user_setMpuThreshold(reset_myAccel);
+		motionSetThreshold = 0;
+	}
+	else {
+		accel_range_mask = user_mpuMovementState(reset_myAccel);
+
+		//The EMG task keeps the set record, it takes the result from the bus
+		if ((accel_range_mask ? 1 : 0) != motionMoved) {
+			motionMoved = accel_range_mask ? 1 : 0;
+			msg.event = BUS_EVT_MOTION;
+			msg.u.motion.setIndex = motionSet;
+			msg.u.motion.repIndex = motionRep;
+			msg.u.motion.moved = motionMoved;
+			bus_publish(&msg);
+		}
+
+//		if(accel_range_mask != 0)
+//		{
+//			//start vibration motors
+//			if(accel_range_mask & X_AXIS_STATE_MASK)
 //			{
-//				//start vibration motors
-//				if(accel_range_mask & X_AXIS_STATE_MASK)
-//				{
 //#if defined(USE_UART)
-//					Log_info0("ACCEL X out of bound ");
+//				Log_info0("ACCEL X out of bound ");
 //#else
-//					System_printf("ACCEL X out of bound\n");
-//					System_flush();
+//				System_printf("ACCEL X out of bound\n");
+//				System_flush();
 //#endif
-//				}
+//			}
 //
-//				if(accel_range_mask & Y_AXIS_STATE_MASK)
-//				{
+//			if(accel_range_mask & Y_AXIS_STATE_MASK)
+//			{
 //#if defined(USE_UART)
-//					Log_info0("ACCEL Y out of bound ");
+//				Log_info0("ACCEL Y out of bound ");
 //#else
-//					System_printf("ACCEL Y out of bound\n");
-//					System_flush();
+//				System_printf("ACCEL Y out of bound\n");
+//				System_flush();
 //#endif
-//				}
+//			}
 //
-//				if(accel_range_mask & Z_AXIS_STATE_MASK)
-//				{
+//			if(accel_range_mask & Z_AXIS_STATE_MASK)
+//			{
 //#if defined(USE_UART)
-//					Log_info0("ACCEL Z out of bound ");
+//				Log_info0("ACCEL Z out of bound ");
 //#else
-//					System_printf("ACCEL Z out of bound\n");
-//					System_flush();
+//				System_printf("ACCEL Z out of bound\n");
+//				System_flush();
 //#endif
 //
-//				}
 //			}
-		}
+//		}
+	}
+}
+
+/**
+ * Samples all IMU axes and appends the frame to the pending stream packet. The packet is
+ * handed to the BLE task once the next frame would not fit in the notification payload,
+ * or when a frame arrives off its expected time slot.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void accel_streamSample(void) {
+	uint16_t nowMs = (uint16_t)(timeSync_toShared(timeSync_localUs()) / 1000);
+	uint16_t maxLen;
+	int16_t delta;
+	uint8_t *pFrame;
+
+	if (accelStreamRestart) {
+		accelStreamRestart = 0;
+		accelStreamPktLen = 0;
+		accelMotionCounter = 0;
+	}
+
+	if (!read_MPU_all(&reset_myAccel))
+		return;
+
+	//Frames are stored at fixed spacing, so start a new packet if one slipped
+	if (accelStreamPktLen) {
+		delta = (int16_t)(nowMs - accelStreamLastMs) - accelStreamPeriodMs;
+		if (delta > 1 || delta < -1)
+			accel_streamFlush();
+	}
+	accelStreamLastMs = nowMs;
+
+	if (0 == accelStreamPktLen) {
+		accelStreamPkt[0] = accelStreamSeq;
+		accelStreamPkt[1] = nowMs & 0xFF;
+		accelStreamPkt[2] = nowMs >> 8;
+		accelStreamPkt[3] = accelStreamPeriodMs;
+		accelStreamPktLen = ACCEL_STREAM_HEADER_SIZE;
 	}
+
+	pFrame = &accelStreamPkt[accelStreamPktLen];
+	pFrame[0] = reset_myAccel.ACCEL_X & 0xFF;
+	pFrame[1] = reset_myAccel.ACCEL_X >> 8;
+	pFrame[2] = reset_myAccel.ACCEL_Y & 0xFF;
+	pFrame[3] = reset_myAccel.ACCEL_Y >> 8;
+	pFrame[4] = reset_myAccel.ACCEL_Z & 0xFF;
+	pFrame[5] = reset_myAccel.ACCEL_Z >> 8;
+	pFrame[6] = reset_myAccel.GYRO_X & 0xFF;
+	pFrame[7] = reset_myAccel.GYRO_X >> 8;
+	pFrame[8] = reset_myAccel.GYRO_Y & 0xFF;
+	pFrame[9] = reset_myAccel.GYRO_Y >> 8;
+	pFrame[10] = reset_myAccel.GYRO_Z & 0xFF;
+	pFrame[11] = reset_myAccel.GYRO_Z >> 8;
+	accelStreamPktLen += ACCEL_STREAM_FRAME_SIZE;
+
+	//Payload excludes the 2-byte type/len header added by user_sendAccelPacket
+	maxLen = user_getNotifyPayloadLen();
+	if (maxLen > ACCEL_STREAM_LEN)
+		maxLen = ACCEL_STREAM_LEN;
+	maxLen -= 2;
+
+	if (accelStreamPktLen + ACCEL_STREAM_FRAME_SIZE > maxLen)
+		accel_streamFlush();
 }
 
 /**
- * Clock callback function that runs in SWI context.
+ * Hands the pending stream packet to the BLE task. Only enqueues a message, never blocks.
  *
  * @param 	none
  * @return 	none
  */
-static void accel_SwiFxn(UArg a0) {
-	//Post semaphore to accel_taskFxn
-	Semaphore_post(Semaphore_handle(&accelSemaphore));
+static void accel_streamFlush(void) {
+	if (accelStreamPktLen > ACCEL_STREAM_HEADER_SIZE)
+	{
+		user_sendAccelPacket(accelStreamPkt, accelStreamPktLen, APP_PACKET_TYPE_IMU_STREAM);
+		accelStreamSeq++;
+	}
+	accelStreamPktLen = 0;
 }
 
@@ -2,7 +2,7 @@
 * Application Name:		FlexZone (Application)
 * File Name: 			accelerometer.h
 * Group: 				GroupX - FlexZone
-* Description:			Defines and prototypes for the Accelerometer Thread.
+* Description:			Defines and prototypes for the Accelerometer handler.
  */
 #ifndef ACCELEROMETER_H
 #define ACCELEROMETER_H
@@ -15,6 +15,25 @@
 //**********************************************************************************
 // Required Definitions
 //**********************************************************************************
+//IMU streaming
+#define ACCEL_STREAM_DEFAULT_RATE_HZ		100
+#define ACCEL_STREAM_MIN_RATE_HZ			5
+#define ACCEL_STREAM_MAX_RATE_HZ			200
+#define ACCEL_STREAM_FRAME_SIZE				12	//6 x int16: accel XYZ, gyro XYZ
+#define ACCEL_STREAM_HEADER_SIZE			4	//seq, t0 (2 bytes), dt
+
+/*
+ * IMU stream packet (APP_PACKET_TYPE_IMU_STREAM), after the 2-byte type/len header:
+ *
+ * 	[0]		uint8	sequence number, incremented per packet
+ * 	[1..2]	uint16	timestamp of first frame, shared time in ms (see time_sync.h),
+ * 			low 16 bits (little endian, wraps)
+ * 	[3]		uint8	ms between consecutive frames
+ * 	[4..]	N frames of ACCEL_X, ACCEL_Y, ACCEL_Z, GYRO_X, GYRO_Y, GYRO_Z (int16, little endian)
+ *
+ * Frame i was sampled at t0 + i*dt. N is derived from the packet length.
+ * tools/accel_stream_decode.py decodes captures and reports loss and throughput.
+ */
 
 //**********************************************************************************
 // Global Data Structures
@@ -24,11 +43,22 @@
 // Function Prototypes
 //**********************************************************************************
 /**
- * Creates Accelerometer task running at and configures all required hardware components.
+ * Registers the Accelerometer handler with the application event loop (sched.h). The
+ * I2C bus and the IMU are opened on first use, by the first sample or rest.
  *
  * @param 	none
  * @return 	none
  */
-extern void accel_createTask(void);
+extern void accel_register(void);
+
+/**
+ * Enables or disables raw IMU streaming. While streaming, the accelerometer clock runs
+ * at the stream rate and motion checks are decimated to their normal period.
+ *
+ * @param 	enable		1 to stream, 0 to stop
+ * @param	rateHz		Sample rate, 0 selects ACCEL_STREAM_DEFAULT_RATE_HZ
+ * @return 	none
+ */
+extern void accel_setStreaming(uint8_t enable, uint8_t rateHz);
 
 #endif /* ACCELEROMETER_H */
@@ -0,0 +1,285 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			adv_policy.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the advertising and reconnect policy.
+ * 						Tries to get the last central back within a second after a
+ * 						link drop, then stays easy to find for a while, then backs
+ * 						off to save power.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//XDCtools Header Files
+#include <xdc/runtime/Log.h>
+
+//SYS/BIOS Header Files
+#include <ti/sysbios/knl/Clock.h>
+
+//BLE Stack Header Files
+#include <bcomdef.h>
+#include <gap.h>
+#include "peripheral.h"
+
+//Home brewed Header Files
+#include "adv_policy.h"
+
+//Standard Header Files
+#include <stddef.h>
+#include <string.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define ADV_POLICY_MS_TO_TICKS(ms)			((ms) * (1000 / Clock_tickPeriod))
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+//Clock Structures
+static Clock_Struct advPolicyClock;
+
+static void (*pfnPolicyPost)(void) = NULL;
+
+static Adv_phase phase = ADV_PHASE_FAST;
+static Adv_phase nextPhase = ADV_PHASE_FAST;	//Prepared for the next link drop
+static uint8_t started = 0;						//The GAP role advertised in this phase
+
+//Last central
+static uint8_t peerAddr[B_ADDR_LEN];
+static uint8_t peerAddrType = ADDRTYPE_PUBLIC;
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static void advPolicy_SwiFxn(UArg a0);
+static void advPolicy_apply(Adv_phase newPhase);
+static void advPolicy_setInterval(uint16_t interval);
+static void advPolicy_enable(uint8_t enable);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Constructs the backoff clock and sets up the fast burst after boot. All advPolicy_*
+ * functions run in the BLE task.
+ *
+ * @param 	pfnPost		Called from the clock Swi, must get advPolicy_evaluate
+ * 						called from the BLE task
+ * @return 	none
+ */
+void advPolicy_init(void (*pfnPost)(void))
+{
+	Clock_Params clockParams;
+	Clock_Params_init(&clockParams);
+	clockParams.period = 0;				//One shot
+	clockParams.startFlag = FALSE;
+
+	Clock_construct(&advPolicyClock, advPolicy_SwiFxn, 1, &clockParams);
+	pfnPolicyPost = pfnPost;
+
+	phase = ADV_PHASE_FAST;
+	started = 0;
+	advPolicy_apply(ADV_PHASE_FAST);
+}
+
+/**
+ * A central connected. Prepares the fast burst in case the link drops before bonding.
+ *
+ * @param 	pPeerAddr	Address of the central
+ * @param	addrType	Its address type
+ * @return 	none
+ */
+void advPolicy_connected(const uint8_t *pPeerAddr, uint8_t addrType)
+{
+	Clock_stop(Clock_handle(&advPolicyClock));
+
+	memcpy(peerAddr, pPeerAddr, B_ADDR_LEN);
+	peerAddrType = addrType;
+
+	phase = ADV_PHASE_NONE;
+	nextPhase = ADV_PHASE_FAST;
+	advPolicy_apply(ADV_PHASE_FAST);
+}
+
+/**
+ * The connected central bonded. Prepares directed advertising to it.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void advPolicy_bonded(void)
+{
+	if (phase != ADV_PHASE_NONE)
+		return;
+
+	nextPhase = ADV_PHASE_DIRECTED;
+	advPolicy_apply(ADV_PHASE_DIRECTED);
+}
+
+/**
+ * The link dropped, the prepared phase is running or about to.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void advPolicy_disconnected(void)
+{
+	phase = nextPhase;
+	started = 0;
+	Log_info1("Reconnect: phase %d", (IArg)phase);
+}
+
+/**
+ * The GAP role started advertising.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void advPolicy_advertising(void)
+{
+	started = 1;
+
+	if (ADV_PHASE_FAST == phase) {
+		Clock_Handle hClock = Clock_handle(&advPolicyClock);
+
+		Clock_stop(hClock);
+		Clock_setTimeout(hClock, ADV_POLICY_MS_TO_TICKS(ADV_POLICY_FAST_MS));
+		Clock_start(hClock);
+	}
+}
+
+/**
+ * The GAP role stopped advertising and waits. Moves on from a finished phase and
+ * starts advertising again.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void advPolicy_waiting(void)
+{
+	if (ADV_PHASE_NONE == phase)
+		return;
+
+	//Directed advertising timed out, the central is not around
+	if (started && ADV_PHASE_DIRECTED == phase) {
+		phase = ADV_PHASE_FAST;
+		started = 0;
+		advPolicy_apply(ADV_PHASE_FAST);
+		Log_info0("Reconnect: directed timed out, fast advertising");
+	}
+
+	advPolicy_enable(TRUE);
+}
+
+/**
+ * Switches the interval for non-connectable advertising while connected, and back.
+ *
+ * @param 	on			1 while broadcasting during a connection
+ * @return 	none
+ */
+void advPolicy_setBroadcasting(uint8_t on)
+{
+	if (on)
+		advPolicy_setInterval(ADV_POLICY_BCAST_INT);
+	else
+		advPolicy_apply(nextPhase);
+}
+
+/**
+ * The fast burst is over, backs off to the slow interval.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void advPolicy_evaluate(void)
+{
+	uint8_t state;
+
+	if (ADV_PHASE_FAST != phase)
+		return;
+
+	phase = ADV_PHASE_SLOW;
+	started = 0;
+	advPolicy_apply(ADV_PHASE_SLOW);
+	Log_info0("Reconnect: backing off to slow advertising");
+
+	//A new interval needs advertising restarted. Stopping lands in advPolicy_waiting,
+	//which starts it again.
+	GAPRole_GetParameter(GAPROLE_STATE, &state);
+	if (GAPROLE_ADVERTISING == state)
+		advPolicy_enable(FALSE);
+	else
+		advPolicy_enable(TRUE);
+}
+
+/**
+ * Current phase.
+ *
+ * @param 	none
+ * @return 	ADV_PHASE_*
+ */
+Adv_phase advPolicy_phase(void)
+{
+	return phase;
+}
+
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Clock callback in Swi context, hands over to the BLE task.
+ *
+ * @param 	a0			unused
+ * @return 	none
+ */
+static void advPolicy_SwiFxn(UArg a0)
+{
+	if (pfnPolicyPost)
+		pfnPolicyPost();
+}
+
+/**
+ * Sets the GAP role up for a phase. Used by the next advertising start.
+ *
+ * @param 	newPhase	ADV_PHASE_DIRECTED, _FAST or _SLOW
+ * @return 	none
+ */
+static void advPolicy_apply(Adv_phase newPhase)
+{
+	uint8_t eventType = GAP_ADTYPE_ADV_IND;
+
+	if (ADV_PHASE_DIRECTED == newPhase) {
+		eventType = GAP_ADTYPE_ADV_HDC_DIRECT_IND;
+		GAPRole_SetParameter(GAPROLE_ADV_DIRECT_TYPE, sizeof(uint8_t), &peerAddrType);
+		GAPRole_SetParameter(GAPROLE_ADV_DIRECT_ADDR, B_ADDR_LEN, peerAddr);
+	}
+	GAPRole_SetParameter(GAPROLE_ADV_EVENT_TYPE, sizeof(uint8_t), &eventType);
+
+	//Directed high duty cycle ignores the interval
+	advPolicy_setInterval((ADV_PHASE_SLOW == newPhase) ? ADV_POLICY_SLOW_INT : ADV_POLICY_FAST_INT);
+}
+
+/**
+ * Sets the general discoverable advertising interval.
+ *
+ * @param 	interval	0.625 ms units
+ * @return 	none
+ */
+static void advPolicy_setInterval(uint16_t interval)
+{
+	GAP_SetParamValue(TGAP_GEN_DISC_ADV_INT_MIN, interval);
+	GAP_SetParamValue(TGAP_GEN_DISC_ADV_INT_MAX, interval);
+}
+
+/**
+ * Enables or disables connectable advertising.
+ *
+ * @param 	enable		TRUE or FALSE
+ * @return 	none
+ */
+static void advPolicy_enable(uint8_t enable)
+{
+	GAPRole_SetParameter(GAPROLE_ADVERT_ENABLED, sizeof(uint8_t), &enable);
+}
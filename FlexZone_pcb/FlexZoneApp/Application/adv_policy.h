@@ -0,0 +1,120 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			adv_policy.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the advertising and reconnect policy.
+ */
+#ifndef ADV_POLICY_H
+#define ADV_POLICY_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+//Advertising intervals in 0.625 ms
+#define ADV_POLICY_FAST_INT					32		//20 ms
+#define ADV_POLICY_SLOW_INT					1636	//1022.5 ms, found quickly by phones
+#define ADV_POLICY_BCAST_INT				320		//200 ms, non-connectable must be >= 100 ms
+
+//How long the fast burst lasts before backing off
+#define ADV_POLICY_FAST_MS					30000
+
+/*
+ * After boot:			fast undirected for ADV_POLICY_FAST_MS, then slow.
+ * After a link drop:	high duty cycle directed advertising to the central if it
+ * 						bonded (the controller ends it after 1.28 s), then the fast
+ * 						burst, then slow.
+ * The parameters for the next phase are set before they are needed, so the GAP role
+ * restarts advertising with them the moment the link drops.
+ */
+typedef enum {
+	ADV_PHASE_NONE = 0,				//Connected
+	ADV_PHASE_DIRECTED,
+	ADV_PHASE_FAST,
+	ADV_PHASE_SLOW
+} Adv_phase;
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Constructs the backoff clock and sets up the fast burst after boot. All advPolicy_*
+ * functions run in the BLE task.
+ *
+ * @param 	pfnPost		Called from the clock Swi, must get advPolicy_evaluate
+ * 						called from the BLE task
+ * @return 	none
+ */
+extern void advPolicy_init(void (*pfnPost)(void));
+
+/**
+ * A central connected. Prepares the fast burst in case the link drops before bonding.
+ *
+ * @param 	pPeerAddr	Address of the central
+ * @param	addrType	Its address type
+ * @return 	none
+ */
+extern void advPolicy_connected(const uint8_t *pPeerAddr, uint8_t addrType);
+
+/**
+ * The connected central bonded. Prepares directed advertising to it.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void advPolicy_bonded(void);
+
+/**
+ * The link dropped, the prepared phase is running or about to.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void advPolicy_disconnected(void);
+
+/**
+ * The GAP role started advertising.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void advPolicy_advertising(void);
+
+/**
+ * The GAP role stopped advertising and waits. Moves on from a finished phase and
+ * starts advertising again.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void advPolicy_waiting(void);
+
+/**
+ * Switches the interval for non-connectable advertising while connected, and back.
+ *
+ * @param 	on			1 while broadcasting during a connection
+ * @return 	none
+ */
+extern void advPolicy_setBroadcasting(uint8_t on);
+
+/**
+ * The fast burst is over, backs off to the slow interval.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void advPolicy_evaluate(void);
+
+/**
+ * Current phase.
+ *
+ * @param 	none
+ * @return 	ADV_PHASE_*
+ */
+extern Adv_phase advPolicy_phase(void);
+
+#endif /* ADV_POLICY_H */
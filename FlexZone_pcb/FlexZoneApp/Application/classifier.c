@@ -0,0 +1,206 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			classifier.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the on-device int8 exercise classifier.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//SYS/BIOS Header Files
+#include <ti/sysbios/hal/Hwi.h>
+
+#ifdef CLASSIFIER_BENCH
+//CC26XXWARE Header Files
+#include <inc/hw_types.h>
+#include <inc/hw_memmap.h>
+#include <inc/hw_cpu_dwt.h>
+#include <inc/hw_cpu_scs.h>
+#endif //CLASSIFIER_BENCH
+
+//Home brewed Header Files
+#include "classifier.h"
+#include "classifier_model.h"
+#ifdef CLASSIFIER_BENCH
+#include "trace.h"
+#endif //CLASSIFIER_BENCH
+
+//Standard Header Files
+#include <stdint.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+//Feature quantisation, chosen so a typical lift uses most of the int8 range
+#define CLASSIFIER_ACCEL_SHIFT				8	//+-2g full scale -> +-64 per g
+#define CLASSIFIER_GYRO_SHIFT				8	//+-250dps full scale -> ~2dps per step
+#define CLASSIFIER_EMG_SHIFT				5	//12-bit ADC -> 0..127
+#define CLASSIFIER_WIDTH_SHIFT				4	//16ms per step, saturates at ~2s
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+//Feature window, written by the event loop task, read and cleared by the EMG task,
+//which preempts it, so only touched with interrupts off
+static int32_t accelSum[3];
+static uint32_t gyroAbsSum[3];
+static uint16_t sampleCount;
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static int8_t saturate8(int32_t value);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Clears the IMU feature window. Called when a set starts.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void classifier_reset(void)
+{
+	uint8_t i;
+	UInt key;
+
+	key = Hwi_disable();
+	for (i = 0; i < 3; i++) {
+		accelSum[i] = 0;
+		gyroAbsSum[i] = 0;
+	}
+	sampleCount = 0;
+	Hwi_restore(key);
+}
+
+/**
+ * Adds one IMU sample to the feature window. Called from the event loop task.
+ *
+ * @param 	sample		Accel/gyro reading
+ * @return 	none
+ */
+void classifier_addImuSample(const Accel_State *sample)
+{
+	int16_t gx = (int16_t)sample->GYRO_X;
+	int16_t gy = (int16_t)sample->GYRO_Y;
+	int16_t gz = (int16_t)sample->GYRO_Z;
+	UInt key;
+
+	key = Hwi_disable();
+	if (sampleCount < 0xFFFF) {
+		accelSum[0] += (int16_t)sample->ACCEL_X;
+		accelSum[1] += (int16_t)sample->ACCEL_Y;
+		accelSum[2] += (int16_t)sample->ACCEL_Z;
+		gyroAbsSum[0] += (gx < 0) ? -gx : gx;
+		gyroAbsSum[1] += (gy < 0) ? -gy : gy;
+		gyroAbsSum[2] += (gz < 0) ? -gz : gz;
+		sampleCount++;
+	}
+	Hwi_restore(key);
+}
+
+/**
+ * Quantises a consistent copy of the window plus the EMG features of the first rep
+ * into the model inputs. The host training tool uses it too, so both see the same
+ * features.
+ *
+ * @param 	peakIntensity	EMG peak of the rep (12-bit ADC counts)
+ * @param	pulseWidth		EMG pulse width of the rep in ms
+ * @param	pX				Returns CLASSIFIER_NUM_FEATURES inputs
+ * @return 	1 on success, 0 if there were no IMU samples.
+ */
+uint8_t classifier_features(uint16_t peakIntensity, uint16_t pulseWidth, int8_t *pX)
+{
+	int32_t accel[3];
+	uint32_t gyro[3];
+	uint16_t count;
+	uint8_t i;
+	UInt key;
+
+	key = Hwi_disable();
+	for (i = 0; i < 3; i++) {
+		accel[i] = accelSum[i];
+		gyro[i] = gyroAbsSum[i];
+	}
+	count = sampleCount;
+	Hwi_restore(key);
+
+	if (0 == count)
+		return 0;
+
+	for (i = 0; i < 3; i++) {
+		pX[i] = saturate8((accel[i] / count) >> CLASSIFIER_ACCEL_SHIFT);
+		pX[3 + i] = saturate8((gyro[i] / count) >> CLASSIFIER_GYRO_SHIFT);
+	}
+	pX[6] = saturate8(peakIntensity >> CLASSIFIER_EMG_SHIFT);
+	pX[7] = saturate8(pulseWidth >> CLASSIFIER_WIDTH_SHIFT);
+	return 1;
+}
+
+/**
+ * Quantises the window plus the EMG features of the first rep and runs the model.
+ * With CLASSIFIER_BENCH defined it traces the DWT cycles of every call.
+ *
+ * @param 	peakIntensity	EMG peak of the rep (12-bit ADC counts)
+ * @param	pulseWidth		EMG pulse width of the rep in ms
+ * @return 	EXERCISE_* id, EXERCISE_UNKNOWN if there were no IMU samples or no class scored high enough.
+ */
+uint8_t classifier_run(uint16_t peakIntensity, uint16_t pulseWidth)
+{
+	int8_t x[CLASSIFIER_NUM_FEATURES];
+	int8_t h[CLASSIFIER_NUM_HIDDEN];
+	int32_t acc, best = 0;
+	uint8_t i, j, bestClass = EXERCISE_UNKNOWN;
+#ifdef CLASSIFIER_BENCH
+	uint32_t start;
+
+	HWREG(CPU_SCS_BASE + CPU_SCS_O_DEMCR) |= CPU_SCS_DEMCR_TRCENA;
+	HWREG(CPU_DWT_BASE + CPU_DWT_O_CTRL) |= CPU_DWT_CTRL_CYCCNTENA;
+	start = HWREG(CPU_DWT_BASE + CPU_DWT_O_CYCCNT);
+#endif //CLASSIFIER_BENCH
+
+	if (!classifier_features(peakIntensity, pulseWidth, x))
+		return EXERCISE_UNKNOWN;
+
+	//Hidden layer, ReLU folded into the requantisation clamp
+	for (j = 0; j < CLASSIFIER_NUM_HIDDEN; j++) {
+		acc = classifierB1[j];
+		for (i = 0; i < CLASSIFIER_NUM_FEATURES; i++)
+			acc += classifierW1[j][i] * x[i];
+		acc >>= CLASSIFIER_L1_SHIFT;
+		h[j] = (acc < 0) ? 0 : saturate8(acc);
+	}
+
+	//Output layer, only the arg max is needed
+	for (j = 0; j < CLASSIFIER_NUM_CLASSES; j++) {
+		acc = classifierB2[j];
+		for (i = 0; i < CLASSIFIER_NUM_HIDDEN; i++)
+			acc += classifierW2[j][i] * h[i];
+		if (acc >= CLASSIFIER_MIN_SCORE && acc > best) {
+			best = acc;
+			bestClass = j;
+		}
+	}
+
+#ifdef CLASSIFIER_BENCH
+	TRACE_INFO2(TRACE_CLASSIFIER_CYCLES, HWREG(CPU_DWT_BASE + CPU_DWT_O_CYCCNT) - start, bestClass);
+#endif //CLASSIFIER_BENCH
+	return bestClass;
+}
+
+/**
+ * Clamps a value to the int8 range.
+ *
+ * @param 	value
+ * @return 	value saturated to [-128, 127]
+ */
+static int8_t saturate8(int32_t value)
+{
+	if (value > 127)
+		return 127;
+	if (value < -128)
+		return -128;
+	return (int8_t)value;
+}
@@ -0,0 +1,73 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			classifier.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the on-device int8 exercise classifier.
+ */
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define CLASSIFIER_NUM_FEATURES				8
+#define CLASSIFIER_NUM_HIDDEN				8
+#define CLASSIFIER_NUM_CLASSES				4
+
+#define EXERCISE_BICEP_CURL					0
+#define EXERCISE_SHOULDER_PRESS				1
+#define EXERCISE_SQUAT						2
+#define EXERCISE_ROW						3
+#define EXERCISE_UNKNOWN					0xFF
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Clears the IMU feature window. Called when a set starts.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void classifier_reset(void);
+
+/**
+ * Adds one IMU sample to the feature window. Called from the event loop task.
+ *
+ * @param 	sample		Accel/gyro reading
+ * @return 	none
+ */
+extern void classifier_addImuSample(const Accel_State *sample);
+
+/**
+ * Quantises a consistent copy of the window plus the EMG features of the first rep
+ * into the model inputs. The host training tool uses it too, so both see the same
+ * features.
+ *
+ * @param 	peakIntensity	EMG peak of the rep (12-bit ADC counts)
+ * @param	pulseWidth		EMG pulse width of the rep in ms
+ * @param	pX				Returns CLASSIFIER_NUM_FEATURES inputs
+ * @return 	1 on success, 0 if there were no IMU samples.
+ */
+extern uint8_t classifier_features(uint16_t peakIntensity, uint16_t pulseWidth, int8_t *pX);
+
+/**
+ * Quantises the window plus the EMG features of the first rep and runs the model.
+ * Uses no heap and about 80 bytes of stack; 96 MACs per call.
+ *
+ * @param 	peakIntensity	EMG peak of the rep (12-bit ADC counts)
+ * @param	pulseWidth		EMG pulse width of the rep in ms
+ * @return 	EXERCISE_* id, EXERCISE_UNKNOWN if there were no IMU samples or no class scored high enough.
+ */
+extern uint8_t classifier_run(uint16_t peakIntensity, uint16_t pulseWidth);
+
+#endif /* CLASSIFIER_H */
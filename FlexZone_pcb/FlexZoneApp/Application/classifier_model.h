@@ -0,0 +1,46 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			classifier_model.h
+* Group: 				GroupX - FlexZone
+* Description:			Weight tables for the int8 exercise classifier.
+*
+* Layout is an 8-8-4 MLP: hidden = clamp((W1*x + B1) >> CLASSIFIER_L1_SHIFT, 0, 127),
+* scores = W2*hidden + B2. Inputs are the quantised features described in classifier.c.
+*
+* Generated by tools/host/classifier_train from 800 generated windows (--synth),
+* a stand-in until recorded sets exist; do not edit.
+* tools/host/classifier_bench reports its accuracy and cost.
+ */
+#ifndef CLASSIFIER_MODEL_H
+#define CLASSIFIER_MODEL_H
+
+#include <stdint.h>
+#include "classifier.h"
+
+#define CLASSIFIER_L1_SHIFT					7
+#define CLASSIFIER_MIN_SCORE				4086
+
+//Feature order: accel X/Y/Z mean, gyro X/Y/Z mean magnitude, EMG peak, pulse width
+static const int8_t classifierW1[CLASSIFIER_NUM_HIDDEN][CLASSIFIER_NUM_FEATURES] = {
+		{   -6,  -16,   19,  -19,   -1,  -32,  -26,   -9 },
+		{  127,   44,  -51,   39,   41,   81,  -11,  -16 },
+		{   65,   -8,  -24,   79,   31,   46,   35,   24 },
+		{  -54,   28,  -55,  -41,   16,   -2,   19,   25 },
+		{  -79,   46,   -4,  -87,  -23,  -70,   13,    8 },
+		{   -2,   12,   18,   24,    3,   -2,  -16,  -15 },
+		{   22,  -45,  108,   51,  -20,   38,    5,   22 },
+		{  -73,    3,  102,  -29,  -35,  -59,    1,   -7 },
+};
+
+static const int32_t classifierB1[CLASSIFIER_NUM_HIDDEN] = { -81, 851, 1328, 159, 878, -91, 2670, 2053 };
+
+static const int8_t classifierW2[CLASSIFIER_NUM_CLASSES][CLASSIFIER_NUM_HIDDEN] = {
+		{    8,  -12,  -43,   -3,   77,  -11,  -20,   78 },		//EXERCISE_BICEP_CURL
+		{    1,   66,   47,  -32,  -93,    8,  -40,  -28 },		//EXERCISE_SHOULDER_PRESS
+		{   -6, -127,   18,   71,   17,   14,  -52, -113 },		//EXERCISE_SQUAT
+		{   -4,  -31,   28,  -60,  -71,  -12,   47,   22 },		//EXERCISE_ROW
+};
+
+static const int32_t classifierB2[CLASSIFIER_NUM_CLASSES] = { -181, 208, -89, 74 };
+
+#endif /* CLASSIFIER_MODEL_H */
@@ -0,0 +1,296 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			conn_policy.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the connection parameter policy.
+ * 						Picks an interval for what the device is doing and asks
+ * 						the central for it, at most once per CONN_POLICY_MIN_SPACING_MS.
+ * 						A request the central ignores is repeated with a wider
+ * 						interval range, then given up until the level changes.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//XDCtools Header Files
+#include <xdc/runtime/Log.h>
+
+//SYS/BIOS Header Files
+#include <ti/sysbios/knl/Clock.h>
+
+//BLE Stack Header Files
+#include <bcomdef.h>
+#include "peripheral.h"
+
+//Home brewed Header Files
+#include "conn_policy.h"
+
+//Standard Header Files
+#include <stddef.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define CONN_POLICY_MS_TO_TICKS(ms)			((ms) * (1000 / Clock_tickPeriod))
+#define CONN_POLICY_MAX_INTERVAL			0x0C80	//4 s, BLE limit
+#define CONN_POLICY_MAX_TIMEOUT				0x0C80	//32 s, BLE limit
+
+//Shortest supervision timeout (10 ms) the spec allows for a max interval (1.25 ms)
+//and latency: timeout > (1 + latency) * interval * 2
+#define CONN_POLICY_MIN_TIMEOUT(maxInt, latency)	((((uint32_t)(latency) + 1) * (maxInt)) / 4 + 1)
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+typedef struct {
+	uint16_t minInt;
+	uint16_t maxInt;
+	uint16_t latency;
+	uint16_t timeout;
+} Conn_params;
+
+static const Conn_params levelParams[] = {
+	{ CONN_POLICY_IDLE_MIN_INT, CONN_POLICY_IDLE_MAX_INT, CONN_POLICY_IDLE_LATENCY, CONN_POLICY_IDLE_TIMEOUT },
+	{ CONN_POLICY_SET_MIN_INT, CONN_POLICY_SET_MAX_INT, CONN_POLICY_SET_LATENCY, CONN_POLICY_SET_TIMEOUT },
+	{ CONN_POLICY_STREAM_MIN_INT, CONN_POLICY_STREAM_MAX_INT, CONN_POLICY_STREAM_LATENCY, CONN_POLICY_STREAM_TIMEOUT },
+};
+
+//Clock Structures
+static Clock_Struct connPolicyClock;
+
+static void (*pfnPolicyPost)(void) = NULL;
+
+static uint8_t connected = 0;
+static uint8_t activities = 0;
+static uint16_t curInterval = 0;
+static uint16_t curLatency = 0;
+
+static Conn_level requestedLevel = CONN_LEVEL_NONE;
+static uint8_t attempts = 0;
+static uint32_t lastRequestTicks = 0;
+static uint8_t haveRequested = 0;
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static void connPolicy_SwiFxn(UArg a0);
+static Conn_level connPolicy_level(void);
+static void connPolicy_retryIn(uint32_t ms);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Constructs the retry clock. All connPolicy_* functions run in the BLE task.
+ *
+ * @param 	pfnPost		Called from the clock Swi, must get connPolicy_evaluate
+ * 						called from the BLE task
+ * @return 	none
+ */
+void connPolicy_init(void (*pfnPost)(void))
+{
+	Clock_Params clockParams;
+	Clock_Params_init(&clockParams);
+	clockParams.period = 0;				//One shot
+	clockParams.startFlag = FALSE;
+
+	Clock_construct(&connPolicyClock, connPolicy_SwiFxn, 1, &clockParams);
+	pfnPolicyPost = pfnPost;
+}
+
+/**
+ * Starts applying the policy to a new connection.
+ *
+ * @param 	interval	Current interval, 1.25 ms
+ * @param	latency		Current slave latency
+ * @return 	none
+ */
+void connPolicy_connected(uint16_t interval, uint16_t latency)
+{
+	connected = 1;
+	curInterval = interval;
+	curLatency = latency;
+	requestedLevel = CONN_LEVEL_NONE;
+	attempts = 0;
+	haveRequested = 0;
+
+	connPolicy_evaluate();
+}
+
+/**
+ * Stops requesting updates, the connection is gone.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void connPolicy_disconnected(void)
+{
+	connected = 0;
+	Clock_stop(Clock_handle(&connPolicyClock));
+}
+
+/**
+ * Marks an activity as started or stopped and re-evaluates the policy.
+ *
+ * @param 	activity	CONN_ACTIVITY_* bits
+ * @param	active		1 started, 0 stopped
+ * @return 	none
+ */
+void connPolicy_setActivity(uint8_t activity, uint8_t active)
+{
+	if (active)
+		activities |= activity;
+	else
+		activities &= ~activity;
+
+	connPolicy_evaluate();
+}
+
+/**
+ * Records parameters applied by the central.
+ *
+ * @param 	interval	New interval, 1.25 ms
+ * @param	latency		New slave latency
+ * @return 	none
+ */
+void connPolicy_paramsUpdated(uint16_t interval, uint16_t latency)
+{
+	curInterval = interval;
+	curLatency = latency;
+
+	Log_info2("Conn params: interval %d x1.25ms, latency %d", (IArg)interval, (IArg)latency);
+	connPolicy_evaluate();
+}
+
+/**
+ * Requests the parameters for the current activities if the link does not have them yet.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void connPolicy_evaluate(void)
+{
+	Conn_level level;
+	const Conn_params *pTarget;
+	uint16_t maxInt, timeout;
+	uint32_t elapsedMs;
+	uint8_t req = TRUE;
+
+	if (!connected)
+		return;
+
+	level = connPolicy_level();
+	pTarget = &levelParams[level];
+
+	if (level != requestedLevel) {
+		requestedLevel = level;
+		attempts = 0;
+	}
+
+	//Each failed attempt doubles the accepted max interval
+	maxInt = pTarget->maxInt << attempts;
+	if (maxInt > CONN_POLICY_MAX_INTERVAL)
+		maxInt = CONN_POLICY_MAX_INTERVAL;
+	//Keep the widened interval within what the longest timeout covers with latency
+	if (CONN_POLICY_MIN_TIMEOUT(maxInt, pTarget->latency) > CONN_POLICY_MAX_TIMEOUT)
+		maxInt = ((uint32_t)CONN_POLICY_MAX_TIMEOUT - 1) * 4 / (pTarget->latency + 1);
+
+	//The level's timeout, longer if the widened interval needs it
+	timeout = pTarget->timeout;
+	if (timeout < CONN_POLICY_MIN_TIMEOUT(maxInt, pTarget->latency))
+		timeout = CONN_POLICY_MIN_TIMEOUT(maxInt, pTarget->latency);
+
+	//Close enough: anything between the level's min and the widened max
+	if (curInterval >= pTarget->minInt && curInterval <= maxInt) {
+		Clock_stop(Clock_handle(&connPolicyClock));
+		return;
+	}
+
+	if (attempts >= CONN_POLICY_MAX_ATTEMPTS) {
+		//Central keeps refusing, live with its choice until the level changes
+		Clock_stop(Clock_handle(&connPolicyClock));
+		return;
+	}
+
+	//Rate limit
+	if (haveRequested) {
+		elapsedMs = (Clock_getTicks() - lastRequestTicks) / CONN_POLICY_MS_TO_TICKS(1);
+		if (elapsedMs < CONN_POLICY_MIN_SPACING_MS) {
+			connPolicy_retryIn(CONN_POLICY_MIN_SPACING_MS - elapsedMs);
+			return;
+		}
+	}
+
+	GAPRole_SetParameter(GAPROLE_MIN_CONN_INTERVAL, sizeof(uint16_t), (void *)&pTarget->minInt);
+	GAPRole_SetParameter(GAPROLE_MAX_CONN_INTERVAL, sizeof(uint16_t), &maxInt);
+	GAPRole_SetParameter(GAPROLE_SLAVE_LATENCY, sizeof(uint16_t), (void *)&pTarget->latency);
+	GAPRole_SetParameter(GAPROLE_TIMEOUT_MULTIPLIER, sizeof(uint16_t), &timeout);
+
+	if (GAPRole_SetParameter(GAPROLE_PARAM_UPDATE_REQ, sizeof(uint8_t), &req) == SUCCESS) {
+		Log_info3("Conn param request: level %d, %d-%d x1.25ms", (IArg)level,
+				  (IArg)pTarget->minInt, (IArg)maxInt);
+		attempts++;
+		haveRequested = 1;
+		lastRequestTicks = Clock_getTicks();
+		//Check the result, widen the range if the central ignored it
+		connPolicy_retryIn(CONN_POLICY_RESPONSE_MS);
+	}
+	else {
+		//Previous procedure still running, try again later
+		connPolicy_retryIn(CONN_POLICY_MIN_SPACING_MS);
+	}
+}
+
+/**
+ * Interval the link runs at.
+ *
+ * @param 	none
+ * @return 	Interval, 1.25 ms, 0 while not connected
+ */
+uint16_t connPolicy_getInterval(void)
+{
+	return connected ? curInterval : 0;
+}
+
+/**
+ * Level for the current activities.
+ *
+ * @param 	none
+ * @return 	CONN_LEVEL_*
+ */
+static Conn_level connPolicy_level(void)
+{
+	if (activities & (CONN_ACTIVITY_STREAM | CONN_ACTIVITY_EMG_STREAM | CONN_ACTIVITY_SYNC))
+		return CONN_LEVEL_STREAM;
+	if (activities & CONN_ACTIVITY_SET)
+		return CONN_LEVEL_SET;
+	return CONN_LEVEL_IDLE;
+}
+
+/**
+ * Arms the one shot clock to re-evaluate later.
+ *
+ * @param 	ms			Delay
+ * @return 	none
+ */
+static void connPolicy_retryIn(uint32_t ms)
+{
+	Clock_Handle hClock = Clock_handle(&connPolicyClock);
+	uint32_t ticks = CONN_POLICY_MS_TO_TICKS(ms);
+
+	Clock_stop(hClock);
+	Clock_setTimeout(hClock, (ticks > 0) ? ticks : 1);
+	Clock_start(hClock);
+}
+
+/**
+ * Retry clock expired, hand the evaluation to the BLE task.
+ *
+ * @param 	a0			unused
+ * @return 	none
+ */
+static void connPolicy_SwiFxn(UArg a0)
+{
+	if (pfnPolicyPost != NULL)
+		pfnPolicyPost();
+}
@@ -0,0 +1,116 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			conn_policy.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the connection parameter policy.
+ */
+#ifndef CONN_POLICY_H
+#define CONN_POLICY_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+//Connection parameters per level. Intervals in 1.25 ms, timeouts in 10 ms.
+//Streaming: as many notifications per second as the link allows
+#define CONN_POLICY_STREAM_MIN_INT			6		//7.5 ms
+#define CONN_POLICY_STREAM_MAX_INT			12		//15 ms
+#define CONN_POLICY_STREAM_LATENCY			0
+#define CONN_POLICY_STREAM_TIMEOUT			200		//2 s
+//Set in progress: rep events and summaries arrive within ~50 ms
+#define CONN_POLICY_SET_MIN_INT				24		//30 ms
+#define CONN_POLICY_SET_MAX_INT				40		//50 ms
+#define CONN_POLICY_SET_LATENCY				0
+#define CONN_POLICY_SET_TIMEOUT				300		//3 s
+//Idle or resting: wake rarely, skip empty connection events
+#define CONN_POLICY_IDLE_MIN_INT			80		//100 ms
+#define CONN_POLICY_IDLE_MAX_INT			160		//200 ms
+#define CONN_POLICY_IDLE_LATENCY			4
+#define CONN_POLICY_IDLE_TIMEOUT			600		//6 s
+
+//Rate limiting and fallback
+#define CONN_POLICY_MIN_SPACING_MS			5000	//Between two requests
+#define CONN_POLICY_RESPONSE_MS				8000	//Wait for the central to apply a request
+#define CONN_POLICY_MAX_ATTEMPTS			3		//Requests per level, max interval doubles each time
+
+//Activities, bit mask. The highest one active picks the level.
+#define CONN_ACTIVITY_STREAM				0x01	//IMU streaming
+#define CONN_ACTIVITY_SYNC					0x02	//Bulk transfer
+#define CONN_ACTIVITY_SET					0x04	//Set in progress
+#define CONN_ACTIVITY_EMG_STREAM			0x08	//Raw EMG streaming
+
+typedef enum {
+	CONN_LEVEL_IDLE = 0,
+	CONN_LEVEL_SET,
+	CONN_LEVEL_STREAM,
+	CONN_LEVEL_NONE = 0xFF			//Nothing requested yet
+} Conn_level;
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Constructs the retry clock. All connPolicy_* functions run in the BLE task.
+ *
+ * @param 	pfnPost		Called from the clock Swi, must get connPolicy_evaluate
+ * 						called from the BLE task
+ * @return 	none
+ */
+extern void connPolicy_init(void (*pfnPost)(void));
+
+/**
+ * Starts applying the policy to a new connection.
+ *
+ * @param 	interval	Current interval, 1.25 ms
+ * @param	latency		Current slave latency
+ * @return 	none
+ */
+extern void connPolicy_connected(uint16_t interval, uint16_t latency);
+
+/**
+ * Stops requesting updates, the connection is gone.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void connPolicy_disconnected(void);
+
+/**
+ * Marks an activity as started or stopped and re-evaluates the policy.
+ *
+ * @param 	activity	CONN_ACTIVITY_* bits
+ * @param	active		1 started, 0 stopped
+ * @return 	none
+ */
+extern void connPolicy_setActivity(uint8_t activity, uint8_t active);
+
+/**
+ * Records parameters applied by the central.
+ *
+ * @param 	interval	New interval, 1.25 ms
+ * @param	latency		New slave latency
+ * @return 	none
+ */
+extern void connPolicy_paramsUpdated(uint16_t interval, uint16_t latency);
+
+/**
+ * Requests the parameters for the current activities if the link does not have them yet.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void connPolicy_evaluate(void);
+
+/**
+ * Interval the link runs at.
+ *
+ * @param 	none
+ * @return 	Interval, 1.25 ms, 0 while not connected
+ */
+extern uint16_t connPolicy_getInterval(void);
+
+#endif /* CONN_POLICY_H */
@@ -0,0 +1,540 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			diag.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the runtime diagnostics counters.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//XDCtools Header Files
+#include <xdc/runtime/Timestamp.h>
+#include <xdc/runtime/Types.h>
+
+//SYS/BIOS Header Files
+#include <ti/sysbios/hal/Hwi.h>
+
+//CC26XXWARE Header Files
+#include <driverlib/aon_rtc.h>
+
+//BLE Stack Header Files
+#include <bcomdef.h>
+#include <ICall.h>
+
+//Home brewed Header Files
+#include "diag.h"
+#include "msg_pool.h"
+#include "trace.h"
+
+//Standard Header Files
+#include <string.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define DIAG_US_MAX							0xFFFF
+#define DIAG_COUNT_MAX						0xFFFF
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+typedef struct {
+	uint16_t minUs;
+	uint16_t maxUs;
+	uint64_t sumUs;						//Cannot overflow before count does
+	uint32_t count;						//Measurements in sumUs
+	uint16_t hist[DIAG_HIST_BUCKETS];
+} Diag_timerStats;
+
+typedef struct {
+	uint16_t stackSize[DIAG_NUM_TASKS];
+	uint16_t stackUsed[DIAG_NUM_TASKS];
+	uint16_t sysStackSize;
+	uint16_t sysStackUsed;
+	uint16_t heapSize;
+	uint16_t heapInUse;
+	uint16_t heapPeak;
+	uint16_t allocFailures;
+} Diag_memory;
+
+//Written from Hwi, Swi and Task context, so only touched with interrupts off
+static Diag_timerStats timers[DIAG_NUM_TIMERS];
+static uint16_t counters[DIAG_NUM_COUNTERS];
+static uint16_t allocFailures = 0;
+
+//ms since boot, written once per phase
+static uint32_t bootMs[DIAG_NUM_BOOT_PHASES];
+
+//Registered before BIOS_start, read only after
+static Task_Handle tasks[DIAG_NUM_TASKS];
+
+//Timestamp ticks to us. The CC26xx timestamp runs off the RTC, slower than 1 MHz,
+//so the slow case is a Q16 multiplier.
+static uint32_t ticksPerUs = 0;		//0 - use usPerTickQ16
+static uint32_t usPerTickQ16 = 0;
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static uint16_t ticksToUs(uint32_t ticks);
+static uint8_t histBucket(uint16_t us);
+static uint8_t *put16(uint8_t *p, uint16_t value);
+static uint8_t *putTimer(uint8_t *p, const Diag_timerStats *pTimer);
+static void heapMetrics(uint16_t *pInUse, uint16_t *pPeak);
+static void collectMemory(Diag_memory *pMem);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Reads the timestamp frequency. Call once before the first diag_timerUs.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void diag_init(void)
+{
+	Types_FreqHz freq;
+
+	Timestamp_getFreq(&freq);
+	if (freq.lo >= 1000000)
+	{
+		ticksPerUs = freq.lo / 1000000;
+	}
+	else if (freq.lo)
+	{
+		ticksPerUs = 0;
+		usPerTickQ16 = (uint32_t)((1000000ULL << 16) / freq.lo);
+	}
+
+	diag_reset();
+}
+
+/**
+ * Adds one measurement to a timer. Safe from Hwi, Swi and Task context.
+ *
+ * @param 	timer		DIAG_TIMER_*
+ * @param	ticks		Duration in Timestamp_get32 ticks
+ * @return 	Duration in us, 0xFFFF if longer.
+ */
+uint16_t diag_timerUs(Diag_timer timer, uint32_t ticks)
+{
+	Diag_timerStats *pTimer = &timers[timer];
+	uint16_t us = ticksToUs(ticks);
+	uint8_t bucket = histBucket(us);
+	UInt key;
+
+	key = Hwi_disable();
+	if (us < pTimer->minUs)
+		pTimer->minUs = us;
+	if (us > pTimer->maxUs)
+		pTimer->maxUs = us;
+
+	//Halving both keeps the mean when the count would overflow
+	if (pTimer->count == 0xFFFFFFFF)
+	{
+		pTimer->sumUs >>= 1;
+		pTimer->count >>= 1;
+	}
+	pTimer->sumUs += us;
+	pTimer->count++;
+
+	if (pTimer->hist[bucket] < DIAG_COUNT_MAX)
+		pTimer->hist[bucket]++;
+	Hwi_restore(key);
+
+	return us;
+}
+
+/**
+ * Counts one event. Safe from Hwi, Swi and Task context.
+ *
+ * @param 	counter		DIAG_*
+ * @return 	none
+ */
+void diag_count(Diag_counter counter)
+{
+	UInt key;
+
+	key = Hwi_disable();
+	if (counters[counter] < DIAG_COUNT_MAX)
+		counters[counter]++;
+	Hwi_restore(key);
+}
+
+/**
+ * Records when a boot phase is first reached. Later calls for the same phase are
+ * ignored. Safe from Hwi, Swi and Task context, also before diag_init.
+ *
+ * @param 	phase		DIAG_BOOT_*
+ * @return 	none
+ */
+void diag_bootMark(Diag_bootPhase phase)
+{
+	uint64_t rtc;
+	uint32_t ms;
+	UInt key;
+
+	if (bootMs[phase])
+		return;
+
+	rtc = AONRTCCurrent64BitValueGet();		//32.32 seconds
+	ms = (uint32_t)((rtc * 1000) >> 32);
+
+	if (0 == ms)
+		ms = 1;		//0 is not reached yet
+
+	key = Hwi_disable();
+	if (bootMs[phase])
+	{
+		Hwi_restore(key);
+		return;
+	}
+	bootMs[phase] = ms;
+	Hwi_restore(key);
+
+	TRACE_INFO2(TRACE_BOOT_PHASE, phase, ms);
+}
+
+/**
+ * Adds a task to the memory report. Called where the task is constructed, before
+ * BIOS_start.
+ *
+ * @param 	task		DIAG_TASK_*
+ * @param	hTask		Constructed task
+ * @return 	none
+ */
+void diag_addTask(Diag_task task, Task_Handle hTask)
+{
+	tasks[task] = hTask;
+}
+
+/**
+ * Counts an application allocation from the ICall heap that failed. Safe from Hwi,
+ * Swi and Task context.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void diag_allocFailed(void)
+{
+	UInt key;
+
+	key = Hwi_disable();
+	if (allocFailures < DIAG_COUNT_MAX)
+		allocFailures++;
+	Hwi_restore(key);
+}
+
+/**
+ * Zeros the timers and counters.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void diag_reset(void)
+{
+	uint8_t i;
+	UInt key;
+
+	key = Hwi_disable();
+	memset(timers, 0, sizeof(timers));
+	memset(counters, 0, sizeof(counters));
+	for (i = 0; i < DIAG_NUM_TIMERS; i++)
+		timers[i].minUs = DIAG_US_MAX;
+	Hwi_restore(key);
+}
+
+/**
+ * Copies part of a fresh snapshot. Runs in the BLE stack task for reads and in the
+ * BLE application task for notifications.
+ *
+ * @param 	offset		First byte
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+uint16_t diag_read(uint16_t offset, uint8_t *pDst, uint16_t maxLen)
+{
+	uint8_t value[DIAG_SNAPSHOT_LEN];
+	Diag_timerStats timerCopy[DIAG_NUM_TIMERS];
+	uint16_t counterCopy[DIAG_NUM_COUNTERS];
+	TxQueue_stats txq;
+	MsgPool_stats pool;
+	uint16_t heapInUse, heapPeak;
+	uint32_t uptime = AONRTCSecGet();
+	uint8_t *p = value;
+	uint8_t i;
+	UInt key;
+
+	if (offset >= DIAG_SNAPSHOT_LEN)
+		return 0;
+
+	key = Hwi_disable();
+	memcpy(timerCopy, timers, sizeof(timers));
+	memcpy(counterCopy, counters, sizeof(counters));
+	txq = *user_getTxQueueStats();
+	pool = *msgPool_getStats();
+	Hwi_restore(key);
+
+	heapMetrics(&heapInUse, &heapPeak);
+
+	*p++ = DIAG_VERSION;
+	*p++ = BREAK_UINT32(uptime, 0);
+	*p++ = BREAK_UINT32(uptime, 1);
+	*p++ = BREAK_UINT32(uptime, 2);
+	*p++ = BREAK_UINT32(uptime, 3);
+
+	for (i = 0; i < DIAG_NUM_TIMERS; i++)
+		p = putTimer(p, &timerCopy[i]);
+	for (i = 0; i < DIAG_NUM_COUNTERS; i++)
+		p = put16(p, counterCopy[i]);
+
+	*p++ = txq.depth;
+	*p++ = txq.highWater;
+	p = put16(p, txq.sent);
+	p = put16(p, txq.retries);
+	p = put16(p, txq.drops);
+	p = put16(p, txq.discards);
+
+#ifdef HEAPMGR_SIZE
+	p = put16(p, HEAPMGR_SIZE);
+#else
+	p = put16(p, 0);
+#endif //HEAPMGR_SIZE
+	p = put16(p, heapInUse);
+	p = put16(p, heapPeak);
+
+	for (i = 0; i < MSG_POOL_NUM_CLASSES; i++)
+	{
+		*p++ = pool.cls[i].inUse;
+		*p++ = pool.cls[i].highWater;
+		p = put16(p, pool.cls[i].exhausted);
+	}
+	p = put16(p, pool.heapFallbacks);
+	p = put16(p, pool.failures);
+
+	for (i = 0; i < DIAG_NUM_BOOT_PHASES; i++)
+	{
+		*p++ = BREAK_UINT32(bootMs[i], 0);
+		*p++ = BREAK_UINT32(bootMs[i], 1);
+		*p++ = BREAK_UINT32(bootMs[i], 2);
+		*p++ = BREAK_UINT32(bootMs[i], 3);
+	}
+
+	maxLen = MIN(maxLen, DIAG_SNAPSHOT_LEN - offset);
+	memcpy(pDst, &value[offset], maxLen);
+	return maxLen;
+}
+
+/**
+ * Copies part of a fresh memory report. Runs in the BLE stack task.
+ *
+ * @param 	offset		First byte
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+uint16_t diag_readMemory(uint16_t offset, uint8_t *pDst, uint16_t maxLen)
+{
+	uint8_t value[DIAG_MEMORY_LEN];
+	Diag_memory mem;
+	uint8_t *p = value;
+	uint8_t i;
+
+	if (offset >= DIAG_MEMORY_LEN)
+		return 0;
+
+	collectMemory(&mem);
+
+	*p++ = DIAG_MEMORY_VERSION;
+	*p++ = DIAG_NUM_TASKS;
+	for (i = 0; i < DIAG_NUM_TASKS; i++)
+	{
+		p = put16(p, mem.stackSize[i]);
+		p = put16(p, mem.stackUsed[i]);
+	}
+	p = put16(p, mem.sysStackSize);
+	p = put16(p, mem.sysStackUsed);
+	p = put16(p, mem.heapSize);
+	p = put16(p, mem.heapInUse);
+	p = put16(p, mem.heapPeak);
+	p = put16(p, mem.allocFailures);
+
+	maxLen = MIN(maxLen, DIAG_MEMORY_LEN - offset);
+	memcpy(pDst, &value[offset], maxLen);
+	return maxLen;
+}
+
+/**
+ * Writes the memory report to the UART trace, stacks close to full as warnings.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void diag_traceMemory(void)
+{
+	Diag_memory mem;
+	uint8_t i;
+
+	collectMemory(&mem);
+
+	for (i = 0; i < DIAG_NUM_TASKS; i++)
+	{
+		if (0 == mem.stackSize[i])
+			continue;
+
+		if (mem.stackUsed[i] + DIAG_STACK_MARGIN > mem.stackSize[i])
+			TRACE_WARNING3(TRACE_MEM_TASK, i, mem.stackUsed[i], mem.stackSize[i]);
+		else
+			TRACE_INFO3(TRACE_MEM_TASK, i, mem.stackUsed[i], mem.stackSize[i]);
+	}
+
+	if (mem.sysStackUsed + DIAG_STACK_MARGIN > mem.sysStackSize)
+		TRACE_WARNING2(TRACE_MEM_SYSTEM, mem.sysStackUsed, mem.sysStackSize);
+	else
+		TRACE_INFO2(TRACE_MEM_SYSTEM, mem.sysStackUsed, mem.sysStackSize);
+
+	TRACE_INFO4(TRACE_MEM_HEAP, mem.heapInUse, mem.heapPeak, mem.heapSize, mem.allocFailures);
+}
+
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Converts a duration to us.
+ *
+ * @param 	ticks		Timestamp ticks
+ * @return 	us, DIAG_US_MAX if longer.
+ */
+static uint16_t ticksToUs(uint32_t ticks)
+{
+	uint32_t us;
+
+	if (ticksPerUs)
+	{
+		us = ticks / ticksPerUs;
+	}
+	else
+	{
+		if (usPerTickQ16 && ticks > 0xFFFFFFFF / usPerTickQ16)
+			return DIAG_US_MAX;
+		us = (ticks * usPerTickQ16) >> 16;
+	}
+
+	return (uint16_t)MIN(us, DIAG_US_MAX);
+}
+
+/**
+ * Finds the histogram bucket of a duration.
+ *
+ * @param 	us			Duration
+ * @return 	Bucket, 0 to DIAG_HIST_BUCKETS - 1
+ */
+static uint8_t histBucket(uint16_t us)
+{
+	uint8_t bucket = 0;
+	uint16_t v = us / DIAG_HIST_BASE_US;
+
+	while (v && bucket < DIAG_HIST_BUCKETS - 1)
+	{
+		v >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+/**
+ * Writes a little endian uint16.
+ *
+ * @param 	p			Output
+ * @param	value		Value
+ * @return 	Byte after it
+ */
+static uint8_t *put16(uint8_t *p, uint16_t value)
+{
+	p[0] = LO_UINT16(value);
+	p[1] = HI_UINT16(value);
+	return p + 2;
+}
+
+/**
+ * Reads the ICall heap use, 0 unless built with HEAPMGR_METRICS.
+ *
+ * @param 	pInUse		Output, bytes in use
+ * @param	pPeak		Output, most bytes in use so far
+ * @return 	none
+ */
+static void heapMetrics(uint16_t *pInUse, uint16_t *pPeak)
+{
+	uint32_t inUse = 0, peak = 0;
+#ifdef HEAPMGR_METRICS
+	uint32_t blkMax, blkCnt, blkFree, memUB;
+
+	ICall_getHeapMgrGetMetrics(&blkMax, &blkCnt, &blkFree, &inUse, &peak, &memUB);
+#endif //HEAPMGR_METRICS
+
+	*pInUse = (uint16_t)MIN(inUse, 0xFFFF);
+	*pPeak = (uint16_t)MIN(peak, 0xFFFF);
+}
+
+/**
+ * Reads the stack high water marks and the heap use.
+ *
+ * @param 	pMem		Output
+ * @return 	none
+ */
+static void collectMemory(Diag_memory *pMem)
+{
+	Task_Stat stat;
+	Hwi_StackInfo stackInfo;
+	uint8_t i;
+	UInt key;
+
+	memset(pMem, 0, sizeof(*pMem));
+
+	for (i = 0; i < DIAG_NUM_TASKS; i++)
+	{
+		if (NULL == tasks[i])
+			continue;
+
+		Task_stat(tasks[i], &stat);
+		pMem->stackSize[i] = (uint16_t)MIN(stat.stackSize, 0xFFFF);
+		pMem->stackUsed[i] = (uint16_t)MIN(stat.used, 0xFFFF);
+	}
+
+	Hwi_getStackInfo(&stackInfo, TRUE);
+	pMem->sysStackSize = (uint16_t)MIN(stackInfo.hwiStackSize, 0xFFFF);
+	pMem->sysStackUsed = (uint16_t)MIN(stackInfo.hwiStackPeak, 0xFFFF);
+
+#ifdef HEAPMGR_SIZE
+	pMem->heapSize = HEAPMGR_SIZE;
+#endif //HEAPMGR_SIZE
+	heapMetrics(&pMem->heapInUse, &pMem->heapPeak);
+
+	key = Hwi_disable();
+	pMem->allocFailures = allocFailures;
+	Hwi_restore(key);
+}
+
+/**
+ * Writes min, mean, max and the histogram of a timer.
+ *
+ * @param 	p			Output
+ * @param	pTimer		Timer
+ * @return 	Byte after it
+ */
+static uint8_t *putTimer(uint8_t *p, const Diag_timerStats *pTimer)
+{
+	uint8_t i;
+
+	p = put16(p, pTimer->count ? pTimer->minUs : 0);
+	p = put16(p, pTimer->count ? (uint16_t)(pTimer->sumUs / pTimer->count) : 0);
+	p = put16(p, pTimer->maxUs);
+	for (i = 0; i < DIAG_HIST_BUCKETS; i++)
+		p = put16(p, pTimer->hist[i]);
+
+	return p;
+}
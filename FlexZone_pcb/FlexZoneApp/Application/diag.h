@@ -0,0 +1,217 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			diag.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the runtime diagnostics counters.
+ */
+#ifndef DIAG_H
+#define DIAG_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//SYS/BIOS Header Files
+#include <ti/sysbios/knl/Task.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define DIAG_VERSION						4
+
+//Processing time histogram, bucket 0 is below DIAG_HIST_BASE_US and every other
+//bucket doubles, the last one holds everything from 2048 us on
+#define DIAG_HIST_BUCKETS					8
+#define DIAG_HIST_BASE_US					32
+
+/*
+ * Snapshot, read from the Diagnostics Counters characteristic or sent as a
+ * notification. Multi-byte fields are little endian, times in us, every counter
+ * stops at its maximum instead of wrapping.
+ * 	[0]		DIAG_VERSION
+ * 	[1-4]	uptime in seconds
+ * 	[5-26]	EMG slice processing: min, mean, max, then DIAG_HIST_BUCKETS counts
+ * 	[27-48]	EMG sample Swi: same layout
+ * 	[49-70]	haptic cue, vibe_play to motor on: same layout
+ * 	[71-84]	missed deadlines, slice overruns, I2C transfers, I2C errors,
+ * 			SPI transfers, SPI errors, set summaries dropped
+ * 	[85]	TX queue depth
+ * 	[86]	TX queue high water
+ * 	[87-94]	TX queue sent, retries, drops, discards
+ * 	[95-100]	ICall heap size, in use, most in use (0 unless built with HEAPMGR_METRICS)
+ * 	[101-108]	message pool per class: in use, high water, exhausted (u16)
+ * 	[109-112]	message pool heap fallbacks, failures
+ * 	[113-132]	boot phases in Diag_bootPhase order, ms since boot (u32), 0 until
+ * 			the phase is reached
+ *
+ * A missed deadline is a sample the EMG Swi skipped because the last slice was still
+ * being processed. An overrun is a slice that took longer than one sample period,
+ * which is all the time it has before samples are skipped. A set summary is dropped
+ * when a set ends while the one before it still could not be queued to the BLE task.
+ * Boot phases are kept from the first time they are reached until the next reset.
+ *
+ * Writes to the Diagnostics Control characteristic:
+ * 	[0]		DIAG_OP_NOTIFY - notify a snapshot now, as much as fits in the ATT MTU
+ * 			DIAG_OP_RESET - zero the timers and counters, uptime, boot phases
+ * 			and the pool and queue counters are left alone
+ * 			DIAG_OP_TRACE_MEMORY - write the memory report to the UART trace
+ */
+#define DIAG_SNAPSHOT_LEN					133
+
+#define DIAG_OP_NOTIFY						0x01
+#define DIAG_OP_RESET						0x02
+#define DIAG_OP_TRACE_MEMORY				0x03
+
+#define DIAG_MEMORY_VERSION					2
+
+//Headroom below which the memory report traces a stack as a warning
+#define DIAG_STACK_MARGIN					64
+
+/*
+ * Memory report, read from the Diagnostics Memory characteristic. Multi-byte fields
+ * are little endian, sizes in bytes. Stack use is the high water mark SYS/BIOS finds
+ * by scanning the stack for its fill pattern, so it covers the whole run so far.
+ * 	[0]		DIAG_MEMORY_VERSION
+ * 	[1]		DIAG_NUM_TASKS
+ * 	[2-21]	per task, in Diag_task order: stack size, most used; both 0 for a
+ * 			task that was not created
+ * 	[22-25]	system stack, shared by Hwi and Swi: size, most used
+ * 	[26-33]	ICall heap size, in use, most in use (0 unless built with
+ * 			HEAPMGR_METRICS), failed application allocations
+ */
+#define DIAG_MEMORY_LEN						34
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+typedef enum {
+	DIAG_TIMER_SLICE = 0,				//EMG task, one slice
+	DIAG_TIMER_SAMPLE,					//EMG Swi, one sample
+	DIAG_TIMER_HAPTIC,					//Haptic cue, request to motor on
+	DIAG_NUM_TIMERS
+} Diag_timer;
+
+typedef enum {
+	DIAG_MISSED_DEADLINE = 0,
+	DIAG_OVERRUN,
+	DIAG_I2C_TRANSFER,
+	DIAG_I2C_ERROR,
+	DIAG_SPI_TRANSFER,
+	DIAG_SPI_ERROR,
+	DIAG_SET_DROPPED,
+	DIAG_NUM_COUNTERS
+} Diag_counter;
+
+typedef enum {
+	DIAG_BOOT_APP_START = 0,			//BLE application task runs
+	DIAG_BOOT_APP_READY,				//BLE application initialized
+	DIAG_BOOT_DEVICE_STARTED,			//GAPRole started the device
+	DIAG_BOOT_ADVERTISING,				//First advertisement
+	DIAG_BOOT_FIRST_SAMPLE,				//First EMG sample
+	DIAG_NUM_BOOT_PHASES
+} Diag_bootPhase;
+
+typedef enum {
+	DIAG_TASK_APP = 0,					//FlexZone BLE application
+	DIAG_TASK_GAPROLE,
+	DIAG_TASK_EMG,
+	DIAG_TASK_SCHED,					//Application event loop (sched.h)
+	DIAG_TASK_TRACE,
+	DIAG_NUM_TASKS
+} Diag_task;
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Reads the timestamp frequency. Call once before the first diag_timerUs.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void diag_init(void);
+
+/**
+ * Adds one measurement to a timer. Safe from Hwi, Swi and Task context.
+ *
+ * @param 	timer		DIAG_TIMER_*
+ * @param	ticks		Duration in Timestamp_get32 ticks
+ * @return 	Duration in us, 0xFFFF if longer.
+ */
+extern uint16_t diag_timerUs(Diag_timer timer, uint32_t ticks);
+
+/**
+ * Counts one event. Safe from Hwi, Swi and Task context.
+ *
+ * @param 	counter		DIAG_*
+ * @return 	none
+ */
+extern void diag_count(Diag_counter counter);
+
+/**
+ * Records when a boot phase is first reached. Later calls for the same phase are
+ * ignored. Safe from Hwi, Swi and Task context, also before diag_init.
+ *
+ * @param 	phase		DIAG_BOOT_*
+ * @return 	none
+ */
+extern void diag_bootMark(Diag_bootPhase phase);
+
+/**
+ * Adds a task to the memory report. Called where the task is constructed, before
+ * BIOS_start.
+ *
+ * @param 	task		DIAG_TASK_*
+ * @param	hTask		Constructed task
+ * @return 	none
+ */
+extern void diag_addTask(Diag_task task, Task_Handle hTask);
+
+/**
+ * Counts an application allocation from the ICall heap that failed. Safe from Hwi,
+ * Swi and Task context.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void diag_allocFailed(void);
+
+/**
+ * Zeros the timers and counters.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void diag_reset(void);
+
+/**
+ * Copies part of a fresh snapshot. Runs in the BLE stack task for reads and in the
+ * BLE application task for notifications.
+ *
+ * @param 	offset		First byte
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+extern uint16_t diag_read(uint16_t offset, uint8_t *pDst, uint16_t maxLen);
+
+/**
+ * Copies part of a fresh memory report. Runs in the BLE stack task.
+ *
+ * @param 	offset		First byte
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+extern uint16_t diag_readMemory(uint16_t offset, uint8_t *pDst, uint16_t maxLen);
+
+/**
+ * Writes the memory report to the UART trace, stacks close to full as warnings.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void diag_traceMemory(void);
+
+#endif /* DIAG_H */
@@ -27,9 +27,21 @@
 #include <driverlib/aux_adc.h>
 #include <driverlib/aux_wuc.h>
 
+//BLE Stack Header Files
+#include <bcomdef.h>
+
 //Board Specific Header Files
 #include "Board.h"
 #include "emg.h"
+#include "classifier.h"
+#include "conn_policy.h"
+#include "diag.h"
+#include "emg_stream.h"
+#include "event_bus.h"
+#include "time_sync.h"
+#include "trace.h"
+#include "vibe.h"
+#include "workout_config.h"
 #include "DigiPot.h"
 #include "MPU9250.h"
 
@@ -43,14 +55,19 @@
 #define EMG_TASK_STACK_SIZE               	400
 #endif
 
-#define EMG_PERIOD_IN_MS					30
 #define EMG_MOVING_WINDOW					1
-#define REP_THRESHHOLD_HIGH 				1600
-#define REP_THRESHHOLD_LOW  				800
-#define EMG_NUMBER_OF_SAMPLES_READING		4
 
 #define STARTTIME							1412800000
-#define SET_TIMEOUT							15	// in seconds
+
+//Board_ANALOG_EN drives Q3, the low side switch of the analog ground
+#define EMG_ANALOG_ON						1
+#define EMG_ANALOG_OFF						0
+
+//Rest between sets with the front end off
+#define EMG_REST_MIN_SEC					5		//Shorter rests keep sampling
+#define EMG_REST_MAX_SEC					3600	//Keeps the Clock timeout in 32 bits
+#define EMG_SETTLE_MS						100		//Front end settling after power up
+#define EMG_SET_RETRY_MS					100		//Queuing a set summary again
 //**********************************************************************************
 // Global Data Structures
 //**********************************************************************************
@@ -63,23 +80,59 @@ Semaphore_Struct emgSemaphore;
 
 //Clock Structures
 Clock_Struct emgClock;
+Clock_Struct restClock;					//One shot, end of the rest after a set
 
 //Global data buffer for ADC samples
 uint32_t rawAdc[EMG_NUMBER_OF_SAMPLES_SLICE];
 //uint32_t adjustedAdc = 0, uvAdc = 0;
 uint16_t adcCounter = 0;
+static uint64_t sliceStartUs = 0;			//Device time of rawAdc[0]
 
 //EMG processing
-EMG_stats emg_set_stats;
-EMG_stats emg_set_statsSend;
+//Set records, double buffered. emg_set_stats points at the one being filled; the
+//other holds the last published set until the BLE task has stored it. Only a FREE
+//record is filled, and only the BLE task frees a QUEUED one (emg_setStored).
+typedef enum {
+	SET_RECORD_FREE = 0,
+	SET_RECORD_UNQUEUED,				//Finished, the message pool was empty
+	SET_RECORD_QUEUED					//Handed to the BLE task
+} Set_recordState;
+
+static EMG_stats setRecord[2];
+static volatile uint8_t setRecordState[2];
+static uint8_t setRecordIndex[2];
+static uint8_t setRecordMotion[2];
+EMG_stats *emg_set_stats = &setRecord[0];
 double lastAverage=-1;
 uint64_t pulseStart=0, pulseEnd=0;
 uint64_t deadStart=0, deadEnd=0;
 uint8_t processingDone = 1;
 uint8_t inRep = 0;
-uint8_t setIMUThres = 0;
 uint8_t repCount = 0;
 uint8_t setCount = 0;
+uint16_t lastRepPeak = 0;
+static uint8_t repEventSeq = 0;
+
+//Rep cue detector, owned by the Swi. The EMG task only resets it between slices.
+static uint8_t cueInRep = 0;
+static uint16_t cueWidth = 0;				//Like pulseTickCounter
+static uint16_t cueElapsed = 0;				//Samples since the rep started
+static uint16_t cuePeak = 0;
+static uint16_t cuePeakAt = 0;				//cueElapsed at the peak
+static uint8_t cueReps = 0;					//Reps cued in the set, like repCount
+
+//Rest state, owned by the task. settleSamples is only written while emgClock is
+//stopped, then counted down by the Swi.
+static uint8_t emgResting = 0;
+static uint32_t restStartSec = 0;
+static uint8_t settleSamples = 0;
+
+//Hardware brought up on first use, owned by the task
+static uint8_t frontEndOn = 0;				//Analog front end and ADC clocks
+#ifndef USE_UART
+static uint8_t digiPotOpen = 0;
+static uint8_t digiPotWiper[2] = {0, 0};	//Last wipers written, 0 - never
+#endif //USE_UART
 
 //workout config
 Workout_config myWorkoutConfig;
@@ -108,7 +161,8 @@ uint32_t pulseWidth=0, deadWidth=0;
 Types_FreqHz freq;
 
 
-uint8_t stopEmgRequest = 0;
+//Workout state, repCount and setCount above and myWorkoutConfig are written by this
+//task only; other threads change them through the event bus
 uint8_t emgRunning = 0;
 //**********************************************************************************
 // Local Function Prototypes
@@ -119,10 +173,27 @@ static void emgPoll_SwiFxn(UArg a0);
 static void adc_init(void);
 static uint32_t read_adc(uint8_t channel);
 void analog_init(void);
-void sendStructBle(void);
-void sendStructBleV2(void);
+void publishSet(void);
+static uint8_t setRecord_queue(uint8_t r);
+static uint8_t setRecord_unqueued(void);
 void gracefulExitEmg(void);
 void flushStruct(void);
+static void sendRepEvent(uint8_t repIndex, uint32_t endMs);
+static void publishRep(uint8_t event, uint8_t repIndex);
+static void emg_busWake(void);
+static void emg_busHandler(const Bus_msg *pMsg);
+static void startWorkout(void);
+static void configChanged(const Workout_config *pOld);
+static void updateGain(void);
+static void repCue_sample(uint32_t sample);
+static void repCue_rep(uint32_t concentricMs, uint32_t eccentricMs);
+static int8_t repCue_tempo(uint32_t ms, uint8_t target);
+static uint8_t widthUnit(uint8_t a, uint8_t b);
+static void frontEnd_power(uint8_t on);
+static void rest_start(uint32_t restedSec);
+static void rest_end(uint8_t reason);
+static void rest_resume(uint8_t reason);
+static void restClock_SwiFxn(UArg a0);
 //**********************************************************************************
 // Function Definitions
 //**********************************************************************************
@@ -140,6 +211,9 @@ void emg_createTask(void) {
 	Semaphore_Params_init(&semaphoreParams);
 	Semaphore_construct(&emgSemaphore, 0, &semaphoreParams);
 
+	//Defaults until the app writes a configuration
+	workoutConfig_init();
+
 	// Configure task
 	Task_Params_init(&taskParams);
 	taskParams.stack = emgTaskStack;
@@ -148,10 +222,21 @@ void emg_createTask(void) {
 
 	//Dynamically construct task
 	Task_construct(&emgTask, emg_taskFxn, &taskParams, NULL);
+	diag_addTask(DIAG_TASK_EMG, Task_handle(&emgTask));
+
+	//Workout commands and motion results reach the task through the bus
+	bus_addSink(BUS_SINK_EMG, emg_busWake);
+	bus_subscribe(BUS_SINK_EMG, BUS_EVT_WORKOUT_START, emg_busHandler);
+	bus_subscribe(BUS_SINK_EMG, BUS_EVT_WORKOUT_STOP, emg_busHandler);
+	bus_subscribe(BUS_SINK_EMG, BUS_EVT_WORKOUT_UPDATE, emg_busHandler);
+	bus_subscribe(BUS_SINK_EMG, BUS_EVT_MOTION, emg_busHandler);
+	bus_subscribe(BUS_SINK_EMG, BUS_EVT_REST_WAKE, emg_busHandler);
 }
 
 /**
- * Initializes hardware for EMG and creates required clock. Starts & configures ADC to run on DIO30 (AUXIO7).
+ * Claims the EMG pins and creates the required clocks. The analog front end stays off
+ * until a workout starts and the DigiPot SPI is opened for the first gain written,
+ * so nothing is brought up at boot that may not be used.
  *
  * @param 	none
  * @return 	none
@@ -160,10 +245,7 @@ static void emg_init(void) {
 	adc_init();
 	analog_init();
 	Seconds_set(STARTTIME);
-
-#ifndef USE_UART
-	digiPot_spi_init();
-#endif //USE_UART
+	flushStruct();
 
 	//Configure clock object
 	Clock_Params clockParams;
@@ -175,6 +257,10 @@ static void emg_init(void) {
 	//Dynamically Construct Clock
 //	Clock_construct(&emgClock, emgPoll_SwiFxn, EMG_PERIOD_IN_MS * (1000 / Clock_tickPeriod), &clockParams);
 	Clock_construct(&emgClock, emgPoll_SwiFxn, 0, &clockParams);
+
+	//Rest clock, the timeout is set for each rest
+	clockParams.period = 0;
+	Clock_construct(&restClock, restClock_SwiFxn, 0, &clockParams);
 }
 
 /**
@@ -186,6 +272,7 @@ static void emg_init(void) {
 static void emg_taskFxn(UArg a0, UArg a1) {
 	//Initialize required hardware & clocks for task.
 	emg_init();
+	Workout_config oldConfig;
 	uint64_t pulseTickCounter = 0, deadTickCounter = 0;
 	Timestamp_getFreq(&freq);
 	uint16_t pulsePeak = 0;
@@ -196,18 +283,45 @@ static void emg_taskFxn(UArg a0, UArg a1) {
 
 	while (1)
 	{
-		//Wait for ADC poll and ADC reading
-		Semaphore_pend(Semaphore_handle(&emgSemaphore), BIOS_WAIT_FOREVER);
+		//Wait for ADC poll and ADC reading, or a bus message. A set summary that could
+		//not be queued is tried again on every wake, at least every EMG_SET_RETRY_MS.
+		Semaphore_pend(Semaphore_handle(&emgSemaphore), setRecord_unqueued() ?
+				EMG_SET_RETRY_MS * (1000 / Clock_tickPeriod) : BIOS_WAIT_FOREVER);
+		if (setRecord_unqueued())
+			setRecord_queue(setRecord_unqueued() - 1);
+		bus_dispatch(BUS_SINK_EMG);
+
+		//No slice waiting, or a stop dropped it
+		if (processingDone)
+			continue;
 		timeStart = Timestamp_get32();
 
+		//Safe point: nothing of the last slice is in flight, so a new configuration
+		//takes effect for the whole of this slice
+		if (workoutConfig_apply(&oldConfig))
+			configChanged(&oldConfig);
+		updateGain();
+
+		//The Swi leaves rawAdc alone until processingDone is set again
+		if (myWorkoutConfig.rawStream)
+			emgStream_sendSlice(rawAdc, EMG_NUMBER_OF_SAMPLES_SLICE, sliceStartUs,
+								myWorkoutConfig.samplePeriodMs * 1000);
+
 		pulsePeak = 0;
 
+		//Reps the set holds. An update may lower the target below the reps done.
+		uint8_t repLimit = MIN(myWorkoutConfig.targetRepCount, EMG_MAX_REPS);
+
 		int i;
 		for(i = 0; i < EMG_NUMBER_OF_SAMPLES_SLICE; ++i)
 		{
+			//The set is full and ends below, the rest of the slice is rest
+			if (repCount >= repLimit)
+				break;
+
 
 		    //edge detection for reps
-			if (rawAdc[i] >= REP_THRESHHOLD_HIGH)
+			if (rawAdc[i] >= myWorkoutConfig.repThresholdHigh)
 			{
 				//always increment the pulse tick above the threshhold
 				//we know we are in a pulse
@@ -217,16 +331,14 @@ static void emg_taskFxn(UArg a0, UArg a1) {
 				if ( !inRep )//&& lastAverage < REP_THRESHHOLD_HIGH)
 				{
 					inRep = 1;//we are in the rep
-					  setIMUThres = 1;
-					  if (myWorkoutConfig.imuFeedback)
-							Clock_start(Clock_handle(&accelClock));
+					publishRep(BUS_EVT_REP_START, repCount);
 
 				    pulseStart = (Timestamp_get32()/1000);
 
 				    if ( repCount > 0 )
 				    {
-				    	deadWidth = deadTickCounter*EMG_PERIOD_IN_MS;
-				    	emg_set_stats.deadWidth[repCount-1] = deadWidth;
+				    	deadWidth = deadTickCounter*myWorkoutConfig.samplePeriodMs;
+				    	emg_set_stats->deadWidth[repCount-1] = deadWidth;
 				    }
 
 				    pulseTickCounter = 0;
@@ -236,9 +348,9 @@ static void emg_taskFxn(UArg a0, UArg a1) {
 				if ( rawAdc[i] > pulsePeak )
 				{
 					pulsePeak = rawAdc[i];
-					emg_set_stats.peakIntensity[repCount] = pulsePeak;
+					emg_set_stats->peakIntensity[repCount] = pulsePeak;
 					pulsePeakTime = (Timestamp_get32()/1000);
-					emg_set_stats.concentricTime[repCount] = pulsePeakTime - pulseStart;
+					emg_set_stats->concentricTime[repCount] = pulsePeakTime - pulseStart;
 				}
 
 			}
@@ -246,7 +358,7 @@ static void emg_taskFxn(UArg a0, UArg a1) {
 			//between thresholding levels
 			//if inRep, will keep going
 			//if !inRep, won't start
-			else if (rawAdc[i] >= REP_THRESHHOLD_LOW)
+			else if (rawAdc[i] >= myWorkoutConfig.repThresholdLow)
 			{
 				if( inRep )
 				{
@@ -264,32 +376,39 @@ static void emg_taskFxn(UArg a0, UArg a1) {
 				//end of the rep
 				if ( inRep )
 				{
-					pulseWidth = pulseTickCounter*EMG_PERIOD_IN_MS;
+					pulseWidth = pulseTickCounter*myWorkoutConfig.samplePeriodMs;
 
 					// THIS IS THE END OF A DETECTED REP!
 					// if-statement gets rid of questionable reps
-					if(pulseWidth > 250)
+					if(pulseWidth > myWorkoutConfig.minRepMs)
 					{
 						inRep = 0;
 
 						deadTickCounter = 0;
 
-						emg_set_stats.pulseWidth[repCount] = pulseWidth;
+						emg_set_stats->pulseWidth[repCount] = pulseWidth;
 						pulseEndTime = (Timestamp_get32()/1000);
-						emg_set_stats.eccentricTime[repCount] = pulseEndTime - pulsePeakTime;
+						emg_set_stats->eccentricTime[repCount] = pulseEndTime - pulsePeakTime;
 						repCount++;
 						lastRepTime = Seconds_get();
 
-#if defined(USE_UART)
-						Log_info1("get big my mans: %u", repCount);
-#else
-						System_printf("get big my mans: %u\n", repCount);
-						System_flush();
-#endif // USE_UART
+						TRACE_INFO1(TRACE_EMG_REP, repCount);
+						publishRep(BUS_EVT_REP_END, repCount - 1);
+
+						//Identify the exercise from the first rep of the set
+						if (1 == repCount)
+						{
+							user_setConnActivity(CONN_ACTIVITY_SET, 1);
+							emg_set_stats->exerciseId = classifier_run(emg_set_stats->peakIntensity[0],
+																	  emg_set_stats->pulseWidth[0]);
+							TRACE_INFO1(TRACE_EMG_EXERCISE, emg_set_stats->exerciseId);
+						}
 
-						if (myWorkoutConfig.imuFeedback)
-							Clock_stop(Clock_handle(&accelClock));
-//						user_sendEmgPacket(&repCount, 4, 0);
+						lastRepPeak = emg_set_stats->peakIntensity[repCount - 1];
+
+						//Sample i ended the rep
+						sendRepEvent(repCount - 1, (uint32_t)(timeSync_toShared(sliceStartUs +
+									 (uint64_t)i * myWorkoutConfig.samplePeriodMs * 1000) / 1000));
 					}
 				}
 				else //!inRep
@@ -300,57 +419,66 @@ static void emg_taskFxn(UArg a0, UArg a1) {
 //			lastAverage = rawAdc[i];
 		}//for each samples/slice
 
-#if defined(USE_UART)
-				Log_info1("\nstruct rep count: %u", emg_set_stats.numReps);
+		TRACE_DEBUG1(TRACE_EMG_SLICE, repCount);
 //				for(i=0; i<5; ++i){
-//					Log_info1("peak intensity: %u", emg_set_stats.peakIntensity[i]);
+//					Log_info1("peak intensity: %u", emg_set_stats->peakIntensity[i]);
 //				}
 //				for(i=0; i<5; ++i){
-//					Log_info1("pulse width: %u", emg_set_stats.pulseWidth[i]);
+//					Log_info1("pulse width: %u", emg_set_stats->pulseWidth[i]);
 //				}
 //				for(i=0; i<5; ++i){
-//					Log_info1("dead width: %u", emg_set_stats.deadWidth[i]);
+//					Log_info1("dead width: %u", emg_set_stats->deadWidth[i]);
 //				}
 //				for(i=0; i<5; ++i){
-//					Log_info1("concentric time: %u", emg_set_stats.concentricTime[i]);
+//					Log_info1("concentric time: %u", emg_set_stats->concentricTime[i]);
 //				}
 //				for(i=0; i<5; ++i){
-//					Log_info1("eccentric time: %u", emg_set_stats.eccentricTime[i]);
+//					Log_info1("eccentric time: %u", emg_set_stats->eccentricTime[i]);
 //				}
-				Log_info0("\n");
-#endif
 		//SET is DONE
-		if ( (repCount > 0 && (Seconds_get() - lastRepTime) > SET_TIMEOUT) || repCount == myWorkoutConfig.targetRepCount ) {
+		if ( (repCount > 0 && (Seconds_get() - lastRepTime) > myWorkoutConfig.setTimeoutSec) || repCount >= repLimit ) {
+
+			Bus_msg msg;
+
+			msg.event = BUS_EVT_SET_DONE;
+			msg.u.set.setIndex = setCount;
+			msg.u.set.numReps = repCount;
+			bus_publish(&msg);
 
 			setCount++;
-			Log_info0("set done!!!!!!!!!!!!!!!!!!!!!!!!!!");
-			emg_set_stats.numReps = repCount;
-			emg_set_stats.setDone = 1;
+			TRACE_INFO2(TRACE_EMG_SET_DONE, setCount, repCount);
+			emg_set_stats->numReps = repCount;
+			emg_set_stats->setDone = 1;
 
 			// Reset stats, flush the struct
 			repCount = 0;
 
 			inRep = 0;
+			cueInRep = 0;
+			cueReps = 0;
 
-			// if imu activated, stop imu thread
-			if (myWorkoutConfig.imuFeedback)
-				Clock_stop(Clock_handle(&accelClock));
-
-			//do deep copy, send data, flush struct
-			sendStructBleV2();
+			//publish the set, flush the next record
+			publishSet();
 			flushStruct();
 
 			//haptic feedback on set completion
 			if ( 1 == myWorkoutConfig.hapticFeedback)
 				buzz(1);
+
+			//Rest before the next set, nothing to rest for after the last one
+			if (setCount < myWorkoutConfig.targetSetCount)
+				rest_start(Seconds_get() - lastRepTime);
 		}//set is done
 
-		emg_set_stats.numReps = repCount;
-		processingDone = 1;
+		emg_set_stats->numReps = repCount;
 
-		//reset all required items and stop clock on user stop request
-		if (stopEmgRequest)
-			gracefulExitEmg();
+		//The slice has to be done before the next sample, or the Swi skips it
+		timeEnd = Timestamp_get32();
+		timeProcessing = timeEnd - timeStart;
+		usProcessing = diag_timerUs(DIAG_TIMER_SLICE, timeProcessing);
+		if (usProcessing > (uint32_t)myWorkoutConfig.samplePeriodMs * 1000)
+			diag_count(DIAG_OVERRUN);
+		processingDone = 1;
 
 		// all sets done
 		if (setCount == myWorkoutConfig.targetSetCount)
@@ -370,19 +498,34 @@ static void emg_taskFxn(UArg a0, UArg a1) {
  */
 static void emgPoll_SwiFxn(UArg a0) {
 
+	//Front end still settling after a rest, the sample would be off
+	if (settleSamples)
+	{
+		settleSamples--;
+		return;
+	}
+
 	if (processingDone)
 	{
+		uint32_t sampleStart = Timestamp_get32();
 		uint64_t localSum = 0;
+		uint8_t numReadings = myWorkoutConfig.adcAverage;
 		int i;
 
+		if (adcCounter == 0)
+			sliceStartUs = timeSync_localUs();
+
 		//ADC Sampling
-		for (i = 0; i < EMG_NUMBER_OF_SAMPLES_READING; i++)
+		for (i = 0; i < numReadings; i++)
 		{
 			//Read ADC
 			localSum += read_adc(0);
 		}
 
-		rawAdc[adcCounter++] = localSum/EMG_NUMBER_OF_SAMPLES_READING;
+		rawAdc[adcCounter++] = localSum/numReadings;
+		repCue_sample(rawAdc[adcCounter - 1]);
+		diag_timerUs(DIAG_TIMER_SAMPLE, Timestamp_get32() - sampleStart);
+		diag_bootMark(DIAG_BOOT_FIRST_SAMPLE);
 
 //#if defined(USE_UART)
 //			Log_info2("adc0: %u \t adc1: %u", rawAdc[adcCounter-1], read_adc(1));
@@ -393,7 +536,6 @@ static void emgPoll_SwiFxn(UArg a0) {
 
 		if (EMG_NUMBER_OF_SAMPLES_SLICE == adcCounter)
 		{
-			printWorkoutConfig();
 //			buzz(1);
 			adcCounter = 0;
 			processingDone = 0;
@@ -403,20 +545,116 @@ static void emgPoll_SwiFxn(UArg a0) {
 	}
 	else
 	{
-#if defined(USE_UART)
-		Log_info0("Missed deadline");
-#else
-		System_printf("Missed deadline\n");
-		System_flush();
-#endif //USE_UART
+		diag_count(DIAG_MISSED_DEADLINE);
+		TRACE_WARNING0(TRACE_EMG_MISSED_DEADLINE);
 	}
 }
 
+/**
+ * Rep cue detector, runs in the Swi on every sample. It follows the rep detection of
+ * emg_taskFxn sample by sample, same thresholds and minimum width, so it cues exactly
+ * the reps the task counts, but as soon as their last sample is read instead of after
+ * the slice. Like the task it stops once the set holds its target. The cue goes
+ * straight to the vibe Swi, no task in between.
+ *
+ * @param 	sample		Averaged ADC sample
+ * @return 	none
+ */
+static void repCue_sample(uint32_t sample) {
+	uint32_t period = myWorkoutConfig.samplePeriodMs;
+
+	//The set is full and ends after the slice
+	if (cueReps >= MIN(myWorkoutConfig.targetRepCount, EMG_MAX_REPS))
+		return;
+
+	if (cueInRep)
+		cueElapsed++;
+
+	if (sample >= myWorkoutConfig.repThresholdHigh)
+	{
+		if (!cueInRep)
+		{
+			cueInRep = 1;
+			cueWidth = 0;
+			cueElapsed = 0;
+			cuePeak = 0;
+		}
+		else
+		{
+			cueWidth++;
+		}
+
+		if (sample > cuePeak)
+		{
+			cuePeak = sample;
+			cuePeakAt = cueElapsed;
+		}
+	}
+	else if (sample >= myWorkoutConfig.repThresholdLow)
+	{
+		if (cueInRep)
+			cueWidth++;
+	}
+	else if (cueInRep && cueWidth * period > myWorkoutConfig.minRepMs)
+	{
+		cueInRep = 0;
+		cueReps++;
+		repCue_rep(cuePeakAt * period, (cueElapsed - cuePeakAt) * period);
+	}
+}
+
+/**
+ * Cues a counted rep: a tempo cue if a phase missed its target, else the tick.
+ *
+ * @param 	concentricMs	Rep start to peak
+ * @param	eccentricMs		Peak to rep end
+ * @return 	none
+ */
+static void repCue_rep(uint32_t concentricMs, uint32_t eccentricMs) {
+	int8_t tempo;
+
+	if (1 != myWorkoutConfig.hapticFeedback)
+		return;
+
+	//The eccentric is the phase lifters rush
+	tempo = repCue_tempo(eccentricMs, myWorkoutConfig.eccentricTarget);
+	if (0 == tempo)
+		tempo = repCue_tempo(concentricMs, myWorkoutConfig.concentricTarget);
+
+	if (tempo < 0)
+		vibe_play(VIBE_PATTERN_TEMPO_SLOWER, VIBE_PRIO_CUE, 1);
+	else if (tempo > 0)
+		vibe_play(VIBE_PATTERN_TEMPO_FASTER, VIBE_PRIO_CUE, 1);
+	else if (myWorkoutConfig.repCue)
+		vibe_play(VIBE_PATTERN_REP_TICK, VIBE_PRIO_CUE, 1);
+}
+
+/**
+ * Compares a rep phase with its tempo target.
+ *
+ * @param 	ms			Phase time
+ * @param	target		Target in 100 ms, 0 for none
+ * @return 	-1 if too fast, 1 if too slow, 0 if within WORKOUT_CFG_TEMPO_TOLERANCE
+ */
+static int8_t repCue_tempo(uint32_t ms, uint8_t target) {
+	uint32_t targetMs = (uint32_t)target * 100;
+	uint32_t tolerance = targetMs * WORKOUT_CFG_TEMPO_TOLERANCE / 100;
+
+	if (0 == target)
+		return 0;
+	if (ms + tolerance < targetMs)
+		return -1;
+	if (ms > targetMs + tolerance)
+		return 1;
+	return 0;
+}
+
 //**********************************************************************************
 // Low Level Functions
 //**********************************************************************************
 /**
- * Initialize ADC module
+ * Initialize ADC module. The AUX, ADI and ADC clocks are enabled with the front end,
+ * see frontEnd_power.
  *
  * @param 	none
  * @return	none
@@ -424,12 +662,6 @@ static void emgPoll_SwiFxn(UArg a0) {
 void adc_init() {
 	// Set up pins
 	emgPinHandle = PIN_open(&emgPinState, emgPins);
-
-	//Initialize AUX, ADI, and ADC Clocks
-	AUXWUCClockEnable(AUX_WUC_MODCLKEN0_ANAIF_M | AUX_WUC_MODCLKEN0_AUX_ADI4_M);
-
-	//Configure ADC to use DIO7 (AUXIO7) on manual trigger.
-	AUXADCSelectInput(BOARD_CH0_AUX);
 }
 
 /**
@@ -462,69 +694,426 @@ uint32_t read_adc(uint8_t channel) {
 }
 
 /**
- * Sets DIO1 high to power on analog circuit.
+ * Claims DIO1, which powers the analog circuit. It opens low, so the circuit stays
+ * off until frontEnd_power.
  *
  * @param 	none
  * @return	none
  */
 void analog_init() {
 	analogPinHandle = PIN_open(&analogPinState, analogPinTable);
-    PIN_setOutputValue(analogPinHandle, Board_ANALOG_EN, 0);
 }
 
 
-void sendStructBle(void) {
-	int i=0;
-	for (i=0; i<EMG_MAX_REPS;i++ )
-	{
-		emg_set_statsSend.pulseWidth[i] = emg_set_stats.pulseWidth[i];
-		emg_set_statsSend.deadWidth[i] = emg_set_stats.deadWidth[i];
-		emg_set_statsSend.concentricTime[i] = emg_set_stats.concentricTime[i];
-		emg_set_statsSend.eccentricTime[i] = emg_set_stats.eccentricTime[i];
-		emg_set_statsSend.peakIntensity[i] = emg_set_stats.peakIntensity[i];
-		emg_set_statsSend.movedOrNah[i] = emg_set_stats.movedOrNah[i];
+/**
+ * Publishes the finished set to the BLE task and swaps to the other record. The BLE
+ * task encodes the summary from the published record into the set history once, sends
+ * its notifications from there and frees the record with emg_setStored. If the
+ * message pool is empty the record is kept and queued again from the task loop; a
+ * set still not queued when the next one ends is dropped and counted in diag.
+ *
+ * @param 	none
+ * @return	none
+ */
+void publishSet(void) {
+	uint8_t cur = (emg_set_stats == &setRecord[0]) ? 0 : 1;
+	uint8_t next = cur ^ 1;
+
+	//Oldest first
+	if (setRecordState[next] == SET_RECORD_UNQUEUED && !setRecord_queue(next)) {
+		TRACE_WARNING1(TRACE_EMG_SET_DROPPED, setRecordIndex[next]);
+		diag_count(DIAG_SET_DROPPED);
+		setRecordState[next] = SET_RECORD_FREE;
 	}
-	emg_set_statsSend.numReps = emg_set_stats.numReps;
-	emg_set_statsSend.setDone = emg_set_stats.setDone;
-
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.pulseWidth, 38, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.deadWidth, 38, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.concentricTime, 38, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.eccentricTime, 38, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.peakIntensity, 38, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.movedOrNah, 21, 0);
+
+	setRecordIndex[cur] = setCount;
+	setRecordMotion[cur] = myWorkoutConfig.imuFeedback;
+	setRecordState[cur] = SET_RECORD_UNQUEUED;
+	setRecord_queue(cur);
+	//Resting until the first rep of the next set
+	user_setConnActivity(CONN_ACTIVITY_SET, 0);
+
+	//The BLE task runs at a higher priority, so this only waits while it is blocked
+	while (setRecordState[next] == SET_RECORD_QUEUED)
+		Task_sleep(EMG_SET_RETRY_MS * (1000 / Clock_tickPeriod));
+	emg_set_stats = &setRecord[next];
 }
 
-void sendStructBleV2(void) {
-	int i=0;
-	for (i=0; i<EMG_MAX_REPS;i++ )
-	{
-		emg_set_statsSend.pulseWidth[i] = emg_set_stats.pulseWidth[i];
-		emg_set_statsSend.deadWidth[i] = emg_set_stats.deadWidth[i];
-		emg_set_statsSend.concentricTime[i] = emg_set_stats.concentricTime[i];
-		emg_set_statsSend.eccentricTime[i] = emg_set_stats.eccentricTime[i];
-		emg_set_statsSend.peakIntensity[i] = emg_set_stats.peakIntensity[i];
-		emg_set_statsSend.movedOrNah[i] = emg_set_stats.movedOrNah[i];
+/**
+ * Queues an UNQUEUED record's summary to the BLE task.
+ *
+ * @param 	r		Record index
+ * @return	1 if queued
+ */
+static uint8_t setRecord_queue(uint8_t r) {
+	//The BLE task may store and free the record before the call returns
+	setRecordState[r] = SET_RECORD_QUEUED;
+	if (USER_APP_ERROR_OK != user_publishSetSummary(&setRecord[r], setRecordIndex[r],
+			setRecordMotion[r])) {
+		setRecordState[r] = SET_RECORD_UNQUEUED;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Finished record the BLE task has not been given yet, the older of the two.
+ *
+ * @param 	none
+ * @return	Record index + 1, 0 if none
+ */
+static uint8_t setRecord_unqueued(void) {
+	uint8_t r = (emg_set_stats == &setRecord[0]) ? 1 : 0;
+
+	return (setRecordState[r] == SET_RECORD_UNQUEUED) ? r + 1 : 0;
+}
+
+/**
+ * The BLE task has stored a published set, the EMG task may reuse its record. Call
+ * from the BLE task, once per queued set summary.
+ *
+ * @param 	pStats		Record passed to user_publishSetSummary
+ * @return 	none
+ */
+void emg_setStored(const EMG_stats *pStats) {
+	setRecordState[(pStats == &setRecord[0]) ? 0 : 1] = SET_RECORD_FREE;
+}
+
+/**
+ * Queues a rep event for the rep that just ended. Only copies into a pool message
+ * and posts the BLE task, so the EMG task never waits on the radio.
+ *
+ * @param 	repIndex	Rep in the current set
+ * @param	endMs		End of the rep, ms since boot
+ * @return	none
+ */
+static void sendRepEvent(uint8_t repIndex, uint32_t endMs) {
+	uint8_t event[EMG_REP_EVENT_LEN];
+	uint16_t deadBefore = (repIndex > 0) ? emg_set_stats->deadWidth[repIndex - 1] : 0;
+
+	event[0] = repEventSeq++;
+	event[1] = setCount + 1;		//setCount counts finished sets
+	event[2] = repIndex;
+	event[3] = emg_set_stats->exerciseId;
+	event[4] = BREAK_UINT32(endMs, 0);
+	event[5] = BREAK_UINT32(endMs, 1);
+	event[6] = BREAK_UINT32(endMs, 2);
+	event[7] = BREAK_UINT32(endMs, 3);
+	event[8] = LO_UINT16(emg_set_stats->peakIntensity[repIndex]);
+	event[9] = HI_UINT16(emg_set_stats->peakIntensity[repIndex]);
+	event[10] = LO_UINT16(emg_set_stats->pulseWidth[repIndex]);
+	event[11] = HI_UINT16(emg_set_stats->pulseWidth[repIndex]);
+	event[12] = LO_UINT16(deadBefore);
+	event[13] = HI_UINT16(deadBefore);
+	event[14] = LO_UINT16(emg_set_stats->concentricTime[repIndex]);
+	event[15] = HI_UINT16(emg_set_stats->concentricTime[repIndex]);
+	event[16] = LO_UINT16(emg_set_stats->eccentricTime[repIndex]);
+	event[17] = HI_UINT16(emg_set_stats->eccentricTime[repIndex]);
+
+	user_sendEmgPacket(event, EMG_REP_EVENT_LEN, APP_PACKET_TYPE_REP_EVENT);
+}
+
+/**
+ * Publishes the start or end of a rep of the current set.
+ *
+ * @param 	event		BUS_EVT_REP_START or BUS_EVT_REP_END
+ * @param	repIndex	Rep in the current set
+ * @return	none
+ */
+static void publishRep(uint8_t event, uint8_t repIndex) {
+	Bus_msg msg;
+
+	msg.event = event;
+	msg.u.rep.setIndex = setCount;
+	msg.u.rep.repIndex = repIndex;
+	msg.u.rep.imuFeedback = myWorkoutConfig.imuFeedback;
+	bus_publish(&msg);
+}
+
+/**
+ * Wakes the task for bus messages. Any context.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void emg_busWake(void) {
+	Semaphore_post(Semaphore_handle(&emgSemaphore));
+}
+
+/**
+ * Handles the bus messages of BUS_SINK_EMG, in the EMG task between two slices.
+ *
+ * @param 	pMsg		Message
+ * @return 	none
+ */
+static void emg_busHandler(const Bus_msg *pMsg) {
+	Workout_config oldConfig;
+
+	switch (pMsg->event) {
+	case BUS_EVT_WORKOUT_START:
+		if (emgResting)
+			rest_end(BUS_WAKE_CONFIG);
+		startWorkout();	//Powers the front end up
+		break;
+
+	case BUS_EVT_WORKOUT_STOP:
+		if (emgRunning)
+			gracefulExitEmg();
+		break;
+
+	case BUS_EVT_WORKOUT_UPDATE:
+		//While a workout runs it is applied at the start of the next slice
+		if (emgResting)
+			rest_resume(BUS_WAKE_CONFIG);
+		else if (!emgRunning)
+			workoutConfig_apply(&oldConfig);
+		break;
+
+	case BUS_EVT_REST_WAKE:
+		if (emgResting)
+			rest_resume(pMsg->u.wake.reason);
+		break;
+
+	case BUS_EVT_MOTION:
+		//Results of a rep of an earlier set come too late for its record
+		if (pMsg->u.motion.setIndex == setCount && pMsg->u.motion.repIndex < EMG_MAX_REPS)
+			emg_set_stats->movedOrNah[pMsg->u.motion.repIndex] = pMsg->u.motion.moved;
+		break;
+
+	default:
+		break;
+	}
+}
+
+/**
+ * Starts a workout with the staged configuration, or restarts the set count of the
+ * running one.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void startWorkout(void) {
+	Workout_config oldConfig;
+
+	//While a workout runs the new configuration is applied between two slices
+	if (!emgRunning) {
+		workoutConfig_apply(&oldConfig);
+		flushStruct();
+	}
+	frontEnd_power(EMG_ANALOG_ON);
+	setCount = 0;
+	emg_startClock();
+	emgRunning = 1;
+	user_setConnActivity(CONN_ACTIVITY_SET, 1);
+	if (myWorkoutConfig.rawStream) {
+		emgStream_reset();
+		user_setConnActivity(CONN_ACTIVITY_EMG_STREAM, 1);
+	}
+}
+
+/**
+ * (Re)starts EMG sampling at the configured sample period. Safe in Swi context.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void emg_startClock(void) {
+	Clock_Handle hClock = Clock_handle(&emgClock);
+	uint32_t ticks = myWorkoutConfig.samplePeriodMs * (1000 / Clock_tickPeriod);
+
+	Clock_stop(hClock);
+	Clock_setPeriod(hClock, ticks);
+	Clock_setTimeout(hClock, ticks);
+	Clock_start(hClock);
+}
+
+/**
+ * Follows up on a configuration applied during a workout.
+ *
+ * @param 	pOld		Configuration that was active before
+ * @return	none
+ */
+static void configChanged(const Workout_config *pOld) {
+	TRACE_INFO0(TRACE_EMG_CONFIG);
+	printWorkoutConfig();
+
+	if (pOld->samplePeriodMs != myWorkoutConfig.samplePeriodMs) {
+		emg_startClock();
+		emg_set_stats->samplePeriodMs = repCount ?
+				widthUnit(emg_set_stats->samplePeriodMs, myWorkoutConfig.samplePeriodMs) :
+				myWorkoutConfig.samplePeriodMs;
+	}
+
+	if (pOld->rawStream != myWorkoutConfig.rawStream) {
+		if (myWorkoutConfig.rawStream)
+			emgStream_reset();
+		user_setConnActivity(CONN_ACTIVITY_EMG_STREAM, myWorkoutConfig.rawStream);
+	}
+
+}
+
+/**
+ * Width unit of a set whose sample period changed: the widths recorded so far are
+ * multiples of the old period, the ones to come of the new one.
+ *
+ * @param 	a			Unit of the record
+ * @param	b			New sample period
+ * @return	Greatest common divisor of a and b
+ */
+static uint8_t widthUnit(uint8_t a, uint8_t b) {
+	while (b) {
+		uint8_t r = a % b;
+
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+/**
+ * Writes configured DigiPot wipers that changed, opening the DigiPot SPI for the
+ * first one. The DigiPot shares its pins with the UART, so UART builds only keep
+ * the values.
+ *
+ * @param 	none
+ * @return	none
+ */
+static void updateGain(void) {
+#ifndef USE_UART
+	uint8_t i;
+
+	for (i = 0; i < 2; i++) {
+		if (myWorkoutConfig.gain[i] && myWorkoutConfig.gain[i] != digiPotWiper[i]) {
+			if (!digiPotOpen) {
+				digiPot_spi_init();
+				digiPotOpen = 1;
+			}
+			set_Wiper(myWorkoutConfig.gain[i], i);
+			digiPotWiper[i] = myWorkoutConfig.gain[i];
+		}
+	}
+#endif //USE_UART
+}
+
+/**
+ * Powers the analog front end and the ADC clocks up or down. After power up the
+ * first samples once emgClock starts are dropped while the front end settles, and
+ * the rep detectors start from their idle state. Called by the task while emgClock
+ * is stopped or the Swi is paused for the slice.
+ *
+ * @param 	on			EMG_ANALOG_ON or EMG_ANALOG_OFF
+ * @return 	none
+ */
+static void frontEnd_power(uint8_t on) {
+	if (on == frontEndOn)
+		return;
+	frontEndOn = on;
+
+	adcCounter = 0;
+	if (EMG_ANALOG_OFF == on) {
+		AUXWUCClockDisable(AUX_WUC_MODCLKEN0_ANAIF_M | AUX_WUC_MODCLKEN0_AUX_ADI4_M);
+		PIN_setOutputValue(analogPinHandle, Board_ANALOG_EN, EMG_ANALOG_OFF);
+		return;
 	}
-	emg_set_statsSend.numReps = emg_set_stats.numReps;
-	emg_set_statsSend.setDone = emg_set_stats.setDone;
-
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.pulseWidth[0], 20, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.pulseWidth[10], 18, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.deadWidth[0], 20, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.deadWidth[10], 18, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.concentricTime[0], 20, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.concentricTime[10], 18, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.eccentricTime[0], 20, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.eccentricTime[10], 18, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.peakIntensity[0], 20, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.peakIntensity[10], 18, 0);
-	user_sendEmgPacket((uint8_t*)&emg_set_statsSend.movedOrNah[0], 21, 0);
+
+	PIN_setOutputValue(analogPinHandle, Board_ANALOG_EN, EMG_ANALOG_ON);
+	AUXWUCClockEnable(AUX_WUC_MODCLKEN0_ANAIF_M | AUX_WUC_MODCLKEN0_AUX_ADI4_M);
+	AUXADCSelectInput(BOARD_CH0_AUX);
+
+	processingDone = 1;
+	inRep = 0;
+	cueInRep = 0;
+	settleSamples = (EMG_SETTLE_MS + myWorkoutConfig.samplePeriodMs - 1) / myWorkoutConfig.samplePeriodMs;
+}
+
+/**
+ * Starts the rest after a set: stops sampling and powers down the analog front end
+ * and the ADC clocks until the rest timer, a motion wake or a workout command.
+ * Called by the task while the Swi is paused for the slice.
+ *
+ * @param 	restedSec	Rest since the last rep, the set timeout
+ * @return 	none
+ */
+static void rest_start(uint32_t restedSec) {
+	uint32_t restSec;
+	Bus_msg msg;
+
+	if (myWorkoutConfig.maxRestSeconds < restedSec + EMG_REST_MIN_SEC)
+		return;
+	restSec = myWorkoutConfig.maxRestSeconds - restedSec;
+	if (restSec > EMG_REST_MAX_SEC)
+		restSec = EMG_REST_MAX_SEC;
+
+	Clock_stop(Clock_handle(&emgClock));
+	frontEnd_power(EMG_ANALOG_OFF);
+
+	emgResting = 1;
+	restStartSec = Seconds_get();
+	Clock_setTimeout(Clock_handle(&restClock), restSec * (1000000 / Clock_tickPeriod));
+	Clock_start(Clock_handle(&restClock));
+
+	msg.event = BUS_EVT_REST_START;
+	bus_publish(&msg);
+	TRACE_INFO1(TRACE_EMG_REST_START, restSec);
+}
+
+/**
+ * Ends the rest. The front end stays off, the caller powers it up for the next set
+ * or leaves it off when the workout ends. Sampling is not restarted.
+ *
+ * @param 	reason		BUS_WAKE_*
+ * @return 	none
+ */
+static void rest_end(uint8_t reason) {
+	Bus_msg msg;
+
+	Clock_stop(Clock_handle(&restClock));
+	emgResting = 0;
+
+	msg.event = BUS_EVT_REST_END;
+	bus_publish(&msg);
+	TRACE_INFO2(TRACE_EMG_REST_END, Seconds_get() - restStartSec, reason);
+}
+
+/**
+ * Ends the rest and resumes sampling. A rest that ran out is cued, so the lifter
+ * knows to start the next set.
+ *
+ * @param 	reason		BUS_WAKE_*
+ * @return 	none
+ */
+static void rest_resume(uint8_t reason) {
+	rest_end(reason);
+	frontEnd_power(EMG_ANALOG_ON);
+	emg_startClock();
+
+	if (BUS_WAKE_TIMER == reason && 1 == myWorkoutConfig.hapticFeedback)
+		vibe_play(VIBE_PATTERN_REST_OVER, VIBE_PRIO_CUE, 1);
+}
+
+/**
+ * Rest clock callback, runs in Swi context.
+ *
+ * @param 	a0			Not used
+ * @return 	none
+ */
+static void restClock_SwiFxn(UArg a0) {
+	Bus_msg msg;
+
+	msg.event = BUS_EVT_REST_WAKE;
+	msg.u.wake.reason = BUS_WAKE_TIMER;
+	bus_publish(&msg);
 }
 
 void gracefulExitEmg(void) {
+	Bus_msg msg;
+
+	//No more samples, then the Swi's state can be reset
+	Clock_stop(Clock_handle(&emgClock));
+	if (emgResting)
+		rest_end(BUS_WAKE_CONFIG);
+	frontEnd_power(EMG_ANALOG_OFF);
 
-	stopEmgRequest = 0;
 	//clear set buffer
 	//reset adcCounter and repCount
 	adcCounter = 0;
@@ -532,23 +1121,31 @@ void gracefulExitEmg(void) {
 	processingDone = 1;
 	emgRunning = 0;
 	inRep = 0;
+	cueInRep = 0;
+	cueReps = 0;
 	flushStruct();
 
-	if (myWorkoutConfig.imuFeedback)
-		Clock_stop(Clock_handle(&accelClock));
-	Clock_stop(Clock_handle(&emgClock));
+	msg.event = BUS_EVT_WORKOUT_ENDED;
+	bus_publish(&msg);
+	user_setConnActivity(CONN_ACTIVITY_SET, 0);
+	if (myWorkoutConfig.rawStream)
+		user_setConnActivity(CONN_ACTIVITY_EMG_STREAM, 0);
 }
 
 void flushStruct(void) {
 	int resetCnt;
 	for (resetCnt = 0; resetCnt<EMG_MAX_REPS; resetCnt++){
-		emg_set_stats.pulseWidth[resetCnt] = 0;
-		emg_set_stats.deadWidth[resetCnt] = 0;
-		emg_set_stats.concentricTime[resetCnt] = 0;
-		emg_set_stats.eccentricTime[resetCnt] = 0;
-		emg_set_stats.peakIntensity[resetCnt] = 0;
+		emg_set_stats->pulseWidth[resetCnt] = 0;
+		emg_set_stats->deadWidth[resetCnt] = 0;
+		emg_set_stats->concentricTime[resetCnt] = 0;
+		emg_set_stats->eccentricTime[resetCnt] = 0;
+		emg_set_stats->peakIntensity[resetCnt] = 0;
+		emg_set_stats->movedOrNah[resetCnt] = 0;
 	}
 
-	emg_set_stats.numReps = 0;
-	emg_set_stats.setDone = 0;
+	emg_set_stats->numReps = 0;
+	emg_set_stats->setDone = 0;
+	emg_set_stats->samplePeriodMs = myWorkoutConfig.samplePeriodMs;
+	emg_set_stats->exerciseId = EXERCISE_UNKNOWN;
+	classifier_reset();
 }
@@ -15,6 +15,23 @@
 //**********************************************************************************
 // Required Definitions
 //**********************************************************************************
+#define EMG_REP_EVENT_LEN					18
+
+/*
+ * Rep event, sent as one APP_PACKET_TYPE_REP_EVENT packet on the EMG stream as soon
+ * as a rep ends. Multi-byte fields are little endian, times in ms.
+ *
+ * 	[0]		sequence number, +1 per event, so the app can spot lost events
+ * 	[1]		set index, matches the set summary of the same set
+ * 	[2]		rep index in the set, from 0
+ * 	[3]		exerciseId, EXERCISE_* once the first rep is classified
+ * 	[4-7]	uint32	end of the rep, shared time in ms (see time_sync.h), low 32 bits
+ * 	[8-9]	uint16	peakIntensity
+ * 	[10-11]	uint16	pulseWidth
+ * 	[12-13]	uint16	deadWidth before the rep, 0 for the first rep
+ * 	[14-15]	uint16	concentricTime
+ * 	[16-17]	uint16	eccentricTime
+ */
 
 //**********************************************************************************
 // Global Data Structures
@@ -31,4 +48,21 @@
  */
 extern void emg_createTask(void);
 
+/**
+ * (Re)starts EMG sampling at the configured sample period. Safe in Swi context.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void emg_startClock(void);
+
+/**
+ * The BLE task has stored a published set, the EMG task may reuse its record. Call
+ * from the BLE task, once per queued set summary.
+ *
+ * @param 	pStats		Record passed to user_publishSetSummary
+ * @return 	none
+ */
+extern void emg_setStored(const EMG_stats *pStats);
+
 #endif /* EMG_H */
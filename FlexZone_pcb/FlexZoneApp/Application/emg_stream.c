@@ -0,0 +1,247 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			emg_stream.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the live raw EMG stream encoder.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//Home brewed Header Files
+#include "emg_stream.h"
+#include "EMG_Service.h"
+#include "time_sync.h"
+
+//Standard Header Files
+#include <stddef.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define EMG_STREAM_SAMPLE_MASK				((1 << EMG_STREAM_SAMPLE_BITS) - 1)
+#define EMG_STREAM_MAX_COUNT				255		//Count is one byte
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+//LSB first bit packer. Never holds more than 7 bits between calls.
+typedef struct {
+	uint8_t *pDst;
+	uint16_t pos;
+	uint32_t acc;
+	uint8_t accBits;
+} EmgStream_writer;
+
+//Only the EMG task sends, so one block buffer is enough and keeps it off the task stack
+static uint8_t streamBlock[EMG_STREAM_LEN];
+static uint8_t streamSeq = 0;
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static uint16_t residual(const uint32_t *pSamples, uint16_t i);
+static uint8_t riceBits(uint16_t u, uint8_t k);
+static void putBits(EmgStream_writer *w, uint32_t value, uint8_t nBits);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Restarts the block sequence number. Call when a workout starts.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void emgStream_reset(void)
+{
+	streamSeq = 0;
+}
+
+/**
+ * Encodes one block from the front of pSamples. Every sample costs at most three
+ * passes of constant work, plus EMG_STREAM_K_WINDOW residuals per block to pick k.
+ *
+ * @param 	pSamples	ADC samples, only the low 12 bits are used
+ * @param	count		Samples available
+ * @param	seq			Sequence number for the header
+ * @param	timeUs		Time of the first sample for the header
+ * @param	pDst		Output block
+ * @param	dstLen		Size of pDst, at least EMG_STREAM_HEADER_LEN + 2
+ * @param	pUsed		Returns the number of samples in the block
+ * @return 	Block length, 0 if nothing fits.
+ */
+uint16_t emgStream_encodeBlock(const uint32_t *pSamples, uint16_t count, uint8_t seq,
+							   uint32_t timeUs, uint8_t *pDst, uint16_t dstLen,
+							   uint16_t *pUsed)
+{
+	EmgStream_writer w;
+	uint16_t bitBudget, riceTotal = 0, verbTotal;
+	uint32_t sum = 0;
+	uint16_t nVerb, nRice, n, i, first;
+	uint8_t k = 0, b, useRice;
+
+	*pUsed = 0;
+	if (count == 0 || dstLen < EMG_STREAM_HEADER_LEN + 2)
+		return 0;
+	if (count > EMG_STREAM_MAX_COUNT)
+		count = EMG_STREAM_MAX_COUNT;
+
+	bitBudget = (dstLen - EMG_STREAM_HEADER_LEN) * 8;
+
+	//Verbatim always fits this many
+	nVerb = 1 + bitBudget / EMG_STREAM_SAMPLE_BITS;
+	if (nVerb > count)
+		nVerb = count;
+
+	//Pick k from the mean residual of the first few samples
+	n = (count - 1 < EMG_STREAM_K_WINDOW) ? count - 1 : EMG_STREAM_K_WINDOW;
+	for (i = 1; i <= n; i++)
+		sum += residual(pSamples, i);
+	while (k < EMG_STREAM_MAX_K && (n << k) < sum)
+		k++;
+
+	//Take residuals while they fit
+	for (nRice = 1; nRice < count; nRice++) {
+		b = riceBits(residual(pSamples, nRice), k);
+		if (riceTotal + b > bitBudget)
+			break;
+		riceTotal += b;
+	}
+
+	//Fall back to verbatim unless Rice carries more samples, or the same in fewer bits
+	verbTotal = (nVerb - 1) * EMG_STREAM_SAMPLE_BITS;
+	useRice = (nRice > nVerb) || (nRice == nVerb && riceTotal < verbTotal);
+	n = useRice ? nRice : nVerb;
+
+	first = pSamples[0] & EMG_STREAM_SAMPLE_MASK;
+	pDst[0] = seq;
+	pDst[1] = useRice ? k : EMG_STREAM_MODE_VERBATIM;
+	pDst[2] = n;
+	pDst[3] = LO_UINT16(first);
+	pDst[4] = HI_UINT16(first);
+	pDst[5] = BREAK_UINT32(timeUs, 0);
+	pDst[6] = BREAK_UINT32(timeUs, 1);
+	pDst[7] = BREAK_UINT32(timeUs, 2);
+	pDst[8] = BREAK_UINT32(timeUs, 3);
+
+	w.pDst = &pDst[EMG_STREAM_HEADER_LEN];
+	w.pos = 0;
+	w.acc = 0;
+	w.accBits = 0;
+
+	for (i = 1; i < n; i++) {
+		if (useRice) {
+			uint16_t u = residual(pSamples, i);
+			uint16_t q = u >> k;
+
+			if (q < EMG_STREAM_ESCAPE_Q) {
+				//q ones, then the terminating zero
+				putBits(&w, (1 << q) - 1, q + 1);
+				putBits(&w, u & ((1 << k) - 1), k);
+			}
+			else {
+				putBits(&w, (1 << EMG_STREAM_ESCAPE_Q) - 1, EMG_STREAM_ESCAPE_Q);
+				putBits(&w, u, EMG_STREAM_ESCAPE_BITS);
+			}
+		}
+		else {
+			putBits(&w, pSamples[i] & EMG_STREAM_SAMPLE_MASK, EMG_STREAM_SAMPLE_BITS);
+		}
+	}
+
+	//Flush the partial byte
+	if (w.accBits)
+		w.pDst[w.pos++] = (uint8_t)w.acc;
+
+	*pUsed = n;
+	return EMG_STREAM_HEADER_LEN + w.pos;
+}
+
+/**
+ * Encodes a slice of samples and queues it on the EMG stream, as many blocks as the
+ * current notification payload needs. Runs in the EMG task.
+ *
+ * @param 	pSamples	ADC samples
+ * @param	count		Number of samples
+ * @param	firstUs		Device time of the first sample, from timeSync_localUs
+ * @param	periodUs	Sample period
+ * @return 	none
+ */
+void emgStream_sendSlice(const uint32_t *pSamples, uint16_t count, uint64_t firstUs,
+						 uint32_t periodUs)
+{
+	//Leave room for the two byte packet header
+	uint16_t dstLen = MIN(user_getNotifyPayloadLen(), EMG_STREAM_LEN) - 2;
+	uint16_t len, used;
+
+	while (count > 0) {
+		len = emgStream_encodeBlock(pSamples, count, streamSeq,
+									(uint32_t)timeSync_toShared(firstUs),
+									streamBlock, dstLen, &used);
+		if (len == 0)
+			break;
+
+		//Copied into the message, the block buffer is free again on return
+		user_sendEmgPacket(streamBlock, len, APP_PACKET_TYPE_EMG_RAW);
+		streamSeq++;
+
+		pSamples += used;
+		count -= used;
+		firstUs += (uint64_t)used * periodUs;
+	}
+}
+
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Zigzag mapped difference between sample i and the one before it.
+ *
+ * @param 	pSamples	ADC samples
+ * @param	i			Sample index, at least 1
+ * @return 	0, 1, 2, ... for differences 0, -1, 1, ...
+ */
+static uint16_t residual(const uint32_t *pSamples, uint16_t i)
+{
+	int16_t d = (int16_t)(pSamples[i] & EMG_STREAM_SAMPLE_MASK) -
+				(int16_t)(pSamples[i - 1] & EMG_STREAM_SAMPLE_MASK);
+
+	return (uint16_t)(((uint16_t)d << 1) ^ (d >> 15));
+}
+
+/**
+ * Coded length of one residual.
+ *
+ * @param 	u			Zigzag residual
+ * @param	k			Rice parameter
+ * @return 	Bits
+ */
+static uint8_t riceBits(uint16_t u, uint8_t k)
+{
+	uint16_t q = u >> k;
+
+	if (q < EMG_STREAM_ESCAPE_Q)
+		return q + 1 + k;
+	return EMG_STREAM_ESCAPE_Q + EMG_STREAM_ESCAPE_BITS;
+}
+
+/**
+ * Appends the low nBits of value, at most 16 per call.
+ *
+ * @param 	w			Writer
+ * @param	value		Bits to append
+ * @param	nBits		Number of bits
+ * @return 	none
+ */
+static void putBits(EmgStream_writer *w, uint32_t value, uint8_t nBits)
+{
+	w->acc |= value << w->accBits;
+	w->accBits += nBits;
+
+	while (w->accBits >= 8) {
+		w->pDst[w->pos++] = (uint8_t)w->acc;
+		w->acc >>= 8;
+		w->accBits -= 8;
+	}
+}
@@ -0,0 +1,91 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			emg_stream.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the live raw EMG stream encoder.
+ */
+#ifndef EMG_STREAM_H
+#define EMG_STREAM_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define EMG_STREAM_HEADER_LEN				9
+#define EMG_STREAM_SAMPLE_BITS				12		//AUX ADC resolution
+#define EMG_STREAM_MAX_K					11
+#define EMG_STREAM_ESCAPE_Q					15		//Unary prefix that marks an escaped residual
+#define EMG_STREAM_ESCAPE_BITS				13		//Zigzag of a 12 bit difference
+#define EMG_STREAM_K_WINDOW					16		//Residuals used to pick k
+
+//Mode byte
+#define EMG_STREAM_MODE_VERBATIM			0x80
+#define EMG_STREAM_MODE_K_MASK				0x0F
+
+/*
+ * Raw EMG block, sent as one APP_PACKET_TYPE_EMG_RAW packet on the EMG stream.
+ * Samples are the averaged ADC readings, one every configured sample period.
+ *
+ * 	[0]		sequence number, restarts at 0 when a workout starts
+ * 	[1]		mode: EMG_STREAM_MODE_VERBATIM, or Rice parameter k (0-11)
+ * 	[2]		number of samples in the block, at least 1
+ * 	[3-4]	first sample, little endian
+ * 	[5-8]	time of the first sample, shared time in us (see time_sync.h), low
+ * 			32 bits, little endian
+ * 	then the other count - 1 samples, bits packed LSB first:
+ * 		verbatim	12 bits per sample
+ * 		Rice		u = zigzag(sample - previous sample), then
+ * 					q = u >> k one bits, a zero bit and the low k bits of u, or
+ * 					if q >= 15, 15 one bits and the 13 bits of u
+ * 	the last byte is zero padded
+ *
+ * Each block decodes on its own, a lost block only loses its own samples. The
+ * receiver spots the gap from the sequence number.
+ */
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Restarts the block sequence number. Call when a workout starts.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void emgStream_reset(void);
+
+/**
+ * Encodes one block from the front of pSamples. Every sample costs at most three
+ * passes of constant work, plus EMG_STREAM_K_WINDOW residuals per block to pick k.
+ *
+ * @param 	pSamples	ADC samples, only the low 12 bits are used
+ * @param	count		Samples available
+ * @param	seq			Sequence number for the header
+ * @param	timeUs		Time of the first sample for the header
+ * @param	pDst		Output block
+ * @param	dstLen		Size of pDst, at least EMG_STREAM_HEADER_LEN + 2
+ * @param	pUsed		Returns the number of samples in the block
+ * @return 	Block length, 0 if nothing fits.
+ */
+extern uint16_t emgStream_encodeBlock(const uint32_t *pSamples, uint16_t count, uint8_t seq,
+									  uint32_t timeUs, uint8_t *pDst, uint16_t dstLen,
+									  uint16_t *pUsed);
+
+/**
+ * Encodes a slice of samples and queues it on the EMG stream, as many blocks as the
+ * current notification payload needs. Runs in the EMG task.
+ *
+ * @param 	pSamples	ADC samples
+ * @param	count		Number of samples
+ * @param	firstUs		Device time of the first sample, from timeSync_localUs
+ * @param	periodUs	Sample period
+ * @return 	none
+ */
+extern void emgStream_sendSlice(const uint32_t *pSamples, uint16_t count, uint64_t firstUs,
+								uint32_t periodUs);
+
+#endif /* EMG_STREAM_H */
@@ -0,0 +1,181 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			event_bus.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the event bus. Every sink has a ring of
+ * 						one-word slots that publishers reserve lock-free.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//SYS/BIOS Header Files
+#include <ti/sysbios/hal/Hwi.h>
+
+//Home brewed Header Files
+#include "event_bus.h"
+#include "trace.h"
+
+//Standard Header Files
+#include <stddef.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define BUS_SLOT_MASK						(BUS_SLOTS - 1)
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+typedef union {
+	Bus_msg msg;
+	uint32_t word;
+} Bus_slot;
+
+//Publishers reserve a slot by moving head on, then store the message in one word.
+//The sink stops at a reserved slot that is still 0 and frees slots back to 0, so a
+//message preempted between the two steps keeps its place.
+static volatile uint32_t slots[BUS_NUM_SINKS][BUS_SLOTS];
+static volatile uint32_t head[BUS_NUM_SINKS];
+static volatile uint32_t tail[BUS_NUM_SINKS];
+
+static Bus_wakeFxn wakeFxns[BUS_NUM_SINKS];
+static Bus_handler handlers[BUS_NUM_SINKS][BUS_NUM_EVENTS];
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static uint8_t bus_reserve(Bus_sink sink, uint32_t *pPos);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Adds a sink. Called before BIOS_start.
+ *
+ * @param 	sink		BUS_SINK_*
+ * @param	wakeFxn		Makes the sink call bus_dispatch, from any context
+ * @return 	none
+ */
+void bus_addSink(Bus_sink sink, Bus_wakeFxn wakeFxn)
+{
+	wakeFxns[sink] = wakeFxn;
+}
+
+/**
+ * Subscribes a handler of a sink to an event. Called before BIOS_start.
+ *
+ * @param 	sink		BUS_SINK_*
+ * @param	event		BUS_EVT_*
+ * @param	handler		Runs in the sink's thread
+ * @return 	none
+ */
+void bus_subscribe(Bus_sink sink, Bus_event event, Bus_handler handler)
+{
+	handlers[sink][event] = handler;
+}
+
+/**
+ * Publishes a message to every sink subscribed to its event. Safe from Hwi, Swi and
+ * Task context, never blocks.
+ *
+ * @param 	pMsg		Message, copied
+ * @return 	1 if every subscribed sink had a free slot
+ */
+uint8_t bus_publish(const Bus_msg *pMsg)
+{
+	Bus_slot slot;
+	uint32_t pos;
+	uint8_t sink;
+	uint8_t allQueued = 1;
+
+	slot.word = 0;
+	slot.msg = *pMsg;
+
+	for (sink = 0; sink < BUS_NUM_SINKS; sink++)
+	{
+		if (NULL == handlers[sink][pMsg->event])
+			continue;
+
+		if (!bus_reserve((Bus_sink)sink, &pos))
+		{
+			TRACE_WARNING2(TRACE_BUS_DROPPED, pMsg->event, sink);
+			allQueued = 0;
+			continue;
+		}
+
+		slots[sink][pos & BUS_SLOT_MASK] = slot.word;
+		if (wakeFxns[sink])
+			wakeFxns[sink]();
+	}
+
+	return allQueued;
+}
+
+/**
+ * Runs the handlers of the messages waiting for a sink. Call only from the sink's
+ * thread.
+ *
+ * @param 	sink		BUS_SINK_*
+ * @return 	none
+ */
+void bus_dispatch(Bus_sink sink)
+{
+	volatile uint32_t *pSlot;
+	Bus_slot slot;
+	Bus_handler handler;
+
+	while (tail[sink] != head[sink])
+	{
+		pSlot = &slots[sink][tail[sink] & BUS_SLOT_MASK];
+		slot.word = *pSlot;
+		if (0 == slot.word)
+			break;		//Reserved, the publisher stores it and wakes the sink again
+
+		*pSlot = 0;
+		tail[sink]++;
+
+		handler = handlers[sink][slot.msg.event];
+		if (handler)
+			handler(&slot.msg);
+	}
+}
+
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Reserves the next slot of a sink.
+ *
+ * @param 	sink		BUS_SINK_*
+ * @param	pPos		Returns the slot, not masked
+ * @return 	1 if reserved, 0 when the ring is full
+ */
+static uint8_t bus_reserve(Bus_sink sink, uint32_t *pPos)
+{
+	uint32_t pos;
+#if defined(__TI_COMPILER_VERSION__)
+	//Exclusive load/store, retried if anything else touched head in between
+	do
+	{
+		pos = __ldrex((void *)&head[sink]);
+		if (pos - tail[sink] >= BUS_SLOTS)
+			return 0;
+	} while (__strex(pos + 1, (void *)&head[sink]));
+#else
+	UInt key;
+
+	key = Hwi_disable();
+	pos = head[sink];
+	if (pos - tail[sink] >= BUS_SLOTS)
+	{
+		Hwi_restore(key);
+		return 0;
+	}
+	head[sink] = pos + 1;
+	Hwi_restore(key);
+#endif
+
+	*pPos = pos;
+	return 1;
+}
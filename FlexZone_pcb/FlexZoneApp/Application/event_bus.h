@@ -0,0 +1,127 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			event_bus.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the event bus between the EMG task,
+* 						the application event loop and the Swis.
+ */
+#ifndef EVENT_BUS_H
+#define EVENT_BUS_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define BUS_SLOTS							16		//Per sink, power of 2
+
+/*
+ * Typed publish/subscribe. A sink is a thread that takes messages: it adds a wake
+ * function, subscribes handlers and calls bus_dispatch when woken; the handlers run
+ * there. A publish copies the message into a preallocated slot of every subscribed
+ * sink, without locks, so it is safe from Hwi, Swi and Task context, and wakes the
+ * sink. Each sink gets its messages in publish order.
+ *
+ * State that belongs to one thread is changed only by that thread's handlers: the
+ * workout state, counters and configuration by the EMG task, the motion check by the
+ * accelerometer.
+ */
+typedef enum {
+	BUS_SINK_EMG = 0,					//EMG task
+	BUS_SINK_APP,						//Application event loop (sched.h)
+	BUS_NUM_SINKS
+} Bus_sink;
+
+typedef enum {
+	BUS_WAKE_TIMER = 0,					//Rest timer expired
+	BUS_WAKE_MOTION,					//IMU wake on motion
+	BUS_WAKE_CONFIG						//Workout command
+} Bus_wakeReason;
+
+typedef enum {
+	BUS_EVT_NONE = 0,					//Marks a free slot, never published
+	BUS_EVT_WORKOUT_START,				//Config Swi: start, with the staged configuration
+	BUS_EVT_WORKOUT_STOP,				//Config Swi: stop the running workout
+	BUS_EVT_WORKOUT_UPDATE,				//Config Swi: staged configuration while idle
+	BUS_EVT_WORKOUT_ENDED,				//EMG: stopped or all sets done
+	BUS_EVT_REP_START,					//EMG: rep, u.rep
+	BUS_EVT_REP_END,					//EMG: rep, u.rep
+	BUS_EVT_SET_DONE,					//EMG: set, u.set
+	BUS_EVT_MOTION,						//Accelerometer: motion during a rep changed, u.motion
+	BUS_EVT_REST_START,					//EMG: front end powered down after a set
+	BUS_EVT_REST_END,					//EMG: rest over, front end back on unless the workout ended
+	BUS_EVT_REST_WAKE,					//Rest timer or accelerometer: resume sampling, u.wake
+	BUS_NUM_EVENTS
+} Bus_event;
+
+//One slot word, so a publish lands in a single store
+typedef struct {
+	uint8_t event;						//Bus_event
+	union {
+		struct {
+			uint8_t setIndex;			//Finished sets before this one
+			uint8_t repIndex;
+			uint8_t imuFeedback;		//1 if the rep gets a motion check
+		} rep;
+		struct {
+			uint8_t setIndex;
+			uint8_t repIndex;
+			uint8_t moved;
+		} motion;
+		struct {
+			uint8_t setIndex;
+			uint8_t numReps;
+		} set;
+		struct {
+			uint8_t reason;				//BUS_WAKE_*
+		} wake;
+	} u;
+} Bus_msg;
+
+typedef void (*Bus_wakeFxn)(void);
+typedef void (*Bus_handler)(const Bus_msg *pMsg);
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Adds a sink. Called before BIOS_start.
+ *
+ * @param 	sink		BUS_SINK_*
+ * @param	wakeFxn		Makes the sink call bus_dispatch, from any context
+ * @return 	none
+ */
+extern void bus_addSink(Bus_sink sink, Bus_wakeFxn wakeFxn);
+
+/**
+ * Subscribes a handler of a sink to an event. Called before BIOS_start.
+ *
+ * @param 	sink		BUS_SINK_*
+ * @param	event		BUS_EVT_*
+ * @param	handler		Runs in the sink's thread
+ * @return 	none
+ */
+extern void bus_subscribe(Bus_sink sink, Bus_event event, Bus_handler handler);
+
+/**
+ * Publishes a message to every sink subscribed to its event. Safe from Hwi, Swi and
+ * Task context, never blocks.
+ *
+ * @param 	pMsg		Message, copied
+ * @return 	1 if every subscribed sink had a free slot
+ */
+extern uint8_t bus_publish(const Bus_msg *pMsg);
+
+/**
+ * Runs the handlers of the messages waiting for a sink. Call only from the sink's
+ * thread.
+ *
+ * @param 	sink		BUS_SINK_*
+ * @return 	none
+ */
+extern void bus_dispatch(Bus_sink sink);
+
+#endif /* EVENT_BUS_H */
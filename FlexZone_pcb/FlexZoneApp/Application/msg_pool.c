@@ -0,0 +1,189 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			msg_pool.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the application message pool.
+ * 						Fixed-size blocks on per-class free lists, so alloc and free
+ * 						are O(1) and never touch (or fragment) the ICall heap.
+ * 						tools/host/msg_pool_bench stress tests it and compares it with
+ * 						the heap.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//SYS/BIOS Header Files
+#include <ti/sysbios/BIOS.h>
+#include <ti/sysbios/hal/Hwi.h>
+
+//BLE Stack Header Files
+#include <ICall.h>
+
+//Home brewed Header Files
+#include "msg_pool.h"
+#include "diag.h"
+
+//Standard Header Files
+#include <stddef.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define MSG_POOL_WORDS(bytes)				(((bytes) + 3) / 4)
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+typedef struct MsgPool_block {
+	struct MsgPool_block *pNext;
+} MsgPool_block;
+
+typedef struct {
+	uint8_t *pStart;			//First block
+	uint8_t *pEnd;				//One past the last block
+	uint16_t blockSize;
+	uint8_t blockCount;
+	MsgPool_block *pFree;		//Free list head
+} MsgPool_class;
+
+//Block storage, uint32_t keeps every block word aligned for Queue_Elem
+static uint32_t smallBlocks[MSG_POOL_SMALL_BLOCK_COUNT * MSG_POOL_WORDS(MSG_POOL_SMALL_BLOCK_SIZE)];
+static uint32_t largeBlocks[MSG_POOL_LARGE_BLOCK_COUNT * MSG_POOL_WORDS(MSG_POOL_LARGE_BLOCK_SIZE)];
+
+static MsgPool_class poolClass[MSG_POOL_NUM_CLASSES] = {
+	{ (uint8_t *)smallBlocks, (uint8_t *)smallBlocks + sizeof(smallBlocks),
+	  MSG_POOL_WORDS(MSG_POOL_SMALL_BLOCK_SIZE) * 4, MSG_POOL_SMALL_BLOCK_COUNT, NULL },
+	{ (uint8_t *)largeBlocks, (uint8_t *)largeBlocks + sizeof(largeBlocks),
+	  MSG_POOL_WORDS(MSG_POOL_LARGE_BLOCK_SIZE) * 4, MSG_POOL_LARGE_BLOCK_COUNT, NULL },
+};
+
+static MsgPool_stats poolStats;
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Builds the free lists. Call once before the first msgPool_alloc.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void msgPool_init(void)
+{
+	uint8_t c, i;
+	MsgPool_class *pClass;
+
+	for (c = 0; c < MSG_POOL_NUM_CLASSES; c++) {
+		pClass = &poolClass[c];
+		pClass->pFree = NULL;
+		for (i = pClass->blockCount; i > 0; i--) {
+			MsgPool_block *pBlock = (MsgPool_block *)(pClass->pStart + (i - 1) * pClass->blockSize);
+			pBlock->pNext = pClass->pFree;
+			pClass->pFree = pBlock;
+		}
+	}
+}
+
+/**
+ * Allocates a block of at least size bytes from the smallest class with a free block.
+ * Safe from Hwi, Swi and Task context. Only a Task falls back to ICall_malloc once the
+ * pool is empty, the ICall heap is not safe from a Hwi or Swi; elsewhere the request
+ * fails and counts in notTask.
+ *
+ * @param 	size	Bytes needed
+ * @return 	Block, or NULL if the pool and the fallback are exhausted.
+ */
+void *msgPool_alloc(uint16_t size)
+{
+	MsgPool_block *pBlock = NULL;
+	MsgPool_classStats *pStats;
+	uint8_t c;
+	UInt key;
+
+	key = Hwi_disable();
+	for (c = 0; c < MSG_POOL_NUM_CLASSES; c++) {
+		if (size > poolClass[c].blockSize)
+			continue;
+
+		pStats = &poolStats.cls[c];
+		pBlock = poolClass[c].pFree;
+		if (pBlock == NULL) {
+			//Full, spill into the next larger class
+			pStats->exhausted++;
+			continue;
+		}
+
+		poolClass[c].pFree = pBlock->pNext;
+		pStats->allocs++;
+		if (++pStats->inUse > pStats->highWater)
+			pStats->highWater = pStats->inUse;
+		break;
+	}
+	Hwi_restore(key);
+
+	if (pBlock != NULL)
+		return pBlock;
+
+#if MSG_POOL_FALLBACK_HEAP
+	if (BIOS_getThreadType() != BIOS_ThreadType_Task) {
+		key = Hwi_disable();
+		poolStats.notTask++;
+		poolStats.failures++;
+		Hwi_restore(key);
+		return NULL;
+	}
+
+	pBlock = ICall_malloc(size);
+	if (pBlock == NULL)
+		diag_allocFailed();
+#endif
+	key = Hwi_disable();
+	if (pBlock != NULL)
+		poolStats.heapFallbacks++;
+	else
+		poolStats.failures++;
+	Hwi_restore(key);
+
+	return pBlock;
+}
+
+/**
+ * Returns a block from msgPool_alloc. Heap fallback blocks go back to ICall_free, so a
+ * block that may have come from the heap is freed from a Task.
+ *
+ * @param 	pBlock	Block to free, NULL is ignored
+ * @return 	none
+ */
+void msgPool_free(void *pBlock)
+{
+	uint8_t *p = (uint8_t *)pBlock;
+	uint8_t c;
+	UInt key;
+
+	if (p == NULL)
+		return;
+
+	for (c = 0; c < MSG_POOL_NUM_CLASSES; c++) {
+		if (p >= poolClass[c].pStart && p < poolClass[c].pEnd) {
+			key = Hwi_disable();
+			((MsgPool_block *)p)->pNext = poolClass[c].pFree;
+			poolClass[c].pFree = (MsgPool_block *)p;
+			poolStats.cls[c].inUse--;
+			Hwi_restore(key);
+			return;
+		}
+	}
+
+	ICall_free(pBlock);
+}
+
+/**
+ * Usage counters, see MsgPool_stats.
+ *
+ * @param 	none
+ * @return 	Pointer to the live counters
+ */
+const MsgPool_stats *msgPool_getStats(void)
+{
+	return &poolStats;
+}
@@ -0,0 +1,90 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			msg_pool.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the application message pool.
+ */
+#ifndef MSG_POOL_H
+#define MSG_POOL_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+//Size classes, smallest first. Block sizes are multiples of 4 bytes.
+//Small: GAP state changes, passcode requests, short characteristic writes.
+#define MSG_POOL_SMALL_BLOCK_SIZE			32
+#define MSG_POOL_SMALL_BLOCK_COUNT			8
+//Large: a full stream notification (app_msg_t + char_data_t + USER_MAX_NOTIFY_LEN).
+#define MSG_POOL_LARGE_BLOCK_SIZE			116
+#define MSG_POOL_LARGE_BLOCK_COUNT			8
+
+#define MSG_POOL_NUM_CLASSES				2
+
+//1 - a Task falls back to ICall_malloc when every class that fits is empty
+//0 - fail the allocation, the caller drops the message
+#ifndef MSG_POOL_FALLBACK_HEAP
+#define MSG_POOL_FALLBACK_HEAP				1
+#endif
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+typedef struct {
+	uint16_t allocs;			//Blocks handed out by this class
+	uint8_t inUse;				//Blocks currently out
+	uint8_t highWater;			//Most blocks out at once
+	uint16_t exhausted;			//Requests that found this class empty
+} MsgPool_classStats;
+
+typedef struct {
+	MsgPool_classStats cls[MSG_POOL_NUM_CLASSES];
+	uint16_t heapFallbacks;		//Requests served by ICall_malloc
+	uint16_t failures;			//Requests nobody could serve
+	uint16_t notTask;			//Of those, pool empty outside a Task, heap not tried
+} MsgPool_stats;
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Builds the free lists. Call once before the first msgPool_alloc.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void msgPool_init(void);
+
+/**
+ * Allocates a block of at least size bytes from the smallest class with a free block.
+ * Safe from Hwi, Swi and Task context. Only a Task falls back to ICall_malloc once the
+ * pool is empty, the ICall heap is not safe from a Hwi or Swi; elsewhere the request
+ * fails and counts in notTask.
+ *
+ * @param 	size	Bytes needed
+ * @return 	Block, or NULL if the pool and the fallback are exhausted.
+ */
+extern void *msgPool_alloc(uint16_t size);
+
+/**
+ * Returns a block from msgPool_alloc. Heap fallback blocks go back to ICall_free, so a
+ * block that may have come from the heap is freed from a Task.
+ *
+ * @param 	pBlock	Block to free, NULL is ignored
+ * @return 	none
+ */
+extern void msgPool_free(void *pBlock);
+
+/**
+ * Usage counters, see MsgPool_stats.
+ *
+ * @param 	none
+ * @return 	Pointer to the live counters
+ */
+extern const MsgPool_stats *msgPool_getStats(void);
+
+#endif /* MSG_POOL_H */
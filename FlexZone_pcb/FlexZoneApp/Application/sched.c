@@ -0,0 +1,433 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			sched.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the application event loop. One task
+ * 						dispatches event flags, a mailbox and timers to the handlers
+ * 						that used to have a task each.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//SYS/BIOS Header Files
+#include <ti/sysbios/BIOS.h>				//required for BIOS_WAIT_FOREVER in Semaphore_pend();
+#include <ti/sysbios/knl/Task.h>
+#include <ti/sysbios/knl/Clock.h>
+#include <ti/sysbios/knl/Semaphore.h>
+#include <ti/sysbios/hal/Hwi.h>
+
+//Home brewed Header Files
+#include "sched.h"
+#include "diag.h"
+#include "event_bus.h"
+
+//Standard Header Files
+#include <stddef.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+//Below the EMG task, which keeps the sample deadlines
+#define SCHED_TASK_PRIORITY					1
+#ifndef SCHED_TASK_STACK_SIZE
+#define SCHED_TASK_STACK_SIZE				400		//Accelerometer I2C reads are the deepest
+#endif
+
+#define SCHED_MS_TO_TICKS(ms)				((ms) * (1000 / Clock_tickPeriod))
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+typedef struct {
+	uint8_t event;
+	uint32_t arg;
+} Sched_msg;
+
+//Task Structures
+Task_Struct schedTask;
+Char schedTaskStack[SCHED_TASK_STACK_SIZE];
+
+//Semaphore Structures, binary: one pass of the loop handles every post before it
+Semaphore_Struct schedSemaphore;
+
+//Clock Structures, armed for the first timer only
+Clock_Struct schedClock;
+
+static Sched_initFxn initFxns[SCHED_NUM_EVENTS];
+static Sched_handler handlers[SCHED_NUM_EVENTS];
+
+//Everything below is shared with the posters and the Clock Swi, under Hwi_disable
+static volatile uint32_t pendingFlags = 0;
+static Sched_msg mailbox[SCHED_MAILBOX_LEN];
+static uint8_t mailboxHead = 0;
+static uint8_t mailboxCount = 0;
+static Sched_timer *pTimers = NULL;
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static void sched_taskFxn(UArg a0, UArg a1);
+static void sched_clockFxn(UArg a0);
+static uint8_t sched_takeMsg(Sched_msg *pMsg);
+static void sched_insertTimer(Sched_timer *pTimer);
+static void sched_removeTimer(Sched_timer *pTimer);
+static void sched_armClock(void);
+static void sched_busWake(void);
+static void sched_busHandler(uint32_t arg);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Creates the application event loop task. Call before the modules register.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void sched_createTask(void)
+{
+	Task_Params taskParams;
+	Semaphore_Params semaphoreParams;
+	Clock_Params clockParams;
+
+	// Configure & construct semaphore
+	Semaphore_Params_init(&semaphoreParams);
+	semaphoreParams.mode = Semaphore_Mode_BINARY;
+	Semaphore_construct(&schedSemaphore, 0, &semaphoreParams);
+
+	//One shot, the timeout is set for each deadline
+	Clock_Params_init(&clockParams);
+	clockParams.period = 0;
+	clockParams.startFlag = FALSE;
+	Clock_construct(&schedClock, sched_clockFxn, 1, &clockParams);
+
+	// Configure task
+	Task_Params_init(&taskParams);
+	taskParams.stack = schedTaskStack;
+	taskParams.stackSize = SCHED_TASK_STACK_SIZE;
+	taskParams.priority = SCHED_TASK_PRIORITY;
+
+	//Dynamically construct task
+	Task_construct(&schedTask, sched_taskFxn, &taskParams, NULL);
+	diag_addTask(DIAG_TASK_SCHED, Task_handle(&schedTask));
+
+	//The loop is the bus sink of the handlers that run here
+	bus_addSink(BUS_SINK_APP, sched_busWake);
+	sched_register(SCHED_EVT_BUS, NULL, sched_busHandler);
+}
+
+/**
+ * Registers the handler of an event. Called before BIOS_start.
+ *
+ * @param 	event		SCHED_EVT_*
+ * @param	initFxn		Runs once in the loop task before any handler, or NULL
+ * @param	handler		Runs for every post of the event
+ * @return 	none
+ */
+void sched_register(Sched_event event, Sched_initFxn initFxn, Sched_handler handler)
+{
+	initFxns[event] = initFxn;
+	handlers[event] = handler;
+}
+
+/**
+ * Posts an event as a flag. Safe from Hwi, Swi and Task context.
+ *
+ * @param 	event		SCHED_EVT_*
+ * @return 	none
+ */
+void sched_post(Sched_event event)
+{
+	UInt key = Hwi_disable();
+	pendingFlags |= (uint32_t)1 << event;
+	Hwi_restore(key);
+
+	Semaphore_post(Semaphore_handle(&schedSemaphore));
+}
+
+/**
+ * Queues an event with an argument in the mailbox. Safe from Hwi, Swi and Task context.
+ *
+ * @param 	event		SCHED_EVT_*
+ * @param	arg			Passed to the handler
+ * @return 	1 if queued, 0 when the mailbox is full
+ */
+uint8_t sched_send(Sched_event event, uint32_t arg)
+{
+	Sched_msg *pMsg;
+	UInt key = Hwi_disable();
+
+	if (mailboxCount >= SCHED_MAILBOX_LEN)
+	{
+		Hwi_restore(key);
+		return 0;
+	}
+
+	pMsg = &mailbox[(mailboxHead + mailboxCount) % SCHED_MAILBOX_LEN];
+	pMsg->event = event;
+	pMsg->arg = arg;
+	mailboxCount++;
+	Hwi_restore(key);
+
+	Semaphore_post(Semaphore_handle(&schedSemaphore));
+	return 1;
+}
+
+/**
+ * Starts or restarts a timer. Safe from Swi and Task context.
+ *
+ * @param 	pTimer		Timer, stays owned by the caller
+ * @param	event		SCHED_EVT_* posted on expiry
+ * @param	delayMs		Time to the first expiry
+ * @param	periodMs	Time between later expiries, 0 for one shot
+ * @return 	none
+ */
+void sched_timerStart(Sched_timer *pTimer, Sched_event event, uint32_t delayMs,
+					  uint32_t periodMs)
+{
+	UInt key = Hwi_disable();
+
+	if (pTimer->armed)
+		sched_removeTimer(pTimer);
+
+	pTimer->event = event;
+	pTimer->period = SCHED_MS_TO_TICKS(periodMs);
+	pTimer->deadline = Clock_getTicks() + SCHED_MS_TO_TICKS(delayMs);
+	sched_insertTimer(pTimer);
+	sched_armClock();
+
+	Hwi_restore(key);
+}
+
+/**
+ * Starts a one shot timer delayMs after its last deadline rather than after now, so a
+ * chain of expiries keeps its phase however late each handler runs. A deadline that
+ * has passed expires right away.
+ *
+ * @param 	pTimer		Timer that was started before
+ * @param	event		SCHED_EVT_* posted on expiry
+ * @param	delayMs		Time from the last deadline
+ * @return 	none
+ */
+void sched_timerNext(Sched_timer *pTimer, Sched_event event, uint32_t delayMs)
+{
+	UInt key = Hwi_disable();
+
+	if (pTimer->armed)
+		sched_removeTimer(pTimer);
+
+	pTimer->event = event;
+	pTimer->period = 0;
+	pTimer->deadline += SCHED_MS_TO_TICKS(delayMs);
+	sched_insertTimer(pTimer);
+	sched_armClock();
+
+	Hwi_restore(key);
+}
+
+/**
+ * Stops a timer. An expiry that was already posted is still handled.
+ *
+ * @param 	pTimer		Timer
+ * @return 	none
+ */
+void sched_timerStop(Sched_timer *pTimer)
+{
+	UInt key = Hwi_disable();
+
+	if (pTimer->armed)
+	{
+		sched_removeTimer(pTimer);
+		sched_armClock();
+	}
+
+	Hwi_restore(key);
+}
+
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Event loop. Runs the init functions once, then dispatches the flags and the mailbox
+ * every time the semaphore is posted.
+ *
+ * @param 	a0, a1		unused
+ * @return 	none
+ */
+static void sched_taskFxn(UArg a0, UArg a1)
+{
+	Sched_msg msg;
+	uint32_t flags;
+	uint8_t i;
+	UInt key;
+
+	for (i = 0; i < SCHED_NUM_EVENTS; i++)
+	{
+		if (initFxns[i])
+			initFxns[i]();
+	}
+
+	while (1)
+	{
+		Semaphore_pend(Semaphore_handle(&schedSemaphore), BIOS_WAIT_FOREVER);
+
+		key = Hwi_disable();
+		flags = pendingFlags;
+		pendingFlags = 0;
+		Hwi_restore(key);
+
+		for (i = 0; flags; i++, flags >>= 1)
+		{
+			if ((flags & 1) && handlers[i])
+				handlers[i](0);
+		}
+
+		while (sched_takeMsg(&msg))
+		{
+			if (handlers[msg.event])
+				handlers[msg.event](msg.arg);
+		}
+	}
+}
+
+/**
+ * Clock callback function that runs in SWI context. Posts the events of every expired
+ * timer, puts the periodic ones back and arms the Clock for the next deadline.
+ *
+ * @param 	a0			unused
+ * @return 	none
+ */
+static void sched_clockFxn(UArg a0)
+{
+	Sched_timer *pTimer;
+	uint32_t now;
+	UInt key = Hwi_disable();
+
+	now = Clock_getTicks();
+	while (pTimers && (int32_t)(pTimers->deadline - now) <= 0)
+	{
+		pTimer = pTimers;
+		sched_removeTimer(pTimer);
+		pendingFlags |= (uint32_t)1 << pTimer->event;
+
+		if (pTimer->period)
+		{
+			//Keep the period's phase, unless the timer fell a whole period behind
+			pTimer->deadline += pTimer->period;
+			if ((int32_t)(pTimer->deadline - now) <= 0)
+				pTimer->deadline = now + pTimer->period;
+			sched_insertTimer(pTimer);
+		}
+	}
+	sched_armClock();
+
+	Hwi_restore(key);
+
+	Semaphore_post(Semaphore_handle(&schedSemaphore));
+}
+
+/**
+ * Takes the oldest mailbox message.
+ *
+ * @param 	pMsg		Message, written if there was one
+ * @return 	1 if a message was taken
+ */
+static uint8_t sched_takeMsg(Sched_msg *pMsg)
+{
+	UInt key = Hwi_disable();
+
+	if (0 == mailboxCount)
+	{
+		Hwi_restore(key);
+		return 0;
+	}
+
+	*pMsg = mailbox[mailboxHead];
+	mailboxHead = (mailboxHead + 1) % SCHED_MAILBOX_LEN;
+	mailboxCount--;
+	Hwi_restore(key);
+
+	return 1;
+}
+
+/**
+ * Inserts a timer in deadline order. Called with Hwi disabled.
+ *
+ * @param 	pTimer		Timer, not armed
+ * @return 	none
+ */
+static void sched_insertTimer(Sched_timer *pTimer)
+{
+	Sched_timer **ppNext = &pTimers;
+
+	while (*ppNext && (int32_t)((*ppNext)->deadline - pTimer->deadline) <= 0)
+		ppNext = &(*ppNext)->pNext;
+
+	pTimer->pNext = *ppNext;
+	*ppNext = pTimer;
+	pTimer->armed = 1;
+}
+
+/**
+ * Unlinks a timer. Called with Hwi disabled.
+ *
+ * @param 	pTimer		Timer, armed
+ * @return 	none
+ */
+static void sched_removeTimer(Sched_timer *pTimer)
+{
+	Sched_timer **ppNext = &pTimers;
+
+	while (*ppNext && *ppNext != pTimer)
+		ppNext = &(*ppNext)->pNext;
+
+	if (*ppNext)
+		*ppNext = pTimer->pNext;
+	pTimer->pNext = NULL;
+	pTimer->armed = 0;
+}
+
+/**
+ * Arms the Clock for the first deadline, or stops it when no timer runs. Called with
+ * Hwi disabled.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void sched_armClock(void)
+{
+	int32_t timeout;
+
+	Clock_stop(Clock_handle(&schedClock));
+	if (NULL == pTimers)
+		return;
+
+	timeout = (int32_t)(pTimers->deadline - Clock_getTicks());
+	if (timeout < 1)
+		timeout = 1;
+	Clock_setTimeout(Clock_handle(&schedClock), (uint32_t)timeout);
+	Clock_start(Clock_handle(&schedClock));
+}
+
+/**
+ * Wakes the loop for messages published to BUS_SINK_APP. Any context.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void sched_busWake(void)
+{
+	sched_post(SCHED_EVT_BUS);
+}
+
+/**
+ * Runs the bus handlers of BUS_SINK_APP.
+ *
+ * @param 	arg			unused
+ * @return 	none
+ */
+static void sched_busHandler(uint32_t arg)
+{
+	bus_dispatch(BUS_SINK_APP);
+}
@@ -0,0 +1,124 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			sched.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the application event loop.
+ */
+#ifndef SCHED_H
+#define SCHED_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define SCHED_MAILBOX_LEN					8
+
+/*
+ * One task runs the handlers of the modules that only react to events and timers
+ * (accelerometer, workout config) instead of a task each, and the event
+ * bus handlers of BUS_SINK_APP (event_bus.h). A handler runs
+ * to completion and never pends or sleeps, waiting is done with a Sched_timer; the
+ * EMG acquisition keeps its own higher priority task.
+ *
+ * An event is posted either as a flag, which coalesces until its handler runs and
+ * gets arg 0, or through the mailbox, where every message reaches the handler with
+ * its argument. Flags are dispatched first, lowest event first, then the mailbox
+ * in order.
+ */
+typedef enum {
+	SCHED_EVT_BUS = 0,					//Event bus messages for BUS_SINK_APP
+	SCHED_EVT_ACCEL,					//Accelerometer sample/motion check is due
+	SCHED_NUM_EVENTS
+} Sched_event;
+
+typedef void (*Sched_initFxn)(void);
+typedef void (*Sched_handler)(uint32_t arg);
+
+/*
+ * Timer, owned by the module that starts it. Timers are kept in deadline order and a
+ * single Clock object is armed for the first one, so nothing ticks while none runs.
+ * On expiry the timer posts its event as a flag.
+ */
+typedef struct Sched_timer {
+	struct Sched_timer *pNext;
+	uint32_t deadline;					//Clock ticks
+	uint32_t period;					//Clock ticks, 0 for one shot
+	uint8_t event;						//Sched_event
+	uint8_t armed;
+} Sched_timer;
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Creates the application event loop task. Call before the modules register.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void sched_createTask(void);
+
+/**
+ * Registers the handler of an event. Called before BIOS_start.
+ *
+ * @param 	event		SCHED_EVT_*
+ * @param	initFxn		Runs once in the loop task before any handler, or NULL
+ * @param	handler		Runs for every post of the event
+ * @return 	none
+ */
+extern void sched_register(Sched_event event, Sched_initFxn initFxn, Sched_handler handler);
+
+/**
+ * Posts an event as a flag. Safe from Hwi, Swi and Task context.
+ *
+ * @param 	event		SCHED_EVT_*
+ * @return 	none
+ */
+extern void sched_post(Sched_event event);
+
+/**
+ * Queues an event with an argument in the mailbox. Safe from Hwi, Swi and Task context.
+ *
+ * @param 	event		SCHED_EVT_*
+ * @param	arg			Passed to the handler
+ * @return 	1 if queued, 0 when the mailbox is full
+ */
+extern uint8_t sched_send(Sched_event event, uint32_t arg);
+
+/**
+ * Starts or restarts a timer. Safe from Swi and Task context.
+ *
+ * @param 	pTimer		Timer, stays owned by the caller
+ * @param	event		SCHED_EVT_* posted on expiry
+ * @param	delayMs		Time to the first expiry
+ * @param	periodMs	Time between later expiries, 0 for one shot
+ * @return 	none
+ */
+extern void sched_timerStart(Sched_timer *pTimer, Sched_event event, uint32_t delayMs,
+							 uint32_t periodMs);
+
+/**
+ * Starts a one shot timer delayMs after its last deadline rather than after now, so a
+ * chain of expiries keeps its phase however late each handler runs. A deadline that
+ * has passed expires right away.
+ *
+ * @param 	pTimer		Timer that was started before
+ * @param	event		SCHED_EVT_* posted on expiry
+ * @param	delayMs		Time from the last deadline
+ * @return 	none
+ */
+extern void sched_timerNext(Sched_timer *pTimer, Sched_event event, uint32_t delayMs);
+
+/**
+ * Stops a timer. An expiry that was already posted is still handled.
+ *
+ * @param 	pTimer		Timer
+ * @return 	none
+ */
+extern void sched_timerStop(Sched_timer *pTimer);
+
+#endif /* SCHED_H */
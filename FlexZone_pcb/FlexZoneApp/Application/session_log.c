@@ -0,0 +1,803 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			session_log.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the offline session log. Keeps rep times
+ * 						and set summaries in OSAL SNV while no app is connected, and
+ * 						streams them to the app once it is back.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//XDCtools Header Files
+#include <xdc/runtime/Log.h>
+
+//SYS/BIOS Header Files
+#include <ti/sysbios/knl/Task.h>
+
+//BLE Stack Header Files
+#include <bcomdef.h>
+#include <osal_snv.h>
+
+//Home brewed Header Files
+#include "session_log.h"
+#include "emg.h"
+#include "set_summary.h"
+
+//Standard Header Files
+#include <string.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define SESSION_LOG_NONE					0xFFFF		//No record ends / starts in the block
+#define SESSION_LOG_NO_BLOCK				0xFFFFFFFF
+#define SESSION_LOG_ENCODE_CHUNK			32			//Summary bytes encoded at a time
+#define SESSION_LOG_CAPACITY				((uint32_t)(SESSION_LOG_BLOCKS - 1) * SESSION_LOG_BLOCK_DATA_LEN)
+#define SESSION_LOG_REP_TIMES_HEADER_LEN	7
+#define SESSION_LOG_REP_TIMES_MAX_LEN		(SESSION_LOG_REP_TIMES_HEADER_LEN + (EMG_MAX_REPS - 1) * 5)
+
+#define SESSION_LOG_NV_ID(index)			(SESSION_LOG_NV_FIRST + (index) % SESSION_LOG_BLOCKS)
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+//Block being filled, header and data as written to SNV
+static uint8_t headBlock[SESSION_LOG_BLOCK_SIZE];
+static uint32_t headIndex = 0;
+static uint16_t headUsed = 0;
+static uint16_t headEnd = SESSION_LOG_NONE;		//Bytes of complete records
+static uint16_t headFirst = SESSION_LOG_NONE;	//First record that starts in it
+static uint8_t headDirty = 0;
+
+//Blocks in SNV before the head, headIndex - storedBlocks on
+static uint8_t storedBlocks = 0;
+static uint16_t blockFirst[SESSION_LOG_BLOCKS];
+
+//Rep end times not logged yet, reps stagedFirst on of set stagedSet
+static uint8_t stagedSet = 0;
+static uint8_t stagedFirst = 0;
+static uint8_t stagedCount = 0;
+static uint32_t stagedEndMs[EMG_MAX_REPS];
+
+//Last block read back for the sync
+static uint8_t readBlock[SESSION_LOG_BLOCK_SIZE];
+static uint32_t readIndex = SESSION_LOG_NO_BLOCK;
+
+static uint32_t firstOffset = 0;
+static uint32_t endOffset = 0;
+static uint32_t writtenEnd = 0;		//End of the records in SNV, where a sync stops
+static uint32_t ackedOffset = 0;
+static uint16_t lostRecords = 0;
+static uint8_t stateDirty = 0;		//ackedOffset or lostRecords not written yet
+
+//Characteristic value, rebuilt by publishStatus so the stack task never reads it
+//half updated
+static uint8_t status[SESSION_LOG_STATUS_LEN];
+
+//Bulk sync
+static uint8_t syncActive = 0;
+static uint8_t syncEndSent = 0;
+static uint8_t syncWindow = SESSION_LOG_DEFAULT_WINDOW;
+static uint32_t syncSent = 0;		//Next offset to send
+static uint32_t syncAcked = 0;		//Everything below arrived
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static void startHead(uint32_t index);
+static uint8_t writeHead(void);
+static void nextBlock(void);
+static uint16_t countUnacked(uint32_t index);
+static uint32_t oldestOffset(void);
+static uint8_t putRecord(uint8_t type, uint16_t len, uint16_t crc, const uint8_t *pData,
+						 const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion);
+static uint8_t putRepTimes(void);
+static void putBytes(const uint8_t *pData, uint16_t len);
+static const uint8_t *locate(uint32_t offset, uint16_t *pAvail);
+static uint8_t loadBlock(uint32_t index);
+static void publishStatus(void);
+static uint16_t get16(const uint8_t *p);
+static uint32_t get32(const uint8_t *p);
+static void put16(uint8_t *p, uint16_t value);
+static void put32(uint8_t *p, uint32_t value);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Reads the log blocks and finds the end of the log. All sessionLog_* functions but
+ * sessionLog_read run in the BLE application task, after ICall registration.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void sessionLog_init(void)
+{
+	uint32_t base[SESSION_LOG_BLOCKS];
+	uint8_t state[SESSION_LOG_STATE_LEN];
+	uint8_t i;
+
+	syncActive = 0;
+	readIndex = SESSION_LOG_NO_BLOCK;
+	stagedCount = 0;
+	ackedOffset = 0;
+	lostRecords = 0;
+	stateDirty = 0;
+	if (osal_snv_read(SESSION_LOG_NV_STATE, SESSION_LOG_STATE_LEN, state) == SUCCESS) {
+		ackedOffset = get32(&state[0]);
+		lostRecords = get16(&state[4]);
+	}
+
+	//The end of the log is the end of the newest complete record in any block
+	endOffset = 0;
+	for (i = 0; i < SESSION_LOG_BLOCKS; i++) {
+		uint16_t end;
+
+		base[i] = SESSION_LOG_NO_BLOCK;
+		if (osal_snv_read(SESSION_LOG_NV_FIRST + i, SESSION_LOG_BLOCK_SIZE, readBlock) != SUCCESS)
+			continue;
+		base[i] = get32(&readBlock[0]);
+		end = get16(&readBlock[4]);
+		blockFirst[i] = get16(&readBlock[6]);
+		if (base[i] % SESSION_LOG_BLOCK_DATA_LEN ||
+				(base[i] / SESSION_LOG_BLOCK_DATA_LEN) % SESSION_LOG_BLOCKS != i) {
+			base[i] = SESSION_LOG_NO_BLOCK;
+			continue;
+		}
+		if (end != SESSION_LOG_NONE && end <= SESSION_LOG_BLOCK_DATA_LEN && base[i] + end > endOffset)
+			endOffset = base[i] + end;
+	}
+
+	//Continue in the block that holds the end, without what a power loss cut short
+	startHead(endOffset / SESSION_LOG_BLOCK_DATA_LEN);
+	i = headIndex % SESSION_LOG_BLOCKS;
+	if (base[i] == headIndex * SESSION_LOG_BLOCK_DATA_LEN &&
+			osal_snv_read(SESSION_LOG_NV_FIRST + i, SESSION_LOG_BLOCK_SIZE, headBlock) == SUCCESS) {
+		headUsed = endOffset - base[i];
+		if (headUsed)
+			headEnd = headUsed;
+		if (blockFirst[i] < headUsed)
+			headFirst = blockFirst[i];
+	}
+
+	//Whole blocks right before it
+	storedBlocks = 0;
+	while (storedBlocks < SESSION_LOG_BLOCKS - 1 && storedBlocks < headIndex) {
+		uint32_t index = headIndex - storedBlocks - 1;
+
+		if (base[index % SESSION_LOG_BLOCKS] != index * SESSION_LOG_BLOCK_DATA_LEN)
+			break;
+		storedBlocks++;
+	}
+
+	firstOffset = oldestOffset();
+	writtenEnd = endOffset;
+	if (ackedOffset > endOffset)
+		ackedOffset = endOffset;
+	publishStatus();
+
+	Log_info3("Session log: %d bytes, %d acked, %d blocks",
+			  (IArg)(endOffset - firstOffset), (IArg)(ackedOffset - firstOffset), (IArg)(storedBlocks + 1));
+}
+
+/**
+ * Appends one record.
+ *
+ * @param 	type		SESSION_LOG_REC_*
+ * @param	pData		Payload
+ * @param	len			Payload length, at most SESSION_LOG_MAX_PAYLOAD
+ * @return 	1 if stored
+ */
+uint8_t sessionLog_append(uint8_t type, const uint8_t *pData, uint16_t len)
+{
+	uint16_t crc;
+
+	if (len > SESSION_LOG_MAX_PAYLOAD)
+		return 0;
+
+	crc = setSummary_crc16(&type, 1, 0xFFFF);
+	crc = setSummary_crc16(pData, len, crc);
+	return putRecord(type, len, crc, pData, NULL, 0, 0);
+}
+
+/**
+ * Keeps the end time of a rep event for the next SESSION_LOG_REC_REP_TIMES record.
+ *
+ * @param 	pEvent		Rep event, see emg.h
+ * @param	len			Its length, EMG_REP_EVENT_LEN
+ * @return 	1 if kept
+ */
+uint8_t sessionLog_appendRep(const uint8_t *pEvent, uint16_t len)
+{
+	if (len < EMG_REP_EVENT_LEN)
+		return 0;
+
+	//One record holds consecutive reps of one set
+	if (stagedCount && (pEvent[1] != stagedSet || pEvent[2] != stagedFirst + stagedCount ||
+			stagedCount == EMG_MAX_REPS) && !putRepTimes())
+		return 0;
+
+	if (stagedCount == 0) {
+		stagedSet = pEvent[1];
+		stagedFirst = pEvent[2];
+	}
+	stagedEndMs[stagedCount++] = get32(&pEvent[4]);
+	return 1;
+}
+
+/**
+ * Appends the rep times kept for it, a set summary record and writes the block being
+ * filled.
+ *
+ * @param 	stats		Finished set
+ * @param	setIndex	Index of the set in the workout
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @return 	1 if stored
+ */
+uint8_t sessionLog_appendSet(const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion)
+{
+	uint8_t type = SESSION_LOG_REC_SET_SUMMARY;
+	uint8_t chunk[SESSION_LOG_ENCODE_CHUNK];
+	uint16_t len = setSummary_encodeRange(stats, setIndex, withMotion, 0, NULL, 0);
+	uint16_t crc;
+	uint16_t pos;
+	uint16_t n;
+
+	if (len > SESSION_LOG_MAX_PAYLOAD || !putRepTimes())
+		return 0;
+
+	//The header goes first, so the summary is encoded twice: once for the CRC,
+	//once into the log
+	crc = setSummary_crc16(&type, 1, 0xFFFF);
+	for (pos = 0; pos < len; pos += n) {
+		n = MIN(len - pos, SESSION_LOG_ENCODE_CHUNK);
+		setSummary_encodeRange(stats, setIndex, withMotion, pos, chunk, n);
+		crc = setSummary_crc16(chunk, n, crc);
+	}
+
+	//The end of a set, the summary and the rep times before it go to SNV
+	return putRecord(type, len, crc, NULL, stats, setIndex, withMotion) && writeHead();
+}
+
+/**
+ * Handles a write to the Session Log characteristic.
+ *
+ * @param 	pBuf		Write
+ * @param	len			Write length
+ * @return 	1 while a sync runs
+ */
+uint8_t sessionLog_control(const uint8_t *pBuf, uint16_t len)
+{
+	uint32_t offset;
+
+	if (len < 1)
+		return syncActive;
+
+	switch (pBuf[0]) {
+	case SESSION_LOG_OP_START:
+		if (len < 5)
+			break;
+		offset = get32(&pBuf[1]);
+		if (offset < firstOffset || offset > writtenEnd)
+			offset = firstOffset;
+		syncSent = offset;
+		syncAcked = offset;
+		syncWindow = (len > 5 && pBuf[5]) ? pBuf[5] : SESSION_LOG_DEFAULT_WINDOW;
+		syncEndSent = 0;
+		syncActive = 1;
+		Log_info2("Session log: sync from %d, %d bytes", (IArg)offset, (IArg)(writtenEnd - offset));
+		break;
+
+	case SESSION_LOG_OP_ACK:
+		if (!syncActive || len < 5)
+			break;
+		offset = get32(&pBuf[1]);
+		if (offset > syncAcked && offset <= syncSent)
+			syncAcked = offset;
+		if (syncEndSent && syncAcked == writtenEnd) {
+			UInt key = Task_disable();
+
+			//Written by sessionLog_flush once the connection is gone
+			syncActive = 0;
+			if (syncAcked > ackedOffset) {
+				ackedOffset = syncAcked;
+				stateDirty = 1;
+			}
+			Task_restore(key);
+			publishStatus();
+			Log_info1("Session log: synced up to %d", (IArg)syncAcked);
+		}
+		break;
+
+	case SESSION_LOG_OP_STOP:
+		syncActive = 0;
+		break;
+	}
+
+	return syncActive;
+}
+
+/**
+ * Builds the next sync notification. The sync moves on only when
+ * sessionLog_chunkSent confirms it.
+ *
+ * @param 	pDst		Output, NULL to only get the length
+ * @param	maxLen		Largest notification
+ * @return 	Notification length, 0 if there is nothing to send now.
+ */
+uint16_t sessionLog_nextChunk(uint8_t *pDst, uint16_t maxLen)
+{
+	const uint8_t *pSrc = NULL;
+	uint16_t len = 0;
+
+	if (!syncActive || maxLen <= SESSION_LOG_CHUNK_HEADER_LEN)
+		return 0;
+
+	if (syncSent >= writtenEnd) {
+		//Only the end of log notice is left
+		if (syncEndSent)
+			return 0;
+	}
+	else {
+		if (syncSent - syncAcked >= (uint32_t)syncWindow * (maxLen - SESSION_LOG_CHUNK_HEADER_LEN))
+			return 0;	//Window full, wait for an ack
+		pSrc = locate(syncSent, &len);
+		if (pSrc == NULL) {
+			//Block unreadable, go on with the next record after it
+			syncSent = len ? syncSent + len : writtenEnd;
+			return 0;
+		}
+		len = MIN(len, maxLen - SESSION_LOG_CHUNK_HEADER_LEN);
+	}
+
+	if (pDst != NULL) {
+		put32(pDst, syncSent);
+		if (len)
+			memcpy(&pDst[SESSION_LOG_CHUNK_HEADER_LEN], pSrc, len);
+	}
+	return SESSION_LOG_CHUNK_HEADER_LEN + len;
+}
+
+/**
+ * The notification built by sessionLog_nextChunk went out.
+ *
+ * @param 	len			Its length
+ * @return 	none
+ */
+void sessionLog_chunkSent(uint16_t len)
+{
+	if (len <= SESSION_LOG_CHUNK_HEADER_LEN)
+		syncEndSent = 1;
+	else
+		syncSent += len - SESSION_LOG_CHUNK_HEADER_LEN;
+}
+
+/**
+ * Ends the sync, the app resumes it with a new start.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void sessionLog_stopSync(void)
+{
+	syncActive = 0;
+}
+
+/**
+ * Writes what waits in RAM: the rep times kept, the block being filled and the acked
+ * offset. Call when the connection is gone.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void sessionLog_flush(void)
+{
+	uint8_t state[SESSION_LOG_STATE_LEN];
+
+	putRepTimes();
+	if (headDirty)
+		writeHead();
+
+	if (stateDirty) {
+		put32(&state[0], ackedOffset);
+		put16(&state[4], lostRecords);
+		if (osal_snv_write(SESSION_LOG_NV_STATE, SESSION_LOG_STATE_LEN, state) == SUCCESS)
+			stateDirty = 0;
+		else
+			Log_error0("Session log: state not written");
+	}
+}
+
+/**
+ * Copies part of the characteristic value. Runs in the BLE stack task.
+ *
+ * @param 	offset		First byte
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+uint16_t sessionLog_read(uint16_t offset, uint8_t *pDst, uint16_t maxLen)
+{
+	uint16_t len;
+
+	if (offset >= SESSION_LOG_STATUS_LEN)
+		return 0;
+
+	len = MIN(maxLen, SESSION_LOG_STATUS_LEN - offset);
+	memcpy(pDst, &status[offset], len);
+	return len;
+}
+
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Makes a block the empty head.
+ *
+ * @param 	index		Block of the stream
+ * @return 	none
+ */
+static void startHead(uint32_t index)
+{
+	memset(headBlock, 0xFF, sizeof(headBlock));
+	headIndex = index;
+	headUsed = 0;
+	headEnd = SESSION_LOG_NONE;
+	headFirst = SESSION_LOG_NONE;
+	headDirty = 0;
+}
+
+/**
+ * Writes the head block to its SNV item. The stack does the flash work and any
+ * compaction it takes.
+ *
+ * @param 	none
+ * @return 	1 on success
+ */
+static uint8_t writeHead(void)
+{
+	put32(&headBlock[0], headIndex * SESSION_LOG_BLOCK_DATA_LEN);
+	put16(&headBlock[4], headEnd);
+	put16(&headBlock[6], headFirst);
+	if (readIndex == headIndex)
+		readIndex = SESSION_LOG_NO_BLOCK;
+
+	if (osal_snv_write(SESSION_LOG_NV_ID(headIndex), SESSION_LOG_BLOCK_SIZE, headBlock) != SUCCESS) {
+		Log_error1("Session log: block %d not written", (IArg)headIndex);
+		return 0;
+	}
+	headDirty = 0;
+	if (headEnd != SESSION_LOG_NONE)
+		writtenEnd = headIndex * SESSION_LOG_BLOCK_DATA_LEN + headEnd;
+	return 1;
+}
+
+/**
+ * Moves on to the next block once the head is full and written, dropping the oldest
+ * block if the ring is full.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void nextBlock(void)
+{
+	uint16_t lost = 0;
+	UInt key;
+
+	if (storedBlocks == SESSION_LOG_BLOCKS - 1)
+		lost = countUnacked(headIndex - storedBlocks);
+
+	blockFirst[headIndex % SESSION_LOG_BLOCKS] = headFirst;
+	key = Task_disable();
+	if (lost) {
+		lostRecords += lost;
+		stateDirty = 1;
+	}
+	else if (storedBlocks < SESSION_LOG_BLOCKS - 1) {
+		storedBlocks++;
+	}
+	Task_restore(key);
+	startHead(headIndex + 1);
+
+	if (lost)
+		Log_warning1("Session log full, %d records lost", (IArg)lost);
+}
+
+/**
+ * Records starting in a block the app has not acked.
+ *
+ * @param 	index		Block of the stream
+ * @return 	Record count
+ */
+static uint16_t countUnacked(uint32_t index)
+{
+	uint32_t base = index * SESSION_LOG_BLOCK_DATA_LEN;
+	uint16_t pos = blockFirst[index % SESSION_LOG_BLOCKS];
+	uint16_t count = 0;
+
+	if (pos == SESSION_LOG_NONE || base + SESSION_LOG_BLOCK_DATA_LEN <= ackedOffset)
+		return 0;
+	if (!loadBlock(index))
+		return 1;
+
+	//Only the length of records that start after it in the block is needed
+	while (pos < SESSION_LOG_BLOCK_DATA_LEN) {
+		const uint8_t *r = &readBlock[SESSION_LOG_BLOCK_HEADER_LEN + pos];
+
+		if (base + pos >= ackedOffset)
+			count++;
+		if (pos + 2 > SESSION_LOG_BLOCK_DATA_LEN)
+			break;
+		pos += SESSION_LOG_RECORD_HEADER_LEN + get16(r);
+	}
+	return count;
+}
+
+/**
+ * Log offset of the oldest record still stored.
+ *
+ * @param 	none
+ * @return 	Offset
+ */
+static uint32_t oldestOffset(void)
+{
+	uint32_t index = headIndex - storedBlocks;
+
+	for (; index < headIndex; index++)
+		if (blockFirst[index % SESSION_LOG_BLOCKS] != SESSION_LOG_NONE)
+			return index * SESSION_LOG_BLOCK_DATA_LEN + blockFirst[index % SESSION_LOG_BLOCKS];
+	if (headFirst != SESSION_LOG_NONE)
+		return headIndex * SESSION_LOG_BLOCK_DATA_LEN + headFirst;
+	return endOffset;
+}
+
+/**
+ * Appends a record to the head, writing and moving on from every block it fills.
+ *
+ * @param 	type		SESSION_LOG_REC_*
+ * @param	len			Payload length
+ * @param	crc			CRC over type and payload
+ * @param	pData		Payload, NULL to encode the set summary below
+ * @param	stats		Finished set
+ * @param	setIndex	Index of the set in the workout
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @return 	1 on success
+ */
+static uint8_t putRecord(uint8_t type, uint16_t len, uint16_t crc, const uint8_t *pData,
+						 const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion)
+{
+	uint8_t hdr[SESSION_LOG_RECORD_HEADER_LEN];
+	uint8_t chunk[SESSION_LOG_ENCODE_CHUNK];
+	uint16_t pos;
+	uint16_t n;
+	UInt key;
+
+	if ((uint32_t)SESSION_LOG_RECORD_HEADER_LEN + len > SESSION_LOG_CAPACITY)
+		return 0;
+
+	//A set summary may have filled and written it already
+	if (headUsed == SESSION_LOG_BLOCK_DATA_LEN) {
+		if (headDirty)
+			writeHead();
+		nextBlock();
+	}
+	if (headFirst == SESSION_LOG_NONE)
+		headFirst = headUsed;
+
+	put16(&hdr[0], len);
+	hdr[2] = type;
+	hdr[3] = 0x00;
+	put16(&hdr[4], crc);
+	putBytes(hdr, SESSION_LOG_RECORD_HEADER_LEN);
+	if (pData != NULL) {
+		putBytes(pData, len);
+	}
+	else {
+		for (pos = 0; pos < len; pos += n) {
+			n = MIN(len - pos, SESSION_LOG_ENCODE_CHUNK);
+			setSummary_encodeRange(stats, setIndex, withMotion, pos, chunk, n);
+			putBytes(chunk, n);
+		}
+	}
+
+	headEnd = headUsed;
+	headDirty = 1;
+	key = Task_disable();
+	endOffset += SESSION_LOG_RECORD_HEADER_LEN + len;
+	firstOffset = oldestOffset();
+	Task_restore(key);
+	publishStatus();
+	return 1;
+}
+
+/**
+ * Appends the rep end times kept as one SESSION_LOG_REC_REP_TIMES record.
+ *
+ * @param 	none
+ * @return 	1 on success or if none are kept
+ */
+static uint8_t putRepTimes(void)
+{
+	uint8_t type = SESSION_LOG_REC_REP_TIMES;
+	uint8_t buf[SESSION_LOG_REP_TIMES_MAX_LEN];
+	uint16_t len = SESSION_LOG_REP_TIMES_HEADER_LEN;
+	uint16_t crc;
+	uint32_t v;
+	uint8_t i;
+
+	if (stagedCount == 0)
+		return 1;
+
+	buf[0] = stagedSet;
+	buf[1] = stagedFirst;
+	buf[2] = stagedCount;
+	put32(&buf[3], stagedEndMs[0]);
+	for (i = 1; i < stagedCount; i++) {
+		int32_t delta = (int32_t)(stagedEndMs[i] - stagedEndMs[i - 1]);
+
+		//Zigzag, the shared time may be set back between reps
+		v = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+		while (v >= 0x80) {
+			buf[len++] = (uint8_t)(v | 0x80);
+			v >>= 7;
+		}
+		buf[len++] = (uint8_t)v;
+	}
+	stagedCount = 0;
+
+	crc = setSummary_crc16(&type, 1, 0xFFFF);
+	crc = setSummary_crc16(buf, len, crc);
+	return putRecord(type, len, crc, buf, NULL, 0, 0);
+}
+
+/**
+ * Copies record bytes into the head. A full head is written and the next block
+ * started, unless these are the last bytes of the record.
+ *
+ * @param 	pData		Bytes
+ * @param	len			Length of pData
+ * @return 	none
+ */
+static void putBytes(const uint8_t *pData, uint16_t len)
+{
+	uint16_t n;
+
+	while (len) {
+		if (headUsed == SESSION_LOG_BLOCK_DATA_LEN) {
+			writeHead();
+			nextBlock();
+		}
+		n = MIN(len, SESSION_LOG_BLOCK_DATA_LEN - headUsed);
+		memcpy(&headBlock[SESSION_LOG_BLOCK_HEADER_LEN + headUsed], pData, n);
+		headUsed += n;
+		pData += n;
+		len -= n;
+	}
+}
+
+/**
+ * Finds the stored bytes at a log offset.
+ *
+ * @param 	offset		Log offset
+ * @param	pAvail		Returns the bytes from there to the end of its block or of the
+ * 						written records, or for an unreadable block the bytes to the
+ * 						next record after it
+ * @return 	First byte, NULL if the offset is not readable.
+ */
+static const uint8_t *locate(uint32_t offset, uint16_t *pAvail)
+{
+	uint32_t index = offset / SESSION_LOG_BLOCK_DATA_LEN;
+	uint16_t pos = offset % SESSION_LOG_BLOCK_DATA_LEN;
+
+	*pAvail = 0;
+	if (offset < firstOffset || offset >= writtenEnd)
+		return NULL;
+
+	if (index == headIndex) {
+		*pAvail = writtenEnd - offset;
+		return &headBlock[SESSION_LOG_BLOCK_HEADER_LEN + pos];
+	}
+
+	if (!loadBlock(index)) {
+		uint32_t next;
+
+		//Skip to the next record that starts in a later block
+		while (++index < headIndex && blockFirst[index % SESSION_LOG_BLOCKS] == SESSION_LOG_NONE);
+		next = (index < headIndex) ? index * SESSION_LOG_BLOCK_DATA_LEN + blockFirst[index % SESSION_LOG_BLOCKS] :
+				(headFirst != SESSION_LOG_NONE) ? headIndex * SESSION_LOG_BLOCK_DATA_LEN + headFirst : writtenEnd;
+		*pAvail = (uint16_t)MIN(MIN(next, writtenEnd) - offset, 0xFFFF);
+		return NULL;
+	}
+	*pAvail = (uint16_t)MIN(SESSION_LOG_BLOCK_DATA_LEN - pos, writtenEnd - offset);
+	return &readBlock[SESSION_LOG_BLOCK_HEADER_LEN + pos];
+}
+
+/**
+ * Reads a stored block into readBlock, if it is not there already.
+ *
+ * @param 	index		Block of the stream
+ * @return 	1 on success
+ */
+static uint8_t loadBlock(uint32_t index)
+{
+	if (readIndex == index)
+		return 1;
+
+	readIndex = SESSION_LOG_NO_BLOCK;
+	if (osal_snv_read(SESSION_LOG_NV_ID(index), SESSION_LOG_BLOCK_SIZE, readBlock) != SUCCESS ||
+			get32(&readBlock[0]) != index * SESSION_LOG_BLOCK_DATA_LEN)
+		return 0;
+	readIndex = index;
+	return 1;
+}
+
+/**
+ * Rebuilds the characteristic value.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void publishStatus(void)
+{
+	UInt key = Task_disable();
+
+	status[0] = SESSION_LOG_VERSION;
+	put32(&status[1], firstOffset);
+	put32(&status[5], endOffset);
+	put32(&status[9], ackedOffset);
+	status[13] = LO_UINT16(lostRecords);
+	status[14] = HI_UINT16(lostRecords);
+	Task_restore(key);
+}
+
+/**
+ * Reads a little endian uint16.
+ *
+ * @param 	p			First byte
+ * @return 	Value
+ */
+static uint16_t get16(const uint8_t *p)
+{
+	return BUILD_UINT16(p[0], p[1]);
+}
+
+/**
+ * Reads a little endian uint32.
+ *
+ * @param 	p			First byte
+ * @return 	Value
+ */
+static uint32_t get32(const uint8_t *p)
+{
+	return BUILD_UINT32(p[0], p[1], p[2], p[3]);
+}
+
+/**
+ * Writes a little endian uint16.
+ *
+ * @param 	p			First byte
+ * @param	value		Value
+ * @return 	none
+ */
+static void put16(uint8_t *p, uint16_t value)
+{
+	p[0] = LO_UINT16(value);
+	p[1] = HI_UINT16(value);
+}
+
+/**
+ * Writes a little endian uint32.
+ *
+ * @param 	p			First byte
+ * @param	value		Value
+ * @return 	none
+ */
+static void put32(uint8_t *p, uint32_t value)
+{
+	p[0] = BREAK_UINT32(value, 0);
+	p[1] = BREAK_UINT32(value, 1);
+	p[2] = BREAK_UINT32(value, 2);
+	p[3] = BREAK_UINT32(value, 3);
+}
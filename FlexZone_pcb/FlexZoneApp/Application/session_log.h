@@ -0,0 +1,212 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			session_log.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the offline session log and its bulk sync.
+ */
+#ifndef SESSION_LOG_H
+#define SESSION_LOG_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+//OSAL SNV items of the log, from the customer range of bcomdef.h. The stack writes
+//them, so flash is only erased where it is safe for the radio.
+#define SESSION_LOG_NV_FIRST				BLE_NVID_CUST_START
+#define SESSION_LOG_BLOCKS					12
+#define SESSION_LOG_NV_STATE				(SESSION_LOG_NV_FIRST + SESSION_LOG_BLOCKS)
+#define SESSION_LOG_BLOCK_SIZE				128		//SNV item length
+#define SESSION_LOG_BLOCK_HEADER_LEN		8
+#define SESSION_LOG_BLOCK_DATA_LEN			(SESSION_LOG_BLOCK_SIZE - SESSION_LOG_BLOCK_HEADER_LEN)
+#define SESSION_LOG_STATE_LEN				6
+
+#define SESSION_LOG_VERSION					3
+#define SESSION_LOG_RECORD_HEADER_LEN		6
+#define SESSION_LOG_MAX_PAYLOAD				512
+
+//Record types
+#define SESSION_LOG_REC_REP_EVENT			0x01	//Rep event, see emg.h
+#define SESSION_LOG_REC_SET_SUMMARY			0x02	//Whole set summary, see set_summary.h
+#define SESSION_LOG_REC_REP_TIMES			0x03	//Rep end times, see below
+
+/*
+ * The log is a stream of records
+ * 	[0-1]	payload length
+ * 	[2]		SESSION_LOG_REC_*
+ * 	[3]		0x00, the record is complete
+ * 	[4-5]	CRC-16/CCITT-FALSE over type and payload
+ * 	then the payload
+ * kept in a ring of SNV items of SESSION_LOG_BLOCK_DATA_LEN stream bytes each. Block
+ * k of the stream, offsets k * SESSION_LOG_BLOCK_DATA_LEN on, is item
+ * SESSION_LOG_NV_FIRST + k % SESSION_LOG_BLOCKS:
+ * 	[0-3]	log offset of its first byte
+ * 	[4-5]	bytes of complete records, up to the end of the last record that ends in
+ * 			the block, 0xFFFF if none does
+ * 	[6-7]	where the first record that starts in the block starts, 0xFFFF if none does
+ * 	then the stream bytes
+ * Multi-byte fields are little endian. Records run on from one block into the next.
+ *
+ * A log offset counts record bytes since the log was formatted, so it never goes back.
+ * Records are appended while disconnected. Rep events are not logged one by one: the
+ * set summary repeats everything in them but the time, so only their end times are
+ * kept, in RAM, and go into one SESSION_LOG_REC_REP_TIMES record ahead of the summary
+ * (or when the connection ends, or a rep does not follow on):
+ * 	[0]		set index, as in the rep event
+ * 	[1]		index of the first rep
+ * 	[2]		reps
+ * 	[3-6]	end of the first rep, shared ms
+ * 	then per further rep an unsigned LEB128 varint of zigzag(ms since the end of the
+ * 	rep before)
+ * That takes a rep from 24 log bytes to about 2. The block being filled stays in RAM
+ * and is written when it is full, after each set summary and when a connection ends,
+ * so a power loss costs at most the rep events of the set in progress. The stack
+ * replaces an SNV item as a whole, so a block is either the old or the new one after
+ * a power loss.
+ *
+ * The ring holds (SESSION_LOG_BLOCKS - 1) * SESSION_LOG_BLOCK_DATA_LEN = 1320 record
+ * bytes plus the block in RAM, about 2.5 workouts of 4 sets of up to EMG_MAX_REPS
+ * reps (tools/host/session_log_test; 1.1 when each rep event was logged whole). When
+ * it is full the oldest block is reused. The app is told: records it had not acked are counted as
+ * lost in the status below, and a sync from an offset no longer stored starts at the
+ * oldest record, which the first notification shows.
+ *
+ * SESSION_LOG_NV_STATE holds the acked offset [0-3] and the lost record count [4-5].
+ *
+ * Bulk sync, on the EMG Session Log characteristic. The app writes
+ * 	[0]		SESSION_LOG_OP_START
+ * 	[1-4]	offset to send from, usually the last offset it acked
+ * 	[5]		window, notifications in flight before an ack (0 for the default)
+ * and gets notifications of
+ * 	[0-3]	log offset of the first byte
+ * 	then the records from that offset on
+ * A notification with no record bytes means the device has sent everything. The app
+ * acks with
+ * 	[0]		SESSION_LOG_OP_ACK
+ * 	[1-4]	offset, everything below it arrived
+ * A sync sends the records written to SNV, so an offset the app has seen is never reused
+ * after a power loss. Rep events of a set still in RAM follow with the next sync. An ack
+ * of the last of them finishes the sync. The acked offset is written once the
+ * connection ends, so the sync itself never waits on flash. If the device loses power
+ * before that, the app gets those records again and drops them by offset. After a link
+ * drop the app starts again from its last offset. An offset that is no longer stored
+ * starts at the oldest record, which the first notification shows. SESSION_LOG_OP_STOP
+ * ends a sync early.
+ *
+ * Reading the characteristic returns
+ * 	[0]		SESSION_LOG_VERSION
+ * 	[1-4]	offset of the oldest record still stored
+ * 	[5-8]	end of the log
+ * 	[9-12]	acked offset
+ * 	[13-14]	records lost because the ring filled up before they were acked
+ */
+#define SESSION_LOG_OP_START				0x01
+#define SESSION_LOG_OP_ACK					0x02
+#define SESSION_LOG_OP_STOP					0x03
+
+#define SESSION_LOG_CTRL_LEN				6
+#define SESSION_LOG_STATUS_LEN				15
+#define SESSION_LOG_CHUNK_HEADER_LEN		4
+#define SESSION_LOG_DEFAULT_WINDOW			8
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Reads the log blocks and finds the end of the log. All sessionLog_* functions but
+ * sessionLog_read run in the BLE application task, after ICall registration.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void sessionLog_init(void);
+
+/**
+ * Appends one record.
+ *
+ * @param 	type		SESSION_LOG_REC_*
+ * @param	pData		Payload
+ * @param	len			Payload length, at most SESSION_LOG_MAX_PAYLOAD
+ * @return 	1 if stored
+ */
+extern uint8_t sessionLog_append(uint8_t type, const uint8_t *pData, uint16_t len);
+
+/**
+ * Keeps the end time of a rep event for the next SESSION_LOG_REC_REP_TIMES record.
+ *
+ * @param 	pEvent		Rep event, see emg.h
+ * @param	len			Its length, EMG_REP_EVENT_LEN
+ * @return 	1 if kept
+ */
+extern uint8_t sessionLog_appendRep(const uint8_t *pEvent, uint16_t len);
+
+/**
+ * Appends the rep times kept for it, a set summary record and writes the block being
+ * filled.
+ *
+ * @param 	stats		Finished set
+ * @param	setIndex	Index of the set in the workout
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @return 	1 if stored
+ */
+extern uint8_t sessionLog_appendSet(const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion);
+
+/**
+ * Handles a write to the Session Log characteristic.
+ *
+ * @param 	pBuf		Write
+ * @param	len			Write length
+ * @return 	1 while a sync runs
+ */
+extern uint8_t sessionLog_control(const uint8_t *pBuf, uint16_t len);
+
+/**
+ * Builds the next sync notification. The sync moves on only when
+ * sessionLog_chunkSent confirms it.
+ *
+ * @param 	pDst		Output, NULL to only get the length
+ * @param	maxLen		Largest notification
+ * @return 	Notification length, 0 if there is nothing to send now.
+ */
+extern uint16_t sessionLog_nextChunk(uint8_t *pDst, uint16_t maxLen);
+
+/**
+ * The notification built by sessionLog_nextChunk went out.
+ *
+ * @param 	len			Its length
+ * @return 	none
+ */
+extern void sessionLog_chunkSent(uint16_t len);
+
+/**
+ * Ends the sync, the app resumes it with a new start.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void sessionLog_stopSync(void);
+
+/**
+ * Writes what waits in RAM: the rep times kept, the block being filled and the acked
+ * offset. Call when the connection is gone.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void sessionLog_flush(void);
+
+/**
+ * Copies part of the characteristic value. Runs in the BLE stack task.
+ *
+ * @param 	offset		First byte
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+extern uint16_t sessionLog_read(uint16_t offset, uint8_t *pDst, uint16_t maxLen);
+
+#endif /* SESSION_LOG_H */
@@ -0,0 +1,268 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			set_history.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the readable set summary history.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//SYS/BIOS Header Files
+#include <ti/sysbios/knl/Task.h>
+
+//BLE Stack Header Files
+#include <bcomdef.h>
+
+//Home brewed Header Files
+#include "set_history.h"
+
+//Standard Header Files
+#include <string.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define SET_HISTORY_LEN_PREFIX				2
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+//Summaries back to back, each behind its length, oldest first. Only bytes below
+//storeUsed are visible to readers.
+static uint8_t store[SET_HISTORY_STORE_LEN];
+static uint16_t storeUsed = 0;
+static uint8_t storeCount = 0;
+static uint8_t storeIds[SET_HISTORY_MAX_SETS];		//setHistory_add ids, same order
+static uint8_t nextId = 1;
+static uint8_t generation = 0;
+static uint8_t lastSetIndex = 0;
+
+//Session aggregate
+static uint8_t sessionSets = 0;
+static uint16_t sessionReps = 0;
+static uint16_t sessionMaxPeak = 0;
+static uint32_t sessionTutMs = 0;
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static void dropOldest(void);
+static uint16_t findEntry(uint8_t id, uint16_t *pLen);
+static void buildHeader(uint8_t *pHdr);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Stores a finished set and adds it to the session aggregate. The first set of a
+ * workout starts a new session. Runs in the BLE application task.
+ *
+ * @param 	stats		Finished set
+ * @param	setIndex	Index of the set in the workout, from 1
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @return 	Id of the stored summary for setHistory_fillFragment, never 0.
+ */
+uint8_t setHistory_add(const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion)
+{
+	uint16_t len = setSummary_encodeRange(stats, setIndex, withMotion, 0, NULL, 0);
+	uint32_t tut = 0;
+	uint16_t peak = 0;
+	uint8_t numReps = MIN(stats->numReps, EMG_MAX_REPS);
+	uint8_t i;
+	UInt key;
+
+	for (i = 0; i < numReps; i++) {
+		tut += stats->pulseWidth[i];
+		if (stats->peakIntensity[i] > peak)
+			peak = stats->peakIntensity[i];
+	}
+
+	//Make room. The stack task reads between our calls, so it must never see a
+	//half moved store.
+	key = Task_disable();
+	if (setIndex <= 1) {
+		storeUsed = 0;
+		storeCount = 0;
+		lastSetIndex = 0;
+		sessionSets = 0;
+		sessionReps = 0;
+		sessionMaxPeak = 0;
+		sessionTutMs = 0;
+	}
+	while (storeCount > 0 && (storeCount == SET_HISTORY_MAX_SETS ||
+			storeUsed + SET_HISTORY_LEN_PREFIX + len > SET_HISTORY_STORE_LEN))
+		dropOldest();
+	Task_restore(key);
+
+	//Written past storeUsed, so readers do not see it yet
+	store[storeUsed] = LO_UINT16(len);
+	store[storeUsed + 1] = HI_UINT16(len);
+	setSummary_encodeRange(stats, setIndex, withMotion, 0,
+						   &store[storeUsed + SET_HISTORY_LEN_PREFIX], len);
+
+	key = Task_disable();
+	storeUsed += SET_HISTORY_LEN_PREFIX + len;
+	storeIds[storeCount] = nextId;
+	storeCount++;
+	generation++;
+	lastSetIndex = setIndex;
+	sessionSets++;
+	sessionReps += numReps;
+	sessionTutMs += tut;
+	if (peak > sessionMaxPeak)
+		sessionMaxPeak = peak;
+	Task_restore(key);
+
+	if (++nextId == 0)
+		nextId = 1;
+	return storeIds[storeCount - 1];
+}
+
+/**
+ * Writes one notification fragment of a stored summary, in the layout of
+ * setSummary_fillFragment, straight from the store. Runs in the BLE application task,
+ * like setHistory_add. Fragments of one summary must all use the same maxLen.
+ *
+ * @param 	id			Id from setHistory_add
+ * @param	fragIdx		Fragment to write
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst, at least 2
+ * @return 	Bytes written, 0 once fragIdx is past the last fragment or the summary
+ * 			was dropped from the store.
+ */
+uint16_t setHistory_fillFragment(uint8_t id, uint8_t fragIdx, uint8_t *pDst, uint16_t maxLen)
+{
+	uint16_t chunk = maxLen - 1;
+	uint16_t offset = fragIdx * chunk;
+	uint16_t pos, len, n;
+
+	pos = findEntry(id, &len);
+	if (pos == SET_HISTORY_STORE_LEN || offset >= len)
+		return 0;
+
+	n = MIN(chunk, len - offset);
+	pDst[0] = fragIdx & SET_SUMMARY_FRAG_INDEX_MASK;
+	if (offset + n == len)
+		pDst[0] |= SET_SUMMARY_FRAG_LAST;
+	memcpy(&pDst[1], &store[pos + SET_HISTORY_LEN_PREFIX + offset], n);
+
+	return n + 1;
+}
+
+/**
+ * Length of the characteristic value.
+ *
+ * @param 	none
+ * @return 	Bytes
+ */
+uint16_t setHistory_length(void)
+{
+	return SET_HISTORY_HEADER_LEN + storeUsed;
+}
+
+/**
+ * Index of the newest stored set.
+ *
+ * @param 	none
+ * @return 	Set index, 0 if nothing is stored.
+ */
+uint8_t setHistory_lastSetIndex(void)
+{
+	return storeCount ? lastSetIndex : 0;
+}
+
+/**
+ * Copies part of the characteristic value. Runs in the BLE stack task, which
+ * setHistory_add keeps out while it changes the store.
+ *
+ * @param 	offset		First byte, at most setHistory_length()
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+uint16_t setHistory_read(uint16_t offset, uint8_t *pDst, uint16_t maxLen)
+{
+	uint8_t hdr[SET_HISTORY_HEADER_LEN];
+	uint16_t total = setHistory_length();
+	uint16_t len, n = 0;
+
+	if (offset >= total)
+		return 0;
+	len = MIN(maxLen, total - offset);
+
+	//Header part, built on the fly
+	if (offset < SET_HISTORY_HEADER_LEN) {
+		buildHeader(hdr);
+		n = MIN(len, SET_HISTORY_HEADER_LEN - offset);
+		memcpy(pDst, &hdr[offset], n);
+		offset = SET_HISTORY_HEADER_LEN;
+	}
+
+	//Store part
+	memcpy(&pDst[n], &store[offset - SET_HISTORY_HEADER_LEN], len - n);
+
+	return len;
+}
+
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Removes the oldest summary. Call with tasks disabled.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void dropOldest(void)
+{
+	uint16_t entry = SET_HISTORY_LEN_PREFIX + BUILD_UINT16(store[0], store[1]);
+
+	memmove(store, &store[entry], storeUsed - entry);
+	storeUsed -= entry;
+	storeCount--;
+	memmove(storeIds, &storeIds[1], storeCount);
+}
+
+/**
+ * Finds a stored summary.
+ *
+ * @param 	id			Id from setHistory_add
+ * @param	pLen		Returns the summary length
+ * @return 	Offset of its length prefix in store, SET_HISTORY_STORE_LEN if it is gone.
+ */
+static uint16_t findEntry(uint8_t id, uint16_t *pLen)
+{
+	uint16_t pos = 0;
+	uint8_t i;
+
+	for (i = 0; i < storeCount; i++) {
+		*pLen = BUILD_UINT16(store[pos], store[pos + 1]);
+		if (storeIds[i] == id)
+			return pos;
+		pos += SET_HISTORY_LEN_PREFIX + *pLen;
+	}
+	return SET_HISTORY_STORE_LEN;
+}
+
+/**
+ * Builds the value header from the current state.
+ *
+ * @param 	pHdr		Output, SET_HISTORY_HEADER_LEN bytes
+ * @return 	none
+ */
+static void buildHeader(uint8_t *pHdr)
+{
+	pHdr[0] = SET_HISTORY_VERSION;
+	pHdr[1] = generation;
+	pHdr[2] = storeCount;
+	pHdr[3] = sessionSets;
+	pHdr[4] = LO_UINT16(sessionReps);
+	pHdr[5] = HI_UINT16(sessionReps);
+	pHdr[6] = LO_UINT16(sessionMaxPeak);
+	pHdr[7] = HI_UINT16(sessionMaxPeak);
+	pHdr[8] = BREAK_UINT32(sessionTutMs, 0);
+	pHdr[9] = BREAK_UINT32(sessionTutMs, 1);
+	pHdr[10] = BREAK_UINT32(sessionTutMs, 2);
+	pHdr[11] = BREAK_UINT32(sessionTutMs, 3);
+}
@@ -0,0 +1,98 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			set_history.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the readable set summary history.
+ */
+#ifndef SET_HISTORY_H
+#define SET_HISTORY_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+#include "set_summary.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define SET_HISTORY_VERSION					1
+#define SET_HISTORY_HEADER_LEN				12
+#define SET_HISTORY_MAX_SETS				4
+#define SET_HISTORY_STORE_LEN				384		//Encoded summaries with their lengths
+#define SET_HISTORY_MAX_LEN					(SET_HISTORY_HEADER_LEN + SET_HISTORY_STORE_LEN)
+
+/*
+ * Value of the EMG Summary characteristic, read with ATT Read / Read Blob.
+ * Multi-byte fields are little endian.
+ *
+ * 	[0]		version (SET_HISTORY_VERSION)
+ * 	[1]		generation, +1 per stored set. If it changed between the first and
+ * 			the last blob of a long read, read again from offset 0.
+ * 	[2]		number of summaries that follow
+ * 	session aggregate, all sets since the first set of the workout:
+ * 	[3]		sets
+ * 	[4-5]	reps
+ * 	[6-7]	highest peakIntensity
+ * 	[8-11]	time under tension in ms, sum of all pulseWidth
+ * 	then the last SET_HISTORY_MAX_SETS summaries, oldest first, each
+ * 			uint16 length, then the set summary (see set_summary.h)
+ * 	Older summaries are dropped when SET_HISTORY_STORE_LEN runs out.
+ */
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Stores a finished set and adds it to the session aggregate. The first set of a
+ * workout starts a new session. Runs in the BLE application task.
+ *
+ * @param 	stats		Finished set
+ * @param	setIndex	Index of the set in the workout, from 1
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @return 	Id of the stored summary for setHistory_fillFragment, never 0.
+ */
+extern uint8_t setHistory_add(const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion);
+
+/**
+ * Writes one notification fragment of a stored summary, in the layout of
+ * setSummary_fillFragment, straight from the store. Runs in the BLE application task,
+ * like setHistory_add. Fragments of one summary must all use the same maxLen.
+ *
+ * @param 	id			Id from setHistory_add
+ * @param	fragIdx		Fragment to write
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst, at least 2
+ * @return 	Bytes written, 0 once fragIdx is past the last fragment or the summary
+ * 			was dropped from the store.
+ */
+extern uint16_t setHistory_fillFragment(uint8_t id, uint8_t fragIdx, uint8_t *pDst, uint16_t maxLen);
+
+/**
+ * Length of the characteristic value.
+ *
+ * @param 	none
+ * @return 	Bytes
+ */
+extern uint16_t setHistory_length(void);
+
+/**
+ * Index of the newest stored set.
+ *
+ * @param 	none
+ * @return 	Set index, 0 if nothing is stored.
+ */
+extern uint8_t setHistory_lastSetIndex(void);
+
+/**
+ * Copies part of the characteristic value. Runs in the BLE stack task, which
+ * setHistory_add keeps out while it changes the store.
+ *
+ * @param 	offset		First byte, at most setHistory_length()
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+extern uint16_t setHistory_read(uint16_t offset, uint8_t *pDst, uint16_t maxLen);
+
+#endif /* SET_HISTORY_H */
@@ -0,0 +1,209 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			set_summary.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the compact set summary encoding.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//Home brewed Header Files
+#include "set_summary.h"
+
+//Standard Header Files
+#include <stddef.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define ZIGZAG16(v)							((uint16_t)(((v) << 1) ^ ((v) >> 15)))
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+//Encoder output cursor. Bytes outside [start, end) are counted and CRC'd but not
+//stored, so a fragment can be built straight into its notification buffer.
+typedef struct {
+	uint16_t pos;
+	uint16_t start;
+	uint16_t end;
+	uint8_t *pDst;
+	uint16_t crc;
+} SetSummary_writer;
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static void putByte(SetSummary_writer *w, uint8_t value);
+static void putVarint(SetSummary_writer *w, uint16_t value);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Encodes a set into the version 1 summary format.
+ *
+ * @param 	stats		Finished set
+ * @param	setIndex	Index of the set in the workout
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @param	pBuf		Output buffer, SET_SUMMARY_MAX_LEN always fits
+ * @param	bufLen		Size of pBuf
+ * @return 	Encoded length, 0 if pBuf is too small.
+ */
+uint16_t setSummary_encode(const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion,
+						   uint8_t *pBuf, uint16_t bufLen)
+{
+	uint16_t len = setSummary_encodeRange(stats, setIndex, withMotion, 0, pBuf, bufLen);
+
+	return (len > bufLen) ? 0 : len;
+}
+
+/**
+ * Encodes the window [offset, offset + winLen) of a set summary.
+ *
+ * @param 	stats		Finished set
+ * @param	setIndex	Index of the set in the workout
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @param	offset		First byte of the summary to write
+ * @param	pDst		Output for the window, NULL to only size the summary
+ * @param	winLen		Size of the window
+ * @return 	Total length of the summary.
+ */
+uint16_t setSummary_encodeRange(const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion,
+								uint16_t offset, uint8_t *pDst, uint16_t winLen)
+{
+	SetSummary_writer w;
+	uint8_t numReps = stats->numReps;
+	uint8_t bits = 0;
+	uint16_t crc;
+	int16_t lastPeak = 0, delta;
+	uint8_t i;
+
+	if (numReps > EMG_MAX_REPS)
+		numReps = EMG_MAX_REPS;
+
+	w.pos = 0;
+	w.start = offset;
+	w.end = offset + winLen;
+	w.pDst = pDst;
+	w.crc = 0xFFFF;
+
+	putByte(&w, SET_SUMMARY_VERSION);
+	putByte(&w, setIndex);
+	putByte(&w, numReps);
+	putByte(&w, (stats->setDone ? SET_SUMMARY_FLAG_SET_DONE : 0) | (withMotion ? SET_SUMMARY_FLAG_MOTION : 0));
+	putByte(&w, stats->exerciseId);
+	putByte(&w, stats->samplePeriodMs);
+
+	for (i = 0; i < numReps; i++) {
+		//Widths are whole sample periods, so dividing is lossless
+		putVarint(&w, stats->pulseWidth[i] / stats->samplePeriodMs);
+		putVarint(&w, stats->deadWidth[i] / stats->samplePeriodMs);
+		putVarint(&w, stats->concentricTime[i]);
+		putVarint(&w, stats->eccentricTime[i]);
+
+		delta = (int16_t)stats->peakIntensity[i] - lastPeak;
+		putVarint(&w, ZIGZAG16(delta));
+		lastPeak = stats->peakIntensity[i];
+	}
+
+	if (withMotion) {
+		for (i = 0; i < numReps; i++) {
+			if (stats->movedOrNah[i])
+				bits |= 1 << (i % 8);
+			if (i % 8 == 7 || i == numReps - 1) {
+				putByte(&w, bits);
+				bits = 0;
+			}
+		}
+	}
+
+	crc = w.crc;
+	putByte(&w, crc & 0xFF);
+	putByte(&w, crc >> 8);
+
+	return w.pos;
+}
+
+/**
+ * Writes one fragment of a set summary: the fragment byte, then as much of the
+ * summary as fits. Fragments of one set must all use the same maxLen.
+ *
+ * @param 	stats		Finished set
+ * @param	setIndex	Index of the set in the workout
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @param	fragIdx		Fragment to write
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst, at least 2
+ * @return 	Bytes written, 0 once fragIdx is past the last fragment.
+ */
+uint16_t setSummary_fillFragment(const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion,
+								 uint8_t fragIdx, uint8_t *pDst, uint16_t maxLen)
+{
+	uint16_t chunk = maxLen - 1;
+	uint16_t offset = fragIdx * chunk;
+	uint16_t total, n;
+
+	total = setSummary_encodeRange(stats, setIndex, withMotion, offset, &pDst[1], chunk);
+	if (offset >= total)
+		return 0;
+
+	n = (total - offset > chunk) ? chunk : total - offset;
+	pDst[0] = fragIdx & SET_SUMMARY_FRAG_INDEX_MASK;
+	if (offset + n == total)
+		pDst[0] |= SET_SUMMARY_FRAG_LAST;
+
+	return n + 1;
+}
+
+/**
+ * CRC-16/CCITT-FALSE (poly 0x1021).
+ *
+ * @param 	pData		Data
+ * @param	len			Length of data
+ * @param	crc			Seed, 0xFFFF for a new CRC
+ * @return 	CRC
+ */
+uint16_t setSummary_crc16(const uint8_t *pData, uint16_t len, uint16_t crc)
+{
+	uint8_t bit;
+
+	while (len--) {
+		crc ^= (uint16_t)(*pData++) << 8;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	}
+	return crc;
+}
+
+/**
+ * Emits one summary byte: adds it to the CRC and stores it if it falls in the window.
+ *
+ * @param 	w			Writer
+ * @param	value		Byte
+ * @return 	none
+ */
+static void putByte(SetSummary_writer *w, uint8_t value)
+{
+	w->crc = setSummary_crc16(&value, 1, w->crc);
+	if (w->pDst != NULL && w->pos >= w->start && w->pos < w->end)
+		w->pDst[w->pos - w->start] = value;
+	w->pos++;
+}
+
+/**
+ * Emits an unsigned LEB128 varint.
+ *
+ * @param 	w			Writer
+ * @param	value		Value to encode
+ * @return 	none
+ */
+static void putVarint(SetSummary_writer *w, uint16_t value)
+{
+	while (value >= 0x80) {
+		putByte(w, (value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	putByte(w, value);
+}
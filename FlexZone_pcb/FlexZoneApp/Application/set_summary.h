@@ -0,0 +1,110 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			set_summary.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the compact set summary encoding.
+ */
+#ifndef SET_SUMMARY_H
+#define SET_SUMMARY_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define SET_SUMMARY_VERSION					1
+#define SET_SUMMARY_HEADER_LEN				6
+#define SET_SUMMARY_MAX_REP_LEN				15	//5 varints of at most 3 bytes
+#define SET_SUMMARY_MAX_LEN					(SET_SUMMARY_HEADER_LEN + EMG_MAX_REPS * SET_SUMMARY_MAX_REP_LEN \
+											 + (EMG_MAX_REPS + 7) / 8 + 2)
+
+//Header flags
+#define SET_SUMMARY_FLAG_SET_DONE			0x01
+#define SET_SUMMARY_FLAG_MOTION				0x02	//movedOrNah bitmap present
+
+//Fragment byte, first byte of every APP_PACKET_TYPE_SET_SUMMARY payload
+#define SET_SUMMARY_FRAG_LAST				0x80
+#define SET_SUMMARY_FRAG_INDEX_MASK			0x7F
+
+/*
+ * Set summary, version 1. Multi-byte integers are unsigned LEB128 varints.
+ *
+ * 	[0]		version (SET_SUMMARY_VERSION)
+ * 	[1]		set index
+ * 	[2]		numReps
+ * 	[3]		flags (SET_SUMMARY_FLAG_*)
+ * 	[4]		exerciseId
+ * 	[5]		width unit in ms, the sample period of the set
+ * 	numReps records of
+ * 			varint	pulseWidth / width unit
+ * 			varint	deadWidth / width unit
+ * 			varint	concentricTime
+ * 			varint	eccentricTime
+ * 			varint	zigzag(peakIntensity - previous rep's peakIntensity), first rep against 0
+ * 	(numReps + 7) / 8 bytes of movedOrNah, rep 0 in bit 0, if SET_SUMMARY_FLAG_MOTION
+ * 	uint16	CRC-16/CCITT-FALSE over all previous bytes, little endian
+ *
+ * The summary is split into as few notifications as the payload allows. Each carries
+ * one fragment byte (index, SET_SUMMARY_FRAG_LAST on the final one) followed by data.
+ * tools/set_summary_decode.py reassembles and decodes captured summaries.
+ */
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Encodes a set into the version 1 summary format.
+ *
+ * @param 	stats		Finished set
+ * @param	setIndex	Index of the set in the workout
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @param	pBuf		Output buffer, SET_SUMMARY_MAX_LEN always fits
+ * @param	bufLen		Size of pBuf
+ * @return 	Encoded length, 0 if pBuf is too small.
+ */
+extern uint16_t setSummary_encode(const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion,
+								  uint8_t *pBuf, uint16_t bufLen);
+
+/**
+ * Encodes the window [offset, offset + winLen) of a set summary.
+ *
+ * @param 	stats		Finished set
+ * @param	setIndex	Index of the set in the workout
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @param	offset		First byte of the summary to write
+ * @param	pDst		Output for the window, NULL to only size the summary
+ * @param	winLen		Size of the window
+ * @return 	Total length of the summary.
+ */
+extern uint16_t setSummary_encodeRange(const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion,
+									   uint16_t offset, uint8_t *pDst, uint16_t winLen);
+
+/**
+ * Writes one fragment of a set summary: the fragment byte, then as much of the
+ * summary as fits. Fragments of one set must all use the same maxLen.
+ *
+ * @param 	stats		Finished set
+ * @param	setIndex	Index of the set in the workout
+ * @param	withMotion	1 if movedOrNah holds IMU results
+ * @param	fragIdx		Fragment to write
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst, at least 2
+ * @return 	Bytes written, 0 once fragIdx is past the last fragment.
+ */
+extern uint16_t setSummary_fillFragment(const EMG_stats *stats, uint8_t setIndex, uint8_t withMotion,
+										uint8_t fragIdx, uint8_t *pDst, uint16_t maxLen);
+
+/**
+ * CRC-16/CCITT-FALSE (poly 0x1021).
+ *
+ * @param 	pData		Data
+ * @param	len			Length of data
+ * @param	crc			Seed, 0xFFFF for a new CRC
+ * @return 	CRC
+ */
+extern uint16_t setSummary_crc16(const uint8_t *pData, uint16_t len, uint16_t crc);
+
+#endif /* SET_SUMMARY_H */
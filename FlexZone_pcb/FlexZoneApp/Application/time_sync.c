@@ -0,0 +1,525 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			time_sync.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the shared timebase between devices.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//SYS/BIOS Header Files
+#include <ti/sysbios/hal/Hwi.h>
+
+//CC26XXWARE Header Files
+#include <driverlib/aon_rtc.h>
+
+//BLE Stack Header Files
+#include <bcomdef.h>
+
+//Home brewed Header Files
+#include "time_sync.h"
+
+//Standard Header Files
+#include <string.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define TIME_SYNC_RTT_NONE					0xFFFF
+
+//Connection event notices the anchor estimate is taken from, a ping needs them all
+#define TIME_SYNC_ANCHOR_NOTICES			16
+//Notices without a busy CPU come within this of each other, by the event length
+#define TIME_SYNC_ANCHOR_SPREAD_US			2000
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+//Shared time = local + refOffset + (local - refLocal) * driftPpb / 1e9. Read from any
+//context, so only touched with interrupts off.
+typedef struct {
+	uint64_t refLocal;
+	int64_t refOffset;
+	int32_t driftPpb;
+	uint8_t points;						//Bursts in the fit, 0 - not synced
+} TimeSync_model;
+
+static TimeSync_model model;
+
+//Best sample of each of the last bursts: local time it was taken, shared - local
+static uint64_t pointLocal[TIME_SYNC_POINTS];
+static int64_t pointOffset[TIME_SYNC_POINTS];
+static uint8_t pointCount = 0;
+static uint8_t pointNext = 0;
+
+//Burst in progress
+static uint8_t exchangesLeft = 0;
+static uint8_t pingSeq = 0;
+static uint8_t pingOutstanding = 0;
+static uint64_t pingTxUs;				//Anchor the ping goes out at
+static uint64_t pingQueuedUs;			//When it was handed to the stack
+static uint64_t pendingTxUs;			//Anchor of the ping being built
+static uint64_t bestLocal;
+static int64_t bestOffset;
+static uint16_t bestRttUs;
+static uint16_t lastRttUs = TIME_SYNC_RTT_NONE;
+
+//Connection event end of the least delayed recent notice, moved on by whole intervals,
+//and how late the recent notices came against it
+static uint64_t anchorUs;
+static uint32_t anchorIntervalUs = 0;	//0 - no anchor yet
+static int32_t noticeLateUs[TIME_SYNC_ANCHOR_NOTICES];
+static uint8_t noticeCount;
+static uint8_t noticeNext;
+
+//Pong arrival, stamped in the BLE stack task
+static volatile uint64_t rxUs;
+static volatile uint8_t rxValid = 0;
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static void trackAnchor(uint64_t nowUs, uint32_t intervalUs);
+static int32_t wrapLate(int64_t lateUs, uint32_t intervalUs);
+static void exchangeDone(void);
+static void addPoint(uint64_t local, int64_t offset);
+static void fit(void);
+static int64_t modelOffset(const TimeSync_model *pModel, uint64_t localUs);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Clears the timebase. All timeSync_* functions but the ones marked otherwise run in
+ * the BLE application task.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void timeSync_init(void)
+{
+	UInt key;
+
+	key = Hwi_disable();
+	memset(&model, 0, sizeof(model));
+	Hwi_restore(key);
+
+	pointCount = 0;
+	pointNext = 0;
+	timeSync_stop();
+}
+
+/**
+ * Device clock, from the RTC that runs since power up. Safe from any context.
+ *
+ * @param 	none
+ * @return 	us since power up
+ */
+uint64_t timeSync_localUs(void)
+{
+	uint64_t rtc = AONRTCCurrent64BitValueGet();	//32.32 seconds
+
+	return (rtc >> 32) * 1000000 + (((rtc & 0xFFFFFFFF) * 1000000) >> 32);
+}
+
+/**
+ * Moves a device time onto the shared timebase. Safe from any context.
+ *
+ * @param 	localUs		From timeSync_localUs
+ * @return 	Shared time, us
+ */
+uint64_t timeSync_toShared(uint64_t localUs)
+{
+	TimeSync_model m;
+	UInt key;
+
+	key = Hwi_disable();
+	m = model;
+	Hwi_restore(key);
+
+	if (0 == m.points)
+		return localUs;
+
+	return localUs + modelOffset(&m, localUs);
+}
+
+/**
+ * Handles a write to the Time Sync characteristic.
+ *
+ * @param 	pBuf		Write
+ * @param	len			Write length
+ * @return 	1 while a burst runs
+ */
+uint8_t timeSync_control(const uint8_t *pBuf, uint16_t len)
+{
+	uint64_t centralUs;
+	uint64_t rx;
+	int64_t offset;
+	uint32_t rtt;
+	uint8_t i;
+
+	if (len >= TIME_SYNC_START_LEN && TIME_SYNC_OP_START == pBuf[0])
+	{
+		exchangesLeft = pBuf[1] ? MIN(pBuf[1], TIME_SYNC_MAX_EXCHANGES) : TIME_SYNC_DEFAULT_EXCHANGES;
+		pingOutstanding = 0;
+		bestRttUs = TIME_SYNC_RTT_NONE;
+	}
+	else if (len >= TIME_SYNC_PONG_LEN && TIME_SYNC_OP_PONG == pBuf[0])
+	{
+		//Late answers to a ping that timed out are of no use
+		if (!pingOutstanding || pBuf[1] != pingSeq || !rxValid)
+			return timeSync_isActive();
+
+		centralUs = 0;
+		for (i = 0; i < 8; i++)
+			centralUs |= (uint64_t)pBuf[2 + i] << (8 * i);
+
+		//The central reads its clock late, never early, so the smallest offset is the
+		//best sample. The round trip cannot tell: the pong waits for an anchor anyway.
+		rx = rxUs;
+		rtt = (rx > pingTxUs) ? (uint32_t)MIN(rx - pingTxUs, TIME_SYNC_RTT_NONE - 1) : 0;
+		offset = (int64_t)(centralUs - pingTxUs);
+		if (TIME_SYNC_RTT_NONE == bestRttUs || offset < bestOffset)
+		{
+			bestRttUs = rtt;
+			bestLocal = pingTxUs;
+			bestOffset = offset;
+		}
+
+		pingOutstanding = 0;
+		exchangeDone();
+	}
+
+	return timeSync_isActive();
+}
+
+/**
+ * Stamps the arrival of a write to the Time Sync characteristic. Runs in the BLE
+ * stack task, as close to the connection event as the application gets.
+ *
+ * @param 	pBuf		Write
+ * @param	len			Write length
+ * @return 	none
+ */
+void timeSync_markRx(const uint8_t *pBuf, uint16_t len)
+{
+	//Only the first answer to the ping in flight, the application checks the rest
+	if (len >= TIME_SYNC_PONG_LEN && TIME_SYNC_OP_PONG == pBuf[0] &&
+		pingOutstanding && pBuf[1] == pingSeq && !rxValid)
+	{
+		rxUs = timeSync_localUs();
+		rxValid = 1;
+	}
+}
+
+/**
+ * A connection event ended. Gives the next ping, if one is due.
+ *
+ * @param 	intervalUs	Connection interval
+ * @param	pDst		Output, TIME_SYNC_PING_LEN bytes
+ * @return 	Ping length, 0 if none is due.
+ */
+uint16_t timeSync_connEvent(uint32_t intervalUs, uint8_t *pDst)
+{
+	uint64_t nowUs = timeSync_localUs();
+
+	if (!timeSync_isActive() || 0 == intervalUs)
+		return 0;
+
+	trackAnchor(nowUs, intervalUs);
+
+	if (pingOutstanding)
+	{
+		if (nowUs - pingQueuedUs < (uint64_t)TIME_SYNC_PONG_TIMEOUT_MS * 1000)
+			return 0;
+
+		pingOutstanding = 0;
+		exchangeDone();
+		if (!timeSync_isActive())
+			return 0;
+	}
+
+	if (noticeCount < TIME_SYNC_ANCHOR_NOTICES)
+		return 0;
+
+	//Queued now, the ping leaves at the first anchor after now
+	pendingTxUs = anchorUs;
+	if (nowUs >= anchorUs)
+		pendingTxUs += ((nowUs - anchorUs) / intervalUs + 1) * intervalUs;
+	rxValid = 0;
+	pDst[0] = TIME_SYNC_OP_PING;
+	pDst[1] = ++pingSeq;
+	return TIME_SYNC_PING_LEN;
+}
+
+/**
+ * The ping from timeSync_connEvent was handed to the stack.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void timeSync_pingSent(void)
+{
+	pingTxUs = pendingTxUs;
+	pingQueuedUs = timeSync_localUs();
+	pingOutstanding = 1;
+}
+
+/**
+ * Whether a burst runs and needs connection event notices.
+ *
+ * @param 	none
+ * @return 	1 while a burst runs
+ */
+uint8_t timeSync_isActive(void)
+{
+	return (exchangesLeft > 0);
+}
+
+/**
+ * Ends the burst, after a disconnect. The timebase is kept.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void timeSync_stop(void)
+{
+	exchangesLeft = 0;
+	pingOutstanding = 0;
+	anchorIntervalUs = 0;
+}
+
+/**
+ * Copies part of the characteristic value. Runs in the BLE stack task.
+ *
+ * @param 	offset		First byte
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+uint16_t timeSync_read(uint16_t offset, uint8_t *pDst, uint16_t maxLen)
+{
+	uint8_t status[TIME_SYNC_STATUS_LEN];
+	TimeSync_model m;
+	uint64_t nowUs;
+	uint8_t i;
+	UInt key;
+
+	if (offset >= TIME_SYNC_STATUS_LEN)
+		return 0;
+
+	key = Hwi_disable();
+	m = model;
+	Hwi_restore(key);
+
+	nowUs = timeSync_toShared(timeSync_localUs());
+	status[0] = TIME_SYNC_VERSION;
+	status[1] = m.points;
+	for (i = 0; i < 8; i++)
+		status[2 + i] = (uint8_t)(nowUs >> (8 * i));
+	status[10] = BREAK_UINT32(m.driftPpb, 0);
+	status[11] = BREAK_UINT32(m.driftPpb, 1);
+	status[12] = BREAK_UINT32(m.driftPpb, 2);
+	status[13] = BREAK_UINT32(m.driftPpb, 3);
+	status[14] = LO_UINT16(lastRttUs);
+	status[15] = HI_UINT16(lastRttUs);
+
+	maxLen = MIN(maxLen, TIME_SYNC_STATUS_LEN - offset);
+	memcpy(pDst, &status[offset], maxLen);
+	return maxLen;
+}
+
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Follows the connection anchors on the device clock. A notice comes some time
+ * after its connection event, longer events and a busy CPU make it later, by up to
+ * more than an interval. How late each recent notice came is kept against the
+ * estimate, within half an interval either way. Their median is a notice without a
+ * busy CPU, and the ones up to TIME_SYNC_ANCHOR_SPREAD_US before it are the shortest
+ * events. A notice that was most of an interval late looks early and can land among
+ * them, so the second earliest of them is the new estimate.
+ *
+ * @param 	nowUs		Time of the notice
+ * @param	intervalUs	Connection interval
+ * @return 	none
+ */
+static void trackAnchor(uint64_t nowUs, uint32_t intervalUs)
+{
+	int32_t sorted[TIME_SYNC_ANCHOR_NOTICES];
+	int32_t median, shift, v;
+	uint8_t i, j;
+
+	if (intervalUs != anchorIntervalUs)
+	{
+		anchorUs = nowUs;
+		anchorIntervalUs = intervalUs;
+		noticeCount = 0;
+		noticeNext = 0;
+	}
+
+	noticeLateUs[noticeNext] = wrapLate((int64_t)(nowUs - anchorUs), intervalUs);
+	noticeNext = (noticeNext + 1) % TIME_SYNC_ANCHOR_NOTICES;
+	if (noticeCount < TIME_SYNC_ANCHOR_NOTICES)
+		noticeCount++;
+
+	for (i = 0; i < noticeCount; i++)
+	{
+		v = noticeLateUs[i];
+		for (j = i; j > 0 && sorted[j - 1] > v; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = v;
+	}
+	median = sorted[(noticeCount - 1) / 2];
+	for (i = 0; sorted[i] < median - TIME_SYNC_ANCHOR_SPREAD_US; i++)
+		;
+	if (sorted[i] < median)
+		i++;
+	shift = sorted[i];
+
+	//Onto the estimate, then to its last anchor before the notice
+	for (i = 0; i < noticeCount; i++)
+		noticeLateUs[i] = wrapLate(noticeLateUs[i] - shift, intervalUs);
+	anchorUs += shift;
+	if (nowUs >= anchorUs)
+		anchorUs += ((nowUs - anchorUs) / intervalUs) * intervalUs;
+}
+
+/**
+ * How late a notice came against an anchor, within half an interval either way.
+ *
+ * @param 	lateUs		Notice - anchor
+ * @param	intervalUs	Connection interval
+ * @return 	Lateness, us
+ */
+static int32_t wrapLate(int64_t lateUs, uint32_t intervalUs)
+{
+	int64_t r = (lateUs + intervalUs / 2) % intervalUs;
+
+	if (r < 0)
+		r += intervalUs;
+	return (int32_t)(r - intervalUs / 2);
+}
+
+/**
+ * One exchange of the burst is over, answered or not. The last one adds the best
+ * sample to the fit.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void exchangeDone(void)
+{
+	if (exchangesLeft && --exchangesLeft)
+		return;
+
+	lastRttUs = bestRttUs;
+	if (bestRttUs != TIME_SYNC_RTT_NONE)
+		addPoint(bestLocal, bestOffset);
+	anchorIntervalUs = 0;
+}
+
+/**
+ * Adds the best sample of a burst and refits. A sample far from the fit means the
+ * central clock was set. That leaves the crystals alone, so the older samples move
+ * by the step and keep the drift they give.
+ *
+ * @param 	local		Device time of the sample
+ * @param	offset		Shared - device time
+ * @return 	none
+ */
+static void addPoint(uint64_t local, int64_t offset)
+{
+	int64_t err;
+	uint8_t i;
+
+	if (model.points)
+	{
+		err = offset - modelOffset(&model, local);
+		if (err > TIME_SYNC_STEP_US || err < -TIME_SYNC_STEP_US)
+		{
+			for (i = 0; i < pointCount; i++)
+				pointOffset[i] += err;
+		}
+	}
+
+	pointLocal[pointNext] = local;
+	pointOffset[pointNext] = offset;
+	pointNext = (pointNext + 1) % TIME_SYNC_POINTS;
+	if (pointCount < TIME_SYNC_POINTS)
+		pointCount++;
+
+	fit();
+}
+
+/**
+ * Least squares line through the points, offset against device time, referenced to
+ * the newest point so the sums stay small.
+ *
+ * @param 	none
+ * @return 	none
+ */
+static void fit(void)
+{
+	uint8_t newest = (pointNext + TIME_SYNC_POINTS - 1) % TIME_SYNC_POINTS;
+	uint64_t refLocal = pointLocal[newest];
+	int64_t refOffset = pointOffset[newest];
+	int32_t dx[TIME_SYNC_POINTS];			//ms before the newest point
+	int64_t dy[TIME_SYNC_POINTS];			//us
+	int64_t sumX = 0, sumY = 0, sxx = 0, sxy = 0;
+	int64_t meanX, meanY, cx;
+	int32_t span = 0;
+	int32_t driftPpb = 0;
+	uint8_t i;
+	UInt key;
+
+	for (i = 0; i < pointCount; i++)
+	{
+		dx[i] = -(int32_t)((refLocal - pointLocal[i]) / 1000);
+		dy[i] = pointOffset[i] - refOffset;
+		sumX += dx[i];
+		sumY += dy[i];
+		if (-dx[i] > span)
+			span = -dx[i];
+	}
+	meanX = sumX / pointCount;
+	meanY = sumY / pointCount;
+
+	//Over a short span the jitter of the samples would pass for drift
+	if (span >= TIME_SYNC_MIN_DRIFT_SPAN_MS)
+	{
+		for (i = 0; i < pointCount; i++)
+		{
+			cx = dx[i] - meanX;
+			sxx += cx * cx;
+			sxy += cx * (dy[i] - meanY);
+		}
+
+		//us per ms is 1e-3, ppb is 1e-9
+		driftPpb = (int32_t)MAX(MIN((sxy * 1000) / (sxx / 1000), TIME_SYNC_MAX_DRIFT_PPB),
+								-TIME_SYNC_MAX_DRIFT_PPB);
+	}
+
+	key = Hwi_disable();
+	model.refLocal = refLocal;
+	model.refOffset = refOffset + meanY - ((int64_t)driftPpb * meanX) / 1000000;
+	model.driftPpb = driftPpb;
+	model.points = pointCount;
+	Hwi_restore(key);
+}
+
+/**
+ * Shared - device time from a model.
+ *
+ * @param 	pModel		Model with at least one point
+ * @param	localUs		Device time
+ * @return 	Offset, us
+ */
+static int64_t modelOffset(const TimeSync_model *pModel, uint64_t localUs)
+{
+	int64_t d = (int64_t)(localUs - pModel->refLocal);
+
+	return pModel->refOffset + (d * pModel->driftPpb) / 1000000000;
+}
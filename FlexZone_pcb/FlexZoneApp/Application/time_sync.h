@@ -0,0 +1,166 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			time_sync.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the shared timebase between devices.
+ */
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define TIME_SYNC_VERSION					1
+
+#define TIME_SYNC_DEFAULT_EXCHANGES			8
+#define TIME_SYNC_MAX_EXCHANGES				32
+#define TIME_SYNC_PONG_TIMEOUT_MS			1000	//Exchange given up, next ping
+#define TIME_SYNC_POINTS					8		//Bursts kept for the drift fit
+#define TIME_SYNC_MIN_DRIFT_SPAN_MS			10000	//Shorter spans only give the offset
+#define TIME_SYNC_MAX_DRIFT_PPB				200000	//Crystals are good for +-40 ppm
+#define TIME_SYNC_STEP_US					5000	//Farther off the fit, the central clock jumped
+
+/*
+ * The central owns the shared timebase, in us of its own clock. Several devices
+ * connected to the same central are on the same timebase once each has synced.
+ *
+ * On the EMG Time Sync characteristic the central writes
+ * 	[0]		TIME_SYNC_OP_START
+ * 	[1]		exchanges in the burst, 0 for the default
+ * and the device runs that many exchanges. Each starts with a notification
+ * 	[0]		TIME_SYNC_OP_PING
+ * 	[1]		sequence number
+ * sent at the end of a connection event, so it goes out at the next anchor. The
+ * device knows that anchor on its own clock. The central answers right away with
+ * 	[0]		TIME_SYNC_OP_PONG
+ * 	[1]		sequence number of the ping
+ * 	[2-9]	its clock when the ping arrived, us
+ * Each answer is one sample of the offset between the two clocks. A central that
+ * reads its clock late only makes the offset larger, so the burst keeps the sample
+ * with the smallest one. The best samples of the last TIME_SYNC_POINTS bursts give the
+ * offset and, once they span TIME_SYNC_MIN_DRIFT_SPAN_MS, the drift.
+ *
+ * With bursts every minute, devices on one central stay within 1 ms of each other at
+ * p99 (tools/host/time_sync_sim: 0.7 - 0.95 ms over five runs of eight devices). Each
+ * is within 1.5 ms of the central's own clock at p99 (1.25 ms at most in the same
+ * runs): the device only sees its connection event end, not the anchor, and the
+ * central reads its clock some time after the ping arrives. Both lags are much the
+ * same on every device, so they cancel between devices but not against the central.
+ * Sub-millisecond holds between devices only.
+ *
+ * Reading the characteristic returns
+ * 	[0]		TIME_SYNC_VERSION
+ * 	[1]		bursts in the fit, 0 until the first one finishes
+ * 	[2-9]	shared time now, us
+ * 	[10-13]	drift of this device against the central, ppb, signed
+ * 	[14-15]	round trip of the best sample of the last burst, us
+ * Multi-byte fields are little endian.
+ *
+ * Rep events, raw EMG blocks and IMU frames carry shared time. Before the first
+ * burst, and on a device that never synced, shared time is the device uptime.
+ */
+#define TIME_SYNC_OP_START					0x01
+#define TIME_SYNC_OP_PING					0x02
+#define TIME_SYNC_OP_PONG					0x03
+
+#define TIME_SYNC_START_LEN					2
+#define TIME_SYNC_PING_LEN					2
+#define TIME_SYNC_PONG_LEN					10
+#define TIME_SYNC_STATUS_LEN				16
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Clears the timebase. All timeSync_* functions but the ones marked otherwise run in
+ * the BLE application task.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void timeSync_init(void);
+
+/**
+ * Device clock, from the RTC that runs since power up. Safe from any context.
+ *
+ * @param 	none
+ * @return 	us since power up
+ */
+extern uint64_t timeSync_localUs(void);
+
+/**
+ * Moves a device time onto the shared timebase. Safe from any context.
+ *
+ * @param 	localUs		From timeSync_localUs
+ * @return 	Shared time, us
+ */
+extern uint64_t timeSync_toShared(uint64_t localUs);
+
+/**
+ * Handles a write to the Time Sync characteristic.
+ *
+ * @param 	pBuf		Write
+ * @param	len			Write length
+ * @return 	1 while a burst runs
+ */
+extern uint8_t timeSync_control(const uint8_t *pBuf, uint16_t len);
+
+/**
+ * Stamps the arrival of a write to the Time Sync characteristic. Runs in the BLE
+ * stack task, as close to the connection event as the application gets.
+ *
+ * @param 	pBuf		Write
+ * @param	len			Write length
+ * @return 	none
+ */
+extern void timeSync_markRx(const uint8_t *pBuf, uint16_t len);
+
+/**
+ * A connection event ended. Gives the next ping, if one is due.
+ *
+ * @param 	intervalUs	Connection interval
+ * @param	pDst		Output, TIME_SYNC_PING_LEN bytes
+ * @return 	Ping length, 0 if none is due.
+ */
+extern uint16_t timeSync_connEvent(uint32_t intervalUs, uint8_t *pDst);
+
+/**
+ * The ping from timeSync_connEvent was handed to the stack.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void timeSync_pingSent(void);
+
+/**
+ * Whether a burst runs and needs connection event notices.
+ *
+ * @param 	none
+ * @return 	1 while a burst runs
+ */
+extern uint8_t timeSync_isActive(void);
+
+/**
+ * Ends the burst, after a disconnect. The timebase is kept.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void timeSync_stop(void);
+
+/**
+ * Copies part of the characteristic value. Runs in the BLE stack task.
+ *
+ * @param 	offset		First byte
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+extern uint16_t timeSync_read(uint16_t offset, uint8_t *pDst, uint16_t maxLen);
+
+#endif /* TIME_SYNC_H */
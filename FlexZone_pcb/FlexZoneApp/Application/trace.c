@@ -0,0 +1,351 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			trace.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the tokenized trace. Records go into a
+ * 						lock-free ring of words; a low priority task drains them to
+ * 						the UART.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//SYS/BIOS Header Files
+#include <ti/sysbios/BIOS.h>
+#include <ti/sysbios/knl/Task.h>
+#include <ti/sysbios/knl/Clock.h>
+#include <ti/sysbios/hal/Hwi.h>
+
+//BLE Stack Header Files
+#include <bcomdef.h>
+
+//Home brewed Header Files
+#include "trace.h"
+#include "diag.h"
+
+//Standard Header Files
+#include <stddef.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define TRACE_TASK_PRIORITY					1
+#ifndef TRACE_TASK_STACK_SIZE
+#define TRACE_TASK_STACK_SIZE				400
+#endif
+
+#define TRACE_DRAIN_MS						100
+#define TRACE_MS_TO_TICKS(ms)				((ms) * (1000 / Clock_tickPeriod))
+
+#define TRACE_RING_WORDS					128		//Power of 2
+#define TRACE_RING_MASK						(TRACE_RING_WORDS - 1)
+#define TRACE_REC_FIXED_WORDS				2		//Header, ticks
+
+#define TRACE_HDR_VALID						0x80000000
+#define TRACE_HDR_ID(hdr)					((hdr) & 0xFFFF)
+#define TRACE_HDR_LEVEL(hdr)				(((hdr) >> 24) & 0x0F)
+#define TRACE_HDR_NUM_ARGS(hdr)				(((hdr) >> 28) & 0x07)
+
+#define TRACE_FRAME_SYNC					0x00
+#define TRACE_FRAME_HEADER_LEN				2
+#define TRACE_FRAME_MAX_LEN					128
+#define TRACE_REC_LEN(numArgs)				(7 + 4 * (numArgs))	//Bytes on the wire
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+//Task Structures
+Task_Struct traceTask;
+Char traceTaskStack[TRACE_TASK_STACK_SIZE];
+
+static UART_Handle hTraceUart = NULL;
+
+//Writers reserve words by moving head on, then fill them and set the header last, so
+//the drain stops at a record that is reserved but not written yet. Both count words
+//and only wrap through TRACE_RING_MASK.
+static volatile uint32_t ring[TRACE_RING_WORDS];
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile uint32_t drops = 0;
+
+static uint8_t frame[TRACE_FRAME_MAX_LEN];
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static void trace_taskFxn(UArg a0, UArg a1);
+static uint8_t trace_store(uint32_t hdr, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3,
+						   uint32_t a4);
+static uint8_t trace_reserve(uint32_t words, uint32_t *pPos);
+static void trace_addDrops(uint32_t count);
+static uint32_t trace_takeDrops(void);
+static uint16_t trace_pack(uint8_t *pDst, uint16_t maxLen, uint32_t *pWords);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Creates the task that writes the records to the UART.
+ *
+ * @param 	hUart		UART, also used by the xdc Log output
+ * @return 	none
+ */
+void trace_createTask(UART_Handle hUart)
+{
+	Task_Params taskParams;
+
+	hTraceUart = hUart;
+
+	Task_Params_init(&taskParams);
+	taskParams.stack = traceTaskStack;
+	taskParams.stackSize = TRACE_TASK_STACK_SIZE;
+	taskParams.priority = TRACE_TASK_PRIORITY;
+
+	Task_construct(&traceTask, trace_taskFxn, &taskParams, NULL);
+	diag_addTask(DIAG_TASK_TRACE, Task_handle(&traceTask));
+}
+
+/**
+ * Stores one record, or counts it as dropped when the ring is full. Use the
+ * TRACE_<level><n> macros.
+ *
+ * @param 	hdr			TRACE_HDR
+ * @param	a0			Arguments, the ones past the count in hdr are ignored
+ * @return 	none
+ */
+void trace_write(uint32_t hdr, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3,
+				 uint32_t a4)
+{
+	if (!trace_store(hdr, a0, a1, a2, a3, a4))
+		trace_addDrops(1);
+}
+
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Stores one record.
+ *
+ * @param 	hdr			TRACE_HDR
+ * @param	a0			Arguments, the ones past the count in hdr are ignored
+ * @return 	1 - stored, 0 - ring full
+ */
+static uint8_t trace_store(uint32_t hdr, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3,
+						   uint32_t a4)
+{
+	uint32_t numArgs = TRACE_HDR_NUM_ARGS(hdr);
+	uint32_t pos;
+
+	if (!trace_reserve(TRACE_REC_FIXED_WORDS + numArgs, &pos))
+		return 0;
+
+	ring[(pos + 1) & TRACE_RING_MASK] = Clock_getTicks();
+	switch (numArgs)
+	{
+	case 5:
+		ring[(pos + 6) & TRACE_RING_MASK] = a4;
+		//Fall through
+	case 4:
+		ring[(pos + 5) & TRACE_RING_MASK] = a3;
+		//Fall through
+	case 3:
+		ring[(pos + 4) & TRACE_RING_MASK] = a2;
+		//Fall through
+	case 2:
+		ring[(pos + 3) & TRACE_RING_MASK] = a1;
+		//Fall through
+	case 1:
+		ring[(pos + 2) & TRACE_RING_MASK] = a0;
+	default:
+		break;
+	}
+
+	//Published last, the drain reads nothing of the record before this
+	ring[pos & TRACE_RING_MASK] = hdr | TRACE_HDR_VALID;
+	return 1;
+}
+
+/**
+ * Writes the records to the UART every TRACE_DRAIN_MS. A write that fails because the
+ * Log output holds the UART leaves the records for the next round. Drops are reported
+ * once the ring is drained, so the report fits; if it still does not, its count waits
+ * for the next round.
+ *
+ * @param 	a0, a1		unused
+ * @return 	none
+ */
+static void trace_taskFxn(UArg a0, UArg a1)
+{
+	uint32_t words;
+#if TRACE_LEVEL >= TRACE_LEVEL_WARNING
+	uint32_t dropped;
+#endif
+	uint16_t len;
+
+	TRACE_INFO1(TRACE_BOOT, TRACE_NUM_MSGS);
+
+	while (1)
+	{
+		Task_sleep(TRACE_MS_TO_TICKS(TRACE_DRAIN_MS));
+
+		while ((len = trace_pack(&frame[TRACE_FRAME_HEADER_LEN],
+								 TRACE_FRAME_MAX_LEN - TRACE_FRAME_HEADER_LEN, &words)) > 0)
+		{
+			frame[0] = TRACE_FRAME_SYNC;
+			frame[1] = (uint8_t)len;
+			if (NULL == hTraceUart ||
+				UART_write(hTraceUart, frame, len + TRACE_FRAME_HEADER_LEN) == UART_ERROR)
+				break;
+
+			//Free the words for the writers only after they are on the wire
+			for (; words; words--)
+			{
+				ring[tail & TRACE_RING_MASK] = 0;
+				tail++;
+			}
+		}
+
+#if TRACE_LEVEL >= TRACE_LEVEL_WARNING
+		if ((dropped = trace_takeDrops()) > 0 &&
+			!trace_store(TRACE_HDR(TRACE_DROPPED, TRACE_LEVEL_WARNING, 1), dropped, 0, 0, 0, 0))
+			trace_addDrops(dropped);
+#endif
+	}
+}
+
+/**
+ * Reserves words at the head of the ring.
+ *
+ * @param 	words		Words of the record
+ * @param	pPos		Output, first word
+ * @return 	1 - reserved, 0 - ring full
+ */
+static uint8_t trace_reserve(uint32_t words, uint32_t *pPos)
+{
+	uint32_t pos;
+#if defined(__TI_COMPILER_VERSION__)
+	//Exclusive load/store, retried if anything else touched head in between
+	do
+	{
+		pos = __ldrex((void *)&head);
+		if (pos + words - tail > TRACE_RING_WORDS)
+			return 0;
+	} while (__strex(pos + words, (void *)&head));
+#else
+	UInt key;
+
+	key = Hwi_disable();
+	pos = head;
+	if (pos + words - tail > TRACE_RING_WORDS)
+	{
+		Hwi_restore(key);
+		return 0;
+	}
+	head = pos + words;
+	Hwi_restore(key);
+#endif
+
+	*pPos = pos;
+	return 1;
+}
+
+/**
+ * Counts records that did not fit.
+ *
+ * @param 	count		Records
+ * @return 	none
+ */
+static void trace_addDrops(uint32_t count)
+{
+#if defined(__TI_COMPILER_VERSION__)
+	uint32_t total;
+
+	do
+	{
+		total = __ldrex((void *)&drops);
+	} while (__strex(total + count, (void *)&drops));
+#else
+	UInt key;
+
+	key = Hwi_disable();
+	drops += count;
+	Hwi_restore(key);
+#endif
+}
+
+/**
+ * Takes the count of records that did not fit and clears it, the same way the writers
+ * count them.
+ *
+ * @param 	none
+ * @return 	Records dropped since the last call
+ */
+static uint32_t trace_takeDrops(void)
+{
+	uint32_t count;
+#if defined(__TI_COMPILER_VERSION__)
+	do
+	{
+		count = __ldrex((void *)&drops);
+	} while (count && __strex(0, (void *)&drops));
+#else
+	UInt key;
+
+	key = Hwi_disable();
+	count = drops;
+	drops = 0;
+	Hwi_restore(key);
+#endif
+
+	return count;
+}
+
+/**
+ * Copies the complete records at the tail of the ring into a frame, without freeing
+ * them.
+ *
+ * @param 	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @param	pWords		Output, ring words behind the copied records
+ * @return 	Bytes copied, 0 if nothing is complete.
+ */
+static uint16_t trace_pack(uint8_t *pDst, uint16_t maxLen, uint32_t *pWords)
+{
+	uint32_t pos = tail;
+	uint32_t hdr, ticks, arg;
+	uint16_t len = 0;
+	uint8_t numArgs, i;
+
+	while (pos != head)
+	{
+		hdr = ring[pos & TRACE_RING_MASK];
+		if (!(hdr & TRACE_HDR_VALID))
+			break;
+
+		numArgs = TRACE_HDR_NUM_ARGS(hdr);
+		if (len + TRACE_REC_LEN(numArgs) > maxLen)
+			break;
+
+		ticks = ring[(pos + 1) & TRACE_RING_MASK];
+		pDst[len++] = LO_UINT16(TRACE_HDR_ID(hdr));
+		pDst[len++] = HI_UINT16(TRACE_HDR_ID(hdr));
+		pDst[len++] = (TRACE_HDR_LEVEL(hdr) << 4) | numArgs;
+		pDst[len++] = BREAK_UINT32(ticks, 0);
+		pDst[len++] = BREAK_UINT32(ticks, 1);
+		pDst[len++] = BREAK_UINT32(ticks, 2);
+		pDst[len++] = BREAK_UINT32(ticks, 3);
+		for (i = 0; i < numArgs; i++)
+		{
+			arg = ring[(pos + TRACE_REC_FIXED_WORDS + i) & TRACE_RING_MASK];
+			pDst[len++] = BREAK_UINT32(arg, 0);
+			pDst[len++] = BREAK_UINT32(arg, 1);
+			pDst[len++] = BREAK_UINT32(arg, 2);
+			pDst[len++] = BREAK_UINT32(arg, 3);
+		}
+
+		pos += TRACE_REC_FIXED_WORDS + numArgs;
+	}
+
+	*pWords = pos - tail;
+	return len;
+}
@@ -0,0 +1,145 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			trace.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the tokenized trace.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+#include "trace_msgs.h"
+
+//TI-RTOS Header Files
+#include <ti/drivers/UART.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define TRACE_LEVEL_NONE					0
+#define TRACE_LEVEL_ERROR					1
+#define TRACE_LEVEL_WARNING					2
+#define TRACE_LEVEL_INFO					3
+#define TRACE_LEVEL_DEBUG					4
+
+//Calls above this level compile to nothing. Set it in the project to change it.
+#ifndef TRACE_LEVEL
+#if defined(USE_UART)
+#define TRACE_LEVEL							TRACE_LEVEL_INFO
+#else
+#define TRACE_LEVEL							TRACE_LEVEL_NONE
+#endif //USE_UART
+#endif //TRACE_LEVEL
+
+#define TRACE_MAX_ARGS						5
+
+/*
+ * A call stores the message ID, its level, the Clock ticks and the raw arguments in a
+ * RAM ring, nothing is formatted on the device. Safe from Hwi, Swi and Task context.
+ * A task at priority 1 writes the records to the UART, shared with the xdc Log text,
+ * as frames
+ * 	[0]		0x00, never part of the Log text
+ * 	[1]		length of the records that follow
+ * 	[2..]	records
+ * and each record is
+ * 	[0-1]	message ID, position in TRACE_MSGS
+ * 	[2]		level << 4 | number of arguments
+ * 	[3-6]	Clock ticks
+ * 	[7..]	arguments, 4 bytes each
+ * Multi-byte fields are little endian.
+ */
+#define TRACE_MSG(id, fmt)					id,
+typedef enum {
+	TRACE_MSGS
+	TRACE_NUM_MSGS
+} Trace_id;
+#undef TRACE_MSG
+
+#define TRACE_HDR(id, level, numArgs)		((uint32_t)(id) | ((uint32_t)(level) << 24) | \
+											 ((uint32_t)(numArgs) << 28))
+
+#define TRACE_A(x)							((uint32_t)(x))
+#define TRACE_0(l, id)						trace_write(TRACE_HDR(id, l, 0), 0, 0, 0, 0, 0)
+#define TRACE_1(l, id, a)					trace_write(TRACE_HDR(id, l, 1), TRACE_A(a), 0, 0, 0, 0)
+#define TRACE_2(l, id, a, b)				trace_write(TRACE_HDR(id, l, 2), TRACE_A(a), TRACE_A(b), 0, 0, 0)
+#define TRACE_3(l, id, a, b, c)				trace_write(TRACE_HDR(id, l, 3), TRACE_A(a), TRACE_A(b), \
+														TRACE_A(c), 0, 0)
+#define TRACE_4(l, id, a, b, c, d)			trace_write(TRACE_HDR(id, l, 4), TRACE_A(a), TRACE_A(b), \
+														TRACE_A(c), TRACE_A(d), 0)
+#define TRACE_5(l, id, a, b, c, d, e)		trace_write(TRACE_HDR(id, l, 5), TRACE_A(a), TRACE_A(b), \
+														TRACE_A(c), TRACE_A(d), TRACE_A(e))
+
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TRACE_ERROR0(id)					TRACE_0(TRACE_LEVEL_ERROR, id)
+#define TRACE_ERROR1(id, a)					TRACE_1(TRACE_LEVEL_ERROR, id, a)
+#define TRACE_ERROR2(id, a, b)				TRACE_2(TRACE_LEVEL_ERROR, id, a, b)
+#else
+#define TRACE_ERROR0(id)
+#define TRACE_ERROR1(id, a)
+#define TRACE_ERROR2(id, a, b)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_WARNING
+#define TRACE_WARNING0(id)					TRACE_0(TRACE_LEVEL_WARNING, id)
+#define TRACE_WARNING1(id, a)				TRACE_1(TRACE_LEVEL_WARNING, id, a)
+#define TRACE_WARNING2(id, a, b)			TRACE_2(TRACE_LEVEL_WARNING, id, a, b)
+#define TRACE_WARNING3(id, a, b, c)			TRACE_3(TRACE_LEVEL_WARNING, id, a, b, c)
+#else
+#define TRACE_WARNING0(id)
+#define TRACE_WARNING1(id, a)
+#define TRACE_WARNING2(id, a, b)
+#define TRACE_WARNING3(id, a, b, c)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO0(id)						TRACE_0(TRACE_LEVEL_INFO, id)
+#define TRACE_INFO1(id, a)					TRACE_1(TRACE_LEVEL_INFO, id, a)
+#define TRACE_INFO2(id, a, b)				TRACE_2(TRACE_LEVEL_INFO, id, a, b)
+#define TRACE_INFO3(id, a, b, c)			TRACE_3(TRACE_LEVEL_INFO, id, a, b, c)
+#define TRACE_INFO4(id, a, b, c, d)			TRACE_4(TRACE_LEVEL_INFO, id, a, b, c, d)
+#define TRACE_INFO5(id, a, b, c, d, e)		TRACE_5(TRACE_LEVEL_INFO, id, a, b, c, d, e)
+#else
+#define TRACE_INFO0(id)
+#define TRACE_INFO1(id, a)
+#define TRACE_INFO2(id, a, b)
+#define TRACE_INFO3(id, a, b, c)
+#define TRACE_INFO4(id, a, b, c, d)
+#define TRACE_INFO5(id, a, b, c, d, e)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG0(id)					TRACE_0(TRACE_LEVEL_DEBUG, id)
+#define TRACE_DEBUG1(id, a)					TRACE_1(TRACE_LEVEL_DEBUG, id, a)
+#define TRACE_DEBUG2(id, a, b)				TRACE_2(TRACE_LEVEL_DEBUG, id, a, b)
+#else
+#define TRACE_DEBUG0(id)
+#define TRACE_DEBUG1(id, a)
+#define TRACE_DEBUG2(id, a, b)
+#endif
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Creates the task that writes the records to the UART.
+ *
+ * @param 	hUart		UART, also used by the xdc Log output
+ * @return 	none
+ */
+extern void trace_createTask(UART_Handle hUart);
+
+/**
+ * Stores one record, or counts it as dropped when the ring is full. Use the
+ * TRACE_<level><n> macros.
+ *
+ * @param 	hdr			TRACE_HDR
+ * @param	a0			Arguments, the ones past the count in hdr are ignored
+ * @return 	none
+ */
+extern void trace_write(uint32_t hdr, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3,
+						uint32_t a4);
+
+#endif /* TRACE_H */
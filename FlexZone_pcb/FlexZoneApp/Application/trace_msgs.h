@@ -0,0 +1,40 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			trace_msgs.h
+* Group: 				GroupX - FlexZone
+* Description:			Message table of the tokenized trace. The position of a message
+* 						is its ID on the wire; tools/trace_decode.py reads this file
+* 						to print the records.
+ */
+#ifndef TRACE_MSGS_H
+#define TRACE_MSGS_H
+
+/*
+ * Only append, or move the firmware and the decoder together. Formats take %d, %u,
+ * %x and %c with their flags and widths, no %s: the string would not be on the
+ * wire.
+ */
+#define TRACE_MSGS \
+	TRACE_MSG(TRACE_BOOT,					"Trace started, %u messages") \
+	TRACE_MSG(TRACE_DROPPED,				"%u trace records dropped") \
+	TRACE_MSG(TRACE_EMG_MISSED_DEADLINE,	"EMG: missed sample deadline") \
+	TRACE_MSG(TRACE_EMG_SLICE,				"EMG: slice done, reps %u") \
+	TRACE_MSG(TRACE_EMG_REP,				"EMG: rep %u") \
+	TRACE_MSG(TRACE_EMG_EXERCISE,			"EMG: exercise %u") \
+	TRACE_MSG(TRACE_EMG_SET_DONE,			"EMG: set %u done, %u reps") \
+	TRACE_MSG(TRACE_EMG_CONFIG,				"EMG: config applied") \
+	TRACE_MSG(TRACE_WORKOUT_CONFIG,			"Sets: %u Reps: %u Rest: %u Haptic: %u IMU: %u") \
+	TRACE_MSG(TRACE_SVC_WRITE,				"(CB) Characteristic value change: svc(0x%04x) paramID(%d)") \
+	TRACE_MSG(TRACE_SVC_CFG,				"(CB) Char config change: svc(0x%04x) paramID(%d)") \
+	TRACE_MSG(TRACE_MEM_TASK,				"Task %u stack: %u of %u bytes") \
+	TRACE_MSG(TRACE_MEM_SYSTEM,				"System stack: %u of %u bytes") \
+	TRACE_MSG(TRACE_MEM_HEAP,				"ICall heap: %u in use, %u peak of %u bytes, %u failed allocs") \
+	TRACE_MSG(TRACE_BUS_DROPPED,			"Event bus: event %u dropped, sink %u full") \
+	TRACE_MSG(TRACE_VIBE_DROPPED,			"Vibe: pattern %u, priority %u dropped, queue full") \
+	TRACE_MSG(TRACE_EMG_REST_START,			"EMG: front end off, rest up to %u s") \
+	TRACE_MSG(TRACE_EMG_REST_END,			"EMG: rest over after %u s, wake %u") \
+	TRACE_MSG(TRACE_BOOT_PHASE,				"Boot phase %u at %u ms") \
+	TRACE_MSG(TRACE_CLASSIFIER_CYCLES,		"Classifier: %u cycles, exercise %u") \
+	TRACE_MSG(TRACE_EMG_SET_DROPPED,		"EMG: set %u summary dropped, never queued")
+
+#endif /* TRACE_MSGS_H */
@@ -2,46 +2,102 @@
  * Application Name:	FlexZone (Application)
  * File Name: 			vibe.c
  * Group: 				GroupX - FlexZone
- * Description:			Implementation file for the vibe motor thread.
+ * Description:			Implementation file for the vibe motor handler.
  */
 
 //**********************************************************************************
 // Header Files
 //**********************************************************************************
 //XDCtools Header Files
+#include <xdc/runtime/Timestamp.h>
 
 //SYS/BIOS Header Files
-#include <ti/sysbios/BIOS.h>				//required for BIOS_WAIT_FOREVER in Semaphore_pend();
+#include <ti/sysbios/knl/Clock.h>
+#include <ti/sysbios/knl/Swi.h>
+#include <ti/sysbios/hal/Hwi.h>
+#include <ti/sysbios/family/arm/cc26xx/Power.h>
+#include <ti/sysbios/family/arm/cc26xx/PowerCC2650.h>
 
 //TI-RTOS Header Files
-#include <ti/sysbios/knl/Task.h>
-#include <ti/sysbios/knl/Clock.h>
+#include <ti/drivers/pin/PINCC26XX.h>
+#include <inc/hw_memmap.h>
+#include <driverlib/timer.h>
 
 //Board Specific Header Files
 #include "Board.h"
 
 //Home brewed Header Files
 #include "vibe.h"
+#include "diag.h"
+#include "trace.h"
 
 //Standard Header Files
 
 //**********************************************************************************
 // Required Definitions
 //**********************************************************************************
-#define VIBE_TASK_PRIORITY					1
-#ifndef VIBE_TASK_STACK_SIZE
-#define VIBE_TASK_STACK_SIZE              200
-#endif
+#define VIBE_PWM_FREQ_HZ					20000	//Above hearing
+#define VIBE_PWM_LOAD						(48000000 / VIBE_PWM_FREQ_HZ)
+
+//Above every task, so a cue does not wait for the BLE or EMG task
+#define VIBE_SWI_PRIORITY					1
+
+//Swi trigger bits
+#define VIBE_TRIG_REQUEST					0x01	//vibe_play queued a cue
+#define VIBE_TRIG_STEP						0x02	//vibeClock expired
+
+#define VIBE_MS_TO_TICKS(ms)				((ms) * (1000 / Clock_tickPeriod))
+
+#define VIBE_PHASE_ON						0
+#define VIBE_PHASE_OFF						1
 
 //**********************************************************************************
 // Global Data Structures
 //**********************************************************************************
-//Task Structures
-Task_Struct vibeTask;
-Char vibeTaskStack[VIBE_TASK_STACK_SIZE];
+typedef struct {
+	uint8_t pattern;					//Vibe_patternId
+	uint8_t prio;						//Vibe_prio
+	uint8_t times;
+	uint32_t requested;					//Timestamp_get32 of vibe_play
+} Vibe_cue;
+
+//Pattern table, indexed by Vibe_patternId
+static const Vibe_step buzzSteps[] = {
+		{100, 40, 20, 1}
+};
+
+static const Vibe_step repTickSteps[] = {
+		{100, 3, 7, 1}
+};
+
+static const Vibe_step tempoSlowerSteps[] = {
+		{60, 15, 10, 2}
+};
+
+static const Vibe_step tempoFasterSteps[] = {
+		{100, 4, 6, 3}
+};
 
-//Semaphore Structures
-Semaphore_Struct vibeSemaphore;
+static const Vibe_step restOverSteps[] = {
+		{100, 20, 10, 3}
+};
+
+#define VIBE_STEPS(steps)					{steps, sizeof(steps) / sizeof(steps[0])}
+
+static const Vibe_pattern patterns[VIBE_NUM_PATTERNS] = {
+		VIBE_STEPS(buzzSteps),
+		VIBE_STEPS(repTickSteps),
+		VIBE_STEPS(tempoSlowerSteps),
+		VIBE_STEPS(tempoFasterSteps),
+		VIBE_STEPS(restOverSteps)
+};
+
+//Swi Structures
+Swi_Struct vibeSwi;
+
+//Clock Structures, one shot for the end of each phase
+Clock_Struct vibeClock;
+static uint32_t vibeDeadline;			//Clock ticks
 
 //Pin stuff
 PIN_Handle vibePinHandle;
@@ -51,53 +107,102 @@ PIN_Config vibePinTable[] = {
 		PIN_TERMINATE
 };
 
-uint8_t numberOfBuzz;
+//The queue is in priority order, oldest first within one. Shared with vibe_play, so
+//only touched with interrupts off.
+static Vibe_cue queue[VIBE_QUEUE_LEN];
+static uint8_t queueLen = 0;
+
+//Owned by vibe_SwiFxn
+static uint8_t playing = 0;
+static Vibe_cue cue;					//Playing, times counts down
+static uint8_t stepIndex;
+static uint8_t repeatsLeft;
+static uint8_t phase;
+static uint8_t pwmOn = 0;
+
 //**********************************************************************************
 // Local Function Prototypes
 //**********************************************************************************
-void vibe_init();
-static void vibe_taskFxn(UArg a0, UArg a1);
+static void vibe_SwiFxn(UArg a0, UArg a1);
+static void vibe_clockFxn(UArg a0);
+static uint8_t vibe_enqueue(const Vibe_cue *pCue, Vibe_cue *pDropped);
+static void vibe_step(void);
+static void vibe_nextCue(uint8_t fromNow);
+static void vibe_stepOn(uint8_t fromNow);
+static void vibe_timerStart(uint32_t ms, uint8_t fromNow);
+static void vibe_setDuty(uint8_t duty);
 
 //**********************************************************************************
 // Function Definitions
 //**********************************************************************************
+/**
+ * Buzzes the vibe motor. Safe from Hwi, Swi and Task context.
+ *
+ * @param 	numTimes	Number of buzzes
+ * @return 	none
+ */
 void buzz(uint8_t numTimes)
 {
-	numberOfBuzz = numTimes;
-	Semaphore_post(Semaphore_handle(&vibeSemaphore));
+	vibe_play(VIBE_PATTERN_BUZZ, VIBE_PRIO_INFO, numTimes);
 }
 
 /**
- * Creates Vibration Motor task.
+ * Queues a cue. Safe from Hwi, Swi and Task context.
  *
- * @param 	none
- * @return 	none
+ * @param 	pattern		VIBE_PATTERN_*
+ * @param	prio		VIBE_PRIO_*
+ * @param	times		Times the whole pattern plays, at least 1
+ * @return 	1 if queued, 0 if it was dropped
  */
-void vibe_createTask()
+uint8_t vibe_play(Vibe_patternId pattern, Vibe_prio prio, uint8_t times)
 {
-    Task_Params taskParams;
-	Semaphore_Params semaphoreParams;
+	Vibe_cue newCue, dropped;
+	uint8_t queued;
+	UInt key;
+
+	if (0 == times || pattern >= VIBE_NUM_PATTERNS || prio >= VIBE_NUM_PRIOS)
+		return 0;
 
-	// Configure & construct semaphore
-	Semaphore_Params_init(&semaphoreParams);
-	Semaphore_construct(&vibeSemaphore, 0, &semaphoreParams);
+	newCue.pattern = pattern;
+	newCue.prio = prio;
+	newCue.times = times;
+	newCue.requested = Timestamp_get32();
+	dropped.times = 0;
 
-    Task_Params_init(&taskParams);
-    taskParams.stackSize = VIBE_TASK_STACK_SIZE;
-    taskParams.stack = &vibeTaskStack;
-    taskParams.priority = VIBE_TASK_PRIORITY;
+	key = Hwi_disable();
+	queued = vibe_enqueue(&newCue, &dropped);
+	Hwi_restore(key);
 
-    Task_construct(&vibeTask, (Task_FuncPtr)vibe_taskFxn, &taskParams, NULL);
+	if (dropped.times)
+		TRACE_WARNING2(TRACE_VIBE_DROPPED, dropped.pattern, dropped.prio);
+	if (queued)
+		Swi_or(Swi_handle(&vibeSwi), VIBE_TRIG_REQUEST);
+
+	return queued;
 }
 
 /**
- * Initializes Vibe Motor pins.
+ * Initializes the Vibe Motor pin and constructs the sequencer Swi and clock. Called
+ * before BIOS_start.
  *
  * @param 	none
  * @return 	none
  */
 void vibe_init(void)
 {
+	Swi_Params swiParams;
+	Clock_Params clockParams;
+
+	Swi_Params_init(&swiParams);
+	swiParams.priority = VIBE_SWI_PRIORITY;
+	Swi_construct(&vibeSwi, vibe_SwiFxn, &swiParams, NULL);
+
+	//One shot, the timeout is set for each phase
+	Clock_Params_init(&clockParams);
+	clockParams.period = 0;
+	clockParams.startFlag = FALSE;
+	Clock_construct(&vibeClock, vibe_clockFxn, 1, &clockParams);
+
 	// Open GPIO pins
 	vibePinHandle = PIN_open(&vibePinState, vibePinTable);
 	if (!vibePinHandle) {
@@ -110,23 +215,238 @@ void vibe_init(void)
 	}
 }
 
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Sequencer Swi. A step moves the cue on by one on or off phase; a request plays the
+ * first queued cue at once if the motor is idle or the cue outranks the one playing.
+ *
+ * @param 	a0, a1		Not used
+ * @return 	none
+ */
+static void vibe_SwiFxn(UArg a0, UArg a1)
+{
+	uint32_t trigger = Swi_getTrigger();
+	uint8_t outranks;
+	UInt key;
+
+	//A preempted cue's expiry can still be pending after the new cue started the clock
+	if ((trigger & VIBE_TRIG_STEP) && playing && !Clock_isActive(Clock_handle(&vibeClock)))
+		vibe_step();
+
+	if (trigger & VIBE_TRIG_REQUEST)
+	{
+		key = Hwi_disable();
+		outranks = queueLen && (!playing || queue[0].prio > cue.prio);
+		Hwi_restore(key);
+
+		if (outranks)
+		{
+			//Preempted, the rest of the cue is dropped
+			Clock_stop(Clock_handle(&vibeClock));
+			vibe_nextCue(1);
+		}
+	}
+}
+
 /**
- * Primary Vibe Motor task.
+ * Clock callback, ends the phase playing.
+ *
+ * @param 	a0			Not used
+ * @return 	none
+ */
+static void vibe_clockFxn(UArg a0)
+{
+	Swi_or(Swi_handle(&vibeSwi), VIBE_TRIG_STEP);
+}
+
+/**
+ * Moves the cue playing on by one phase, at the end of its last phase to the next
+ * queued cue.
  *
  * @param 	none
  * @return 	none
  */
-void vibe_taskFxn(UArg a0, UArg a1)
+static void vibe_step(void)
+{
+	const Vibe_step *pStep = &patterns[cue.pattern].pSteps[stepIndex];
+
+	if (VIBE_PHASE_ON == phase && pStep->offTime)
+	{
+		vibe_setDuty(0);
+		phase = VIBE_PHASE_OFF;
+		vibe_timerStart(pStep->offTime * VIBE_TIME_UNIT_MS, 0);
+		return;
+	}
+
+	if (0 == --repeatsLeft)
+	{
+		if (++stepIndex == patterns[cue.pattern].numSteps)
+		{
+			stepIndex = 0;
+			if (0 == --cue.times)
+			{
+				vibe_nextCue(0);
+				return;
+			}
+		}
+		repeatsLeft = patterns[cue.pattern].pSteps[stepIndex].repeats;
+	}
+	vibe_stepOn(0);
+}
+
+/**
+ * Queues a cue behind the cues of the same or higher priority. When the queue is full
+ * the lowest priority cue is dropped, the new one if it is not above it. Called with
+ * interrupts off.
+ *
+ * @param 	pCue		Cue, copied
+ * @param	pDropped	Returns the cue dropped, times left alone if none
+ * @return 	1 if queued
+ */
+static uint8_t vibe_enqueue(const Vibe_cue *pCue, Vibe_cue *pDropped)
+{
+	uint8_t pos;
+	uint8_t i;
+
+	if (VIBE_QUEUE_LEN == queueLen)
+	{
+		if (pCue->prio <= queue[queueLen - 1].prio)
+		{
+			*pDropped = *pCue;
+			return 0;
+		}
+		*pDropped = queue[--queueLen];
+	}
+
+	for (pos = 0; pos < queueLen && queue[pos].prio >= pCue->prio; pos++)
+		;
+	for (i = queueLen; i > pos; i--)
+		queue[i] = queue[i - 1];
+
+	queue[pos] = *pCue;
+	queueLen++;
+	return 1;
+}
+
+/**
+ * Plays the first queued cue, or stops the motor when there is none.
+ *
+ * @param 	fromNow		1 to time the cue from now, 0 to follow on the last deadline
+ * @return 	none
+ */
+static void vibe_nextCue(uint8_t fromNow)
+{
+	uint8_t i;
+	UInt key;
+
+	key = Hwi_disable();
+	if (0 == queueLen)
+	{
+		Hwi_restore(key);
+		vibe_setDuty(0);
+		playing = 0;
+		return;
+	}
+
+	cue = queue[0];
+	queueLen--;
+	for (i = 0; i < queueLen; i++)
+		queue[i] = queue[i + 1];
+	Hwi_restore(key);
+
+	playing = 1;
+	stepIndex = 0;
+	repeatsLeft = patterns[cue.pattern].pSteps[0].repeats;
+	vibe_stepOn(fromNow);
+
+	//Request to motor on, for a cue that did not wait behind another
+	if (fromNow)
+		diag_timerUs(DIAG_TIMER_HAPTIC, Timestamp_get32() - cue.requested);
+}
+
+/**
+ * Starts the on phase of the current step.
+ *
+ * @param 	fromNow		1 to time the phase from now, 0 to follow on the last deadline
+ * @return 	none
+ */
+static void vibe_stepOn(uint8_t fromNow)
+{
+	const Vibe_step *pStep = &patterns[cue.pattern].pSteps[stepIndex];
+	uint32_t onMs = pStep->onTime * VIBE_TIME_UNIT_MS;
+
+	vibe_setDuty(pStep->duty);
+	phase = VIBE_PHASE_ON;
+	vibe_timerStart(onMs, fromNow);
+}
+
+/**
+ * Starts vibeClock for the end of a phase, timed from the end of the last phase
+ * rather than from now, so a late Swi does not stretch the pattern.
+ *
+ * @param 	ms			Length of the phase
+ * @param	fromNow		1 for the first phase of a cue
+ * @return 	none
+ */
+static void vibe_timerStart(uint32_t ms, uint8_t fromNow)
+{
+	int32_t timeout;
+
+	if (fromNow)
+		vibeDeadline = Clock_getTicks();
+	vibeDeadline += VIBE_MS_TO_TICKS(ms);
+
+	timeout = (int32_t)(vibeDeadline - Clock_getTicks());
+	if (timeout < 1)
+		timeout = 1;
+
+	Clock_setTimeout(Clock_handle(&vibeClock), timeout);
+	Clock_start(Clock_handle(&vibeClock));
+}
+
+/**
+ * Drives the motor. 0 and 100 % set the pin, anything between routes GPT0A in PWM
+ * mode to it. The GPT stops in standby, so standby is kept off while the PWM runs.
+ *
+ * @param 	duty		Percent
+ * @return 	none
+ */
+static void vibe_setDuty(uint8_t duty)
 {
-	int i;
-	while (1)
+	uint32_t match;
+
+	if (0 == duty || duty >= 100)
 	{
-		Semaphore_pend(Semaphore_handle(&vibeSemaphore), BIOS_WAIT_FOREVER);
-		for (i = 0; i < numberOfBuzz; i++) {
-			PIN_setOutputValue(vibePinHandle, Board_VIBE_MOTOR, 1);
-			Task_sleep((UInt) 400 * (1000 / Clock_tickPeriod));
-			PIN_setOutputValue(vibePinHandle, Board_VIBE_MOTOR, 0);
-			Task_sleep((UInt) 200 * (1000 / Clock_tickPeriod));
+		if (pwmOn)
+		{
+			TimerDisable(GPT0_BASE, TIMER_A);
+			PINCC26XX_setMux(vibePinHandle, Board_VIBE_MOTOR, PINCC26XX_MUX_GPIO);
+			Power_releaseConstraint(Power_SB_DISALLOW);
+			Power_releaseDependency(PERIPH_GPT0);
+			pwmOn = 0;
 		}
+		PIN_setOutputValue(vibePinHandle, Board_VIBE_MOTOR, duty ? 1 : 0);
+		return;
+	}
+
+	if (!pwmOn)
+	{
+		Power_setDependency(PERIPH_GPT0);
+		Power_setConstraint(Power_SB_DISALLOW);
+		TimerConfigure(GPT0_BASE, TIMER_CFG_SPLIT_PAIR | TIMER_CFG_A_PWM);
+		TimerLoadSet(GPT0_BASE, TIMER_A, VIBE_PWM_LOAD);
+		pwmOn = 1;
 	}
+	else
+	{
+		TimerDisable(GPT0_BASE, TIMER_A);
+	}
+
+	//Counting down, the output is high from the load to the match
+	match = VIBE_PWM_LOAD - (VIBE_PWM_LOAD * duty) / 100;
+	TimerMatchSet(GPT0_BASE, TIMER_A, match);
+	PINCC26XX_setMux(vibePinHandle, Board_VIBE_MOTOR, IOC_PORT_MCU_PORT_EVENT0);
+	TimerEnable(GPT0_BASE, TIMER_A);
 }
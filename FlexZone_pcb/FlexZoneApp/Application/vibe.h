@@ -2,7 +2,7 @@
 * Application Name:		FlexZone (Application)
 * File Name: 			vibe.h
 * Group: 				GroupX - FlexZone
-* Description:			Defines and prototypes for the vibration motor Thread.
+* Description:			Defines and prototypes for the vibration motor handler.
  */
 #ifndef VIBE_H
 #define VIBE_H
@@ -15,20 +15,71 @@
 //**********************************************************************************
 // Required Definitions
 //**********************************************************************************
+#define VIBE_TIME_UNIT_MS					10
+#define VIBE_QUEUE_LEN						4
+
+/*
+ * Haptic sequencer. A pattern is a list of steps; each step drives the motor at its
+ * duty for onTime, stops it for offTime and plays repeats times. The sequencer is a
+ * Swi with a one shot clock for the phases, above every task, so a cue starts within
+ * microseconds of vibe_play from any thread and nothing waits while it plays. The
+ * duty is a PWM of GPT0A on the motor pin, 0 and 100 % drive the pin directly.
+ *
+ * Cues wait in a queue by priority, in order within a priority. A cue of higher
+ * priority than the one playing stops it and plays at once; when the queue is full
+ * the lowest priority cue is dropped.
+ */
+typedef enum {
+	VIBE_PRIO_INFO = 0,					//Acknowledgements, set done
+	VIBE_PRIO_CUE,						//Cues the user acts on
+	VIBE_PRIO_URGENT,
+	VIBE_NUM_PRIOS
+} Vibe_prio;
+
+typedef enum {
+	VIBE_PATTERN_BUZZ = 0,				//400 ms on, 200 ms off
+	VIBE_PATTERN_REP_TICK,				//30 ms tick, a rep was counted
+	VIBE_PATTERN_TEMPO_SLOWER,			//Two soft pulses, the last rep was too fast
+	VIBE_PATTERN_TEMPO_FASTER,			//Three short ticks, the last rep was too slow
+	VIBE_PATTERN_REST_OVER,				//Three 200 ms pulses, start the next set
+	VIBE_NUM_PATTERNS
+} Vibe_patternId;
 
 //**********************************************************************************
 // Global Data Structures
 //**********************************************************************************
+typedef struct {
+	uint8_t duty;						//Percent, 0 for a pause
+	uint8_t onTime;						//VIBE_TIME_UNIT_MS
+	uint8_t offTime;					//VIBE_TIME_UNIT_MS
+	uint8_t repeats;					//At least 1
+} Vibe_step;
+
+typedef struct {
+	const Vibe_step *pSteps;
+	uint8_t numSteps;
+} Vibe_pattern;
 
 //**********************************************************************************
 // Function Prototypes
 //**********************************************************************************
 /**
- * Creates Vibration motor task running at and configures all required hardware components.
+ * Initializes the Vibe Motor pin and constructs the sequencer Swi and clock. Called
+ * before BIOS_start.
  *
  * @param 	none
  * @return 	none
  */
-extern void vibe_createTask(void);
+extern void vibe_init(void);
+
+/**
+ * Queues a cue. Safe from Hwi, Swi and Task context.
+ *
+ * @param 	pattern		VIBE_PATTERN_*
+ * @param	prio		VIBE_PRIO_*
+ * @param	times		Times the whole pattern plays, at least 1
+ * @return 	1 if queued, 0 if it was dropped
+ */
+extern uint8_t vibe_play(Vibe_patternId pattern, Vibe_prio prio, uint8_t times);
 
 #endif /* VIBE_H */
@@ -0,0 +1,400 @@
+/*
+ * Application Name:	FlexZone (Application)
+ * File Name: 			workout_config.c
+ * Group: 				GroupX - FlexZone
+ * Description:			Implementation file for the workout and acquisition configuration.
+ */
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+//SYS/BIOS Header Files
+#include <ti/sysbios/hal/Hwi.h>
+
+//BLE Stack Header Files
+#include <bcomdef.h>
+
+//Home brewed Header Files
+#include "workout_config.h"
+
+//Standard Header Files
+#include <stddef.h>
+#include <string.h>
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define WORKOUT_CFG_LEGACY_LEN				7
+#define WORKOUT_CFG_LEGACY_STOP				0xCF
+#define WORKOUT_CFG_LEGACY_REST_UNIT		30		//Seconds
+
+//**********************************************************************************
+// Global Data Structures
+//**********************************************************************************
+typedef struct {
+	uint8_t key;
+	uint8_t offset;				//In Workout_config
+	uint8_t size;				//1 or 2
+	uint16_t min;
+	uint16_t max;
+} WorkoutConfig_key;
+
+static const WorkoutConfig_key keys[] = {
+	{ WORKOUT_CFG_KEY_SET_COUNT,		offsetof(Workout_config, targetSetCount),	1, 1, 255 },
+	{ WORKOUT_CFG_KEY_REP_COUNT,		offsetof(Workout_config, targetRepCount),	1, 1, EMG_MAX_REPS },
+	{ WORKOUT_CFG_KEY_MAX_REST,			offsetof(Workout_config, maxRestSeconds),	2, 0, 0xFFFF },
+	{ WORKOUT_CFG_KEY_HAPTIC,			offsetof(Workout_config, hapticFeedback),	1, 0, 1 },
+	{ WORKOUT_CFG_KEY_IMU,				offsetof(Workout_config, imuFeedback),		1, 0, 1 },
+	{ WORKOUT_CFG_KEY_RAW_STREAM,		offsetof(Workout_config, rawStream),		1, 0, 1 },
+	{ WORKOUT_CFG_KEY_BROADCAST,		offsetof(Workout_config, broadcastPeriod),	1, 0, 255 },
+	{ WORKOUT_CFG_KEY_REP_CUE,			offsetof(Workout_config, repCue),			1, 0, 1 },
+	{ WORKOUT_CFG_KEY_CONCENTRIC,		offsetof(Workout_config, concentricTarget),	1, 0, 100 },
+	{ WORKOUT_CFG_KEY_ECCENTRIC,		offsetof(Workout_config, eccentricTarget),	1, 0, 100 },
+	{ WORKOUT_CFG_KEY_THRESHOLD_HIGH,	offsetof(Workout_config, repThresholdHigh),	2, 1, 4095 },
+	{ WORKOUT_CFG_KEY_THRESHOLD_LOW,	offsetof(Workout_config, repThresholdLow),	2, 1, 4095 },
+	{ WORKOUT_CFG_KEY_MIN_REP_MS,		offsetof(Workout_config, minRepMs),			2, 0, 5000 },
+	{ WORKOUT_CFG_KEY_SET_TIMEOUT,		offsetof(Workout_config, setTimeoutSec),	1, 1, 255 },
+	{ WORKOUT_CFG_KEY_SAMPLE_PERIOD,	offsetof(Workout_config, samplePeriodMs),	1, 10, 100 },
+	{ WORKOUT_CFG_KEY_ADC_AVERAGE,		offsetof(Workout_config, adcAverage),		1, 1, 16 },
+	{ WORKOUT_CFG_KEY_GAIN_0,			offsetof(Workout_config, gain),				1, 0, 255 },
+	{ WORKOUT_CFG_KEY_GAIN_1,			offsetof(Workout_config, gain) + 1,			1, 0, 255 },
+};
+
+#define WORKOUT_CFG_NUM_KEYS				(sizeof(keys) / sizeof(keys[0]))
+
+//Accepted write waiting for workoutConfig_apply. Shared with the EMG task and the
+//EMG config Swi, so only touched with interrupts off.
+static Workout_config staged;
+static uint8_t stagedValid = 0;
+static uint8_t pendingCmd = WORKOUT_CFG_CMD_NONE;
+
+//Reported on the Active Config characteristic
+static uint8_t lastResult = WORKOUT_CFG_OK;
+static uint8_t lastErrPos = 0;
+
+//**********************************************************************************
+// Local Function Prototypes
+//**********************************************************************************
+static const WorkoutConfig_key *findKey(uint8_t key);
+static uint16_t getField(const Workout_config *pCfg, const WorkoutConfig_key *pKey);
+static void setField(Workout_config *pCfg, const WorkoutConfig_key *pKey, uint16_t value);
+static uint8_t parseLegacy(const uint8_t *pBuf, uint16_t len, Workout_config *pCfg);
+
+//**********************************************************************************
+// Function Definitions
+//**********************************************************************************
+/**
+ * Sets the active configuration to the defaults.
+ *
+ * @param 	none
+ * @return 	none
+ */
+void workoutConfig_init(void)
+{
+	memset(&myWorkoutConfig, 0, sizeof(myWorkoutConfig));
+	myWorkoutConfig.targetSetCount = WORKOUT_CFG_DEFAULT_SETS;
+	myWorkoutConfig.targetRepCount = EMG_MAX_REPS;
+	myWorkoutConfig.repThresholdHigh = WORKOUT_CFG_DEFAULT_THRESHOLD_HIGH;
+	myWorkoutConfig.repThresholdLow = WORKOUT_CFG_DEFAULT_THRESHOLD_LOW;
+	myWorkoutConfig.minRepMs = WORKOUT_CFG_DEFAULT_MIN_REP_MS;
+	myWorkoutConfig.setTimeoutSec = WORKOUT_CFG_DEFAULT_SET_TIMEOUT;
+	myWorkoutConfig.samplePeriodMs = EMG_PERIOD_IN_MS;
+	myWorkoutConfig.adcAverage = WORKOUT_CFG_DEFAULT_ADC_AVERAGE;
+}
+
+/**
+ * Parses a v2 write into pCfg. Plain C without RTOS calls, so the app can share it.
+ *
+ * @param 	pBuf		Write, starting with WORKOUT_CFG_MAGIC
+ * @param	len			Write length
+ * @param	pCfg		In: values to start from. Out: parsed values, only on success.
+ * @param	pCmd		Returns the command
+ * @param	pErrPos		Returns the offset of the failing TLV
+ * @return 	WORKOUT_CFG_OK or WORKOUT_CFG_ERR_*
+ */
+uint8_t workoutConfig_parse(const uint8_t *pBuf, uint16_t len, Workout_config *pCfg,
+							uint8_t *pCmd, uint8_t *pErrPos)
+{
+	Workout_config cfg = *pCfg;
+	const WorkoutConfig_key *pKey;
+	uint16_t pos = WORKOUT_CFG_HEADER_LEN, value;
+	uint8_t vLen;
+
+	*pCmd = WORKOUT_CFG_CMD_NONE;
+	*pErrPos = 0;
+
+	if (len < WORKOUT_CFG_HEADER_LEN)
+		return WORKOUT_CFG_ERR_TRUNCATED;
+	if (pBuf[1] < WORKOUT_CFG_CMD_START || pBuf[1] > WORKOUT_CFG_CMD_UPDATE) {
+		*pErrPos = 1;
+		return WORKOUT_CFG_ERR_COMMAND;
+	}
+
+	if (pBuf[1] != WORKOUT_CFG_CMD_STOP) {
+		while (pos < len) {
+			*pErrPos = pos;
+			if (pos + 2 > len)
+				return WORKOUT_CFG_ERR_TRUNCATED;
+
+			vLen = pBuf[pos + 1];
+			if (pos + 2 + vLen > len)
+				return WORKOUT_CFG_ERR_TRUNCATED;
+
+			pKey = findKey(pBuf[pos]);
+			if (pKey) {
+				if (vLen != pKey->size)
+					return WORKOUT_CFG_ERR_LENGTH;
+
+				value = (vLen == 1) ? pBuf[pos + 2] : BUILD_UINT16(pBuf[pos + 2], pBuf[pos + 3]);
+				if (value < pKey->min || value > pKey->max)
+					return WORKOUT_CFG_ERR_RANGE;
+
+				setField(&cfg, pKey, value);
+			}
+
+			pos += 2 + vLen;
+		}
+
+		*pErrPos = 0;
+		if (cfg.repThresholdLow >= cfg.repThresholdHigh)
+			return WORKOUT_CFG_ERR_CONFLICT;
+	}
+
+	*pCfg = cfg;
+	*pCmd = pBuf[1];
+	return WORKOUT_CFG_OK;
+}
+
+/**
+ * Encodes every key of pCfg as TLVs.
+ *
+ * @param 	pCfg		Configuration
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes written, whole TLVs only.
+ */
+uint16_t workoutConfig_encode(const Workout_config *pCfg, uint8_t *pDst, uint16_t maxLen)
+{
+	uint16_t pos = 0, value;
+	uint8_t i;
+
+	for (i = 0; i < WORKOUT_CFG_NUM_KEYS; i++) {
+		if (pos + 2 + keys[i].size > maxLen)
+			break;
+
+		value = getField(pCfg, &keys[i]);
+		pDst[pos++] = keys[i].key;
+		pDst[pos++] = keys[i].size;
+		pDst[pos++] = LO_UINT16(value);
+		if (keys[i].size == 2)
+			pDst[pos++] = HI_UINT16(value);
+	}
+
+	return pos;
+}
+
+/**
+ * Handles a write to the EMG Config characteristic, either layout. Runs in the BLE
+ * application task. An accepted write is staged for workoutConfig_apply.
+ *
+ * @param 	pBuf		Write
+ * @param	len			Write length
+ * @param	pStaged		Returns the staged configuration
+ * @return 	WORKOUT_CFG_CMD_*, WORKOUT_CFG_CMD_NONE if rejected.
+ */
+uint8_t workoutConfig_write(const uint8_t *pBuf, uint16_t len, Workout_config *pStaged)
+{
+	Workout_config cfg;
+	uint8_t cmd, errPos = 0, result;
+	UInt key;
+
+	//Start from what will be active once the last accepted write is applied
+	key = Hwi_disable();
+	cfg = stagedValid ? staged : myWorkoutConfig;
+	Hwi_restore(key);
+
+	if (len > 0 && pBuf[0] == WORKOUT_CFG_MAGIC) {
+		result = workoutConfig_parse(pBuf, len, &cfg, &cmd, &errPos);
+	}
+	else {
+		cmd = parseLegacy(pBuf, len, &cfg);
+		result = WORKOUT_CFG_OK;
+	}
+
+	lastResult = result;
+	lastErrPos = errPos;
+	*pStaged = cfg;
+	if (result != WORKOUT_CFG_OK) {
+		Log_warning2("Config rejected: error %d at %d", (IArg)result, (IArg)errPos);
+		return WORKOUT_CFG_CMD_NONE;
+	}
+
+	key = Hwi_disable();
+	if (cmd != WORKOUT_CFG_CMD_STOP) {
+		staged = cfg;
+		stagedValid = 1;
+	}
+	pendingCmd = cmd;
+	Hwi_restore(key);
+
+	return cmd;
+}
+
+/**
+ * Command of the last accepted write, cleared by the call.
+ *
+ * @param 	none
+ * @return 	WORKOUT_CFG_CMD_*
+ */
+uint8_t workoutConfig_takeCommand(void)
+{
+	UInt key = Hwi_disable();
+	uint8_t cmd = pendingCmd;
+
+	pendingCmd = WORKOUT_CFG_CMD_NONE;
+	Hwi_restore(key);
+
+	return cmd;
+}
+
+/**
+ * Makes the staged configuration active, all fields at once. Call only where nothing
+ * is halfway through using myWorkoutConfig: the EMG task between slices, or the EMG
+ * config Swi while the EMG task is idle.
+ *
+ * @param 	pOld		Returns the configuration that was active
+ * @return 	1 if a staged configuration was applied
+ */
+uint8_t workoutConfig_apply(Workout_config *pOld)
+{
+	UInt key = Hwi_disable();
+
+	if (!stagedValid) {
+		Hwi_restore(key);
+		return 0;
+	}
+
+	*pOld = myWorkoutConfig;
+	myWorkoutConfig = staged;
+	stagedValid = 0;
+	Hwi_restore(key);
+
+	return 1;
+}
+
+/**
+ * Copies part of the Active Config characteristic value. Runs in the BLE stack task.
+ *
+ * @param 	offset		First byte
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+uint16_t workoutConfig_read(uint16_t offset, uint8_t *pDst, uint16_t maxLen)
+{
+	uint8_t value[WORKOUT_CFG_READ_MAX_LEN];
+	Workout_config cfg;
+	uint16_t total;
+	UInt key;
+
+	key = Hwi_disable();
+	cfg = myWorkoutConfig;
+	value[3] = stagedValid;
+	Hwi_restore(key);
+
+	value[0] = WORKOUT_CFG_MAGIC;
+	value[1] = lastResult;
+	value[2] = lastErrPos;
+	total = WORKOUT_CFG_READ_HEADER_LEN +
+			workoutConfig_encode(&cfg, &value[WORKOUT_CFG_READ_HEADER_LEN],
+								 WORKOUT_CFG_READ_MAX_LEN - WORKOUT_CFG_READ_HEADER_LEN);
+
+	if (offset >= total)
+		return 0;
+
+	maxLen = MIN(maxLen, total - offset);
+	memcpy(pDst, &value[offset], maxLen);
+	return maxLen;
+}
+
+//**********************************************************************************
+// Local Functions
+//**********************************************************************************
+/**
+ * Looks up a key.
+ *
+ * @param 	key			WORKOUT_CFG_KEY_*
+ * @return 	Key description, NULL if unknown.
+ */
+static const WorkoutConfig_key *findKey(uint8_t key)
+{
+	uint8_t i;
+
+	for (i = 0; i < WORKOUT_CFG_NUM_KEYS; i++) {
+		if (keys[i].key == key)
+			return &keys[i];
+	}
+	return NULL;
+}
+
+/**
+ * Reads the field of a key.
+ *
+ * @param 	pCfg		Configuration
+ * @param	pKey		Key description
+ * @return 	Field value
+ */
+static uint16_t getField(const Workout_config *pCfg, const WorkoutConfig_key *pKey)
+{
+	const uint8_t *pField = (const uint8_t *)pCfg + pKey->offset;
+
+	return (pKey->size == 1) ? *pField : *(const uint16_t *)pField;
+}
+
+/**
+ * Writes the field of a key.
+ *
+ * @param 	pCfg		Configuration
+ * @param	pKey		Key description
+ * @param	value		Validated value
+ * @return 	none
+ */
+static void setField(Workout_config *pCfg, const WorkoutConfig_key *pKey, uint16_t value)
+{
+	uint8_t *pField = (uint8_t *)pCfg + pKey->offset;
+
+	if (pKey->size == 1)
+		*pField = (uint8_t)value;
+	else
+		*(uint16_t *)pField = value;
+}
+
+/**
+ * Parses the old fixed layout. Bytes past the end of the write count as 0.
+ *
+ * @param 	pBuf		Write
+ * @param	len			Write length
+ * @param	pCfg		In: values to start from. Out: parsed values.
+ * @return 	WORKOUT_CFG_CMD_START or WORKOUT_CFG_CMD_STOP
+ */
+static uint8_t parseLegacy(const uint8_t *pBuf, uint16_t len, Workout_config *pCfg)
+{
+	uint8_t b[WORKOUT_CFG_LEGACY_LEN] = {0};
+
+	memcpy(b, pBuf, MIN(len, WORKOUT_CFG_LEGACY_LEN));
+
+	if (b[0] == WORKOUT_CFG_LEGACY_STOP && b[4] == WORKOUT_CFG_LEGACY_STOP)
+		return WORKOUT_CFG_CMD_STOP;
+
+	pCfg->targetSetCount = b[0] ? b[0] : WORKOUT_CFG_DEFAULT_SETS;
+	pCfg->targetRepCount = (b[1] && b[1] < EMG_MAX_REPS) ? b[1] : EMG_MAX_REPS;
+	pCfg->maxRestSeconds = b[2] * WORKOUT_CFG_LEGACY_REST_UNIT;
+	//As 0 or 1, so the Active Config read-back stays a valid v2 write. The EMG task
+	//only ever took 1 as haptic on.
+	pCfg->hapticFeedback = (1 == b[3]);
+	pCfg->imuFeedback = (0 != b[4]);
+	pCfg->rawStream = (0 != b[5]);
+	pCfg->broadcastPeriod = b[6];
+
+	return WORKOUT_CFG_CMD_START;
+}
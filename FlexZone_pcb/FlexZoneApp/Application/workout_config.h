@@ -0,0 +1,188 @@
+/*
+* Application Name:		FlexZone (Application)
+* File Name: 			workout_config.h
+* Group: 				GroupX - FlexZone
+* Description:			Defines and prototypes for the workout and acquisition configuration.
+ */
+#ifndef WORKOUT_CONFIG_H
+#define WORKOUT_CONFIG_H
+
+//**********************************************************************************
+// Header Files
+//**********************************************************************************
+#include "FlexZoneGlobals.h"
+
+//**********************************************************************************
+// Required Definitions
+//**********************************************************************************
+#define WORKOUT_CFG_MAGIC					0xC2	//0xC0 | protocol version
+#define WORKOUT_CFG_HEADER_LEN				2
+#define WORKOUT_CFG_READ_HEADER_LEN			4
+#define WORKOUT_CFG_READ_MAX_LEN			64
+
+/*
+ * Config protocol v2, written to the EMG Config characteristic:
+ *
+ * 	[0]		WORKOUT_CFG_MAGIC
+ * 	[1]		command, WORKOUT_CFG_CMD_*
+ * 	then TLVs up to the end of the write, each
+ * 			[key][len][value], value little endian
+ *
+ * Keys not in the write keep their current value. Unknown keys are skipped. A write
+ * with any malformed or out of range TLV changes nothing. Accepted values are applied
+ * together by the EMG task between two slices, or right away while idle.
+ *
+ * 	key		len	field				range
+ * 	0x01	1	targetSetCount		1-255
+ * 	0x02	1	targetRepCount		1-EMG_MAX_REPS
+ * 	0x03	2	maxRestSeconds		any, rest from the last rep of a set to the next set
+ * 	0x04	1	hapticFeedback		0-1
+ * 	0x05	1	imuFeedback			0-1
+ * 	0x06	1	rawStream			0-1
+ * 	0x07	1	broadcast period	in 100 ms, 0 off
+ * 	0x08	1	repCue				0-1, haptic tick on every counted rep
+ * 	0x09	1	concentricTarget	in 100 ms, 0 off, tempo coaching
+ * 	0x0A	1	eccentricTarget		in 100 ms, 0 off, tempo coaching
+ * 	0x10	2	repThresholdHigh	1-4095, above repThresholdLow
+ * 	0x11	2	repThresholdLow		1-4095
+ * 	0x12	2	minRepMs			0-5000, shorter pulses are not reps
+ * 	0x13	1	setTimeoutSec		1-255, rest that ends a set
+ * 	0x14	1	samplePeriodMs		10-100
+ * 	0x15	1	adcAverage			1-16 ADC reads per sample
+ * 	0x16	1	DigiPot 0 wiper		0 leaves it at its power-on value
+ * 	0x17	1	DigiPot 1 wiper		same
+ *
+ * Writes that do not start with WORKOUT_CFG_MAGIC use the old fixed layout: sets,
+ * reps, rest in 30 s, haptic, IMU, raw stream, broadcast period. 0xCF in bytes 0 and
+ * 4 stops the workout.
+ *
+ * After a set the analog front end, the ADC clocks and the IMU power down for the rest
+ * of maxRestSeconds, unless that is under 5 s. Sampling resumes when it runs out, with
+ * a haptic cue, on IMU motion, or on a start or update command.
+ *
+ * Rep and tempo cues need hapticFeedback as well. A rep whose concentric or eccentric
+ * time misses its target by more than WORKOUT_CFG_TEMPO_TOLERANCE percent gets a tempo
+ * cue instead of the tick.
+ *
+ * The EMG Active Config characteristic reads back:
+ * 	[0]		WORKOUT_CFG_MAGIC
+ * 	[1]		result of the last write, WORKOUT_CFG_OK or WORKOUT_CFG_ERR_*
+ * 	[2]		offset of the TLV that failed, 0 if none
+ * 	[3]		1 while an accepted write waits for the EMG task
+ * 	then every key above as a TLV, with the active value
+ */
+#define WORKOUT_CFG_CMD_NONE				0x00	//Write rejected
+#define WORKOUT_CFG_CMD_START				0x01	//Apply and start the workout
+#define WORKOUT_CFG_CMD_STOP				0x02	//Stop the workout, TLVs ignored
+#define WORKOUT_CFG_CMD_UPDATE				0x03	//Apply without starting or stopping
+
+#define WORKOUT_CFG_OK						0x00
+#define WORKOUT_CFG_ERR_COMMAND				0x01	//Unknown command
+#define WORKOUT_CFG_ERR_TRUNCATED			0x02	//TLV runs past the end of the write
+#define WORKOUT_CFG_ERR_LENGTH				0x03	//Wrong value length for the key
+#define WORKOUT_CFG_ERR_RANGE				0x04	//Value out of range
+#define WORKOUT_CFG_ERR_CONFLICT			0x05	//repThresholdLow not below repThresholdHigh
+
+#define WORKOUT_CFG_KEY_SET_COUNT			0x01
+#define WORKOUT_CFG_KEY_REP_COUNT			0x02
+#define WORKOUT_CFG_KEY_MAX_REST			0x03
+#define WORKOUT_CFG_KEY_HAPTIC				0x04
+#define WORKOUT_CFG_KEY_IMU					0x05
+#define WORKOUT_CFG_KEY_RAW_STREAM			0x06
+#define WORKOUT_CFG_KEY_BROADCAST			0x07
+#define WORKOUT_CFG_KEY_REP_CUE				0x08
+#define WORKOUT_CFG_KEY_CONCENTRIC			0x09
+#define WORKOUT_CFG_KEY_ECCENTRIC			0x0A
+#define WORKOUT_CFG_KEY_THRESHOLD_HIGH		0x10
+#define WORKOUT_CFG_KEY_THRESHOLD_LOW		0x11
+#define WORKOUT_CFG_KEY_MIN_REP_MS			0x12
+#define WORKOUT_CFG_KEY_SET_TIMEOUT			0x13
+#define WORKOUT_CFG_KEY_SAMPLE_PERIOD		0x14
+#define WORKOUT_CFG_KEY_ADC_AVERAGE			0x15
+#define WORKOUT_CFG_KEY_GAIN_0				0x16
+#define WORKOUT_CFG_KEY_GAIN_1				0x17
+
+//Defaults, used until the first write
+#define WORKOUT_CFG_DEFAULT_SETS			10
+#define WORKOUT_CFG_DEFAULT_THRESHOLD_HIGH	1600
+#define WORKOUT_CFG_DEFAULT_THRESHOLD_LOW	800
+#define WORKOUT_CFG_DEFAULT_MIN_REP_MS		250
+#define WORKOUT_CFG_DEFAULT_SET_TIMEOUT		15
+#define WORKOUT_CFG_DEFAULT_ADC_AVERAGE		4
+
+#define WORKOUT_CFG_TEMPO_TOLERANCE			25		//Percent of the target
+
+//**********************************************************************************
+// Function Prototypes
+//**********************************************************************************
+/**
+ * Sets the active configuration to the defaults.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void workoutConfig_init(void);
+
+/**
+ * Parses a v2 write into pCfg. Plain C without RTOS calls, so the app can share it.
+ *
+ * @param 	pBuf		Write, starting with WORKOUT_CFG_MAGIC
+ * @param	len			Write length
+ * @param	pCfg		In: values to start from. Out: parsed values, only on success.
+ * @param	pCmd		Returns the command
+ * @param	pErrPos		Returns the offset of the failing TLV
+ * @return 	WORKOUT_CFG_OK or WORKOUT_CFG_ERR_*
+ */
+extern uint8_t workoutConfig_parse(const uint8_t *pBuf, uint16_t len, Workout_config *pCfg,
+								   uint8_t *pCmd, uint8_t *pErrPos);
+
+/**
+ * Encodes every key of pCfg as TLVs.
+ *
+ * @param 	pCfg		Configuration
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes written, whole TLVs only.
+ */
+extern uint16_t workoutConfig_encode(const Workout_config *pCfg, uint8_t *pDst, uint16_t maxLen);
+
+/**
+ * Handles a write to the EMG Config characteristic, either layout. Runs in the BLE
+ * application task. An accepted write is staged for workoutConfig_apply.
+ *
+ * @param 	pBuf		Write
+ * @param	len			Write length
+ * @param	pStaged		Returns the staged configuration
+ * @return 	WORKOUT_CFG_CMD_*, WORKOUT_CFG_CMD_NONE if rejected.
+ */
+extern uint8_t workoutConfig_write(const uint8_t *pBuf, uint16_t len, Workout_config *pStaged);
+
+/**
+ * Command of the last accepted write, cleared by the call.
+ *
+ * @param 	none
+ * @return 	WORKOUT_CFG_CMD_*
+ */
+extern uint8_t workoutConfig_takeCommand(void);
+
+/**
+ * Makes the staged configuration active, all fields at once. Call only where nothing
+ * is halfway through using myWorkoutConfig: the EMG task between slices, or the EMG
+ * config Swi while the EMG task is idle.
+ *
+ * @param 	pOld		Returns the configuration that was active
+ * @return 	1 if a staged configuration was applied
+ */
+extern uint8_t workoutConfig_apply(Workout_config *pOld);
+
+/**
+ * Copies part of the Active Config characteristic value. Runs in the BLE stack task.
+ *
+ * @param 	offset		First byte
+ * @param	pDst		Output
+ * @param	maxLen		Size of pDst
+ * @return 	Bytes copied.
+ */
+extern uint16_t workoutConfig_read(uint16_t offset, uint8_t *pDst, uint16_t maxLen);
+
+#endif /* WORKOUT_CONFIG_H */
@@ -74,6 +74,9 @@
  */
 #define ACCELCONFIG_TASK_STACK_SIZE		256
 #define ACCELCONFIG_TASK_PRIORITY		3
+// Index of the Stream Characteristic Value in the attribute table
+#define ACCEL_STREAM_VAL_IDX              5
+
 /*********************************************************************
  * TYPEDEFS
  */
@@ -400,6 +403,46 @@ bStatus_t AccelService_GetParameter( uint8_t param, uint16_t *len, void *value )
   return ret;
 }
 
+/*
+ * AccelService_AllocStreamNoti - Allocate a stack-owned notification for the Stream
+ *          characteristic, so the caller can build the value in place.
+ *
+ *    len         - length of the value, at most ATT MTU - 3
+ *    pConnHandle - returns the connection that has notifications enabled,
+ *                  also on bleMemAllocError so the caller can retry on it
+ *    pNoti       - returns the notification, fill pNoti->pValue then send it
+ *                  with GATT_Notification(), or GATT_bm_free() it
+ *
+ *    Returns bleIncorrectMode if no peer has enabled notifications.
+ */
+bStatus_t AccelService_AllocStreamNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti )
+{
+  uint8_t i;
+
+  for ( i = 0; i < linkDBNumConns; i++ )
+  {
+    gattCharCfg_t *pItem = &accel_StreamConfig[i];
+
+    if ( ( pItem->connHandle != INVALID_CONNHANDLE ) &&
+         ( pItem->value & GATT_CLIENT_CFG_NOTIFY ) )
+    {
+      *pConnHandle = pItem->connHandle;
+      pNoti->pValue = (uint8 *)GATT_bm_alloc( pItem->connHandle, ATT_HANDLE_VALUE_NOTI,
+                                              len, NULL );
+      if ( pNoti->pValue == NULL )
+      {
+        return ( bleMemAllocError );
+      }
+
+      pNoti->handle = Accel_ServiceAttrTbl[ACCEL_STREAM_VAL_IDX].handle;
+      pNoti->len = len;
+      return ( SUCCESS );
+    }
+  }
+
+  return ( bleIncorrectMode );
+}
+
 /*********************************************************************
  * @internal
  * @fn          Accel_Service_findCharParamId
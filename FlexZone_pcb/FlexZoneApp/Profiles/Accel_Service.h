@@ -54,6 +54,7 @@ extern "C"
  * INCLUDES
  */
 #include <bcomdef.h>
+#include "att.h"
 #include "FlexZoneGlobals.h"
 #include <ti/sysbios/knl/Swi.h>
 
@@ -75,7 +76,7 @@ extern "C"
 #define ACCEL_STREAM_ID                 1
 #define ACCEL_STREAM_UUID               0x1132
 #define ACCEL_STREAM_UUID_BASE128(uuid) 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x00, 0x40, 0x51, 0x04, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
-#define ACCEL_STREAM_LEN                40
+#define ACCEL_STREAM_LEN                USER_MAX_NOTIFY_LEN
 #define ACCEL_STREAM_LEN_MIN            0
 /*********************************************************************
  * TYPEDEFS
@@ -152,6 +153,17 @@ extern bStatus_t AccelService_SetParameter( uint8_t param, uint16_t len, void *v
  */
 extern bStatus_t AccelService_GetParameter( uint8_t param, uint16_t *len, void *value );
 
+/*
+ * AccelService_AllocStreamNoti - Allocate a stack-owned notification for the Stream
+ *          characteristic, so the caller can build the value in place.
+ *
+ *    len         - length of the value, at most ATT MTU - 3
+ *    pConnHandle - returns the connection that has notifications enabled
+ *    pNoti       - returns the notification, fill pNoti->pValue then send it
+ *                  with GATT_Notification(), or GATT_bm_free() it
+ */
+extern bStatus_t AccelService_AllocStreamNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti );
+
 
 extern Swi_Struct accelConfigSwi;
 
@@ -0,0 +1,501 @@
+/******************************************************************************
+ * Filename:       Diag_Service.c
+ *
+ * Description:    This file contains the implementation of the service.
+ *
+
+ * Copyright (c) 2015, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ **********************************************************************************/
+
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <Diag_Service.h>
+#include <string.h>
+
+//#define xdc_runtime_Log_DISABLE_ALL 1  // Add to disable logs from this file
+#include <xdc/runtime/Log.h>
+#include <xdc/runtime/Diags.h>
+
+#include "bcomdef.h"
+#include "OSAL.h"
+#include "linkdb.h"
+#include "att.h"
+#include "gatt.h"
+#include "gatt_uuid.h"
+#include "gattservapp.h"
+#include "gapbondmgr.h"
+
+#include "diag.h"
+
+
+/*********************************************************************
+ * MACROS
+ */
+
+/*********************************************************************
+ * CONSTANTS
+ */
+// Index of the Counters Characteristic Value in the attribute table
+#define DIAG_COUNTERS_VAL_IDX             2
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*********************************************************************
+* GLOBAL VARIABLES
+*/
+
+// Diag_Service Service UUID
+CONST uint8_t DiagServiceUUID[ATT_UUID_SIZE] =
+{
+  DIAG_SERVICE_SERV_UUID_BASE128(DIAG_SERVICE_SERV_UUID)
+};
+
+// Counters UUID
+CONST uint8_t diag_CountersUUID[ATT_UUID_SIZE] =
+{
+  DIAG_COUNTERS_UUID_BASE128(DIAG_COUNTERS_UUID)
+};
+
+// Control UUID
+CONST uint8_t diag_ControlUUID[ATT_UUID_SIZE] =
+{
+  DIAG_CONTROL_UUID_BASE128(DIAG_CONTROL_UUID)
+};
+
+// Memory UUID
+CONST uint8_t diag_MemoryUUID[ATT_UUID_SIZE] =
+{
+  DIAG_MEMORY_UUID_BASE128(DIAG_MEMORY_UUID)
+};
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+static DiagServiceCBs_t *pAppCBs = NULL;
+static uint8_t diag_icall_rsp_task_id = INVALID_TASK_ID;
+
+/*********************************************************************
+* Profile Attributes - variables
+*/
+
+// Service declaration
+static CONST gattAttrType_t DiagServiceDecl = { ATT_UUID_SIZE, DiagServiceUUID };
+
+// Characteristic "Counters" Properties (for declaration)
+static uint8_t diag_CountersProps = GATT_PROP_READ | GATT_PROP_NOTIFY;
+
+// Characteristic "Counters" Value variable. Unused, reads are built by diag_read().
+static uint8_t diag_CountersVal[1] = {0};
+
+// Characteristic "Counters" Client Characteristic Configuration Descriptor
+static gattCharCfg_t *diag_CountersConfig;
+
+// Characteristic "Control" Properties (for declaration)
+static uint8_t diag_ControlProps = GATT_PROP_WRITE;
+
+// Characteristic "Control" Value variable
+static uint8_t diag_ControlVal[DIAG_CONTROL_LEN] = {0};
+
+// Characteristic "Memory" Properties (for declaration)
+static uint8_t diag_MemoryProps = GATT_PROP_READ;
+
+// Characteristic "Memory" Value variable. Unused, reads are built by diag_readMemory().
+static uint8_t diag_MemoryVal[1] = {0};
+
+static char diag_UserCountersString[] = "Diagnostics Counters";
+static char diag_UserControlString[] = "Diagnostics Control";
+static char diag_UserMemoryString[] = "Diagnostics Memory";
+
+/*********************************************************************
+* Profile Attributes - Table
+*/
+
+static gattAttribute_t Diag_ServiceAttrTbl[] =
+{
+  // Diag_Service Service Declaration
+  {
+    { ATT_BT_UUID_SIZE, primaryServiceUUID },
+    GATT_PERMIT_READ,
+    0,
+    (uint8_t *)&DiagServiceDecl
+  },
+    // Counters Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &diag_CountersProps
+    },
+      // Counters Characteristic Value
+      {
+        { ATT_UUID_SIZE, diag_CountersUUID },
+        GATT_PERMIT_READ,
+        0,
+        diag_CountersVal
+      },
+      // Counters CCCD
+      {
+        { ATT_BT_UUID_SIZE, clientCharCfgUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        (uint8_t *)&diag_CountersConfig
+      },
+
+	  // Counters CUDs
+		{
+		  { ATT_BT_UUID_SIZE, charUserDescUUID },
+		  GATT_PERMIT_READ,
+		  0,
+		  (uint8_t *)&diag_UserCountersString
+		},
+
+    // Control Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &diag_ControlProps
+    },
+      // Control Characteristic Value
+      {
+        { ATT_UUID_SIZE, diag_ControlUUID },
+        GATT_PERMIT_WRITE,
+        0,
+        diag_ControlVal
+      },
+
+	  // Control CUDs
+		{
+		  { ATT_BT_UUID_SIZE, charUserDescUUID },
+		  GATT_PERMIT_READ,
+		  0,
+		  (uint8_t *)&diag_UserControlString
+		},
+
+    // Memory Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &diag_MemoryProps
+    },
+      // Memory Characteristic Value
+      {
+        { ATT_UUID_SIZE, diag_MemoryUUID },
+        GATT_PERMIT_READ,
+        0,
+        diag_MemoryVal
+      },
+
+	  // Memory CUDs
+		{
+		  { ATT_BT_UUID_SIZE, charUserDescUUID },
+		  GATT_PERMIT_READ,
+		  0,
+		  (uint8_t *)&diag_UserMemoryString
+		},
+};
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+static bStatus_t Diag_Service_ReadAttrCB( uint16_t connHandle, gattAttribute_t *pAttr,
+                                          uint8_t *pValue, uint16_t *pLen, uint16_t offset,
+                                          uint16_t maxLen, uint8_t method );
+static bStatus_t Diag_Service_WriteAttrCB( uint16_t connHandle, gattAttribute_t *pAttr,
+                                           uint8_t *pValue, uint16_t len, uint16_t offset,
+                                           uint8_t method );
+
+/*********************************************************************
+ * PROFILE CALLBACKS
+ */
+// Diag Service Callbacks
+CONST gattServiceCBs_t Diag_ServiceCBs =
+{
+  Diag_Service_ReadAttrCB,  // Read callback function pointer
+  Diag_Service_WriteAttrCB, // Write callback function pointer
+  NULL                      // Authorization callback function pointer
+};
+
+/*********************************************************************
+* PUBLIC FUNCTIONS
+*/
+
+/*
+ * DiagService_AddService- Initializes the Diag_Service service by registering
+ *          GATT attributes with the GATT server.
+ *
+ *    rspTaskId - The ICall Task Id that should receive responses for Indications.
+ */
+extern bStatus_t DiagService_AddService( uint8_t rspTaskId )
+{
+  uint8_t status;
+
+  // Allocate Client Characteristic Configuration table
+  diag_CountersConfig = (gattCharCfg_t *)ICall_malloc( sizeof(gattCharCfg_t) * linkDBNumConns );
+  if ( diag_CountersConfig == NULL )
+  {
+    return ( bleMemAllocError );
+  }
+
+  // Initialize Client Characteristic Configuration attributes
+  GATTServApp_InitCharCfg( INVALID_CONNHANDLE, diag_CountersConfig );
+  // Register GATT attribute list and CBs with GATT Server App
+  status = GATTServApp_RegisterService( Diag_ServiceAttrTbl,
+                                        GATT_NUM_ATTRS( Diag_ServiceAttrTbl ),
+                                        GATT_MAX_ENCRYPT_KEY_SIZE,
+                                        &Diag_ServiceCBs );
+  Log_info1("Registered service, %d attributes", (IArg)GATT_NUM_ATTRS( Diag_ServiceAttrTbl ));
+  diag_icall_rsp_task_id = rspTaskId;
+
+  return ( status );
+}
+
+/*
+ * DiagService_RegisterAppCBs - Registers the application callback function.
+ *                    Only call this function once.
+ *
+ *    appCallbacks - pointer to application callbacks.
+ */
+bStatus_t DiagService_RegisterAppCBs( DiagServiceCBs_t *appCallbacks )
+{
+  if ( appCallbacks )
+  {
+    pAppCBs = appCallbacks;
+    Log_info1("Registered callbacks to application. Struct %p", (IArg)appCallbacks);
+    return ( SUCCESS );
+  }
+  else
+  {
+    Log_warning0("Null pointer given for app callbacks.");
+    return ( FAILURE );
+  }
+}
+
+/*
+ * DiagService_AllocCountersNoti - Allocate a stack-owned notification for the
+ *          Counters characteristic, so the caller can build the value in place.
+ *
+ *    len         - length of the value, at most ATT MTU - 3
+ *    pConnHandle - returns the connection that has notifications enabled
+ *    pNoti       - returns the notification, fill pNoti->pValue then send it
+ *                  with GATT_Notification(), or GATT_bm_free() it
+ *
+ *    Returns bleIncorrectMode if no peer has enabled notifications.
+ */
+bStatus_t DiagService_AllocCountersNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti )
+{
+  uint8_t i;
+
+  for ( i = 0; i < linkDBNumConns; i++ )
+  {
+    gattCharCfg_t *pItem = &diag_CountersConfig[i];
+
+    if ( ( pItem->connHandle != INVALID_CONNHANDLE ) &&
+         ( pItem->value & GATT_CLIENT_CFG_NOTIFY ) )
+    {
+      *pConnHandle = pItem->connHandle;
+      pNoti->pValue = (uint8 *)GATT_bm_alloc( pItem->connHandle, ATT_HANDLE_VALUE_NOTI,
+                                              len, NULL );
+      if ( pNoti->pValue == NULL )
+      {
+        return ( bleMemAllocError );
+      }
+
+      pNoti->handle = Diag_ServiceAttrTbl[DIAG_COUNTERS_VAL_IDX].handle;
+      pNoti->len = len;
+      return ( SUCCESS );
+    }
+  }
+
+  return ( bleIncorrectMode );
+}
+
+/*********************************************************************
+ * @internal
+ * @fn          Diag_Service_findCharParamId
+ *
+ * @brief       Find the logical param id of an attribute in the service's attr table.
+ *
+ *              Works only for Characteristic Value attributes and
+ *              Client Characteristic Configuration Descriptor attributes.
+ *
+ * @param       pAttr - pointer to attribute
+ *
+ * @return      uint8_t paramID (ref Diag_Service.h) or 0xFF if not found.
+ */
+static uint8_t Diag_Service_findCharParamId(gattAttribute_t *pAttr)
+{
+  // Is this a Client Characteristic Configuration Descriptor?
+  if (ATT_BT_UUID_SIZE == pAttr->type.len && GATT_CLIENT_CHAR_CFG_UUID == *(uint16_t *)pAttr->type.uuid)
+    return Diag_Service_findCharParamId(pAttr - 1); // Assume the value attribute precedes CCCD and recurse
+
+  // Is this attribute in "Counters"?
+  else if ( ATT_UUID_SIZE == pAttr->type.len && !memcmp(pAttr->type.uuid, diag_CountersUUID, pAttr->type.len))
+    return DIAG_COUNTERS_ID;
+
+  // Is this attribute in "Control"?
+  else if ( ATT_UUID_SIZE == pAttr->type.len && !memcmp(pAttr->type.uuid, diag_ControlUUID, pAttr->type.len))
+    return DIAG_CONTROL_ID;
+
+  // Is this attribute in "Memory"?
+  else if ( ATT_UUID_SIZE == pAttr->type.len && !memcmp(pAttr->type.uuid, diag_MemoryUUID, pAttr->type.len))
+    return DIAG_MEMORY_ID;
+
+  else
+    return 0xFF; // Not found. Return invalid.
+}
+
+/*********************************************************************
+ * @fn          Diag_Service_ReadAttrCB
+ *
+ * @brief       Read an attribute.
+ *
+ * @param       connHandle - connection message was received on
+ * @param       pAttr - pointer to attribute
+ * @param       pValue - pointer to data to be read
+ * @param       pLen - length of data to be read
+ * @param       offset - offset of the first octet to be read
+ * @param       maxLen - maximum length of data to be read
+ * @param       method - type of read message
+ *
+ * @return      SUCCESS, blePending or Failure
+ */
+static bStatus_t Diag_Service_ReadAttrCB( uint16_t connHandle, gattAttribute_t *pAttr,
+                                          uint8_t *pValue, uint16_t *pLen, uint16_t offset,
+                                          uint16_t maxLen, uint8_t method )
+{
+  uint8_t paramID = Diag_Service_findCharParamId( pAttr );
+
+  // Only the Counters and Memory values are readable
+  if ( paramID != DIAG_COUNTERS_ID && paramID != DIAG_MEMORY_ID )
+  {
+    Log_error0("Attribute was not found.");
+    return ATT_ERR_ATTR_NOT_FOUND;
+  }
+
+  Log_info4("ReadAttrCB : %s connHandle: %d offset: %d method: 0x%02x",
+             (IArg)(paramID == DIAG_COUNTERS_ID ? "Counters" : "Memory"),
+             (IArg)connHandle,
+             (IArg)offset,
+             (IArg)method);
+
+  // Built on the fly, long reads get the rest of a fresh one
+  if ( offset > ( paramID == DIAG_COUNTERS_ID ? DIAG_SNAPSHOT_LEN : DIAG_MEMORY_LEN ) )
+  {
+    Log_error0("An invalid offset was requested.");
+    return ATT_ERR_INVALID_OFFSET;
+  }
+
+  if ( paramID == DIAG_COUNTERS_ID )
+    *pLen = diag_read( offset, pValue, maxLen );
+  else
+    *pLen = diag_readMemory( offset, pValue, maxLen );
+  return SUCCESS;
+}
+
+/*********************************************************************
+ * @fn      Diag_Service_WriteAttrCB
+ *
+ * @brief   Validate attribute data prior to a write operation
+ *
+ * @param   connHandle - connection message was received on
+ * @param   pAttr - pointer to attribute
+ * @param   pValue - pointer to data to be written
+ * @param   len - length of data
+ * @param   offset - offset of the first octet to be written
+ * @param   method - type of write message
+ *
+ * @return  SUCCESS, blePending or Failure
+ */
+static bStatus_t Diag_Service_WriteAttrCB( uint16_t connHandle, gattAttribute_t *pAttr,
+                                           uint8_t *pValue, uint16_t len, uint16_t offset,
+                                           uint8_t method )
+{
+  // See if request is regarding a Client Characterisic Configuration
+  if (ATT_BT_UUID_SIZE == pAttr->type.len && GATT_CLIENT_CHAR_CFG_UUID == *(uint16_t *)pAttr->type.uuid)
+  {
+    bStatus_t status;
+
+    Log_info3("WriteAttrCB (CCCD): param: %d connHandle: %d %s",
+              (IArg)Diag_Service_findCharParamId(pAttr),
+              (IArg)connHandle,
+              (IArg)(method == GATT_LOCAL_WRITE?"- restoring bonded state":"- OTA write"));
+
+    status = GATTServApp_ProcessCCCWriteReq( connHandle, pAttr, pValue, len,
+                                             offset, GATT_CLIENT_CFG_NOTIFY );
+    if (SUCCESS == status && pAppCBs && pAppCBs->pfnCfgChangeCb)
+       pAppCBs->pfnCfgChangeCb( connHandle, DIAG_SERVICE_SERV_UUID,
+                                Diag_Service_findCharParamId(pAttr), pValue, len );
+
+     return status;
+  }
+
+  if ( Diag_Service_findCharParamId( pAttr ) != DIAG_CONTROL_ID )
+  {
+    Log_error0("Attribute was not found.");
+    return ATT_ERR_ATTR_NOT_FOUND;
+  }
+
+  Log_info5("WriteAttrCB : %s connHandle(%d) len(%d) offset(%d) method(0x%02x)",
+             (IArg)"Control",
+             (IArg)connHandle,
+             (IArg)len,
+             (IArg)offset,
+             (IArg)method);
+
+  // A single op byte, no long or partial writes
+  if ( offset != 0 )
+  {
+    Log_error0("An invalid offset was requested.");
+    return ATT_ERR_INVALID_OFFSET;
+  }
+  if ( len < DIAG_CONTROL_LEN_MIN || len > DIAG_CONTROL_LEN )
+  {
+    Log_error0("Invalid value length was received.");
+    return ATT_ERR_INVALID_VALUE_SIZE;
+  }
+
+  memcpy(pAttr->pValue, pValue, len);
+
+  // Let the application act on the op, from stack task context.
+  if ( pAppCBs && pAppCBs->pfnChangeCb )
+    pAppCBs->pfnChangeCb( connHandle, DIAG_SERVICE_SERV_UUID, DIAG_CONTROL_ID, pValue, len );
+
+  return SUCCESS;
+}
@@ -0,0 +1,150 @@
+/******************************************************************************
+ * Filename:       Diag_Service.h
+ *
+ * Description:    This file contains the Diag_Service service definitions and
+ *                 prototypes.
+ *
+
+ * Copyright (c) 2015, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+
+#ifndef _DIAG_SERVICE_H_
+#define _DIAG_SERVICE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <bcomdef.h>
+#include "att.h"
+#include "FlexZoneGlobals.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+// Service UUID
+#define DIAG_SERVICE_SERV_UUID 0x1150
+#define DIAG_SERVICE_SERV_UUID_BASE128(uuid) 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x00, 0x40, 0x51, 0x04, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
+
+// Counters Characteristic defines
+#define DIAG_COUNTERS_ID                0
+#define DIAG_COUNTERS_UUID              0x1151
+#define DIAG_COUNTERS_UUID_BASE128(uuid) 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x00, 0x40, 0x51, 0x04, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
+
+// Control Characteristic defines
+#define DIAG_CONTROL_ID                 1
+#define DIAG_CONTROL_UUID               0x1152
+#define DIAG_CONTROL_UUID_BASE128(uuid) 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x00, 0x40, 0x51, 0x04, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
+#define DIAG_CONTROL_LEN                1
+#define DIAG_CONTROL_LEN_MIN            1
+
+// Memory Characteristic defines
+#define DIAG_MEMORY_ID                  2
+#define DIAG_MEMORY_UUID                0x1153
+#define DIAG_MEMORY_UUID_BASE128(uuid)  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x00, 0x40, 0x51, 0x04, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Fields in characteristic "Counters"
+//   Snapshot built by diag_read(), layout in diag.h
+
+// Fields in characteristic "Control"
+//   Field "Op" format: uint8, DIAG_OP_* in diag.h
+
+// Fields in characteristic "Memory"
+//   Report built by diag_readMemory(), layout in diag.h
+
+/*********************************************************************
+ * MACROS
+ */
+
+/*********************************************************************
+ * Profile Callbacks
+ */
+
+// Callback when a characteristic value has changed
+typedef void (*DiagServiceChange_t)( uint16_t connHandle, uint16_t svcUuid, uint8_t paramID, uint8_t *pValue, uint16_t len );
+
+typedef struct
+{
+  DiagServiceChange_t        pfnChangeCb;     // Called when characteristic value changes
+  DiagServiceChange_t        pfnCfgChangeCb;  // Called when characteristic CCCD changes
+} DiagServiceCBs_t;
+
+
+
+/*********************************************************************
+ * API FUNCTIONS
+ */
+
+
+/*
+ * DiagService_AddService- Initializes the Diag_Service service by registering
+ *          GATT attributes with the GATT server.
+ *
+ *    rspTaskId - The ICall Task Id that should receive responses for Indications.
+ */
+extern bStatus_t DiagService_AddService( uint8_t rspTaskId );
+
+/*
+ * DiagService_RegisterAppCBs - Registers the application callback function.
+ *                    Only call this function once.
+ *
+ *    appCallbacks - pointer to application callbacks.
+ */
+extern bStatus_t DiagService_RegisterAppCBs( DiagServiceCBs_t *appCallbacks );
+
+/*
+ * DiagService_AllocCountersNoti - Allocate a stack-owned notification for the
+ *          Counters characteristic, so the caller can build the value in place.
+ *
+ *    len         - length of the value, at most ATT MTU - 3
+ *    pConnHandle - returns the connection that has notifications enabled
+ *    pNoti       - returns the notification, fill pNoti->pValue then send it
+ *                  with GATT_Notification(), or GATT_bm_free() it
+ */
+extern bStatus_t DiagService_AllocCountersNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti );
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DIAG_SERVICE_H_ */
@@ -52,8 +52,6 @@
 #include <xdc/runtime/Log.h>
 #include <xdc/runtime/Diags.h>
 #include <ti/sysbios/BIOS.h>
-#include <ti/sysbios/knl/Semaphore.h>
-#include <ti/sysbios/knl/Task.h>
 
 #include "bcomdef.h"
 #include "OSAL.h"
@@ -64,6 +62,15 @@
 #include "gattservapp.h"
 #include "gapbondmgr.h"
 
+#include "conn_policy.h"
+#include "emg_stream.h"
+#include "event_bus.h"
+#include "set_history.h"
+#include "session_log.h"
+#include "time_sync.h"
+#include "workout_config.h"
+#include "emg.h"
+
 
 /*********************************************************************
  * MACROS
@@ -72,8 +79,15 @@
 /*********************************************************************
  * CONSTANTS
  */
-#define EMGCONFIG_TASK_STACK_SIZE		256
-#define EMGCONFIG_TASK_PRIORITY			3
+// Index of the Stream Characteristic Value in the attribute table
+#define EMG_STREAM_VAL_IDX              5
+// Index of the Summary Characteristic Value in the attribute table
+#define EMG_SUMMARY_VAL_IDX             9
+// Index of the Session Log Characteristic Value in the attribute table
+#define EMG_SESSION_LOG_VAL_IDX         16
+// Index of the Time Sync Characteristic Value in the attribute table
+#define EMG_TIME_SYNC_VAL_IDX           20
+
 /*********************************************************************
  * TYPEDEFS
  */
@@ -100,6 +114,30 @@ CONST uint8_t emg_StreamUUID[ATT_UUID_SIZE] =
   EMG_STREAM_UUID_BASE128(EMG_STREAM_UUID)
 };
 
+// Summary UUID
+CONST uint8_t emg_SummaryUUID[ATT_UUID_SIZE] =
+{
+  EMG_SUMMARY_UUID_BASE128(EMG_SUMMARY_UUID)
+};
+
+// Active Config UUID
+CONST uint8_t emg_ActiveConfigUUID[ATT_UUID_SIZE] =
+{
+  EMG_ACTIVE_CONFIG_UUID_BASE128(EMG_ACTIVE_CONFIG_UUID)
+};
+
+// Session Log UUID
+CONST uint8_t emg_SessionLogUUID[ATT_UUID_SIZE] =
+{
+  EMG_SESSION_LOG_UUID_BASE128(EMG_SESSION_LOG_UUID)
+};
+
+// Time Sync UUID
+CONST uint8_t emg_TimeSyncUUID[ATT_UUID_SIZE] =
+{
+  EMG_TIME_SYNC_UUID_BASE128(EMG_TIME_SYNC_UUID)
+};
+
 
 /*********************************************************************
  * LOCAL VARIABLES
@@ -108,8 +146,6 @@ CONST uint8_t emg_StreamUUID[ATT_UUID_SIZE] =
 static EMGServiceCBs_t *pAppCBs = NULL;
 static uint8_t emg_icall_rsp_task_id = INVALID_TASK_ID;
 
-Semaphore_Struct emgConfig_Semaphore;
-Task_Struct emgConfigTask;
 Swi_Struct emgConfigSwi;
 uint8_t emgConfig_data[EMG_CONFIG_LEN];
 /*********************************************************************
@@ -141,10 +177,46 @@ static uint16_t emg_StreamValLen = EMG_STREAM_LEN_MIN;
 // Characteristic "Stream" Client Characteristic Configuration Descriptor
 static gattCharCfg_t *emg_StreamConfig;
 
+// Characteristic "Summary" Properties (for declaration)
+static uint8_t emg_SummaryProps = GATT_PROP_READ | GATT_PROP_NOTIFY;
+
+// Characteristic "Summary" Client Characteristic Configuration Descriptor
+static gattCharCfg_t *emg_SummaryConfig;
+
+// Characteristic "Active Config" Properties (for declaration)
+static uint8_t emg_ActiveConfigProps = GATT_PROP_READ;
+
+// Characteristic "Session Log" Properties (for declaration)
+static uint8_t emg_SessionLogProps = GATT_PROP_READ | GATT_PROP_WRITE | GATT_PROP_WRITE_NO_RSP | GATT_PROP_NOTIFY;
+
+// Characteristic "Session Log" control write, reads come from session_log
+static uint8_t emg_SessionLogVal[EMG_SESSION_LOG_LEN] = {0};
+
+// Length of the last control write
+static uint16_t emg_SessionLogValLen = EMG_SESSION_LOG_LEN_MIN;
+
+// Characteristic "Session Log" Client Characteristic Configuration Descriptor
+static gattCharCfg_t *emg_SessionLogConfig;
+
+// Characteristic "Time Sync" Properties (for declaration)
+static uint8_t emg_TimeSyncProps = GATT_PROP_READ | GATT_PROP_WRITE | GATT_PROP_WRITE_NO_RSP | GATT_PROP_NOTIFY;
+
+// Characteristic "Time Sync" last write, reads come from time_sync
+static uint8_t emg_TimeSyncVal[EMG_TIME_SYNC_LEN] = {0};
+
+// Length of the last write
+static uint16_t emg_TimeSyncValLen = EMG_TIME_SYNC_LEN_MIN;
+
+// Characteristic "Time Sync" Client Characteristic Configuration Descriptor
+static gattCharCfg_t *emg_TimeSyncConfig;
+
 static char emg_UserStreamString[] = "EMG Data";
+static char emg_UserSummaryString[] = "Set Summaries";
+static char emg_UserActiveConfigString[] = "Active Config";
+static char emg_UserSessionLogString[] = "Session Log";
+static char emg_UserTimeSyncString[] = "Time Sync";
 static char emg_UserConfigString[] = "EMG Config";
 
-Char emgConfigTaskStack[EMGCONFIG_TASK_STACK_SIZE];
 /*********************************************************************
 * Profile Attributes - Table
 */
@@ -209,6 +281,119 @@ static gattAttribute_t EMG_ServiceAttrTbl[] =
 		  0,
 		  (uint8_t *)&emg_UserStreamString
 		},
+
+    // Summary Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &emg_SummaryProps
+    },
+      // Summary Characteristic Value, read through set_history
+      {
+        { ATT_UUID_SIZE, emg_SummaryUUID },
+        GATT_PERMIT_READ,
+        0,
+        NULL
+      },
+      // Summary CCCD
+      {
+        { ATT_BT_UUID_SIZE, clientCharCfgUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        (uint8_t *)&emg_SummaryConfig
+      },
+
+	  // Summary CUD
+		{
+		  { ATT_BT_UUID_SIZE, charUserDescUUID },
+		  GATT_PERMIT_READ,
+		  0,
+		  (uint8_t *)&emg_UserSummaryString
+		},
+
+    // Active Config Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &emg_ActiveConfigProps
+    },
+      // Active Config Characteristic Value, read through workout_config
+      {
+        { ATT_UUID_SIZE, emg_ActiveConfigUUID },
+        GATT_PERMIT_READ,
+        0,
+        NULL
+      },
+
+	  // Active Config CUD
+		{
+		  { ATT_BT_UUID_SIZE, charUserDescUUID },
+		  GATT_PERMIT_READ,
+		  0,
+		  (uint8_t *)&emg_UserActiveConfigString
+		},
+
+    // Session Log Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &emg_SessionLogProps
+    },
+      // Session Log Characteristic Value, read through session_log
+      {
+        { ATT_UUID_SIZE, emg_SessionLogUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        emg_SessionLogVal
+      },
+      // Session Log CCCD
+      {
+        { ATT_BT_UUID_SIZE, clientCharCfgUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        (uint8_t *)&emg_SessionLogConfig
+      },
+
+	  // Session Log CUD
+		{
+		  { ATT_BT_UUID_SIZE, charUserDescUUID },
+		  GATT_PERMIT_READ,
+		  0,
+		  (uint8_t *)&emg_UserSessionLogString
+		},
+
+    // Time Sync Characteristic Declaration
+    {
+      { ATT_BT_UUID_SIZE, characterUUID },
+      GATT_PERMIT_READ,
+      0,
+      &emg_TimeSyncProps
+    },
+      // Time Sync Characteristic Value, read through time_sync
+      {
+        { ATT_UUID_SIZE, emg_TimeSyncUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        emg_TimeSyncVal
+      },
+      // Time Sync CCCD
+      {
+        { ATT_BT_UUID_SIZE, clientCharCfgUUID },
+        GATT_PERMIT_READ | GATT_PERMIT_WRITE,
+        0,
+        (uint8_t *)&emg_TimeSyncConfig
+      },
+
+	  // Time Sync CUD
+		{
+		  { ATT_BT_UUID_SIZE, charUserDescUUID },
+		  GATT_PERMIT_READ,
+		  0,
+		  (uint8_t *)&emg_UserTimeSyncString
+		},
 };
 
 /*********************************************************************
@@ -220,6 +405,8 @@ static bStatus_t EMG_Service_ReadAttrCB( uint16_t connHandle, gattAttribute_t *p
 static bStatus_t EMG_Service_WriteAttrCB( uint16_t connHandle, gattAttribute_t *pAttr,
                                             uint8_t *pValue, uint16_t len, uint16_t offset,
                                             uint8_t method );
+static bStatus_t EMG_Service_allocNoti( gattCharCfg_t *pCharCfg, uint8_t valIdx, uint16_t len,
+                                        uint16_t *pConnHandle, attHandleValueNoti_t *pNoti );
 
 /*********************************************************************
  * PROFILE CALLBACKS
@@ -253,8 +440,35 @@ extern bStatus_t EMGService_AddService( uint8_t rspTaskId )
     return ( bleMemAllocError );
   }
 
+  emg_SummaryConfig = (gattCharCfg_t *)ICall_malloc( sizeof(gattCharCfg_t) * linkDBNumConns );
+  if ( emg_SummaryConfig == NULL )
+  {
+    ICall_free( emg_StreamConfig );
+    return ( bleMemAllocError );
+  }
+
+  emg_SessionLogConfig = (gattCharCfg_t *)ICall_malloc( sizeof(gattCharCfg_t) * linkDBNumConns );
+  if ( emg_SessionLogConfig == NULL )
+  {
+    ICall_free( emg_SummaryConfig );
+    ICall_free( emg_StreamConfig );
+    return ( bleMemAllocError );
+  }
+
+  emg_TimeSyncConfig = (gattCharCfg_t *)ICall_malloc( sizeof(gattCharCfg_t) * linkDBNumConns );
+  if ( emg_TimeSyncConfig == NULL )
+  {
+    ICall_free( emg_SessionLogConfig );
+    ICall_free( emg_SummaryConfig );
+    ICall_free( emg_StreamConfig );
+    return ( bleMemAllocError );
+  }
+
   // Initialize Client Characteristic Configuration attributes
   GATTServApp_InitCharCfg( INVALID_CONNHANDLE, emg_StreamConfig );
+  GATTServApp_InitCharCfg( INVALID_CONNHANDLE, emg_SummaryConfig );
+  GATTServApp_InitCharCfg( INVALID_CONNHANDLE, emg_SessionLogConfig );
+  GATTServApp_InitCharCfg( INVALID_CONNHANDLE, emg_TimeSyncConfig );
   // Register GATT attribute list and CBs with GATT Server App
   status = GATTServApp_RegisterService( EMG_ServiceAttrTbl,
                                         GATT_NUM_ATTRS( EMG_ServiceAttrTbl ),
@@ -399,6 +613,94 @@ bStatus_t EMGService_GetParameter( uint8_t param, uint16_t *len, void *value )
   return ret;
 }
 
+/*
+ * EMGService_AllocStreamNoti - Allocate a stack-owned notification for the Stream
+ *          characteristic, so the caller can build the value in place.
+ *
+ *    len         - length of the value, at most ATT MTU - 3
+ *    pConnHandle - returns the connection that has notifications enabled,
+ *                  also on bleMemAllocError so the caller can retry on it
+ *    pNoti       - returns the notification, fill pNoti->pValue then send it
+ *                  with GATT_Notification(), or GATT_bm_free() it
+ *
+ *    Returns bleIncorrectMode if no peer has enabled notifications.
+ */
+bStatus_t EMGService_AllocStreamNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti )
+{
+  return EMG_Service_allocNoti( emg_StreamConfig, EMG_STREAM_VAL_IDX, len, pConnHandle, pNoti );
+}
+
+/*
+ * EMGService_AllocSummaryNoti - Same as EMGService_AllocStreamNoti, for the
+ *          "summary available" notification of the Summary characteristic.
+ */
+bStatus_t EMGService_AllocSummaryNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti )
+{
+  return EMG_Service_allocNoti( emg_SummaryConfig, EMG_SUMMARY_VAL_IDX, len, pConnHandle, pNoti );
+}
+
+/*
+ * EMGService_AllocSessionLogNoti - Same as EMGService_AllocStreamNoti, for the
+ *          bulk sync notifications of the Session Log characteristic.
+ */
+bStatus_t EMGService_AllocSessionLogNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti )
+{
+  return EMG_Service_allocNoti( emg_SessionLogConfig, EMG_SESSION_LOG_VAL_IDX, len, pConnHandle, pNoti );
+}
+
+/*
+ * EMGService_AllocTimeSyncNoti - Same as EMGService_AllocStreamNoti, for the
+ *          pings of the Time Sync characteristic.
+ */
+bStatus_t EMGService_AllocTimeSyncNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti )
+{
+  return EMG_Service_allocNoti( emg_TimeSyncConfig, EMG_TIME_SYNC_VAL_IDX, len, pConnHandle, pNoti );
+}
+
+/*********************************************************************
+ * @internal
+ * @fn          EMG_Service_allocNoti
+ *
+ * @brief       Allocate a notification for the first connection that has
+ *              notifications enabled in a CCCD table.
+ *
+ * @param       pCharCfg - CCCD table of the characteristic
+ * @param       valIdx - index of the value attribute in the attr table
+ * @param       len - length of the value
+ * @param       pConnHandle - returns the connection
+ * @param       pNoti - returns the notification
+ *
+ * @return      SUCCESS, bleMemAllocError or bleIncorrectMode
+ */
+static bStatus_t EMG_Service_allocNoti( gattCharCfg_t *pCharCfg, uint8_t valIdx, uint16_t len,
+                                        uint16_t *pConnHandle, attHandleValueNoti_t *pNoti )
+{
+  uint8_t i;
+
+  for ( i = 0; i < linkDBNumConns; i++ )
+  {
+    gattCharCfg_t *pItem = &pCharCfg[i];
+
+    if ( ( pItem->connHandle != INVALID_CONNHANDLE ) &&
+         ( pItem->value & GATT_CLIENT_CFG_NOTIFY ) )
+    {
+      *pConnHandle = pItem->connHandle;
+      pNoti->pValue = (uint8 *)GATT_bm_alloc( pItem->connHandle, ATT_HANDLE_VALUE_NOTI,
+                                              len, NULL );
+      if ( pNoti->pValue == NULL )
+      {
+        return ( bleMemAllocError );
+      }
+
+      pNoti->handle = EMG_ServiceAttrTbl[valIdx].handle;
+      pNoti->len = len;
+      return ( SUCCESS );
+    }
+  }
+
+  return ( bleIncorrectMode );
+}
+
 /*********************************************************************
  * @internal
  * @fn          EMG_Service_findCharParamId
@@ -426,6 +728,22 @@ static uint8_t EMG_Service_findCharParamId(gattAttribute_t *pAttr)
   else if ( ATT_UUID_SIZE == pAttr->type.len && !memcmp(pAttr->type.uuid, emg_StreamUUID, pAttr->type.len))
     return EMG_STREAM_ID;
 
+  // Is this attribute in "Summary"?
+  else if ( ATT_UUID_SIZE == pAttr->type.len && !memcmp(pAttr->type.uuid, emg_SummaryUUID, pAttr->type.len))
+    return EMG_SUMMARY_ID;
+
+  // Is this attribute in "Active Config"?
+  else if ( ATT_UUID_SIZE == pAttr->type.len && !memcmp(pAttr->type.uuid, emg_ActiveConfigUUID, pAttr->type.len))
+    return EMG_ACTIVE_CONFIG_ID;
+
+  // Is this attribute in "Session Log"?
+  else if ( ATT_UUID_SIZE == pAttr->type.len && !memcmp(pAttr->type.uuid, emg_SessionLogUUID, pAttr->type.len))
+    return EMG_SESSION_LOG_ID;
+
+  // Is this attribute in "Time Sync"?
+  else if ( ATT_UUID_SIZE == pAttr->type.len && !memcmp(pAttr->type.uuid, emg_TimeSyncUUID, pAttr->type.len))
+    return EMG_TIME_SYNC_ID;
+
   else
     return 0xFF; // Not found. Return invalid.
 }
@@ -479,6 +797,66 @@ static bStatus_t EMG_Service_ReadAttrCB( uint16_t connHandle, gattAttribute_t *p
       /* Other considerations for Stream can be inserted here */
       break;
 
+    case EMG_SUMMARY_ID:
+      Log_info4("ReadAttrCB : %s connHandle: %d offset: %d method: 0x%02x",
+                 (IArg)"Summary",
+                 (IArg)connHandle,
+                 (IArg)offset,
+                 (IArg)method);
+      // Built on the fly, long reads (Read Blob) continue at offset
+      if ( offset > setHistory_length() )
+      {
+        Log_error0("An invalid offset was requested.");
+        return ATT_ERR_INVALID_OFFSET;
+      }
+      *pLen = setHistory_read( offset, pValue, maxLen );
+      return SUCCESS;
+
+    case EMG_ACTIVE_CONFIG_ID:
+      Log_info4("ReadAttrCB : %s connHandle: %d offset: %d method: 0x%02x",
+                 (IArg)"Active Config",
+                 (IArg)connHandle,
+                 (IArg)offset,
+                 (IArg)method);
+      // Built on the fly from the configuration in use
+      if ( offset > WORKOUT_CFG_READ_MAX_LEN )
+      {
+        Log_error0("An invalid offset was requested.");
+        return ATT_ERR_INVALID_OFFSET;
+      }
+      *pLen = workoutConfig_read( offset, pValue, maxLen );
+      return SUCCESS;
+
+    case EMG_SESSION_LOG_ID:
+      Log_info4("ReadAttrCB : %s connHandle: %d offset: %d method: 0x%02x",
+                 (IArg)"Session Log",
+                 (IArg)connHandle,
+                 (IArg)offset,
+                 (IArg)method);
+      // Log status, the records themselves come as notifications
+      if ( offset > SESSION_LOG_STATUS_LEN )
+      {
+        Log_error0("An invalid offset was requested.");
+        return ATT_ERR_INVALID_OFFSET;
+      }
+      *pLen = sessionLog_read( offset, pValue, maxLen );
+      return SUCCESS;
+
+    case EMG_TIME_SYNC_ID:
+      Log_info4("ReadAttrCB : %s connHandle: %d offset: %d method: 0x%02x",
+                 (IArg)"Time Sync",
+                 (IArg)connHandle,
+                 (IArg)offset,
+                 (IArg)method);
+      // Sync status, the pings come as notifications
+      if ( offset > TIME_SYNC_STATUS_LEN )
+      {
+        Log_error0("An invalid offset was requested.");
+        return ATT_ERR_INVALID_OFFSET;
+      }
+      *pLen = timeSync_read( offset, pValue, maxLen );
+      return SUCCESS;
+
     default:
       Log_error0("Attribute was not found.");
       return ATT_ERR_ATTR_NOT_FOUND;
@@ -574,6 +952,36 @@ static bStatus_t EMG_Service_WriteAttrCB( uint16_t connHandle, gattAttribute_t *
       /* Other considerations for Stream can be inserted here */
       break;
 
+    case EMG_SESSION_LOG_ID:
+      writeLenMin  = EMG_SESSION_LOG_LEN_MIN;
+      writeLenMax  = EMG_SESSION_LOG_LEN;
+      pValueLenVar = &emg_SessionLogValLen;
+
+      Log_info5("WriteAttrCB : %s connHandle(%d) len(%d) offset(%d) method(0x%02x)",
+                 (IArg)"Session Log",
+                 (IArg)connHandle,
+                 (IArg)len,
+                 (IArg)offset,
+                 (IArg)method);
+      break;
+
+    case EMG_TIME_SYNC_ID:
+      writeLenMin  = EMG_TIME_SYNC_LEN_MIN;
+      writeLenMax  = EMG_TIME_SYNC_LEN;
+      pValueLenVar = &emg_TimeSyncValLen;
+
+      // Arrival time of a pong, before the write waits in the application queue
+      if ( offset == 0 )
+        timeSync_markRx( pValue, len );
+
+      Log_info5("WriteAttrCB : %s connHandle(%d) len(%d) offset(%d) method(0x%02x)",
+                 (IArg)"Time Sync",
+                 (IArg)connHandle,
+                 (IArg)len,
+                 (IArg)offset,
+                 (IArg)method);
+      break;
+
     default:
       Log_error0("Attribute was not found.");
       return ATT_ERR_ATTR_NOT_FOUND;
@@ -625,54 +1033,24 @@ static bStatus_t EMG_Service_WriteAttrCB( uint16_t connHandle, gattAttribute_t *
   return status;
 }
 
-void saveWorkoutConfig() {
-	if (emgConfig_data[0] == 0x00)
-		myWorkoutConfig.targetSetCount=10;
-	else
-		myWorkoutConfig.targetSetCount=emgConfig_data[0];
-	if (emgConfig_data[1] == 0x00)
-		myWorkoutConfig.targetRepCount=EMG_MAX_REPS;
-	else
-		myWorkoutConfig.targetRepCount=emgConfig_data[1];
-
-	myWorkoutConfig.maxRestSeconds=emgConfig_data[2]*30;
-	myWorkoutConfig.hapticFeedback=emgConfig_data[3];
-	myWorkoutConfig.imuFeedback=emgConfig_data[4];
-}
-
-static void emgConfig_task(UArg a0, UArg a1)
+/*
+ * The EMG task applies the command itself, see emg.c; what can wait runs here, in the
+ * application event loop.
+ */
+static void emgConfig_handler(const Bus_msg *pMsg)
 {
-	while(1){
-		//Wait for Accelerometer Semaphore
-		Semaphore_pend(Semaphore_handle(&emgConfig_Semaphore), BIOS_WAIT_FOREVER);
-		//Do things with accelConfig_data
 #if defined(USE_UART)
-		Log_info5("EMG Config data received: %c-%c-%c-%c-%c",
-				emgConfig_data[0]+'0',emgConfig_data[1]+'0',emgConfig_data[2]+'0',emgConfig_data[3]+'0',emgConfig_data[4]+'0');
+	Log_info5("EMG Config data received: %c-%c-%c-%c-%c",
+			emgConfig_data[0]+'0',emgConfig_data[1]+'0',emgConfig_data[2]+'0',emgConfig_data[3]+'0',emgConfig_data[4]+'0');
 #else
-		System_printf("EMG Config data received: %c-%c-%c-%c-%c\n",
-				emgConfig_data[0],emgConfig_data[1],emgConfig_data[2],emgConfig_data[3],emgConfig_data[4]);
-		System_flush();
+	System_printf("EMG Config data received: %c-%c-%c-%c-%c\n",
+			emgConfig_data[0],emgConfig_data[1],emgConfig_data[2],emgConfig_data[3],emgConfig_data[4]);
+	System_flush();
 #endif //USE_UART
-	}
 }
 
-void emgConfig_createTask(void) {
-	Task_Params taskParams;
-	Semaphore_Params emgConfig_semaphoreParams;
-
-	// Configure & construct semaphore
-	Semaphore_Params_init(&emgConfig_semaphoreParams);
-	Semaphore_construct(&emgConfig_Semaphore, 0, &emgConfig_semaphoreParams);
-
-	// Configure task
-	Task_Params_init(&taskParams);
-	taskParams.stack = emgConfigTaskStack;
-	taskParams.stackSize = EMGCONFIG_TASK_STACK_SIZE;
-	taskParams.priority = EMGCONFIG_TASK_PRIORITY;
-
-	//Dynamically construct task
-	Task_construct(&emgConfigTask, emgConfig_task, &taskParams, NULL);
+void emgConfig_register(void) {
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_WORKOUT_START, emgConfig_handler);
 }
 
 void emgConfig_createSwi(void) {
@@ -686,11 +1064,15 @@ void emgConfig_createSwi(void) {
 }
 
 void emgConfig_SwiFxn(void) {
+	Bus_msg msg;
+	uint8_t cmd = workoutConfig_takeCommand();
+
 	buzz(2);
-	if (emgConfig_data[0] == 0xCF && emgConfig_data[4] == 0xCF)	// stop flag
+	msg.event = BUS_EVT_NONE;
+	if (WORKOUT_CFG_CMD_STOP == cmd)
 	{
-		if (emgRunning)
-			stopEmgRequest = 1;		//sets flag so graceful exit can run on next scheduled run
+		//The EMG task stops at once, even in the middle of a slice
+		msg.event = BUS_EVT_WORKOUT_STOP;
 #if defined(USE_UART)
 		Log_info0("Stopping fam");
 #else
@@ -698,11 +1080,13 @@ void emgConfig_SwiFxn(void) {
 		System_flush();
 #endif //USE_UART
 	}
-	else {						//Post semaphore to emg_taskFxn if not stop request
-		saveWorkoutConfig();
-		setCount = 0;
-		Clock_start(Clock_handle(&emgClock));
-		emgRunning = 1;
-		Semaphore_post(Semaphore_handle(&emgConfig_Semaphore));
+	else if (WORKOUT_CFG_CMD_START == cmd) {
+		msg.event = BUS_EVT_WORKOUT_START;
+	}
+	else if (WORKOUT_CFG_CMD_UPDATE == cmd) {
+		msg.event = BUS_EVT_WORKOUT_UPDATE;
 	}
+
+	if (BUS_EVT_NONE != msg.event)
+		bus_publish(&msg);
 }
@@ -54,6 +54,7 @@ extern "C"
  * INCLUDES
  */
 #include <bcomdef.h>
+#include "att.h"
 #include "FlexZoneGlobals.h"
 #include <ti/sysbios/knl/Swi.h>
 
@@ -75,8 +76,33 @@ extern "C"
 #define EMG_STREAM_ID                 1
 #define EMG_STREAM_UUID               0x1142
 #define EMG_STREAM_UUID_BASE128(uuid) 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x00, 0x40, 0x51, 0x04, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
-#define EMG_STREAM_LEN                40
+#define EMG_STREAM_LEN                USER_MAX_NOTIFY_LEN
 #define EMG_STREAM_LEN_MIN            0
+
+// Summary Characteristic defines, value see set_history.h
+#define EMG_SUMMARY_ID                2
+#define EMG_SUMMARY_UUID              0x1143
+#define EMG_SUMMARY_UUID_BASE128(uuid) 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x00, 0x40, 0x51, 0x04, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
+#define EMG_SUMMARY_NOTI_LEN          1     // "Summary available", the set index
+
+// Active Config Characteristic defines, value see workout_config.h
+#define EMG_ACTIVE_CONFIG_ID          3
+#define EMG_ACTIVE_CONFIG_UUID        0x1144
+#define EMG_ACTIVE_CONFIG_UUID_BASE128(uuid) 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x00, 0x40, 0x51, 0x04, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
+
+// Session Log Characteristic defines, protocol see session_log.h
+#define EMG_SESSION_LOG_ID            4
+#define EMG_SESSION_LOG_UUID          0x1145
+#define EMG_SESSION_LOG_UUID_BASE128(uuid) 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x00, 0x40, 0x51, 0x04, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
+#define EMG_SESSION_LOG_LEN           6     // Largest control write
+#define EMG_SESSION_LOG_LEN_MIN       1
+
+// Time Sync Characteristic defines, protocol see time_sync.h
+#define EMG_TIME_SYNC_ID              5
+#define EMG_TIME_SYNC_UUID            0x1146
+#define EMG_TIME_SYNC_UUID_BASE128(uuid) 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0, 0x00, 0x40, 0x51, 0x04, LO_UINT16(uuid), HI_UINT16(uuid), 0x00, 0xF0
+#define EMG_TIME_SYNC_LEN             10    // Largest write, a pong
+#define EMG_TIME_SYNC_LEN_MIN         2
 /*********************************************************************
  * TYPEDEFS
  */
@@ -152,13 +178,41 @@ extern bStatus_t EMGService_SetParameter( uint8_t param, uint16_t len, void *val
  */
 extern bStatus_t EMGService_GetParameter( uint8_t param, uint16_t *len, void *value );
 
+/*
+ * EMGService_AllocStreamNoti - Allocate a stack-owned notification for the Stream
+ *          characteristic, so the caller can build the value in place.
+ *
+ *    len         - length of the value, at most ATT MTU - 3
+ *    pConnHandle - returns the connection that has notifications enabled
+ *    pNoti       - returns the notification, fill pNoti->pValue then send it
+ *                  with GATT_Notification(), or GATT_bm_free() it
+ */
+extern bStatus_t EMGService_AllocStreamNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti );
+
+/*
+ * EMGService_AllocSummaryNoti - Same as EMGService_AllocStreamNoti, for the
+ *          "summary available" notification of the Summary characteristic.
+ */
+extern bStatus_t EMGService_AllocSummaryNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti );
+
+/*
+ * EMGService_AllocSessionLogNoti - Same as EMGService_AllocStreamNoti, for the
+ *          bulk sync notifications of the Session Log characteristic.
+ */
+extern bStatus_t EMGService_AllocSessionLogNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti );
+
+/*
+ * EMGService_AllocTimeSyncNoti - Same as EMGService_AllocStreamNoti, for the
+ *          pings of the Time Sync characteristic.
+ */
+extern bStatus_t EMGService_AllocTimeSyncNoti( uint16_t len, uint16_t *pConnHandle, attHandleValueNoti_t *pNoti );
+
 
 extern Swi_Struct emgConfigSwi;
 
 void emgConfig_SwiFxn(void);
-void emgConfig_createTask(void);
+void emgConfig_register(void);
 void emgConfig_createSwi(void);
-void saveWorkoutConfig(void);
 /*********************************************************************
 *********************************************************************/
 
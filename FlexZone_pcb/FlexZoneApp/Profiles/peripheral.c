@@ -67,6 +67,8 @@
 #include "osal_snv.h"
 #include "ICallBleAPIMSG.h"
 
+#include "diag.h"
+
 /*********************************************************************
  * MACROS
  */
@@ -791,6 +793,7 @@ void GAPRole_createTask(void)
   taskParams.priority = GAPROLE_TASK_PRIORITY;
   
   Task_construct(&gapRoleTask, gapRole_taskFxn, &taskParams, NULL);
+  diag_addTask(DIAG_TASK_GAPROLE, Task_handle(&gapRoleTask));
 }
 
 /*********************************************************************
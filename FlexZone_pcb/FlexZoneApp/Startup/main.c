@@ -37,6 +37,8 @@ bleUserCfg_t user0Cfg = BLE_USER_CFG;
 #include "emg.h"
 #include "accelerometer.h"
 #include "vibe.h"
+#include "sched.h"
+#include "trace.h"
 
 //**********************************************************************************
 // Required Definitions
@@ -90,6 +92,10 @@ void halAssertHandler(void) {
 // Main
 //**********************************************************************************
 int main() {
+#if defined(USE_UART)
+	UART_Handle hUart;
+#endif // USE_UART
+
 	PIN_init(BoardGpioInitTable);
 
 #ifndef POWER_SAVING
@@ -102,7 +108,10 @@ int main() {
 	//Initialize the RTOS Log formatting and output to UART in Idle thread.
 	//Note: Define xdc_runtime_Log_DISABLE_ALL to remove all impact of Log.
 	//Note: NULL as Params gives 115200,8,N,1 and Blocking mode
-	UartLog_init(UART_open(Board_UART, NULL));
+	//The tokenized trace shares the UART, its drain task is priority 1.
+	hUart = UART_open(Board_UART, NULL);
+	UartLog_init(hUart);
+	trace_createTask(hUart);
 #endif // USE_UART
 
 	//Initialize ICall module
@@ -119,19 +128,22 @@ int main() {
 	//**********************************************************************************
 	//BlE task - Priority 4
 	FlexZone_createTask();
-	//EMG task - Priority 1
+	//EMG task - Priority 2
 	emg_createTask();
-	// MPU2650 Accelerometer (SPI) - Priority 2
-	accel_createTask();
 
-	//BLE Services - Priority 3
+	//Application event loop - Priority 1, runs the handlers registered below
+	sched_createTask();
+	// MPU2650 Accelerometer (I2C)
+	accel_register();
+
+	//BLE Services
 //	accelConfig_createSwi();
 //	accelConfig_createTask();
 	emgConfig_createSwi();
-	emgConfig_createTask();
+	emgConfig_register();
 
-	//Vibration Motor Task - Priority 1
-	vibe_createTask();
+	//Vibration Motor - Swi, so haptic cues do not wait for a task
+	vibe_init();
 	//**********************************************************************************
 	// Enable Interrupts & start SYS/BIOS
 	//**********************************************************************************
@@ -141,14 +153,7 @@ int main() {
 }
 
 void printWorkoutConfig(void) {
-#if defined(USE_UART)
-		Log_info5("Sets: %u Reps: %u Rest: %u Haptic: %u IMU: %u",
-				myWorkoutConfig.targetSetCount,myWorkoutConfig.targetRepCount,myWorkoutConfig.maxRestSeconds,
-				myWorkoutConfig.hapticFeedback,myWorkoutConfig.imuFeedback);
-#else
-		System_printf("Sets: %u Reps: %u Rest: %u Haptic: %u IMU: %u\n",
+		TRACE_INFO5(TRACE_WORKOUT_CONFIG,
 				myWorkoutConfig.targetSetCount,myWorkoutConfig.targetRepCount,myWorkoutConfig.maxRestSeconds,
 				myWorkoutConfig.hapticFeedback,myWorkoutConfig.imuFeedback);
-		System_flush();
-#endif //USE_UART
 }
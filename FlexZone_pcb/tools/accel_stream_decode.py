@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+"""
+Decodes the raw IMU stream of the Accel stream characteristic and reports loss and
+throughput.
+
+Packets are APP_PACKET_TYPE_IMU_STREAM (see Application/accelerometer.h): sequence
+number, 16-bit shared time of the first frame in ms, ms between frames, then int16
+accel XYZ and gyro XYZ frames. The capture format is described in fz_capture.py.
+
+A sequence gap is a notification lost on the way. A packet that follows its
+predecessor without a gap but starts later than the predecessor's last frame plus one
+period is a slip on the device: the IMU read failed or came late, and the firmware
+started a new packet instead of storing frames off their time slot.
+
+    accel_stream_decode.py capture.txt
+    accel_stream_decode.py capture.txt --csv frames.csv
+    accel_stream_decode.py capture.txt --expect frames.jsonl
+
+--expect compares every decoded frame and its time, relative to the first one, with
+the frames as written by host/accel_stream_dump, and the lost packets, lost frames
+and slips of the report with what the dump left out of the capture.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+from fz_capture import read_capture, split_packet
+
+APP_PACKET_TYPE_IMU_STREAM = 2
+HEADER_LEN = 4
+FRAME_LEN = 12
+
+
+def decode_packet(payload):
+    """(seq, t0 ms, dt ms, frames) of one packet payload, None if malformed."""
+    if len(payload) < HEADER_LEN + FRAME_LEN or (len(payload) - HEADER_LEN) % FRAME_LEN:
+        return None
+    seq, t0, dt = struct.unpack_from('<BHB', payload, 0)
+    frames = [struct.unpack_from('<6h', payload, pos)
+              for pos in range(HEADER_LEN, len(payload), FRAME_LEN)]
+    return seq, t0, dt, frames
+
+
+class Report(object):
+    def __init__(self):
+        self.packets = 0
+        self.malformed = 0
+        self.frames = 0
+        self.payload_bytes = 0
+        self.lost_packets = 0
+        self.lost_frames = 0
+        self.slips = 0
+        self.slipped_frames = 0
+        self.first_ms = None
+        self.last_ms = None
+        self.last_dt = 0
+        self.first_host = None
+        self.last_host = None
+        self.per_packet = {}
+
+    def lines(self):
+        out = []
+        out.append('packets           %u (%u malformed)' % (self.packets, self.malformed))
+        out.append('frames            %u' % self.frames)
+        sent = self.packets + self.lost_packets
+        out.append('lost packets      %u of %u (%.2f %%)' %
+                   (self.lost_packets, sent, 100.0 * self.lost_packets / sent if sent else 0))
+        out.append('lost frames       ~%u' % self.lost_frames)
+        out.append('device slips      %u, ~%u frames' % (self.slips, self.slipped_frames))
+        if self.per_packet:
+            sizes = ', '.join('%u x %u' % (n, c) for n, c in sorted(self.per_packet.items()))
+            out.append('frames per packet %s' % sizes)
+
+        if self.first_ms is not None:
+            span = (self.last_ms + self.last_dt - self.first_ms) / 1000.0
+            if span > 0:
+                out.append('device time       %.3f s' % span)
+                out.append('frame rate        %.1f Hz' % (self.frames / span))
+                out.append('throughput        %.0f B/s payload, %.1f notifications/s' %
+                           (self.payload_bytes / span, self.packets / span))
+        if self.first_host is not None and self.last_host > self.first_host:
+            span = self.last_host - self.first_host
+            out.append('host time         %.3f s, %.0f B/s payload' %
+                       (span, self.payload_bytes / span))
+        return out
+
+
+def decode(capture, report, frame_out=None):
+    """Decodes every IMU packet of a capture into report; frames go to frame_out as
+    (device ms, 6 values)."""
+    prev = None		#(seq, t0, absolute t0, dt, frames) of the last packet
+
+    for t, value in capture:
+        pkt = split_packet(value)
+        if pkt is None or pkt[0] != APP_PACKET_TYPE_IMU_STREAM:
+            continue
+        decoded = decode_packet(pkt[1])
+        report.packets += 1
+        if decoded is None:
+            report.malformed += 1
+            continue
+        seq, t0, dt, frames = decoded
+
+        if prev is None:
+            abs_ms = t0
+            report.first_ms = abs_ms
+        else:
+            p_seq, p_t0, p_abs, p_dt, p_frames = prev
+            abs_ms = p_abs + ((t0 - p_t0) & 0xFFFF)
+            expect = p_abs + len(p_frames) * p_dt
+            missing = int(round(float(abs_ms - expect) / p_dt)) if p_dt else 0
+            gap = (seq - p_seq - 1) & 0xFF
+            if gap:
+                report.lost_packets += gap
+                report.lost_frames += max(missing, 0)
+            elif abs_ms - expect > 1:
+                report.slips += 1
+                report.slipped_frames += max(missing, 0)
+        prev = (seq, t0, abs_ms, dt, frames)
+
+        report.frames += len(frames)
+        report.payload_bytes += len(pkt[1])
+        report.per_packet[len(frames)] = report.per_packet.get(len(frames), 0) + 1
+        report.last_ms = abs_ms + (len(frames) - 1) * dt
+        report.last_dt = dt
+        if t is not None:
+            if report.first_host is None:
+                report.first_host = t
+            report.last_host = t
+
+        if frame_out:
+            for i, frame in enumerate(frames):
+                frame_out(abs_ms + i * dt, frame)
+
+
+def check(report, got, expect_path):
+    """Compares with the frames that were sent; returns the number of failures."""
+    want = []
+    totals = None
+    with open(expect_path) as f:
+        for line in f:
+            if line.strip():
+                e = json.loads(line)
+                if 'frame' in e:
+                    want.append((e['ms'], tuple(e['frame'])))
+                else:
+                    totals = e
+
+    failures = 0
+    if len(got) != len(want):
+        print('decoded %u frames, expected %u' % (len(got), len(want)))
+        failures += 1
+    for i, ((t, v), (wt, wv)) in enumerate(zip(got, want)):
+        if v != wv or t - got[0][0] != wt - want[0][0]:
+            print('frame %u: decoded %s at %d ms, expected %s at %d ms' %
+                  (i, v, t - got[0][0], wv, wt - want[0][0]))
+            failures += 1
+            break
+    for key, value in (('packets', report.packets), ('lost_packets', report.lost_packets),
+                       ('lost_frames', report.lost_frames), ('slips', report.slips)):
+        if totals is None or totals[key] != value:
+            print('%s %u, expected %s' % (key, value, totals and totals[key]))
+            failures += 1
+    if report.malformed:
+        print('%u malformed packets' % report.malformed)
+        failures += 1
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', help='capture file, - for stdin')
+    parser.add_argument('--csv', help='write the frames here')
+    parser.add_argument('--expect', help='JSON lines of the frames that were sent')
+    args = parser.parse_args()
+
+    report = Report()
+    csv = None
+    frame_out = None
+    got = []
+    if args.expect:
+        frame_out = lambda ms, f: got.append((ms, tuple(f)))
+    if args.csv:
+        csv = open(args.csv, 'w')
+        csv.write('t_ms,accel_x,accel_y,accel_z,gyro_x,gyro_y,gyro_z\n')
+        frame_out = lambda ms, f: csv.write('%u,%d,%d,%d,%d,%d,%d\n' % ((ms,) + tuple(f)))
+
+    try:
+        decode(read_capture(args.capture), report, frame_out)
+    finally:
+        if csv:
+            csv.close()
+
+    if not report.packets:
+        sys.exit('no IMU stream packets in %s' % args.capture)
+    print('\n'.join(report.lines()))
+    if args.expect:
+        failures = check(report, got, args.expect)
+        print('%u failures' % failures)
+        sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
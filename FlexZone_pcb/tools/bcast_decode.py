@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+"""
+Decodes the live status FlexZones broadcast in their advertising data and follows
+several devices at once, as a coach's tablet would.
+
+The status is the manufacturer specific AD structure of advertData (see
+USER_BCAST_STATUS_LEN in Application/FlexZone.c): the 11 11 40 11 prefix, then sequence
+number, USER_BCAST_FLAG_* bits, finished sets, reps in the current set and the peak of
+the last rep, little endian. An all zero status means broadcasting is off.
+
+The capture format is described in fz_capture.py, with the advertising PDU payload as
+the value: AdvA, least significant byte first as on air, then AdvData. Advertisements of
+other devices are skipped.
+
+    bcast_decode.py capture.txt
+    bcast_decode.py capture.txt --expect updates.jsonl
+
+Without --expect every status is printed with the time and address it came from, and
+a note where updates of a device were missed.
+
+--expect compares every received status with the updates as written by
+host/bcast_scan_sim: it must be the one its device published last before the
+advertising event it came in. It then prints per device how many updates the scanner
+saw and how old the shown status got.
+"""
+
+import argparse
+import bisect
+import json
+import sys
+
+from fz_capture import read_capture
+
+ADDR_LEN = 6
+AD_TYPE_MANUFACTURER = 0xFF
+PREFIX = b'\x11\x11\x40\x11'
+STATUS_LEN = 6
+
+FLAG_ACTIVE = 0x01
+FLAG_WORKOUT = 0x02
+FLAG_CONNECTED = 0x04
+
+# An advertising event goes out on three channels within ~1.5 ms with the data it
+# started with; a status published meanwhile waits for the next event
+EVENT_S = 0.002
+
+
+def ad_structures(data):
+    """Yields (type, data) of the AD structures; ValueError if one runs past the end."""
+    pos = 0
+    while pos < len(data):
+        n = data[pos]
+        if n == 0:
+            return
+        if pos + 1 + n > len(data):
+            raise ValueError('AD structure runs past the end')
+        yield data[pos + 1], data[pos + 2:pos + 1 + n]
+        pos += 1 + n
+
+
+def decode_adv(value):
+    """(address, status dict or None for broadcasting off) of a FlexZone
+    advertisement, None for anything else; ValueError if it is damaged."""
+    if len(value) < ADDR_LEN:
+        raise ValueError('no address')
+    addr = ':'.join('%02x' % b for b in reversed(value[:ADDR_LEN]))
+    for ad_type, data in ad_structures(value[ADDR_LEN:]):
+        if ad_type != AD_TYPE_MANUFACTURER or not data.startswith(PREFIX):
+            continue
+        s = data[len(PREFIX):]
+        if len(s) != STATUS_LEN:
+            raise ValueError('%s: status of %u bytes' % (addr, len(s)))
+        if not any(s):
+            return addr, None
+        if not s[1] & FLAG_ACTIVE:
+            raise ValueError('%s: status without the active flag' % addr)
+        return addr, {'seq': s[0], 'flags': s[1], 'sets': s[2], 'reps': s[3],
+                      'peak': s[4] | s[5] << 8}
+    return None
+
+
+def statuses(capture):
+    """Yields (time, address, status or None) of every FlexZone advertisement, or
+    (time, None, ValueError) for a damaged one."""
+    for t, value in capture:
+        try:
+            adv = decode_adv(value)
+        except ValueError as e:
+            yield t, None, e
+            continue
+        if adv is not None:
+            yield t, adv[0], adv[1]
+
+
+def format_status(s):
+    flags = ''.join(c for f, c in ((FLAG_WORKOUT, 'W'), (FLAG_CONNECTED, 'C'))
+                    if s['flags'] & f) or '-'
+    return 'seq %3u %-2s set %3u rep %3u peak %4u' % (s['seq'], flags, s['sets'], s['reps'],
+                                                    s['peak'])
+
+
+def pct(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, len(values) * p // 100)] if values else 0
+
+
+def check(decoded, expect_path):
+    """Compares with the published updates; returns the number of failures."""
+    updates = {}
+    with open(expect_path) as f:
+        for line in f:
+            if line.strip():
+                u = json.loads(line)
+                updates.setdefault(u['addr'], []).append(u)
+    times = dict((a, [u['t'] for u in us]) for a, us in updates.items())
+
+    failures = 0
+    seen = dict((a, set()) for a in updates)
+    ages = dict((a, []) for a in updates)
+    rx = dict((a, 0) for a in updates)
+    last_new = {}
+    stale = dict((a, 0.0) for a in updates)
+    off = 0
+    for t, addr, s in decoded:
+        if isinstance(s, ValueError):
+            print('%.6f: damaged advertisement: %s' % (t, s))
+            failures += 1
+            continue
+        if addr not in updates:
+            print('%.6f: %s is not a broadcasting device' % (t, addr))
+            failures += 1
+            continue
+        if s is None:
+            off += 1
+            continue
+        rx[addr] += 1
+
+        # The update current when the event started
+        i = bisect.bisect_right(times[addr], t) - 1
+        if i >= 0 and updates[addr][i]['seq'] != s['seq'] and times[addr][i] > t - EVENT_S:
+            i -= 1
+        want = updates[addr][i] if i >= 0 else None
+        if want is None or any(want[k] != s[k] for k in s):
+            print('%.6f %s: %s, expected %s' % (t, addr, format_status(s),
+                                                 format_status(want) if want else 'none'))
+            failures += 1
+            continue
+
+        if i not in seen[addr]:
+            seen[addr].add(i)
+            if addr in last_new:
+                stale[addr] = max(stale[addr], t - last_new[addr])
+            last_new[addr] = t
+        ages[addr].append(t - want['t'])
+
+    print('%-17s %6s %6s %5s %8s %8s %9s %9s %11s' % (
+        'device', 'period', 'adv', 'rx', 'updates', 'seen', 'age p50', 'age max', 'stale max'))
+    for addr in sorted(updates):
+        us = updates[addr]
+        published = bisect.bisect_right(times[addr], max(t for t, _, _ in decoded))
+        print('%-17s %4u ms %4.0f ms %5u %8u %7.1f%% %6.0f ms %6.0f ms %8.0f ms' % (
+            addr, us[0]['period_ms'], us[0]['adv_ms'], rx[addr], published,
+            100.0 * len(seen[addr]) / max(published, 1), 1000 * pct(ages[addr], 50),
+            1000 * max(ages[addr] or [0]), 1000 * stale[addr]))
+        if not rx[addr]:
+            print('%s: nothing received' % addr)
+            failures += 1
+    if off:
+        print('%u advertisements before broadcasting started' % off)
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', help='capture file, - for stdin')
+    parser.add_argument('--expect', help='JSON lines of the status updates published')
+    args = parser.parse_args()
+
+    decoded = list(statuses(read_capture(args.capture)))
+    if not decoded:
+        sys.exit('no FlexZone advertisements in %s' % args.capture)
+
+    if args.expect:
+        failures = check(decoded, args.expect)
+        print('%u failures' % failures)
+        sys.exit(1 if failures else 0)
+
+    last = {}
+    for t, addr, s in decoded:
+        if isinstance(s, ValueError):
+            print('# damaged advertisement: %s' % s)
+            continue
+        if s is None:
+            print('%.6f %s broadcast off' % (t, addr))
+            continue
+        if addr in last and s['seq'] != last[addr]:
+            missed = (s['seq'] - last[addr] - 1) & 0xFF
+            if missed:
+                print('# %s: %u updates missed' % (addr, missed))
+        last[addr] = s['seq']
+        print('%.6f %s %s' % (t, addr, format_status(s)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""
+Decodes Diagnostics Counters snapshots (Application/diag.h, version 4), read from the
+characteristic or notified after a DIAG_OP_NOTIFY, and prints the performance health
+of a field device.
+
+The capture format is described in fz_capture.py, with the characteristic value as
+the value. A notification carries as much of the snapshot as fits in the ATT MTU;
+fields it cuts off are left out.
+
+    diag_decode.py capture.txt
+    diag_decode.py capture.txt --expect expected.jsonl
+
+--expect compares every snapshot with a JSON line as written by host/diag_dump; every
+field must match.
+"""
+
+import argparse
+import json
+import sys
+
+from fz_capture import read_capture
+
+DIAG_VERSION = 4
+SNAPSHOT_LEN = 133
+HIST_BUCKETS = 8
+HIST_BASE_US = 32
+
+TIMERS = ['slice', 'sample', 'haptic']
+COUNTERS = ['missed_deadlines', 'overruns', 'i2c_transfers', 'i2c_errors',
+            'spi_transfers', 'spi_errors', 'set_drops']
+TXQ = ['depth', 'high_water', 'sent', 'retries', 'drops', 'discards']
+BOOT_PHASES = ['app_start', 'app_ready', 'device_started', 'advertising', 'first_sample']
+POOL_CLASSES = 2
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def has(self, n):
+        return self.pos + n <= len(self.data)
+
+    def u8(self):
+        self.pos += 1
+        return self.data[self.pos - 1]
+
+    def u16(self):
+        self.pos += 2
+        return int.from_bytes(self.data[self.pos - 2:self.pos], 'little')
+
+    def u32(self):
+        self.pos += 4
+        return int.from_bytes(self.data[self.pos - 4:self.pos], 'little')
+
+
+def decode(data):
+    """Dict of the fields a snapshot holds; ValueError if it is not one."""
+    if not data or data[0] != DIAG_VERSION:
+        raise ValueError('not a version %u snapshot' % DIAG_VERSION)
+    if len(data) > SNAPSHOT_LEN:
+        raise ValueError('%u bytes, a snapshot has %u' % (len(data), SNAPSHOT_LEN))
+    r = Reader(data)
+    r.u8()
+    s = {'partial': len(data) < SNAPSHOT_LEN}
+    if r.has(4):
+        s['uptime'] = r.u32()
+    s['timers'] = []
+    for _ in TIMERS:
+        if not r.has(6 + 2 * HIST_BUCKETS):
+            break
+        s['timers'].append({'min': r.u16(), 'mean': r.u16(), 'max': r.u16(),
+                            'hist': [r.u16() for _ in range(HIST_BUCKETS)]})
+    if r.has(2 * len(COUNTERS)):
+        s['counters'] = [r.u16() for _ in COUNTERS]
+    if r.has(10):
+        s['txq'] = [r.u8(), r.u8()] + [r.u16() for _ in range(4)]
+    if r.has(6):
+        s['heap'] = [r.u16() for _ in range(3)]
+    if r.has(4 * POOL_CLASSES + 4):
+        s['pool'] = [[r.u8(), r.u8(), r.u16()] for _ in range(POOL_CLASSES)]
+        s['pool_heap'] = [r.u16(), r.u16()]
+    if r.has(4 * len(BOOT_PHASES)):
+        s['boot_ms'] = [r.u32() for _ in BOOT_PHASES]
+    return s
+
+
+def bucket_label(i):
+    if i == 0:
+        return '<%u' % HIST_BASE_US
+    if i == HIST_BUCKETS - 1:
+        return '>=%u' % (HIST_BASE_US << (i - 1))
+    return '%u-%u' % (HIST_BASE_US << (i - 1), (HIST_BASE_US << i) - 1)
+
+
+def print_snapshot(t, s):
+    print('%s snapshot%s' % ('%.6f' % t if t is not None else '-',
+                             ', cut short by the MTU' if s['partial'] else ''))
+    if 'uptime' in s:
+        print('  uptime %u s' % s['uptime'])
+    for name, tm in zip(TIMERS, s['timers']):
+        print('  %-7s min %5u mean %5u max %5u us   %s' % (
+            name, tm['min'], tm['mean'], tm['max'],
+            ' '.join('%s:%u' % (bucket_label(i), n) for i, n in enumerate(tm['hist']) if n)))
+    if 'counters' in s:
+        print('  ' + ' '.join('%s %u' % (n, v) for n, v in zip(COUNTERS, s['counters'])))
+    if 'txq' in s:
+        print('  txq ' + ' '.join('%s %u' % (n, v) for n, v in zip(TXQ, s['txq'])))
+    if 'heap' in s:
+        print('  heap size %u in use %u peak %u' % tuple(s['heap']))
+    if 'pool' in s:
+        for i, c in enumerate(s['pool']):
+            print('  pool class %u: in use %u high water %u exhausted %u' % (i, c[0], c[1], c[2]))
+        print('  pool heap fallbacks %u failures %u' % tuple(s['pool_heap']))
+    if 'boot_ms' in s:
+        print('  boot ' + ' '.join('%s %s' % (n, '%u ms' % v if v else '-')
+                                   for n, v in zip(BOOT_PHASES, s['boot_ms'])))
+
+
+def check(snapshots, expect_path):
+    """Compares with the expected values; returns the number of failures."""
+    with open(expect_path) as f:
+        expected = [json.loads(line) for line in f if line.strip()]
+    failures = 0
+    if len(snapshots) != len(expected):
+        print('%u snapshots, %u expected' % (len(snapshots), len(expected)))
+        failures += 1
+
+    for n, ((t, s), e) in enumerate(zip(snapshots, expected), 1):
+        bad = []
+        if isinstance(s, ValueError):
+            bad.append(str(s))
+        else:
+            if s['partial']:
+                bad.append('cut short')
+            for k in ('uptime', 'counters', 'txq', 'heap', 'pool', 'pool_heap', 'boot_ms'):
+                if s.get(k) != e[k]:
+                    bad.append('%s %s, expected %s' % (k, s.get(k), e[k]))
+            for name, got, want in zip(TIMERS, s['timers'], e['timers']):
+                for k in ('min', 'mean', 'max', 'hist'):
+                    if got[k] != want[k]:
+                        bad.append('%s %s %s, expected %s' % (name, k, got[k], want[k]))
+        if bad:
+            failures += 1
+            if failures <= 10:
+                print('snapshot %u: %s' % (n, '; '.join(bad)))
+    print('%u snapshots' % len(snapshots))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', help='capture file, - for stdin')
+    parser.add_argument('--expect', help='JSON lines of the expected snapshots')
+    args = parser.parse_args()
+
+    snapshots = []
+    for t, value in read_capture(args.capture):
+        try:
+            snapshots.append((t, decode(value)))
+        except ValueError as e:
+            snapshots.append((t, e))
+    if not snapshots:
+        sys.exit('no snapshots in %s' % args.capture)
+
+    if args.expect:
+        failures = check(snapshots, args.expect)
+        print('%u failures' % failures)
+        sys.exit(1 if failures else 0)
+
+    for t, s in snapshots:
+        if isinstance(s, ValueError):
+            print('# %s' % s)
+        else:
+            print_snapshot(t, s)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""
+Decodes Diagnostics Memory reports (Application/diag.h, version 2) and checks them
+against the RAM budget, so a new feature can be run on a device and gated on the
+headroom it leaves.
+
+The capture format is described in fz_capture.py, with the characteristic value as
+the value.
+
+    diag_memory.py capture.txt
+    diag_memory.py capture.txt --budget
+    diag_memory.py capture.txt --expect expected.jsonl
+
+--budget fails if any report has a stack with less than DIAG_STACK_MARGIN bytes of
+headroom, or a heap that failed an application allocation or peaked within the same
+margin of its size. --expect compares every report with a JSON line as written by
+host/diag_memory_dump, including what the budget check flags; every field must match.
+"""
+
+import argparse
+import json
+import sys
+
+from fz_capture import read_capture
+
+MEMORY_VERSION = 2
+MEMORY_LEN = 34
+STACK_MARGIN = 64
+
+TASKS = ['app', 'gaprole', 'emg', 'sched', 'trace']
+
+
+def u16(data, pos):
+    return int.from_bytes(data[pos:pos + 2], 'little')
+
+
+def decode(data):
+    """Dict of the fields a report holds; ValueError if it is not one."""
+    if not data or data[0] != MEMORY_VERSION:
+        raise ValueError('not a version %u memory report' % MEMORY_VERSION)
+    if len(data) != MEMORY_LEN:
+        raise ValueError('%u bytes, a memory report has %u' % (len(data), MEMORY_LEN))
+    if data[1] != len(TASKS):
+        raise ValueError('%u tasks, expected %u' % (data[1], len(TASKS)))
+    pos = 2 + 4 * len(TASKS)
+    return {'tasks': [[u16(data, 2 + 4 * i), u16(data, 4 + 4 * i)] for i in range(len(TASKS))],
+            'system': [u16(data, pos), u16(data, pos + 2)],
+            'heap': [u16(data, pos + 4), u16(data, pos + 6), u16(data, pos + 8)],
+            'alloc_failures': u16(data, pos + 10)}
+
+
+def over_budget(r):
+    """Names of the stacks and heap a report puts over the budget."""
+    over = [name for name, (size, used) in zip(TASKS, r['tasks'])
+            if size and used + STACK_MARGIN > size]
+    if r['system'][1] + STACK_MARGIN > r['system'][0]:
+        over.append('system')
+    size, _, peak = r['heap']
+    if r['alloc_failures'] or peak + STACK_MARGIN > size:
+        over.append('heap')
+    return over
+
+
+def print_report(t, r):
+    print('%s memory report' % ('%.6f' % t if t is not None else '-'))
+    for name, (size, used) in zip(TASKS, r['tasks']):
+        if size:
+            print('  %-8s stack %5u used %5u headroom %5d' % (name, size, used, size - used))
+        else:
+            print('  %-8s not created' % name)
+    size, used = r['system']
+    print('  %-8s stack %5u used %5u headroom %5d' % ('system', size, used, size - used))
+    print('  heap size %u in use %u peak %u, %u failed allocations' % (
+        tuple(r['heap']) + (r['alloc_failures'],)))
+    over = over_budget(r)
+    if over:
+        print('  over budget: ' + ', '.join(over))
+
+
+def check(reports, expect_path):
+    """Compares with the expected values; returns the number of failures."""
+    with open(expect_path) as f:
+        expected = [json.loads(line) for line in f if line.strip()]
+    failures = 0
+    if len(reports) != len(expected):
+        print('%u reports, %u expected' % (len(reports), len(expected)))
+        failures += 1
+
+    flagged = 0
+    for n, ((t, r), e) in enumerate(zip(reports, expected), 1):
+        bad = []
+        if isinstance(r, ValueError):
+            bad.append(str(r))
+        else:
+            for k in ('tasks', 'system', 'heap', 'alloc_failures'):
+                if r[k] != e[k]:
+                    bad.append('%s %s, expected %s' % (k, r[k], e[k]))
+            over = over_budget(r)
+            if over != e['over']:
+                bad.append('over budget %s, expected %s' % (over, e['over']))
+            flagged += bool(over)
+        if bad:
+            failures += 1
+            if failures <= 10:
+                print('report %u: %s' % (n, '; '.join(bad)))
+    print('%u reports, %u over budget' % (len(reports), flagged))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', help='capture file, - for stdin')
+    parser.add_argument('--budget', action='store_true', help='fail on a report over budget')
+    parser.add_argument('--expect', help='JSON lines of the expected reports')
+    args = parser.parse_args()
+
+    reports = []
+    for t, value in read_capture(args.capture):
+        try:
+            reports.append((t, decode(value)))
+        except ValueError as e:
+            reports.append((t, e))
+    if not reports:
+        sys.exit('no memory reports in %s' % args.capture)
+
+    if args.expect:
+        failures = check(reports, args.expect)
+        print('%u failures' % failures)
+        sys.exit(1 if failures else 0)
+
+    over = 0
+    for t, r in reports:
+        if isinstance(r, ValueError):
+            print('# %s' % r)
+        else:
+            print_report(t, r)
+            over += bool(over_budget(r))
+    if args.budget and over:
+        print('%u of %u reports over budget' % (over, len(reports)))
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,285 @@
+#!/usr/bin/env python3
+"""
+Decodes the raw EMG stream (Application/emg_stream.h) and reports block loss,
+compression and what the link carries.
+
+APP_PACKET_TYPE_EMG_RAW packets carry one block each: sequence number, mode (Rice
+parameter k or verbatim), sample count, the first sample and its time, then the other
+samples as 12 bit verbatim values or as Rice coded zigzag deltas. A delta whose Rice
+quotient reaches 15 is sent as 15 one bits and its 13 bit zigzag value. The capture
+format is described in fz_capture.py.
+
+    emg_stream_decode.py capture.txt
+    emg_stream_decode.py capture.txt --expect slices.jsonl --bench
+
+Without --expect the samples are printed one per line, the first of each block after
+its time in us, the others after a '-'.
+
+--expect compares every decoded sample and its time with the slices as written by
+host/emg_stream_dump, and checks the encoder's choices where the block shows them:
+k must be the one the first 16 deltas call for, and a verbatim block must not have
+fitted in fewer bits as Rice. With --coverage it also fails unless the capture
+exercised escaped deltas, verbatim blocks and more than one k.
+
+--bench prints bits per sample by mode, the compression against 12 bit packing and
+against the uint32 samples, and the samples per second a connection carries.
+"""
+
+import argparse
+import json
+import sys
+
+from fz_capture import read_capture, split_packet
+
+APP_PACKET_TYPE_EMG_RAW = 4
+HEADER_LEN = 9
+SAMPLE_BITS = 12
+MAX_K = 11
+ESCAPE_Q = 15
+ESCAPE_BITS = 13
+K_WINDOW = 16
+MODE_VERBATIM = 0x80
+MODE_K_MASK = 0x0F
+
+NOTIFY_HEADER_LEN = 2
+LL_MAX_PAYLOAD = 27
+LL_OVERHEAD = 10
+L2CAP_ATT_HEADER = 7
+US_PER_BYTE = 8
+T_IFS_US = 150
+
+
+class BitReader(object):
+    """LSB first, as putBits writes."""
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def bits(self, n):
+        v = 0
+        for i in range(n):
+            byte = self.pos >> 3
+            if byte >= len(self.data):
+                raise ValueError('block runs out of bits')
+            v |= ((self.data[byte] >> (self.pos & 7)) & 1) << i
+            self.pos += 1
+        return v
+
+
+def unzigzag(u):
+    return (u >> 1) ^ -(u & 1)
+
+
+def zigzag(d):
+    return ((d << 1) ^ (d >> 15)) & 0xFFFF
+
+
+def rice_bits(u, k):
+    q = u >> k
+    return q + 1 + k if q < ESCAPE_Q else ESCAPE_Q + ESCAPE_BITS
+
+
+def decode_block(payload):
+    """dict of one block; ValueError if it is damaged."""
+    if len(payload) < HEADER_LEN:
+        raise ValueError('block too short')
+    seq, mode, count = payload[0], payload[1], payload[2]
+    if count == 0:
+        raise ValueError('empty block')
+    first = payload[3] | payload[4] << 8
+    time_us = payload[5] | payload[6] << 8 | payload[7] << 16 | payload[8] << 24
+    verbatim = mode == MODE_VERBATIM
+    k = None if verbatim else mode & MODE_K_MASK
+    if not verbatim and (mode & ~MODE_K_MASK or k > MAX_K):
+        raise ValueError('bad mode 0x%02x' % mode)
+
+    r = BitReader(payload[HEADER_LEN:])
+    samples = [first]
+    residuals = []
+    escapes = 0
+    for _ in range(count - 1):
+        if verbatim:
+            samples.append(r.bits(SAMPLE_BITS))
+            continue
+        q = 0
+        while q < ESCAPE_Q and r.bits(1):
+            q += 1
+        if q == ESCAPE_Q:
+            u = r.bits(ESCAPE_BITS)
+            escapes += 1
+        else:
+            u = q << k | r.bits(k)
+        residuals.append(u)
+        samples.append((samples[-1] + unzigzag(u)) & 0xFFFF)
+    if any(s > 0xFFF for s in samples):
+        raise ValueError('sample outside 12 bits')
+    if (r.pos + 7) // 8 != len(payload) - HEADER_LEN:
+        raise ValueError('%d bits, %d bytes of data' % (r.pos, len(payload) - HEADER_LEN))
+    return {'seq': seq, 'k': k, 'time_us': time_us, 'samples': samples,
+            'residuals': residuals, 'escapes': escapes, 'bits': r.pos}
+
+
+def blocks(capture):
+    """Yields (decoded block or ValueError, notification length)."""
+    for _, value in capture:
+        pkt = split_packet(value)
+        if pkt is None or pkt[0] != APP_PACKET_TYPE_EMG_RAW:
+            continue
+        try:
+            yield decode_block(pkt[1]), len(value)
+        except ValueError as e:
+            yield e, len(value)
+
+
+def expected_k(samples):
+    """k as emgStream_encodeBlock picks it, from the deltas of a run of samples."""
+    n = min(len(samples) - 1, K_WINDOW)
+    total = sum(zigzag(samples[i] - samples[i - 1]) for i in range(1, n + 1))
+    k = 0
+    while k < MAX_K and (n << k) < total:
+        k += 1
+    return k
+
+
+def check(decoded, expect_path, coverage):
+    """Compares with the encoded slices; returns the number of failures."""
+    want = []
+    with open(expect_path) as f:
+        for line in f:
+            if line.strip():
+                s = json.loads(line)
+                want += [((s['first_us'] + i * s['period_us']) & 0xFFFFFFFF, v)
+                         for i, v in enumerate(s['samples'])]
+    failures = 0
+    got = []
+    k_checked = verbatim = escapes = 0
+    ks = set()
+    seq = 0
+    for b, _ in decoded:
+        if isinstance(b, ValueError):
+            print('damaged block: %s' % b)
+            failures += 1
+            continue
+        if b['seq'] != seq & 0xFF:
+            print('block %u: sequence %u' % (seq, b['seq']))
+            failures += 1
+        seq += 1
+        start = len(got)
+        got += [(None, v) for v in b['samples']]
+        if start < len(want):
+            got[start] = (b['time_us'], got[start][1])
+        # The encoder picked k from the first 16 deltas of what was left of the slice;
+        # when the block holds them all, k and the mode must follow from them
+        if len(b['samples']) > K_WINDOW:
+            k = expected_k(b['samples'])
+            k_checked += 1
+            if b['k'] is None:
+                rice = sum(rice_bits(zigzag(b['samples'][i] - b['samples'][i - 1]), k)
+                           for i in range(1, len(b['samples'])))
+                if rice < (len(b['samples']) - 1) * SAMPLE_BITS:
+                    print('block %u: verbatim, Rice k=%u needs %u bits' % (seq - 1, k, rice))
+                    failures += 1
+            elif b['k'] != k:
+                print('block %u: k=%u, the deltas call for %u' % (seq - 1, b['k'], k))
+                failures += 1
+        if b['k'] is None:
+            verbatim += 1
+        else:
+            ks.add(b['k'])
+        escapes += b['escapes']
+
+    if len(got) != len(want):
+        print('decoded %u samples, expected %u' % (len(got), len(want)))
+        failures += 1
+    for i, ((t, v), (wt, wv)) in enumerate(zip(got, want)):
+        if v != wv or (t is not None and t != wt):
+            print('sample %u: decoded %s at %s, expected %u at %u' % (i, v, t, wv, wt))
+            failures += 1
+            break
+
+    print('%u blocks, %u samples: k checked on %u, %u escaped deltas, %u verbatim blocks, '
+          'k used %s' % (seq, len(got), k_checked, escapes, verbatim,
+                         ','.join(str(k) for k in sorted(ks))))
+    if coverage and (not escapes or not verbatim or len(ks) < 2):
+        print('escapes, verbatim blocks and several k values must all occur')
+        failures += 1
+    return failures
+
+
+def ll_packets(value_len):
+    return -(-(value_len + L2CAP_ATT_HEADER) // LL_MAX_PAYLOAD)
+
+
+def bench(decoded):
+    modes = {}
+    samples = value_bytes = packets = 0
+    for b, value_len in decoded:
+        if isinstance(b, ValueError):
+            continue
+        m = modes.setdefault(MAX_K + 1 if b['k'] is None else b['k'], [0, 0, 0])
+        m[0] += 1
+        m[1] += len(b['samples'])
+        m[2] += value_len
+        samples += len(b['samples'])
+        value_bytes += value_len
+        packets += ll_packets(value_len)
+    if not samples:
+        return
+
+    print('%-12s %7s %8s %14s' % ('mode', 'blocks', 'samples', 'bits/sample'))
+    for mode in sorted(modes):
+        n, s, v = modes[mode]
+        print('%-12s %7u %8u %14.2f' % ('verbatim' if mode > MAX_K else 'rice k=%u' % mode,
+                                        n, s, 8.0 * v / s))
+    bits = 8.0 * value_bytes / samples
+    print('overall %.2f bits per sample with headers: %.2fx against 12 bit packing, '
+          '%.2fx against uint32 samples' % (bits, SAMPLE_BITS / bits, 32 / bits))
+
+    # Samples per second at a few links, every LL packet carrying the stream
+    us_per_packet = (LL_OVERHEAD + LL_MAX_PAYLOAD) * US_PER_BYTE + 2 * T_IFS_US + LL_OVERHEAD * US_PER_BYTE
+    per_packet = samples / float(packets)
+    print('%.2f samples per LL packet' % per_packet)
+    for interval_ms, per_event in ((7.5, 4), (15, 6), (30, 6)):
+        fit = min(per_event, int(interval_ms * 1000 // us_per_packet))
+        print('  %4.1f ms interval, %u packets per event: %7.0f samples/s' %
+              (interval_ms, fit, per_packet * fit * 1000 / interval_ms))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', help='capture file, - for stdin')
+    parser.add_argument('--expect', help='JSON lines of the slices that were encoded')
+    parser.add_argument('--coverage', action='store_true',
+                        help='with --expect, require escapes, verbatim blocks and several k')
+    parser.add_argument('--bench', action='store_true', help='print the compression')
+    args = parser.parse_args()
+
+    decoded = list(blocks(read_capture(args.capture)))
+    if not decoded:
+        sys.exit('no raw EMG blocks in %s' % args.capture)
+
+    if args.expect:
+        failures = check(decoded, args.expect, args.coverage)
+        print('%u failures' % failures)
+        if args.bench:
+            bench(decoded)
+        sys.exit(1 if failures else 0)
+
+    last = None
+    for b, _ in decoded:
+        if isinstance(b, ValueError):
+            print('# damaged block: %s' % b)
+            continue
+        if last is not None and b['seq'] != (last + 1) & 0xFF:
+            print('# %u blocks lost' % ((b['seq'] - last - 1) & 0xFF))
+        last = b['seq']
+        for i, v in enumerate(b['samples']):
+            print('%s %u' % ('%u' % b['time_us'] if i == 0 else '-', v))
+    if args.bench:
+        bench(decoded)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""
+Shows where an application image sits in the CC2640 flash and checks it stays below
+the BLE stack image.
+
+The stack starts at ICALL_STACK0_ADDR of FlexZoneApp/.cproject and runs up to the
+CCFG in the last page, which the application image carries itself. Everything the
+application links from FLASH_BASE up must end below the stack; the flash above the
+image and below the stack is what the application can still grow into.
+
+    flash_layout.py FlexZoneApp.hex
+    flash_layout.py FlexZoneApp.hex --check
+
+--check fails if any byte outside the CCFG lies at or above the stack start.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CPROJECT = os.path.join(HERE, '..', 'FlexZoneApp', '.cproject')
+
+FLASH_SIZE = 0x20000
+PAGE_SIZE = 0x1000
+CCFG_START = FLASH_SIZE - 0x58
+
+
+def read_hex(path):
+    """Merged (start, end) ranges of the data records of an Intel HEX file."""
+    ranges = []
+    base = 0
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            if line[0] != ':':
+                raise ValueError('line %u: not a record' % n)
+            rec = bytes.fromhex(line[1:])
+            if len(rec) < 5 or len(rec) != 5 + rec[0] or sum(rec) & 0xFF:
+                raise ValueError('line %u: damaged record' % n)
+            addr = rec[1] << 8 | rec[2]
+            if rec[3] == 0x00 and rec[0]:
+                start = base + addr
+                if ranges and ranges[-1][1] == start:
+                    ranges[-1] = (ranges[-1][0], start + rec[0])
+                else:
+                    ranges.append((start, start + rec[0]))
+            elif rec[3] == 0x02:
+                base = (rec[4] << 8 | rec[5]) << 4
+            elif rec[3] == 0x04:
+                base = (rec[4] << 8 | rec[5]) << 16
+            elif rec[3] == 0x01:
+                break
+    ranges.sort()
+    merged = []
+    for r in ranges:
+        if merged and r[0] <= merged[-1][1]:
+            merged[-1] = (merged[-1][0], max(merged[-1][1], r[1]))
+        else:
+            merged.append(r)
+    return merged
+
+
+def stack_start(path):
+    with open(path) as f:
+        m = re.search(r'ICALL_STACK0_ADDR=(0x[0-9A-Fa-f]+)', f.read())
+    if not m:
+        raise ValueError('no ICALL_STACK0_ADDR in %s' % path)
+    return int(m.group(1), 16)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('hex', help='application image, Intel HEX')
+    parser.add_argument('--cproject', default=CPROJECT, help='application .cproject')
+    parser.add_argument('--check', action='store_true', help='fail on an overlap')
+    args = parser.parse_args()
+
+    try:
+        ranges = read_hex(args.hex)
+        stack = stack_start(args.cproject)
+    except (OSError, ValueError) as e:
+        sys.exit(str(e))
+
+    app = [r for r in ranges if r[0] < CCFG_START]
+    end = max(r[1] for r in app) if app else 0
+    used = sum(min(r[1], CCFG_START) - r[0] for r in app)
+    for start, stop in ranges:
+        what = 'CCFG' if start >= CCFG_START else 'application'
+        if start < CCFG_START and stop > stack:
+            what += ', overlaps the stack'
+        print('0x%05x-0x%05x %6u bytes  %s' % (start, stop - 1, stop - start, what))
+    print('application: %u bytes up to 0x%05x, stack from 0x%05x' % (used, end, stack))
+    print('free below the stack: %u bytes, %u whole pages' % (
+        max(stack - end, 0), max(stack // PAGE_SIZE - (end + PAGE_SIZE - 1) // PAGE_SIZE, 0)))
+
+    if args.check and end > stack:
+        print('application image runs %u bytes into the stack' % (end - stack))
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
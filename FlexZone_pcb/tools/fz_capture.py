@@ -0,0 +1,65 @@
+"""
+Reads captured FlexZone notifications for the host decoders.
+
+A capture is text, one notification value per line, as written by a BLE logger or by
+the host checks in host/:
+
+    [time,]hex
+
+time is the host receive time in seconds and may be left out. hex is the value of the
+characteristic, including the 2-byte type/len header of the stream characteristics;
+pairs may be separated by spaces, '-' or ':' and may carry a 0x prefix. Empty lines and
+lines starting with '#' are skipped.
+"""
+
+import re
+import sys
+
+HEX_SEP_RE = re.compile(r'[\s:\-]+')
+HEX_PREFIX_RE = re.compile(r'0[xX]')
+
+
+def parse_line(line):
+    """(time or None, bytes), or None for a line without a value."""
+    line = line.strip()
+    if not line or line.startswith('#'):
+        return None
+
+    t = None
+    if ',' in line:
+        head, line = line.split(',', 1)
+        t = float(head)
+
+    text = HEX_SEP_RE.sub('', HEX_PREFIX_RE.sub('', line))
+    return t, bytes.fromhex(text)
+
+
+def read_capture(path):
+    """Yields (time or None, bytes) for every notification of a capture file, '-' for
+    stdin."""
+    f = sys.stdin if path == '-' else open(path)
+    try:
+        for num, line in enumerate(f, 1):
+            try:
+                value = parse_line(line)
+            except ValueError:
+                sys.stderr.write('%s:%d: not a capture line\n' % (path, num))
+                continue
+            if value is not None:
+                yield value
+    finally:
+        if f is not sys.stdin:
+            f.close()
+
+
+def split_packet(value):
+    """(type, payload) of a stream notification, None if the length byte is off."""
+    if len(value) < 2 or value[1] != len(value) - 2:
+        return None
+    return value[0], value[2:]
+
+
+def format_line(t, value):
+    """A capture line."""
+    text = value.hex()
+    return text if t is None else '%.6f,%s' % (t, text)
@@ -0,0 +1,284 @@
+/*
+ * Streams IMU frames through the firmware's accelerometer.c, run by the event loop
+ * (sched.c) on simulated time, and writes the APP_PACKET_TYPE_IMU_STREAM notifications
+ * it queues as a capture for accel_stream_decode.py, plus every frame sent and what the
+ * decoder must report as JSON lines to compare against.
+ *
+ *     accel_stream_dump <seed> <seconds> <expected.jsonl> > capture.txt
+ *
+ * Streaming runs for a few seconds at a time, at a rate drawn from the whole range and
+ * past its ends, with a notification length from the default ATT MTU up to
+ * USER_MAX_NOTIFY_LEN; both only change while the stream is off, as they do on the
+ * device. The shared time starts close to the 16-bit ms wrap. Now and then an IMU
+ * read fails, so the firmware starts a new packet a frame late, which the decoder must
+ * report as a slip. Now and then a notification is left out of the capture, as lost
+ * on the air; only ones inside an unbroken run of frames, so the decoder can tell the
+ * frames it held.
+ *
+ * The expected file has one line per frame sent, {"ms": shared time, "frame": [6]},
+ * and a last line with the packets captured, lost packets and frames, and slips.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "accelerometer.h"
+#include "diag.h"
+#include "MPU9250.h"
+#include "sched.h"
+#include "time_sync.h"
+
+#define NOTIFY_HEADER_LEN					2
+#define MIN_NOTIFY_LEN						20			//ATT MTU 23
+#define SHARED_START_US						62000000	//Shared ms wraps 3.5 s in
+#define READ_FAIL_ONE_IN					150
+#define DROP_ONE_IN							40
+#define MAX_FRAMES							64
+
+typedef struct {
+	uint32_t ms;
+	int16_t v[6];
+	Bool gapBefore;				//A read failed or the stream started before it
+} Frame;
+
+typedef struct {
+	double t;
+	uint8_t value[USER_MAX_NOTIFY_LEN];
+	uint8_t len;
+	Frame frames[USER_MAX_NOTIFY_LEN / ACCEL_STREAM_FRAME_SIZE];
+	uint8_t numFrames;
+} Packet;
+
+static uint32_t rngState;
+static uint16_t payloadLen = MIN_NOTIFY_LEN;
+static FILE *expect;
+
+//Frames read and not yet sent, oldest first
+static Frame frames[MAX_FRAMES];
+static uint8_t frameHead, frameCount;
+static Bool gapNext = TRUE;
+
+//The last packet is held until the next one shows whether it may be dropped
+static Packet held;
+static Bool haveHeld, anyCaptured;
+static uint32_t captured, lostPackets, lostFrames, slips, readFails, failures;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void fail(const char *what, uint32_t a, uint32_t b)
+{
+	if (failures++ < 10)
+		fprintf(stderr, "%.3f s: %s (%u, %u)\n", shim_nowUs() / 1e6, what, a, b);
+}
+
+//**********************************************************************************
+// What accelerometer.c runs with
+//**********************************************************************************
+void diag_addTask(Diag_task task, Task_Handle hTask)
+{
+}
+
+void trace_write(uint32_t hdr, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4)
+{
+}
+
+uint64_t timeSync_localUs(void)
+{
+	return shim_nowUs();
+}
+
+uint64_t timeSync_toShared(uint64_t localUs)
+{
+	return localUs + SHARED_START_US;
+}
+
+uint16_t user_getNotifyPayloadLen(void)
+{
+	return payloadLen;
+}
+
+void user_setConnActivity(uint8_t activity, uint8_t active)
+{
+}
+
+void classifier_addImuSample(const Accel_State *sample)
+{
+}
+
+void mpu_i2c_init()
+{
+}
+
+uint8_t mpu_enterWakeOnMotion(void)
+{
+	return 1;
+}
+
+void mpu_exitWakeOnMotion(void)
+{
+}
+
+uint8_t mpu_motionDetected(void)
+{
+	return 0;
+}
+
+uint8_t user_mpuMovementState(Accel_State accelState)
+{
+	return 0;
+}
+
+void user_setMpuThreshold(Accel_State accelState)
+{
+}
+
+uint8_t read_MPU_all(Accel_State *state)
+{
+	Frame *pFrame;
+
+	if (rnd(READ_FAIL_ONE_IN) == 0) {
+		readFails++;
+		gapNext = TRUE;
+		return 0;
+	}
+	if (frameCount == MAX_FRAMES) {
+		fail("frames read and never sent", frameCount, 0);
+		return 0;
+	}
+
+	pFrame = &frames[(frameHead + frameCount++) % MAX_FRAMES];
+	pFrame->ms = (uint32_t)(timeSync_toShared(timeSync_localUs()) / 1000);
+	pFrame->gapBefore = gapNext;
+	gapNext = FALSE;
+	state->ACCEL_X = pFrame->v[0] = (int16_t)rnd(0x10000);
+	state->ACCEL_Y = pFrame->v[1] = (int16_t)rnd(0x10000);
+	state->ACCEL_Z = pFrame->v[2] = (int16_t)rnd(0x10000);
+	state->GYRO_X = pFrame->v[3] = (int16_t)rnd(0x10000);
+	state->GYRO_Y = pFrame->v[4] = (int16_t)rnd(0x10000);
+	state->GYRO_Z = pFrame->v[5] = (int16_t)rnd(0x10000);
+	return 1;
+}
+
+//**********************************************************************************
+// Capture
+//**********************************************************************************
+static void capture(const Packet *pPkt)
+{
+	uint8_t i;
+
+	printf("%.6f,", pPkt->t);
+	for (i = 0; i < pPkt->len; i++)
+		printf("%02x", pPkt->value[i]);
+	printf("\n");
+
+	for (i = 0; i < pPkt->numFrames; i++) {
+		const Frame *pFrame = &pPkt->frames[i];
+
+		fprintf(expect, "{\"ms\": %u, \"frame\": [%d, %d, %d, %d, %d, %d]}\n", pFrame->ms,
+				pFrame->v[0], pFrame->v[1], pFrame->v[2], pFrame->v[3], pFrame->v[4], pFrame->v[5]);
+	}
+	if (anyCaptured && pPkt->frames[0].gapBefore)
+		slips++;
+	anyCaptured = TRUE;
+	captured++;
+}
+
+/**
+ * Captures or drops the held packet. A packet may only be dropped inside an unbroken
+ * run of frames, neither it nor the next one starting after a gap, so the decoder can
+ * count its frames from the times around it.
+ */
+static void release(const Packet *pNext)
+{
+	if (!haveHeld)
+		return;
+	if (anyCaptured && pNext != NULL && !held.frames[0].gapBefore &&
+			!pNext->frames[0].gapBefore && rnd(DROP_ONE_IN) == 0) {
+		lostPackets++;
+		lostFrames += held.numFrames;
+	} else {
+		capture(&held);
+	}
+	haveHeld = FALSE;
+}
+
+user_app_error_type_t user_sendAccelPacket(uint8_t *pData, uint8_t len, app_pkt_type_t packetType)
+{
+	Packet pkt;
+	uint8_t i;
+
+	pkt.t = shim_nowUs() / 1e6;
+	pkt.value[0] = packetType;
+	pkt.value[1] = len;
+	memcpy(&pkt.value[NOTIFY_HEADER_LEN], pData, len);
+	pkt.len = len + NOTIFY_HEADER_LEN;
+	if (pkt.len > payloadLen)
+		fail("notification over the payload length", pkt.len, payloadLen);
+
+	pkt.numFrames = (len - ACCEL_STREAM_HEADER_SIZE) / ACCEL_STREAM_FRAME_SIZE;
+	if (pkt.numFrames > frameCount) {
+		fail("frames in packet, read", pkt.numFrames, frameCount);
+		return USER_APP_ERROR_OK;
+	}
+	for (i = 0; i < pkt.numFrames; i++) {
+		pkt.frames[i] = frames[frameHead];
+		frameHead = (frameHead + 1) % MAX_FRAMES;
+		frameCount--;
+	}
+
+	release(&pkt);
+	held = pkt;
+	haveHeld = TRUE;
+	return USER_APP_ERROR_OK;
+}
+
+int main(int argc, char **argv)
+{
+	static const uint8_t rates[] = { 0, 2, 5, 7, 13, 30, 50, 100, 150, 200, 250 };
+	uint64_t endUs;
+
+	if (argc != 4) {
+		fprintf(stderr, "usage: accel_stream_dump <seed> <seconds> <expected.jsonl>\n");
+		return 2;
+	}
+	rngState = strtoul(argv[1], NULL, 0) | 1;
+	endUs = strtoull(argv[2], NULL, 0) * 1000000;
+	expect = fopen(argv[3], "w");
+	if (!expect) {
+		perror(argv[3]);
+		return 2;
+	}
+
+	printf("# accel_stream_dump %s %s\n", argv[1], argv[2]);
+	sched_createTask();
+	accel_register();
+	shim_runTasks();
+
+	while (shim_nowUs() < endUs) {
+		payloadLen = MIN_NOTIFY_LEN + rnd(USER_MAX_NOTIFY_LEN - MIN_NOTIFY_LEN + 1);
+		gapNext = TRUE;
+		accel_setStreaming(1, rates[rnd(sizeof(rates))]);
+		shim_runTasks();
+		shim_advanceUs(3000000 + rnd(17000000));
+
+		//The handler flushes what is left
+		accel_setStreaming(0, 0);
+		shim_runTasks();
+		if (frameCount)
+			fail("frames left after the stream stopped", frameCount, 0);
+		shim_advanceUs(500000 + rnd(2500000));
+	}
+	release(NULL);
+
+	fprintf(expect, "{\"packets\": %u, \"lost_packets\": %u, \"lost_frames\": %u, \"slips\": %u}\n",
+			captured, lostPackets, lostFrames, slips);
+	fclose(expect);
+	fprintf(stderr, "%u packets captured, %u dropped, %u failed reads\n", captured, lostPackets,
+			readFails);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,533 @@
+/*
+ * Checks the advertising and reconnect policy (adv_policy.c) against the GAP peripheral
+ * role and a central that drops the link, and reports the reconnect timeline.
+ *
+ * The role is Profiles/peripheral.c as far as advertising goes: the enable flags and
+ * what setting them does, START_ADVERTISING_EVT taking the parameters of the moment,
+ * the make/end discoverable done events with GAPROLE_ADVERT_OFF_TIME at its 30 s
+ * default, high duty cycle directed advertising ending after 1.28 s as a failed link
+ * establishment, and a link drop restarting advertising before the application hears
+ * of it. State changes reach the application afterwards, as the messages FlexZone.c
+ * queues, and are handled as user_processStateChangeEvt does, with the broadcast
+ * switching of user_bcastConnectedAdv.
+ *
+ * The central hears an advertising event with the probability of its scan duty and
+ * connects on the first connectable one it hears, directed ones only when they are
+ * addressed to it. A bonded central bonds again after every connection. Every scenario
+ * boots, gets connected, loses the link to a supervision timeout and waits for the
+ * central to come back, and fails if
+ *
+ *     an advertisement starts with the wrong type, interval or directed address for
+ *     the phase adv_policy is in, or has prepared when the role restarts it on the drop
+ *     the first phase after the drop is not directed for a bonded central and fast
+ *     otherwise, or the reconnect happens in another phase than expected
+ *     the fast burst does not last ADV_POLICY_FAST_MS
+ *     the device goes more than MAX_SILENCE_MS without advertising while disconnected
+ *     the central does not get back within RECONNECT_LIMIT_MS of its return
+ *
+ *     adv_policy_test
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "adv_policy.h"
+#include "peripheral.h"
+#include "gap.h"
+
+#define GAP_ADTYPE_ADV_NONCONN_IND			0x03
+
+#define STEP_US								1000
+#define HDC_EVENT_US						3750		//High duty cycle directed, <= 3.75 ms
+#define HDC_TIMEOUT_US						1280000
+#define ADV_DELAY_MAX_US					10000
+#define ADVERT_OFF_TIME_MS					30000		//peripheral.c DEFAULT_ADVERT_OFF_TIME
+
+#define CONNECT_AT_MS						3000		//The app opens after boot
+#define BOND_AFTER_MS						800
+#define BCAST_AFTER_MS						1000
+#define DROP_AT_MS							20000
+#define MAX_SILENCE_MS						50
+#define RECONNECT_LIMIT_MS					120000
+#define FAST_MS_SLACK						50
+
+typedef struct {
+	const char *name;
+	uint8_t bonded;
+	uint8_t broadcasting;		//Broadcasting while connected when the link drops
+	uint32_t awayMs;			//Out of range after the drop
+	uint8_t scanDuty;			//Percent of the advertising events the central hears
+	Adv_phase expectPhase;		//Reconnects in
+} Scenario;
+
+static const Scenario scenarios[] = {
+	{ "link lost, bonded", 1, 0, 0, 10, ADV_PHASE_DIRECTED },
+	{ "link lost, not bonded", 0, 0, 0, 10, ADV_PHASE_FAST },
+	{ "link lost while broadcasting", 1, 1, 0, 10, ADV_PHASE_DIRECTED },
+	{ "away 10 s, background scan", 1, 0, 10000, 10, ADV_PHASE_FAST },
+	{ "away 60 s, background scan", 1, 0, 60000, 10, ADV_PHASE_SLOW },
+	{ "away 60 s, app in front", 1, 0, 60000, 90, ADV_PHASE_SLOW },
+};
+
+static const char *phaseNames[] = { "connected", "directed", "fast", "slow" };
+
+static const uint8_t centralAddr[B_ADDR_LEN] = { 0x66, 0x55, 0x44, 0x33, 0x22, 0x11 };
+
+//peripheral.c
+typedef enum {
+	ROLE_EVT_NONE = 0,
+	ROLE_EVT_MAKE_DONE,
+	ROLE_EVT_END_DONE
+} Role_evt;
+
+static struct {
+	gaprole_States_t state;
+	uint8_t advEnabled;
+	uint8_t nonConnEnabled;
+	uint8_t eventType;
+	uint8_t directType;
+	uint8_t directAddr[B_ADDR_LEN];
+	uint16_t advIntMin;
+	uint8_t startEvt;
+	uint64_t startAdvClockUs;		//0 while stopped
+	Role_evt evt;
+
+	//The advertising running
+	uint8_t on;
+	uint8_t onType;
+	uint32_t onIntUs;
+	uint64_t onStartUs;
+	uint64_t nextAdvUs;
+} role;
+
+//FlexZone.c
+static gaprole_States_t appState = GAPROLE_INIT;
+static gaprole_States_t stateMsgs[8];
+static uint8_t numStateMsgs;
+static uint8_t policyPosted;
+static uint8_t bcastRestoreAdv;
+static uint8_t bcastOn;
+
+//Run
+static const Scenario *sc;
+static uint32_t rngState = 17;
+static uint32_t failures;
+static uint8_t centralHere, linkUp, dropped, bonded;
+static uint64_t connectedUs, dropUs, backUs, silentSinceUs;
+static uint64_t fastStartUs, slowStartUs, longestSilenceUs;
+static Adv_phase firstPhase = ADV_PHASE_NONE;
+static uint32_t advEvents, connects;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static uint32_t nowMs(void)
+{
+	return (uint32_t)(shim_nowUs() / 1000);
+}
+
+static void note(const char *what, const char *detail)
+{
+	printf("  %7u ms  %s%s%s\n", nowMs(), what, detail ? " " : "", detail ? detail : "");
+}
+
+static void fail(const char *what, uint32_t a, uint32_t b)
+{
+	if (failures++ < 10)
+		printf("  %7u ms  FAIL %s (%u, %u)\n", nowMs(), what, a, b);
+}
+
+//**********************************************************************************
+// GAP role
+//**********************************************************************************
+static void roleNotify(gaprole_States_t state)
+{
+	role.state = state;
+	if (numStateMsgs < sizeof(stateMsgs) / sizeof(stateMsgs[0]))
+		stateMsgs[numStateMsgs++] = state;
+}
+
+static void roleEndDiscoverable(void)
+{
+	role.on = 0;
+	role.evt = ROLE_EVT_END_DONE;
+}
+
+bStatus_t GAPRole_SetParameter(uint16_t param, uint8_t len, void *pValue)
+{
+	uint8_t v = *(uint8_t *)pValue, old;
+
+	switch (param) {
+	case GAPROLE_ADVERT_ENABLED:
+		if (role.nonConnEnabled)
+			return FAILURE;
+		old = role.advEnabled;
+		role.advEnabled = v;
+		if (old && !v && (role.state == GAPROLE_ADVERTISING ||
+				role.state == GAPROLE_WAITING_AFTER_TIMEOUT))
+			roleEndDiscoverable();
+		else if (!old && v && (role.state == GAPROLE_STARTED || role.state == GAPROLE_WAITING ||
+				role.state == GAPROLE_WAITING_AFTER_TIMEOUT))
+			role.startEvt = 1;
+		break;
+	case GAPROLE_ADV_NONCONN_ENABLED:
+		if (role.advEnabled)
+			return FAILURE;
+		old = role.nonConnEnabled;
+		role.nonConnEnabled = v;
+		if (old && !v && (role.state == GAPROLE_ADVERTISING_NONCONN ||
+				role.state == GAPROLE_CONNECTED_ADV || role.state == GAPROLE_WAITING_AFTER_TIMEOUT))
+			roleEndDiscoverable();
+		else if (!old && v && (role.state == GAPROLE_STARTED || role.state == GAPROLE_WAITING ||
+				role.state == GAPROLE_CONNECTED || role.state == GAPROLE_WAITING_AFTER_TIMEOUT))
+			role.startEvt = 1;
+		break;
+	case GAPROLE_ADV_EVENT_TYPE:
+		role.eventType = v;
+		break;
+	case GAPROLE_ADV_DIRECT_TYPE:
+		role.directType = v;
+		break;
+	case GAPROLE_ADV_DIRECT_ADDR:
+		memcpy(role.directAddr, pValue, B_ADDR_LEN);
+		break;
+	}
+	return SUCCESS;
+}
+
+bStatus_t GAPRole_GetParameter(uint16_t param, void *pValue)
+{
+	if (param == GAPROLE_STATE)
+		*(uint8_t *)pValue = role.state;
+	return SUCCESS;
+}
+
+bStatus_t GAP_SetParamValue(uint16_t paramID, uint16_t paramValue)
+{
+	if (paramID == TGAP_GEN_DISC_ADV_INT_MIN)
+		role.advIntMin = paramValue;
+	return SUCCESS;
+}
+
+/**
+ * GAP_MakeDiscoverable with the parameters of the moment, checked against the phase.
+ */
+static void roleStartAdvertising(void)
+{
+	Adv_phase phase = advPolicy_phase();
+	uint16_t wantInt;
+	char detail[64];
+
+	//Restarted on a link drop before the application heard of it: the phase prepared
+	if (phase == ADV_PHASE_NONE && !linkUp)
+		phase = bonded ? ADV_PHASE_DIRECTED : ADV_PHASE_FAST;
+
+	role.onType = role.nonConnEnabled ? GAP_ADTYPE_ADV_NONCONN_IND : role.eventType;
+	role.onIntUs = (role.onType == GAP_ADTYPE_ADV_HDC_DIRECT_IND) ? HDC_EVENT_US : role.advIntMin * 625;
+	role.onStartUs = role.nextAdvUs = shim_nowUs();
+	role.on = 1;
+	role.evt = ROLE_EVT_MAKE_DONE;
+
+	if (role.onType == GAP_ADTYPE_ADV_NONCONN_IND) {
+		snprintf(detail, sizeof(detail), "non-connectable, %.1f ms", role.onIntUs / 1000.0);
+		note("advertising", detail);
+		if (linkUp && role.advIntMin != ADV_POLICY_BCAST_INT)
+			fail("broadcast interval while connected", role.advIntMin, ADV_POLICY_BCAST_INT);
+		return;
+	}
+	snprintf(detail, sizeof(detail), "%s, %.1f ms", phaseNames[phase],
+			 (role.onType == GAP_ADTYPE_ADV_HDC_DIRECT_IND) ? 3.75 : role.onIntUs / 1000.0);
+	note("advertising", detail);
+
+	if (dropped && firstPhase == ADV_PHASE_NONE)
+		firstPhase = phase;
+	if (phase == ADV_PHASE_DIRECTED) {
+		if (role.onType != GAP_ADTYPE_ADV_HDC_DIRECT_IND)
+			fail("directed phase, event type", role.onType, GAP_ADTYPE_ADV_HDC_DIRECT_IND);
+		if (memcmp(role.directAddr, centralAddr, B_ADDR_LEN) || role.directType != ADDRTYPE_PUBLIC)
+			fail("directed to another address", role.directAddr[0], centralAddr[0]);
+		return;
+	}
+	wantInt = (phase == ADV_PHASE_SLOW) ? ADV_POLICY_SLOW_INT : ADV_POLICY_FAST_INT;
+	if (role.onType != GAP_ADTYPE_ADV_IND || role.advIntMin != wantInt)
+		fail("undirected type or interval", role.onType, role.advIntMin);
+	if (dropped && phase == ADV_PHASE_FAST && !fastStartUs)
+		fastStartUs = shim_nowUs();
+	if (dropped && phase == ADV_PHASE_SLOW && !slowStartUs)
+		slowStartUs = shim_nowUs();
+}
+
+static void roleStep(void)
+{
+	Role_evt evt = role.evt;
+
+	role.evt = ROLE_EVT_NONE;
+	if (evt == ROLE_EVT_MAKE_DONE) {
+		if (role.state == GAPROLE_CONNECTED)
+			roleNotify(GAPROLE_CONNECTED_ADV);
+		else if (role.advEnabled)
+			roleNotify(GAPROLE_ADVERTISING);
+		else
+			roleNotify(GAPROLE_ADVERTISING_NONCONN);
+	} else if (evt == ROLE_EVT_END_DONE) {
+		if (role.advEnabled || role.nonConnEnabled)
+			role.startAdvClockUs = shim_nowUs() + ADVERT_OFF_TIME_MS * 1000ull;
+		roleNotify((role.state == GAPROLE_CONNECTED_ADV) ? GAPROLE_CONNECTED : GAPROLE_WAITING);
+	}
+
+	if (role.startAdvClockUs && shim_nowUs() >= role.startAdvClockUs) {
+		role.startAdvClockUs = 0;
+		role.startEvt = 1;
+	}
+	if (role.startEvt) {
+		role.startEvt = 0;
+		if (role.advEnabled || role.nonConnEnabled)
+			roleStartAdvertising();
+	}
+
+	//The controller ends high duty cycle directed advertising, the link is not
+	//established (bleGAPConnNotAcceptable)
+	if (role.on && role.onType == GAP_ADTYPE_ADV_HDC_DIRECT_IND &&
+			shim_nowUs() - role.onStartUs >= HDC_TIMEOUT_US) {
+		role.on = 0;
+		role.advEnabled = 0;
+		note("directed advertising timed out", NULL);
+		roleNotify(GAPROLE_WAITING);
+	}
+}
+
+static void roleLinkUp(void)
+{
+	role.on = 0;
+	roleNotify(GAPROLE_CONNECTED);
+}
+
+static void roleLinkDown(void)
+{
+	if (role.nonConnEnabled) {
+		roleNotify(GAPROLE_ADVERTISING_NONCONN);
+	} else {
+		roleNotify(GAPROLE_WAITING_AFTER_TIMEOUT);
+		role.startEvt = 1;
+	}
+}
+
+//**********************************************************************************
+// FlexZone.c
+//**********************************************************************************
+//user_bcastConnectedAdv
+static void bcastConnectedAdv(uint8_t enable)
+{
+	uint8_t value = FALSE;
+
+	if (enable) {
+		GAPRole_SetParameter(GAPROLE_ADVERT_ENABLED, sizeof(uint8_t), &value);
+		advPolicy_setBroadcasting(TRUE);
+		value = TRUE;
+		GAPRole_SetParameter(GAPROLE_ADV_NONCONN_ENABLED, sizeof(uint8_t), &value);
+	} else {
+		GAPRole_SetParameter(GAPROLE_ADV_NONCONN_ENABLED, sizeof(uint8_t), &value);
+		advPolicy_setBroadcasting(FALSE);
+		bcastRestoreAdv = TRUE;
+	}
+}
+
+//user_bcastRestoreConnectable
+static void bcastRestoreConnectable(void)
+{
+	uint8_t advEnable = TRUE;
+
+	if (bcastRestoreAdv) {
+		GAPRole_SetParameter(GAPROLE_ADVERT_ENABLED, sizeof(uint8_t), &advEnable);
+		bcastRestoreAdv = FALSE;
+	}
+}
+
+//user_processStateChangeEvt, the advertising part
+static void appStateChange(gaprole_States_t newState)
+{
+	switch (newState) {
+	case GAPROLE_ADVERTISING:
+		advPolicy_advertising();
+		break;
+	case GAPROLE_CONNECTED:
+		if (appState == GAPROLE_CONNECTED_ADV) {
+			bcastRestoreConnectable();
+			break;
+		}
+		advPolicy_connected(centralAddr, ADDRTYPE_PUBLIC);
+		if (bcastOn)
+			bcastConnectedAdv(TRUE);
+		break;
+	case GAPROLE_ADVERTISING_NONCONN:
+		advPolicy_disconnected();
+		bcastConnectedAdv(FALSE);
+		break;
+	case GAPROLE_WAITING:
+	case GAPROLE_WAITING_AFTER_TIMEOUT:
+		if (appState == GAPROLE_CONNECTED || appState == GAPROLE_CONNECTED_ADV)
+			advPolicy_disconnected();
+		bcastRestoreConnectable();
+		advPolicy_waiting();
+		break;
+	default:
+		break;
+	}
+	appState = newState;
+}
+
+static void policyPost(void)
+{
+	policyPosted = 1;
+}
+
+//**********************************************************************************
+// Scenario
+//**********************************************************************************
+/**
+ * Advertising events due, the central connecting on one it hears.
+ */
+static void airStep(void)
+{
+	while (role.on && role.nextAdvUs <= shim_nowUs()) {
+		uint8_t connectable = role.onType == GAP_ADTYPE_ADV_IND ||
+				(role.onType == GAP_ADTYPE_ADV_HDC_DIRECT_IND &&
+				 !memcmp(role.directAddr, centralAddr, B_ADDR_LEN));
+
+		if (!linkUp)
+			advEvents++;
+		role.nextAdvUs += role.onIntUs +
+				((role.onType == GAP_ADTYPE_ADV_HDC_DIRECT_IND) ? 0 : rnd(ADV_DELAY_MAX_US + 1));
+		if (connectable && centralHere && !linkUp && rnd(100) < sc->scanDuty) {
+			Adv_phase phase = advPolicy_phase();
+
+			linkUp = 1;
+			connects++;
+			connectedUs = shim_nowUs();
+			if (dropped) {
+				char detail[64];
+
+				snprintf(detail, sizeof(detail), "in the %s phase", phaseNames[phase]);
+				note("reconnected", detail);
+				if (phase != sc->expectPhase)
+					fail("reconnected in phase", phase, sc->expectPhase);
+			} else {
+				note("connected", NULL);
+			}
+			roleLinkUp();
+		}
+	}
+}
+
+static int run(const Scenario *pScenario)
+{
+	uint8_t enable = TRUE;
+	uint64_t endUs = (DROP_AT_MS + pScenario->awayMs + RECONNECT_LIMIT_MS) * 1000ull;
+	uint32_t i;
+
+	sc = pScenario;
+	printf("%s\n", sc->name);
+
+	//FlexZone_init: advertising enabled, then the role starts
+	advPolicy_init(policyPost);
+	role.state = GAPROLE_INIT;
+	GAPRole_SetParameter(GAPROLE_ADVERT_ENABLED, sizeof(uint8_t), &enable);
+	roleNotify(GAPROLE_STARTED);
+	role.startEvt = 1;
+
+	while (shim_nowUs() < endUs && !(dropped && linkUp)) {
+		shim_advanceUs(STEP_US);
+		centralHere = nowMs() >= CONNECT_AT_MS && (!dropped || shim_nowUs() >= backUs);
+
+		roleStep();
+		airStep();
+
+		//BLE task: state changes, then the other messages
+		for (i = 0; i < numStateMsgs; i++)
+			appStateChange(stateMsgs[i]);
+		numStateMsgs = 0;
+		if (policyPosted) {
+			policyPosted = 0;
+			advPolicy_evaluate();
+			note("fast burst over", NULL);
+		}
+
+		if (linkUp && sc->bonded && !bonded && shim_nowUs() - connectedUs >= BOND_AFTER_MS * 1000) {
+			bonded = 1;
+			note("bonded", NULL);
+			advPolicy_bonded();
+		}
+		if (linkUp && sc->broadcasting && !bcastOn &&
+				shim_nowUs() - connectedUs >= BCAST_AFTER_MS * 1000) {
+			bcastOn = 1;
+			note("broadcasting", NULL);
+			bcastConnectedAdv(TRUE);
+		}
+		if (linkUp && !dropped && nowMs() >= DROP_AT_MS) {
+			dropped = 1;
+			linkUp = 0;
+			bcastOn = 0;
+			dropUs = shim_nowUs();
+			backUs = dropUs + sc->awayMs * 1000ull;
+			silentSinceUs = dropUs;
+			note("link lost, supervision timeout", NULL);
+			roleLinkDown();
+		}
+
+		//Silence while disconnected
+		if (dropped && !linkUp) {
+			if (role.on || shim_nowUs() < silentSinceUs)
+				silentSinceUs = shim_nowUs();
+			else if (shim_nowUs() - silentSinceUs > longestSilenceUs)
+				longestSilenceUs = shim_nowUs() - silentSinceUs;
+		}
+	}
+
+	if (!dropped)
+		fail("never connected before the drop", 0, 0);
+	if (firstPhase != (sc->bonded ? ADV_PHASE_DIRECTED : ADV_PHASE_FAST))
+		fail("first phase after the drop", firstPhase, sc->bonded ? ADV_PHASE_DIRECTED : ADV_PHASE_FAST);
+	if (fastStartUs && slowStartUs && (slowStartUs - fastStartUs < ADV_POLICY_FAST_MS * 1000ull ||
+			slowStartUs - fastStartUs > (ADV_POLICY_FAST_MS + FAST_MS_SLACK) * 1000ull))
+		fail("fast burst length", (uint32_t)((slowStartUs - fastStartUs) / 1000), ADV_POLICY_FAST_MS);
+	if (longestSilenceUs > MAX_SILENCE_MS * 1000)
+		fail("not advertising while disconnected, ms", (uint32_t)(longestSilenceUs / 1000), MAX_SILENCE_MS);
+	if (!(dropped && linkUp))
+		fail("no reconnect", 0, 0);
+
+	printf("  => reconnected %.0f ms after the drop, %.0f ms after the central came back, "
+			"%u advertising events, longest silence %.0f ms\n",
+			(connectedUs - dropUs) / 1000.0, (connectedUs - MIN(connectedUs, backUs)) / 1000.0,
+			advEvents, longestSilenceUs / 1000.0);
+	if (failures)
+		printf("  %u failures\n", failures);
+	return failures ? 1 : 0;
+}
+
+int main(void)
+{
+	uint32_t i, failed = 0;
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		pid_t pid;
+		int status;
+
+		fflush(stdout);
+		pid = fork();
+		if (pid == 0) {
+			rngState += i;
+			exit(run(&scenarios[i]));
+		}
+		if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+				WEXITSTATUS(status))
+			failed++;
+	}
+	printf("\n%u failed scenarios\n", failed);
+	return failed ? 1 : 0;
+}
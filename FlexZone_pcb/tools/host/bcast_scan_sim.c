@@ -0,0 +1,268 @@
+/*
+ * A scanner among several FlexZones broadcasting their live status (the manufacturer
+ * specific data of advertData in FlexZone.c, written by user_updateBroadcast), as a
+ * capture for bcast_decode.py, plus every status update as JSON lines to compare
+ * against.
+ *
+ *     bcast_scan_sim <seed> <devices> <seconds> <updates.jsonl> > capture.txt
+ *
+ * Each device runs a workout of its own and refreshes its status every broadcast
+ * period, 200 to 1000 ms depending on the device. An update goes out with the next
+ * advertising event. Half the devices are connected and advertise non-connectable
+ * every ADV_POLICY_BCAST_INT, the others connectable every ADV_POLICY_SLOW_INT, each
+ * event on channels 37, 38 and 39 after the 0 to 10 ms advDelay. A foreign beacon
+ * advertises in between.
+ *
+ * The scanner listens SCAN_WINDOW_MS of every SCAN_INTERVAL_MS, one channel per
+ * interval in turn, like a phone in its low latency scan mode. A PDU is received when
+ * it lies inside a window on the scanned channel, overlaps no other PDU on that channel
+ * and escapes the random loss. Capture lines are the receive time in seconds and the
+ * PDU payload: AdvA, least significant byte first as on air, then AdvData.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ADDR_LEN							6
+#define ADV_DATA_MAX						31
+#define STATUS_LEN							6			//USER_BCAST_STATUS_LEN
+
+#define BCAST_FLAG_ACTIVE					0x01
+#define BCAST_FLAG_WORKOUT					0x02
+#define BCAST_FLAG_CONNECTED				0x04
+
+//adv_policy.h, in 0.625 ms
+#define ADV_BCAST_US						(320 * 625)
+#define ADV_SLOW_US							(1636 * 625)
+#define ADV_DELAY_MAX_US					10000
+#define CH_STEP_US							600			//PDU and channel switch
+#define PDU_OVERHEAD						10			//Preamble, access address, header, CRC
+#define US_PER_BYTE							8
+
+#define SCAN_INTERVAL_MS					100
+#define SCAN_WINDOW_MS						50
+#define LOSS_PERCENT						3
+
+typedef struct {
+	uint8_t addr[ADDR_LEN];
+	uint32_t periodMs;
+	uint32_t advUs;
+	uint8_t connected;
+
+	//Workout
+	uint64_t nextRepUs;
+	uint8_t sets;
+	uint8_t reps;
+	uint8_t setLen;
+	uint16_t peak;
+
+	uint8_t seq;
+	uint8_t adv[ADV_DATA_MAX];
+	uint8_t advLen;
+} Device;
+
+typedef struct {
+	uint64_t us;
+	uint8_t ch;
+	uint8_t lost;
+	uint8_t len;
+	uint8_t pdu[ADDR_LEN + ADV_DATA_MAX];
+} Pdu;
+
+//advertData of FlexZone.c with the status cleared
+static const uint8_t flexZoneAdv[] = {
+	0x02, 0x01, 0x06,
+	10, 0x09, 'F', 'l', 'e', 'x', 'Z', 'o', 'n', 'e', 'D',
+	1 + 4 + STATUS_LEN, 0xFF, 0x11, 0x11, 0x40, 0x11,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+//Non-connectable beacon of another vendor
+static const uint8_t beaconAdv[] = {
+	0x02, 0x01, 0x04,
+	0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15,
+	0xE2, 0xC5, 0x6D, 0xB5, 0xDF, 0xFB, 0x48, 0xD2, 0xB0, 0x60, 0xD0, 0xF5, 0xA7, 0x10, 0x96, 0xE0,
+	0x00, 0x01, 0x00, 0x02, 0xC5
+};
+
+static uint32_t rngState;
+static Pdu *pdus;
+static uint32_t numPdus, maxPdus;
+static FILE *updates;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void addPdu(uint64_t us, uint8_t ch, const uint8_t *pAddr, const uint8_t *pAdv, uint8_t advLen)
+{
+	Pdu *p;
+
+	if (numPdus == maxPdus) {
+		maxPdus = maxPdus ? 2 * maxPdus : 4096;
+		pdus = realloc(pdus, maxPdus * sizeof(Pdu));
+	}
+	p = &pdus[numPdus++];
+	p->us = us;
+	p->ch = ch;
+	p->lost = 0;
+	p->len = ADDR_LEN + advLen;
+	memcpy(p->pdu, pAddr, ADDR_LEN);
+	memcpy(&p->pdu[ADDR_LEN], pAdv, advLen);
+}
+
+static void advEvent(uint64_t us, const uint8_t *pAddr, const uint8_t *pAdv, uint8_t advLen)
+{
+	uint8_t ch;
+
+	for (ch = 0; ch < 3; ch++)
+		addPdu(us + ch * CH_STEP_US, ch, pAddr, pAdv, advLen);
+}
+
+/**
+ * Reps every 1.5 to 4 s in sets of 8 to 12, 20 to 40 s of rest between sets.
+ */
+static void runWorkout(Device *d, uint64_t us)
+{
+	while (d->nextRepUs <= us) {
+		d->reps++;
+		d->peak = 800 + rnd(3200);
+		if (d->reps == d->setLen) {
+			d->sets++;
+			d->reps = 0;
+			d->setLen = 8 + rnd(5);
+			d->nextRepUs += (20000 + rnd(20000)) * 1000ull;
+		} else {
+			d->nextRepUs += (1500 + rnd(2500)) * 1000ull;
+		}
+	}
+}
+
+//user_updateBroadcast
+static void update(Device *d, uint64_t us)
+{
+	uint8_t *pStatus = &d->adv[d->advLen - STATUS_LEN];
+	uint32_t i;
+
+	runWorkout(d, us);
+	pStatus[0] = d->seq++;
+	pStatus[1] = BCAST_FLAG_ACTIVE | BCAST_FLAG_WORKOUT | (d->connected ? BCAST_FLAG_CONNECTED : 0);
+	pStatus[2] = d->sets;
+	pStatus[3] = d->reps;
+	pStatus[4] = d->peak & 0xFF;
+	pStatus[5] = d->peak >> 8;
+
+	fprintf(updates, "{\"addr\": \"");
+	for (i = ADDR_LEN; i-- > 0;)
+		fprintf(updates, i ? "%02x:" : "%02x", d->addr[i]);
+	fprintf(updates, "\", \"t\": %.6f, \"seq\": %u, \"flags\": %u, \"sets\": %u, \"reps\": %u, "
+			"\"peak\": %u, \"period_ms\": %u, \"adv_ms\": %.1f}\n", us / 1e6, pStatus[0], pStatus[1],
+			d->sets, d->reps, d->peak, d->periodMs, d->advUs / 1e3);
+}
+
+static int cmpPdu(const void *a, const void *b)
+{
+	uint64_t x = ((const Pdu *)a)->us, y = ((const Pdu *)b)->us;
+
+	return (x > y) - (x < y);
+}
+
+static uint32_t airUs(const Pdu *p)
+{
+	return (PDU_OVERHEAD + p->len) * US_PER_BYTE;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t numDevices, n, i, j;
+	uint32_t collided = 0, missed = 0, lost = 0, received = 0;
+	uint64_t endUs, us, tick;
+
+	if (argc != 5) {
+		fprintf(stderr, "bcast_scan_sim <seed> <devices> <seconds> <updates.jsonl> > capture.txt\n");
+		return 2;
+	}
+	rngState = strtoul(argv[1], NULL, 0) | 1;
+	numDevices = strtoul(argv[2], NULL, 0);
+	endUs = strtoull(argv[3], NULL, 0) * 1000000ull;
+	updates = fopen(argv[4], "w");
+	if (updates == NULL) {
+		perror(argv[4]);
+		return 2;
+	}
+
+	//Advertising of every device, status updates in between
+	for (n = 0; n < numDevices; n++) {
+		Device d;
+
+		memset(&d, 0, sizeof(d));
+		d.addr[0] = n;
+		d.addr[1] = rnd(256);
+		d.addr[2] = rnd(256);
+		d.addr[3] = 0x40;
+		d.addr[4] = 0x11;
+		d.addr[5] = 0xB0;
+		d.periodMs = (2 + n % 9) * 100;
+		d.connected = n & 1;
+		d.advUs = d.connected ? ADV_BCAST_US : ADV_SLOW_US;
+		d.nextRepUs = (5000 + rnd(20000)) * 1000ull;
+		d.setLen = 8 + rnd(5);
+		memcpy(d.adv, flexZoneAdv, sizeof(flexZoneAdv));
+		d.advLen = sizeof(flexZoneAdv);
+
+		//Broadcasting turned on, user_setBroadcast publishes at once
+		tick = rnd(2000) * 1000ull;
+		us = rnd(d.advUs);
+		while (us < endUs) {
+			while (tick <= us) {
+				update(&d, tick);
+				tick += d.periodMs * 1000ull;
+			}
+			advEvent(us, d.addr, d.adv, d.advLen);
+			us += d.advUs + rnd(ADV_DELAY_MAX_US + 1);
+		}
+	}
+	{
+		const uint8_t beaconAddr[ADDR_LEN] = { 0x5A, 0x3C, 0x02, 0x9E, 0x71, 0xC4 };
+
+		for (us = rnd(100000); us < endUs; us += 100000 + rnd(ADV_DELAY_MAX_US + 1))
+			advEvent(us, beaconAddr, beaconAdv, sizeof(beaconAdv));
+	}
+	fclose(updates);
+
+	//Two PDUs on one channel at once: neither is received
+	qsort(pdus, numPdus, sizeof(Pdu), cmpPdu);
+	for (i = 0; i < numPdus; i++)
+		for (j = i + 1; j < numPdus && pdus[j].us < pdus[i].us + airUs(&pdus[i]); j++)
+			if (pdus[j].ch == pdus[i].ch)
+				pdus[i].lost = pdus[j].lost = 1;
+
+	for (i = 0; i < numPdus; i++) {
+		Pdu *p = &pdus[i];
+		uint64_t scan = p->us / (SCAN_INTERVAL_MS * 1000);
+		uint64_t windowEnd = scan * SCAN_INTERVAL_MS * 1000 + SCAN_WINDOW_MS * 1000;
+
+		if (p->lost) {
+			collided++;
+		} else if (scan % 3 != p->ch || p->us + airUs(p) > windowEnd) {
+			missed++;
+		} else if (rnd(100) < LOSS_PERCENT) {
+			lost++;
+		} else {
+			received++;
+			printf("%.6f,", (p->us + airUs(p)) / 1e6);
+			for (j = 0; j < p->len; j++)
+				printf("%02x", p->pdu[j]);
+			printf("\n");
+		}
+	}
+
+	fprintf(stderr, "%u devices, %u PDUs: %u collided, %u outside the scan, %u lost, %u received\n",
+			numDevices, numPdus, collided, missed, lost, received);
+	return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Accuracy and cost of the exercise classifier as built into the firmware: runs
+ * classifier.c with the in-tree classifier_model.h over the held-out windows and
+ * reports the confusion matrix, the rejection rate, the work per call and the host
+ * time per call.
+ *
+ *     classifier_bench --synth
+ *     classifier_bench --csv sets.csv
+ *
+ * The on-target cycle count comes from building the application with
+ * CLASSIFIER_BENCH defined, see classifier.c.
+ */
+#include "classifier_data.hpp"
+
+#include <chrono>
+
+extern "C" {
+#include "classifier_model.h"
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<Window> windows;
+	unsigned confusion[CLASSIFIER_NUM_CLASSES][CLASSIFIER_NUM_CLASSES + 1] = { { 0 } };
+	unsigned tested = 0, correct = 0, rejected = 0;
+
+	if (argc == 2 && !strcmp(argv[1], "--synth"))
+		synthWindows(2, 100, windows);		//Different seed from training
+	else if (argc == 3 && !strcmp(argv[1], "--csv")) {
+		if (!loadWindows(argv[2], windows))
+			return 1;
+	} else {
+		fprintf(stderr, "usage: classifier_bench (--synth | --csv sets.csv)\n");
+		return 2;
+	}
+
+	for (size_t w = 0; w < windows.size(); w++) {
+		const Window &win = windows[w];
+		int8_t x[CLASSIFIER_NUM_FEATURES];
+		if (!isHeldOut(win) || !windowFeatures(win, x))
+			continue;
+
+		uint8_t result = classifier_run(win.peak, win.widthMs);
+		int col = result == EXERCISE_UNKNOWN ? CLASSIFIER_NUM_CLASSES : result;
+		confusion[win.label][col]++;
+		tested++;
+		correct += result == win.label;
+		rejected += result == EXERCISE_UNKNOWN;
+	}
+	if (!tested) {
+		fprintf(stderr, "no held-out windows\n");
+		return 1;
+	}
+
+	printf("held-out windows  %u\n", tested);
+	printf("accuracy          %.1f %% (%u rejected as unknown)\n", 100.0 * correct / tested, rejected);
+	printf("confusion         rows true, columns curl press squat row unknown\n");
+	for (int k = 0; k < CLASSIFIER_NUM_CLASSES; k++) {
+		printf("  %-6s         ", exerciseNames[k]);
+		for (int c = 0; c <= CLASSIFIER_NUM_CLASSES; c++)
+			printf(" %5u", confusion[k][c]);
+		printf("\n");
+	}
+
+	const unsigned macs = CLASSIFIER_NUM_FEATURES * CLASSIFIER_NUM_HIDDEN +
+			CLASSIFIER_NUM_HIDDEN * CLASSIFIER_NUM_CLASSES;
+	printf("work per call     %u MACs, %zu B of tables, 26 B of window RAM\n", macs,
+			sizeof(classifierW1) + sizeof(classifierB1) + sizeof(classifierW2) + sizeof(classifierB2));
+
+	//The last held-out window is still in the feature window
+	const int calls = 1000000;
+	volatile uint8_t sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < calls; i++)
+		sink ^= classifier_run((uint16_t)(1000 + (i & 0x3FF)), 1200);
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	printf("host time         %.1f ns per call\n", ns / calls);
+
+	return correct * 10 >= tested * 9 ? 0 : 1;
+}
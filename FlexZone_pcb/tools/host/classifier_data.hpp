@@ -0,0 +1,215 @@
+/*
+ * Labelled first-rep windows for the exercise classifier tools: loaded from recorded
+ * sets or generated, and turned into model inputs by the firmware's own feature code.
+ *
+ * Recorded sets are CSV, one IMU sample of the first rep per line, raw MPU9250 counts
+ * at the power-on ranges (+-2 g, +-250 dps), e.g. from accel_stream_decode.py --csv
+ * with the set and EMG columns added:
+ *
+ *     set_id,exercise,peak,width_ms,accel_x,accel_y,accel_z,gyro_x,gyro_y,gyro_z
+ *
+ * exercise is an EXERCISE_* number or one of curl, press, squat, row.
+ *
+ * The generator models a sensor on the working muscle: gravity in the sensor frame
+ * follows the limb orientation of each exercise, turned by a random placement error,
+ * gyro energy and EMG peak/width follow per-exercise distributions. It is a stand-in
+ * until recordings exist and says nothing about real-world accuracy.
+ */
+#ifndef CLASSIFIER_DATA_HPP
+#define CLASSIFIER_DATA_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "classifier.h"
+}
+
+struct ImuSample {
+	int16_t v[6];		//accel XYZ, gyro XYZ
+};
+
+struct Window {
+	int setId;
+	int label;			//EXERCISE_*
+	uint16_t peak;
+	uint16_t widthMs;
+	std::vector<ImuSample> samples;
+};
+
+static const char *const exerciseNames[CLASSIFIER_NUM_CLASSES] = { "curl", "press", "squat", "row" };
+
+static inline int parseExercise(const std::string &text)
+{
+	for (int i = 0; i < CLASSIFIER_NUM_CLASSES; i++)
+		if (text == exerciseNames[i])
+			return i;
+	char *end;
+	long id = strtol(text.c_str(), &end, 10);
+	if (*end || id < 0 || id >= CLASSIFIER_NUM_CLASSES)
+		return -1;
+	return (int)id;
+}
+
+static inline bool loadWindows(const char *path, std::vector<Window> &out)
+{
+	std::ifstream in(path);
+	std::map<int, size_t> bySet;
+	std::string line;
+	int num = 0;
+
+	if (!in) {
+		fprintf(stderr, "%s: cannot open\n", path);
+		return false;
+	}
+	while (std::getline(in, line)) {
+		num++;
+		if (line.empty() || line[0] == '#' || line.compare(0, 6, "set_id") == 0)
+			continue;
+
+		std::stringstream ss(line);
+		std::string field[10];
+		int n = 0;
+		while (n < 10 && std::getline(ss, field[n], ','))
+			n++;
+		int label = n == 10 ? parseExercise(field[1]) : -1;
+		if (label < 0) {
+			fprintf(stderr, "%s:%d: not a sample line\n", path, num);
+			return false;
+		}
+
+		int setId = atoi(field[0].c_str());
+		if (!bySet.count(setId)) {
+			Window w;
+			w.setId = setId;
+			w.label = label;
+			w.peak = (uint16_t)atoi(field[2].c_str());
+			w.widthMs = (uint16_t)atoi(field[3].c_str());
+			bySet[setId] = out.size();
+			out.push_back(w);
+		}
+		ImuSample s;
+		for (int i = 0; i < 6; i++)
+			s.v[i] = (int16_t)atoi(field[4 + i].c_str());
+		out[bySet[setId]].samples.push_back(s);
+	}
+	return true;
+}
+
+struct ExerciseModel {
+	double gravity[3];		//Unit vector of the mean accel reading in the sensor frame
+	double gyroDps[3];		//Mean absolute rate per axis over the rep
+	double peak, peakSd;	//ADC counts
+	double widthMs, widthSd;
+};
+
+static const ExerciseModel exerciseModels[CLASSIFIER_NUM_CLASSES] = {
+	//Curl, on the biceps: upper arm hangs and barely turns, the forearm does the work
+	{ { -0.95, 0.10, 0.25 }, { 10, 25, 8 }, 2300, 450, 1300, 300 },
+	//Press, on the deltoid: upper arm swings from horizontal to vertical
+	{ { 0.45, 0.15, -0.85 }, { 15, 95, 20 }, 1900, 450, 1500, 350 },
+	//Squat, on the quadriceps: thigh from vertical to near horizontal
+	{ { -0.60, 0.05, -0.75 }, { 10, 70, 12 }, 2700, 500, 2100, 400 },
+	//Row, on the lats: torso bent over, arm pulls back
+	{ { 0.10, -0.70, 0.65 }, { 35, 20, 15 }, 2000, 450, 1300, 300 },
+};
+
+static inline void rotate(double v[3], double ax, double ay, double az)
+{
+	double x = v[0], y = v[1], z = v[2], t;
+
+	t = y * cos(ax) - z * sin(ax); z = y * sin(ax) + z * cos(ax); y = t;
+	t = x * cos(ay) + z * sin(ay); z = -x * sin(ay) + z * cos(ay); x = t;
+	t = x * cos(az) - y * sin(az); y = x * sin(az) + y * cos(az); x = t;
+	v[0] = x; v[1] = y; v[2] = z;
+}
+
+static inline int16_t clamp16(double v)
+{
+	if (v > 32767)
+		return 32767;
+	if (v < -32768)
+		return -32768;
+	return (int16_t)lrint(v);
+}
+
+/**
+ * Generates windows, perClass for each exercise, from a seed.
+ */
+static inline void synthWindows(unsigned seed, int perClass, std::vector<Window> &out)
+{
+	const double accelPerG = 16384.0, gyroPerDps = 131.0, placementRad = 20.0 * M_PI / 180;
+	const int checkMs = 300;		//ACCEL_PERIOD_IN_MS, motion check samples of the rep
+	std::mt19937 rng(seed);
+	std::normal_distribution<double> unit(0.0, 1.0);
+	std::uniform_real_distribution<double> place(-placementRad, placementRad);
+
+	for (int label = 0; label < CLASSIFIER_NUM_CLASSES; label++) {
+		const ExerciseModel &m = exerciseModels[label];
+		for (int k = 0; k < perClass; k++) {
+			Window w;
+			double g[3] = { m.gravity[0], m.gravity[1], m.gravity[2] };
+			double scale[3];
+
+			w.setId = (int)out.size();
+			w.label = label;
+			w.peak = (uint16_t)std::min(4095.0, std::max(200.0, m.peak + m.peakSd * unit(rng)));
+			w.widthMs = (uint16_t)std::max(300.0, m.widthMs + m.widthSd * unit(rng));
+			rotate(g, place(rng), place(rng), place(rng));
+			for (int i = 0; i < 3; i++)
+				scale[i] = std::max(0.2, 1.0 + 0.3 * unit(rng));
+
+			int n = std::max(2, (int)w.widthMs / checkMs);
+			for (int s = 0; s < n; s++) {
+				ImuSample smp;
+				double phase = sin(M_PI * (s + 0.5) / n);		//Limb speed over the rep
+				for (int i = 0; i < 3; i++) {
+					double a = g[i] + 0.15 * unit(rng);
+					double rate = m.gyroDps[i] * scale[i] * phase * (M_PI / 2) + 5 * unit(rng);
+					smp.v[i] = clamp16(a * accelPerG);
+					smp.v[3 + i] = clamp16((unit(rng) < 0 ? -rate : rate) * gyroPerDps);
+				}
+				w.samples.push_back(smp);
+			}
+			out.push_back(w);
+		}
+	}
+}
+
+/**
+ * Model inputs of a window, computed by classifier.c.
+ */
+static inline bool windowFeatures(const Window &w, int8_t x[CLASSIFIER_NUM_FEATURES])
+{
+	classifier_reset();
+	for (size_t i = 0; i < w.samples.size(); i++) {
+		Accel_State s;
+		s.ACCEL_X = (uint16_t)w.samples[i].v[0];
+		s.ACCEL_Y = (uint16_t)w.samples[i].v[1];
+		s.ACCEL_Z = (uint16_t)w.samples[i].v[2];
+		s.GYRO_X = (uint16_t)w.samples[i].v[3];
+		s.GYRO_Y = (uint16_t)w.samples[i].v[4];
+		s.GYRO_Z = (uint16_t)w.samples[i].v[5];
+		classifier_addImuSample(&s);
+	}
+	return classifier_features(w.peak, w.widthMs, x) != 0;
+}
+
+/**
+ * Sets with set_id % 5 == 4 are held out for testing.
+ */
+static inline bool isHeldOut(const Window &w)
+{
+	return w.setId % 5 == 4;
+}
+
+#endif /* CLASSIFIER_DATA_HPP */
@@ -0,0 +1,340 @@
+/*
+ * Trains the 8-8-4 exercise classifier and exports it as classifier_model.h.
+ *
+ * Inputs are the firmware's own int8 features (classifier_features() in classifier.c)
+ * of labelled first-rep windows, see classifier_data.hpp. The float model is trained
+ * with softmax cross entropy and Adam from a fixed seed, then quantised to the layout
+ * classifier_run() evaluates:
+ *
+ *     hidden = clamp((W1*x + B1) >> CLASSIFIER_L1_SHIFT, 0, 127)
+ *     scores = W2*hidden + B2, arg max if it reaches CLASSIFIER_MIN_SCORE
+ *
+ * W1 takes the largest scale that fits int8; the shift brings the largest hidden
+ * activation seen in training back under 127. W2 is scaled the same way. The
+ * rejection threshold is the 1st percentile of the winning score of correctly
+ * classified training windows.
+ *
+ *     classifier_train --synth -o ../../FlexZoneApp/Application/classifier_model.h
+ *     classifier_train --csv sets.csv -o model.h
+ *
+ * classifier_bench measures the exported model on the held-out windows.
+ */
+#include "classifier_data.hpp"
+
+#include <algorithm>
+
+static const int NI = CLASSIFIER_NUM_FEATURES;
+static const int NH = CLASSIFIER_NUM_HIDDEN;
+static const int NO = CLASSIFIER_NUM_CLASSES;
+static const double INPUT_SCALE = 1.0 / 64;		//Float model sees x / 64
+
+struct Sample {
+	double x[NI];
+	int8_t q[NI];
+	int label;
+};
+
+struct Model {
+	double w1[NH][NI], b1[NH];
+	double w2[NO][NH], b2[NO];
+};
+
+struct QModel {
+	int8_t w1[NH][NI];
+	int32_t b1[NH];
+	int8_t w2[NO][NH];
+	int32_t b2[NO];
+	int shift;
+	int32_t minScore;
+};
+
+static void forward(const Model &m, const double *x, double *h, double *p)
+{
+	double max = -1e30, sum = 0;
+
+	for (int j = 0; j < NH; j++) {
+		double a = m.b1[j];
+		for (int i = 0; i < NI; i++)
+			a += m.w1[j][i] * x[i];
+		h[j] = a > 0 ? a : 0;
+	}
+	for (int k = 0; k < NO; k++) {
+		double a = m.b2[k];
+		for (int j = 0; j < NH; j++)
+			a += m.w2[k][j] * h[j];
+		p[k] = a;
+		max = std::max(max, a);
+	}
+	for (int k = 0; k < NO; k++) {
+		p[k] = exp(p[k] - max);
+		sum += p[k];
+	}
+	for (int k = 0; k < NO; k++)
+		p[k] /= sum;
+}
+
+static void train(Model &m, const std::vector<Sample> &data, int epochs, unsigned seed)
+{
+	const int n = sizeof(Model) / sizeof(double);
+	const double rate = 0.01, beta1 = 0.9, beta2 = 0.999, eps = 1e-8;
+	std::vector<double> mom(n, 0), vel(n, 0);
+	std::vector<size_t> order(data.size());
+	std::mt19937 rng(seed);
+	std::normal_distribution<double> init(0.0, 1.0);
+	double *w = reinterpret_cast<double *>(&m);
+	int step = 0;
+
+	for (int j = 0; j < NH; j++) {
+		for (int i = 0; i < NI; i++)
+			m.w1[j][i] = init(rng) * sqrt(2.0 / NI);
+		m.b1[j] = 0.1;
+	}
+	for (int k = 0; k < NO; k++) {
+		for (int j = 0; j < NH; j++)
+			m.w2[k][j] = init(rng) * sqrt(1.0 / NH);
+		m.b2[k] = 0;
+	}
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+
+	for (int epoch = 0; epoch < epochs; epoch++) {
+		std::shuffle(order.begin(), order.end(), rng);
+		for (size_t start = 0; start < order.size(); start += 32) {
+			Model g;
+			double *gw = reinterpret_cast<double *>(&g);
+			size_t end = std::min(order.size(), start + 32);
+
+			std::fill(gw, gw + n, 0.0);
+			for (size_t s = start; s < end; s++) {
+				const Sample &d = data[order[s]];
+				double h[NH], p[NO], dh[NH] = { 0 };
+
+				forward(m, d.x, h, p);
+				for (int k = 0; k < NO; k++) {
+					double dz = p[k] - (k == d.label);
+					g.b2[k] += dz;
+					for (int j = 0; j < NH; j++) {
+						g.w2[k][j] += dz * h[j];
+						dh[j] += dz * m.w2[k][j];
+					}
+				}
+				for (int j = 0; j < NH; j++) {
+					if (h[j] <= 0)
+						continue;
+					g.b1[j] += dh[j];
+					for (int i = 0; i < NI; i++)
+						g.w1[j][i] += dh[j] * d.x[i];
+				}
+			}
+
+			step++;
+			for (int i = 0; i < n; i++) {
+				double grad = gw[i] / (end - start);
+				mom[i] = beta1 * mom[i] + (1 - beta1) * grad;
+				vel[i] = beta2 * vel[i] + (1 - beta2) * grad * grad;
+				w[i] -= rate * (mom[i] / (1 - pow(beta1, step))) /
+						(sqrt(vel[i] / (1 - pow(beta2, step))) + eps);
+			}
+		}
+	}
+}
+
+static int8_t toInt8(double v)
+{
+	return (int8_t)std::max(-127L, std::min(127L, lrint(v)));
+}
+
+/**
+ * Integer scores of one window, the same arithmetic as classifier_run().
+ */
+static void qScores(const QModel &q, const int8_t *x, int32_t *scores)
+{
+	int32_t h[NH];
+
+	for (int j = 0; j < NH; j++) {
+		int32_t acc = q.b1[j];
+		for (int i = 0; i < NI; i++)
+			acc += q.w1[j][i] * x[i];
+		acc >>= q.shift;
+		h[j] = acc < 0 ? 0 : std::min(acc, (int32_t)127);
+	}
+	for (int k = 0; k < NO; k++) {
+		scores[k] = q.b2[k];
+		for (int j = 0; j < NH; j++)
+			scores[k] += q.w2[k][j] * h[j];
+	}
+}
+
+static QModel quantise(const Model &m, const std::vector<Sample> &data)
+{
+	QModel q;
+	double max1 = 0, max2 = 0, hmax = 0;
+
+	//The float model sees x / 64, so W1 in integer inputs is w1 / 64
+	for (int j = 0; j < NH; j++)
+		for (int i = 0; i < NI; i++)
+			max1 = std::max(max1, fabs(m.w1[j][i] * INPUT_SCALE));
+	double s1 = 127 / max1;
+
+	for (size_t s = 0; s < data.size(); s++) {
+		double h[NH], p[NO];
+		forward(m, data[s].x, h, p);
+		for (int j = 0; j < NH; j++)
+			hmax = std::max(hmax, h[j]);
+	}
+	q.shift = std::max(0, (int)ceil(log2(s1 * hmax / 127)));
+	double sh = s1 / (1 << q.shift);		//Hidden unit scale after the shift
+
+	for (int j = 0; j < NH; j++) {
+		for (int i = 0; i < NI; i++)
+			q.w1[j][i] = toInt8(m.w1[j][i] * INPUT_SCALE * s1);
+		q.b1[j] = (int32_t)lrint(m.b1[j] * s1);
+	}
+	for (int k = 0; k < NO; k++)
+		for (int j = 0; j < NH; j++)
+			max2 = std::max(max2, fabs(m.w2[k][j]));
+	double s2 = 127 / max2;
+	for (int k = 0; k < NO; k++) {
+		for (int j = 0; j < NH; j++)
+			q.w2[k][j] = toInt8(m.w2[k][j] * s2);
+		q.b2[k] = (int32_t)lrint(m.b2[k] * s2 * sh);
+	}
+
+	std::vector<int32_t> wins;
+	for (size_t s = 0; s < data.size(); s++) {
+		int32_t scores[NO];
+		qScores(q, data[s].q, scores);
+		int best = (int)(std::max_element(scores, scores + NO) - scores);
+		if (best == data[s].label)
+			wins.push_back(scores[best]);
+	}
+	std::sort(wins.begin(), wins.end());
+	q.minScore = wins.empty() ? 0 : std::max((int32_t)1, wins[wins.size() / 100]);
+	return q;
+}
+
+static void writeHeader(FILE *out, const QModel &q, const char *source, size_t n)
+{
+	static const char *const names[NO] = {
+		"EXERCISE_BICEP_CURL", "EXERCISE_SHOULDER_PRESS", "EXERCISE_SQUAT", "EXERCISE_ROW"
+	};
+
+	fprintf(out, "/*\n"
+			"* Application Name:\t\tFlexZone (Application)\n"
+			"* File Name: \t\t\tclassifier_model.h\n"
+			"* Group: \t\t\t\tGroupX - FlexZone\n"
+			"* Description:\t\t\tWeight tables for the int8 exercise classifier.\n"
+			"*\n"
+			"* Layout is an 8-8-4 MLP: hidden = clamp((W1*x + B1) >> CLASSIFIER_L1_SHIFT, 0, 127),\n"
+			"* scores = W2*hidden + B2. Inputs are the quantised features described in classifier.c.\n"
+			"*\n"
+			"* Generated by tools/host/classifier_train from %zu %s; do not edit.\n"
+			"* tools/host/classifier_bench reports its accuracy and cost.\n"
+			" */\n"
+			"#ifndef CLASSIFIER_MODEL_H\n"
+			"#define CLASSIFIER_MODEL_H\n\n"
+			"#include <stdint.h>\n"
+			"#include \"classifier.h\"\n\n"
+			"#define CLASSIFIER_L1_SHIFT\t\t\t\t\t%d\n"
+			"#define CLASSIFIER_MIN_SCORE\t\t\t\t%d\n\n"
+			"//Feature order: accel X/Y/Z mean, gyro X/Y/Z mean magnitude, EMG peak, pulse width\n"
+			"static const int8_t classifierW1[CLASSIFIER_NUM_HIDDEN][CLASSIFIER_NUM_FEATURES] = {\n",
+			n, source, q.shift, q.minScore);
+	for (int j = 0; j < NH; j++) {
+		fprintf(out, "\t\t{");
+		for (int i = 0; i < NI; i++)
+			fprintf(out, " %4d%s", q.w1[j][i], i < NI - 1 ? "," : "");
+		fprintf(out, " },\n");
+	}
+	fprintf(out, "};\n\nstatic const int32_t classifierB1[CLASSIFIER_NUM_HIDDEN] = {");
+	for (int j = 0; j < NH; j++)
+		fprintf(out, " %d%s", q.b1[j], j < NH - 1 ? "," : "");
+	fprintf(out, " };\n\nstatic const int8_t classifierW2[CLASSIFIER_NUM_CLASSES][CLASSIFIER_NUM_HIDDEN] = {\n");
+	for (int k = 0; k < NO; k++) {
+		fprintf(out, "\t\t{");
+		for (int j = 0; j < NH; j++)
+			fprintf(out, " %4d%s", q.w2[k][j], j < NH - 1 ? "," : "");
+		fprintf(out, " },\t\t//%s\n", names[k]);
+	}
+	fprintf(out, "};\n\nstatic const int32_t classifierB2[CLASSIFIER_NUM_CLASSES] = {");
+	for (int k = 0; k < NO; k++)
+		fprintf(out, " %d%s", q.b2[k], k < NO - 1 ? "," : "");
+	fprintf(out, " };\n\n#endif /* CLASSIFIER_MODEL_H */\n");
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: classifier_train (--synth | --csv sets.csv) [-o model.h] [--epochs n]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<Window> windows;
+	std::vector<Sample> data;
+	const char *csv = NULL, *outPath = NULL;
+	bool synth = false;
+	int epochs = 300;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--synth"))
+			synth = true;
+		else if (!strcmp(argv[i], "--csv") && i + 1 < argc)
+			csv = argv[++i];
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			outPath = argv[++i];
+		else if (!strcmp(argv[i], "--epochs") && i + 1 < argc)
+			epochs = atoi(argv[++i]);
+		else
+			usage();
+	}
+	if (synth == (csv != NULL))
+		usage();
+
+	if (synth)
+		synthWindows(1, 250, windows);
+	else if (!loadWindows(csv, windows))
+		return 1;
+
+	for (size_t w = 0; w < windows.size(); w++) {
+		Sample s;
+		if (isHeldOut(windows[w]) || !windowFeatures(windows[w], s.q))
+			continue;
+		for (int i = 0; i < NI; i++)
+			s.x[i] = s.q[i] * INPUT_SCALE;
+		s.label = windows[w].label;
+		data.push_back(s);
+	}
+	if (data.empty()) {
+		fprintf(stderr, "no training windows\n");
+		return 1;
+	}
+
+	Model m;
+	train(m, data, epochs, 1);
+	QModel q = quantise(m, data);
+
+	size_t floatHits = 0, intHits = 0;
+	for (size_t s = 0; s < data.size(); s++) {
+		double h[NH], p[NO];
+		int32_t scores[NO];
+		forward(m, data[s].x, h, p);
+		floatHits += (std::max_element(p, p + NO) - p) == data[s].label;
+		qScores(q, data[s].q, scores);
+		int best = (int)(std::max_element(scores, scores + NO) - scores);
+		intHits += best == data[s].label && scores[best] >= q.minScore;
+	}
+	fprintf(stderr, "%zu training windows: float %.1f %%, int8 %.1f %% (shift %d, min score %d)\n",
+			data.size(), 100.0 * floatHits / data.size(), 100.0 * intHits / data.size(),
+			q.shift, q.minScore);
+
+	FILE *out = outPath ? fopen(outPath, "w") : stdout;
+	if (!out) {
+		perror(outPath);
+		return 1;
+	}
+	writeHeader(out, q, synth ? "generated windows (--synth),\n* a stand-in until recorded sets exist" : csv, data.size());
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * Checks the connection parameter policy (conn_policy.c) against a simulated central
+ * and reports the radio duty cycle and delivery latency of every level.
+ *
+ * A workout timeline (idle, IMU streaming, a set, idle again) is replayed against three
+ * centrals: one that applies every request, one that ignores them all, and one that only
+ * runs intervals that are multiples of 15 ms of at least 30 ms, like a phone that sets
+ * its own floor. Every request must be valid for GAPRole_SetParameter and the spec:
+ *
+ *     6 <= minInt <= maxInt <= 3200, latency < 500, 10 <= timeout <= 3200
+ *     timeout * 10 ms > (1 + latency) * maxInt * 1.25 ms * 2
+ *
+ * and requests must keep CONN_POLICY_MIN_SPACING_MS apart, with at most
+ * CONN_POLICY_MAX_ATTEMPTS per level.
+ *
+ * Duty cycle: per connection event the radio listens for the central's packet and
+ * answers, each empty PDU 80 us and T_IFS 150 us apart, plus window widening for
+ * 90 ppm of combined sleep clock accuracy; data packets add their bytes at 8 us each.
+ * With slave latency the device only wakes for every (1 + latency)th event unless it
+ * has something to send. Notification latency is the wait for the next connection
+ * event; a write from the central waits up to (1 + latency) intervals.
+ *
+ *     conn_policy_test
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "conn_policy.h"
+
+#define PARAM_MAX_INTERVAL					3200
+#define PARAM_MAX_LATENCY					500
+#define PARAM_MIN_TIMEOUT					10
+#define PARAM_MAX_TIMEOUT					3200
+
+#define STEP_MS								100
+
+//Radio timing
+#define EMPTY_PDU_US						80
+#define T_IFS_US							150
+#define US_PER_BYTE							8
+#define LL_OVERHEAD							10
+#define SCA_PPM								90
+
+typedef enum {
+	CENTRAL_ACCEPT = 0,
+	CENTRAL_IGNORE,
+	CENTRAL_COARSE,
+	CENTRAL_COUNT
+} Central;
+
+static const char *centralNames[] = { "accepts", "ignores", "30 ms floor" };
+
+typedef struct {
+	uint32_t ms;
+	uint8_t activity;
+	uint8_t active;
+} Step;
+
+//Idle after connecting, stream, stop, a set, rest
+static const Step timeline[] = {
+	{ 40000, CONN_ACTIVITY_STREAM, 1 },
+	{ 90000, CONN_ACTIVITY_STREAM, 0 },
+	{ 100000, CONN_ACTIVITY_SET, 1 },
+	{ 150000, CONN_ACTIVITY_SET, 0 },
+};
+#define TIMELINE_END_MS						210000
+
+typedef struct {
+	const char *name;
+	Conn_level level;
+	uint8_t activity;
+	double notifsPerS;		//Device to central
+	uint16_t notifyLen;
+} Traffic;
+
+static const Traffic traffic[] = {
+	{ "stream", CONN_LEVEL_STREAM, CONN_ACTIVITY_STREAM, 100.0, 20 },		//IMU, ATT MTU 23
+	{ "set", CONN_LEVEL_SET, CONN_ACTIVITY_SET, 1.0, 15 },					//Rep events
+	{ "idle", CONN_LEVEL_IDLE, 0, 0.0, 0 },
+};
+
+static uint16_t reqMin, reqMax, reqLatency, reqTimeout;
+static uint8_t posted;
+static uint32_t failures;
+
+//Simulated central and link
+static Central central;
+static uint16_t linkInterval, linkLatency;
+static uint8_t pendingApply;
+static uint32_t applyAtMs, lastReqMs, requests;
+static uint8_t haveReq;
+
+//Level the timeline is in, requests made for it
+static Conn_level simLevel;
+static uint32_t levelRequests[3], levelAttempts;
+static uint16_t widestIdleMax;
+
+static uint32_t nowMs(void)
+{
+	return (uint32_t)(shim_nowUs() / 1000);
+}
+
+static void fail(const char *what)
+{
+	printf("  %6u ms  %s: %u-%u x1.25ms, latency %u, timeout %u x10ms\n", nowMs(), what,
+			reqMin, reqMax, reqLatency, reqTimeout);
+	failures++;
+}
+
+/**
+ * Interval the central picks in the requested range, 0 if it refuses.
+ */
+static uint16_t centralPick(void)
+{
+	uint16_t i;
+
+	switch (central) {
+	case CENTRAL_ACCEPT:
+		return reqMin;
+	case CENTRAL_COARSE:
+		for (i = 24; i <= reqMax; i += 12)		//n x 15 ms from 30 ms
+			if (i >= reqMin)
+				return i;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+bStatus_t GAPRole_SetParameter(uint16_t param, uint8_t len, void *pValue)
+{
+	uint16_t v = (len == sizeof(uint16_t)) ? *(uint16_t *)pValue : *(uint8_t *)pValue;
+
+	switch (param) {
+	case GAPROLE_MIN_CONN_INTERVAL:
+		reqMin = v;
+		break;
+	case GAPROLE_MAX_CONN_INTERVAL:
+		reqMax = v;
+		break;
+	case GAPROLE_SLAVE_LATENCY:
+		reqLatency = v;
+		break;
+	case GAPROLE_TIMEOUT_MULTIPLIER:
+		reqTimeout = v;
+		break;
+	case GAPROLE_PARAM_UPDATE_REQ:
+		if (pendingApply)
+			return FAILURE;		//Procedure still running
+		requests++;
+		levelRequests[simLevel]++;
+		if (simLevel == CONN_LEVEL_IDLE && reqMax > widestIdleMax)
+			widestIdleMax = reqMax;
+		if (++levelAttempts > CONN_POLICY_MAX_ATTEMPTS)
+			fail("more than CONN_POLICY_MAX_ATTEMPTS requests for one level");
+		if (reqMin < 6 || reqMin > reqMax || reqMax > PARAM_MAX_INTERVAL)
+			fail("interval range invalid");
+		if (reqLatency >= PARAM_MAX_LATENCY)
+			fail("latency invalid");
+		if (reqTimeout < PARAM_MIN_TIMEOUT || reqTimeout > PARAM_MAX_TIMEOUT)
+			fail("timeout invalid");
+		if ((uint32_t)reqTimeout * 4 <= ((uint32_t)reqLatency + 1) * reqMax)
+			fail("timeout shorter than (1 + latency) x maxInt x 2");
+		if (haveReq && nowMs() - lastReqMs < CONN_POLICY_MIN_SPACING_MS)
+			fail("requests closer than CONN_POLICY_MIN_SPACING_MS");
+		haveReq = 1;
+		lastReqMs = nowMs();
+		pendingApply = 1;
+		applyAtMs = nowMs() + 1000;		//L2CAP round trip and instant
+		break;
+	}
+	return SUCCESS;
+}
+
+static void policyPost(void)
+{
+	posted = 1;
+}
+
+static void centralStep(void)
+{
+	uint16_t interval;
+
+	if (!pendingApply || nowMs() < applyAtMs)
+		return;
+	pendingApply = 0;
+	interval = centralPick();
+	if (interval) {
+		linkInterval = interval;
+		linkLatency = reqLatency;
+		connPolicy_paramsUpdated(linkInterval, linkLatency);
+	}
+}
+
+/**
+ * Replays the timeline. Records the interval and latency the link runs at by level.
+ *
+ * @return 	Requests made
+ */
+static uint32_t replay(Central c, uint16_t *pLevelInt, uint16_t *pLevelLat)
+{
+	uint32_t startMs = nowMs();
+	uint8_t next = 0, activities = 0;
+
+	central = c;
+	linkInterval = 36;		//Phone default, 45 ms
+	linkLatency = 0;
+	pendingApply = haveReq = 0;
+	requests = levelAttempts = 0;
+	memset(levelRequests, 0, sizeof(levelRequests));
+	simLevel = CONN_LEVEL_IDLE;
+	connPolicy_connected(linkInterval, linkLatency);
+
+	while (nowMs() - startMs < TIMELINE_END_MS) {
+		while (next < sizeof(timeline) / sizeof(timeline[0]) &&
+				timeline[next].ms <= nowMs() - startMs) {
+			Conn_level level;
+
+			if (timeline[next].active)
+				activities |= timeline[next].activity;
+			else
+				activities &= ~timeline[next].activity;
+			level = (activities & CONN_ACTIVITY_STREAM) ? CONN_LEVEL_STREAM :
+					(activities & CONN_ACTIVITY_SET) ? CONN_LEVEL_SET : CONN_LEVEL_IDLE;
+			if (level != simLevel) {
+				simLevel = level;
+				levelAttempts = 0;
+			}
+			connPolicy_setActivity(timeline[next].activity, timeline[next].active);
+			next++;
+		}
+
+		shim_advanceUs(STEP_MS * 1000);
+		centralStep();
+		if (posted) {
+			posted = 0;
+			connPolicy_evaluate();
+		}
+
+		if (pLevelInt) {
+			pLevelInt[simLevel] = linkInterval;
+			pLevelLat[simLevel] = linkLatency;
+		}
+	}
+	connPolicy_disconnected();
+
+	printf("central %-12s %2u requests (idle %u, set %u, stream %u), ends at %u x1.25ms\n",
+			centralNames[c], requests, levelRequests[CONN_LEVEL_IDLE], levelRequests[CONN_LEVEL_SET],
+			levelRequests[CONN_LEVEL_STREAM], linkInterval);
+	return requests;
+}
+
+/**
+ * Radio duty cycle and latencies for one level's traffic at an interval and latency.
+ */
+static void duty(const Traffic *pT, uint16_t interval, uint16_t latency)
+{
+	double intervalMs = interval * 1.25;
+	double eventsPerS = 1000.0 / intervalMs, wakesPerS, perEventUs, dataUs, notifsPerEvent;
+	uint16_t llPackets;
+
+	//Asleep through latency events with nothing to send, awake for every event with data
+	notifsPerEvent = pT->notifsPerS / eventsPerS;
+	wakesPerS = eventsPerS / (1 + latency);
+	if (pT->notifsPerS > 0)
+		wakesPerS += (eventsPerS - wakesPerS) * (notifsPerEvent >= 1.0 ? 1.0 : notifsPerEvent);
+
+	perEventUs = 2 * EMPTY_PDU_US + T_IFS_US + 2.0 * SCA_PPM * intervalMs * (1 + latency) / 1000.0;
+	llPackets = (pT->notifyLen + 7 + 26) / 27;
+	dataUs = pT->notifsPerS * llPackets * ((LL_OVERHEAD + 27) * US_PER_BYTE + EMPTY_PDU_US + 2 * T_IFS_US);
+
+	printf("%-7s %7.1f ms %4u %9.1f %9.3f %% %10.1f %10.1f %10.1f\n", pT->name, intervalMs,
+			latency, wakesPerS, (wakesPerS * perEventUs + dataUs) / 1e4, intervalMs / 2,
+			intervalMs, intervalMs * (1 + latency));
+}
+
+int main(void)
+{
+	uint16_t levelInt[3], levelLat[3];
+	uint8_t c, i;
+
+	connPolicy_init(policyPost);
+
+	for (c = 0; c < CENTRAL_COUNT; c++) {
+		widestIdleMax = 0;
+		replay((Central)c, (c == CENTRAL_ACCEPT) ? levelInt : NULL, levelLat);
+
+		//Ignored, idle goes through its whole widening sequence: the last attempt is
+		//the one that asked for 800 ms at latency 4 with a 6 s timeout
+		if (c == CENTRAL_IGNORE &&
+				widestIdleMax != CONN_POLICY_IDLE_MAX_INT << (CONN_POLICY_MAX_ATTEMPTS - 1)) {
+			printf("  ignored central: widest idle request %u x1.25ms\n", widestIdleMax);
+			failures++;
+		}
+	}
+
+	printf("\n%-7s %10s %4s %9s %11s %10s %10s %10s\n", "level", "interval", "lat", "wakeups/s",
+			"radio duty", "notify avg", "notify max", "write max");
+	for (i = 0; i < sizeof(traffic) / sizeof(traffic[0]); i++)
+		duty(&traffic[i], levelInt[traffic[i].level], levelLat[traffic[i].level]);
+	//What the central's default would cost for the same traffic
+	printf("phone default\n");
+	for (i = 0; i < sizeof(traffic) / sizeof(traffic[0]); i++)
+		duty(&traffic[i], 36, 0);
+
+	printf("\n%u failures\n", failures);
+	return failures ? 1 : 0;
+}
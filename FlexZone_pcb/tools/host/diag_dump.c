@@ -0,0 +1,255 @@
+/*
+ * Feeds generated measurements and counts into the firmware's diag.c and writes the
+ * Diagnostics Counters values a central would read, as a capture for diag_decode.py,
+ * plus what each one must hold as JSON lines to compare against.
+ *
+ *     diag_dump <seed> <snapshots> <timestamp Hz> <expected.jsonl> > capture.txt
+ *
+ * Every snapshot is read as an ATT long read, 22 bytes at a time from diag_read, at a
+ * random time of up to a few hours. Before it the timers get random durations, from
+ * a few us to past the 16-bit us range, sent in Timestamp ticks at the given
+ * frequency; the counters, the TX queue counters and the message pool change at
+ * random, and now and then diag_reset runs or a boot phase comes in. Every 16th
+ * snapshot pushes a counter and a histogram bucket past 0xFFFF and every 64th the
+ * timer sums past 32 bits.
+ *
+ * The expected values come from a reference kept here with exact arithmetic: durations
+ * in us are floor(ticks * 10^6 / Hz), the mean is floor(sum / count) and the buckets
+ * are [0, 32), [32, 64), ... [2048, inf) us.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diag.h"
+#include "msg_pool.h"
+
+#define READ_LEN							22			//ATT MTU 23
+#define MAX_HELD							24
+
+typedef struct {
+	uint32_t min, max, count;
+	uint64_t sum;
+	uint32_t hist[DIAG_HIST_BUCKETS];
+} RefTimer;
+
+static uint32_t rngState;
+static TxQueue_stats txq;
+static RefTimer refTimers[DIAG_NUM_TIMERS];
+static uint32_t refCounters[DIAG_NUM_COUNTERS];
+static uint32_t refBootMs[DIAG_NUM_BOOT_PHASES];
+static void *held[MAX_HELD];
+static uint8_t numHeld;
+
+const TxQueue_stats *user_getTxQueueStats(void)
+{
+	return &txq;
+}
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void refReset(void)
+{
+	memset(refTimers, 0, sizeof(refTimers));
+	memset(refCounters, 0, sizeof(refCounters));
+}
+
+static uint8_t refBucket(uint32_t us)
+{
+	static const uint32_t edges[DIAG_HIST_BUCKETS - 1] = { 32, 64, 128, 256, 512, 1024, 2048 };
+	uint8_t b = 0;
+
+	while (b < DIAG_HIST_BUCKETS - 1 && us >= edges[b])
+		b++;
+	return b;
+}
+
+/**
+ * One measurement of a duration in us, as the firmware's timer code gets it.
+ */
+static void measure(Diag_timer t, uint32_t us)
+{
+	uint32_t ticks = (uint32_t)MIN((uint64_t)us * shim_timestampHz / 1000000, 0xFFFFFFFF);
+	uint32_t refUs = (uint32_t)MIN((uint64_t)ticks * 1000000 / shim_timestampHz, 0xFFFF);
+	RefTimer *r = &refTimers[t];
+	uint16_t got = diag_timerUs(t, ticks);
+
+	if (got != refUs) {
+		fprintf(stderr, "diag_timerUs: %u ticks gave %u us, expected %u\n", ticks, got, refUs);
+		exit(1);
+	}
+	r->min = r->count ? MIN(r->min, refUs) : refUs;
+	r->max = MAX(r->max, refUs);
+	r->sum += refUs;
+	r->count++;
+	r->hist[refBucket(refUs)]++;
+}
+
+static uint32_t duration(void)
+{
+	switch (rnd(8)) {
+	case 0:
+		return rnd(40);
+	case 1:
+		return 50000 + rnd(200000);		//Past the u16 us range
+	default:
+		return rnd(1u << (5 + rnd(8)));
+	}
+}
+
+static void poolChurn(void)
+{
+	uint8_t n = rnd(12);
+
+	while (n--) {
+		if (numHeld && (numHeld == MAX_HELD || rnd(2))) {
+			uint8_t i = rnd(numHeld);
+
+			msgPool_free(held[i]);
+			held[i] = held[--numHeld];
+		}
+		else {
+			void *p = msgPool_alloc(1 + rnd(MSG_POOL_LARGE_BLOCK_SIZE + 40));
+
+			if (p != NULL)
+				held[numHeld++] = p;
+		}
+	}
+}
+
+static void writeTimer(FILE *f, const RefTimer *r)
+{
+	uint8_t i;
+
+	fprintf(f, "{\"min\": %u, \"mean\": %u, \"max\": %u, \"hist\": [",
+			r->count ? r->min : 0, r->count ? (uint32_t)(r->sum / r->count) : 0, r->max);
+	for (i = 0; i < DIAG_HIST_BUCKETS; i++)
+		fprintf(f, "%s%u", i ? ", " : "", MIN(r->hist[i], 0xFFFF));
+	fprintf(f, "]}");
+}
+
+static void writeExpected(FILE *f, double t)
+{
+	const MsgPool_stats *pool = msgPool_getStats();
+	uint8_t i;
+
+	fprintf(f, "{\"t\": %.6f, \"uptime\": %u, \"timers\": [", t, (uint32_t)(shim_nowUs() / 1000000));
+	for (i = 0; i < DIAG_NUM_TIMERS; i++) {
+		if (i)
+			fprintf(f, ", ");
+		writeTimer(f, &refTimers[i]);
+	}
+	fprintf(f, "], \"counters\": [");
+	for (i = 0; i < DIAG_NUM_COUNTERS; i++)
+		fprintf(f, "%s%u", i ? ", " : "", MIN(refCounters[i], 0xFFFF));
+	fprintf(f, "], \"txq\": [%u, %u, %u, %u, %u, %u]", txq.depth, txq.highWater, txq.sent,
+			txq.retries, txq.drops, txq.discards);
+	fprintf(f, ", \"heap\": [0, 0, 0], \"pool\": [");
+	for (i = 0; i < MSG_POOL_NUM_CLASSES; i++)
+		fprintf(f, "%s[%u, %u, %u]", i ? ", " : "", pool->cls[i].inUse, pool->cls[i].highWater,
+				pool->cls[i].exhausted);
+	fprintf(f, "], \"pool_heap\": [%u, %u], \"boot_ms\": [", pool->heapFallbacks, pool->failures);
+	for (i = 0; i < DIAG_NUM_BOOT_PHASES; i++)
+		fprintf(f, "%s%u", i ? ", " : "", refBootMs[i]);
+	fprintf(f, "]}\n");
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t value[DIAG_SNAPSHOT_LEN];
+	uint32_t snapshots, n, i;
+	FILE *f;
+
+	if (argc != 5) {
+		fprintf(stderr, "usage: diag_dump <seed> <snapshots> <timestamp Hz> <expected.jsonl>\n");
+		return 2;
+	}
+	rngState = strtoul(argv[1], NULL, 0) | 1;
+	snapshots = strtoul(argv[2], NULL, 0);
+	shim_timestampHz = strtoul(argv[3], NULL, 0);
+	f = fopen(argv[4], "w");
+	if (f == NULL || !shim_timestampHz) {
+		perror(argv[4]);
+		return 2;
+	}
+
+	msgPool_init();
+	diag_init();
+
+	//Half way through a ms from here on, where the shim's RTC fraction cannot round down
+	shim_advanceUs(500);
+	refReset();
+
+	for (n = 0; n < snapshots; n++) {
+		uint32_t m = rnd(200);
+		uint16_t off, len;
+
+		shim_advanceUs(1000 * (1 + rnd(120000)));
+
+		//Boot phases, only the first mark of each counts
+		if (rnd(4) == 0) {
+			Diag_bootPhase p = rnd(DIAG_NUM_BOOT_PHASES);
+
+			diag_bootMark(p);
+			if (!refBootMs[p])
+				refBootMs[p] = (uint32_t)(shim_nowUs() / 1000);
+		}
+		if (rnd(20) == 0) {
+			diag_reset();
+			refReset();
+		}
+
+		if (n % 64 == 63) {
+			//Sums past 32 bits
+			for (i = 0; i < 70000; i++)
+				measure(DIAG_TIMER_SLICE, 60000 + rnd(5000));
+		}
+		while (m--)
+			measure(rnd(DIAG_NUM_TIMERS), duration());
+
+		m = (n % 16 == 15) ? 70000 : rnd(50);
+		while (m--) {
+			Diag_counter c = (n % 16 == 15) ? DIAG_SPI_TRANSFER : rnd(DIAG_NUM_COUNTERS);
+
+			diag_count(c);
+			refCounters[c]++;
+		}
+		if (n % 16 == 15) {
+			for (i = 0; i < 70000; i++)
+				measure(DIAG_TIMER_SAMPLE, 40 + rnd(20));
+		}
+
+		txq.depth = rnd(16);
+		txq.highWater = MAX(txq.highWater, txq.depth);
+		txq.sent += rnd(500);
+		txq.retries += rnd(5);
+		txq.drops += rnd(2);
+		txq.discards += rnd(3);
+		poolChurn();
+
+		//Read then Read Blob until a short response
+		for (off = 0; ; off += len) {
+			len = diag_read(off, &value[off], READ_LEN);
+			if (len < READ_LEN)
+				break;
+		}
+		if (off + len != DIAG_SNAPSHOT_LEN) {
+			fprintf(stderr, "long read returned %u bytes\n", off + len);
+			return 1;
+		}
+
+		printf("%.6f,", shim_nowUs() / 1e6);
+		for (i = 0; i < DIAG_SNAPSHOT_LEN; i++)
+			printf("%02x", value[i]);
+		printf("\n");
+		writeExpected(f, shim_nowUs() / 1e6);
+	}
+
+	fclose(f);
+	return 0;
+}
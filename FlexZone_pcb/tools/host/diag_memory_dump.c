@@ -0,0 +1,255 @@
+/*
+ * Runs the firmware's memory accounting in diag.c against stacks and a heap that
+ * change at random, and writes the Diagnostics Memory values a central would read, as
+ * a capture for diag_memory.py, plus what each one must hold as JSON lines to compare
+ * against.
+ *
+ *     diag_memory_dump <seed> <reports> <expected.jsonl> > capture.txt
+ *
+ * The tasks have the stack sizes of the firmware and are registered one by one over
+ * the first reports, so the early ones leave some out. Before every report a few
+ * stacks are written to a random depth, mostly well inside them and now and then into
+ * the last bytes or all of them, and the system stack the same way; the shim finds the marks by the SYS/BIOS fill scan. The
+ * ICall heap is HEAPMGR_SIZE bytes with the heap manager's 4-byte headers, taken by
+ * direct allocations and by message pool blocks that spill into it, until it fails.
+ *
+ * The expected values come from the deepest write to each stack, the heap kept here
+ * and the message pool allocations that returned NULL. "over" lists what the RAM
+ * budget check must flag: a stack with less than DIAG_STACK_MARGIN bytes of headroom,
+ * and the heap once an allocation failed or its peak came within the same margin.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diag.h"
+#include "msg_pool.h"
+
+#define READ_LEN							22			//ATT MTU 23
+#define SYS_STACK_SIZE						1024		//Program.stack of the BLE stack configuration
+#define HEAP_HEADER							4
+#define MAX_HELD							24
+
+static const char *const taskNames[DIAG_NUM_TASKS] = { "app", "gaprole", "emg", "sched", "trace" };
+static const uint16_t taskStackSizes[DIAG_NUM_TASKS] = { 600, 520, 400, 400, 400 };
+
+static uint32_t rngState;
+static Task_Struct taskStructs[DIAG_NUM_TASKS];
+static uint8_t taskStacks[DIAG_NUM_TASKS][600];
+static uint8_t sysStack[SYS_STACK_SIZE];
+static uint16_t refUsed[DIAG_NUM_TASKS];
+static uint16_t refSysUsed;
+static uint32_t heapInUse, heapPeak, refFailures;
+
+typedef struct {
+	void *p;
+	Bool pool;
+} Held;
+
+static Held held[MAX_HELD];
+static uint8_t numHeld;
+static TxQueue_stats txq;
+
+//diag_read links it, the memory report does not read it
+const TxQueue_stats *user_getTxQueueStats(void)
+{
+	return &txq;
+}
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static uint32_t heapCost(uint16_t size)
+{
+	return ((size + 3u) & ~3u) + HEAP_HEADER;
+}
+
+void *ICall_malloc(uint16_t size)
+{
+	uint32_t *p;
+
+	if (heapInUse + heapCost(size) > HEAPMGR_SIZE)
+		return NULL;
+	p = malloc(sizeof(uint32_t) * 2 + size);
+	p[0] = heapCost(size);
+	heapInUse += p[0];
+	heapPeak = MAX(heapPeak, heapInUse);
+	return &p[2];
+}
+
+void ICall_free(void *pMsg)
+{
+	uint32_t *p = (uint32_t *)pMsg - 2;
+
+	heapInUse -= p[0];
+	free(p);
+}
+
+void ICall_getHeapMgrGetMetrics(uint32_t *pBlkMax, uint32_t *pBlkCnt, uint32_t *pBlkFree,
+								uint32_t *pMemAlo, uint32_t *pMemMax, uint32_t *pMemUB)
+{
+	*pBlkMax = *pBlkCnt = *pBlkFree = *pMemUB = 0;
+	*pMemAlo = heapInUse;
+	*pMemMax = heapPeak;
+}
+
+/**
+ * Writes a stack down to depth bytes from its top, the deepest byte never the fill.
+ */
+static void touch(uint8_t *pStack, uint16_t size, uint16_t depth, uint16_t *pRef)
+{
+	uint16_t i;
+
+	if (!depth)
+		return;
+	for (i = size - depth; i < size; i++)
+		pStack[i] = rnd(256);
+	if (pStack[size - depth] == SHIM_STACK_FILL)
+		pStack[size - depth] = 0;
+	*pRef = MAX(*pRef, depth);
+}
+
+static uint16_t depth(uint16_t size)
+{
+	uint32_t r = rnd(200);
+
+	if (r == 0)
+		return size - rnd(DIAG_STACK_MARGIN + 1);		//Into the margin or full
+	if (r < 3)
+		return rnd(size + 1);
+	return rnd(size * 3 / 4);
+}
+
+static void heapChurn(void)
+{
+	uint8_t n = rnd(16);
+
+	while (n--) {
+		if (numHeld && (numHeld == MAX_HELD || rnd(2))) {
+			uint8_t i = rnd(numHeld);
+
+			if (held[i].pool)
+				msgPool_free(held[i].p);
+			else
+				ICall_free(held[i].p);
+			held[i] = held[--numHeld];
+		}
+		else if (rnd(2)) {
+			//BLE stack messages and the like, now and then a big one; not counted as
+			//application failures
+			void *p = ICall_malloc(rnd(40) ? 8 + rnd(200) : 1000 + rnd(1500));
+
+			if (p != NULL)
+				held[numHeld++] = (Held){ p, FALSE };
+		}
+		else {
+			void *p = msgPool_alloc(1 + rnd(MSG_POOL_LARGE_BLOCK_SIZE));
+
+			if (p != NULL)
+				held[numHeld++] = (Held){ p, TRUE };
+			else
+				refFailures++;
+		}
+	}
+}
+
+static void writeExpected(FILE *f, double t)
+{
+	Bool registered[DIAG_NUM_TASKS];
+	const char *over[DIAG_NUM_TASKS + 2];
+	uint8_t numOver = 0;
+	uint8_t i;
+
+	fprintf(f, "{\"t\": %.6f, \"tasks\": [", t);
+	for (i = 0; i < DIAG_NUM_TASKS; i++) {
+		registered[i] = taskStructs[i].stackSize != 0;
+		fprintf(f, "%s[%u, %u]", i ? ", " : "", registered[i] ? taskStackSizes[i] : 0,
+				registered[i] ? refUsed[i] : 0);
+		if (registered[i] && refUsed[i] + DIAG_STACK_MARGIN > taskStackSizes[i])
+			over[numOver++] = taskNames[i];
+	}
+	if (refSysUsed + DIAG_STACK_MARGIN > SYS_STACK_SIZE)
+		over[numOver++] = "system";
+	if (refFailures || heapPeak + DIAG_STACK_MARGIN > HEAPMGR_SIZE)
+		over[numOver++] = "heap";
+
+	fprintf(f, "], \"system\": [%u, %u], \"heap\": [%u, %u, %u], \"alloc_failures\": %u, \"over\": [",
+			SYS_STACK_SIZE, refSysUsed, HEAPMGR_SIZE, heapInUse, heapPeak, MIN(refFailures, 0xFFFF));
+	for (i = 0; i < numOver; i++)
+		fprintf(f, "%s\"%s\"", i ? ", " : "", over[i]);
+	fprintf(f, "]}\n");
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t value[DIAG_MEMORY_LEN];
+	uint32_t reports, n, i;
+	Task_Params taskParams;
+	FILE *f;
+
+	if (argc != 4) {
+		fprintf(stderr, "usage: diag_memory_dump <seed> <reports> <expected.jsonl>\n");
+		return 2;
+	}
+	rngState = strtoul(argv[1], NULL, 0) | 1;
+	reports = strtoul(argv[2], NULL, 0);
+	f = fopen(argv[3], "w");
+	if (f == NULL) {
+		perror(argv[3]);
+		return 2;
+	}
+
+	//Allocations come from here as from the application task, so pool blocks spill
+	//into the heap
+	shim_threadType = BIOS_ThreadType_Task;
+	msgPool_init();
+	diag_init();
+	memset(sysStack, SHIM_STACK_FILL, sizeof(sysStack));
+	shim_hwiStack = sysStack;
+	shim_hwiStackSize = sizeof(sysStack);
+
+	for (n = 0; n < reports; n++) {
+		uint16_t off, len;
+
+		shim_advanceUs(1000 * (1 + rnd(600000)));
+
+		for (i = 0; i < DIAG_NUM_TASKS; i++) {
+			if (taskStructs[i].stackSize == 0 && rnd(4) == 0) {
+				Task_Params_init(&taskParams);
+				taskParams.stack = taskStacks[i];
+				taskParams.stackSize = taskStackSizes[i];
+				Task_construct(&taskStructs[i], NULL, &taskParams, NULL);
+				diag_addTask(i, Task_handle(&taskStructs[i]));
+			}
+			if (taskStructs[i].stackSize && rnd(3) == 0)
+				touch(taskStacks[i], taskStackSizes[i], depth(taskStackSizes[i]), &refUsed[i]);
+		}
+		if (rnd(3) == 0)
+			touch(sysStack, SYS_STACK_SIZE, depth(SYS_STACK_SIZE), &refSysUsed);
+		heapChurn();
+
+		//Read then Read Blob until a short response
+		for (off = 0; ; off += len) {
+			len = diag_readMemory(off, &value[off], READ_LEN);
+			if (len < READ_LEN)
+				break;
+		}
+		if (off + len != DIAG_MEMORY_LEN) {
+			fprintf(stderr, "long read returned %u bytes\n", off + len);
+			return 1;
+		}
+
+		printf("%.6f,", shim_nowUs() / 1e6);
+		for (i = 0; i < DIAG_MEMORY_LEN; i++)
+			printf("%02x", value[i]);
+		printf("\n");
+		writeExpected(f, shim_nowUs() / 1e6);
+	}
+
+	fclose(f);
+	return 0;
+}
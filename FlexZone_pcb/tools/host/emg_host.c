@@ -0,0 +1,182 @@
+/*
+ * Host stand-in for the BLE task side of the EMG task, see emg_host.h.
+ */
+#include <stdio.h>
+#include <time.h>
+
+#include "emg_host.h"
+#include "EMG_Service.h"
+#include "diag.h"
+#include "emg.h"
+#include "event_bus.h"
+#include "msg_pool.h"
+#include "trace.h"
+#include "workout_config.h"
+
+//app_msg_t and char_data_t of FlexZone.c
+typedef struct {
+	Queue_Elem _elem;
+	uint8_t type;
+	uint8_t pdu[];
+} Host_msg;
+
+typedef struct {
+	uint16_t svcUUID;
+	uint16_t dataLen;
+	uint8_t paramID;
+	uint8_t data[];
+} Host_charData;
+
+uint32_t (*emgHost_signal)(uint64_t us) = NULL;
+void (*emgHost_packetFxn)(const uint8_t *pData, uint8_t len, app_pkt_type_t type) = NULL;
+void (*emgHost_setFxn)(const EMG_stats *pStats, uint8_t setIndex) = NULL;
+void (*emgHost_vibeFxn)(Vibe_patternId pattern, Vibe_prio prio) = NULL;
+Bool emgHost_setQueueFull = FALSE;
+uint32_t emgHost_counters[DIAG_NUM_COUNTERS];
+
+static Queue_Struct appMsgQueue;
+static Semaphore_Struct appSem;
+
+static uint32_t adcSource(uint32_t input)
+{
+	return (emgHost_signal && input == BOARD_CH0_AUX) ? emgHost_signal(shim_nowUs()) : 0;
+}
+
+uint64_t emgHost_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void emgHost_init(void)
+{
+	Queue_construct(&appMsgQueue, NULL);
+	Semaphore_construct(&appSem, 0, NULL);
+	msgPool_init();
+	shim_adcSource = adcSource;
+	emg_createTask();
+	shim_runTasks();
+}
+
+uint8_t emgHost_configure(uint8_t cmd, const uint8_t *pTlvs, uint16_t len)
+{
+	uint8_t buf[EMG_CONFIG_LEN];
+	Workout_config staged;
+	Bus_msg msg;
+
+	if (len > sizeof(buf) - WORKOUT_CFG_HEADER_LEN)
+		return WORKOUT_CFG_CMD_NONE;
+	buf[0] = WORKOUT_CFG_MAGIC;
+	buf[1] = cmd;
+	memcpy(&buf[WORKOUT_CFG_HEADER_LEN], pTlvs, len);
+	if (WORKOUT_CFG_CMD_NONE == workoutConfig_write(buf, WORKOUT_CFG_HEADER_LEN + len, &staged))
+		return WORKOUT_CFG_CMD_NONE;
+
+	//emgConfig_SwiFxn
+	cmd = workoutConfig_takeCommand();
+	msg.event = (WORKOUT_CFG_CMD_STOP == cmd) ? BUS_EVT_WORKOUT_STOP :
+			(WORKOUT_CFG_CMD_START == cmd) ? BUS_EVT_WORKOUT_START : BUS_EVT_WORKOUT_UPDATE;
+	bus_publish(&msg);
+	shim_runTasks();
+	return cmd;
+}
+
+//**********************************************************************************
+// FlexZone.c
+//**********************************************************************************
+//user_enqueueStreamPacket, the BLE task's side of the queue is the hook
+user_app_error_type_t user_sendEmgPacket(uint8_t *pData, uint8_t len, app_pkt_type_t packetType)
+{
+	Host_msg *pMsg;
+	Host_charData *pCharData;
+
+	if (pData == NULL || len == 0)
+		return USER_APP_ERROR_INVALID_PARAM;
+	if (len > EMG_STREAM_LEN - 2)
+		return USER_APP_ERROR_INVALID_LEN;
+
+	pMsg = msgPool_alloc(sizeof(Host_msg) + sizeof(Host_charData) + len + 2);
+	if (pMsg == NULL)
+		return USER_APP_ERROR_OK;
+	pCharData = (Host_charData *)pMsg->pdu;
+	pCharData->dataLen = len + 2;
+	pCharData->data[0] = packetType;
+	pCharData->data[1] = len;
+	memcpy(&pCharData->data[2], pData, len);
+	Queue_enqueue(Queue_handle(&appMsgQueue), &pMsg->_elem);
+	Semaphore_post(Semaphore_handle(&appSem));
+
+	if (emgHost_packetFxn)
+		emgHost_packetFxn(&pCharData->data[2], len, packetType);
+	Semaphore_pend(Semaphore_handle(&appSem), BIOS_NO_WAIT);
+	Queue_remove(&pMsg->_elem);
+	msgPool_free(pMsg);
+	return USER_APP_ERROR_OK;
+}
+
+uint16_t user_getNotifyPayloadLen(void)
+{
+	return USER_MAX_NOTIFY_LEN;
+}
+
+//The BLE task stores the set as soon as it is queued
+user_app_error_type_t user_publishSetSummary(const EMG_stats *pStats, uint8_t setIndex,
+		uint8_t withMotion)
+{
+	if (emgHost_setQueueFull)
+		return USER_APP_ERROR_NO_MEM;
+	if (emgHost_setFxn)
+		emgHost_setFxn(pStats, setIndex);
+	emg_setStored(pStats);
+	return USER_APP_ERROR_OK;
+}
+
+void user_setConnActivity(uint8_t activity, uint8_t active)
+{
+}
+
+void printWorkoutConfig(void)
+{
+}
+
+//**********************************************************************************
+// vibe.c unless a check links it, diag.c, trace.c
+//**********************************************************************************
+__attribute__((weak)) uint8_t vibe_play(Vibe_patternId pattern, Vibe_prio prio, uint8_t times)
+{
+	if (emgHost_vibeFxn)
+		emgHost_vibeFxn(pattern, prio);
+	return 1;
+}
+
+__attribute__((weak)) void buzz(uint8_t numTimes)
+{
+}
+
+uint16_t diag_timerUs(Diag_timer timer, uint32_t ticks)
+{
+	return (uint16_t)MIN(ticks, 0xFFFF);
+}
+
+void diag_count(Diag_counter counter)
+{
+	emgHost_counters[counter]++;
+}
+
+void diag_bootMark(Diag_bootPhase phase)
+{
+}
+
+void diag_addTask(Diag_task task, Task_Handle hTask)
+{
+}
+
+void diag_allocFailed(void)
+{
+}
+
+void trace_write(uint32_t hdr, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4)
+{
+}
@@ -0,0 +1,88 @@
+/*
+ * Runs the firmware's EMG task (emg.c) on the host shim, with the event bus, workout
+ * configuration, classifier, time sync and raw stream modules it uses. The checks
+ * built on it drive the ADC with a signal on simulated time and see what the task
+ * hands to the rest of the firmware through hooks.
+ *
+ * What the BLE task side does is stood in for here: configuration writes go through
+ * workoutConfig_write and the EMG config Swi's bus message, and user_sendEmgPacket
+ * copies into a message pool block and queues it as FlexZone.c does, then hands the
+ * packet to the hook and frees the block. Set summaries go to a hook, unless the check
+ * makes the queue fail. Diagnostics and the trace are stubs that only count diag_count,
+ * and so are the haptics unless the check links vibe.c.
+ */
+#ifndef EMG_HOST_H
+#define EMG_HOST_H
+
+#include "FlexZoneGlobals.h"
+#include "diag.h"
+#include "vibe.h"
+
+/**
+ * ADC level at a time. Every read of one sample asks for the same time.
+ *
+ * @param 	us			Simulated time of the sample
+ * @return 	12 bit level
+ */
+extern uint32_t (*emgHost_signal)(uint64_t us);
+
+/**
+ * A packet was queued for the EMG stream, at simulated time shim_nowUs().
+ *
+ * @param 	pData		Packet without the [type, len] header
+ * @param	len			Length of pData
+ * @param	type		APP_PACKET_TYPE_*
+ */
+extern void (*emgHost_packetFxn)(const uint8_t *pData, uint8_t len, app_pkt_type_t type);
+
+/**
+ * A finished set was published. The BLE task has stored it once this returns and the
+ * EMG task may reuse the record.
+ *
+ * @param 	pStats		Published record
+ * @param	setIndex	Sets finished, this one included
+ */
+extern void (*emgHost_setFxn)(const EMG_stats *pStats, uint8_t setIndex);
+
+//While set, user_publishSetSummary fails as with the message pool empty
+extern Bool emgHost_setQueueFull;
+
+//diag_count calls, by counter
+extern uint32_t emgHost_counters[DIAG_NUM_COUNTERS];
+
+/**
+ * A haptic pattern was requested, with the vibe.c stub.
+ *
+ * @param 	pattern		VIBE_PATTERN_*
+ * @param	prio		VIBE_PRIO_*
+ */
+extern void (*emgHost_vibeFxn)(Vibe_patternId pattern, Vibe_prio prio);
+
+/**
+ * Creates the EMG task and starts the shim's tasks. Call once, hooks set first.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void emgHost_init(void);
+
+/**
+ * Writes the EMG Config characteristic as the app would and lets the EMG task take
+ * it in.
+ *
+ * @param 	cmd			WORKOUT_CFG_CMD_*
+ * @param	pTlvs		TLVs after the header, see workout_config.h
+ * @param	len			Length of pTlvs
+ * @return 	Command accepted, WORKOUT_CFG_CMD_NONE if the write was rejected
+ */
+extern uint8_t emgHost_configure(uint8_t cmd, const uint8_t *pTlvs, uint16_t len);
+
+/**
+ * Host monotonic time, for timing the firmware code.
+ *
+ * @param 	none
+ * @return 	ns
+ */
+extern uint64_t emgHost_ns(void);
+
+#endif /* EMG_HOST_H */
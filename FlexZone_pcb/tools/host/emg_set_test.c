@@ -0,0 +1,347 @@
+/*
+ * Set boundaries of the firmware's EMG task (emg.c) on the host shim, see emg_host.h,
+ * where the configuration changes under a running workout:
+ *
+ *     slice			100 ms period, several reps end in every 50 sample slice,
+ *     				so the rep target is passed inside a slice
+ *     lowered target	an update sets targetRepCount below the reps the set already
+ *     				has: the set ends with those reps at the first slice after it
+ *     period change	an update changes the sample period halfway through a set
+ *     restart			a stop halfway through a set, then a start at another period
+ *     queue full		the message pool is empty when a set ends: its summary must
+ *     				come once the pool has blocks again; when the next set ends
+ *     				first, the older summary is dropped and counted
+ *
+ * Every set must end and every later set must hold exactly the target. Rep events
+ * must count 0, 1, ... within the set and stay below EMG_MAX_REPS. Rep cues are on:
+ * every set must get one cue per rep it holds, none for the reps past the target. A
+ * rep that ends in the slice a lowered target is applied at is cued on the old one,
+ * so that set may have one cue more. Each summary's
+ * samplePeriodMs must be the expected width unit, the GCD of the periods its reps
+ * were measured at, and divide each of its widths, and its index must follow the
+ * last one, past the summaries the scenario expects to be dropped.
+ *
+ *     emg_set_test
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "emg_host.h"
+#include "emg.h"
+#include "workout_config.h"
+
+#define MAX_REPS							1000
+#define MAX_SETS							8
+#define STEP_US								10000
+#define TIMEOUT_US							(120 * 1000000ull)
+
+#define LEVEL_REST							400
+#define LEVEL_EDGE							1000		//Above repThresholdLow
+#define NOISE								50
+
+typedef struct {
+	uint64_t startUs;
+	uint64_t endUs;
+	uint16_t peak;
+} Rep;
+
+typedef struct {
+	const char *name;
+	uint8_t periodMs;
+	uint16_t repMinMs;			//Rep length
+	uint16_t repMaxMs;
+	uint16_t gapMinMs;			//Between reps
+	uint16_t gapMaxMs;
+	void (*run)(void);
+} Scenario;
+
+static Rep reps[MAX_REPS];
+static uint32_t rngState = 17;
+static const Scenario *pScenario;
+static uint32_t failures;
+
+//What the sets must hold, by set since the last start
+static uint8_t wantReps[MAX_SETS];
+static uint8_t wantUnit[MAX_SETS];
+static uint8_t setsDone, repsInSet, setsDropped;
+static uint8_t cuesInSet, cueSlack;
+static uint64_t endByUs = UINT64_MAX;	//The current set must end by then
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void fail(const char *what, uint32_t a, uint32_t b)
+{
+	if (failures++ < 10)
+		printf("  %s, set %u at %.1f s: %s (%u, %u)\n", pScenario->name, setsDone,
+				shim_nowUs() / 1e6, what, a, b);
+}
+
+static void makeReps(void)
+{
+	uint64_t t = 2000000;		//After the start and the front end settling
+	uint32_t n;
+
+	for (n = 0; n < MAX_REPS; n++) {
+		t += (pScenario->gapMinMs + rnd(pScenario->gapMaxMs - pScenario->gapMinMs + 1)) * 1000;
+		reps[n].startUs = t;
+		t += (pScenario->repMinMs + rnd(pScenario->repMaxMs - pScenario->repMinMs + 1)) * 1000;
+		reps[n].endUs = t;
+		reps[n].peak = 2000 + rnd(1800);
+	}
+}
+
+static uint32_t emgSignal(uint64_t us)
+{
+	static uint32_t r = 0;
+
+	while (r < MAX_REPS && reps[r].endUs <= us)
+		r++;
+	if (r < MAX_REPS && us >= reps[r].startUs) {
+		//Flat top, one edge level sample at each end at most
+		if (us - reps[r].startUs < 5000 || reps[r].endUs - us < 5000)
+			return LEVEL_EDGE + rnd(NOISE);
+		return reps[r].peak - rnd(NOISE);
+	}
+	return LEVEL_REST + rnd(2 * NOISE) - NOISE;
+}
+
+static void packet(const uint8_t *pData, uint8_t len, app_pkt_type_t type)
+{
+	if (type != APP_PACKET_TYPE_REP_EVENT)
+		return;
+	if (pData[2] >= EMG_MAX_REPS)
+		fail("rep event index", pData[2], EMG_MAX_REPS);
+	if (pData[2] != repsInSet)
+		fail("rep event out of sequence", pData[2], repsInSet);
+	repsInSet = pData[2] + 1;
+}
+
+static void vibe(Vibe_patternId pattern, Vibe_prio prio)
+{
+	if (VIBE_PRIO_CUE == prio)
+		cuesInSet++;
+}
+
+static void setDone(const EMG_stats *pStats, uint8_t setIndex)
+{
+	uint8_t i;
+
+	if (setsDone >= MAX_SETS) {
+		fail("more sets than the workout has", setsDone, MAX_SETS);
+		return;
+	}
+	if (pStats->numReps > EMG_MAX_REPS || pStats->numReps != wantReps[setsDone])
+		fail("reps", pStats->numReps, wantReps[setsDone]);
+	if (pStats->numReps != repsInSet)
+		fail("reps against rep events", pStats->numReps, repsInSet);
+	if (cuesInSet < pStats->numReps || cuesInSet > pStats->numReps + cueSlack)
+		fail("rep cues against reps", cuesInSet, pStats->numReps);
+	if (pStats->samplePeriodMs != wantUnit[setsDone])
+		fail("width unit", pStats->samplePeriodMs, wantUnit[setsDone]);
+	if (setIndex != setsDone + setsDropped + 1)
+		fail("set index", setIndex, setsDone + setsDropped + 1);
+	if (shim_nowUs() > endByUs)
+		fail("ended late, ms", (uint32_t)((shim_nowUs() - endByUs) / 1000), 0);
+	for (i = 0; i < MIN(pStats->numReps, EMG_MAX_REPS) && pStats->samplePeriodMs; i++) {
+		if (!pStats->pulseWidth[i] || pStats->pulseWidth[i] % pStats->samplePeriodMs)
+			fail("pulse width not in units", pStats->pulseWidth[i], i);
+		if (pStats->deadWidth[i] % pStats->samplePeriodMs)
+			fail("dead width not in units", pStats->deadWidth[i], i);
+	}
+	setsDone++;
+	repsInSet = 0;
+	cuesInSet = 0;
+	cueSlack = 0;
+	endByUs = UINT64_MAX;
+}
+
+static uint8_t configure(uint8_t cmd, uint8_t sets, uint8_t repTarget, uint8_t periodMs)
+{
+	const uint8_t tlvs[] = {
+		WORKOUT_CFG_KEY_SET_COUNT, 1, sets,
+		WORKOUT_CFG_KEY_REP_COUNT, 1, repTarget,
+		WORKOUT_CFG_KEY_MAX_REST, 2, 0, 0,
+		WORKOUT_CFG_KEY_SET_TIMEOUT, 1, 60,
+		WORKOUT_CFG_KEY_MIN_REP_MS, 2, 100, 0,
+		WORKOUT_CFG_KEY_SAMPLE_PERIOD, 1, periodMs,
+		WORKOUT_CFG_KEY_HAPTIC, 1, 1,
+		WORKOUT_CFG_KEY_REP_CUE, 1, 1,
+	};
+
+	return emgHost_configure(cmd, tlvs, sizeof(tlvs));
+}
+
+static void update(uint8_t key, uint8_t value)
+{
+	const uint8_t tlv[] = { key, 1, value };
+
+	if (emgHost_configure(WORKOUT_CFG_CMD_UPDATE, tlv, sizeof(tlv)) != WORKOUT_CFG_CMD_UPDATE)
+		fail("update rejected", key, value);
+}
+
+/**
+ * Runs until the set in progress has reps reps, or sets sets are done.
+ */
+static void runUntil(uint8_t sets, uint8_t reps)
+{
+	uint64_t timeout = shim_nowUs() + TIMEOUT_US;
+
+	while (setsDone < sets && (!reps || repsInSet < reps)) {
+		if (shim_nowUs() > timeout) {
+			fail("no set end", repsInSet, sets);
+			return;
+		}
+		shim_advanceUs(STEP_US);
+	}
+}
+
+static void slice(void)
+{
+	uint8_t n;
+
+	for (n = 0; n < 3; n++) {
+		wantReps[n] = 8;
+		wantUnit[n] = 100;
+	}
+	configure(WORKOUT_CFG_CMD_START, 3, 8, 100);
+	runUntil(3, 0);
+}
+
+static void loweredTarget(void)
+{
+	wantUnit[0] = wantUnit[1] = wantUnit[2] = 20;
+	wantReps[1] = wantReps[2] = 4;
+	configure(WORKOUT_CFG_CMD_START, 3, 12, 20);
+	runUntil(1, 7);
+
+	//Applied before the next slice, which ends the set
+	wantReps[0] = repsInSet;
+	cueSlack = 1;
+	endByUs = shim_nowUs() + 2 * EMG_NUMBER_OF_SAMPLES_SLICE * 20 * 1000;
+	update(WORKOUT_CFG_KEY_REP_COUNT, 4);
+	runUntil(3, 0);
+}
+
+static void periodChange(void)
+{
+	wantReps[0] = wantReps[1] = 10;
+	wantUnit[0] = 10;
+	wantUnit[1] = 30;
+	configure(WORKOUT_CFG_CMD_START, 2, 10, 20);
+	runUntil(1, 4);
+	update(WORKOUT_CFG_KEY_SAMPLE_PERIOD, 30);
+	runUntil(2, 0);
+}
+
+static void restart(void)
+{
+	configure(WORKOUT_CFG_CMD_START, 3, 6, 20);
+	runUntil(1, 3);
+	configure(WORKOUT_CFG_CMD_STOP, 0, 1, 10);
+	repsInSet = 0;
+	cuesInSet = 0;
+
+	wantReps[0] = wantReps[1] = 6;
+	wantUnit[0] = wantUnit[1] = 50;
+	if (configure(WORKOUT_CFG_CMD_START, 2, 6, 50) != WORKOUT_CFG_CMD_START)
+		fail("start rejected", 0, 0);
+	runUntil(2, 0);
+}
+
+static void queueFull(void)
+{
+	uint8_t n;
+
+	for (n = 0; n < 3; n++) {
+		wantReps[n] = 5;
+		wantUnit[n] = 20;
+	}
+	configure(WORKOUT_CFG_CMD_START, 4, 5, 20);
+
+	//Ends with the pool empty, queued once it has blocks again. The gaps between reps
+	//keep the next rep event a slice away.
+	emgHost_setQueueFull = TRUE;
+	runUntil(1, 5);
+	shim_advanceUs(300000);
+	if (setsDone != 0)
+		fail("summary while the queue is full", setsDone, 0);
+	emgHost_setQueueFull = FALSE;
+	shim_advanceUs(200000);		//Retried every 100 ms
+	if (setsDone != 1)
+		fail("summary not queued again", setsDone, 1);
+
+	//The next set ends while this one still waits: this one is dropped
+	emgHost_setQueueFull = TRUE;
+	runUntil(2, 5);
+	repsInSet = 0;
+	cuesInSet = 0;
+	runUntil(2, 5);
+	emgHost_setQueueFull = FALSE;
+	setsDropped = 1;
+	runUntil(2, 0);
+	if (emgHost_counters[DIAG_SET_DROPPED] != 1)
+		fail("dropped summaries counted", emgHost_counters[DIAG_SET_DROPPED], 1);
+
+	runUntil(3, 0);
+}
+
+static const Scenario scenarios[] = {
+	{ "slice", 100, 300, 500, 150, 300, slice },
+	{ "lowered target", 20, 400, 900, 300, 900, loweredTarget },
+	{ "period change", 20, 400, 900, 300, 900, periodChange },
+	{ "restart", 20, 400, 900, 300, 900, restart },
+	{ "queue full", 20, 400, 600, 1600, 2000, queueFull },
+};
+
+/**
+ * One scenario, in a process of its own since the EMG task is constructed once.
+ */
+static int run(const Scenario *p)
+{
+	pScenario = p;
+	makeReps();
+	emgHost_signal = emgSignal;
+	emgHost_packetFxn = packet;
+	emgHost_setFxn = setDone;
+	emgHost_vibeFxn = vibe;
+	emgHost_init();
+
+	shim_advanceUs(1000000);
+	p->run();
+
+	printf("%-16s %3u ms %5u sets %6.1f s\n", p->name, p->periodMs, setsDone, shim_nowUs() / 1e6);
+	if (failures)
+		printf("  %u failures\n", failures);
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t i, failed = 0;
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		pid_t pid;
+		int status;
+
+		fflush(stdout);
+		pid = fork();
+		if (pid == 0)
+			exit(run(&scenarios[i]));
+		if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+				WEXITSTATUS(status)) {
+			if (pid > 0 && WIFSIGNALED(status))
+				printf("  %s: signal %d\n", scenarios[i].name, WTERMSIG(status));
+			failed++;
+		}
+	}
+	printf("\n%u failed scenarios\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Encodes EMG slices with the firmware's emg_stream.c and writes the APP_PACKET_TYPE_EMG_RAW
+ * notifications the EMG task would queue, as a capture for emg_stream_decode.py, plus
+ * the slices themselves as JSON lines to compare against.
+ *
+ *     emg_stream_dump <seed | trace> <slices> <notification length> <expected.jsonl> > capture.txt
+ *
+ * A trace is a recorded ADC stream, one sample per line; otherwise slices are generated
+ * from the seed, cycling through the shapes the encoder has to handle: rest noise,
+ * contractions, a flat line (k = 0), steps of thousands of counts (escaped residuals)
+ * and full range noise (verbatim blocks). Slices are EMG_NUMBER_OF_SAMPLES_SLICE samples
+ * at 1 ms, as emg.c sends them.
+ *
+ * The encoder's time per sample on this host goes to stderr, mean and worst slice.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "emg_stream.h"
+
+#define NOTIFY_HEADER_LEN					2
+#define SLICE_LEN							EMG_NUMBER_OF_SAMPLES_SLICE
+#define PERIOD_US							1000
+
+enum { SHAPE_REST = 0, SHAPE_CONTRACTION, SHAPE_FLAT, SHAPE_STEPS, SHAPE_NOISE, SHAPE_COUNT };
+
+static uint16_t payloadLen;
+static uint32_t rngState;
+
+//Blocks of the current slice, written out after the encoder is timed
+static uint8_t blocks[SLICE_LEN][USER_MAX_NOTIFY_LEN];
+static uint8_t numBlocks;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+uint16_t user_getNotifyPayloadLen(void)
+{
+	return payloadLen;
+}
+
+uint64_t timeSync_toShared(uint64_t localUs)
+{
+	return localUs;
+}
+
+user_app_error_type_t user_sendEmgPacket(uint8_t *pData, uint8_t len, app_pkt_type_t packetType)
+{
+	blocks[numBlocks][0] = packetType;
+	blocks[numBlocks][1] = len;
+	memcpy(&blocks[numBlocks][NOTIFY_HEADER_LEN], pData, len);
+	numBlocks++;
+	return (user_app_error_type_t)0;
+}
+
+static uint32_t clamp(int32_t v)
+{
+	return (uint32_t)(v < 0 ? 0 : (v > 4095 ? 4095 : v));
+}
+
+static void makeSlice(uint32_t n, uint32_t *pSamples)
+{
+	static int32_t level = 1800;
+	uint8_t i;
+
+	for (i = 0; i < SLICE_LEN; i++) {
+		int32_t amp;
+
+		switch (n % SHAPE_COUNT) {
+		case SHAPE_REST:
+			pSamples[i] = clamp(level + (int32_t)rnd(9) - 4);
+			break;
+		case SHAPE_CONTRACTION:
+			amp = 40 + 400 * (int32_t)(i < SLICE_LEN / 2 ? i : SLICE_LEN - i) / SLICE_LEN;
+			pSamples[i] = clamp(level + (int32_t)rnd(2 * amp + 1) - amp);
+			break;
+		case SHAPE_FLAT:
+			pSamples[i] = level;
+			break;
+		case SHAPE_STEPS:
+			//Electrode lift-off: rail to rail every few samples
+			if (i % 5 == 0)
+				level = rnd(2) ? 100 + rnd(200) : 3800 + rnd(200);
+			pSamples[i] = clamp(level + (int32_t)rnd(5) - 2);
+			break;
+		default:
+			pSamples[i] = rnd(4096);
+			break;
+		}
+	}
+	level = 1500 + rnd(600);
+}
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t samples[SLICE_LEN];
+	uint32_t slices, n, i, b;
+	uint64_t ns, totalNs = 0, worstNs = 0;
+	uint16_t notifyLen;
+	FILE *trace, *expect;
+
+	if (argc != 5) {
+		fprintf(stderr, "usage: emg_stream_dump <seed | trace> <slices> <notification length> "
+				"<expected.jsonl>\n");
+		return 2;
+	}
+	trace = fopen(argv[1], "r");
+	rngState = trace ? 1 : (strtoul(argv[1], NULL, 0) | 1);
+	slices = strtoul(argv[2], NULL, 0);
+	notifyLen = (uint16_t)strtoul(argv[3], NULL, 0);
+	if (notifyLen < NOTIFY_HEADER_LEN + EMG_STREAM_HEADER_LEN + 2 || notifyLen > USER_MAX_NOTIFY_LEN) {
+		fprintf(stderr, "notification length must be %u to %u\n",
+				NOTIFY_HEADER_LEN + EMG_STREAM_HEADER_LEN + 2, USER_MAX_NOTIFY_LEN);
+		return 2;
+	}
+	payloadLen = notifyLen;
+	expect = fopen(argv[4], "w");
+	if (!expect) {
+		perror(argv[4]);
+		return 1;
+	}
+
+	printf("# emg_stream_dump %s %s %s\n", argv[1], argv[2], argv[3]);
+	emgStream_reset();
+	for (n = 0; n < slices; n++) {
+		uint64_t firstUs = (uint64_t)n * SLICE_LEN * PERIOD_US;
+
+		if (trace) {
+			for (i = 0; i < SLICE_LEN; i++) {
+				unsigned long v;
+
+				if (fscanf(trace, "%lu", &v) != 1)
+					break;
+				samples[i] = v & 0xFFF;
+			}
+			if (i < SLICE_LEN)
+				break;
+		} else {
+			makeSlice(n, samples);
+		}
+
+		fprintf(expect, "{\"first_us\": %llu, \"period_us\": %u, \"samples\": [",
+				(unsigned long long)firstUs, PERIOD_US);
+		for (i = 0; i < SLICE_LEN; i++)
+			fprintf(expect, "%s%u", i ? ", " : "", samples[i]);
+		fprintf(expect, "]}\n");
+
+		numBlocks = 0;
+		ns = nowNs();
+		emgStream_sendSlice(samples, SLICE_LEN, firstUs, PERIOD_US);
+		ns = nowNs() - ns;
+		totalNs += ns;
+		if (ns > worstNs)
+			worstNs = ns;
+
+		for (b = 0; b < numBlocks; b++) {
+			for (i = 0; i < NOTIFY_HEADER_LEN + blocks[b][1]; i++)
+				printf("%02x", blocks[b][i]);
+			printf("\n");
+		}
+	}
+
+	fprintf(stderr, "encoder: %.1f ns per sample, worst slice %.1f ns per sample\n",
+			n ? (double)totalNs / (n * SLICE_LEN) : 0.0, (double)worstNs / SLICE_LEN);
+	if (trace)
+		fclose(trace);
+	fclose(expect);
+	return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * Ordering check and latency benchmark of the event bus (event_bus.c), built with
+ * its device path: slots reserved with __ldrex/__strex, which the shim runs as
+ * compare-and-swap.
+ *
+ * Ordering: host threads in place of the Swis publish concurrently to both sinks,
+ * each sink drained by a thread of its own that is woken through its wake function.
+ * The threads give up the CPU every few exclusive loads and stores, so publishers
+ * preempt each other inside the reservation and between it and the store.
+ * Every producer numbers its messages; each sink must get every one of them, once,
+ * in the order each producer published. A publish that finds the sink full is
+ * retried, as it is the producer's to decide. A sink that finds messages after a
+ * second without a wake lost one.
+ *
+ * Benchmark: post to handler on this host, once with the handler run by the same
+ * thread right after the publish (the bus path itself) and once across threads with
+ * the sink woken through a semaphore (adds the host's thread wake up, where the
+ * device has a task switch).
+ *
+ *     event_bus_test [messages per producer]
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "event_bus.h"
+#include "trace.h"
+
+#define PRODUCERS							4
+#define BENCH_MESSAGES						200000
+#define BENCH_ROUNDS						20000
+
+typedef struct {
+	sem_t wake;
+	uint32_t expected;
+	uint32_t received;
+	uint32_t nextSeq[PRODUCERS];
+	uint32_t disorder;
+	uint32_t lostWakes;
+} Sink;
+
+static Sink sinks[BUS_NUM_SINKS];
+static uint32_t perProducer = 20000;
+static volatile uint32_t fullCount = 0;
+static uint32_t failures = 0;
+
+//Benchmark
+static uint64_t publishNs;
+static uint32_t latencies[BENCH_MESSAGES];
+static uint32_t numLatencies;
+static sem_t handled;
+
+void trace_write(uint32_t hdr, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4)
+{
+	__atomic_add_fetch(&fullCount, 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void fail(const char *what, uint32_t a, uint32_t b)
+{
+	if (++failures <= 10)
+		printf("%s %u %u\n", what, a, b);
+}
+
+//**********************************************************************************
+// Ordering
+//**********************************************************************************
+static void wakeEmg(void)
+{
+	sem_post(&sinks[BUS_SINK_EMG].wake);
+}
+
+static void wakeApp(void)
+{
+	sem_post(&sinks[BUS_SINK_APP].wake);
+}
+
+static void check(Sink *pSink, const Bus_msg *pMsg)
+{
+	uint8_t producer = pMsg->u.rep.setIndex;
+	uint32_t seq = pMsg->u.rep.repIndex | (uint32_t)pMsg->u.rep.imuFeedback << 8;
+
+	if (producer >= PRODUCERS) {
+		fail("bad producer", producer, seq);
+		return;
+	}
+	if (seq != (pSink->nextSeq[producer] & 0xFFFF)) {
+		pSink->disorder++;
+		fail("out of order, producer/seq", producer, seq);
+	}
+	pSink->nextSeq[producer] = seq + 1;
+	pSink->received++;
+}
+
+static void handleEmg(const Bus_msg *pMsg)
+{
+	check(&sinks[BUS_SINK_EMG], pMsg);
+}
+
+static void handleApp(const Bus_msg *pMsg)
+{
+	check(&sinks[BUS_SINK_APP], pMsg);
+}
+
+static void *consumer(void *arg)
+{
+	Bus_sink sink = (Bus_sink)(uintptr_t)arg;
+	Sink *pSink = &sinks[sink];
+	struct timespec ts;
+	uint32_t before;
+
+	while (pSink->received < pSink->expected) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec++;
+		if (sem_timedwait(&pSink->wake, &ts) && errno == ETIMEDOUT) {
+			before = pSink->received;
+			bus_dispatch(sink);
+			if (pSink->received != before)
+				pSink->lostWakes++;
+			else
+				break;		//Nothing came in a second, the producers are done
+			continue;
+		}
+		bus_dispatch(sink);
+	}
+	return NULL;
+}
+
+static void *producer(void *arg)
+{
+	uint8_t id = (uint8_t)(uintptr_t)arg;
+	Bus_msg msg;
+	uint32_t seq;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.u.rep.setIndex = id;
+	for (seq = 0; seq < perProducer; seq++) {
+		msg.u.rep.repIndex = seq & 0xFF;
+		msg.u.rep.imuFeedback = (seq >> 8) & 0xFF;
+
+		//Each sink subscribes one of the events, so a retry never repeats a message
+		msg.event = BUS_EVT_REP_START;
+		while (!bus_publish(&msg))
+			sched_yield();
+		msg.event = BUS_EVT_REP_END;
+		while (!bus_publish(&msg))
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void ordering(void)
+{
+	pthread_t producers[PRODUCERS], consumers[BUS_NUM_SINKS];
+	uint8_t i, s;
+
+	shim_exclusiveYield = 3;
+	bus_addSink(BUS_SINK_EMG, wakeEmg);
+	bus_addSink(BUS_SINK_APP, wakeApp);
+	bus_subscribe(BUS_SINK_EMG, BUS_EVT_REP_START, handleEmg);
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_REP_END, handleApp);
+
+	for (s = 0; s < BUS_NUM_SINKS; s++) {
+		sem_init(&sinks[s].wake, 0, 0);
+		sinks[s].expected = PRODUCERS * perProducer;
+		pthread_create(&consumers[s], NULL, consumer, (void *)(uintptr_t)s);
+	}
+	for (i = 0; i < PRODUCERS; i++)
+		pthread_create(&producers[i], NULL, producer, (void *)(uintptr_t)i);
+	for (i = 0; i < PRODUCERS; i++)
+		pthread_join(producers[i], NULL);
+	for (s = 0; s < BUS_NUM_SINKS; s++)
+		pthread_join(consumers[s], NULL);
+	shim_exclusiveYield = 0;
+
+	for (s = 0; s < BUS_NUM_SINKS; s++) {
+		Sink *pSink = &sinks[s];
+
+		printf("sink %u: %u of %u messages, %u out of order, %u lost wakes\n", s,
+			   pSink->received, pSink->expected, pSink->disorder, pSink->lostWakes);
+		if (pSink->received != pSink->expected)
+			fail("sink/received", s, pSink->received);
+		if (pSink->lostWakes)
+			fail("sink/lost wakes", s, pSink->lostWakes);
+		for (i = 0; i < PRODUCERS; i++)
+			if (pSink->nextSeq[i] != perProducer)
+				fail("producer ended at", i, pSink->nextSeq[i]);
+	}
+	printf("%u producers x %u messages x 2 events, sink full %u times\n", PRODUCERS,
+		   perProducer, fullCount);
+}
+
+//**********************************************************************************
+// Benchmark
+//**********************************************************************************
+static void stampLatency(const Bus_msg *pMsg)
+{
+	if (numLatencies < BENCH_MESSAGES)
+		latencies[numLatencies++] = (uint32_t)(nowNs() - publishNs);
+}
+
+static void stampAndSignal(const Bus_msg *pMsg)
+{
+	stampLatency(pMsg);
+	sem_post(&handled);
+}
+
+static void *benchSink(void *arg)
+{
+	uint32_t n = 0;
+
+	while (n < BENCH_ROUNDS) {
+		sem_wait(&sinks[BUS_SINK_APP].wake);
+		bus_dispatch(BUS_SINK_APP);
+		n = numLatencies;
+	}
+	return NULL;
+}
+
+static int cmpU32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name)
+{
+	qsort(latencies, numLatencies, sizeof(uint32_t), cmpU32);
+	printf("%-13s %8u %8u ns %8u ns %8u ns\n", name, numLatencies,
+		   latencies[numLatencies / 2], latencies[numLatencies * 99 / 100],
+		   latencies[numLatencies - 1]);
+	numLatencies = 0;
+}
+
+static void benchmark(void)
+{
+	pthread_t thread;
+	Bus_msg msg;
+	uint32_t i;
+
+	memset(&msg, 0, sizeof(msg));
+	printf("%-13s %8s %11s %11s %11s\n", "post->handler", "messages", "p50", "p99", "max");
+
+	//Same thread: reserve, store, wake, dispatch, handler
+	bus_addSink(BUS_SINK_EMG, NULL);
+	bus_subscribe(BUS_SINK_EMG, BUS_EVT_MOTION, stampLatency);
+	msg.event = BUS_EVT_MOTION;
+	for (i = 0; i < BENCH_MESSAGES; i++) {
+		publishNs = nowNs();
+		bus_publish(&msg);
+		bus_dispatch(BUS_SINK_EMG);
+	}
+	report("same thread");
+
+	//Across threads, one message at a time
+	sem_init(&handled, 0, 0);
+	sem_init(&sinks[BUS_SINK_APP].wake, 0, 0);
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_SET_DONE, stampAndSignal);
+	pthread_create(&thread, NULL, benchSink, NULL);
+	msg.event = BUS_EVT_SET_DONE;
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		publishNs = nowNs();
+		bus_publish(&msg);
+		sem_wait(&handled);
+	}
+	pthread_join(thread, NULL);
+	report("cross thread");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		perProducer = strtoul(argv[1], NULL, 0);
+	if (perProducer == 0 || perProducer > 0x10000) {
+		fprintf(stderr, "usage: event_bus_test [messages per producer, up to 65536]\n");
+		return 2;
+	}
+
+	ordering();
+	benchmark();
+
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+}
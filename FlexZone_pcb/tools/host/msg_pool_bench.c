@@ -0,0 +1,379 @@
+/*
+ * Stress check and benchmark of the application message pool (msg_pool.c) against
+ * the first-fit heap behind ICall_malloc.
+ *
+ * Benchmark: a streaming session is replayed twice over the same seed, once with
+ * app_msg_t allocations going through msgPool_alloc and once straight to the heap.
+ * Both runs share the heap with the stack's notification buffers, which live until
+ * their connection event. Reported per allocator: time per alloc + free on this host,
+ * heap blocks walked per allocation (the part that scales on the device), and
+ * fragmentation: the largest free block against all free bytes, and allocations that
+ * failed although enough bytes were free.
+ *
+ * Stress: host threads in place of the Swi and Task contexts allocate, fill, check and
+ * free blocks concurrently, through the pool, its spill into the larger class and its
+ * heap fallback; every block must come back intact and the counters must balance. Only
+ * the Task threads may reach the heap, the Swi ones must fail once the pool is empty.
+ *
+ *     msg_pool_bench [events]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "msg_pool.h"
+
+//Target sizes: app_msg_t is 12 bytes, char_data_t 6
+#define APP_MSG_LEN							12
+#define CHAR_DATA_LEN						6
+
+//The ICall heap model: OSAL style first fit over 4-byte headed blocks, coalesced
+//while walking
+#define HEAP_SIZE							3000	//HEAPMGR_SIZE of the project
+#define HEAP_HDR							4
+#define HEAP_USED							0x8000
+
+#define STACK_BUFS_MAX						16
+#define APP_MSGS_MAX						12		//USER_TXQ_DEPTH plus messages not yet taken by the task
+
+#define STRESS_THREADS						4
+#define STRESS_ROUNDS						200000
+#define STRESS_HELD							6
+
+static uint32_t heap[HEAP_SIZE / 4];
+static uint64_t heapWalks, heapAllocs, heapFragFails, heapFails;
+static uint32_t heapFragSamples;
+static double heapFragSum;
+static uint8_t heapLocked;		//Stress runs take the Hwi lock like ICall does
+static volatile uint32_t heapOutsideTask;
+
+static uint32_t rngState = 1;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static uint16_t *hdr(uint32_t off)
+{
+	return (uint16_t *)((uint8_t *)heap + off);
+}
+
+static void heapInit(void)
+{
+	memset(heap, 0, sizeof(heap));
+	*hdr(0) = HEAP_SIZE;
+	heapWalks = heapAllocs = heapFragFails = heapFails = 0;
+	heapFragSum = 0;
+	heapFragSamples = 0;
+}
+
+static void *heapAlloc(uint16_t size)
+{
+	uint32_t need = (size + HEAP_HDR + 3) & ~3u, off = 0, freeBytes = 0;
+	void *p = NULL;
+
+	heapAllocs++;
+	while (off < HEAP_SIZE) {
+		uint16_t len = *hdr(off) & ~HEAP_USED;
+
+		heapWalks++;
+		if (!(*hdr(off) & HEAP_USED)) {
+			//Coalesce the free run that follows
+			while (off + len < HEAP_SIZE && !(*hdr(off + len) & HEAP_USED))
+				len += *hdr(off + len);
+			*hdr(off) = len;
+			if (len >= need) {
+				if (len - need >= HEAP_HDR + 4) {
+					*hdr(off + need) = len - need;
+					len = need;
+				}
+				*hdr(off) = len | HEAP_USED;
+				p = (uint8_t *)heap + off + HEAP_HDR;
+				break;
+			}
+			freeBytes += len;
+		}
+		off += len;
+	}
+
+	if (p == NULL) {
+		heapFails++;
+		if (freeBytes >= need)
+			heapFragFails++;
+	}
+	return p;
+}
+
+static void heapFree(void *p)
+{
+	uint32_t off = (uint8_t *)p - (uint8_t *)heap - HEAP_HDR;
+
+	*hdr(off) &= ~HEAP_USED;
+}
+
+/**
+ * 1 - largest free block / free bytes, 0 for one contiguous free area.
+ */
+static void heapSampleFragmentation(void)
+{
+	uint32_t off = 0, total = 0, largest = 0, run = 0;
+
+	while (off < HEAP_SIZE) {
+		uint16_t len = *hdr(off) & ~HEAP_USED;
+		if (*hdr(off) & HEAP_USED) {
+			run = 0;
+		} else {
+			run += len;
+			total += len;
+			if (run > largest)
+				largest = run;
+		}
+		off += len;
+	}
+	if (total) {
+		heapFragSum += 1.0 - (double)largest / total;
+		heapFragSamples++;
+	}
+}
+
+void *ICall_malloc(uint16_t size)
+{
+	UInt key;
+	void *p;
+
+	if (BIOS_getThreadType() != BIOS_ThreadType_Task)
+		__sync_fetch_and_add(&heapOutsideTask, 1);
+	key = heapLocked ? Hwi_disable() : 0;
+	p = heapAlloc(size);
+
+	if (heapLocked)
+		Hwi_restore(key);
+	return p;
+}
+
+void ICall_free(void *pMsg)
+{
+	UInt key;
+
+	if (BIOS_getThreadType() != BIOS_ThreadType_Task)
+		__sync_fetch_and_add(&heapOutsideTask, 1);
+	key = heapLocked ? Hwi_disable() : 0;
+	heapFree(pMsg);
+	if (heapLocked)
+		Hwi_restore(key);
+}
+
+void diag_allocFailed(void)
+{
+}
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+typedef struct {
+	void *p;
+	uint32_t freeAt;
+} Held;
+
+/**
+ * One app message of a streaming session: mostly IMU and EMG stream packets, a rep
+ * event now and then, the odd write or GAP message.
+ */
+static uint16_t appMsgSize(void)
+{
+	uint32_t r = rnd(100);
+
+	if (r < 70)
+		return APP_MSG_LEN + CHAR_DATA_LEN + 4 + 12 * (1 + rnd(7));		//IMU stream
+	if (r < 85)
+		return APP_MSG_LEN + CHAR_DATA_LEN + 2 + 40 + rnd(57);			//EMG raw block
+	if (r < 93)
+		return APP_MSG_LEN + CHAR_DATA_LEN + 2 + 11;						//Rep event
+	if (r < 98)
+		return APP_MSG_LEN + CHAR_DATA_LEN + 1 + rnd(20);				//Characteristic write
+	return APP_MSG_LEN + 4;												//GAP state
+}
+
+/**
+ * Replays a streaming session. The task drains app messages a few events after they
+ * were queued, longer while the connection stalls; the stack's buffers for the sent
+ * notifications stay until their connection event.
+ */
+static void replay(uint32_t events, uint8_t usePool, const char *name)
+{
+	Held app[APP_MSGS_MAX], stack[STACK_BUFS_MAX];
+	uint32_t numApp = 0, numStack = 0, e, i, stall = 0;
+	uint64_t ns = 0, ops = 0, dropped = 0;
+
+	heapInit();
+	msgPool_init();
+	rngState = 12345;
+	memset((void *)msgPool_getStats(), 0, sizeof(MsgPool_stats));
+
+	for (e = 0; e < events; e++) {
+		uint64_t t0;
+		uint16_t size = appMsgSize();
+		void *p;
+
+		if (stall == 0 && rnd(400) == 0)
+			stall = 20 + rnd(60);		//Connection events missed
+		else if (stall)
+			stall--;
+
+		//Stack buffers of sent notifications, freed once their event passed
+		for (i = 0; i < numStack; ) {
+			if (stack[i].freeAt <= e) {
+				ICall_free(stack[i].p);
+				stack[i] = stack[--numStack];
+			} else {
+				i++;
+			}
+		}
+
+		//Task drains queued messages
+		for (i = 0; i < numApp; ) {
+			if (!stall && app[i].freeAt <= e) {
+				uint16_t bufLen = 7 + 20 + rnd(77);
+				if (numStack < STACK_BUFS_MAX) {
+					stack[numStack].p = ICall_malloc(bufLen);
+					stack[numStack].freeAt = e + 1 + rnd(6);
+					if (stack[numStack].p)
+						numStack++;
+				}
+				t0 = nowNs();
+				if (usePool)
+					msgPool_free(app[i].p);
+				else
+					ICall_free(app[i].p);
+				ns += nowNs() - t0;
+				app[i] = app[--numApp];
+			} else {
+				i++;
+			}
+		}
+
+		if (numApp == APP_MSGS_MAX) {
+			dropped++;
+			continue;
+		}
+		t0 = nowNs();
+		p = usePool ? msgPool_alloc(size) : ICall_malloc(size);
+		ns += nowNs() - t0;
+		ops++;
+		if (p == NULL) {
+			dropped++;
+			continue;
+		}
+		memset(p, 0xA5, size);
+		app[numApp].p = p;
+		app[numApp].freeAt = e + 1 + rnd(3);
+		numApp++;
+
+		if (e % 16 == 0)
+			heapSampleFragmentation();
+	}
+
+	printf("%-6s %8.1f ns %10.2f %10.3f %8llu %8llu",
+			name, (double)ns / ops, (double)heapWalks / (heapAllocs ? heapAllocs : 1),
+			heapFragSamples ? heapFragSum / heapFragSamples : 0.0,
+			(unsigned long long)heapFragFails, (unsigned long long)dropped);
+	if (usePool) {
+		const MsgPool_stats *s = msgPool_getStats();
+		printf("   small hw %u/%u, large hw %u/%u, exhausted %u/%u, heap fallbacks %u",
+				s->cls[0].highWater, MSG_POOL_SMALL_BLOCK_COUNT, s->cls[1].highWater,
+				MSG_POOL_LARGE_BLOCK_COUNT, s->cls[0].exhausted, s->cls[1].exhausted,
+				s->heapFallbacks);
+	}
+	printf("\n");
+}
+
+static volatile uint32_t stressErrors;
+
+static void *stressThread(void *arg)
+{
+	uint32_t seed = (uint32_t)(uintptr_t)arg * 2654435761u | 1, n, k;
+	struct { uint8_t *p; uint16_t size; uint8_t tag; } held[STRESS_HELD];
+
+	//Odd threads stand in for Swis
+	shim_threadType = ((uintptr_t)arg & 1) ? BIOS_ThreadType_Swi : BIOS_ThreadType_Task;
+	memset(held, 0, sizeof(held));
+	for (n = 0; n < STRESS_ROUNDS; n++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		k = seed % STRESS_HELD;
+
+		if (held[k].p) {
+			for (uint16_t i = 0; i < held[k].size; i++)
+				if (held[k].p[i] != held[k].tag) {
+					__sync_fetch_and_add(&stressErrors, 1);
+					break;
+				}
+			msgPool_free(held[k].p);
+			held[k].p = NULL;
+		} else {
+			held[k].size = 8 + (seed >> 8) % 108;
+			held[k].tag = (uint8_t)(seed >> 20);
+			held[k].p = msgPool_alloc(held[k].size);
+			if (held[k].p)
+				memset(held[k].p, held[k].tag, held[k].size);
+		}
+	}
+	for (k = 0; k < STRESS_HELD; k++)
+		msgPool_free(held[k].p);
+	return NULL;
+}
+
+static int stress(void)
+{
+	pthread_t threads[STRESS_THREADS];
+	const MsgPool_stats *s = msgPool_getStats();
+	uint8_t i;
+
+	heapInit();
+	msgPool_init();
+	memset((void *)s, 0, sizeof(*s));
+	heapLocked = 1;
+	for (i = 0; i < STRESS_THREADS; i++)
+		pthread_create(&threads[i], NULL, stressThread, (void *)(uintptr_t)(i + 1));
+	for (i = 0; i < STRESS_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	heapLocked = 0;
+
+	printf("stress  %u threads x %u rounds: %u corrupted blocks, in use %u/%u, "
+			"heap fallbacks %u, failures %u (%u outside a Task), heap used outside a Task %u\n",
+			STRESS_THREADS, STRESS_ROUNDS, stressErrors, s->cls[0].inUse, s->cls[1].inUse,
+			s->heapFallbacks, s->failures, s->notTask, heapOutsideTask);
+
+	//Every block is back: the whole heap is one free block again and the pool
+	//hands out its full count per class
+	heapSampleFragmentation();
+	return stressErrors || s->cls[0].inUse || s->cls[1].inUse || heapFragSum != 0.0 ||
+			s->heapFallbacks == 0 || s->notTask == 0 || heapOutsideTask;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t events = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+
+	//The replay allocates as the application task does
+	shim_threadType = BIOS_ThreadType_Task;
+
+	printf("%u events, %u B heap shared with the stack's notification buffers\n", events, HEAP_SIZE);
+	printf("%-6s %11s %10s %10s %8s %8s\n", "", "alloc+free", "walk/alloc", "frag", "fragfail",
+			"dropped");
+	replay(events, 0, "heap");
+	replay(events, 1, "pool");
+
+	return stress();
+}
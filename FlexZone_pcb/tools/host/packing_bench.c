@@ -0,0 +1,239 @@
+/*
+ * Packing benchmark: how much stream data each radio packet carries at every ATT MTU
+ * a central may negotiate.
+ *
+ * The device asks for an MTU of USER_MAX_NOTIFY_LEN + 3; a central offering more ends
+ * up there, one offering less sets the limit. For every resulting notification payload
+ * the three streams are packed the way the firmware does:
+ *
+ *     IMU		frames per packet as accel_streamSample sizes them
+ *     raw EMG	emgStream_sendSlice (emg_stream.c) over a synthetic signal, rests
+ *     			and contractions
+ *     summary	setHistory_fillFragment (set_history.c) over random sets
+ *
+ * Reported per stream and MTU: notification value length, LL packets per notification
+ * on the stack's 27 byte LL payload, data bytes per LL packet and radio time per data
+ * byte (LE 1M, the central's empty PDU and two T_IFS per packet). The DLE column is
+ * data per LL packet with 251 byte LL payloads, for a stack with data length
+ * extension; BLE stack 2.1 has none. Raw EMG data bytes count 12 bits per sample, so
+ * they run above the bytes on air when the Rice coding pays off.
+ *
+ * Fails if a notification exceeds the payload or the largest MTU carries less data per
+ * LL packet than the default one.
+ *
+ *     packing_bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "accelerometer.h"
+#include "emg_stream.h"
+#include "set_history.h"
+#include "Accel_Service.h"
+#include "EMG_Service.h"
+
+#define NOTIFY_HEADER_LEN					2
+#define DEVICE_MTU							(USER_MAX_NOTIFY_LEN + 3)
+
+#define LL_PAYLOAD							27
+#define LL_PAYLOAD_DLE						251
+#define L2CAP_ATT_HEADER					7
+#define LL_OVERHEAD							10
+#define US_PER_BYTE							8
+#define EMPTY_PDU_US						80
+#define T_IFS_US							150
+
+#define EMG_SAMPLES							200000
+#define EMG_SLICE							EMG_NUMBER_OF_SAMPLES_SLICE
+#define SUMMARY_SETS						500
+
+enum { STREAM_IMU = 0, STREAM_EMG, STREAM_SUMMARY, STREAM_COUNT };
+static const char *streamNames[] = { "IMU", "raw EMG", "summary" };
+
+typedef struct {
+	uint32_t notifs;
+	uint64_t valueBytes;	//Notification values, packet headers included
+	uint64_t dataBytes;		//What the stream carries
+	uint64_t llPackets;
+	uint64_t llPacketsDle;
+	uint64_t radioUs;
+	uint16_t maxValue;
+} Packing;
+
+static uint16_t payloadLen;
+static Packing *pCur;
+static uint32_t failures;
+static uint32_t emgSamples[EMG_SAMPLES];
+
+static uint32_t rngState = 5;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+uint16_t user_getNotifyPayloadLen(void)
+{
+	return payloadLen;
+}
+
+uint64_t timeSync_toShared(uint64_t localUs)
+{
+	return localUs;
+}
+
+static void addNotification(uint16_t valueLen, uint32_t dataBytes)
+{
+	uint16_t left = valueLen + L2CAP_ATT_HEADER;
+
+	pCur->notifs++;
+	pCur->valueBytes += valueLen;
+	pCur->dataBytes += dataBytes;
+	pCur->llPacketsDle += (left + LL_PAYLOAD_DLE - 1) / LL_PAYLOAD_DLE;
+	while (left) {
+		uint16_t n = MIN(left, LL_PAYLOAD);
+
+		pCur->llPackets++;
+		pCur->radioUs += (LL_OVERHEAD + n) * US_PER_BYTE + 2 * T_IFS_US + EMPTY_PDU_US;
+		left -= n;
+	}
+	if (valueLen > pCur->maxValue)
+		pCur->maxValue = valueLen;
+}
+
+user_app_error_type_t user_sendEmgPacket(uint8_t *pData, uint8_t len, app_pkt_type_t packetType)
+{
+	//Samples in the block, 12 bits each
+	addNotification(NOTIFY_HEADER_LEN + len, (pData[2] * EMG_STREAM_SAMPLE_BITS + 7) / 8);
+	return (user_app_error_type_t)0;
+}
+
+/**
+ * Averaged EMG: a quiet baseline, then contractions of about a second with a rising
+ * and falling envelope.
+ */
+static void makeEmg(void)
+{
+	uint32_t i;
+	int32_t v;
+
+	for (i = 0; i < EMG_SAMPLES; i++) {
+		uint32_t phase = i % 3000;
+		int32_t amp = (phase < 1000) ? 0 : (phase < 2000 ? (int32_t)(phase - 1000) / 3 :
+				(int32_t)(3000 - phase) / 3);
+
+		v = 1800 + (int32_t)rnd(9) - 4;
+		if (amp)
+			v += ((int32_t)rnd(2 * amp + 1) - amp) + ((int32_t)rnd(2 * amp + 1) - amp) / 2;
+		emgSamples[i] = (uint32_t)(v < 0 ? 0 : (v > 4095 ? 4095 : v));
+	}
+}
+
+static void packImu(void)
+{
+	uint16_t maxLen = MIN(payloadLen, ACCEL_STREAM_LEN) - NOTIFY_HEADER_LEN;
+	uint16_t frames = (maxLen - ACCEL_STREAM_HEADER_SIZE) / ACCEL_STREAM_FRAME_SIZE;
+	uint32_t n;
+
+	//One minute at 100 Hz
+	for (n = 0; n < 6000 / frames; n++)
+		addNotification(NOTIFY_HEADER_LEN + ACCEL_STREAM_HEADER_SIZE +
+						frames * ACCEL_STREAM_FRAME_SIZE, frames * ACCEL_STREAM_FRAME_SIZE);
+}
+
+static void packEmg(void)
+{
+	uint32_t i;
+
+	emgStream_reset();
+	for (i = 0; i + EMG_SLICE <= EMG_SAMPLES; i += EMG_SLICE)
+		emgStream_sendSlice(&emgSamples[i], EMG_SLICE, (uint64_t)i * 1000, 1000);
+}
+
+static void packSummaries(void)
+{
+	uint8_t noti[USER_MAX_NOTIFY_LEN];
+	uint16_t fragLen = MIN(payloadLen, EMG_STREAM_LEN) - NOTIFY_HEADER_LEN;
+	EMG_stats s;
+	uint32_t n;
+	uint8_t id, frag, i;
+
+	rngState = 9;
+	for (n = 0; n < SUMMARY_SETS; n++) {
+		memset(&s, 0, sizeof(s));
+		s.samplePeriodMs = 10;
+		s.numReps = 1 + rnd(EMG_MAX_REPS);
+		s.setDone = 1;
+		for (i = 0; i < s.numReps; i++) {
+			s.pulseWidth[i] = (40 + rnd(200)) * s.samplePeriodMs;
+			s.deadWidth[i] = rnd(300) * s.samplePeriodMs;
+			s.concentricTime[i] = 300 + rnd(2000);
+			s.eccentricTime[i] = 300 + rnd(3000);
+			s.peakIntensity[i] = 500 + rnd(3500);
+			s.movedOrNah[i] = rnd(2);
+		}
+		id = setHistory_add(&s, 1 + n % 12, 1);
+
+		for (frag = 0; ; frag++) {
+			uint16_t len = setHistory_fillFragment(id, frag, noti, fragLen);
+
+			if (len == 0)
+				break;
+			addNotification(NOTIFY_HEADER_LEN + len, len - 1);
+			if (noti[0] & SET_SUMMARY_FRAG_LAST)
+				break;
+		}
+	}
+}
+
+int main(void)
+{
+	static const uint16_t centralMtus[] = { 23, 27, 35, 50, 65, 100, 185, 247 };
+	Packing result[sizeof(centralMtus) / sizeof(centralMtus[0])][STREAM_COUNT];
+	uint8_t m, st, last = sizeof(centralMtus) / sizeof(centralMtus[0]) - 1;
+
+	makeEmg();
+	memset(result, 0, sizeof(result));
+
+	for (m = 0; m <= last; m++) {
+		payloadLen = MIN(centralMtus[m], DEVICE_MTU) - 3;
+
+		pCur = &result[m][STREAM_IMU];
+		packImu();
+		pCur = &result[m][STREAM_EMG];
+		packEmg();
+		pCur = &result[m][STREAM_SUMMARY];
+		packSummaries();
+
+		for (st = 0; st < STREAM_COUNT; st++)
+			if (result[m][st].maxValue > payloadLen) {
+				printf("%s: %u byte notification at a %u byte payload\n", streamNames[st],
+						result[m][st].maxValue, payloadLen);
+				failures++;
+			}
+	}
+
+	for (st = 0; st < STREAM_COUNT; st++) {
+		printf("\n%-8s %4s %4s %8s %9s %10s %9s %11s\n", streamNames[st], "MTU", "used",
+				"value B", "LL/notif", "data B/LL", "DLE B/LL", "us/data B");
+		for (m = 0; m <= last; m++) {
+			const Packing *p = &result[m][st];
+
+			printf("%-8s %4u %4u %8.1f %9.2f %10.2f %9.2f %11.2f\n", "", centralMtus[m],
+					MIN(centralMtus[m], DEVICE_MTU), (double)p->valueBytes / p->notifs,
+					(double)p->llPackets / p->notifs, (double)p->dataBytes / p->llPackets,
+					(double)p->dataBytes / p->llPacketsDle, (double)p->radioUs / p->dataBytes);
+		}
+		if ((double)result[last][st].dataBytes / result[last][st].llPackets <=
+				(double)result[0][st].dataBytes / result[0][st].llPackets) {
+			printf("%s: no gain over the default MTU\n", streamNames[st]);
+			failures++;
+		}
+	}
+
+	printf("\n%u failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * Rep cue latency: from the EMG sample that ends a rep to the vibe motor turning on,
+ * with the firmware's EMG task (emg.c) and haptic sequencer (vibe.c) on the host shim,
+ * see emg_host.h. The budget is 50 ms.
+ *
+ * The ADC reads a workout of reps with random rests, each a rise to its peak and a
+ * fall back, timed so its concentric (start to peak) and eccentric (peak to end) are
+ * on the tempo targets, well under or well over one of them. Rep cues and tempo
+ * coaching are on, so every rep must get the tick or the tempo cue its times call
+ * for, told apart by the first pulse the motor plays. For every sample period given
+ * the run reports
+ *
+ *     sample		end sample read to motor on, the budget (the Swis take no
+ *     				simulated time, so anything but 0 is a cue that waited)
+ *     signal		end of the rep in the signal to motor on, adds the wait for the
+ *     				next sample
+ *     host			end sample read to motor on on this host: the rest of the sample
+ *     				Swi, the vibe Swi and the motor drive
+ *
+ * and fails if a rep gets no cue or the wrong one, or its cue is 50 ms or more after
+ * the end sample, or a set ends without its buzz.
+ *
+ *     rep_cue_latency [period ms ...]		default 10 20 50
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "emg_host.h"
+#include "emg.h"
+#include "workout_config.h"
+
+#define REPS								300
+#define REPS_PER_SET						10
+#define SET_TIMEOUT_SEC						8
+#define SET_REST_MS							12000
+#define CONCENTRIC_TARGET					10			//100 ms
+#define ECCENTRIC_TARGET					20
+#define BUDGET_US							50000
+#define MAX_ENDS							8
+
+#define LEVEL_REST							400
+#define LEVEL_EDGE							1000		//Above repThresholdLow
+#define NOISE								50
+
+typedef enum {
+	CUE_TICK = 0,
+	CUE_SLOWER,
+	CUE_FASTER,
+	NUM_CUES
+} Cue;
+
+typedef struct {
+	uint64_t startUs;
+	uint64_t peakUs;
+	uint64_t endUs;
+	uint16_t peak;
+	uint8_t cue;
+} Rep;
+
+static Rep reps[REPS];
+static uint32_t rngState = 13;
+extern PIN_Handle vibePinHandle;
+
+//End samples whose cue is still to come, oldest first
+static uint64_t endUs[MAX_ENDS];
+static uint64_t endReadNs[MAX_ENDS];
+static uint8_t endHead, endCount;
+static uint32_t endRep;
+static uint8_t sigInRep;
+static uint64_t lastSampleUs = UINT64_MAX;
+
+//Motor
+static Bool motorOn;
+static uint64_t onUs;
+static uint8_t onDuty;
+static int32_t cueRep = -1;				//Rep of the pulse playing, -1 for none
+
+static uint32_t periodMs;
+static uint32_t cues, failures, buzzes;
+static uint32_t cueCounts[NUM_CUES];
+static uint32_t *sampleUs, *signalUs, *hostNs;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void fail(const char *what, uint32_t a, uint32_t b)
+{
+	if (failures++ < 10)
+		printf("  %u ms period, rep %u: %s (%u, %u)\n", periodMs, endRep, what, a, b);
+}
+
+/**
+ * Phase times as the cue detector measures them: the concentric from the first
+ * sample above repThresholdHigh, so the rise is longer by the part below it; the
+ * eccentric to the first sample back at rest.
+ */
+static void makeReps(void)
+{
+	uint64_t t = 2000000;		//After the start and the front end settling
+	uint32_t n, conc, ecc;
+
+	for (n = 0; n < REPS; n++) {
+		t += ((n % REPS_PER_SET) ? 300 + rnd(2200) : SET_REST_MS) * 1000;
+		conc = CONCENTRIC_TARGET * 100 * (90 + rnd(21)) / 100;
+		ecc = ECCENTRIC_TARGET * 100 * (90 + rnd(21)) / 100;
+		reps[n].cue = CUE_TICK;
+		switch (rnd(5)) {
+		case 1:
+			ecc = ECCENTRIC_TARGET * 100 / 2;
+			reps[n].cue = CUE_SLOWER;
+			break;
+		case 2:
+			ecc = ECCENTRIC_TARGET * 100 * 8 / 5;
+			reps[n].cue = CUE_FASTER;
+			break;
+		case 3:
+			conc = CONCENTRIC_TARGET * 100 / 2;
+			reps[n].cue = CUE_SLOWER;
+			break;
+		case 4:
+			conc = CONCENTRIC_TARGET * 100 * 8 / 5;
+			reps[n].cue = CUE_FASTER;
+			break;
+		}
+		reps[n].peak = 2500 + rnd(1300);
+		reps[n].startUs = t;
+		t += (uint64_t)conc * 1000 * (reps[n].peak - LEVEL_EDGE) /
+			 (reps[n].peak - WORKOUT_CFG_DEFAULT_THRESHOLD_HIGH);
+		reps[n].peakUs = t;
+		t += (uint64_t)ecc * 1000;
+		reps[n].endUs = t;
+	}
+}
+
+static uint32_t emgSignal(uint64_t us)
+{
+	static uint32_t r = 0;
+	uint32_t level;
+
+	while (r < REPS && reps[r].endUs <= us)
+		r++;
+	if (r < REPS && us >= reps[r].startUs) {
+		//From LEVEL_EDGE to the peak and back
+		const Rep *pRep = &reps[r];
+
+		if (us < pRep->peakUs)
+			level = LEVEL_EDGE + (uint32_t)((pRep->peak - LEVEL_EDGE) * (us - pRep->startUs) /
+											(pRep->peakUs - pRep->startUs));
+		else
+			level = LEVEL_EDGE + (uint32_t)((pRep->peak - LEVEL_EDGE) * (pRep->endUs - us) /
+											(pRep->endUs - pRep->peakUs));
+		level += rnd(NOISE);
+	} else {
+		level = LEVEL_REST + rnd(2 * NOISE) - NOISE;
+	}
+
+	//First read of a sample, the averaged reads all see the same time
+	if (us != lastSampleUs) {
+		lastSampleUs = us;
+		if (level >= myWorkoutConfig.repThresholdHigh) {
+			sigInRep = 1;
+		} else if (level < myWorkoutConfig.repThresholdLow && sigInRep) {
+			sigInRep = 0;
+			if (endCount == MAX_ENDS) {
+				fail("more rep ends than cues", endCount, 0);
+			} else {
+				endUs[(endHead + endCount) % MAX_ENDS] = us;
+				endReadNs[(endHead + endCount++) % MAX_ENDS] = emgHost_ns();
+			}
+		}
+	}
+	return level;
+}
+
+/**
+ * Tells the cue apart by its first pulse: the tempo cues by their duty and length,
+ * see vibe.h.
+ */
+static void pulseEnded(uint64_t us)
+{
+	uint32_t ms = (uint32_t)((us - onUs) / 1000);
+	Cue cue;
+
+	//The rest of a tempo cue's pulses, or the set done buzz
+	if (cueRep < 0) {
+		if (ms == 400)
+			buzzes++;
+		return;
+	}
+	if (onDuty == 60)
+		cue = CUE_SLOWER;
+	else if (ms == 40)
+		cue = CUE_FASTER;
+	else if (ms == 30)
+		cue = CUE_TICK;
+	else {
+		fail("pulse of ms at duty", ms, onDuty);
+		cueRep = -1;
+		return;
+	}
+	cueCounts[cue]++;
+	if (cue != reps[cueRep].cue)
+		fail("cue, expected", cue, reps[cueRep].cue);
+	cueRep = -1;
+}
+
+static void ioChanged(void)
+{
+	uint32_t bit = 1u << Board_VIBE_MOTOR;
+	Bool on = (vibePinHandle->muxed & bit) ? shim_gpt0.enabled : (vibePinHandle->outputs & bit) != 0;
+	uint64_t now = shim_nowUs();
+
+	if (on == motorOn)
+		return;
+	motorOn = on;
+	if (!on) {
+		pulseEnded(now);
+		return;
+	}
+
+	onUs = now;
+	onDuty = (vibePinHandle->muxed & bit) ?
+			 (shim_gpt0.load - shim_gpt0.match) * 100 / shim_gpt0.load : 100;
+	if (!endCount || endUs[endHead] > now) {
+		//Set done or another cue
+		cueRep = -1;
+		return;
+	}
+
+	if (now - endUs[endHead] >= BUDGET_US)
+		fail("motor on after the end sample, us", (uint32_t)(now - endUs[endHead]), 0);
+	hostNs[cues] = (uint32_t)(emgHost_ns() - endReadNs[endHead]);
+	sampleUs[cues] = (uint32_t)(now - endUs[endHead]);
+	signalUs[cues] = (uint32_t)(now - reps[endRep].endUs);
+	cues++;
+	cueRep = endRep++;
+	endHead = (endHead + 1) % MAX_ENDS;
+	endCount--;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint32_t pct(uint32_t *pV, uint32_t n, uint32_t p)
+{
+	return n ? pV[MIN(n - 1, n * p / 100)] : 0;
+}
+
+/**
+ * One workout at one sample period, in a process of its own since the EMG task is
+ * constructed once.
+ */
+static int run(uint32_t period)
+{
+	const uint8_t start[] = {
+		WORKOUT_CFG_KEY_SET_COUNT, 1, 255,
+		WORKOUT_CFG_KEY_REP_COUNT, 1, EMG_MAX_REPS,
+		WORKOUT_CFG_KEY_MAX_REST, 2, 0, 0,
+		WORKOUT_CFG_KEY_HAPTIC, 1, 1,
+		WORKOUT_CFG_KEY_REP_CUE, 1, 1,
+		WORKOUT_CFG_KEY_CONCENTRIC, 1, CONCENTRIC_TARGET,
+		WORKOUT_CFG_KEY_ECCENTRIC, 1, ECCENTRIC_TARGET,
+		WORKOUT_CFG_KEY_SET_TIMEOUT, 1, SET_TIMEOUT_SEC,
+		WORKOUT_CFG_KEY_SAMPLE_PERIOD, 1, (uint8_t)period,
+	};
+
+	periodMs = period;
+	sampleUs = calloc(REPS, sizeof(uint32_t));
+	signalUs = calloc(REPS, sizeof(uint32_t));
+	hostNs = calloc(REPS, sizeof(uint32_t));
+	makeReps();
+	vibe_init();
+	shim_ioFxn = ioChanged;
+	emgHost_signal = emgSignal;
+	emgHost_init();
+
+	shim_advanceUs(1000000);
+	if (emgHost_configure(WORKOUT_CFG_CMD_START, start, sizeof(start)) != WORKOUT_CFG_CMD_START) {
+		printf("  start rejected\n");
+		return 1;
+	}
+	shim_advanceUs(reps[REPS - 1].endUs + (SET_TIMEOUT_SEC + 5) * 1000000 - shim_nowUs());
+	emgHost_configure(WORKOUT_CFG_CMD_STOP, NULL, 0);
+
+	if (cues != REPS)
+		fail("cues for reps", cues, REPS);
+	if (buzzes != REPS / REPS_PER_SET)
+		fail("set done buzzes, expected", buzzes, REPS / REPS_PER_SET);
+
+	qsort(sampleUs, cues, sizeof(uint32_t), cmp);
+	qsort(signalUs, cues, sizeof(uint32_t), cmp);
+	qsort(hostNs, cues, sizeof(uint32_t), cmp);
+	printf("%6u ms %4u %4u %4u %4u %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8u %8u %8u\n", period, cues,
+		   cueCounts[CUE_TICK], cueCounts[CUE_SLOWER], cueCounts[CUE_FASTER],
+		   pct(sampleUs, cues, 50) / 1000.0, pct(sampleUs, cues, 99) / 1000.0,
+		   sampleUs[cues ? cues - 1 : 0] / 1000.0,
+		   pct(signalUs, cues, 50) / 1000.0, pct(signalUs, cues, 99) / 1000.0,
+		   signalUs[cues ? cues - 1 : 0] / 1000.0,
+		   pct(hostNs, cues, 50), pct(hostNs, cues, 99), hostNs[cues ? cues - 1 : 0]);
+	if (failures)
+		printf("  %u failures\n", failures);
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const uint32_t defaults[] = { 10, 20, 50 };
+	uint32_t n = (argc > 1) ? (uint32_t)argc - 1 : sizeof(defaults) / sizeof(defaults[0]);
+	uint32_t i, failed = 0;
+
+	printf("%9s %4s %4s %4s %4s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "period", "cues", "tick",
+		   "slow", "fast", "sample", "p99 ms", "max ms", "signal", "p99 ms", "max ms", "host ns",
+		   "p99 ns", "max ns");
+	for (i = 0; i < n; i++) {
+		uint32_t period = (argc > 1) ? strtoul(argv[i + 1], NULL, 0) : defaults[i];
+		pid_t pid;
+		int status;
+
+		fflush(stdout);
+		pid = fork();
+		if (pid == 0)
+			exit(run(period));
+		if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+				WEXITSTATUS(status))
+			failed++;
+	}
+	printf("\n%u failed periods\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * Rep event latency: from the EMG sample that ends a rep to its APP_PACKET_TYPE_REP_EVENT
+ * packet being queued for the BLE task, with the firmware's EMG task (emg.c) on the
+ * host shim, see emg_host.h.
+ *
+ * The ADC reads a workout of reps with random lengths, peaks and rests, and a rest that
+ * runs into the set timeout every REPS_PER_SET reps. Each rep stays
+ * above repThresholdLow from its start to its end and crosses repThresholdHigh, so the
+ * first sample after a rep is the one the task counts it on. For every sample period
+ * given the run reports
+ *
+ *     simulated	end sample to queued, the wait for the rest of the 50 sample slice
+ *     				(the task takes no simulated time)
+ *     host			last sample of the slice read to queued: the Swi's post, the task
+ *     				switch and the slice processing up to the rep, on this host
+ *
+ * and fails if an event is missing or out of sequence, has the wrong set or rep index,
+ * an end time other than the end sample's, or is queued later than the slice that
+ * holds its end sample.
+ *
+ *     rep_event_latency [period ms ...]		default 10 20 50
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "emg_host.h"
+#include "emg.h"
+#include "workout_config.h"
+
+#define REPS								300
+#define REPS_PER_SET						10
+#define SET_TIMEOUT_SEC						8
+#define SET_REST_MS							12000
+#define MAX_ENDS							8
+
+#define LEVEL_REST							400
+#define LEVEL_EDGE							1000		//Above repThresholdLow
+#define NOISE								50
+
+typedef struct {
+	uint64_t startUs;
+	uint64_t endUs;
+	uint16_t peak;
+} Rep;
+
+static Rep reps[REPS];
+static uint32_t rngState = 11;
+
+//End samples whose event is still to come, oldest first
+static uint64_t endUs[MAX_ENDS];
+static uint8_t endHead, endCount;
+static uint8_t sigInRep;
+static uint64_t lastSampleUs = UINT64_MAX;
+static uint64_t sliceReadNs;
+
+static uint32_t periodMs;
+static uint32_t events, failures, setsDone;
+static uint8_t nextSeq, nextRep;
+static uint32_t *simUs, *hostNs;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void fail(const char *what, uint32_t a, uint32_t b)
+{
+	if (failures++ < 10)
+		printf("  %u ms period, event %u: %s (%u, %u)\n", periodMs, events, what, a, b);
+}
+
+static void makeReps(void)
+{
+	uint64_t t = 2000000;		//After the start and the front end settling
+	uint32_t n;
+
+	for (n = 0; n < REPS; n++) {
+		t += ((n % REPS_PER_SET) ? 300 + rnd(2200) : SET_REST_MS) * 1000;
+		reps[n].startUs = t;
+		t += (800 + rnd(1700)) * 1000;
+		reps[n].endUs = t;
+		reps[n].peak = 2000 + rnd(1800);
+	}
+}
+
+static uint32_t emgSignal(uint64_t us)
+{
+	static uint32_t r = 0;
+	uint32_t level;
+
+	while (r < REPS && reps[r].endUs <= us)
+		r++;
+	if (r < REPS && us >= reps[r].startUs) {
+		//Triangle from LEVEL_EDGE to the peak and back
+		uint64_t half = (reps[r].endUs - reps[r].startUs) / 2;
+		uint64_t from = (us - reps[r].startUs < half) ? us - reps[r].startUs : reps[r].endUs - us;
+
+		level = LEVEL_EDGE + (uint32_t)((reps[r].peak - LEVEL_EDGE) * from / half) + rnd(NOISE);
+	} else {
+		level = LEVEL_REST + rnd(2 * NOISE) - NOISE;
+	}
+
+	//First read of a sample, the averaged reads all see the same time
+	if (us != lastSampleUs) {
+		lastSampleUs = us;
+		sliceReadNs = emgHost_ns();
+		if (level >= myWorkoutConfig.repThresholdHigh) {
+			sigInRep = 1;
+		} else if (level < myWorkoutConfig.repThresholdLow && sigInRep) {
+			sigInRep = 0;
+			if (endCount == MAX_ENDS)
+				fail("more rep ends than events", endCount, 0);
+			else
+				endUs[(endHead + endCount++) % MAX_ENDS] = us;
+		}
+	}
+	return level;
+}
+
+static void packet(const uint8_t *pData, uint8_t len, app_pkt_type_t type)
+{
+	uint64_t now = shim_nowUs(), end;
+	uint32_t endMs;
+
+	if (type != APP_PACKET_TYPE_REP_EVENT)
+		return;
+	hostNs[events] = (uint32_t)(emgHost_ns() - sliceReadNs);
+	if (len != EMG_REP_EVENT_LEN)
+		fail("length", len, EMG_REP_EVENT_LEN);
+	if (pData[0] != nextSeq)
+		fail("sequence", pData[0], nextSeq);
+	if (pData[1] != setsDone + 1 || pData[2] != nextRep)
+		fail("set / rep index", pData[1], pData[2]);
+	nextSeq = pData[0] + 1;
+	nextRep = pData[2] + 1;
+
+	if (!endCount) {
+		fail("no rep ended", 0, 0);
+		events++;
+		return;
+	}
+	end = endUs[endHead];
+	endHead = (endHead + 1) % MAX_ENDS;
+	endCount--;
+
+	//The AON RTC's 32.32 fraction can put the local time 1 us early
+	endMs = BUILD_UINT32(pData[4], pData[5], pData[6], pData[7]);
+	if (endMs != end / 1000 && endMs + 1 != end / 1000)
+		fail("end time", endMs, (uint32_t)(end / 1000));
+	if (now < end || now - end >= (uint64_t)EMG_NUMBER_OF_SAMPLES_SLICE * periodMs * 1000)
+		fail("queued after its slice", (uint32_t)(now - end), 0);
+	simUs[events++] = (uint32_t)(now - end);
+}
+
+static void setDone(const EMG_stats *pStats, uint8_t setIndex)
+{
+	if (pStats->numReps != REPS_PER_SET || nextRep != REPS_PER_SET)
+		fail("set summary reps", pStats->numReps, nextRep);
+	setsDone = setIndex;
+	nextRep = 0;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint32_t pct(uint32_t *pV, uint32_t n, uint32_t p)
+{
+	return n ? pV[MIN(n - 1, n * p / 100)] : 0;
+}
+
+/**
+ * One workout at one sample period, in a process of its own since the EMG task is
+ * constructed once.
+ */
+static int run(uint32_t period)
+{
+	const uint8_t start[] = {
+		WORKOUT_CFG_KEY_SET_COUNT, 1, 255,
+		WORKOUT_CFG_KEY_REP_COUNT, 1, EMG_MAX_REPS,
+		WORKOUT_CFG_KEY_MAX_REST, 2, 0, 0,
+		WORKOUT_CFG_KEY_SET_TIMEOUT, 1, SET_TIMEOUT_SEC,
+		WORKOUT_CFG_KEY_SAMPLE_PERIOD, 1, (uint8_t)period,
+	};
+
+	periodMs = period;
+	simUs = calloc(REPS, sizeof(uint32_t));
+	hostNs = calloc(REPS, sizeof(uint32_t));
+	makeReps();
+	emgHost_signal = emgSignal;
+	emgHost_packetFxn = packet;
+	emgHost_setFxn = setDone;
+	emgHost_init();
+
+	shim_advanceUs(1000000);
+	if (emgHost_configure(WORKOUT_CFG_CMD_START, start, sizeof(start)) != WORKOUT_CFG_CMD_START) {
+		printf("  start rejected\n");
+		return 1;
+	}
+	shim_advanceUs(reps[REPS - 1].endUs + 2000000 - shim_nowUs());
+	emgHost_configure(WORKOUT_CFG_CMD_STOP, NULL, 0);
+
+	if (events != REPS)
+		fail("events for reps", events, REPS);
+
+	qsort(simUs, events, sizeof(uint32_t), cmp);
+	qsort(hostNs, events, sizeof(uint32_t), cmp);
+	printf("%6u ms %6u %8.1f %8.1f %8.1f %8.1f %9u %9u %9u\n", period, events,
+			(EMG_NUMBER_OF_SAMPLES_SLICE - 1) * period / 1.0, pct(simUs, events, 50) / 1000.0,
+			pct(simUs, events, 99) / 1000.0, simUs[events ? events - 1 : 0] / 1000.0,
+			pct(hostNs, events, 50), pct(hostNs, events, 99), hostNs[events ? events - 1 : 0]);
+	if (failures)
+		printf("  %u failures\n", failures);
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const uint32_t defaults[] = { 10, 20, 50 };
+	uint32_t n = (argc > 1) ? (uint32_t)argc - 1 : sizeof(defaults) / sizeof(defaults[0]);
+	uint32_t i, failed = 0;
+
+	printf("%9s %6s %8s %8s %8s %8s %9s %9s %9s\n", "period", "events", "bound ms", "p50 ms",
+			"p99 ms", "max ms", "host p50", "p99 ns", "max ns");
+	for (i = 0; i < n; i++) {
+		uint32_t period = (argc > 1) ? strtoul(argv[i + 1], NULL, 0) : defaults[i];
+		pid_t pid;
+		int status;
+
+		fflush(stdout);
+		pid = fork();
+		if (pid == 0)
+			exit(run(period));
+		if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+				WEXITSTATUS(status))
+			failed++;
+	}
+	printf("\n%u failed periods\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,483 @@
+/*
+ * Power model of the rest between sets: the firmware's EMG task (emg.c) on the host
+ * shim, see emg_host.h, runs one workout twice, each in a process of its own since the
+ * EMG task is constructed once.
+ *
+ *     baseline		maxRestSeconds 0, sampling and the front end stay on between sets
+ *     rest			maxRestSeconds 90, the front end, the ADC clocks and the IMU go
+ *     				down after each set until the rest timer, motion or a command
+ *
+ * The workout is SETS sets of reps on the ADC. The lifter rests under maxRest and
+ * moves before the next set, rests past it so the timer ends the rest, or the app
+ * sends an update in the middle of the rest. The accelerometer's side of the rest
+ * (accelerometer.c) is played here on the APP sink: wake on motion from REST_START to
+ * REST_END, its status polled every ACCEL_REST_POLL_MS, and the motion wake published
+ * at the first poll after the lifter moves.
+ *
+ * Both runs must count every rep of every set. In the rest run every rest must end the
+ * way the script calls for, a motion wake within one poll of the move, a timer wake at
+ * maxRest after the last rep with the rest over cue, a command wake at the command;
+ * no sample may be read with the front end or the ADC clocks off or while the front
+ * end settles, and the IMU must be in wake on motion exactly while the front end is
+ * off. The charge of each run comes from the times and counts below and the currents
+ * of the datasheets, typical figures, not measured on the board; the run fails unless
+ * the rest run takes less.
+ *
+ *     rest_power_sim [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "emg_host.h"
+#include "emg.h"
+#include "event_bus.h"
+#include "workout_config.h"
+
+#define SETS								8
+#define MAX_REPS_PER_SET					12
+#define MAX_REST_SEC						90
+#define SET_TIMEOUT_SEC						8
+#define MOVE_LEAD_US						2000000		//Lifter moves before the first rep
+#define UPDATE_AFTER_US						30000000	//After the last rep of the set
+#define POLL_US								500000		//ACCEL_REST_POLL_MS of accelerometer.c
+#define SETTLE_US							100000		//EMG_SETTLE_MS of emg.c
+#define ADC_CLOCKS							(AUX_WUC_MODCLKEN0_ANAIF_M | AUX_WUC_MODCLKEN0_AUX_ADI4_M)
+
+#define LEVEL_REST							400
+#define NOISE								50
+
+//Typical currents, uA
+#define FRONT_END_UA						1440		//INA321 40 uA, 2x LM358 700 uA; bias networks left out
+#define IMU_NORMAL_UA						3400		//MPU-9250 accel + gyro, 1 kHz gyro ODR
+#define IMU_WOM_UA							8.7			//MPU-9250 low power accel at 1.95 Hz: 8 uA + 0.376 uA/Hz
+#define MCU_ACTIVE_UA						2930		//CC2640 61 uA/MHz at 48 MHz
+//Active time assumed per ADC conversion (10.6 us sample time and the FIFO read) and
+//per wake on motion poll (wake from standby, one I2C register read at 400 kHz)
+#define CONVERSION_US						15
+#define POLL_ACTIVE_US						250
+
+typedef enum {
+	REST_MOTION = 0,
+	REST_TIMER,
+	REST_CONFIG,
+	NUM_REST_TYPES
+} Rest_type;
+
+typedef struct {
+	uint64_t startUs;
+	uint64_t peakUs;
+	uint64_t endUs;
+	uint16_t peak;
+} Rep;
+
+typedef struct {
+	Rep reps[MAX_REPS_PER_SET];
+	uint8_t numReps;
+	uint8_t restType;			//Of the rest after the set
+	uint64_t updateUs;			//REST_CONFIG: the app's update
+	uint64_t moveUs;			//Lifter moves for this set
+} Set;
+
+typedef struct {
+	uint64_t frontEndUs;		//Board_ANALOG_EN high
+	uint64_t womUs;				//IMU in wake on motion
+	uint64_t imuNormalUs;
+	uint32_t conversions;
+	uint32_t samples;
+	uint32_t polls;
+	uint32_t rests;
+	uint32_t wakes[NUM_REST_TYPES];
+	uint32_t restOvers;
+	uint32_t sets;
+	uint32_t reps;
+	uint32_t failures;
+} Result;
+
+static const char *const restNames[NUM_REST_TYPES] = { "motion", "timer", "config" };
+
+static Set sets[SETS];
+static uint64_t endUs;
+static uint32_t rngState;
+static Result result;
+static uint8_t resting;
+extern PIN_Handle analogPinHandle;
+
+//Front end and IMU
+static Bool frontEndOn, wom;
+static uint64_t frontEndOnUs, lastUs;
+static uint64_t lastSampleUs = UINT64_MAX;
+
+//Rest
+static Clock_Struct pollClock;
+static uint64_t restEndUs = UINT64_MAX;
+static Rest_type restEndType;
+static Bool motionSent, updating;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void fail(const char *what, uint32_t a, uint32_t b)
+{
+	if (result.failures++ < 10)
+		printf("  %s, %.3f s: %s (%u, %u)\n", resting ? "rest" : "baseline",
+			   shim_nowUs() / 1e6, what, a, b);
+}
+
+/**
+ * Sets of 8 to 12 reps, 1.5 to 2.5 s each. Most rests end with a move well before
+ * maxRest, two run well past it and one gets an update at UPDATE_AFTER_US.
+ */
+static void script(void)
+{
+	uint64_t t = 2000000;		//After the start and the front end settling
+	uint32_t s, r, len;
+
+	for (s = 0; s < SETS; s++) {
+		Set *pSet = &sets[s];
+
+		pSet->restType = (s == 2 || s == 5) ? REST_TIMER : (s == 3) ? REST_CONFIG : REST_MOTION;
+		if (s > 0) {
+			const Set *pPrev = &sets[s - 1];
+			uint64_t lastEnd = pPrev->reps[pPrev->numReps - 1].endUs;
+
+			if (pPrev->restType == REST_TIMER)
+				t = lastEnd + (100 + rnd(51)) * 1000000ull;
+			else
+				t = lastEnd + (45 + rnd(36)) * 1000000ull;
+			sets[s - 1].updateUs = lastEnd + UPDATE_AFTER_US;
+		}
+		pSet->moveUs = t - MOVE_LEAD_US;
+
+		pSet->numReps = 8 + rnd(5);
+		for (r = 0; r < pSet->numReps; r++) {
+			Rep *pRep = &pSet->reps[r];
+
+			if (r)
+				t += (300 + rnd(2200)) * 1000;
+			len = 1500 + rnd(1000);
+			pRep->peak = 2500 + rnd(1300);
+			pRep->startUs = t;
+			pRep->peakUs = t + len * (40 + rnd(21)) * 10;
+			t += len * 1000;
+			pRep->endUs = t;
+		}
+	}
+	endUs = t + (SET_TIMEOUT_SEC + 5) * 1000000ull;
+}
+
+/**
+ * Adds the time since the last change to the state it was spent in.
+ */
+static void account(void)
+{
+	uint64_t now = shim_nowUs();
+
+	if (frontEndOn)
+		result.frontEndUs += now - lastUs;
+	if (wom)
+		result.womUs += now - lastUs;
+	else
+		result.imuNormalUs += now - lastUs;
+	lastUs = now;
+}
+
+static uint32_t emgSignal(uint64_t us)
+{
+	static uint32_t s = 0, r = 0;
+
+	if (us != lastSampleUs) {
+		lastSampleUs = us;
+		result.samples++;
+		if (!frontEndOn || (shim_auxClocks & ADC_CLOCKS) != ADC_CLOCKS)
+			fail("sample with the front end off, clocks", shim_auxClocks, 0);
+		else if (us - frontEndOnUs < SETTLE_US)
+			fail("sample while settling, us", (uint32_t)(us - frontEndOnUs), 0);
+	}
+
+	while (s < SETS && sets[s].reps[r].endUs <= us) {
+		if (++r == sets[s].numReps) {
+			s++;
+			r = 0;
+		}
+	}
+	if (s < SETS && us >= sets[s].reps[r].startUs) {
+		const Rep *pRep = &sets[s].reps[r];
+
+		if (us < pRep->peakUs)
+			return LEVEL_REST + (uint32_t)((pRep->peak - LEVEL_REST) * (us - pRep->startUs) /
+										   (pRep->peakUs - pRep->startUs)) + rnd(NOISE);
+		return LEVEL_REST + (uint32_t)((pRep->peak - LEVEL_REST) * (pRep->endUs - us) /
+									   (pRep->endUs - pRep->peakUs)) + rnd(NOISE);
+	}
+	return LEVEL_REST + rnd(2 * NOISE) - NOISE;
+}
+
+static void ioChanged(void)
+{
+	Bool on = (analogPinHandle->outputs & (1u << Board_ANALOG_EN)) != 0;
+
+	if (on == frontEndOn)
+		return;
+	account();
+	frontEndOn = on;
+	if (on) {
+		frontEndOnUs = shim_nowUs();
+		if (wom)
+			fail("front end on in wake on motion", 0, 0);
+	}
+}
+
+static void setDone(const EMG_stats *pStats, uint8_t setIndex)
+{
+	if (setIndex != result.sets + 1 || setIndex > SETS)
+		fail("set, expected", setIndex, result.sets + 1);
+	else if (pStats->numReps != sets[result.sets].numReps)
+		fail("reps in set, expected", pStats->numReps, sets[result.sets].numReps);
+	result.reps += pStats->numReps;
+	result.sets++;
+}
+
+static void vibeRequested(Vibe_patternId pattern, Vibe_prio prio)
+{
+	if (pattern != VIBE_PATTERN_REST_OVER)
+		return;
+	result.restOvers++;
+	if (restEndUs != shim_nowUs() || restEndType != REST_TIMER)
+		fail("rest over cue without a timer wake", 0, 0);
+}
+
+/**
+ * Wake on motion status poll, in Swi context as accelerometer.c's sched timer would
+ * post it.
+ */
+static void pollFxn(UArg a0)
+{
+	Bus_msg msg;
+
+	result.polls++;
+	if (motionSent || result.sets >= SETS || shim_nowUs() < sets[result.sets].moveUs)
+		return;
+
+	motionSent = TRUE;
+	msg.event = BUS_EVT_REST_WAKE;
+	msg.u.wake.reason = BUS_WAKE_MOTION;
+	bus_publish(&msg);
+}
+
+/**
+ * Tells how the rest ended from what came right before REST_END, and checks it
+ * against the script. A timer wake is neither of the others; its cue follows.
+ */
+static void restEnded(void)
+{
+	uint64_t now = shim_nowUs();
+	const Set *pSet = &sets[result.sets - 1];
+	uint64_t lastEnd = pSet->reps[pSet->numReps - 1].endUs;
+	Rest_type type;
+
+	if (motionSent) {
+		type = REST_MOTION;
+		if (now - sets[result.sets].moveUs >= POLL_US)
+			fail("motion wake after the move, us", (uint32_t)(now - sets[result.sets].moveUs), 0);
+	} else if (updating) {
+		type = REST_CONFIG;
+	} else {
+		type = REST_TIMER;
+		if (now + 2000000 < lastEnd + MAX_REST_SEC * 1000000ull ||
+				now > lastEnd + (MAX_REST_SEC + 2) * 1000000ull)
+			fail("timer wake after the last rep, ms", (uint32_t)((now - lastEnd) / 1000), 0);
+	}
+	restEndUs = now;
+	restEndType = type;
+	result.wakes[type]++;
+	if (type != pSet->restType)
+		fail("rest ended by, expected", type, pSet->restType);
+}
+
+static void appHandler(const Bus_msg *pMsg)
+{
+	account();
+	switch (pMsg->event) {
+	case BUS_EVT_REST_START:
+		if (!resting)
+			fail("rest with maxRest 0", 0, 0);
+		if (frontEndOn || (shim_auxClocks & ADC_CLOCKS))
+			fail("rest with the front end on, clocks", shim_auxClocks, 0);
+		result.rests++;
+		motionSent = FALSE;
+		wom = TRUE;
+		Clock_start(Clock_handle(&pollClock));
+		break;
+
+	case BUS_EVT_REST_END:
+		wom = FALSE;
+		Clock_stop(Clock_handle(&pollClock));
+		restEnded();
+		break;
+
+	default:
+		break;
+	}
+}
+
+//The app event loop dispatches as soon as it is woken
+static void appWake(void)
+{
+	bus_dispatch(BUS_SINK_APP);
+}
+
+static void run(uint8_t rest)
+{
+	const uint8_t start[] = {
+		WORKOUT_CFG_KEY_SET_COUNT, 1, SETS,
+		WORKOUT_CFG_KEY_REP_COUNT, 1, EMG_MAX_REPS,
+		WORKOUT_CFG_KEY_MAX_REST, 2, LO_UINT16(rest ? MAX_REST_SEC : 0), HI_UINT16(rest ? MAX_REST_SEC : 0),
+		WORKOUT_CFG_KEY_HAPTIC, 1, 1,
+		WORKOUT_CFG_KEY_SET_TIMEOUT, 1, SET_TIMEOUT_SEC,
+	};
+	const uint8_t update[] = { WORKOUT_CFG_KEY_HAPTIC, 1, 1 };
+	Clock_Params clockParams;
+	uint32_t s;
+
+	resting = rest;
+	Clock_Params_init(&clockParams);
+	clockParams.period = POLL_US / Clock_tickPeriod;
+	Clock_construct(&pollClock, pollFxn, POLL_US / Clock_tickPeriod, &clockParams);
+	bus_addSink(BUS_SINK_APP, appWake);
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_REST_START, appHandler);
+	bus_subscribe(BUS_SINK_APP, BUS_EVT_REST_END, appHandler);
+
+	shim_ioFxn = ioChanged;
+	emgHost_signal = emgSignal;
+	emgHost_setFxn = setDone;
+	emgHost_vibeFxn = vibeRequested;
+	emgHost_init();
+
+	shim_advanceUs(1000000);
+	if (emgHost_configure(WORKOUT_CFG_CMD_START, start, sizeof(start)) != WORKOUT_CFG_CMD_START) {
+		fail("start rejected", 0, 0);
+		return;
+	}
+	for (s = 0; s < SETS - 1; s++) {
+		if (sets[s].restType != REST_CONFIG)
+			continue;
+		shim_advanceUs(sets[s].updateUs - shim_nowUs());
+		updating = TRUE;
+		emgHost_configure(WORKOUT_CFG_CMD_UPDATE, update, sizeof(update));
+		updating = FALSE;
+	}
+	shim_advanceUs(endUs - shim_nowUs());
+	account();
+	result.conversions = shim_adcConversions;
+
+	if (result.sets != SETS)
+		fail("sets, expected", result.sets, SETS);
+	if (frontEndOn || wom)
+		fail("workout over with the front end or wake on motion on", frontEndOn, wom);
+	if (result.restOvers != result.wakes[REST_TIMER])
+		fail("rest over cues for timer wakes", result.restOvers, result.wakes[REST_TIMER]);
+	if (rest && result.rests != SETS - 1)
+		fail("rests, expected", result.rests, SETS - 1);
+}
+
+static int runChild(uint8_t rest, Result *pResult)
+{
+	int fds[2], status;
+	ssize_t got = 0, r;
+	pid_t pid;
+
+	if (pipe(fds))
+		return 1;
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		run(rest);
+		fflush(stdout);
+		_exit(write(fds[1], &result, sizeof(result)) == sizeof(result) ? 0 : 2);
+	}
+	close(fds[1]);
+	while (pid > 0 && got < (ssize_t)sizeof(*pResult) &&
+			(r = read(fds[0], (uint8_t *)pResult + got, sizeof(*pResult) - got)) > 0)
+		got += r;
+	close(fds[0]);
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+			WEXITSTATUS(status) || got != sizeof(*pResult))
+		return 1;
+	return 0;
+}
+
+/**
+ * Charge of a run, mAh: uA x us over 3.6e12.
+ */
+static double charge(const Result *pRes)
+{
+	double uaUs = (double)pRes->frontEndUs * FRONT_END_UA + (double)pRes->imuNormalUs * IMU_NORMAL_UA +
+				  (double)pRes->womUs * IMU_WOM_UA +
+				  ((double)pRes->conversions * CONVERSION_US + (double)pRes->polls * POLL_ACTIVE_US) *
+				  MCU_ACTIVE_UA;
+
+	return uaUs / 3.6e12;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *const names[2] = { "baseline", "rest" };
+	Result res[2];
+	uint32_t failures = 0, expected[NUM_REST_TYPES] = { 0 };
+	double mAh[2];
+	uint32_t reps = 0;
+	uint8_t i;
+
+	rngState = (argc > 1 ? strtoul(argv[1], NULL, 0) : 1) | 1;
+	script();
+	for (i = 0; i < SETS; i++) {
+		reps += sets[i].numReps;
+		if (i < SETS - 1)
+			expected[sets[i].restType]++;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (runChild(i, &res[i])) {
+			printf("%s run did not finish\n", names[i]);
+			return 1;
+		}
+		failures += res[i].failures;
+		mAh[i] = charge(&res[i]);
+	}
+
+	printf("%u sets, %u reps, %.1f min; rests ended by motion %u, timer %u, config %u\n", SETS,
+		   reps, endUs / 60e6, expected[REST_MOTION], expected[REST_TIMER], expected[REST_CONFIG]);
+	printf("run       reps  rests  motion  timer  config  front end    IMU WOM  samples  polls  charge\n");
+	for (i = 0; i < 2; i++)
+		printf("%-8s %5u %6u %7u %6u %7u %9.1f s %8.1f s %8u %6u  %.3f mAh\n", names[i],
+			   res[i].reps, res[i].rests, res[i].wakes[REST_MOTION], res[i].wakes[REST_TIMER],
+			   res[i].wakes[REST_CONFIG], res[i].frontEndUs / 1e6, res[i].womUs / 1e6,
+			   res[i].samples, res[i].polls, mAh[i]);
+	printf("rest saves %.3f mAh per workout (%.1f%%), %.2f mA less while resting\n",
+		   mAh[0] - mAh[1], 100.0 * (1 - mAh[1] / mAh[0]),
+		   res[1].womUs ? (mAh[0] - mAh[1]) * 3.6e9 / res[1].womUs : 0.0);
+
+	for (i = 0; i < NUM_REST_TYPES; i++)
+		if (res[1].wakes[i] != expected[i]) {
+			printf("%s wakes %u, expected %u\n", restNames[i], res[1].wakes[i], expected[i]);
+			failures++;
+		}
+	if (res[0].reps != reps || res[1].reps != reps) {
+		printf("reps counted %u and %u of %u\n", res[0].reps, res[1].reps, reps);
+		failures++;
+	}
+	if (mAh[1] >= mAh[0]) {
+		printf("the rest takes as much charge\n");
+		failures++;
+	}
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+}
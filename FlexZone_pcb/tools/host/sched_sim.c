@@ -0,0 +1,463 @@
+/*
+ * Runs one workout on the two layouts of the handlers that only react to events and
+ * timers, each in a process of its own, and compares the RAM they take and the
+ * context switches they cost.
+ *
+ *     sched_sim [seed] [minutes]
+ *
+ * tasks: the layout main.c had before the application event loop. The accelerometer,
+ * vibe motor and EMG config each have a task, stack and semaphore of the size and
+ * priority they had: the accelerometer samples on its own Clock, the vibe motor
+ * sleeps through every buzz and the config task wakes for every write.
+ *
+ * loop: the firmware's sched.c, with the same work done by handlers. The accelerometer
+ * runs on a periodic Sched_timer, the buzzes on a one shot timer chained with
+ * sched_timerNext and the config writes come through the mailbox.
+ *
+ * The workout is sets of 45 s with a rep every 3 s, give or take, each cued with one
+ * buzz, and 60 s rests. A config write starts and ends every set, and the end of a
+ * set buzzes three times. The accelerometer samples every 300 ms during a set, and
+ * every 20 ms while the central streams the IMU for 20 s every 5 minutes. The EMG
+ * task is the same in both layouts and is left out.
+ *
+ * Both layouts must do the same work at the same time: the same samples, the same
+ * motor edges and the same config writes. The loop must take less stack and no more
+ * switches; a switch is a task starting to run after another one or after idle.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sched.h"
+#include "diag.h"
+#include "trace.h"
+
+#define SET_MS								45000
+#define REST_MS								60000
+#define REP_MS								3000
+#define REP_JITTER_MS						500
+#define STREAM_EVERY_MS						300000
+#define STREAM_MS							20000
+#define ACCEL_PERIOD_MS						300
+#define STREAM_PERIOD_MS					20
+#define BUZZ_ON_MS							400		//As the vibe task slept
+#define BUZZ_OFF_MS							200
+#define MAX_ACTIONS							8192
+
+#define MS_TO_TICKS(ms)						((ms) * (1000 / Clock_tickPeriod))
+
+//Sizes and priorities of the tasks the loop replaced
+#define ACCEL_TASK_STACK_SIZE				400
+#define ACCEL_TASK_PRIORITY					1
+#define VIBE_TASK_STACK_SIZE				200
+#define VIBE_TASK_PRIORITY					1
+#define CONFIG_TASK_STACK_SIZE				256
+#define CONFIG_TASK_PRIORITY				3
+
+//Loop mailbox arguments of SCHED_EVT_BUS; the vibe timer posts it as a flag, arg 0
+#define MSG_CONFIG							1
+#define MSG_BUZZ							2		//Times in the upper bits
+
+enum { ACT_SET_START, ACT_SET_END, ACT_REP, ACT_STREAM_START, ACT_STREAM_END };
+
+typedef struct {
+	uint64_t us;
+	uint8_t what;
+} Action;
+
+typedef struct {
+	uint32_t stackBytes;
+	Shim_kernelStats kernel;
+	uint32_t samples;
+	uint32_t edges;
+	uint32_t configs;
+	uint64_t workHash;					//Times and kinds of all the work, in order
+} Result;
+
+extern Task_Struct schedTask;
+
+static uint32_t rngState;
+static Action actions[MAX_ACTIONS];
+static uint32_t numActions;
+static Result result;
+static uint8_t inSet, streaming;
+
+//tasks layout
+static Task_Struct accelTask, vibeTask, configTask;
+static Char accelTaskStack[ACCEL_TASK_STACK_SIZE];
+static Char vibeTaskStack[VIBE_TASK_STACK_SIZE];
+static Char configTaskStack[CONFIG_TASK_STACK_SIZE];
+static Semaphore_Struct accelSem, vibeSem, configSem;
+static Clock_Struct accelClock;
+static volatile uint8_t numberOfBuzz;
+
+//loop layout
+static Sched_timer accelTimer, vibeTimer;
+static uint8_t buzzLeft, motorOn;
+
+//The memory report and the trace are not read here
+void diag_addTask(Diag_task task, Task_Handle hTask)
+{
+}
+
+void trace_write(uint32_t hdr, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4)
+{
+}
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void work(uint8_t kind)
+{
+	uint64_t v = ((uint64_t)Clock_getTicks() << 2) | kind;
+
+	result.workHash = (result.workHash ^ v) * 0x100000001B3ull;
+}
+
+static void accelSample(void)
+{
+	result.samples++;
+	work(0);
+}
+
+static void setMotor(uint8_t on)
+{
+	result.edges++;
+	work(on ? 1 : 2);
+}
+
+static void configWrite(void)
+{
+	result.configs++;
+	work(3);
+}
+
+static int cmpAction(const void *a, const void *b)
+{
+	const Action *pA = a, *pB = b;
+
+	return (pA->us > pB->us) - (pA->us < pB->us);
+}
+
+static void addAction(uint64_t ms, uint8_t what)
+{
+	if (numActions < MAX_ACTIONS) {
+		actions[numActions].us = ms * 1000;
+		actions[numActions++].what = what;
+	}
+}
+
+static void script(uint32_t minutes)
+{
+	uint64_t endMs = (uint64_t)minutes * 60000;
+	uint64_t t, r;
+
+	for (t = 10000; t + SET_MS < endMs; t += SET_MS + REST_MS) {
+		addAction(t, ACT_SET_START);
+		for (r = t + REP_MS / 2; r + REP_MS < t + SET_MS; r += REP_MS)
+			addAction(r + rnd(REP_JITTER_MS), ACT_REP);
+		addAction(t + SET_MS, ACT_SET_END);
+	}
+	for (t = STREAM_EVERY_MS; t + STREAM_MS < endMs; t += STREAM_EVERY_MS) {
+		addAction(t + rnd(1000), ACT_STREAM_START);
+		addAction(t + STREAM_MS, ACT_STREAM_END);
+	}
+	qsort(actions, numActions, sizeof(Action), cmpAction);
+}
+
+//**********************************************************************************
+// tasks layout
+//**********************************************************************************
+static void accelClockFxn(UArg a0)
+{
+	Semaphore_post(Semaphore_handle(&accelSem));
+}
+
+static void accelTaskFxn(UArg a0, UArg a1)
+{
+	while (1) {
+		Semaphore_pend(Semaphore_handle(&accelSem), BIOS_WAIT_FOREVER);
+		accelSample();
+	}
+}
+
+static void vibeTaskFxn(UArg a0, UArg a1)
+{
+	uint8_t i;
+
+	while (1) {
+		Semaphore_pend(Semaphore_handle(&vibeSem), BIOS_WAIT_FOREVER);
+		for (i = 0; i < numberOfBuzz; i++) {
+			setMotor(1);
+			Task_sleep(MS_TO_TICKS(BUZZ_ON_MS));
+			setMotor(0);
+			Task_sleep(MS_TO_TICKS(BUZZ_OFF_MS));
+		}
+	}
+}
+
+static void configTaskFxn(UArg a0, UArg a1)
+{
+	while (1) {
+		Semaphore_pend(Semaphore_handle(&configSem), BIOS_WAIT_FOREVER);
+		configWrite();
+	}
+}
+
+static void constructTask(Task_Struct *pTask, Task_FuncPtr fxn, Char *pStack, size_t size,
+						  Int priority)
+{
+	Task_Params taskParams;
+
+	Task_Params_init(&taskParams);
+	taskParams.stack = pStack;
+	taskParams.stackSize = size;
+	taskParams.priority = priority;
+	Task_construct(pTask, fxn, &taskParams, NULL);
+}
+
+static void tasksCreate(void)
+{
+	Clock_Params clockParams;
+
+	Semaphore_construct(&accelSem, 0, NULL);
+	Semaphore_construct(&vibeSem, 0, NULL);
+	Semaphore_construct(&configSem, 0, NULL);
+
+	Clock_Params_init(&clockParams);
+	clockParams.period = MS_TO_TICKS(ACCEL_PERIOD_MS);
+	clockParams.startFlag = FALSE;
+	Clock_construct(&accelClock, accelClockFxn, 0, &clockParams);
+
+	constructTask(&accelTask, accelTaskFxn, accelTaskStack, ACCEL_TASK_STACK_SIZE,
+				  ACCEL_TASK_PRIORITY);
+	constructTask(&vibeTask, vibeTaskFxn, vibeTaskStack, VIBE_TASK_STACK_SIZE,
+				  VIBE_TASK_PRIORITY);
+	constructTask(&configTask, configTaskFxn, configTaskStack, CONFIG_TASK_STACK_SIZE,
+				  CONFIG_TASK_PRIORITY);
+	result.stackBytes = ACCEL_TASK_STACK_SIZE + VIBE_TASK_STACK_SIZE + CONFIG_TASK_STACK_SIZE;
+}
+
+static void tasksAccel(uint32_t periodMs)
+{
+	Clock_stop(Clock_handle(&accelClock));
+	if (periodMs) {
+		Clock_setPeriod(Clock_handle(&accelClock), MS_TO_TICKS(periodMs));
+		Clock_setTimeout(Clock_handle(&accelClock), MS_TO_TICKS(periodMs));
+		Clock_start(Clock_handle(&accelClock));
+	}
+}
+
+static void tasksBuzz(uint8_t times)
+{
+	numberOfBuzz = times;
+	Semaphore_post(Semaphore_handle(&vibeSem));
+}
+
+static void tasksConfig(void)
+{
+	Semaphore_post(Semaphore_handle(&configSem));
+}
+
+//**********************************************************************************
+// loop layout
+//**********************************************************************************
+static void loopAccel(uint32_t arg)
+{
+	accelSample();
+}
+
+static void loopMsg(uint32_t arg)
+{
+	if (MSG_CONFIG == arg) {
+		configWrite();
+		return;
+	}
+
+	if ((arg & 0xFF) == MSG_BUZZ) {
+		if (buzzLeft) {
+			buzzLeft += arg >> 8;
+			return;
+		}
+		buzzLeft = arg >> 8;
+		motorOn = 1;
+		setMotor(1);
+		sched_timerStart(&vibeTimer, SCHED_EVT_BUS, BUZZ_ON_MS, 0);
+		return;
+	}
+
+	//Vibe timer expiry
+	if (!buzzLeft)
+		return;
+	if (motorOn) {
+		motorOn = 0;
+		setMotor(0);
+		sched_timerNext(&vibeTimer, SCHED_EVT_BUS, BUZZ_OFF_MS);
+	}
+	else if (--buzzLeft) {
+		motorOn = 1;
+		setMotor(1);
+		sched_timerNext(&vibeTimer, SCHED_EVT_BUS, BUZZ_ON_MS);
+	}
+}
+
+static void loopCreate(void)
+{
+	Task_Stat stat;
+
+	sched_createTask();
+	sched_register(SCHED_EVT_ACCEL, NULL, loopAccel);
+	sched_register(SCHED_EVT_BUS, NULL, loopMsg);
+
+	Task_stat(Task_handle(&schedTask), &stat);
+	result.stackBytes = stat.stackSize;
+}
+
+static void loopAccelPeriod(uint32_t periodMs)
+{
+	if (periodMs)
+		sched_timerStart(&accelTimer, SCHED_EVT_ACCEL, periodMs, periodMs);
+	else
+		sched_timerStop(&accelTimer);
+}
+
+static void loopBuzz(uint8_t times)
+{
+	sched_send(SCHED_EVT_BUS, MSG_BUZZ | ((uint32_t)times << 8));
+}
+
+static void loopConfig(void)
+{
+	sched_send(SCHED_EVT_BUS, MSG_CONFIG);
+}
+
+//**********************************************************************************
+// Both
+//**********************************************************************************
+static void run(uint8_t loop)
+{
+	void (*accel)(uint32_t periodMs) = loop ? loopAccelPeriod : tasksAccel;
+	void (*buzzFxn)(uint8_t times) = loop ? loopBuzz : tasksBuzz;
+	void (*config)(void) = loop ? loopConfig : tasksConfig;
+	uint32_t i;
+
+	if (loop)
+		loopCreate();
+	else
+		tasksCreate();
+	shim_runTasks();
+	shim_kernelStats.switches = 0;
+
+	for (i = 0; i < numActions; i++) {
+		const Action *pAct = &actions[i];
+
+		shim_advanceUs(pAct->us - shim_nowUs());
+		switch (pAct->what) {
+		case ACT_SET_START:
+			inSet = 1;
+			config();
+			break;
+		case ACT_SET_END:
+			inSet = 0;
+			config();
+			buzzFxn(3);
+			break;
+		case ACT_REP:
+			buzzFxn(1);
+			break;
+		case ACT_STREAM_START:
+			streaming = 1;
+			break;
+		case ACT_STREAM_END:
+			streaming = 0;
+			break;
+		}
+		if (ACT_REP != pAct->what)
+			accel(streaming ? STREAM_PERIOD_MS : inSet ? ACCEL_PERIOD_MS : 0);
+		shim_runTasks();
+	}
+	shim_advanceUs(10000000);
+
+	result.kernel = shim_kernelStats;
+}
+
+static int runChild(uint8_t loop, Result *pResult)
+{
+	int fds[2], status;
+	ssize_t got = 0, r;
+	pid_t pid;
+
+	if (pipe(fds))
+		return 1;
+	pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		run(loop);
+		_exit(write(fds[1], &result, sizeof(result)) == sizeof(result) ? 0 : 2);
+	}
+	close(fds[1]);
+	while (pid > 0 && got < (ssize_t)sizeof(*pResult) &&
+			(r = read(fds[0], (uint8_t *)pResult + got, sizeof(*pResult) - got)) > 0)
+		got += r;
+	close(fds[0]);
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+			WEXITSTATUS(status) || got != sizeof(*pResult))
+		return 1;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+	uint32_t minutes = argc > 2 ? strtoul(argv[2], NULL, 0) : 60;
+	static const char *const names[2] = { "tasks", "loop" };
+	Result res[2];
+	uint32_t failures = 0;
+	uint8_t i;
+
+	rngState = seed | 1;
+	script(minutes);
+
+	for (i = 0; i < 2; i++) {
+		if (runChild(i, &res[i])) {
+			printf("%s layout did not finish\n", names[i]);
+			return 1;
+		}
+	}
+
+	printf("%u min, %u actions\n", minutes, numActions);
+	printf("layout  stacks  tasks  sems  clocks  swis  samples  edges  configs  switches\n");
+	for (i = 0; i < 2; i++)
+		printf("%-6s %5u B %6u %5u %7u %5u %8u %6u %8u %9u\n", names[i], res[i].stackBytes,
+			   res[i].kernel.tasks, res[i].kernel.semaphores, res[i].kernel.clocks,
+			   res[i].kernel.swis, res[i].samples, res[i].edges, res[i].configs,
+			   res[i].kernel.switches);
+	printf("loop: %d B of stack, %d tasks, %d semaphores, %d switches (%.1f%%)\n",
+		   (int)res[1].stackBytes - (int)res[0].stackBytes,
+		   (int)res[1].kernel.tasks - (int)res[0].kernel.tasks,
+		   (int)res[1].kernel.semaphores - (int)res[0].kernel.semaphores,
+		   (int)res[1].kernel.switches - (int)res[0].kernel.switches,
+		   100.0 * ((double)res[1].kernel.switches / res[0].kernel.switches - 1));
+
+	if (res[0].samples != res[1].samples || res[0].edges != res[1].edges ||
+			res[0].configs != res[1].configs || res[0].workHash != res[1].workHash) {
+		printf("the layouts did different work\n");
+		failures++;
+	}
+	if (res[1].stackBytes >= res[0].stackBytes) {
+		printf("the loop takes as much stack\n");
+		failures++;
+	}
+	if (res[1].kernel.switches > res[0].kernel.switches) {
+		printf("the loop takes more switches\n");
+		failures++;
+	}
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+}
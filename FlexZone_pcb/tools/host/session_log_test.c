@@ -0,0 +1,577 @@
+/*
+ * Checks the offline session log (session_log.c) on a simulated OSAL SNV.
+ *
+ * The simulated SNV replaces an item as a whole on every write, as the stack does, and
+ * keeps the items in a 4 KB page that is compacted into the other page and erased when
+ * it fills up. Workouts append rep events and set summaries while disconnected; now and
+ * then an app connects, syncs at a random MTU and window, sometimes drops the link
+ * halfway, and the link end flushes the log. The reference builds the rep times records
+ * the log must hold from the rep events itself. Against a reference of every record:
+ *
+ *     records		the stored records, read through the sync, are the reference
+ *     				bytes at their offsets and each has a valid CRC
+ *     sync			notifications run on from the offset asked for, or the oldest
+ *     				record, stay within the window and end at the written end
+ *     retention		records in the last SESSION_LOG_BLOCKS - 2 blocks are kept
+ *     lost			records dropped unacked are counted
+ *     connected		no SNV write at all while a link is up, acks included
+ *
+ * A second run cuts the power at random SNV writes, the write applied or not, and
+ * reboots into sessionLog_init. The log must then end on a record boundary, at or after
+ * everything a set summary or a flush wrote and never past what was appended, must not
+ * lose the acked offset last flushed and must never reuse an offset the app was sent.
+ *
+ * Prints how many workouts the log holds and the SNV writes and page erases each costs.
+ *
+ *     session_log_test [workouts] [power cuts]
+ */
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "emg.h"
+#include "session_log.h"
+#include "set_summary.h"
+
+#define REF_MAX								(4 * 1024 * 1024)
+#define PAGE_SIZE							4096
+#define PAGE_HEADER_LEN						4
+#define ITEM_HEADER_LEN						4
+
+#define SETS_PER_WORKOUT					4
+
+typedef struct {
+	uint8_t data[255];
+	uint8_t len;
+	uint8_t present;
+} Item;
+
+//Simulated SNV
+static Item items[256];
+static uint32_t pageUsed = PAGE_HEADER_LEN;
+static uint32_t snvWrites, snvBytes, erases;
+static uint8_t connected;
+static uint32_t cutAt;			//Write number to cut the power at, 0 for none
+static jmp_buf cutJmp;
+
+//Reference: every record appended, by log offset
+static uint8_t refLog[REF_MAX];
+static uint8_t refStart[REF_MAX];
+static uint32_t refEnd;
+static uint32_t durableEnd;		//Written by a set summary or a flush
+static uint32_t flushedAck;		//Acked offset the last flush wrote
+static uint32_t sentEnd;		//Highest offset the app was sent
+static uint32_t appOffset;		//Where the app resumes
+static uint32_t lostRef;
+
+//Rep events since the last rep times record, and the rep to make next
+static uint8_t repEvents[EMG_MAX_REPS][EMG_REP_EVENT_LEN];
+static uint8_t repsKept;
+static uint8_t repSet, repIndex;
+static uint32_t repEndMs = 0xFFFF0000;		//Wraps in the first workouts
+
+static uint32_t rngState = 29;
+static uint32_t failures;
+static const char *phase;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void fail(const char *what, uint32_t a, uint32_t b)
+{
+	if (failures++ < 10)
+		printf("  %s: %s (%u, %u)\n", phase, what, a, b);
+}
+
+static uint32_t itemCost(uint8_t len)
+{
+	return ITEM_HEADER_LEN + ((len + 3u) & ~3u);
+}
+
+uint8_t osal_snv_read(osalSnvId_t id, osalSnvLen_t len, void *pBuf)
+{
+	if (!items[id].present || items[id].len != len)
+		return NV_OPER_FAILED;
+	memcpy(pBuf, items[id].data, len);
+	return SUCCESS;
+}
+
+uint8_t osal_snv_write(osalSnvId_t id, osalSnvLen_t len, void *pBuf)
+{
+	uint32_t live = PAGE_HEADER_LEN;
+	uint32_t i;
+
+	if (connected)
+		fail("SNV write while connected", id, len);
+	if (id < BLE_NVID_CUST_START || id > BLE_NVID_CUST_END)
+		fail("SNV item outside the customer range", id, len);
+
+	snvWrites++;
+	if (cutAt && snvWrites == cutAt) {
+		cutAt = 0;
+		if (rnd(2)) {
+			memcpy(items[id].data, pBuf, len);
+			items[id].len = len;
+			items[id].present = 1;
+		}
+		longjmp(cutJmp, 1);
+	}
+
+	//Compact into the other page when the new copy does not fit
+	if (pageUsed + itemCost(len) > PAGE_SIZE) {
+		for (i = 0; i < 256; i++)
+			if (items[i].present && i != id)
+				live += itemCost(items[i].len);
+		pageUsed = live;
+		erases++;
+		if (pageUsed + itemCost(len) > PAGE_SIZE) {
+			fail("SNV full", pageUsed, len);
+			return NV_OPER_FAILED;
+		}
+	}
+	pageUsed += itemCost(len);
+	snvBytes += len;
+	memcpy(items[id].data, pBuf, len);
+	items[id].len = len;
+	items[id].present = 1;
+	return SUCCESS;
+}
+
+static uint16_t crc16(const uint8_t *p, uint32_t len, uint16_t crc)
+{
+	uint8_t b;
+
+	while (len--) {
+		crc ^= (uint16_t)(*p++ << 8);
+		for (b = 0; b < 8; b++)
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+	}
+	return crc;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+typedef struct {
+	uint32_t first, end, acked;
+	uint16_t lost;
+} Status;
+
+static Status readStatus(void)
+{
+	uint8_t v[SESSION_LOG_STATUS_LEN];
+	Status s;
+
+	if (sessionLog_read(0, v, sizeof(v)) != SESSION_LOG_STATUS_LEN || v[0] != SESSION_LOG_VERSION)
+		fail("status read", v[0], SESSION_LOG_VERSION);
+	s.first = get32(&v[1]);
+	s.end = get32(&v[5]);
+	s.acked = get32(&v[9]);
+	s.lost = v[13] | v[14] << 8;
+	return s;
+}
+
+/**
+ * Record as the log must hold it, at refEnd.
+ */
+static uint32_t makeRecord(uint8_t type, const uint8_t *pData, uint16_t len)
+{
+	uint8_t *r = &refLog[refEnd];
+	uint16_t crc = crc16(&type, 1, 0xFFFF);
+
+	crc = crc16(pData, len, crc);
+	r[0] = len;
+	r[1] = len >> 8;
+	r[2] = type;
+	r[3] = 0x00;
+	r[4] = crc;
+	r[5] = crc >> 8;
+	memcpy(&r[SESSION_LOG_RECORD_HEADER_LEN], pData, len);
+	return SESSION_LOG_RECORD_HEADER_LEN + len;
+}
+
+static void makeSet(EMG_stats *s)
+{
+	uint8_t i;
+
+	memset(s, 0, sizeof(*s));
+	s->samplePeriodMs = 10 + rnd(3) * 10;
+	s->numReps = 1 + rnd(EMG_MAX_REPS);
+	s->setDone = 1;
+	s->exerciseId = rnd(4);
+	for (i = 0; i < s->numReps; i++) {
+		s->pulseWidth[i] = (20 + rnd(300)) * s->samplePeriodMs;
+		s->deadWidth[i] = rnd(400) * s->samplePeriodMs;
+		s->concentricTime[i] = rnd(3000);
+		s->eccentricTime[i] = rnd(4000);
+		s->peakIntensity[i] = rnd(4096);
+		s->movedOrNah[i] = rnd(2);
+	}
+}
+
+/**
+ * The record bytes between two offsets parse, with valid CRCs.
+ */
+static void checkRecords(const uint8_t *p, uint32_t from, uint32_t to)
+{
+	uint32_t pos = from;
+	uint16_t crc;
+
+	while (pos < to) {
+		uint16_t len = p[pos] | p[pos + 1] << 8;
+
+		if (!refStart[pos] || pos + SESSION_LOG_RECORD_HEADER_LEN + len > to) {
+			fail("record boundary", pos, to);
+			return;
+		}
+		crc = crc16(&p[pos + 2], 1, 0xFFFF);
+		crc = crc16(&p[pos + SESSION_LOG_RECORD_HEADER_LEN], len, crc);
+		if ((p[pos + 2] != SESSION_LOG_REC_REP_TIMES && p[pos + 2] != SESSION_LOG_REC_SET_SUMMARY) ||
+				p[pos + 3] != 0x00 || (p[pos + 4] | p[pos + 5] << 8) != crc) {
+			fail("damaged record", pos, p[pos + 2]);
+			return;
+		}
+		pos += SESSION_LOG_RECORD_HEADER_LEN + len;
+	}
+}
+
+/**
+ * An app connects and syncs from where it stopped. Returns once the sync is done, or
+ * after dropAfter notifications.
+ */
+static void syncOnce(uint32_t dropAfter)
+{
+	static uint8_t got[REF_MAX];
+	uint16_t maxLen = 20 + rnd(225);
+	uint8_t window = 1 + rnd(10);
+	uint8_t ctrl[SESSION_LOG_CTRL_LEN] = { SESSION_LOG_OP_START };
+	uint8_t ack[5] = { SESSION_LOG_OP_ACK };
+	uint8_t noti[256];
+	Status s = readStatus();
+	uint32_t expect = (appOffset < s.first || appOffset > s.end) ? s.first : appOffset;
+	uint32_t from = expect, acked = expect, sent = 0;
+	uint16_t len;
+
+	connected = 1;
+	put32(&ctrl[1], appOffset);
+	ctrl[5] = window;
+	if (!sessionLog_control(ctrl, sizeof(ctrl)))
+		fail("sync did not start", appOffset, s.end);
+
+	for (;;) {
+		len = sessionLog_nextChunk(NULL, maxLen);
+		if (!len) {
+			if (acked == expect)
+				break;
+			//Window full or everything sent: the app acks what arrived
+			put32(&ack[1], expect);
+			sessionLog_control(ack, sizeof(ack));
+			acked = expect;
+			continue;
+		}
+		if (len > maxLen)
+			fail("notification too long", len, maxLen);
+		if (sessionLog_nextChunk(noti, maxLen) != len || get32(noti) != expect)
+			fail("notification offset", get32(noti), expect);
+		sessionLog_chunkSent(len);
+		len -= SESSION_LOG_CHUNK_HEADER_LEN;
+		if (!len) {
+			//End of log
+			put32(&ack[1], expect);
+			if (sessionLog_control(ack, sizeof(ack)))
+				fail("sync goes on after the end was acked", expect, s.end);
+			acked = expect;
+			appOffset = expect;
+			break;
+		}
+		if (expect - acked >= (uint32_t)window * (maxLen - SESSION_LOG_CHUNK_HEADER_LEN))
+			fail("sent with the window full", expect - acked, window);
+		memcpy(&got[expect], &noti[SESSION_LOG_CHUNK_HEADER_LEN], len);
+		expect += len;
+		if (expect > refEnd)
+			fail("sent past the end", expect, refEnd);
+		sentEnd = MAX(sentEnd, expect);
+		if (rnd(4) == 0) {
+			put32(&ack[1], expect);
+			sessionLog_control(ack, sizeof(ack));
+			acked = expect;
+		}
+		if (dropAfter && ++sent == dropAfter) {
+			sessionLog_stopSync();
+			break;
+		}
+	}
+
+	if (expect > from && memcmp(&got[from], &refLog[from], expect - from)) {
+		uint32_t i = from;
+
+		while (got[i] == refLog[i])
+			i++;
+		fail("synced bytes differ at", i, from);
+	}
+	if (!dropAfter) {
+		checkRecords(got, from, expect);
+		s = readStatus();
+		if (s.acked != expect)
+			fail("acked after sync", s.acked, expect);
+		if (expect < durableEnd)
+			fail("sync stopped before the written records", expect, durableEnd);
+	}
+	else if (sent == dropAfter) {
+		//The app keeps what arrived up to a record boundary
+		while (acked < refEnd && !refStart[acked] && acked > from)
+			acked--;
+		appOffset = acked;
+	}
+	connected = 0;
+}
+
+/**
+ * The rep times record of the rep events kept.
+ */
+static void makeRepTimes(void)
+{
+	uint8_t buf[8 + EMG_MAX_REPS * 5];
+	uint16_t len = 7;
+	uint8_t i;
+
+	if (!repsKept)
+		return;
+	buf[0] = repEvents[0][1];
+	buf[1] = repEvents[0][2];
+	buf[2] = repsKept;
+	memcpy(&buf[3], &repEvents[0][4], 4);
+	for (i = 1; i < repsKept; i++) {
+		int32_t d = (int32_t)(get32(&repEvents[i][4]) - get32(&repEvents[i - 1][4]));
+		uint32_t v = d >= 0 ? (uint32_t)d * 2 : (uint32_t)-d * 2 - 1;
+
+		for (; v >= 0x80; v >>= 7)
+			buf[len++] = (uint8_t)v | 0x80;
+		buf[len++] = (uint8_t)v;
+	}
+	refStart[refEnd] = 1;
+	refEnd += makeRecord(SESSION_LOG_REC_REP_TIMES, buf, len);
+	repsKept = 0;
+}
+
+static void disconnect(void)
+{
+	Status s;
+
+	makeRepTimes();
+	sessionLog_flush();
+	s = readStatus();
+	durableEnd = refEnd;
+	flushedAck = s.acked;
+}
+
+/**
+ * The next rep of the set in progress. Now and then one goes missing on the way, or
+ * the time is set back.
+ */
+static void appendRep(void)
+{
+	uint8_t ev[EMG_REP_EVENT_LEN];
+	uint8_t i;
+
+	if (rnd(40) == 0)
+		repIndex++;
+	repEndMs += rnd(50) ? 800 + rnd(5000) : -(int32_t)rnd(100000);
+	for (i = 0; i < EMG_REP_EVENT_LEN; i++)
+		ev[i] = rnd(256);
+	ev[1] = repSet;
+	ev[2] = repIndex++;
+	put32(&ev[4], repEndMs);
+
+	//One record holds consecutive reps of one set
+	if (repsKept && (ev[1] != repEvents[0][1] || ev[2] != repEvents[0][2] + repsKept ||
+			repsKept == EMG_MAX_REPS))
+		makeRepTimes();
+	memcpy(repEvents[repsKept++], ev, sizeof(ev));
+	if (!sessionLog_appendRep(ev, sizeof(ev)))
+		fail("rep event not kept", refEnd, 0);
+}
+
+static void appendSet(uint8_t setIndex)
+{
+	uint8_t buf[SESSION_LOG_MAX_PAYLOAD];
+	EMG_stats stats;
+	uint16_t len;
+
+	makeSet(&stats);
+	len = setSummary_encodeRange(&stats, setIndex, 1, 0, buf, sizeof(buf));
+	makeRepTimes();
+	repSet++;
+	repIndex = 0;
+	refStart[refEnd] = 1;
+	refEnd += makeRecord(SESSION_LOG_REC_SET_SUMMARY, buf, len);
+	if (!sessionLog_appendSet(&stats, setIndex, 1))
+		fail("set summary not stored", refEnd, len);
+	durableEnd = refEnd;
+}
+
+/**
+ * Records dropped since the last call that the app had not acked.
+ */
+static void countLost(uint32_t oldFirst, uint32_t newFirst, uint32_t acked)
+{
+	uint32_t i;
+
+	for (i = MAX(oldFirst, acked); i < newFirst; i++)
+		lostRef += refStart[i];
+}
+
+static void checkStatus(void)
+{
+	Status s = readStatus();
+	uint32_t keep = s.end > (SESSION_LOG_BLOCKS - 2) * SESSION_LOG_BLOCK_DATA_LEN ?
+			s.end - (SESSION_LOG_BLOCKS - 2) * SESSION_LOG_BLOCK_DATA_LEN : 0;
+
+	if (s.end != refEnd)
+		fail("end", s.end, refEnd);
+	if (s.first > s.end || (s.first < s.end && !refStart[s.first]))
+		fail("oldest record", s.first, s.end);
+	while (keep < s.end && !refStart[keep])
+		keep++;
+	if (s.first > keep)
+		fail("dropped records of the last blocks", s.first, keep);
+	if (s.acked > s.end)
+		fail("acked past the end", s.acked, s.end);
+}
+
+/**
+ * Workouts with a connection now and then, no power loss.
+ */
+static void runClean(uint32_t workouts)
+{
+	uint32_t w, writes0, erases0, bytes0;
+	uint32_t maxHeld = 0;
+	Status s;
+	uint8_t set, rep;
+
+	phase = "clean";
+	sessionLog_init();
+	writes0 = snvWrites;
+	erases0 = erases;
+	bytes0 = snvBytes;
+
+	for (w = 0; w < workouts; w++) {
+		for (set = 0; set < SETS_PER_WORKOUT; set++) {
+			for (rep = rnd(EMG_MAX_REPS); rep > 0; rep--) {
+				Status before = readStatus();
+
+				appendRep();
+				s = readStatus();
+				countLost(before.first, s.first, before.acked);
+			}
+			s = readStatus();
+			appendSet(set);
+			countLost(s.first, readStatus().first, s.acked);
+			checkStatus();
+		}
+		disconnect();
+		s = readStatus();
+		if (s.lost != (uint16_t)lostRef)
+			fail("lost records", s.lost, lostRef);
+		maxHeld = MAX(maxHeld, s.end - s.first);
+
+		//The app comes back every few workouts
+		if (rnd(3) == 0) {
+			syncOnce(rnd(3) ? 0 : 1 + rnd(8));
+			disconnect();
+			checkStatus();
+		}
+	}
+
+	printf("%u workouts of %u sets, %u bytes each: %.1f SNV writes, %.0f bytes written, "
+			"%.2f page erases per workout\n", workouts, SETS_PER_WORKOUT, refEnd / workouts,
+			(double)(snvWrites - writes0) / workouts, (double)(snvBytes - bytes0) / workouts,
+			(double)(erases - erases0) / workouts);
+	printf("log holds %u bytes at most, %.1f workouts; %u records lost unsynced\n", maxHeld,
+			(double)maxHeld * workouts / refEnd, lostRef);
+}
+
+/**
+ * Power cuts at random SNV writes, each followed by a reboot.
+ */
+static void runCuts(uint32_t cuts)
+{
+	uint32_t done = 0, applied = 0, ops = 0;
+	uint8_t set = 0;
+	Status s;
+
+	phase = "power cuts";
+	while (done < cuts) {
+		volatile uint32_t preEnd = refEnd;
+		volatile uint8_t op = rnd(8);
+
+		cutAt = rnd(2) ? snvWrites + 1 + rnd(3) : 0;
+		if (setjmp(cutJmp) == 0) {
+			if (op < 5)
+				appendRep();
+			else if (op < 7)
+				appendSet(set++ % SETS_PER_WORKOUT);
+			else if (rnd(2))
+				syncOnce(rnd(2) ? 0 : 1 + rnd(8));
+			else
+				disconnect();
+			cutAt = 0;
+			ops++;
+			continue;
+		}
+
+		//Power cut: the record being appended may or may not have made it
+		done++;
+		connected = 0;
+		sessionLog_init();
+		s = readStatus();
+		if (s.end < durableEnd || s.end > refEnd || (s.end < refEnd && !refStart[s.end]))
+			fail("end after the cut", s.end, durableEnd);
+		if (s.end < sentEnd)
+			fail("offsets the app was sent are reused", s.end, sentEnd);
+		if (s.acked < MIN(flushedAck, s.end) || s.acked > s.end)
+			fail("acked after the cut", s.acked, flushedAck);
+		applied += s.end > preEnd;
+
+		memset(&refStart[s.end], 0, refEnd - s.end + 1);
+		refEnd = s.end;
+		repsKept = 0;
+		durableEnd = s.end;
+		flushedAck = s.acked;
+		appOffset = MIN(appOffset, s.end);
+		checkStatus();
+
+		//Everything left must read back
+		syncOnce(0);
+		disconnect();
+	}
+	printf("%u power cuts in %u operations, %u kept the record being appended\n", done, ops,
+			applied);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t workouts = argc > 1 ? atoi(argv[1]) : 300;
+	uint32_t cuts = argc > 2 ? atoi(argv[2]) : 2000;
+
+	runClean(workouts);
+	runCuts(cuts);
+
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+}
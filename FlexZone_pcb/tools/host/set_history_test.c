@@ -0,0 +1,251 @@
+/*
+ * Checks reads of the EMG Summary characteristic (set_history.c) at arbitrary offsets,
+ * as ATT Read and Read Blob request them.
+ *
+ * Random sets are added, a new workout now and then, and after every add the value is
+ * rebuilt independently: the header from the sets of the session, then the newest
+ * summaries that fit SET_HISTORY_MAX_SETS and SET_HISTORY_STORE_LEN, each encoded with
+ * setSummary_encodeRange behind its length. Against it:
+ *
+ *     every offset	reads of 1, 7, 19 and 22 bytes and of the rest, from each offset,
+ *     				so reads start and end inside the header, on and across every
+ *     				boundary between two summaries, and at the end of the value
+ *     long reads	Read then Read Blob until a short response, at ATT MTUs 23 to 100
+ *     past the end	offset == length reads nothing
+ *     mid-read add	a set stored between two blobs changes the generation byte, so
+ *     				the app knows to read again
+ *
+ * Also prints the round trips a long read of a full history takes per MTU.
+ *
+ *     set_history_test [sets]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "set_history.h"
+
+#define LEN_PREFIX							2
+
+typedef struct {
+	uint8_t data[SET_HISTORY_STORE_LEN];
+	uint16_t len;
+} Entry;
+
+static uint32_t rngState = 13;
+static uint32_t failures;
+
+//Reference: what the value must hold
+static Entry entries[SET_HISTORY_MAX_SETS];
+static uint8_t numEntries;
+static uint8_t refGeneration;
+static uint8_t refSets;
+static uint16_t refReps, refPeak;
+static uint32_t refTut;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void makeSet(EMG_stats *s)
+{
+	uint8_t i;
+
+	memset(s, 0, sizeof(*s));
+	s->samplePeriodMs = 10 + rnd(3) * 10;
+	s->numReps = rnd(EMG_MAX_REPS + 1);
+	s->setDone = 1;
+	s->exerciseId = rnd(4);
+	for (i = 0; i < s->numReps; i++) {
+		s->pulseWidth[i] = (20 + rnd(300)) * s->samplePeriodMs;
+		s->deadWidth[i] = rnd(400) * s->samplePeriodMs;
+		s->concentricTime[i] = rnd(3000);
+		s->eccentricTime[i] = rnd(4000);
+		s->peakIntensity[i] = rnd(4096);
+		s->movedOrNah[i] = rnd(2);
+	}
+}
+
+static uint16_t storeUsed(void)
+{
+	uint16_t used = 0;
+	uint8_t i;
+
+	for (i = 0; i < numEntries; i++)
+		used += LEN_PREFIX + entries[i].len;
+	return used;
+}
+
+static void refAdd(const EMG_stats *s, uint8_t setIndex, uint8_t withMotion)
+{
+	uint16_t len = setSummary_encodeRange(s, setIndex, withMotion, 0, NULL, 0);
+	uint8_t i;
+
+	if (setIndex <= 1) {
+		numEntries = 0;
+		refSets = 0;
+		refReps = refPeak = 0;
+		refTut = 0;
+	}
+	while (numEntries && (numEntries == SET_HISTORY_MAX_SETS ||
+			storeUsed() + LEN_PREFIX + len > SET_HISTORY_STORE_LEN)) {
+		memmove(&entries[0], &entries[1], (numEntries - 1) * sizeof(Entry));
+		numEntries--;
+	}
+	entries[numEntries].len = setSummary_encodeRange(s, setIndex, withMotion, 0,
+													 entries[numEntries].data, len);
+	numEntries++;
+
+	refGeneration++;
+	refSets++;
+	refReps += s->numReps;
+	for (i = 0; i < s->numReps; i++) {
+		refTut += s->pulseWidth[i];
+		if (s->peakIntensity[i] > refPeak)
+			refPeak = s->peakIntensity[i];
+	}
+}
+
+static uint16_t refValue(uint8_t *pOut)
+{
+	uint16_t pos = SET_HISTORY_HEADER_LEN;
+	uint8_t i;
+
+	pOut[0] = SET_HISTORY_VERSION;
+	pOut[1] = refGeneration;
+	pOut[2] = numEntries;
+	pOut[3] = refSets;
+	pOut[4] = LO_UINT16(refReps);
+	pOut[5] = HI_UINT16(refReps);
+	pOut[6] = LO_UINT16(refPeak);
+	pOut[7] = HI_UINT16(refPeak);
+	pOut[8] = BREAK_UINT32(refTut, 0);
+	pOut[9] = BREAK_UINT32(refTut, 1);
+	pOut[10] = BREAK_UINT32(refTut, 2);
+	pOut[11] = BREAK_UINT32(refTut, 3);
+	for (i = 0; i < numEntries; i++) {
+		pOut[pos] = LO_UINT16(entries[i].len);
+		pOut[pos + 1] = HI_UINT16(entries[i].len);
+		memcpy(&pOut[pos + LEN_PREFIX], entries[i].data, entries[i].len);
+		pos += LEN_PREFIX + entries[i].len;
+	}
+	return pos;
+}
+
+static void fail(uint32_t set, const char *what, uint32_t a, uint32_t b)
+{
+	if (failures++ < 20)
+		printf("  set %u: %s (%u, %u)\n", set, what, a, b);
+}
+
+/**
+ * ATT Read, then Read Blob at the next offset until a response is shorter than
+ * MTU - 1. Optionally stores a set after the first response.
+ *
+ * @return 	Bytes read
+ */
+static uint16_t longRead(uint16_t mtu, uint8_t *pOut, uint32_t *pTrips, const EMG_stats *pMid,
+						 uint8_t midIndex)
+{
+	uint16_t offset = 0, n;
+
+	*pTrips = 0;
+	do {
+		n = setHistory_read(offset, &pOut[offset], mtu - 1);
+		(*pTrips)++;
+		offset += n;
+		if (pMid && *pTrips == 1) {
+			setHistory_add(pMid, midIndex, 0);
+			refAdd(pMid, midIndex, 0);
+		}
+	} while (n == mtu - 1);
+	return offset;
+}
+
+int main(int argc, char **argv)
+{
+	static const uint16_t readLens[] = { 1, 7, 19, 22, SET_HISTORY_MAX_LEN };
+	uint32_t sets = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2000;
+	uint8_t want[SET_HISTORY_MAX_LEN], got[SET_HISTORY_MAX_LEN + 1];
+	uint32_t tripsAtMtu[101];
+	uint32_t n, trips, boundaryReads = 0;
+	uint16_t len, offset, mtu, i, fullLen = 0;
+	uint8_t setIndex = 0, r;
+	EMG_stats s;
+
+	memset(tripsAtMtu, 0, sizeof(tripsAtMtu));
+	for (n = 0; n < sets; n++) {
+		setIndex = (rnd(12) == 0) ? 1 : setIndex + 1;
+		makeSet(&s);
+		setHistory_add(&s, setIndex, n & 1);
+		refAdd(&s, setIndex, n & 1);
+		len = refValue(want);
+
+		if (setHistory_length() != len)
+			fail(n, "length", setHistory_length(), len);
+		if (setHistory_lastSetIndex() != setIndex)
+			fail(n, "last set index", setHistory_lastSetIndex(), setIndex);
+
+		//Every offset, with windows that start and end on and across the boundaries
+		for (offset = 0; offset <= len; offset++) {
+			uint16_t entryStart = SET_HISTORY_HEADER_LEN;
+
+			for (r = 0; r < sizeof(readLens) / sizeof(readLens[0]); r++) {
+				uint16_t expect = MIN(readLens[r], len - offset);
+				uint16_t got_n;
+
+				memset(got, 0xA5, sizeof(got));
+				got_n = setHistory_read(offset, got, readLens[r]);
+				if (got_n != expect)
+					fail(n, "read length at offset", offset, got_n);
+				else if (memcmp(got, &want[offset], got_n))
+					fail(n, "read bytes at offset", offset, readLens[r]);
+				else if (got[got_n] != 0xA5)
+					fail(n, "read past maxLen at offset", offset, readLens[r]);
+			}
+			for (i = 0; i < numEntries; i++) {
+				uint16_t next = entryStart + LEN_PREFIX + entries[i].len;
+
+				if (offset < next && offset + readLens[2] > next)
+					boundaryReads++;
+				entryStart = next;
+			}
+		}
+
+		//Long reads at every MTU
+		for (mtu = 23; mtu <= 100; mtu++) {
+			if (longRead(mtu, got, &trips, NULL, 0) != len || memcmp(got, want, len))
+				fail(n, "long read at MTU", mtu, len);
+			if (numEntries == SET_HISTORY_MAX_SETS && len > fullLen)
+				tripsAtMtu[mtu] = trips;
+		}
+		if (numEntries == SET_HISTORY_MAX_SETS && len > fullLen)
+			fullLen = len;
+
+		//A set stored in the middle of a long read
+		if (n % 50 == 49) {
+			uint8_t gen0;
+			EMG_stats mid;
+
+			makeSet(&mid);
+			longRead(23, got, &trips, &mid, ++setIndex);
+			gen0 = got[1];
+			len = refValue(want);
+			if (setHistory_read(0, got, SET_HISTORY_MAX_LEN) != len || memcmp(got, want, len))
+				fail(n, "read after the mid-read add", len, 0);
+			if (got[1] == gen0)
+				fail(n, "generation unchanged by the mid-read add", gen0, got[1]);
+		}
+	}
+
+	printf("%u sets, %u reads spanning a summary boundary\n", sets, boundaryReads);
+	printf("long read of a full history (%u bytes):", fullLen);
+	for (mtu = 23; mtu <= 100; mtu++)
+		if (mtu == 23 || mtu == 27 || mtu == 50 || mtu == 100)
+			printf("  MTU %u %u trips", mtu, tripsAtMtu[mtu]);
+	printf("\n%u failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Checks the set publication path and counts what it copies: set_summary.c and
+ * set_history.c as the firmware runs them, with every memcpy/memmove of those modules
+ * counted (they are built with -fno-builtin and linked with --wrap).
+ *
+ * For every generated set the BLE task's steps are replayed: setHistory_add stores the
+ * summary, the EMG task reuses the record, and the TX queue sends the fragments with
+ * setHistory_fillFragment. The reassembled fragments must equal the summary of the set
+ * as published, at the default and the largest notification length. A summary that
+ * newer sets pushed out of the history, or that a new workout cleared, must yield no
+ * fragments rather than someone else's bytes.
+ *
+ *     set_publish_test [sets]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "set_history.h"
+
+#define NOTIFY_HEADER_LEN					2
+
+//Copies of the path user-030 replaced, per set: the deep copy into emg_set_statsSend
+//(EMG_stats is 213 bytes on the target), 11 slices of it into emgArrayData (211
+//bytes), 11 x 40 bytes into heap messages and 11 x 40 into the service value
+#define OLD_PATH_COPY_BYTES					(213 + 211 + 11 * 40 + 11 * 40)
+
+static uint64_t copyBytes, moveBytes;
+static uint8_t counting;
+
+extern void *__real_memcpy(void *pDst, const void *pSrc, size_t n);
+extern void *__real_memmove(void *pDst, const void *pSrc, size_t n);
+
+void *__wrap_memcpy(void *pDst, const void *pSrc, size_t n)
+{
+	if (counting)
+		copyBytes += n;
+	return __real_memcpy(pDst, pSrc, n);
+}
+
+void *__wrap_memmove(void *pDst, const void *pSrc, size_t n)
+{
+	if (counting)
+		moveBytes += n;
+	return __real_memmove(pDst, pSrc, n);
+}
+
+static uint32_t rngState = 7;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void makeSet(EMG_stats *s)
+{
+	uint8_t i;
+
+	memset(s, 0, sizeof(*s));
+	s->samplePeriodMs = 10;
+	s->numReps = 1 + rnd(EMG_MAX_REPS);
+	s->setDone = 1;
+	s->exerciseId = rnd(4);
+	for (i = 0; i < s->numReps; i++) {
+		s->pulseWidth[i] = (40 + rnd(200)) * s->samplePeriodMs;
+		s->deadWidth[i] = rnd(300) * s->samplePeriodMs;
+		s->concentricTime[i] = 300 + rnd(2000);
+		s->eccentricTime[i] = 300 + rnd(3000);
+		s->peakIntensity[i] = 500 + rnd(3500);
+		s->movedOrNah[i] = rnd(2);
+	}
+}
+
+/**
+ * Sends a stored summary like user_txqSend and reassembles it.
+ *
+ * @return 	Reassembled length, 0 if no fragment came, -1 if the fragments are malformed.
+ */
+static int sendFragments(uint8_t id, uint16_t notifyLen, uint8_t *pOut, uint32_t *pNotifs)
+{
+	uint8_t noti[USER_MAX_NOTIFY_LEN];
+	uint16_t len, total = 0;
+	uint8_t frag;
+
+	for (frag = 0; ; frag++) {
+		len = setHistory_fillFragment(id, frag, &noti[NOTIFY_HEADER_LEN], notifyLen - NOTIFY_HEADER_LEN);
+		if (len == 0)
+			return (frag == 0) ? 0 : -1;		//Ended without the last flag
+		(*pNotifs)++;
+		if ((noti[NOTIFY_HEADER_LEN] & SET_SUMMARY_FRAG_INDEX_MASK) != frag)
+			return -1;
+		__real_memcpy(&pOut[total], &noti[NOTIFY_HEADER_LEN + 1], len - 1);
+		total += len - 1;
+		if (noti[NOTIFY_HEADER_LEN] & SET_SUMMARY_FRAG_LAST)
+			return total;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const uint16_t notifyLens[] = { 20, USER_MAX_NOTIFY_LEN };
+	uint32_t sets = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000;
+	uint32_t n, failures = 0, notifs = 0;
+	uint64_t summaryBytes = 0, addCopy = 0, sendCopy = 0;
+	uint8_t want[SET_SUMMARY_MAX_LEN], got[SET_SUMMARY_MAX_LEN];
+	uint8_t ids[SET_HISTORY_MAX_SETS + 1];
+	EMG_stats record;
+	uint8_t i;
+
+	for (n = 0; n < sets; n++) {
+		uint8_t setIndex = 1 + n % 12, withMotion = n & 1;
+		uint16_t wantLen;
+		int gotLen;
+
+		makeSet(&record);
+		wantLen = setSummary_encode(&record, setIndex, withMotion, want, sizeof(want));
+
+		copyBytes = 0;
+		counting = 1;
+		ids[0] = setHistory_add(&record, setIndex, withMotion);
+		counting = 0;
+		addCopy += copyBytes;
+
+		//The EMG task flushes the record for the next set
+		memset(&record, 0xEE, sizeof(record));
+
+		copyBytes = 0;
+		counting = 1;
+		for (i = 0; i < sizeof(notifyLens) / sizeof(notifyLens[0]); i++) {
+			gotLen = sendFragments(ids[0], notifyLens[i], got, &notifs);
+			if (gotLen != wantLen || memcmp(got, want, wantLen)) {
+				printf("set %u, %u byte notifications: fragments differ from the published set\n",
+						n, notifyLens[i]);
+				failures++;
+			}
+			summaryBytes += wantLen;
+		}
+		counting = 0;
+		sendCopy += copyBytes;
+	}
+
+	//A queued summary that newer sets pushed out of the history sends nothing
+	for (i = 0; i <= SET_HISTORY_MAX_SETS; i++) {
+		makeSet(&record);
+		ids[i] = setHistory_add(&record, 2 + i, 0);
+	}
+	if (sendFragments(ids[0], 20, got, &notifs) != 0) {
+		printf("evicted summary still sent fragments\n");
+		failures++;
+	}
+	if (sendFragments(ids[SET_HISTORY_MAX_SETS], 20, got, &notifs) <= 0) {
+		printf("newest summary not sent\n");
+		failures++;
+	}
+
+	//So does one a new workout cleared
+	makeSet(&record);
+	setHistory_add(&record, 1, 0);
+	if (sendFragments(ids[SET_HISTORY_MAX_SETS], 20, got, &notifs) != 0) {
+		printf("summary of the previous workout still sent fragments\n");
+		failures++;
+	}
+
+	printf("%u sets, %u failures\n", sets, failures);
+	printf("copies per set    %.1f B storing, %.1f B per send of a %.1f B summary, "
+			"%.1f B compaction\n", (double)addCopy / sets, (double)sendCopy / (2 * sets),
+			(double)summaryBytes / (2 * sets), (double)moveBytes / sets);
+	printf("old path          %u B per set\n", OLD_PATH_COPY_BYTES);
+	return failures ? 1 : 0;
+}
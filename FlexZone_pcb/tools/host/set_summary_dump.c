@@ -0,0 +1,138 @@
+/*
+ * Encodes generated sets with the firmware's set_summary.c and writes the
+ * APP_PACKET_TYPE_SET_SUMMARY notifications the TX queue would send, as a capture for
+ * set_summary_decode.py, plus the sets themselves as JSON lines to compare against.
+ *
+ *     set_summary_dump <seed> <sets> <notification length> <expected.jsonl> > capture.txt
+ *
+ * The notification length is what user_txqSend uses, MIN(ATT MTU - 3, EMG_STREAM_LEN):
+ * 20 at the default MTU. Sets cover 0 to EMG_MAX_REPS reps, every supported sample
+ * period and the extremes of every field.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "set_summary.h"
+
+#define NOTIFY_HEADER_LEN					2
+
+static uint32_t rngState;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+/**
+ * A random set; every 8th one takes the extreme values the format has to carry.
+ */
+static void makeSet(uint32_t n, EMG_stats *s)
+{
+	static const uint8_t periods[] = { 1, 2, 5, 10, 20, 30, 50 };
+	uint8_t extreme = (n % 8) == 7;
+	uint8_t i;
+
+	memset(s, 0, sizeof(*s));
+	s->samplePeriodMs = periods[rnd(sizeof(periods))];
+	s->numReps = (n % 20 == 0) ? 0 : (extreme ? EMG_MAX_REPS : rnd(EMG_MAX_REPS + 1));
+	s->setDone = rnd(2);
+	s->exerciseId = rnd(5) == 4 ? 0xFF : rnd(4);
+
+	for (i = 0; i < s->numReps; i++) {
+		uint16_t maxSteps = 0xFFFF / s->samplePeriodMs;
+
+		if (extreme) {
+			s->pulseWidth[i] = maxSteps * s->samplePeriodMs;
+			s->deadWidth[i] = (i & 1) ? 0 : maxSteps * s->samplePeriodMs;
+			s->concentricTime[i] = (i & 1) ? 0xFFFF : 0;
+			s->eccentricTime[i] = 0xFFFF;
+			s->peakIntensity[i] = (i & 1) ? 0 : 4095;
+		} else {
+			s->pulseWidth[i] = (30 + rnd(250)) * s->samplePeriodMs;
+			s->deadWidth[i] = rnd(300) * s->samplePeriodMs;
+			s->concentricTime[i] = 200 + rnd(2500);
+			s->eccentricTime[i] = 200 + rnd(3500);
+			s->peakIntensity[i] = 300 + rnd(3796);
+		}
+		s->movedOrNah[i] = rnd(2);
+	}
+}
+
+static void printJsonArray(FILE *f, const char *name, const uint16_t *v, uint8_t n)
+{
+	uint8_t i;
+
+	fprintf(f, ", \"%s\": [", name);
+	for (i = 0; i < n; i++)
+		fprintf(f, "%s%u", i ? ", " : "", v[i]);
+	fprintf(f, "]");
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t noti[USER_MAX_NOTIFY_LEN];
+	uint32_t sets, n;
+	uint16_t notifyLen, len;
+	FILE *expect;
+
+	if (argc != 5) {
+		fprintf(stderr, "usage: set_summary_dump <seed> <sets> <notification length> <expected.jsonl>\n");
+		return 2;
+	}
+	rngState = strtoul(argv[1], NULL, 0) | 1;
+	sets = strtoul(argv[2], NULL, 0);
+	notifyLen = (uint16_t)strtoul(argv[3], NULL, 0);
+	if (notifyLen < NOTIFY_HEADER_LEN + 2 || notifyLen > USER_MAX_NOTIFY_LEN) {
+		fprintf(stderr, "notification length must be %u to %u\n", NOTIFY_HEADER_LEN + 2,
+				USER_MAX_NOTIFY_LEN);
+		return 2;
+	}
+	expect = fopen(argv[4], "w");
+	if (!expect) {
+		perror(argv[4]);
+		return 1;
+	}
+
+	printf("# set_summary_dump %s %s %s\n", argv[1], argv[2], argv[3]);
+	for (n = 0; n < sets; n++) {
+		EMG_stats s;
+		uint8_t setIndex = n % 10, withMotion = rnd(2), frag, i;
+
+		makeSet(n, &s);
+
+		fprintf(expect, "{\"set_index\": %u, \"num_reps\": %u, \"set_done\": %u, \"exercise\": %u, "
+				"\"width_unit\": %u", setIndex, s.numReps, s.setDone, s.exerciseId, s.samplePeriodMs);
+		printJsonArray(expect, "pulse_width", s.pulseWidth, s.numReps);
+		printJsonArray(expect, "dead_width", s.deadWidth, s.numReps);
+		printJsonArray(expect, "concentric", s.concentricTime, s.numReps);
+		printJsonArray(expect, "eccentric", s.eccentricTime, s.numReps);
+		printJsonArray(expect, "peak", s.peakIntensity, s.numReps);
+		if (withMotion) {
+			fprintf(expect, ", \"moved\": [");
+			for (i = 0; i < s.numReps; i++)
+				fprintf(expect, "%s%u", i ? ", " : "", s.movedOrNah[i]);
+			fprintf(expect, "]");
+		} else {
+			fprintf(expect, ", \"moved\": null");
+		}
+		fprintf(expect, "}\n");
+
+		for (frag = 0; ; frag++) {
+			len = setSummary_fillFragment(&s, setIndex, withMotion, frag, &noti[NOTIFY_HEADER_LEN],
+										  notifyLen - NOTIFY_HEADER_LEN);
+			if (len == 0)
+				break;
+			noti[0] = APP_PACKET_TYPE_SET_SUMMARY;
+			noti[1] = len;
+			for (i = 0; i < len + NOTIFY_HEADER_LEN; i++)
+				printf("%02x", noti[i]);
+			printf("\n");
+		}
+	}
+
+	fclose(expect);
+	return 0;
+}
@@ -0,0 +1,900 @@
+/*
+ * Host implementation of the shimmed kernel, see fz_shim.h.
+ */
+#define _GNU_SOURCE
+#include "fz_shim.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+uint32_t Clock_tickPeriod = 10;		//us, as in the BLE stack configuration
+
+static uint64_t nowUs = 0;
+static uint32_t secondsBase = 0;
+static Clock_Struct *clocks = NULL;
+static Swi_Struct *swis = NULL;
+static UInt swiTrigger = 0;
+static Bool swiRunning = FALSE;
+static Task_Struct *tasks = NULL;
+static __thread Task_Struct *curTask = NULL;	//Tasks all run on the thread that started them
+static Bool tasksStarted = FALSE;
+static ucontext_t schedContext;
+static pthread_mutex_t hwiLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static Task_Struct *lastTask = NULL;		//Ran last, NULL once idle
+
+Shim_kernelStats shim_kernelStats;
+
+#define TASK_HOST_STACK						(256 * 1024)
+
+enum { TASK_READY = 0, TASK_BLOCKED, TASK_SLEEPING, TASK_TERMINATED };
+
+static __thread uint32_t hwiDepth = 0;
+
+static void taskSwitchOut(void);
+static void taskReadyWaiter(Semaphore_Handle hSem);
+static void taskPreempt(void);
+static size_t stackUsed(const void *pStack, size_t size);
+
+//**********************************************************************************
+// XDC
+//**********************************************************************************
+void System_printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
+
+void System_flush(void)
+{
+	fflush(stdout);
+}
+
+uint32_t shim_timestampHz = 1000000;
+
+uint32_t Timestamp_get32(void)
+{
+	return (uint32_t)(nowUs * shim_timestampHz / 1000000);
+}
+
+void Timestamp_getFreq(Types_FreqHz *pFreq)
+{
+	pFreq->hi = 0;
+	pFreq->lo = shim_timestampHz;
+}
+
+//**********************************************************************************
+// Clock
+//**********************************************************************************
+static uint32_t nowTicks(void)
+{
+	return (uint32_t)(nowUs / Clock_tickPeriod);
+}
+
+void Clock_Params_init(Clock_Params *pParams)
+{
+	memset(pParams, 0, sizeof(*pParams));
+}
+
+void Clock_construct(Clock_Struct *pClock, Clock_FuncPtr fxn, uint32_t timeout,
+					 const Clock_Params *pParams)
+{
+	memset(pClock, 0, sizeof(*pClock));
+	shim_kernelStats.clocks++;
+	pClock->fxn = fxn;
+	pClock->timeout = timeout;
+	pClock->period = pParams ? pParams->period : 0;
+	pClock->arg = pParams ? pParams->arg : 0;
+	pClock->pNext = clocks;
+	clocks = pClock;
+	if (pParams && pParams->startFlag)
+		Clock_start(pClock);
+}
+
+Clock_Handle Clock_handle(Clock_Struct *pClock)
+{
+	return pClock;
+}
+
+void Clock_start(Clock_Handle hClock)
+{
+	hClock->deadline = nowTicks() + hClock->timeout;
+	hClock->active = TRUE;
+}
+
+void Clock_stop(Clock_Handle hClock)
+{
+	hClock->active = FALSE;
+}
+
+void Clock_setPeriod(Clock_Handle hClock, uint32_t period)
+{
+	hClock->period = period;
+}
+
+void Clock_setTimeout(Clock_Handle hClock, uint32_t timeout)
+{
+	hClock->timeout = timeout;
+}
+
+uint32_t Clock_getTimeout(Clock_Handle hClock)
+{
+	if (!hClock->active)
+		return hClock->timeout;
+	return hClock->deadline - nowTicks();
+}
+
+Bool Clock_isActive(Clock_Handle hClock)
+{
+	return hClock->active;
+}
+
+uint32_t Clock_getTicks(void)
+{
+	return nowTicks();
+}
+
+//**********************************************************************************
+// Swi
+//**********************************************************************************
+void Swi_Params_init(Swi_Params *pParams)
+{
+	memset(pParams, 0, sizeof(*pParams));
+}
+
+void Swi_construct(Swi_Struct *pSwi, Swi_FuncPtr fxn, const Swi_Params *pParams, void *pEb)
+{
+	memset(pSwi, 0, sizeof(*pSwi));
+	shim_kernelStats.swis++;
+	pSwi->fxn = fxn;
+	if (pParams) {
+		pSwi->arg0 = pParams->arg0;
+		pSwi->arg1 = pParams->arg1;
+		pSwi->priority = pParams->priority;
+		pSwi->trigger = pParams->trigger;
+		pSwi->initTrigger = pParams->trigger;
+	}
+	pSwi->pNext = swis;
+	swis = pSwi;
+}
+
+Swi_Handle Swi_handle(Swi_Struct *pSwi)
+{
+	return pSwi;
+}
+
+//Posted from a task, the Swi preempts it
+void Swi_post(Swi_Handle hSwi)
+{
+	hSwi->posted = TRUE;
+	if (curTask && !hwiDepth) {
+		shim_runSwis();
+		taskPreempt();
+	}
+}
+
+void Swi_or(Swi_Handle hSwi, UInt mask)
+{
+	UInt key = Hwi_disable();
+
+	hSwi->trigger |= mask;
+	hSwi->posted = TRUE;
+	Hwi_restore(key);
+	if (curTask && !hwiDepth) {
+		shim_runSwis();
+		taskPreempt();
+	}
+}
+
+UInt Swi_getTrigger(void)
+{
+	return swiTrigger;
+}
+
+UInt Swi_disable(void)
+{
+	return Hwi_disable();
+}
+
+void Swi_restore(UInt key)
+{
+	Hwi_restore(key);
+}
+
+void shim_runSwis(void)
+{
+	Swi_Struct *pSwi, *pBest;
+	UInt key;
+
+	if (swiRunning)
+		return;		//A Swi posted from a Swi runs once the current one returns
+	swiRunning = TRUE;
+
+	for (;;) {
+		pBest = NULL;
+		for (pSwi = swis; pSwi; pSwi = pSwi->pNext)
+			if (pSwi->posted && (!pBest || pSwi->priority > pBest->priority))
+				pBest = pSwi;
+		if (!pBest)
+			break;
+
+		key = Hwi_disable();
+		pBest->posted = FALSE;
+		swiTrigger = pBest->trigger;
+		pBest->trigger = pBest->initTrigger;
+		Hwi_restore(key);
+		pBest->fxn(pBest->arg0, pBest->arg1);
+	}
+
+	swiRunning = FALSE;
+}
+
+//**********************************************************************************
+// Semaphore, Task, Queue
+//**********************************************************************************
+void Semaphore_Params_init(Semaphore_Params *pParams)
+{
+	pParams->mode = Semaphore_Mode_COUNTING;
+}
+
+void Semaphore_construct(Semaphore_Struct *pSem, Int count, const Semaphore_Params *pParams)
+{
+	shim_kernelStats.semaphores++;
+	pSem->count = count;
+	pSem->mode = pParams ? pParams->mode : Semaphore_Mode_COUNTING;
+}
+
+Semaphore_Handle Semaphore_handle(Semaphore_Struct *pSem)
+{
+	return pSem;
+}
+
+//Blocks only inside a task, elsewhere the checks run the pending side themselves
+Bool Semaphore_pend(Semaphore_Handle hSem, uint32_t timeout)
+{
+	Bool taken = FALSE;
+	UInt key = Hwi_disable();
+
+	if (hSem->count > 0) {
+		hSem->count--;
+		taken = TRUE;
+	}
+	Hwi_restore(key);
+	if (taken || !curTask || timeout == BIOS_NO_WAIT)
+		return taken;
+
+	curTask->state = TASK_BLOCKED;
+	curTask->hWait = hSem;
+	curTask->timed = (timeout != BIOS_WAIT_FOREVER);
+	curTask->wakeTick = nowTicks() + timeout;
+	taskSwitchOut();
+	return curTask->pendResult;
+}
+
+void Semaphore_post(Semaphore_Handle hSem)
+{
+	UInt key = Hwi_disable();
+
+	if (hSem->mode == Semaphore_Mode_BINARY)
+		hSem->count = 1;
+	else
+		hSem->count++;
+	Hwi_restore(key);
+	taskReadyWaiter(hSem);
+}
+
+Int Semaphore_getCount(Semaphore_Handle hSem)
+{
+	return hSem->count;
+}
+
+void Task_Params_init(Task_Params *pParams)
+{
+	memset(pParams, 0, sizeof(*pParams));
+}
+
+void Task_construct(Task_Struct *pTask, Task_FuncPtr fxn, const Task_Params *pParams, void *pEb)
+{
+	memset(pTask, 0, sizeof(*pTask));
+	shim_kernelStats.tasks++;
+	pTask->fxn = fxn;
+	pTask->stack = pParams->stack;
+	pTask->stackSize = pParams->stackSize;
+	if (pTask->stack)
+		memset(pTask->stack, SHIM_STACK_FILL, pTask->stackSize);
+	pTask->priority = pParams->priority;
+	pTask->arg0 = pParams->arg0;
+	pTask->arg1 = pParams->arg1;
+	pTask->state = TASK_READY;
+	pTask->pNext = tasks;
+	tasks = pTask;
+}
+
+Task_Handle Task_handle(Task_Struct *pTask)
+{
+	return pTask;
+}
+
+void Task_stat(Task_Handle hTask, Task_Stat *pStat)
+{
+	memset(pStat, 0, sizeof(*pStat));
+	pStat->priority = hTask->priority;
+	pStat->stack = hTask->stack;
+	pStat->stackSize = hTask->stackSize;
+	pStat->used = stackUsed(hTask->stack, hTask->stackSize);
+}
+
+void Task_sleep(uint32_t ticks)
+{
+	if (!curTask) {
+		shim_advanceUs((uint64_t)ticks * Clock_tickPeriod);
+		return;
+	}
+	curTask->state = TASK_SLEEPING;
+	curTask->wakeTick = nowTicks() + ticks;
+	taskSwitchOut();
+}
+
+UInt Task_disable(void)
+{
+	return 0;
+}
+
+void Task_restore(UInt key)
+{
+}
+
+/**
+ * Readies the highest priority task pended on a semaphore, handing it the count a post
+ * just added. Switches to it at once if it outranks the running task.
+ */
+static void taskReadyWaiter(Semaphore_Handle hSem)
+{
+	Task_Struct *pTask, *pBest = NULL;
+	UInt key = Hwi_disable();
+
+	for (pTask = tasks; pTask; pTask = pTask->pNext)
+		if (pTask->state == TASK_BLOCKED && pTask->hWait == hSem &&
+				(!pBest || pTask->priority > pBest->priority))
+			pBest = pTask;
+	if (pBest && hSem->count > 0) {
+		hSem->count--;
+		pBest->state = TASK_READY;
+		pBest->pendResult = TRUE;
+	}
+	Hwi_restore(key);
+	taskPreempt();
+}
+
+/**
+ * Switches away from the running task if a higher priority one is ready. Deferred while
+ * interrupts are disabled or a Swi runs, like the device's scheduler.
+ */
+static void taskPreempt(void)
+{
+	Task_Struct *pTask;
+
+	if (!curTask || swiRunning || hwiDepth)
+		return;
+	for (pTask = tasks; pTask; pTask = pTask->pNext)
+		if (pTask->state == TASK_READY && pTask->priority > curTask->priority) {
+			curTask->state = TASK_READY;
+			taskSwitchOut();
+			return;
+		}
+}
+
+static void taskSwitchOut(void)
+{
+	swapcontext(&curTask->context, &schedContext);
+}
+
+static void taskEntry(void)
+{
+	curTask->fxn(curTask->arg0, curTask->arg1);
+	curTask->state = TASK_TERMINATED;
+}
+
+/**
+ * Readies the tasks whose sleep or pend timeout has run out.
+ *
+ * @return 	Earliest wake up still to come in us from now, UINT64_MAX for none
+ */
+static uint64_t taskTimeouts(void)
+{
+	Task_Struct *pTask;
+	uint64_t nextUs = UINT64_MAX;
+
+	for (pTask = tasks; pTask; pTask = pTask->pNext) {
+		int32_t left;
+
+		if (pTask->state != TASK_SLEEPING && !(pTask->state == TASK_BLOCKED && pTask->timed))
+			continue;
+		left = (int32_t)(pTask->wakeTick - nowTicks());
+		if (left > 0) {
+			//On the tick, as the clocks
+			if ((uint64_t)left * Clock_tickPeriod - nowUs % Clock_tickPeriod < nextUs)
+				nextUs = (uint64_t)left * Clock_tickPeriod - nowUs % Clock_tickPeriod;
+			continue;
+		}
+		pTask->pendResult = FALSE;
+		pTask->state = TASK_READY;
+	}
+	return nextUs;
+}
+
+void shim_runTasks(void)
+{
+	Task_Struct *pTask, *pBest;
+
+	if (curTask)
+		return;
+	tasksStarted = TRUE;
+
+	for (;;) {
+		shim_runSwis();
+		taskTimeouts();
+
+		pBest = NULL;
+		for (pTask = tasks; pTask; pTask = pTask->pNext)
+			if (pTask->state == TASK_READY && (!pBest || pTask->priority > pBest->priority))
+				pBest = pTask;
+		if (!pBest) {
+			lastTask = NULL;
+			break;
+		}
+		if (pBest != lastTask)
+			shim_kernelStats.switches++;
+		lastTask = pBest;
+
+		if (!pBest->hostStack) {
+			pBest->hostStack = malloc(TASK_HOST_STACK);
+			getcontext(&pBest->context);
+			pBest->context.uc_stack.ss_sp = pBest->hostStack;
+			pBest->context.uc_stack.ss_size = TASK_HOST_STACK;
+			pBest->context.uc_link = &schedContext;
+			makecontext(&pBest->context, taskEntry, 0);
+		}
+		curTask = pBest;
+		swapcontext(&schedContext, &pBest->context);
+		curTask = NULL;
+	}
+}
+
+void Queue_construct(Queue_Struct *pQueue, void *pParams)
+{
+	pQueue->elem.next = &pQueue->elem;
+	pQueue->elem.prev = &pQueue->elem;
+}
+
+Queue_Handle Queue_handle(Queue_Struct *pQueue)
+{
+	return pQueue;
+}
+
+Bool Queue_empty(Queue_Handle hQueue)
+{
+	return hQueue->elem.next == &hQueue->elem;
+}
+
+void Queue_enqueue(Queue_Handle hQueue, Queue_Elem *pElem)
+{
+	pElem->next = &hQueue->elem;
+	pElem->prev = hQueue->elem.prev;
+	hQueue->elem.prev->next = pElem;
+	hQueue->elem.prev = pElem;
+}
+
+void *Queue_dequeue(Queue_Handle hQueue)
+{
+	Queue_Elem *pElem = hQueue->elem.next;
+
+	if (pElem == &hQueue->elem)
+		return pElem;		//Like SYS/BIOS, the queue itself when empty
+	Queue_remove(pElem);
+	return pElem;
+}
+
+void *Queue_head(Queue_Handle hQueue)
+{
+	return hQueue->elem.next;
+}
+
+void Queue_put(Queue_Handle hQueue, Queue_Elem *pElem)
+{
+	UInt key = Hwi_disable();
+
+	Queue_enqueue(hQueue, pElem);
+	Hwi_restore(key);
+}
+
+void *Queue_get(Queue_Handle hQueue)
+{
+	void *pElem;
+	UInt key = Hwi_disable();
+
+	pElem = Queue_dequeue(hQueue);
+	Hwi_restore(key);
+	return pElem;
+}
+
+void Queue_remove(Queue_Elem *pElem)
+{
+	pElem->prev->next = pElem->next;
+	pElem->next->prev = pElem->prev;
+	pElem->next = pElem;
+	pElem->prev = pElem;
+}
+
+//**********************************************************************************
+// Hwi, Seconds, BIOS, Power
+//**********************************************************************************
+UInt Hwi_disable(void)
+{
+	pthread_mutex_lock(&hwiLock);
+	if (curTask)
+		hwiDepth++;
+	return 0;
+}
+
+void Hwi_restore(UInt key)
+{
+	if (curTask && hwiDepth && !--hwiDepth) {
+		pthread_mutex_unlock(&hwiLock);
+		taskPreempt();
+		return;
+	}
+	pthread_mutex_unlock(&hwiLock);
+}
+
+uint32_t shim_exclusiveYield = 0;
+static __thread void *exclusiveAddr = NULL;
+static __thread uint32_t exclusiveValue;
+static __thread uint32_t exclusiveCount = 0;
+
+static void exclusiveYield(void)
+{
+	if (shim_exclusiveYield && ++exclusiveCount % shim_exclusiveYield == 0)
+		sched_yield();
+}
+
+uint32_t __ldrex(void *pAddr)
+{
+	exclusiveAddr = pAddr;
+	exclusiveValue = __atomic_load_n((uint32_t *)pAddr, __ATOMIC_ACQUIRE);
+	exclusiveYield();
+	return exclusiveValue;
+}
+
+uint32_t __strex(uint32_t value, void *pAddr)
+{
+	uint32_t expected = exclusiveValue;
+
+	if (pAddr != exclusiveAddr)
+		return 1;
+	exclusiveAddr = NULL;
+	if (!__atomic_compare_exchange_n((uint32_t *)pAddr, &expected, value, FALSE,
+									 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return 1;
+	exclusiveYield();
+	return 0;
+}
+
+void *shim_hwiStack = NULL;
+size_t shim_hwiStackSize = 0;
+
+Bool Hwi_getStackInfo(Hwi_StackInfo *pInfo, Bool computeStackDepth)
+{
+	memset(pInfo, 0, sizeof(*pInfo));
+	if (!shim_hwiStack)
+		return FALSE;
+
+	pInfo->hwiStackBase = shim_hwiStack;
+	pInfo->hwiStackSize = shim_hwiStackSize;
+	if (computeStackDepth)
+		pInfo->hwiStackPeak = stackUsed(shim_hwiStack, shim_hwiStackSize);
+	return pInfo->hwiStackPeak == shim_hwiStackSize;
+}
+
+/**
+ * Stack grows down from the top, so the fill left at the bottom is what was never used.
+ */
+static size_t stackUsed(const void *pStack, size_t size)
+{
+	const uint8_t *p = pStack;
+	size_t unused = 0;
+
+	if (!p)
+		return 0;
+	while (unused < size && p[unused] == SHIM_STACK_FILL)
+		unused++;
+	return size - unused;
+}
+
+void Seconds_set(uint32_t seconds)
+{
+	secondsBase = seconds - (uint32_t)(nowUs / 1000000);
+}
+
+uint32_t Seconds_get(void)
+{
+	return secondsBase + (uint32_t)(nowUs / 1000000);
+}
+
+void BIOS_start(void)
+{
+}
+
+__thread BIOS_ThreadType shim_threadType = BIOS_ThreadType_Main;
+
+BIOS_ThreadType BIOS_getThreadType(void)
+{
+	if (swiRunning)
+		return BIOS_ThreadType_Swi;
+	if (curTask)
+		return BIOS_ThreadType_Task;
+	return shim_threadType;
+}
+
+int32_t shim_powerCount[SHIM_POWER_IDS];
+
+void Power_setConstraint(UInt constraint)
+{
+	shim_powerCount[constraint]++;
+}
+
+void Power_releaseConstraint(UInt constraint)
+{
+	shim_powerCount[constraint]--;
+}
+
+void Power_setDependency(UInt resource)
+{
+	shim_powerCount[resource]++;
+}
+
+void Power_releaseDependency(UInt resource)
+{
+	shim_powerCount[resource]--;
+}
+
+//**********************************************************************************
+// ICall
+//**********************************************************************************
+__attribute__((weak)) void *ICall_malloc(uint16_t size)
+{
+	return malloc(size);
+}
+
+__attribute__((weak)) void ICall_free(void *pMsg)
+{
+	free(pMsg);
+}
+
+__attribute__((weak)) void ICall_getHeapMgrGetMetrics(uint32_t *pBlkMax, uint32_t *pBlkCnt,
+		uint32_t *pBlkFree, uint32_t *pMemAlo, uint32_t *pMemMax, uint32_t *pMemUB)
+{
+	*pBlkMax = *pBlkCnt = *pBlkFree = *pMemAlo = *pMemMax = *pMemUB = 0;
+}
+
+//**********************************************************************************
+// PIN, AUX ADC and WUC, GPT
+//**********************************************************************************
+uint32_t (*shim_adcSource)(uint32_t input) = NULL;
+void (*shim_ioFxn)(void) = NULL;
+int (*shim_uartWriteFxn)(const void *pBuf, size_t size) = NULL;
+Shim_gpt shim_gpt0;
+static uint32_t adcInput;
+
+PIN_Handle PIN_open(PIN_State *pState, const PIN_Config *pTable)
+{
+	const PIN_Config *pPin;
+
+	pState->pTable = pTable;
+	pState->outputs = 0;
+	pState->muxed = 0;
+	for (pPin = pTable; *pPin != PIN_TERMINATE; pPin++)
+		if ((*pPin & PIN_GPIO_OUTPUT_EN) && (*pPin & PIN_GPIO_HIGH))
+			pState->outputs |= 1u << (*pPin & 0xFF);
+	return pState;
+}
+
+void PIN_close(PIN_Handle hPin)
+{
+}
+
+bStatus_t PIN_setOutputValue(PIN_Handle hPin, PIN_Id pinId, uint32_t val)
+{
+	if (val)
+		hPin->outputs |= 1u << pinId;
+	else
+		hPin->outputs &= ~(1u << pinId);
+	if (shim_ioFxn)
+		shim_ioFxn();
+	return SUCCESS;
+}
+
+bStatus_t PINCC26XX_setMux(PIN_Handle hPin, PIN_Id pinId, int32_t mux)
+{
+	if (PINCC26XX_MUX_GPIO == mux)
+		hPin->muxed &= ~(1u << pinId);
+	else
+		hPin->muxed |= 1u << pinId;
+	if (shim_ioFxn)
+		shim_ioFxn();
+	return SUCCESS;
+}
+
+int UART_write(UART_Handle hUart, const void *pBuf, size_t size)
+{
+	return shim_uartWriteFxn ? shim_uartWriteFxn(pBuf, size) : UART_ERROR;
+}
+
+void AUXADCSelectInput(uint32_t input)
+{
+	adcInput = input;
+}
+
+void AUXADCEnableSync(uint32_t refSource, uint32_t sampleTime, uint32_t trigger)
+{
+}
+
+void AUXADCDisable(void)
+{
+}
+
+uint32_t shim_adcConversions = 0;
+
+void AUXADCGenManualTrigger(void)
+{
+	shim_adcConversions++;
+}
+
+uint32_t AUXADCReadFifo(void)
+{
+	return shim_adcSource ? shim_adcSource(adcInput) & 0xFFF : 0;
+}
+
+uint32_t shim_auxClocks = 0;
+
+void AUXWUCClockEnable(uint32_t clocks)
+{
+	shim_auxClocks |= clocks;
+}
+
+void AUXWUCClockDisable(uint32_t clocks)
+{
+	shim_auxClocks &= ~clocks;
+}
+
+void TimerConfigure(uint32_t base, uint32_t config)
+{
+	shim_gpt0.config = config;
+	shim_gpt0.enabled = FALSE;
+	if (shim_ioFxn)
+		shim_ioFxn();
+}
+
+void TimerLoadSet(uint32_t base, uint32_t timer, uint32_t value)
+{
+	shim_gpt0.load = value;
+	if (shim_ioFxn)
+		shim_ioFxn();
+}
+
+void TimerMatchSet(uint32_t base, uint32_t timer, uint32_t value)
+{
+	shim_gpt0.match = value;
+	if (shim_ioFxn)
+		shim_ioFxn();
+}
+
+void TimerEnable(uint32_t base, uint32_t timer)
+{
+	shim_gpt0.enabled = TRUE;
+	if (shim_ioFxn)
+		shim_ioFxn();
+}
+
+void TimerDisable(uint32_t base, uint32_t timer)
+{
+	shim_gpt0.enabled = FALSE;
+	if (shim_ioFxn)
+		shim_ioFxn();
+}
+
+//**********************************************************************************
+// AON RTC, runs from power up like on the device
+//**********************************************************************************
+uint32_t shim_rtcHz = 0;
+
+uint32_t AONRTCSecGet(void)
+{
+	return (uint32_t)(nowUs / 1000000);
+}
+
+uint32_t AONRTCFractionGet(void)
+{
+	if (shim_rtcHz)
+		return (uint32_t)((((nowUs % 1000000) * shim_rtcHz / 1000000) << 32) / shim_rtcHz);
+	return (uint32_t)(((nowUs % 1000000) << 32) / 1000000);
+}
+
+uint32_t AONRTCCurrentCompareValueGet(void)
+{
+	return (uint32_t)(AONRTCCurrent64BitValueGet() >> 16);
+}
+
+uint64_t AONRTCCurrent64BitValueGet(void)
+{
+	return ((uint64_t)AONRTCSecGet() << 32) | AONRTCFractionGet();
+}
+
+//**********************************************************************************
+// Simulation control
+//**********************************************************************************
+uint64_t (*shim_swiLatencyFxn)(void) = NULL;
+
+uint64_t shim_nowUs(void)
+{
+	return nowUs;
+}
+
+void shim_advanceUs(uint64_t us)
+{
+	uint64_t endUs = nowUs + us;
+	Clock_Struct *pClock, *pDue;
+	uint64_t dueUs, taskUs;
+
+	for (;;) {
+		pDue = NULL;
+		dueUs = endUs;
+		if (tasksStarted) {
+			taskUs = taskTimeouts();
+			if (taskUs != UINT64_MAX && nowUs + taskUs < dueUs)
+				dueUs = nowUs + taskUs;
+		}
+		for (pClock = clocks; pClock; pClock = pClock->pNext) {
+			uint64_t atUs;
+
+			if (!pClock->active)
+				continue;
+			//Deadlines are 32-bit ticks, taken relative to now. A clock fires on the tick
+			//it is due, however far into the current tick it was started
+			atUs = ((uint64_t)(nowUs / Clock_tickPeriod) + (int32_t)(pClock->deadline - nowTicks())) *
+				   Clock_tickPeriod;
+			if (atUs < nowUs)
+				atUs = nowUs;
+			if (atUs <= dueUs) {
+				pDue = pClock;
+				dueUs = atUs;
+			}
+		}
+		if (!pDue && dueUs == endUs)
+			break;
+
+		nowUs = dueUs;
+		if (pDue) {
+			if (pDue->period)
+				pDue->deadline += pDue->period;
+			else
+				pDue->active = FALSE;
+			pDue->fxn(pDue->arg);
+			if (shim_swiLatencyFxn)
+				nowUs += shim_swiLatencyFxn();
+		}
+		shim_runSwis();
+		if (tasksStarted)
+			shim_runTasks();
+	}
+
+	nowUs = endUs;
+	shim_runSwis();
+	if (tasksStarted)
+		shim_runTasks();
+}
@@ -0,0 +1,584 @@
+/*
+ * Host shim of the SYS/BIOS, TI-RTOS driver, driverlib and XDC APIs the FlexZone
+ * application uses, so its modules build and run on the host for the checks in
+ * tools/host. Every TI and BLE stack header path the modules include is a one-line
+ * file that includes this one.
+ *
+ * Kernel objects run on simulated time (shim_advanceUs): Clock callbacks and posted
+ * Swis run from there, in deadline and then priority order. Hwi_disable is a global
+ * recursive lock, so modules touched from several host threads keep their critical
+ * sections; only the thread running the tasks has them switch on Hwi_restore.
+ *
+ * Constructed tasks only run once a check calls shim_runTasks: each gets a host stack
+ * and runs, highest priority first, until it pends on a semaphore with nothing to take
+ * or sleeps. A post that readies a higher priority task switches to it at once, as on
+ * the device. Outside of a task Semaphore_pend never blocks and Task_sleep moves
+ * simulated time on, for the checks that drive a module's task side themselves.
+ */
+#ifndef FZ_SHIM_H
+#define FZ_SHIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ucontext.h>
+
+//**********************************************************************************
+// XDC types
+//**********************************************************************************
+typedef int Int;
+typedef unsigned int UInt;
+typedef uintptr_t UArg;
+typedef intptr_t IArg;
+typedef char Char;
+typedef void Void;
+typedef int Bool;
+typedef uint32_t Bits32;
+
+typedef unsigned char uint8;
+typedef unsigned short uint16;
+typedef unsigned int uint32;
+typedef signed char int8;
+typedef short int16;
+typedef int int32;
+
+#ifndef TRUE
+#define TRUE								1
+#define FALSE								0
+#endif
+#define CONST								const
+#define VOID								(void)
+
+#define Log_info0(f)						((void)0)
+#define Log_info1(f, a)						((void)(a))
+#define Log_info2(f, a, b)					((void)(a), (void)(b))
+#define Log_info3(f, a, b, c)				((void)(a), (void)(b), (void)(c))
+#define Log_info4(f, a, b, c, d)			((void)(a), (void)(b), (void)(c), (void)(d))
+#define Log_info5(f, a, b, c, d, e)			((void)(a), (void)(b), (void)(c), (void)(d), (void)(e))
+#define Log_warning0(f)						((void)0)
+#define Log_warning1(f, a)					((void)(a))
+#define Log_warning2(f, a, b)				((void)(a), (void)(b))
+#define Log_warning3(f, a, b, c)			((void)(a), (void)(b), (void)(c))
+#define Log_error0(f)						((void)0)
+#define Log_error1(f, a)					((void)(a))
+#define Log_error2(f, a, b)					((void)(a), (void)(b))
+#define Log_error3(f, a, b, c)				((void)(a), (void)(b), (void)(c))
+
+extern void System_printf(const char *fmt, ...);
+extern void System_flush(void);
+
+typedef struct {
+	uint32_t hi;
+	uint32_t lo;
+} Types_FreqHz;
+
+//Timestamp runs at shim_timestampHz on simulated time, 1 MHz unless a check sets it
+extern uint32_t shim_timestampHz;
+extern uint32_t Timestamp_get32(void);
+extern void Timestamp_getFreq(Types_FreqHz *pFreq);
+
+//**********************************************************************************
+// SYS/BIOS
+//**********************************************************************************
+#define BIOS_WAIT_FOREVER					(~0u)
+#define BIOS_NO_WAIT						0
+
+typedef void (*Clock_FuncPtr)(UArg arg);
+typedef void (*Swi_FuncPtr)(UArg arg0, UArg arg1);
+typedef void (*Task_FuncPtr)(UArg arg0, UArg arg1);
+
+typedef struct Clock_Struct {
+	struct Clock_Struct *pNext;
+	Clock_FuncPtr fxn;
+	UArg arg;
+	uint32_t timeout;
+	uint32_t period;
+	uint32_t deadline;
+	Bool active;
+} Clock_Struct, *Clock_Handle;
+
+typedef struct {
+	UArg arg;
+	uint32_t period;
+	Bool startFlag;
+} Clock_Params;
+
+typedef struct Swi_Struct {
+	struct Swi_Struct *pNext;
+	Swi_FuncPtr fxn;
+	UArg arg0;
+	UArg arg1;
+	UInt priority;
+	UInt trigger;
+	UInt initTrigger;
+	Bool posted;
+} Swi_Struct, *Swi_Handle;
+
+typedef struct {
+	UArg arg0;
+	UArg arg1;
+	UInt priority;
+	UInt trigger;
+} Swi_Params;
+
+typedef struct {
+	volatile Int count;
+	Int mode;
+} Semaphore_Struct, *Semaphore_Handle;
+
+typedef struct {
+	Int mode;
+} Semaphore_Params;
+
+#define Semaphore_Mode_COUNTING				0
+#define Semaphore_Mode_BINARY				1
+
+typedef struct {
+	void *stack;
+	size_t stackSize;
+	Int priority;
+	UArg arg0;
+	UArg arg1;
+} Task_Params;
+
+typedef struct Task_Struct {
+	struct Task_Struct *pNext;
+	Task_FuncPtr fxn;
+	void *stack;
+	size_t stackSize;
+	Int priority;
+	UArg arg0;
+	UArg arg1;
+	//Host side, see shim_runTasks
+	Int state;
+	Semaphore_Handle hWait;			//Pended on
+	uint32_t wakeTick;				//Sleep or pend timeout
+	Bool timed;
+	Bool pendResult;
+	void *hostStack;
+	ucontext_t context;
+} Task_Struct, *Task_Handle;
+
+typedef struct {
+	Int priority;
+	void *stack;
+	size_t stackSize;
+	size_t used;
+	Int mode;
+} Task_Stat;
+
+typedef struct Queue_Elem {
+	struct Queue_Elem *next;
+	struct Queue_Elem *prev;
+} Queue_Elem;
+
+typedef struct {
+	Queue_Elem elem;
+} Queue_Struct, *Queue_Handle;
+
+typedef struct {
+	size_t hwiStackPeak;
+	size_t hwiStackSize;
+	void *hwiStackBase;
+} Hwi_StackInfo;
+
+extern uint32_t Clock_tickPeriod;
+
+extern void Clock_Params_init(Clock_Params *pParams);
+extern void Clock_construct(Clock_Struct *pClock, Clock_FuncPtr fxn, uint32_t timeout,
+							const Clock_Params *pParams);
+extern Clock_Handle Clock_handle(Clock_Struct *pClock);
+extern void Clock_start(Clock_Handle hClock);
+extern void Clock_stop(Clock_Handle hClock);
+extern void Clock_setPeriod(Clock_Handle hClock, uint32_t period);
+extern void Clock_setTimeout(Clock_Handle hClock, uint32_t timeout);
+extern uint32_t Clock_getTimeout(Clock_Handle hClock);
+extern Bool Clock_isActive(Clock_Handle hClock);
+extern uint32_t Clock_getTicks(void);
+
+extern void Swi_Params_init(Swi_Params *pParams);
+extern void Swi_construct(Swi_Struct *pSwi, Swi_FuncPtr fxn, const Swi_Params *pParams,
+						  void *pEb);
+extern Swi_Handle Swi_handle(Swi_Struct *pSwi);
+extern void Swi_post(Swi_Handle hSwi);
+extern void Swi_or(Swi_Handle hSwi, UInt mask);
+extern UInt Swi_getTrigger(void);
+extern UInt Swi_disable(void);
+extern void Swi_restore(UInt key);
+
+extern void Semaphore_Params_init(Semaphore_Params *pParams);
+extern void Semaphore_construct(Semaphore_Struct *pSem, Int count,
+								const Semaphore_Params *pParams);
+extern Semaphore_Handle Semaphore_handle(Semaphore_Struct *pSem);
+extern Bool Semaphore_pend(Semaphore_Handle hSem, uint32_t timeout);
+extern void Semaphore_post(Semaphore_Handle hSem);
+extern Int Semaphore_getCount(Semaphore_Handle hSem);
+
+extern void Task_Params_init(Task_Params *pParams);
+extern void Task_construct(Task_Struct *pTask, Task_FuncPtr fxn, const Task_Params *pParams,
+						   void *pEb);
+extern Task_Handle Task_handle(Task_Struct *pTask);
+extern void Task_stat(Task_Handle hTask, Task_Stat *pStat);
+extern void Task_sleep(uint32_t ticks);
+extern UInt Task_disable(void);
+extern void Task_restore(UInt key);
+
+extern void Queue_construct(Queue_Struct *pQueue, void *pParams);
+extern Queue_Handle Queue_handle(Queue_Struct *pQueue);
+extern Bool Queue_empty(Queue_Handle hQueue);
+extern void Queue_enqueue(Queue_Handle hQueue, Queue_Elem *pElem);
+extern void *Queue_dequeue(Queue_Handle hQueue);
+extern void *Queue_head(Queue_Handle hQueue);
+extern void Queue_put(Queue_Handle hQueue, Queue_Elem *pElem);
+extern void *Queue_get(Queue_Handle hQueue);
+extern void Queue_remove(Queue_Elem *pElem);
+
+extern UInt Hwi_disable(void);
+extern void Hwi_restore(UInt key);
+extern Bool Hwi_getStackInfo(Hwi_StackInfo *pInfo, Bool computeStackDepth);
+
+//TI compiler intrinsics of the Cortex-M3 exclusive load/store, for the modules built
+//with their __TI_COMPILER_VERSION__ path. A store fails if the word changed since the
+//same thread's load, which is compare-and-swap across host threads. With
+//shim_exclusiveYield set, every so many loads and successful stores give up the CPU
+//right after, where an interrupt can come in on the device
+extern uint32_t shim_exclusiveYield;
+extern uint32_t __ldrex(void *pAddr);
+extern uint32_t __strex(uint32_t value, void *pAddr);
+
+//Task_construct fills a task's stack with SHIM_STACK_FILL and Task_stat counts as used
+//everything above the last fill byte from the bottom, as SYS/BIOS does. Host tasks run
+//on their own stacks, so only a check that writes into the stack moves the mark. The
+//system stack is whatever the check sets here, none unless it does; it is scanned the
+//same way
+#define SHIM_STACK_FILL						0xBE
+
+extern void *shim_hwiStack;
+extern size_t shim_hwiStackSize;
+
+extern void Seconds_set(uint32_t seconds);
+extern uint32_t Seconds_get(void);
+
+extern void BIOS_start(void);
+
+//BIOS_getThreadType reports a Swi while one runs, a task while one runs, and otherwise
+//shim_threadType of the calling host thread: Main unless the check runs that thread in
+//place of a Hwi, Swi or task
+typedef enum {
+	BIOS_ThreadType_Hwi = 0,
+	BIOS_ThreadType_Swi,
+	BIOS_ThreadType_Task,
+	BIOS_ThreadType_Main
+} BIOS_ThreadType;
+
+extern __thread BIOS_ThreadType shim_threadType;
+extern BIOS_ThreadType BIOS_getThreadType(void);
+
+//Constraints and dependencies set and not yet released, by id
+#define Power_SB_DISALLOW					1
+#define Power_IDLE_PD_DISALLOW				2
+#define PERIPH_GPT0							3
+#define SHIM_POWER_IDS						4
+extern int32_t shim_powerCount[SHIM_POWER_IDS];
+
+extern void Power_setConstraint(UInt constraint);
+extern void Power_releaseConstraint(UInt constraint);
+extern void Power_setDependency(UInt resource);
+extern void Power_releaseDependency(UInt resource);
+
+//**********************************************************************************
+// BLE stack: bcomdef.h status codes and hal_defs.h byte macros
+//**********************************************************************************
+typedef uint8_t bStatus_t;
+
+#define SUCCESS								0x00
+#define FAILURE								0x01
+#define INVALIDPARAMETER					0x02
+
+#define BREAK_UINT32(var, ByteNum)			(uint8_t)((uint32_t)(((var) >> ((ByteNum) * 8)) & 0x00FF))
+#define BUILD_UINT32(Byte0, Byte1, Byte2, Byte3) \
+	((uint32_t)((uint32_t)((Byte0) & 0x00FF) + ((uint32_t)((Byte1) & 0x00FF) << 8) \
+	+ ((uint32_t)((Byte2) & 0x00FF) << 16) + ((uint32_t)((Byte3) & 0x00FF) << 24)))
+#define BUILD_UINT16(loByte, hiByte)		((uint16_t)(((loByte) & 0x00FF) + (((hiByte) & 0x00FF) << 8)))
+#define HI_UINT16(a)						(((a) >> 8) & 0xFF)
+#define LO_UINT16(a)						((a) & 0xFF)
+
+#ifndef MIN
+#define MIN(n, m)							(((n) < (m)) ? (n) : (m))
+#endif
+#ifndef MAX
+#define MAX(n, m)							(((n) < (m)) ? (m) : (n))
+#endif
+
+//**********************************************************************************
+// OSAL SNV (osal_snv.h), provided by the check that needs it
+//**********************************************************************************
+#define BLE_NVID_CUST_START					0x80
+#define BLE_NVID_CUST_END					0x8F
+#define NV_OPER_FAILED						0x0A
+
+typedef uint8_t osalSnvId_t;
+typedef uint8_t osalSnvLen_t;
+
+extern uint8_t osal_snv_read(osalSnvId_t id, osalSnvLen_t len, void *pBuf);
+extern uint8_t osal_snv_write(osalSnvId_t id, osalSnvLen_t len, void *pBuf);
+
+//**********************************************************************************
+// ATT (att.h)
+//**********************************************************************************
+typedef struct {
+	uint16_t handle;
+	uint16_t len;
+	uint8_t *pValue;
+} attHandleValueNoti_t;
+
+//**********************************************************************************
+// GAP (gap.h), provided by the check that needs it
+//**********************************************************************************
+#define B_ADDR_LEN							6
+#define ADDRTYPE_PUBLIC						0x00
+
+#define GAP_ADTYPE_ADV_IND					0x00
+#define GAP_ADTYPE_ADV_HDC_DIRECT_IND		0x01
+
+#define TGAP_GEN_DISC_ADV_INT_MIN			8
+#define TGAP_GEN_DISC_ADV_INT_MAX			9
+
+extern bStatus_t GAP_SetParamValue(uint16_t paramID, uint16_t paramValue);
+
+//**********************************************************************************
+// GAP peripheral role (peripheral.h), provided by the check that needs it
+//**********************************************************************************
+#define GAPROLE_ADVERT_ENABLED				0x305
+#define GAPROLE_ADV_EVENT_TYPE				0x309
+#define GAPROLE_ADV_DIRECT_TYPE				0x30A
+#define GAPROLE_ADV_DIRECT_ADDR				0x30B
+#define GAPROLE_MIN_CONN_INTERVAL			0x311
+#define GAPROLE_MAX_CONN_INTERVAL			0x312
+#define GAPROLE_SLAVE_LATENCY				0x313
+#define GAPROLE_TIMEOUT_MULTIPLIER			0x314
+#define GAPROLE_PARAM_UPDATE_REQ			0x319
+#define GAPROLE_STATE						0x31A
+#define GAPROLE_ADV_NONCONN_ENABLED			0x31B
+
+typedef enum {
+	GAPROLE_INIT = 0,
+	GAPROLE_STARTED,
+	GAPROLE_ADVERTISING,
+	GAPROLE_ADVERTISING_NONCONN,
+	GAPROLE_WAITING,
+	GAPROLE_WAITING_AFTER_TIMEOUT,
+	GAPROLE_CONNECTED,
+	GAPROLE_CONNECTED_ADV,
+	GAPROLE_ERROR
+} gaprole_States_t;
+
+extern bStatus_t GAPRole_SetParameter(uint16_t param, uint8_t len, void *pValue);
+extern bStatus_t GAPRole_GetParameter(uint16_t param, void *pValue);
+
+//**********************************************************************************
+// ICall, malloc/free unless a check provides its own heap
+//**********************************************************************************
+extern void *ICall_malloc(uint16_t size);
+extern void ICall_free(void *pMsg);
+//All 0 unless a check provides its own heap
+extern void ICall_getHeapMgrGetMetrics(uint32_t *pBlkMax, uint32_t *pBlkCnt, uint32_t *pBlkFree,
+									   uint32_t *pMemAlo, uint32_t *pMemMax, uint32_t *pMemUB);
+
+//**********************************************************************************
+// TI-RTOS drivers: PIN keeps the output levels and which pins are muxed to a
+// peripheral, UART writes go to shim_uartWriteFxn
+//**********************************************************************************
+typedef uint32_t PIN_Config;
+typedef uint8_t PIN_Id;
+
+typedef struct {
+	const PIN_Config *pTable;
+	uint32_t outputs;				//Bit per IOID
+	uint32_t muxed;					//Bit per IOID not on GPIO
+} PIN_State, *PIN_Handle;
+
+#define IOID_1								1
+#define IOID_3								3
+#define IOID_7								7
+#define IOID_13								13
+#define IOID_23								23
+#define IOID_29								29
+#define PIN_TERMINATE						0xFE
+#define PIN_INPUT_DIS						(1u << 8)
+#define PIN_GPIO_OUTPUT_DIS					(1u << 9)
+#define PIN_GPIO_OUTPUT_EN					(1u << 10)
+#define PIN_GPIO_LOW						(1u << 11)
+#define PIN_GPIO_HIGH						(1u << 12)
+#define PIN_PUSHPULL						(1u << 13)
+#define PIN_DRVSTR_MAX						(1u << 14)
+
+extern PIN_Handle PIN_open(PIN_State *pState, const PIN_Config *pTable);
+extern void PIN_close(PIN_Handle hPin);
+extern bStatus_t PIN_setOutputValue(PIN_Handle hPin, PIN_Id pinId, uint32_t val);
+
+#define PINCC26XX_MUX_GPIO					(-1)
+#define IOC_PORT_MCU_PORT_EVENT0			0x17
+
+extern bStatus_t PINCC26XX_setMux(PIN_Handle hPin, PIN_Id pinId, int32_t mux);
+
+typedef struct UART_Config *UART_Handle;
+
+#define UART_ERROR							(-1)
+
+extern int UART_write(UART_Handle hUart, const void *pBuf, size_t size);
+
+//**********************************************************************************
+// Board (Startup/CC2640.h), the EMG and analog front end pins
+//**********************************************************************************
+#define Board_ANALOG_EN						IOID_1
+#define Board_VIBE_MOTOR					IOID_3
+#define Board_CH1_IN						IOID_29
+#define Board_CH0_IN						IOID_23
+#define BOARD_CH1_AUX						ADC_COMPB_IN_AUXIO1
+#define BOARD_CH0_AUX						ADC_COMPB_IN_AUXIO7
+
+//**********************************************************************************
+// driverlib
+//**********************************************************************************
+//The RTC fraction counts in 1/shim_rtcHz s steps, like the 32 kHz clock of the device,
+//or exactly in us when 0, which it is unless a check sets it
+extern uint32_t shim_rtcHz;
+extern uint32_t AONRTCSecGet(void);
+extern uint32_t AONRTCFractionGet(void);
+extern uint32_t AONRTCCurrentCompareValueGet(void);
+extern uint64_t AONRTCCurrent64BitValueGet(void);
+
+//The ADC reads whatever the check's source returns for the selected input, 0 without one.
+//Conversions triggered so far are counted
+#define ADC_COMPB_IN_AUXIO1					1
+#define ADC_COMPB_IN_AUXIO7					7
+#define AUXADC_REF_FIXED					0
+#define AUXADC_SAMPLE_TIME_10P6_US			3
+#define AUXADC_TRIGGER_MANUAL				0
+
+extern void AUXADCSelectInput(uint32_t input);
+extern void AUXADCEnableSync(uint32_t refSource, uint32_t sampleTime, uint32_t trigger);
+extern void AUXADCDisable(void);
+extern void AUXADCGenManualTrigger(void);
+extern uint32_t AUXADCReadFifo(void);
+extern uint32_t shim_adcConversions;
+
+#define AUX_WUC_MODCLKEN0_ANAIF_M			0x40
+#define AUX_WUC_MODCLKEN0_AUX_ADI4_M		0x80
+
+//AUX module clocks enabled, AUX_WUC_MODCLKEN0_* bits
+extern uint32_t shim_auxClocks;
+extern void AUXWUCClockEnable(uint32_t clocks);
+extern void AUXWUCClockDisable(uint32_t clocks);
+
+//GPT0 timer A keeps what was written to it, for the vibe motor's PWM
+#define GPT0_BASE							0x40010000
+#define TIMER_A								0x000000FF
+#define TIMER_CFG_SPLIT_PAIR				0x04000000
+#define TIMER_CFG_A_PWM						0x0000000A
+
+typedef struct {
+	uint32_t config;
+	uint32_t load;
+	uint32_t match;
+	Bool enabled;
+} Shim_gpt;
+
+extern Shim_gpt shim_gpt0;
+extern void TimerConfigure(uint32_t base, uint32_t config);
+extern void TimerLoadSet(uint32_t base, uint32_t timer, uint32_t value);
+extern void TimerMatchSet(uint32_t base, uint32_t timer, uint32_t value);
+extern void TimerEnable(uint32_t base, uint32_t timer);
+extern void TimerDisable(uint32_t base, uint32_t timer);
+
+//**********************************************************************************
+// Simulation control, used by the checks
+//**********************************************************************************
+/**
+ * Moves simulated time on, running the Clock callbacks that come due and the Swis
+ * they post.
+ *
+ * @param 	us			Time to advance
+ * @return 	none
+ */
+extern void shim_advanceUs(uint64_t us);
+
+/**
+ * Simulated time since start.
+ *
+ * @param 	none
+ * @return 	us
+ */
+extern uint64_t shim_nowUs(void);
+
+/**
+ * How long the Swis a Clock callback posts are held off, as by a higher priority
+ * interrupt, or NULL for not at all. Asked once per callback; the wait must end
+ * before the next Clock is due and before shim_advanceUs is to return.
+ *
+ * @param 	none
+ * @return 	us
+ */
+extern uint64_t (*shim_swiLatencyFxn)(void);
+
+/**
+ * Runs posted Swis, highest priority first. Called by shim_advanceUs and by checks
+ * that post from "task" context.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void shim_runSwis(void);
+
+/**
+ * Runs the constructed tasks that are ready, highest priority first, until all of them
+ * pend or sleep. Posted Swis run before a task is resumed. Called by shim_advanceUs
+ * after each Clock tick that comes due, so a check that called it once keeps its tasks
+ * running as time moves on. Does nothing from inside a task.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void shim_runTasks(void);
+
+//Kernel objects constructed so far, and task switches: a task starting to run after
+//another task or after the CPU went idle
+typedef struct {
+	uint32_t tasks;
+	uint32_t semaphores;
+	uint32_t clocks;
+	uint32_t swis;
+	uint32_t switches;
+} Shim_kernelStats;
+
+extern Shim_kernelStats shim_kernelStats;
+
+/**
+ * Source of AUXADCReadFifo, or NULL for 0.
+ *
+ * @param 	input		Selected ADC_COMPB_IN_*
+ * @return 	12 bit sample
+ */
+extern uint32_t (*shim_adcSource)(uint32_t input);
+
+/**
+ * Called after every pin output, pin mux and GPT0 change, or NULL. A driver that
+ * changes several in a row calls it for each.
+ *
+ * @param 	none
+ * @return 	none
+ */
+extern void (*shim_ioFxn)(void);
+
+/**
+ * Takes UART_write, or NULL for every write to fail.
+ *
+ * @param 	pBuf		Bytes to write
+ * @param	size		Length of pBuf
+ * @return 	size, or UART_ERROR
+ */
+extern int (*shim_uartWriteFxn)(const void *pBuf, size_t size);
+
+#endif /* FZ_SHIM_H */
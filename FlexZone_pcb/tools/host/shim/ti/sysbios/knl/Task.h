@@ -0,0 +1 @@
+#include "fz_shim.h"
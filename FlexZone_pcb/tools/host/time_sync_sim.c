@@ -0,0 +1,408 @@
+/*
+ * Several devices on the shared timebase of one central, each running the firmware's
+ * time_sync.c on the host shim in a process of its own.
+ *
+ * Every device has its own crystal: a fixed error of up to +-40 ppm, a slow wander of
+ * a few ppm on top of it, like a temperature change, and a boot time of its own. The
+ * shim clock is the device clock, with the 32 kHz RTC ticks of the device; the
+ * central clock is the reference and, part way through, is set forward like a phone
+ * taking the network time.
+ *
+ * The central starts a burst on every device once a minute. Connection events come
+ * at the interval of the device on the central clock; the notice of the event end
+ * comes late by the event length and, now and then, a busy CPU. A ping goes out at
+ * the first anchor after the notice. The central reads its clock a little after the
+ * ping arrives, sometimes a lot later when its scheduler gets in the way, and its
+ * pong leaves at the first anchor after that. The BLE stack task stamps the pong a
+ * little after its anchor and the application handles it later still. Pings and
+ * pongs are lost now and then.
+ *
+ * Twice a second, on the central clock, each device turns its clock into shared time
+ * and the error against the central clock is taken. Once every device has its drift
+ * from two bursts, and outside the minute after the central clock was set, no two
+ * devices may be more than ALIGN_MAX_US apart at p99, nor any device more than
+ * OFFSET_MAX_US off the central clock at p99, the bounds time_sync.h states. Once its
+ * fit holds all TIME_SYNC_POINTS bursts, the drift of every device must be within
+ * DRIFT_TOL_PPB of its crystal's at p99.
+ *
+ *     time_sync_sim [seed] [devices] [minutes]
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "time_sync.h"
+
+#define MAX_DEVICES							8
+#define GRID_US								500000.0
+#define BURST_US							60000000.0
+#define RTC_HZ								32768
+
+#define CRYSTAL_PPM							40
+#define WANDER_PPM							3
+#define WANDER_PERIOD_US					(20 * 60 * 1e6)
+
+#define STEP_AT_US							(13.5 * 60 * 1e6)	//The central clock is set
+#define STEP_US								1234567.0
+
+#define ALIGN_MAX_US						1000
+#define OFFSET_MAX_US						1500
+#define DRIFT_TOL_PPB						6000		//The wander moves on over the fit
+
+typedef struct {
+	double ppm;						//Crystal error
+	double wanderPpm;
+	double wanderPhase;
+	double bootUs;					//Device uptime when the central clock reads 0
+	double intervalUs;
+	double anchor0Us;				//First connection event, central clock
+	double burstPhaseUs;			//Of the central's bursts on this device
+} Device;
+
+typedef struct {
+	int32_t err;					//Shared - central time, us
+	int32_t driftErrPpb;			//Reported - actual drift against the central
+	uint8_t points;
+} Sample;
+
+static uint32_t rngState;
+static const Device *dev;
+static Sample *samples;
+static uint32_t numSamples, nextSample;
+
+static uint32_t exchanges, lost, lateNotices;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static double uniform(double lo, double hi)
+{
+	return lo + (hi - lo) * rnd(1000000) / 1e6;
+}
+
+static double expo(double mean)
+{
+	return -mean * log(1.0 - rnd(1000000) / 1e6);
+}
+
+/**
+ * Device clock at a time of the central's crystal, t us after the simulation start.
+ */
+static double localAt(double t)
+{
+	double w = 2 * M_PI / WANDER_PERIOD_US;
+
+	return dev->bootUs + t + dev->ppm * 1e-6 * t +
+			dev->wanderPpm * 1e-6 * (sin(w * t + dev->wanderPhase) - sin(dev->wanderPhase)) / w;
+}
+
+/**
+ * Drift of the device against the central at t, ppb.
+ */
+static double driftAt(double t)
+{
+	double w = 2 * M_PI / WANDER_PERIOD_US;
+	double rate = 1 + (dev->ppm + dev->wanderPpm * cos(w * t + dev->wanderPhase)) * 1e-6;
+
+	//The shared time runs at the central's rate: shared - local changes by 1/rate - 1
+	return (1 / rate - 1) * 1e9;
+}
+
+static uint64_t centralAt(double t)
+{
+	return (uint64_t)(t + (t >= STEP_AT_US ? STEP_US : 0));
+}
+
+static void goLocal(double t)
+{
+	uint64_t l = (uint64_t)localAt(t);
+
+	if (l > shim_nowUs())
+		shim_advanceUs(l - shim_nowUs());
+}
+
+/**
+ * Moves the device clock on to central time t, taking the samples due before it.
+ */
+static void at(double t)
+{
+	uint8_t status[TIME_SYNC_STATUS_LEN];
+	int32_t drift;
+	double tg;
+
+	while (nextSample < numSamples && (tg = (nextSample + 1) * GRID_US) <= t) {
+		goLocal(tg);
+		timeSync_read(0, status, sizeof(status));
+		drift = (int32_t)BUILD_UINT32(status[10], status[11], status[12], status[13]);
+		samples[nextSample].err = (int32_t)((int64_t)timeSync_toShared(timeSync_localUs()) -
+											(int64_t)centralAt(tg));
+		samples[nextSample].driftErrPpb = drift - (int32_t)driftAt(tg);
+		samples[nextSample].points = status[1];
+		nextSample++;
+	}
+	goLocal(t);
+}
+
+static double anchorAfter(double t)
+{
+	double k = ceil((t - dev->anchor0Us) / dev->intervalUs);
+
+	return dev->anchor0Us + k * dev->intervalUs;
+}
+
+/**
+ * Lateness of a connection event end notice after the anchor.
+ */
+static double noticeDelay(void)
+{
+	double us = uniform(700, 2500);		//Event length
+
+	if (rnd(20) == 0)
+		us += uniform(0, 5000);		//Busy CPU
+	return us;
+}
+
+/**
+ * How long after the ping arrives the central reads its clock.
+ */
+static double centralDelay(void)
+{
+	double us = 150 + expo(150);
+
+	if (rnd(5) == 0)
+		us += uniform(1000, 20000);		//Scheduler
+	return us;
+}
+
+/**
+ * One burst, from the central's start write until the device is done.
+ */
+static void burst(double t0)
+{
+	const uint8_t start[TIME_SYNC_START_LEN] = { TIME_SYNC_OP_START, 0 };
+	uint8_t pong[TIME_SYNC_PONG_LEN];
+	uint8_t ping[TIME_SYNC_PING_LEN];
+	double anchor, notice, tx, read, rx = 0, handled = 0;
+	uint8_t pongState = 0;				//1 - on its way, 2 - stamped by the stack task
+	uint64_t c;
+	uint8_t i;
+
+	at(t0);
+	timeSync_control(start, sizeof(start));
+
+	for (anchor = anchorAfter(t0); timeSync_isActive(); anchor += dev->intervalUs) {
+		notice = anchor + noticeDelay();
+
+		//A pong is stamped by the stack task and handled by the application, either
+		//of them may come after the notice
+		if (1 == pongState && rx < notice) {
+			at(rx);
+			timeSync_markRx(pong, sizeof(pong));
+			pongState = 2;
+		}
+		if (2 == pongState && handled < notice) {
+			at(handled);
+			timeSync_control(pong, sizeof(pong));
+			pongState = 0;
+		}
+
+		at(notice);
+		if (timeSync_connEvent((uint32_t)dev->intervalUs, ping) == 0)
+			continue;
+		timeSync_pingSent();
+		exchanges++;
+		if (notice > anchor + dev->intervalUs)
+			lateNotices++;
+
+		//The central gets the ping at the first anchor after the notice and reads its
+		//clock; its pong leaves at the first anchor after that
+		tx = anchorAfter(notice);
+		read = tx + 200 + centralDelay();
+		c = centralAt(read);
+		pong[0] = TIME_SYNC_OP_PONG;
+		pong[1] = ping[1];
+		for (i = 0; i < 8; i++)
+			pong[2 + i] = (uint8_t)(c >> (8 * i));
+		pongState = 0;
+		if (rnd(25) == 0) {
+			lost++;
+			continue;
+		}
+		rx = anchorAfter(read + uniform(300, 2000)) + uniform(200, 600);
+		handled = rx + uniform(100, 3000);
+		pongState = 1;
+	}
+}
+
+/**
+ * One device over the whole run; writes its samples to fd.
+ */
+static int runDevice(const Device *d, double minutes, int fd)
+{
+	double t;
+	uint32_t n;
+
+	dev = d;
+	numSamples = (uint32_t)(minutes * 60e6 / GRID_US);
+	samples = calloc(numSamples, sizeof(Sample));
+	if (samples == NULL)
+		return 2;
+	shim_rtcHz = RTC_HZ;
+	goLocal(0);
+	timeSync_init();
+
+	for (n = 0; (t = d->burstPhaseUs + n * BURST_US) < minutes * 60e6; n++)
+		burst(t);
+	at(minutes * 60e6);
+
+	printf("  %+5.1f ppm %4.1f ms: %u exchanges, %u lost, %u notices over an interval late\n",
+			d->ppm, d->intervalUs / 1000, exchanges, lost, lateNotices);
+	return write(fd, samples, numSamples * sizeof(Sample)) == (ssize_t)(numSamples * sizeof(Sample)) ?
+			0 : 2;
+}
+
+static double settle;
+
+/**
+ * Whether sample n counts: after the settling and outside the minute after the
+ * central clock was set.
+ */
+static uint8_t evaluated(uint32_t n)
+{
+	double t = (n + 1) * GRID_US;
+
+	return t >= settle && !(t >= STEP_AT_US && t < STEP_AT_US + BURST_US);
+}
+
+static int cmpInt(const void *a, const void *b)
+{
+	return (*(const int32_t *)a > *(const int32_t *)b) - (*(const int32_t *)a < *(const int32_t *)b);
+}
+
+static int32_t pct(int32_t *v, uint32_t n, uint32_t p)
+{
+	return n ? v[MIN((uint64_t)n * p / 100, n - 1)] : 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const double intervals[] = { 7500, 15000, 30000, 50000 };
+	Device devices[MAX_DEVICES];
+	Sample *all[MAX_DEVICES];
+	uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+	uint32_t numDevices = argc > 2 ? strtoul(argv[2], NULL, 0) : 4;
+	double minutes = argc > 3 ? atof(argv[3]) : 30;
+	uint32_t n, i, counted = 0, failures = 0;
+	int32_t *align, *abserr, *drift;
+
+	if (numDevices < 2 || numDevices > MAX_DEVICES || minutes < 5) {
+		fprintf(stderr, "usage: time_sync_sim [seed] [2-%u devices] [minutes, 5 or more]\n",
+				MAX_DEVICES);
+		return 2;
+	}
+	rngState = seed | 1;
+	numSamples = (uint32_t)(minutes * 60e6 / GRID_US);
+
+	printf("%u devices, %.0f minutes, bursts every %.0f s, central clock set by %+.3f s at %.1f min\n",
+			numDevices, minutes, BURST_US / 1e6, STEP_US / 1e6, STEP_AT_US / 60e6);
+	fflush(stdout);
+	for (i = 0; i < numDevices; i++) {
+		int fds[2];
+		pid_t pid;
+		int status;
+		size_t got = 0;
+		ssize_t r;
+
+		devices[i].ppm = uniform(-CRYSTAL_PPM, CRYSTAL_PPM);
+		devices[i].wanderPpm = uniform(-WANDER_PPM, WANDER_PPM);
+		devices[i].wanderPhase = uniform(0, 2 * M_PI);
+		devices[i].bootUs = uniform(1e6, 3600e6);
+		devices[i].intervalUs = intervals[rnd(sizeof(intervals) / sizeof(intervals[0]))];
+		devices[i].anchor0Us = uniform(0, devices[i].intervalUs);
+		devices[i].burstPhaseUs = 2e6 + i * 3e6 + uniform(0, 1e6);
+
+		all[i] = malloc(numSamples * sizeof(Sample));
+		if (all[i] == NULL || pipe(fds))
+			return 2;
+		pid = fork();
+		if (pid == 0) {
+			close(fds[0]);
+			rngState = (seed * 7919 + i) | 1;
+			exit(runDevice(&devices[i], minutes, fds[1]));
+		}
+		close(fds[1]);
+		while (pid > 0 && got < numSamples * sizeof(Sample) &&
+				(r = read(fds[0], (uint8_t *)all[i] + got, numSamples * sizeof(Sample) - got)) > 0)
+			got += r;
+		close(fds[0]);
+		if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+				WEXITSTATUS(status) || got != numSamples * sizeof(Sample)) {
+			printf("device %u did not finish\n", i);
+			return 1;
+		}
+	}
+
+	//Drift needs two bursts on every device; once the central clock is set, each
+	//device is off by the step until its next burst
+	settle = devices[numDevices - 1].burstPhaseUs + BURST_US + 2e6;
+	align = malloc(numSamples * sizeof(int32_t));
+	abserr = malloc(numSamples * sizeof(int32_t));
+	drift = malloc(numSamples * sizeof(int32_t));
+	for (n = 0; n < numSamples; n++) {
+		int32_t lo = INT32_MAX, hi = INT32_MIN;
+
+		if (!evaluated(n))
+			continue;
+		for (i = 0; i < numDevices; i++) {
+			if (!all[i][n].points && failures++ < 10)
+				printf("  device %u not synced at %.1f s\n", i, (n + 1) * GRID_US / 1e6);
+			lo = MIN(lo, all[i][n].err);
+			hi = MAX(hi, all[i][n].err);
+		}
+		align[counted++] = hi - lo;
+	}
+
+	qsort(align, counted, sizeof(int32_t), cmpInt);
+	printf("after settling, %u samples: devices apart p50 %d us p99 %d us max %d us\n", counted,
+			pct(align, counted, 50), pct(align, counted, 99), pct(align, counted, 100));
+	if (pct(align, counted, 99) > ALIGN_MAX_US) {
+		failures++;
+		printf("  p99 over %u us\n", ALIGN_MAX_US);
+	}
+
+	//Drift once the fit holds all its bursts
+	for (i = 0; i < numDevices; i++) {
+		uint32_t ne = 0, nd = 0;
+
+		for (n = 0; n < numSamples; n++) {
+			if (!evaluated(n))
+				continue;
+			abserr[ne++] = abs(all[i][n].err);
+			if (TIME_SYNC_POINTS == all[i][n].points)
+				drift[nd++] = abs(all[i][n].driftErrPpb);
+		}
+		qsort(abserr, ne, sizeof(int32_t), cmpInt);
+		qsort(drift, nd, sizeof(int32_t), cmpInt);
+		printf("  device %u %+5.1f ppm %4.1f ms: off the central p50 %d us p99 %d us, "
+				"drift off p99 %d ppb\n", i, devices[i].ppm, devices[i].intervalUs / 1000,
+				pct(abserr, ne, 50), pct(abserr, ne, 99), pct(drift, nd, 99));
+		if (pct(abserr, ne, 99) > OFFSET_MAX_US) {
+			failures++;
+			printf("  off the central over %u us\n", OFFSET_MAX_US);
+		}
+		if (!nd || pct(drift, nd, 99) > DRIFT_TOL_PPB) {
+			failures++;
+			printf("  drift over %u ppb off\n", DRIFT_TOL_PPB);
+		}
+	}
+
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,372 @@
+/*
+ * Concurrency check of the trace ring (trace.c), with the capture it writes decoded by
+ * trace_decode.py. Built twice: trace_test with the device path, words reserved with
+ * __ldrex/__strex, which the shim runs as compare-and-swap, and trace_test_hwi with
+ * the Hwi_disable fallback of other compilers.
+ *
+ * Host threads in place of Swis and Hwis write records of 0 to 5 arguments into the
+ * 128-word ring, which wraps every few records. Every round they each write a burst,
+ * then the firmware's trace task drains the ring to the UART on simulated time; every
+ * fourth round it drains while the bursts are still being written. The bursts overrun
+ * the ring now and then. The threads give up the CPU every few exclusive loads and
+ * stores, so writers preempt each other inside the reservation and between it and
+ * the header. Now and then the UART refuses a frame, as when the Log output holds
+ * it, and Log text goes out between frames.
+ *
+ * Each writer numbers its records and derives the message, level and arguments from
+ * the number. Every record must come out whole, once, in the order its writer wrote
+ * it; every record that did not must be counted in a TRACE_DROPPED record. The
+ * capture goes to a file, and the text trace_decode.py must print for it to another.
+ *
+ * Benchmark: a trace call on this host against formatting the same message with
+ * snprintf, as the Log and System_printf calls it replaced did on the device.
+ *
+ *     trace_test <seed> <rounds> <capture.bin> <expected.txt>
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "diag.h"
+#include "trace.h"
+
+#define WRITERS								4
+#define MAX_BURST							12
+#define CONCURRENT_ONE_IN					4
+#define REFUSE_ONE_IN						10
+#define TEXT_ONE_IN							25
+#define DRAIN_US							100000		//TRACE_DRAIN_MS
+#define TICK_US								10.0
+#define BENCH_CALLS							16			//Fit the ring, 4 words each
+#define BENCH_ROUNDS						2000
+
+//Messages 2 and on. Writer w tags its records without arguments with message 2 + w,
+//the numbered ones use the messages after those
+#define FIRST_TAG_MSG						2
+#define FIRST_NUMBERED_MSG					(FIRST_TAG_MSG + WRITERS)
+#define BENCH_HDR							TRACE_HDR(TRACE_SVC_WRITE, TRACE_LEVEL_DEBUG, 2)
+#define BENCH_SVC							0xFFF0
+
+#define TRACE_MSG(id, fmt)					fmt,
+static const char *const formats[] = { TRACE_MSGS };
+#undef TRACE_MSG
+
+typedef struct {
+	pthread_t thread;
+	uint32_t rngState;
+	uint32_t written;				//Records, numbered or not
+	uint32_t numbered;
+	uint32_t nextSeq;				//Of the capture
+	uint32_t received;
+} Writer;
+
+static Writer writers[WRITERS + 1];	//The last one is the benchmark
+static volatile uint32_t roundNow = 0;
+static volatile uint32_t burstsDone = 0;
+static volatile Bool stop = FALSE;
+
+static uint32_t rngState;
+static FILE *capture, *expect;
+static Bool refuse = TRUE;
+static uint32_t frames, refused, reportedDrops, dropRecords, boots, failures;
+
+static uint32_t rnd(uint32_t *pState, uint32_t n)
+{
+	*pState ^= *pState << 13;
+	*pState ^= *pState >> 17;
+	*pState ^= *pState << 5;
+	return *pState % n;
+}
+
+static void fail(const char *what, uint32_t a, uint32_t b)
+{
+	if (failures++ < 10)
+		printf("%s (%u, %u)\n", what, a, b);
+}
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Word i of the record seq of writer w; 0 is the tag, 1 - 5 the other arguments, the
+ * rest pick the message, level and number of arguments.
+ */
+static uint32_t mix(uint32_t w, uint32_t seq, uint32_t i)
+{
+	uint32_t x = (w << 24 | seq) * 0x9E3779B1u ^ i * 0x85EBCA77u;
+
+	if (0 == i)
+		return w << 24 | seq;
+	x ^= x >> 15;
+	x *= 0x2C1B3C6Du;
+	x ^= x >> 12;
+	return x;
+}
+
+static uint32_t numberedHdr(uint32_t w, uint32_t seq)
+{
+	if (WRITERS == w)
+		return BENCH_HDR;
+	return TRACE_HDR(FIRST_NUMBERED_MSG + mix(w, seq, 6) % (TRACE_NUM_MSGS - FIRST_NUMBERED_MSG),
+					 TRACE_LEVEL_ERROR + mix(w, seq, 7) % 4, 1 + mix(w, seq, 8) % TRACE_MAX_ARGS);
+}
+
+static uint32_t numberedArg(uint32_t w, uint32_t seq, uint32_t i)
+{
+	if (WRITERS == w && i)
+		return 1 == i ? BENCH_SVC : 0;
+	return mix(w, seq, i);
+}
+
+static void writeNumbered(uint32_t w, uint32_t seq)
+{
+	trace_write(numberedHdr(w, seq), mix(w, seq, 0), mix(w, seq, 1), mix(w, seq, 2),
+				mix(w, seq, 3), mix(w, seq, 4));
+}
+
+//**********************************************************************************
+// What trace.c runs with
+//**********************************************************************************
+void diag_addTask(Diag_task task, Task_Handle hTask)
+{
+}
+
+//**********************************************************************************
+// Capture
+//**********************************************************************************
+/**
+ * Checks one record and writes the line trace_decode.py prints for it.
+ */
+static void record(const uint8_t *p, uint8_t numArgs)
+{
+	uint16_t id = BUILD_UINT16(p[0], p[1]);
+	uint8_t level = p[2] >> 4;
+	uint32_t ticks = BUILD_UINT32(p[3], p[4], p[5], p[6]);
+	uint32_t args[TRACE_MAX_ARGS] = { 0 };
+	char text[160];
+	uint32_t w, seq, hdr;
+	uint8_t i;
+
+	for (i = 0; i < numArgs; i++)
+		args[i] = BUILD_UINT32(p[7 + 4 * i], p[8 + 4 * i], p[9 + 4 * i], p[10 + 4 * i]);
+
+	if (TRACE_BOOT == id) {
+		boots++;
+		if (numArgs != 1 || args[0] != TRACE_NUM_MSGS)
+			fail("boot record", numArgs, args[0]);
+	} else if (TRACE_DROPPED == id) {
+		dropRecords++;
+		reportedDrops += args[0];
+		if (numArgs != 1 || level != TRACE_LEVEL_WARNING || 0 == args[0])
+			fail("dropped record", numArgs, args[0]);
+	} else if (id < FIRST_NUMBERED_MSG) {
+		w = id - FIRST_TAG_MSG;
+		if (numArgs || level != TRACE_LEVEL_DEBUG)
+			fail("tag record, writer", w, numArgs);
+		else
+			writers[w].received++;
+	} else {
+		w = args[0] >> 24;
+		seq = args[0] & 0xFFFFFF;
+		hdr = numberedHdr(w, seq);
+		if (w > WRITERS || 0 == numArgs) {
+			fail("record of no writer", w, seq);
+		} else {
+			if (seq < writers[w].nextSeq)
+				fail("record again or out of order, writer", w, seq);
+			writers[w].nextSeq = seq + 1;
+			writers[w].received++;
+			if (id != (hdr & 0xFFFF) || level != ((hdr >> 24) & 0x0F) || numArgs != hdr >> 28)
+				fail("message, level or arguments, writer", w, seq);
+			for (i = 1; i < numArgs; i++)
+				if (args[i] != numberedArg(w, seq, i))
+					fail("argument, writer", w, seq);
+		}
+	}
+
+	snprintf(text, sizeof(text), formats[id], args[0], args[1], args[2], args[3], args[4]);
+	fprintf(expect, "[%12.6f] %c %s\n", ticks * TICK_US / 1e6, level <= 4 ? "?EWID"[level] : '?',
+			text);
+}
+
+/**
+ * Takes the frames the trace task writes to the UART.
+ */
+static int uartWrite(const void *pBuf, size_t size)
+{
+	const uint8_t *p = pBuf;
+	uint8_t numArgs;
+	size_t pos;
+
+	if (refuse && rnd(&rngState, REFUSE_ONE_IN) == 0) {
+		refused++;
+		return UART_ERROR;
+	}
+	if (size < 2 || p[0] != 0x00 || p[1] != size - 2) {
+		fail("frame header", size, size ? p[0] : 0);
+		return (int)size;
+	}
+
+	for (pos = 2; pos < size; pos += 7 + 4 * numArgs) {
+		numArgs = p[pos + 2] & 0x0F;
+		if (pos + 7 + 4 * numArgs > size || numArgs > TRACE_MAX_ARGS ||
+				BUILD_UINT16(p[pos], p[pos + 1]) >= TRACE_NUM_MSGS) {
+			fail("record cut or unknown", pos, size);
+			break;
+		}
+		record(&p[pos], numArgs);
+	}
+	fwrite(p, 1, size, capture);
+	frames++;
+	return (int)size;
+}
+
+//**********************************************************************************
+// Writers
+//**********************************************************************************
+static void *writer(void *arg)
+{
+	uint32_t w = (uint32_t)(uintptr_t)arg;
+	Writer *pWriter = &writers[w];
+	uint32_t seen = 0, n;
+
+	while (!stop) {
+		if (roundNow == seen) {
+			sched_yield();
+			continue;
+		}
+		seen++;			//A burst for every round, even one that went by
+
+		for (n = rnd(&pWriter->rngState, MAX_BURST + 1); n > 0; n--) {
+			if (rnd(&pWriter->rngState, 10) == 0)
+				trace_write(TRACE_HDR(FIRST_TAG_MSG + w, TRACE_LEVEL_DEBUG, 0), 0, 0, 0, 0, 0);
+			else
+				writeNumbered(w, pWriter->numbered++);
+			pWriter->written++;
+		}
+		__atomic_add_fetch(&burstsDone, 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void text(const char *line)
+{
+	fputs(line, capture);
+	fputs(line, expect);
+}
+
+/**
+ * Host time of a trace call and of formatting the same message, ns each.
+ */
+static void bench(void)
+{
+	Writer *pWriter = &writers[WRITERS];
+	uint64_t traceNs = 0, printfNs = 0, t0;
+	uint32_t r, i, seq;
+	char buf[160];
+
+	refuse = FALSE;
+	for (r = 0; r < BENCH_ROUNDS; r++) {
+		seq = pWriter->numbered;
+		t0 = nowNs();
+		for (i = 0; i < BENCH_CALLS; i++)
+			trace_write(BENCH_HDR, WRITERS << 24 | (seq + i), BENCH_SVC, 0, 0, 0);
+		traceNs += nowNs() - t0;
+
+		t0 = nowNs();
+		for (i = 0; i < BENCH_CALLS; i++)
+			snprintf(buf, sizeof(buf), formats[TRACE_SVC_WRITE], BENCH_SVC, WRITERS << 24 | (seq + i));
+		printfNs += nowNs() - t0;
+
+		pWriter->numbered += BENCH_CALLS;
+		pWriter->written += BENCH_CALLS;
+		shim_advanceUs(DRAIN_US);
+	}
+
+	printf("host, per call: trace_write %.0f ns, snprintf of the same message %.0f ns\n",
+		   (double)traceNs / (BENCH_ROUNDS * BENCH_CALLS),
+		   (double)printfNs / (BENCH_ROUNDS * BENCH_CALLS));
+}
+
+int main(int argc, char **argv)
+{
+	static Char uart;
+	uint32_t rounds, r, written = 0, received = 0;
+	uint8_t i;
+
+	if (argc != 5) {
+		fprintf(stderr, "usage: trace_test <seed> <rounds> <capture.bin> <expected.txt>\n");
+		return 2;
+	}
+	rngState = strtoul(argv[1], NULL, 0) | 1;
+	rounds = strtoul(argv[2], NULL, 0);
+	capture = fopen(argv[3], "wb");
+	expect = fopen(argv[4], "w");
+	if (!capture || !expect) {
+		perror("trace_test");
+		return 2;
+	}
+
+	shim_uartWriteFxn = uartWrite;
+	trace_createTask((UART_Handle)&uart);
+	shim_runTasks();
+
+	shim_exclusiveYield = 3;
+	for (i = 0; i < WRITERS; i++) {
+		writers[i].rngState = (strtoul(argv[1], NULL, 0) * 7919 + i) << 1 | 1;
+		pthread_create(&writers[i].thread, NULL, writer, (void *)(uintptr_t)i);
+	}
+
+	for (r = 1; r <= rounds; r++) {
+		roundNow = r;
+		if (rnd(&rngState, CONCURRENT_ONE_IN) != 0) {
+			while (__atomic_load_n(&burstsDone, __ATOMIC_ACQUIRE) < r * WRITERS)
+				sched_yield();
+		}
+		if (rnd(&rngState, TEXT_ONE_IN) == 0)
+			text("Log text between frames\n");
+		shim_advanceUs(DRAIN_US);
+	}
+	while (__atomic_load_n(&burstsDone, __ATOMIC_ACQUIRE) < rounds * WRITERS)
+		sched_yield();
+	stop = TRUE;
+	for (i = 0; i < WRITERS; i++)
+		pthread_join(writers[i].thread, NULL);
+	shim_exclusiveYield = 0;
+
+	//What is left and the last drop count
+	refuse = FALSE;
+	shim_advanceUs(3 * DRAIN_US);
+	bench();
+
+	for (i = 0; i <= WRITERS; i++) {
+		written += writers[i].written;
+		received += writers[i].received;
+		if (writers[i].received > writers[i].written)
+			fail("more records than written, writer", i, writers[i].received);
+	}
+	if (writers[WRITERS].received != writers[WRITERS].written)
+		fail("benchmark records lost", writers[WRITERS].received, writers[WRITERS].written);
+	if (boots != 1)
+		fail("boot records", boots, 1);
+
+	if (reportedDrops != written - received)
+		fail("records lost, reported dropped", written - received, reportedDrops);
+	if (0 == dropRecords)
+		fail("the ring never filled up", 0, 0);
+
+	printf("%u rounds, %u writers: %u records written, %u received, %u reported dropped "
+		   "in %u records; %u frames, %u refused\n", rounds, WRITERS, written, received,
+		   reportedDrops, dropRecords, frames, refused);
+	fclose(capture);
+	fclose(expect);
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+}
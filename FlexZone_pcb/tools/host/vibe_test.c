@@ -0,0 +1,410 @@
+/*
+ * Checks the haptic sequencer (vibe.c) on simulated time. Cues of random patterns,
+ * priorities and repeat counts are requested at random moments, in bursts that fill
+ * the queue and with gaps that let it drain, and the motor drive is compared with a
+ * reference that lays every cue out as its list of phases.
+ *
+ *     vibe_test [seed] [minutes]
+ *
+ * The drive is read after every change of the motor pin, its mux and GPT0, and taken
+ * as it stands once a moment's changes are done: 0 or 100 % on GPIO, the duty of the
+ * match on the PWM. Every change must come at the microsecond the reference puts it
+ * at: the phases of a cue chained on 10 us ticks from its first, a cue that waited
+ * starting at the end of the one before, a cue that outranks the one playing starting
+ * at the request and the rest of the played one dropped. Now and then the sequencer
+ * Swi is held off for up to 2 ms after its clock, as interrupts would; that phase
+ * changes late, the ones after it must not. vibe_play must return what
+ * the reference queues or drops and trace what it drops. While the PWM runs, GPT0 is
+ * powered and standby held off, and neither once it stops.
+ *
+ * vibe_play only posts the sequencer Swi, so the checks run the Swi right after it as
+ * the return from an interrupt would. Neither moves simulated time on.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vibe.h"
+#include "diag.h"
+#include "trace.h"
+
+#define PWM_LOAD							(48000000 / 20000)
+#define MAX_PHASES							64
+#define MAX_EDGES							(1 << 20)
+#define MAX_LATENCIES						256
+#define DUTY_BAD							0xFF
+
+typedef struct {
+	uint64_t us;
+	uint8_t duty;
+} Edge;
+
+typedef struct {
+	Edge *pEdges;
+	uint32_t len;
+} Waveform;
+
+typedef struct {
+	uint8_t pattern;
+	uint8_t prio;
+	uint8_t times;
+} Cue;
+
+//The patterns as vibe.h describes them: {duty, on, off, repeats}
+static const Vibe_step refSteps[VIBE_NUM_PATTERNS][1] = {
+	{ {100, 40, 20, 1} },
+	{ {100, 3, 7, 1} },
+	{ {60, 15, 10, 2} },
+	{ {100, 4, 6, 3} },
+	{ {100, 20, 10, 3} }
+};
+
+static uint32_t rngState;
+static uint32_t failures = 0;
+static Waveform got, expected;
+
+//vibe.c as seen from the outside
+static PIN_Handle hPin;
+static uint8_t dropPending;
+static Cue dropped;
+static uint32_t hapticTimings, hapticLate;
+
+//Swi latencies handed to the shim, in the order the phases end
+static uint32_t latencies[MAX_LATENCIES];
+static uint32_t latencyIn, latencyOut;
+static uint64_t nextRequestUs;
+static uint32_t lateSwis;
+
+//Reference
+static Cue refQueue[VIBE_QUEUE_LEN];
+static uint8_t refQueueLen;
+static Bool refPlaying;
+static Cue refCue;						//Playing
+static uint8_t refDuty[MAX_PHASES];
+static uint32_t refEnd[MAX_PHASES];		//Clock ticks
+static uint8_t refPhases, refPhase;
+static uint32_t refStarted, refChained, refPreempted, refDropped, refRejected;
+
+extern PIN_Handle vibePinHandle;
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void fail(const char *what, uint64_t a, uint64_t b)
+{
+	if (++failures <= 10)
+		printf("%s %llu %llu\n", what, (unsigned long long)a, (unsigned long long)b);
+}
+
+/**
+ * Adds the drive at a moment, replacing what an earlier change of the same moment
+ * left and keeping only changes.
+ */
+static void record(Waveform *pWave, uint64_t us, uint8_t duty)
+{
+	if (pWave->len && pWave->pEdges[pWave->len - 1].us == us)
+		pWave->len--;
+	if (pWave->len ? pWave->pEdges[pWave->len - 1].duty == duty : duty == 0)
+		return;
+	if (pWave->len == MAX_EDGES) {
+		fail("too many edges at", us, duty);
+		return;
+	}
+	pWave->pEdges[pWave->len].us = us;
+	pWave->pEdges[pWave->len].duty = duty;
+	pWave->len++;
+}
+
+//**********************************************************************************
+// Shim and firmware stand-ins
+//**********************************************************************************
+/**
+ * Drive of the motor pin, DUTY_BAD if the pin, GPT0 and power state do not agree.
+ */
+static uint8_t motorDuty(void)
+{
+	uint32_t bit = 1u << Board_VIBE_MOTOR;
+	uint32_t high;
+
+	if (!(hPin->muxed & bit)) {
+		if (shim_gpt0.enabled || shim_powerCount[Power_SB_DISALLOW] || shim_powerCount[PERIPH_GPT0])
+			return DUTY_BAD;
+		return (hPin->outputs & bit) ? 100 : 0;
+	}
+
+	if (!shim_gpt0.enabled || shim_gpt0.config != (TIMER_CFG_SPLIT_PAIR | TIMER_CFG_A_PWM) ||
+		shim_gpt0.load != PWM_LOAD || shim_gpt0.match >= PWM_LOAD ||
+		shim_powerCount[Power_SB_DISALLOW] != 1 || shim_powerCount[PERIPH_GPT0] != 1)
+		return DUTY_BAD;
+	high = PWM_LOAD - shim_gpt0.match;
+	if ((high * 100) % PWM_LOAD || high == 0)
+		return DUTY_BAD;
+	return high * 100 / PWM_LOAD;
+}
+
+static void ioChanged(void)
+{
+	record(&got, shim_nowUs(), motorDuty());
+}
+
+void trace_write(uint32_t hdr, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4)
+{
+	if ((hdr & 0xFFFFFF) == TRACE_VIBE_DROPPED) {
+		dropPending++;
+		dropped.pattern = a0;
+		dropped.prio = a1;
+	}
+}
+
+uint16_t diag_timerUs(Diag_timer timer, uint32_t ticks)
+{
+	if (timer == DIAG_TIMER_HAPTIC) {
+		hapticTimings++;
+		if (ticks)
+			hapticLate++;
+	}
+	return (uint16_t)MIN(ticks, 0xFFFF);
+}
+
+/**
+ * A quarter of the phase ends are late, never up to the next request.
+ */
+static uint64_t swiLatency(void)
+{
+	uint32_t us = rnd(4) ? 0 : 1 + rnd(2000);
+
+	if (shim_nowUs() + us >= nextRequestUs)
+		us = 0;
+	lateSwis += us != 0;
+	latencies[latencyIn++ % MAX_LATENCIES] = us;
+	return us;
+}
+
+//**********************************************************************************
+// Reference
+//**********************************************************************************
+/**
+ * Starts a cue, its phases chained from a tick; the first edge is at startUs.
+ */
+static void refStart(const Cue *pCue, uint64_t startUs, uint32_t tick)
+{
+	const Vibe_step *pStep = refSteps[pCue->pattern];
+	uint8_t t, r;
+
+	refPhases = 0;
+	for (t = 0; t < pCue->times; t++)
+		for (r = 0; r < pStep->repeats; r++) {
+			tick += pStep->onTime * VIBE_TIME_UNIT_MS * 1000 / Clock_tickPeriod;
+			refDuty[refPhases] = pStep->duty;
+			refEnd[refPhases++] = tick;
+			if (pStep->offTime) {
+				tick += pStep->offTime * VIBE_TIME_UNIT_MS * 1000 / Clock_tickPeriod;
+				refDuty[refPhases] = 0;
+				refEnd[refPhases++] = tick;
+			}
+		}
+	refPhase = 0;
+	refPlaying = TRUE;
+	refStarted++;
+	record(&expected, startUs, refDuty[0]);
+}
+
+static Cue refPop(void)
+{
+	Cue cue = refQueue[0];
+
+	memmove(&refQueue[0], &refQueue[1], --refQueueLen * sizeof(Cue));
+	return cue;
+}
+
+/**
+ * Plays the phases that end before a moment, the queued cues following on.
+ */
+static void refAdvance(uint64_t us)
+{
+	while (refPlaying && (uint64_t)refEnd[refPhase] * Clock_tickPeriod <= us) {
+		uint32_t end = refEnd[refPhase];
+		uint64_t edgeUs = (uint64_t)end * Clock_tickPeriod;
+
+		if (latencyOut == latencyIn) {
+			fail("no clock for the phase ending at us", edgeUs, refPhase);
+			refPlaying = FALSE;
+			return;
+		}
+		edgeUs += latencies[latencyOut++ % MAX_LATENCIES];
+
+		if (++refPhase < refPhases) {
+			record(&expected, edgeUs, refDuty[refPhase]);
+			continue;
+		}
+		refPlaying = FALSE;
+		record(&expected, edgeUs, 0);
+		if (refQueueLen) {
+			refCue = refPop();
+			refChained++;
+			refStart(&refCue, edgeUs, end);
+		}
+	}
+}
+
+/**
+ * A request: queued behind its priority, the lowest priority one dropped when full,
+ * started at once if it is now first and outranks the cue playing.
+ *
+ * @return 	1 if queued; *pDropped holds the cue dropped, times 0 if none
+ */
+static uint8_t refPlay(const Cue *pCue, Cue *pDropped, uint64_t us)
+{
+	uint8_t pos;
+
+	pDropped->times = 0;
+	if (!pCue->times || pCue->pattern >= VIBE_NUM_PATTERNS || pCue->prio >= VIBE_NUM_PRIOS) {
+		refRejected++;
+		return 0;
+	}
+	if (refQueueLen == VIBE_QUEUE_LEN) {
+		refDropped++;
+		if (pCue->prio <= refQueue[VIBE_QUEUE_LEN - 1].prio) {
+			*pDropped = *pCue;
+			return 0;
+		}
+		*pDropped = refQueue[--refQueueLen];
+	}
+	for (pos = refQueueLen; pos && refQueue[pos - 1].prio < pCue->prio; pos--)
+		refQueue[pos] = refQueue[pos - 1];
+	refQueue[pos] = *pCue;
+	refQueueLen++;
+
+	if (!refPlaying || refQueue[0].prio > refCue.prio) {
+		if (refPlaying)
+			refPreempted++;
+		refCue = refPop();
+		refStart(&refCue, us, (uint32_t)(us / Clock_tickPeriod));
+	}
+	return 1;
+}
+
+//**********************************************************************************
+// Check
+//**********************************************************************************
+static Cue randomCue(void)
+{
+	Cue cue;
+	uint32_t r = rnd(100);
+
+	cue.pattern = rnd(VIBE_NUM_PATTERNS);
+	cue.prio = (r < 50) ? VIBE_PRIO_INFO : (r < 85) ? VIBE_PRIO_CUE : VIBE_PRIO_URGENT;
+	cue.times = 1 + rnd(3);
+	if (rnd(50) == 0) {
+		//Not a cue
+		if (rnd(2))
+			cue.times = 0;
+		else
+			cue.pattern = VIBE_NUM_PATTERNS + rnd(3);
+	}
+	return cue;
+}
+
+/**
+ * Time to the next request, in us off the 10 us ticks so a request never meets a
+ * phase end: a burst now and then, otherwise a rep's or a set's worth.
+ */
+static uint64_t nextGap(uint8_t *pBurst)
+{
+	uint64_t ms;
+
+	if (*pBurst) {
+		(*pBurst)--;
+		ms = rnd(80);
+	}
+	else if (rnd(10) == 0) {
+		*pBurst = 2 + rnd(6);
+		ms = rnd(80);
+	}
+	else {
+		ms = rnd(3) ? 100 + rnd(2000) : 2000 + rnd(30000);
+	}
+	return ms * 1000 + rnd(100) * Clock_tickPeriod + Clock_tickPeriod / 2;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t endUs, us, beforeUs;
+	uint32_t requests = 0, edges, i;
+	uint8_t burst = 0, queued, refQueued;
+	Cue cue, refDrop = { 0 };
+
+	rngState = (argc > 1 ? strtoul(argv[1], NULL, 0) : 1) | 1;
+	endUs = (argc > 2 ? strtoull(argv[2], NULL, 0) : 30) * 60 * 1000000;
+	got.pEdges = malloc(MAX_EDGES * sizeof(Edge));
+	expected.pEdges = malloc(MAX_EDGES * sizeof(Edge));
+
+	vibe_init();
+	hPin = vibePinHandle;
+	shim_ioFxn = ioChanged;
+	shim_swiLatencyFxn = swiLatency;
+
+	for (us = nextGap(&burst); us < endUs; us += nextGap(&burst)) {
+		nextRequestUs = us;
+		shim_advanceUs(us - shim_nowUs());
+		refAdvance(us);
+
+		cue = randomCue();
+		dropPending = 0;
+		beforeUs = shim_nowUs();
+		edges = got.len;
+		queued = vibe_play(cue.pattern, cue.prio, cue.times);
+		if (got.len != edges)
+			fail("vibe_play drove the motor itself, at us", us, got.pEdges[got.len - 1].duty);
+		shim_runSwis();
+		if (shim_nowUs() != beforeUs)
+			fail("time moved on in vibe_play, us", beforeUs, shim_nowUs());
+		requests++;
+
+		refQueued = refPlay(&cue, &refDrop, us);
+		if (queued != refQueued)
+			fail("vibe_play returned, expected", queued, refQueued);
+		if (dropPending != (refDrop.times != 0))
+			fail("drops traced, expected", dropPending, refDrop.times != 0);
+		else if (dropPending && (dropped.pattern != refDrop.pattern || dropped.prio != refDrop.prio))
+			fail("dropped pattern/prio", dropped.pattern, dropped.prio);
+	}
+	nextRequestUs = 0;
+	shim_advanceUs(endUs - shim_nowUs());
+	refAdvance(endUs);
+
+	//Then idle: everything queued played out
+	shim_advanceUs(60 * 1000000);
+	refAdvance(endUs + 60 * 1000000);
+	if (refPlaying || refQueueLen)
+		fail("reference still playing at the end", refPlaying, refQueueLen);
+	if (latencyOut != latencyIn)
+		fail("clocks without a phase end, expected", latencyIn, latencyOut);
+
+	for (i = 0; i < MIN(got.len, expected.len); i++) {
+		if (got.pEdges[i].duty == DUTY_BAD) {
+			fail("pin, GPT0 and power disagree at us", got.pEdges[i].us, 0);
+			continue;
+		}
+		if (got.pEdges[i].us != expected.pEdges[i].us || got.pEdges[i].duty != expected.pEdges[i].duty) {
+			fail("edge at us/duty", got.pEdges[i].us, got.pEdges[i].duty);
+			fail("  expected us/duty", expected.pEdges[i].us, expected.pEdges[i].duty);
+			break;		//The rest follows from this one
+		}
+	}
+	if (got.len != expected.len)
+		fail("edges, expected", got.len, expected.len);
+	if (hapticTimings != refStarted - refChained || hapticLate)
+		fail("haptic timings/late", hapticTimings, hapticLate);
+
+	printf("%u requests in %llu min: %u cues played, %u after the one before, %u preempting one, "
+		   "%u dropped, %u rejected\n", requests, (unsigned long long)(endUs / 60000000),
+		   refStarted, refChained, refPreempted, refDropped, refRejected);
+	printf("%u edges, %u after a late Swi\n", got.len, lateSwis);
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+}
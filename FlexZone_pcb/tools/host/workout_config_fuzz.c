@@ -0,0 +1,450 @@
+/*
+ * Fuzzes the EMG Config parser (workout_config.c) against a reference written from the
+ * protocol table in workout_config.h, and writes test vectors for workout_config.py.
+ *
+ * Writes are generated valid (random keys in range, in any order, repeated, with
+ * unknown keys between) and then often damaged: a byte changed, cut short or extended,
+ * a length byte off, a value out of range, the thresholds crossed, or random bytes
+ * after the marker. For every write
+ *
+ *     parse		result, failing offset, command and every field equal the
+ *     				reference's; a rejected write leaves the configuration as it was
+ *     write		workoutConfig_write stages what parse returned and reports it on the
+ *     				Active Config characteristic; after workoutConfig_apply the read-back
+ *     				holds every key with the active value, read whole and at every offset
+ *     round trip	workoutConfig_encode of a parsed configuration parses back to it
+ *
+ * Old layout writes, including the 0xCF stop, are mixed in.
+ *
+ *     workout_config_fuzz [writes] [vectors.jsonl]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "workout_config.h"
+
+#define MAX_WRITE							40			//EMG_CONFIG_LEN
+#define NUM_KEYS							18
+#define VECTORS								2000
+
+typedef struct {
+	uint8_t key;
+	uint8_t size;
+	uint16_t min;
+	uint16_t max;
+	const char *name;
+} Ref_key;
+
+//workout_config.h
+static const Ref_key refKeys[NUM_KEYS] = {
+	{ 0x01, 1, 1, 255, "set_count" },
+	{ 0x02, 1, 1, EMG_MAX_REPS, "rep_count" },
+	{ 0x03, 2, 0, 0xFFFF, "max_rest" },
+	{ 0x04, 1, 0, 1, "haptic" },
+	{ 0x05, 1, 0, 1, "imu" },
+	{ 0x06, 1, 0, 1, "raw_stream" },
+	{ 0x07, 1, 0, 255, "broadcast" },
+	{ 0x08, 1, 0, 1, "rep_cue" },
+	{ 0x09, 1, 0, 100, "concentric" },
+	{ 0x0A, 1, 0, 100, "eccentric" },
+	{ 0x10, 2, 1, 4095, "threshold_high" },
+	{ 0x11, 2, 1, 4095, "threshold_low" },
+	{ 0x12, 2, 0, 5000, "min_rep_ms" },
+	{ 0x13, 1, 1, 255, "set_timeout" },
+	{ 0x14, 1, 10, 100, "sample_period" },
+	{ 0x15, 1, 1, 16, "adc_average" },
+	{ 0x16, 1, 0, 255, "gain_0" },
+	{ 0x17, 1, 0, 255, "gain_1" },
+};
+
+//The EMG task's, workout_config.c works on it
+Workout_config myWorkoutConfig;
+
+static uint32_t rngState = 23;
+static uint32_t failures, writeNum;
+static uint32_t results[WORKOUT_CFG_ERR_CONFLICT + 1];
+
+static uint32_t rnd(uint32_t n)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+static void fail(const char *what, uint32_t a, uint32_t b)
+{
+	if (failures++ < 20)
+		printf("  write %u: %s (%u, %u)\n", writeNum, what, a, b);
+}
+
+static void toValues(const Workout_config *c, uint16_t *v)
+{
+	v[0] = c->targetSetCount;
+	v[1] = c->targetRepCount;
+	v[2] = c->maxRestSeconds;
+	v[3] = c->hapticFeedback;
+	v[4] = c->imuFeedback;
+	v[5] = c->rawStream;
+	v[6] = c->broadcastPeriod;
+	v[7] = c->repCue;
+	v[8] = c->concentricTarget;
+	v[9] = c->eccentricTarget;
+	v[10] = c->repThresholdHigh;
+	v[11] = c->repThresholdLow;
+	v[12] = c->minRepMs;
+	v[13] = c->setTimeoutSec;
+	v[14] = c->samplePeriodMs;
+	v[15] = c->adcAverage;
+	v[16] = c->gain[0];
+	v[17] = c->gain[1];
+}
+
+static int refIndex(uint8_t key)
+{
+	int i;
+
+	for (i = 0; i < NUM_KEYS; i++)
+		if (refKeys[i].key == key)
+			return i;
+	return -1;
+}
+
+/**
+ * The protocol as workout_config.h describes it.
+ */
+static uint8_t refParse(const uint8_t *b, uint16_t len, uint16_t *v, uint8_t *pCmd, uint8_t *pErrPos)
+{
+	uint16_t out[NUM_KEYS], pos = 2;
+
+	*pCmd = WORKOUT_CFG_CMD_NONE;
+	*pErrPos = 0;
+	if (len < 2)
+		return WORKOUT_CFG_ERR_TRUNCATED;
+	if (b[1] < 1 || b[1] > 3) {
+		*pErrPos = 1;
+		return WORKOUT_CFG_ERR_COMMAND;
+	}
+	memcpy(out, v, sizeof(out));
+	if (b[1] != WORKOUT_CFG_CMD_STOP) {
+		for (; pos < len; pos += 2 + b[pos + 1]) {
+			int k;
+			uint16_t value;
+
+			*pErrPos = pos;
+			if (len - pos < 2 || len - pos - 2 < b[pos + 1])
+				return WORKOUT_CFG_ERR_TRUNCATED;
+			k = refIndex(b[pos]);
+			if (k < 0)
+				continue;
+			if (b[pos + 1] != refKeys[k].size)
+				return WORKOUT_CFG_ERR_LENGTH;
+			value = b[pos + 2] | ((refKeys[k].size == 2) ? b[pos + 3] << 8 : 0);
+			if (value < refKeys[k].min || value > refKeys[k].max)
+				return WORKOUT_CFG_ERR_RANGE;
+			out[k] = value;
+		}
+		*pErrPos = 0;
+		if (out[11] >= out[10])
+			return WORKOUT_CFG_ERR_CONFLICT;
+	}
+	memcpy(v, out, sizeof(out));
+	*pCmd = b[1];
+	return WORKOUT_CFG_OK;
+}
+
+static uint16_t putTlv(uint8_t *b, uint16_t pos, int k, uint16_t value)
+{
+	b[pos++] = refKeys[k].key;
+	b[pos++] = refKeys[k].size;
+	b[pos++] = value & 0xFF;
+	if (refKeys[k].size == 2)
+		b[pos++] = value >> 8;
+	return pos;
+}
+
+static uint16_t makeWrite(uint8_t *b)
+{
+	uint16_t len = 2, i, n;
+
+	b[0] = WORKOUT_CFG_MAGIC;
+	b[1] = 1 + rnd(3);
+
+	if (rnd(10) == 0) {
+		//Noise after the marker
+		n = rnd(MAX_WRITE);
+		for (i = 1; i < n; i++)
+			b[i] = rnd(256);
+		return MAX(n, 1);
+	}
+
+	while (len + 4 <= MAX_WRITE && rnd(8)) {
+		int k = rnd(NUM_KEYS);
+
+		if (rnd(10) == 0) {
+			//Unknown key
+			uint8_t vLen = rnd(3);
+
+			if (len + 2 + vLen > MAX_WRITE)
+				break;
+			do
+				b[len] = rnd(256);
+			while (refIndex(b[len]) >= 0);
+			b[len + 1] = vLen;
+			for (i = 0; i < vLen; i++)
+				b[len + 2 + i] = rnd(256);
+			len += 2 + vLen;
+			continue;
+		}
+		len = putTlv(b, len, k, refKeys[k].min + rnd(refKeys[k].max - refKeys[k].min + 1));
+	}
+
+	//Damage
+	switch (rnd(8)) {
+	case 0:
+		if (len > 2)
+			b[2 + rnd(len - 2)] = rnd(256);
+		break;
+	case 1:
+		len = 1 + rnd(len);
+		break;
+	case 2:
+		if (len < MAX_WRITE)
+			b[len++] = rnd(256);
+		break;
+	case 3:
+		if (len > 3)
+			b[3 + rnd(len - 3)] ^= 1 << rnd(8);
+		break;
+	case 4:
+		if (len + 4 <= MAX_WRITE) {
+			int k = rnd(NUM_KEYS);
+
+			len = putTlv(b, len, k, rnd(2) ? refKeys[k].max + 1 : refKeys[k].min - 1);
+		}
+		break;
+	case 5:
+		if (len + 8 <= MAX_WRITE) {
+			uint16_t t = 1 + rnd(4095);
+
+			len = putTlv(b, len, 10, t);
+			len = putTlv(b, len, 11, t + rnd(4096 - t));
+		}
+		break;
+	default:
+		break;
+	}
+	return len;
+}
+
+/**
+ * The old layout: 7 bytes or fewer, sometimes the stop request.
+ */
+static uint16_t makeLegacy(uint8_t *b, uint16_t *v, uint8_t *pCmd)
+{
+	uint16_t len = rnd(8), i;
+	uint8_t x[7] = {0};
+
+	for (i = 0; i < len; i++)
+		b[i] = x[i] = rnd(256);
+	if (len == 0 || b[0] == WORKOUT_CFG_MAGIC)
+		b[0] = x[0] = 1;
+	if (rnd(4) == 0 && len >= 5)
+		b[0] = b[4] = x[0] = x[4] = 0xCF;
+
+	if (x[0] == 0xCF && x[4] == 0xCF) {
+		*pCmd = WORKOUT_CFG_CMD_STOP;
+		return MAX(len, 1);
+	}
+	*pCmd = WORKOUT_CFG_CMD_START;
+	v[0] = x[0] ? x[0] : WORKOUT_CFG_DEFAULT_SETS;
+	v[1] = (x[1] && x[1] < EMG_MAX_REPS) ? x[1] : EMG_MAX_REPS;
+	v[2] = x[2] * 30;
+	v[3] = (x[3] == 1);
+	v[4] = (x[4] != 0);
+	v[5] = (x[5] != 0);
+	v[6] = x[6];
+	return MAX(len, 1);
+}
+
+static void dumpHex(FILE *f, const uint8_t *b, uint16_t len)
+{
+	uint16_t i;
+
+	for (i = 0; i < len; i++)
+		fprintf(f, "%02x", b[i]);
+}
+
+static void dumpVector(FILE *f, const uint8_t *b, uint16_t len, const uint16_t *start,
+					   uint8_t result, uint8_t errPos, uint8_t cmd, const uint16_t *v)
+{
+	int k;
+
+	fprintf(f, "{\"write\": \"");
+	dumpHex(f, b, len);
+	fprintf(f, "\", \"start\": {");
+	for (k = 0; k < NUM_KEYS; k++)
+		fprintf(f, "%s\"%s\": %u", k ? ", " : "", refKeys[k].name, start[k]);
+	fprintf(f, "}, \"result\": %u, \"err_pos\": %u, \"cmd\": %u, \"config\": {", result, errPos, cmd);
+	for (k = 0; k < NUM_KEYS; k++)
+		fprintf(f, "%s\"%s\": %u", k ? ", " : "", refKeys[k].name, v[k]);
+	fprintf(f, "}}\n");
+}
+
+/**
+ * Active Config characteristic after a write, whole and from every offset.
+ */
+static void checkReadBack(uint8_t result, uint8_t errPos, uint8_t waiting, FILE *pDump)
+{
+	uint8_t value[WORKOUT_CFG_READ_MAX_LEN + 1], part[WORKOUT_CFG_READ_MAX_LEN + 1];
+	uint16_t want[NUM_KEYS], len, pos, offset, n;
+	int k, seen = 0;
+
+	toValues(&myWorkoutConfig, want);
+	len = workoutConfig_read(0, value, sizeof(value));
+	if (len < WORKOUT_CFG_READ_HEADER_LEN || value[0] != WORKOUT_CFG_MAGIC || value[1] != result ||
+			value[2] != errPos || value[3] != waiting) {
+		fail("read-back header", value[1], result);
+		return;
+	}
+	for (pos = WORKOUT_CFG_READ_HEADER_LEN; pos + 2 <= len; pos += 2 + value[pos + 1]) {
+		k = refIndex(value[pos]);
+		if (k < 0 || value[pos + 1] != refKeys[k].size || pos + 2 + value[pos + 1] > len) {
+			fail("read-back TLV at", pos, value[pos]);
+			return;
+		}
+		if ((value[pos + 2] | ((refKeys[k].size == 2) ? value[pos + 3] << 8 : 0)) != want[k])
+			fail("read-back value of key", refKeys[k].key, want[k]);
+		seen++;
+	}
+	if (pos != len || seen != NUM_KEYS)
+		fail("read-back keys", seen, NUM_KEYS);
+
+	for (offset = 0; offset <= len; offset++) {
+		n = workoutConfig_read(offset, part, 7);
+		if (n != MIN(7, len - offset) || memcmp(part, &value[offset], n))
+			fail("read-back at offset", offset, n);
+	}
+	if (pDump) {
+		fprintf(pDump, "{\"readback\": \"");
+		dumpHex(pDump, value, len);
+		fprintf(pDump, "\"}\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t writes = (argc > 1) ? strtoul(argv[1], NULL, 0) : 200000;
+	FILE *pDump = NULL;
+	uint8_t b[MAX_WRITE], enc[WORKOUT_CFG_READ_MAX_LEN];
+	uint32_t legacy = 0, roundTrips = 0;
+
+	if (argc > 2 && (pDump = fopen(argv[2], "w")) == NULL) {
+		perror(argv[2]);
+		return 2;
+	}
+	workoutConfig_init();
+
+	for (writeNum = 0; writeNum < writes; writeNum++) {
+		uint16_t start[NUM_KEYS], want[NUM_KEYS], got[NUM_KEYS], len;
+		uint8_t result, errPos, cmd, refResult, refErrPos, refCmd;
+		Workout_config cfg, before, staged, old;
+		uint8_t isLegacy = rnd(10) == 0;
+		int k;
+
+		//Start from the active configuration or a random valid one
+		cfg = myWorkoutConfig;
+		toValues(&cfg, start);
+		memcpy(want, start, sizeof(want));
+
+		if (isLegacy) {
+			legacy++;
+			len = makeLegacy(b, want, &refCmd);
+			refResult = WORKOUT_CFG_OK;
+			refErrPos = 0;
+			if (refCmd == WORKOUT_CFG_CMD_STOP)
+				memcpy(want, start, sizeof(want));
+		} else {
+			len = makeWrite(b);
+			refResult = refParse(b, len, want, &refCmd, &refErrPos);
+
+			before = cfg;
+			result = workoutConfig_parse(b, len, &cfg, &cmd, &errPos);
+			toValues(&cfg, got);
+			results[result <= WORKOUT_CFG_ERR_CONFLICT ? result : 0]++;
+			if (result != refResult || errPos != refErrPos || cmd != refCmd)
+				fail("parse result, offset", result * 256 + errPos, refResult * 256 + refErrPos);
+			else if (result != WORKOUT_CFG_OK && memcmp(&cfg, &before, sizeof(cfg)))
+				fail("rejected write changed the configuration", result, 0);
+			else if (memcmp(got, want, sizeof(got)))
+				fail("parsed values", result, cmd);
+			if (pDump && writeNum < VECTORS)
+				dumpVector(pDump, b, len, start, refResult, refErrPos, refCmd, want);
+
+			//Round trip
+			if (result == WORKOUT_CFG_OK) {
+				uint16_t n;
+				Workout_config back = myWorkoutConfig;
+				uint16_t backV[NUM_KEYS];
+
+				enc[0] = WORKOUT_CFG_MAGIC;
+				enc[1] = WORKOUT_CFG_CMD_UPDATE;
+				n = workoutConfig_encode(&cfg, &enc[2], sizeof(enc) - 2);
+				if (workoutConfig_parse(enc, n + 2, &back, &cmd, &errPos) != WORKOUT_CFG_OK)
+					fail("encoded configuration rejected", errPos, 0);
+				toValues(&back, backV);
+				if (memcmp(backV, got, sizeof(got)))
+					fail("round trip", 0, 0);
+				roundTrips++;
+			}
+		}
+
+		//Through the characteristic: staged, reported, applied
+		cmd = workoutConfig_write(b, len, &staged);
+		toValues(&staged, got);
+		if (cmd != refCmd)
+			fail("write command", cmd, refCmd);
+		if (cmd == WORKOUT_CFG_CMD_NONE || cmd == WORKOUT_CFG_CMD_STOP) {
+			if (workoutConfig_apply(&old))
+				fail("nothing to apply after a rejected write or a stop", cmd, 0);
+		} else {
+			if (memcmp(got, want, sizeof(got)))
+				fail("staged values", cmd, 0);
+			if (rnd(2)) {
+				checkReadBack(refResult, refErrPos, 1, NULL);
+			}
+			if (!workoutConfig_apply(&old))
+				fail("staged write not applied", cmd, 0);
+			toValues(&myWorkoutConfig, got);
+			if (memcmp(got, want, sizeof(got)))
+				fail("applied values", cmd, 0);
+		}
+		workoutConfig_takeCommand();
+		checkReadBack(refResult, refErrPos, 0, (pDump && writeNum < VECTORS && !isLegacy) ? pDump : NULL);
+
+		//Now and then back to a random valid configuration
+		if (rnd(20) == 0) {
+			uint16_t pos = 2;
+
+			b[0] = WORKOUT_CFG_MAGIC;
+			b[1] = WORKOUT_CFG_CMD_UPDATE;
+			for (k = 0; k < NUM_KEYS; k++)
+				pos = putTlv(b, pos, k, (k == 11) ? 1 + rnd(1000) : (k == 10) ? 1001 + rnd(3095) :
+							 refKeys[k].min + rnd(refKeys[k].max - refKeys[k].min + 1));
+			if (workoutConfig_write(b, pos, &staged) != WORKOUT_CFG_CMD_UPDATE)
+				fail("random valid configuration rejected", 0, 0);
+			workoutConfig_apply(&old);
+			workoutConfig_takeCommand();
+		}
+	}
+	if (pDump)
+		fclose(pDump);
+
+	printf("%u writes, %u of the old layout, %u round trips\n", writes, legacy, roundTrips);
+	printf("v2 results: ok %u, command %u, truncated %u, length %u, range %u, conflict %u\n",
+			results[WORKOUT_CFG_OK], results[WORKOUT_CFG_ERR_COMMAND], results[WORKOUT_CFG_ERR_TRUNCATED],
+			results[WORKOUT_CFG_ERR_LENGTH], results[WORKOUT_CFG_ERR_RANGE],
+			results[WORKOUT_CFG_ERR_CONFLICT]);
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+}
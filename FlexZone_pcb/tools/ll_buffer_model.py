@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+"""
+Model of the BLE stack's notification buffers, to compare sustained notification
+throughput of the FlexZone TX queue (user_txqDrain in Application/FlexZone.c) with
+the send-once path it replaced.
+
+The stack holds MAX_NUM_PDU (6 in the project) L2CAP PDUs. GATT_Notification fails
+with MSG_BUFFER_NOT_AVAIL while all of them are taken. Each connection event the
+link layer sends LL packets of at most 27 bytes, from the oldest PDU on, until the
+central's packets-per-event limit or the connection interval runs out. A PDU is
+freed once its last LL packet went out.
+
+    send-once   every notification is handed to the stack when it is produced, and
+                dropped if no buffer is free (before user-031)
+    txq         notifications wait in a USER_TXQ_DEPTH ring, are sent when produced
+                if a buffer is free, and the rest refill the buffers at every
+                connection event end (PRZ_CONN_EVT_END_EVT); dropped only when the
+                ring is full
+
+Workload: the IMU stream at 100 frames/s, packed as many 12 byte frames per
+notification as the payload allows, plus a set summary burst every 20 s, split in
+fragments like user_txqSend. A summary counts as complete if every fragment arrived.
+
+    ll_buffer_model.py
+    ll_buffer_model.py --interval 30 --packets 4 --mtu 23 --seconds 120
+    ll_buffer_model.py --check
+
+--check fails unless the TX queue drops no more than send-once anywhere, and loses
+no notification and no summary wherever the link carries the offered load (up to
+30 ms intervals).
+"""
+
+import argparse
+import collections
+import sys
+
+LL_MAX_PAYLOAD = 27
+L2CAP_ATT_HEADER = 7
+US_PER_BYTE = 8
+T_IFS_US = 150
+LL_OVERHEAD = 10
+EVENT_GUARD_US = 1250		#Left free before the next anchor point
+
+MAX_NUM_PDU = 6
+USER_TXQ_DEPTH = 8
+USER_MAX_NOTIFY_LEN = 97
+IMU_HEADER = 4 + 2			#Stream packet header [type, len], then seq, t0, dt
+IMU_FRAME = 12
+IMU_RATE_HZ = 100
+SUMMARY_LEN = 110			#A 10-rep set, see set_summary_decode.py --bench
+SUMMARY_PERIOD_S = 20
+
+
+class Notification(object):
+    __slots__ = ('t', 'length', 'summary', 'left')
+
+    def __init__(self, t, length, summary=None):
+        self.t = t
+        self.length = length
+        self.summary = summary
+        self.left = -(-(length + L2CAP_ATT_HEADER) // LL_MAX_PAYLOAD)
+
+
+def workload(seconds, mtu):
+    """(time us, Notification) in time order."""
+    payload = min(mtu - 3, USER_MAX_NOTIFY_LEN)
+    frames = max(1, (payload - IMU_HEADER) // IMU_FRAME)
+    out = []
+
+    period = 1e6 * frames / IMU_RATE_HZ
+    t = 0.0
+    while t < seconds * 1e6:
+        out.append((t, IMU_HEADER + frames * IMU_FRAME))
+        t += period
+
+    chunk = payload - 2 - 1
+    for n, t in enumerate(range(SUMMARY_PERIOD_S // 2, seconds, SUMMARY_PERIOD_S)):
+        left = SUMMARY_LEN
+        while left > 0:
+            n_bytes = min(chunk, left)
+            out.append((t * 1e6, (2 + 1 + n_bytes, n)))
+            left -= n_bytes
+
+    out.sort(key=lambda e: e[0])
+    return [Notification(t, v[0], v[1]) if isinstance(v, tuple) else Notification(t, v)
+            for t, v in out]
+
+
+class Result(object):
+    def __init__(self):
+        self.offered = 0
+        self.sent = 0
+        self.bytes = 0
+        self.dropped = 0
+        self.latency = []
+        self.queue_high = 0
+        self.summaries = {}		#summary -> [fragments, fragments sent]
+
+
+def run(policy, notifications, interval_ms, packets_per_event, seconds):
+    interval = interval_ms * 1000.0
+    pdus = collections.deque()		#Taken stack buffers, oldest first
+    txq = collections.deque()
+    res = Result()
+
+    def offer(n):
+        if n.summary is not None:
+            res.summaries.setdefault(n.summary, [0, 0])[0] += 1
+        res.offered += 1
+        if policy == 'send-once':
+            if len(pdus) < MAX_NUM_PDU:
+                pdus.append(n)
+            else:
+                res.dropped += 1
+        else:
+            if len(txq) == USER_TXQ_DEPTH:
+                res.dropped += 1
+                return
+            txq.append(n)
+            res.queue_high = max(res.queue_high, len(txq))
+            drain()
+
+    def drain():
+        while txq and len(pdus) < MAX_NUM_PDU:
+            pdus.append(txq.popleft())
+
+    def connection_event(t):
+        budget = interval - EVENT_GUARD_US
+        packets = 0
+        while pdus and packets < packets_per_event:
+            n = pdus[0]
+            ll_len = min(LL_MAX_PAYLOAD, n.length + L2CAP_ATT_HEADER -
+                         (n.left - 1) * LL_MAX_PAYLOAD) if n.left == 1 else LL_MAX_PAYLOAD
+            cost = (LL_OVERHEAD + ll_len) * US_PER_BYTE + 2 * T_IFS_US + LL_OVERHEAD * US_PER_BYTE
+            if cost > budget:
+                break
+            budget -= cost
+            packets += 1
+            n.left -= 1
+            if n.left == 0:
+                pdus.popleft()
+                res.sent += 1
+                res.bytes += n.length
+                res.latency.append((t - n.t) / 1000.0)
+                if n.summary is not None:
+                    res.summaries[n.summary][1] += 1
+        if policy == 'txq':
+            drain()			#PRZ_CONN_EVT_END_EVT
+
+    i = 0
+    t = 0.0
+    while t < seconds * 1e6:
+        while i < len(notifications) and notifications[i].t <= t:
+            offer(notifications[i])
+            i += 1
+        connection_event(t)
+        t += interval
+    return res
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p * len(values)))]
+
+
+def complete_summaries(res):
+    return sum(1 for total, sent in res.summaries.values() if total == sent)
+
+
+def report(policy, res, seconds):
+    complete = complete_summaries(res)
+    print('%-10s %7.1f %7.1f %7.0f %6.2f %%  %3u/%-3u %6.1f %7.1f %6s' % (
+        policy, res.offered / float(seconds), res.sent / float(seconds),
+        res.bytes / float(seconds), 100.0 * res.dropped / max(res.offered, 1),
+        complete, len(res.summaries), percentile(res.latency, 0.5),
+        percentile(res.latency, 0.99), res.queue_high if policy == 'txq' else '-'))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--interval', type=float, nargs='*', default=[7.5, 15, 30, 50],
+                        help='connection intervals in ms')
+    parser.add_argument('--packets', type=int, nargs='*', default=[4, 6],
+                        help="central's LL packets per connection event")
+    parser.add_argument('--mtu', type=int, nargs='*', default=[23, 100], help='ATT MTU')
+    parser.add_argument('--seconds', type=int, default=120)
+    parser.add_argument('--check', action='store_true', help='exit non-zero on a regression')
+    args = parser.parse_args()
+
+    failures = 0
+
+    for mtu in args.mtu:
+        notifications = workload(args.seconds, mtu)
+        for packets in args.packets:
+            for interval in args.interval:
+                print('\nMTU %u, %.1f ms interval, %u packets per event' % (mtu, interval, packets))
+                print('%-10s %7s %7s %7s %8s %8s %6s %7s %6s' % (
+                    'policy', 'offer/s', 'sent/s', 'B/s', 'dropped', 'sets', 'p50 ms',
+                    'p99 ms', 'queue'))
+                res = {}
+                for policy in ('send-once', 'txq'):
+                    for n in notifications:
+                        n.left = -(-(n.length + L2CAP_ATT_HEADER) // LL_MAX_PAYLOAD)
+                    res[policy] = run(policy, notifications, interval, packets, args.seconds)
+                    report(policy, res[policy], args.seconds)
+                txq = res['txq']
+                if txq.dropped > res['send-once'].dropped or (interval <= 30 and (
+                        txq.dropped or complete_summaries(txq) != len(txq.summaries))):
+                    print('FAIL: the TX queue lost notifications')
+                    failures += 1
+
+    if args.check:
+        print('\n%u failures' % failures)
+        sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,269 @@
+#!/usr/bin/env python3
+"""
+Decodes set summaries (Application/set_summary.h, version 1) from the EMG stream and
+compares their cost on air with the 11 fixed notifications they replaced.
+
+APP_PACKET_TYPE_SET_SUMMARY packets carry one fragment byte (index, 0x80 on the last)
+and a piece of the summary. Fragments are reassembled, the CRC-16/CCITT-FALSE checked,
+and the varint records decoded back to the EMG_stats fields. The capture format is
+described in fz_capture.py.
+
+    set_summary_decode.py capture.txt
+    set_summary_decode.py capture.txt --expect sets.jsonl --bench
+
+--expect compares every decoded set with a JSON line of the encoded one, as written
+by host/set_summary_dump, and checks that a flipped bit fails the CRC. --bench prints
+notifications, bytes on air and radio time per set, for the summaries in the capture
+and for the old format.
+
+The radio model is LE 1M without data length extension (the CC2640 stack 2.1 LL
+payload is 27 bytes): every notification adds a 4 byte L2CAP and a 3 byte ATT
+header, is split into 27 byte LL PDUs, and each PDU costs 10 bytes of preamble,
+access address, header and CRC at 8 us a byte, plus two T_IFS and the central's
+empty PDU.
+"""
+
+import argparse
+import json
+import sys
+
+from fz_capture import read_capture, split_packet
+
+APP_PACKET_TYPE_SET_SUMMARY = 3
+SET_SUMMARY_VERSION = 1
+FLAG_SET_DONE = 0x01
+FLAG_MOTION = 0x02
+FRAG_LAST = 0x80
+FRAG_INDEX_MASK = 0x7F
+NOTIFY_HEADER_LEN = 2		#[type, len] of the EMG stream packets
+
+LL_MAX_PAYLOAD = 27
+LL_OVERHEAD = 10
+L2CAP_ATT_HEADER = 7
+US_PER_BYTE = 8
+T_IFS_US = 150
+
+#The format user-028 replaced: 11 notifications of the whole EMG_STREAM_LEN (40)
+#buffer, two per uint16 array and one for movedOrNah, whatever the rep count
+OLD_NOTIFICATIONS = 11
+OLD_VALUE_LEN = 40
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE, as setSummary_crc16."""
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def read_varint(data, pos):
+    """(value, next pos) of an unsigned LEB128 varint."""
+    value = shift = 0
+    while True:
+        if pos >= len(data):
+            raise ValueError('varint runs past the end')
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return value, pos
+        shift += 7
+        if shift > 14:
+            raise ValueError('varint longer than 16 bits')
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def decode_summary(data):
+    """Fields of one reassembled summary, as a dict; ValueError if it is damaged."""
+    if len(data) < 8:
+        raise ValueError('summary too short')
+    if crc16(data[:-2]) != data[-2] | data[-1] << 8:
+        raise ValueError('CRC mismatch')
+    if data[0] != SET_SUMMARY_VERSION:
+        raise ValueError('unknown version %u' % data[0])
+
+    num_reps, flags, unit = data[2], data[3], data[5]
+    s = {
+        'set_index': data[1],
+        'num_reps': num_reps,
+        'set_done': 1 if flags & FLAG_SET_DONE else 0,
+        'exercise': data[4],
+        'width_unit': unit,
+        'pulse_width': [], 'dead_width': [], 'concentric': [], 'eccentric': [], 'peak': [],
+        'moved': None,
+    }
+    pos = 6
+    peak = 0
+    for _ in range(num_reps):
+        v, pos = read_varint(data, pos)
+        s['pulse_width'].append(v * unit)
+        v, pos = read_varint(data, pos)
+        s['dead_width'].append(v * unit)
+        v, pos = read_varint(data, pos)
+        s['concentric'].append(v)
+        v, pos = read_varint(data, pos)
+        s['eccentric'].append(v)
+        v, pos = read_varint(data, pos)
+        peak = (peak + unzigzag(v)) & 0xFFFF
+        s['peak'].append(peak)
+
+    if flags & FLAG_MOTION:
+        nbytes = (num_reps + 7) // 8
+        bits = data[pos:pos + nbytes]
+        if len(bits) != nbytes:
+            raise ValueError('motion bitmap runs past the end')
+        s['moved'] = [(bits[i // 8] >> (i % 8)) & 1 for i in range(num_reps)]
+        pos += nbytes
+    if pos != len(data) - 2:
+        raise ValueError('%d bytes left before the CRC' % (len(data) - 2 - pos))
+    return s
+
+
+class Reassembler(object):
+    """Collects fragments; feed() returns (summary bytes, notification lengths) once
+    the last fragment of a set arrived in order, None otherwise."""
+
+    def __init__(self):
+        self.data = None
+        self.lengths = None
+        self.next = 0
+        self.broken = 0
+
+    def feed(self, payload, notify_len):
+        if not payload:
+            self.broken += 1
+            return None
+        index = payload[0] & FRAG_INDEX_MASK
+        if index == 0:
+            if self.data is not None:
+                self.broken += 1
+            self.data = bytearray()
+            self.lengths = []
+            self.next = 0
+        if self.data is None or index != self.next:
+            self.broken += 1
+            self.data = None
+            return None
+        self.data += payload[1:]
+        self.lengths.append(notify_len)
+        self.next += 1
+        if payload[0] & FRAG_LAST:
+            done = (bytes(self.data), self.lengths)
+            self.data = None
+            return done
+        return None
+
+
+def air_time(notify_lengths):
+    """(LL PDUs, bytes on air, radio us) of a run of notifications."""
+    pdus = air = us = 0
+    for value_len in notify_lengths:
+        left = value_len + L2CAP_ATT_HEADER
+        while left > 0:
+            n = min(left, LL_MAX_PAYLOAD)
+            left -= n
+            pdus += 1
+            air += LL_OVERHEAD + n
+            us += (LL_OVERHEAD + n) * US_PER_BYTE + 2 * T_IFS_US + LL_OVERHEAD * US_PER_BYTE
+    return pdus, air, us
+
+
+def summaries(capture):
+    """Yields (decoded set or ValueError, summary bytes, notification lengths)."""
+    asm = Reassembler()
+    for _, value in capture:
+        pkt = split_packet(value)
+        if pkt is None or pkt[0] != APP_PACKET_TYPE_SET_SUMMARY:
+            continue
+        done = asm.feed(pkt[1], len(value))
+        if done is None:
+            continue
+        data, lengths = done
+        try:
+            yield decode_summary(data), data, lengths
+        except ValueError as e:
+            yield e, data, lengths
+    if asm.broken:
+        sys.stderr.write('%u fragments out of order or without a start\n' % asm.broken)
+
+
+def check(sets, expect_path):
+    """Compares decoded sets with the expected ones; returns the number of failures."""
+    with open(expect_path) as f:
+        expected = [json.loads(line) for line in f if line.strip()]
+    failures = 0
+    if len(sets) != len(expected):
+        print('decoded %u sets, expected %u' % (len(sets), len(expected)))
+        failures += 1
+    for n, ((s, data, _), want) in enumerate(zip(sets, expected)):
+        if isinstance(s, ValueError) or s != want:
+            print('set %u: decoded %s, expected %s' % (n, s, want))
+            failures += 1
+            continue
+        for bit in range(0, len(data) * 8, 13):
+            bad = bytearray(data)
+            bad[bit // 8] ^= 1 << (bit % 8)
+            try:
+                decode_summary(bytes(bad))
+            except ValueError:
+                continue
+            print('set %u: bit %u flipped and still decoded' % (n, bit))
+            failures += 1
+            break
+    return failures
+
+
+def bench(sets):
+    by_reps = {}
+    for s, _, lengths in sets:
+        if not isinstance(s, ValueError):
+            by_reps.setdefault(s['num_reps'], []).append(lengths)
+
+    old = air_time([OLD_VALUE_LEN] * OLD_NOTIFICATIONS)
+    print('%-12s %8s %8s %10s %10s' % ('reps', 'notifs', 'LL PDUs', 'air B', 'radio us'))
+    print('%-12s %8u %8u %10u %10u' % ('old, any', OLD_NOTIFICATIONS, old[0], old[1], old[2]))
+    for reps in sorted(by_reps):
+        runs = by_reps[reps]
+        notifs = sum(len(r) for r in runs) / float(len(runs))
+        cost = [air_time(r) for r in runs]
+        mean = [sum(c[i] for c in cost) / float(len(cost)) for i in range(3)]
+        print('%-12s %8.1f %8.1f %10.0f %10.0f   %3.0f %% of old radio time' %
+              ('%u' % reps, notifs, mean[0], mean[1], mean[2], 100.0 * mean[2] / old[2]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', help='capture file, - for stdin')
+    parser.add_argument('--expect', help='JSON lines of the sets that were encoded')
+    parser.add_argument('--bench', action='store_true', help='print the cost on air')
+    args = parser.parse_args()
+
+    sets = list(summaries(read_capture(args.capture)))
+    if not sets:
+        sys.exit('no set summaries in %s' % args.capture)
+
+    if args.expect:
+        failures = check(sets, args.expect)
+        print('%u sets, %u failures' % (len(sets), failures))
+        if args.bench:
+            bench(sets)
+        sys.exit(1 if failures else 0)
+
+    for s, data, lengths in sets:
+        if isinstance(s, ValueError):
+            print('damaged summary (%s): %s' % (s, data.hex()))
+        else:
+            print(json.dumps(s))
+    if args.bench:
+        bench(sets)
+
+
+if __name__ == '__main__':
+    main()
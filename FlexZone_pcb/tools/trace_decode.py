@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""
+Decodes the tokenized trace of the FlexZone firmware.
+
+The UART carries the xdc Log text and trace frames (see Application/trace.h). Text is
+printed as it comes; each frame starts with a 0x00 byte, which the text never holds,
+and its records are printed with the formats of Application/trace_msgs.h, the same
+table the firmware was built with.
+
+    trace_decode.py capture.bin
+    trace_decode.py --port COM5
+    trace_decode.py capture.bin --expect expected.txt
+
+--expect compares the output with the text host/trace_test wrote for its capture;
+every line must match.
+"""
+
+import argparse
+import io
+import os
+import re
+import struct
+import sys
+
+DEFAULT_MSGS = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            '..', 'FlexZoneApp', 'Application', 'trace_msgs.h')
+
+LEVELS = {1: 'E', 2: 'W', 3: 'I', 4: 'D'}
+FRAME_SYNC = 0x00
+REC_FIXED_LEN = 7
+
+MSG_RE = re.compile(r'TRACE_MSG\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)')
+CONV_RE = re.compile(r'%[-+ #0]*\d*([duxXc%])')
+
+
+def load_msgs(path):
+    """Message table, in ID order."""
+    with open(path) as f:
+        msgs = MSG_RE.findall(f.read())
+    if not msgs:
+        sys.exit('no TRACE_MSG entries in %s' % path)
+    return msgs
+
+
+def format_msg(fmt, args):
+    """printf style formatting of raw 32-bit arguments; %d takes them as signed."""
+    args = list(args)
+
+    def conv(m):
+        if m.group(1) == '%':
+            return '%'
+        value = args.pop(0) if args else 0
+        if m.group(1) == 'd' and value & 0x80000000:
+            value -= 1 << 32
+        spec = m.group(0)
+        if m.group(1) == 'c':
+            value = chr(value & 0xFF)
+        return spec % value
+
+    try:
+        return CONV_RE.sub(conv, fmt)
+    except (TypeError, ValueError):
+        return '%s %s' % (fmt, args)
+
+
+def decode_records(payload, msgs, tick_us):
+    """Yields the lines of the records of one frame."""
+    pos = 0
+    while pos + REC_FIXED_LEN <= len(payload):
+        msg_id, info, ticks = struct.unpack_from('<HBI', payload, pos)
+        num_args = info & 0x0F
+        level = LEVELS.get(info >> 4, '?')
+        pos += REC_FIXED_LEN
+        if pos + 4 * num_args > len(payload):
+            yield '<truncated record>'
+            return
+        args = struct.unpack_from('<%dI' % num_args, payload, pos)
+        pos += 4 * num_args
+
+        if msg_id < len(msgs):
+            name, fmt = msgs[msg_id]
+            text = format_msg(fmt, args)
+            if name == 'TRACE_BOOT' and args and args[0] != len(msgs):
+                text += '  (firmware has %u messages, table has %u)' % (args[0], len(msgs))
+        else:
+            text = 'unknown message %u %s' % (msg_id, list(args))
+        yield '[%12.6f] %s %s' % (ticks * tick_us / 1e6, level, text)
+
+
+def decode_stream(read, msgs, tick_us, out):
+    """Splits the byte stream into Log text and trace frames."""
+    while True:
+        b = read(1)
+        if not b:
+            return
+        if b[0] != FRAME_SYNC:
+            out.write(b.decode('ascii', 'replace'))
+            continue
+
+        n = read(1)
+        if not n:
+            return
+        payload = read(n[0])
+        if len(payload) < n[0]:
+            return
+        for line in decode_records(payload, msgs, tick_us):
+            out.write(line + '\n')
+        out.flush()
+
+
+def check(text, expect_path):
+    """Compares the output with the expected text; returns the number of failures."""
+    with open(expect_path) as f:
+        expected = f.read().splitlines()
+    lines = text.splitlines()
+    failures = 0
+    if len(lines) != len(expected):
+        print('%u lines, %u expected' % (len(lines), len(expected)))
+        failures += 1
+
+    for n, (got, want) in enumerate(zip(lines, expected), 1):
+        if got != want:
+            failures += 1
+            if failures <= 10:
+                print('line %u: %r, expected %r' % (n, got, want))
+    print('%u lines' % len(lines))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', nargs='?', help='raw UART capture file')
+    parser.add_argument('--port', help='serial port to read, needs pyserial')
+    parser.add_argument('--baud', type=int, default=115200)
+    parser.add_argument('--msgs', default=DEFAULT_MSGS, help='trace_msgs.h of the build')
+    parser.add_argument('--tick-us', type=float, default=10.0,
+                        help='Clock_tickPeriod of the build, us')
+    parser.add_argument('--expect', help='text the capture must decode to')
+    args = parser.parse_args()
+
+    msgs = load_msgs(args.msgs)
+
+    if args.port:
+        import serial
+        src = serial.Serial(args.port, args.baud)
+    elif args.capture:
+        src = open(args.capture, 'rb')
+    else:
+        src = sys.stdin.buffer
+
+    out = io.StringIO() if args.expect else sys.stdout
+    try:
+        decode_stream(src.read, msgs, args.tick_us, out)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        src.close()
+
+    if args.expect:
+        failures = check(out.getvalue(), args.expect)
+        print('%u failures' % failures)
+        sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
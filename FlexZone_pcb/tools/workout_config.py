@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+"""
+Builds and decodes EMG Config writes (config protocol v2, Application/workout_config.h)
+and decodes the EMG Active Config read-back, for the app side and for bench testing.
+
+A write is WORKOUT_CFG_MAGIC, a command, then one TLV per key: key, length, value
+little endian. Keys are named after WORKOUT_CFG_KEY_*, lowercase.
+
+    workout_config.py encode start rep_count=8 sample_period=20
+    workout_config.py decode c201020108
+    workout_config.py readback c200000001010a...
+    workout_config.py --check vectors.jsonl
+
+decode prints the command and the keys of a write, or why the firmware rejects it and
+at which offset. readback prints the result of the last write and the active values.
+
+--check parses every write of host/workout_config_fuzz's vectors and compares result,
+failing offset, command and values with the firmware's. Each read-back that follows a
+write must hold the values the write left active, encoded as encode() would.
+"""
+
+import argparse
+import json
+import sys
+
+MAGIC = 0xC2
+READ_HEADER_LEN = 4
+
+CMD_NONE, CMD_START, CMD_STOP, CMD_UPDATE = 0, 1, 2, 3
+CMDS = {'start': CMD_START, 'stop': CMD_STOP, 'update': CMD_UPDATE}
+
+OK, ERR_COMMAND, ERR_TRUNCATED, ERR_LENGTH, ERR_RANGE, ERR_CONFLICT = range(6)
+ERRORS = ['ok', 'unknown command', 'truncated', 'wrong length', 'out of range',
+          'threshold_low not below threshold_high']
+
+EMG_MAX_REPS = 19
+
+# key, name, size, min, max, in the order the firmware encodes them
+KEYS = [
+    (0x01, 'set_count', 1, 1, 255),
+    (0x02, 'rep_count', 1, 1, EMG_MAX_REPS),
+    (0x03, 'max_rest', 2, 0, 0xFFFF),
+    (0x04, 'haptic', 1, 0, 1),
+    (0x05, 'imu', 1, 0, 1),
+    (0x06, 'raw_stream', 1, 0, 1),
+    (0x07, 'broadcast', 1, 0, 255),
+    (0x08, 'rep_cue', 1, 0, 1),
+    (0x09, 'concentric', 1, 0, 100),
+    (0x0A, 'eccentric', 1, 0, 100),
+    (0x10, 'threshold_high', 2, 1, 4095),
+    (0x11, 'threshold_low', 2, 1, 4095),
+    (0x12, 'min_rep_ms', 2, 0, 5000),
+    (0x13, 'set_timeout', 1, 1, 255),
+    (0x14, 'sample_period', 1, 10, 100),
+    (0x15, 'adc_average', 1, 1, 16),
+    (0x16, 'gain_0', 1, 0, 255),
+    (0x17, 'gain_1', 1, 0, 255),
+]
+BY_KEY = dict((k[0], k) for k in KEYS)
+BY_NAME = dict((k[1], k) for k in KEYS)
+
+
+def encode_tlvs(values):
+    """TLVs of the named values, in table order."""
+    out = bytearray()
+    for key, name, size, lo, hi in KEYS:
+        if name in values:
+            v = values[name]
+            if not lo <= v <= hi:
+                raise ValueError('%s=%u outside %u-%u' % (name, v, lo, hi))
+            out += bytes([key, size]) + v.to_bytes(size, 'little')
+    return bytes(out)
+
+
+def encode(cmd, values):
+    """A v2 write."""
+    return bytes([MAGIC, cmd]) + encode_tlvs(values)
+
+
+def parse(data, start):
+    """(result, error offset, command, values) of a v2 write, values starting from
+    start. On error the values are start, as the firmware leaves them."""
+    if len(data) < 2:
+        return ERR_TRUNCATED, 0, CMD_NONE, start
+    if data[1] not in (CMD_START, CMD_STOP, CMD_UPDATE):
+        return ERR_COMMAND, 1, CMD_NONE, start
+    if data[1] == CMD_STOP:
+        return OK, 0, CMD_STOP, start
+    values = dict(start)
+    pos = 2
+    while pos < len(data):
+        if pos + 2 > len(data) or pos + 2 + data[pos + 1] > len(data):
+            return ERR_TRUNCATED, pos, CMD_NONE, start
+        vlen = data[pos + 1]
+        k = BY_KEY.get(data[pos])
+        if k:
+            if vlen != k[2]:
+                return ERR_LENGTH, pos, CMD_NONE, start
+            v = int.from_bytes(data[pos + 2:pos + 2 + vlen], 'little')
+            if not k[3] <= v <= k[4]:
+                return ERR_RANGE, pos, CMD_NONE, start
+            values[k[1]] = v
+        pos += 2 + vlen
+    # Without a start only the keys of the write are known
+    if values.get('threshold_low', 0) >= values.get('threshold_high', 0xFFFF):
+        return ERR_CONFLICT, 0, CMD_NONE, start
+    return OK, 0, data[1], values
+
+
+def parse_readback(data):
+    """(result, error offset, waiting, values) of the Active Config value;
+    ValueError if it is damaged."""
+    if len(data) < READ_HEADER_LEN or data[0] != MAGIC:
+        raise ValueError('no read-back header')
+    values = {}
+    pos = READ_HEADER_LEN
+    while pos < len(data):
+        k = BY_KEY.get(data[pos])
+        if k is None or pos + 2 + k[2] > len(data) or data[pos + 1] != k[2]:
+            raise ValueError('bad TLV at offset %u' % pos)
+        values[k[1]] = int.from_bytes(data[pos + 2:pos + 2 + k[2]], 'little')
+        pos += 2 + k[2]
+    missing = set(BY_NAME) - set(values)
+    if missing:
+        raise ValueError('keys missing: %s' % ', '.join(sorted(missing)))
+    return data[1], data[2], data[3], values
+
+
+def format_values(values):
+    return ' '.join('%s=%u' % (k[1], values[k[1]]) for k in KEYS if k[1] in values)
+
+
+def check(path):
+    """Compares with the firmware's vectors; returns the number of failures."""
+    failures = writes = readbacks = 0
+    last = None
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            if not line.strip():
+                continue
+            v = json.loads(line)
+            if 'write' in v:
+                writes += 1
+                got = parse(bytes.fromhex(v['write']), v['start'])
+                want = (v['result'], v['err_pos'], v['cmd'], v['config'])
+                if got != want:
+                    print('line %u: %s -> result %u at %u cmd %u, firmware %u at %u cmd %u' % (
+                        n, v['write'], got[0], got[1], got[2], want[0], want[1], want[2]))
+                    failures += 1
+                last = v
+                continue
+            readbacks += 1
+            data = bytes.fromhex(v['readback'])
+            try:
+                result, err_pos, waiting, values = parse_readback(data)
+            except ValueError as e:
+                print('line %u: %s' % (n, e))
+                failures += 1
+                continue
+            if last is None or (result, err_pos) != (last['result'], last['err_pos']) or \
+                    values != last['config'] or data[READ_HEADER_LEN:] != encode_tlvs(values):
+                print('line %u: read-back %s does not follow the write' % (n, format_values(values)))
+                failures += 1
+    print('%u writes, %u read-backs' % (writes, readbacks))
+    if not writes or not readbacks:
+        failures += 1
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('what', nargs='?', choices=('encode', 'decode', 'readback'))
+    parser.add_argument('args', nargs='*', help='command and name=value, or hex bytes')
+    parser.add_argument('--check', metavar='VECTORS', help='JSON lines of host/workout_config_fuzz')
+    args = parser.parse_args()
+
+    if args.check:
+        failures = check(args.check)
+        print('%u failures' % failures)
+        sys.exit(1 if failures else 0)
+    if not args.what or not args.args:
+        parser.error('nothing to do')
+
+    if args.what == 'encode':
+        if args.args[0] not in CMDS:
+            parser.error('command is one of %s' % ', '.join(CMDS))
+        values = {}
+        for a in args.args[1:]:
+            name, _, v = a.partition('=')
+            if name not in BY_NAME or not v:
+                parser.error('unknown key %s' % name)
+            values[name] = int(v, 0)
+        try:
+            print(encode(CMDS[args.args[0]], values).hex())
+        except ValueError as e:
+            sys.exit(str(e))
+        return
+
+    data = bytes.fromhex(''.join(args.args))
+    if args.what == 'readback':
+        try:
+            result, err_pos, waiting, values = parse_readback(data)
+        except ValueError as e:
+            sys.exit(str(e))
+        print('last write: %s%s%s' % (ERRORS[result] if result < len(ERRORS) else result,
+                                       ' at offset %u' % err_pos if err_pos else '',
+                                       ', waiting for the EMG task' if waiting else ''))
+        print(format_values(values))
+        return
+
+    if not data or data[0] != MAGIC:
+        sys.exit('old layout write, not v2')
+    result, err_pos, cmd, values = parse(data, {})
+    if result != OK:
+        sys.exit('rejected: %s at offset %u' % (ERRORS[result], err_pos))
+    names = dict((v, k) for k, v in CMDS.items())
+    print('%s %s' % (names[cmd], format_values(values)))
+
+
+if __name__ == '__main__':
+    main()